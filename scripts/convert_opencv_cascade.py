@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+"""Convert an OpenCV Haar cascade XML (new format) into models/face_cascade.txt.
+
+Usage: ./scripts/convert_opencv_cascade.py haarcascade_frontalface_default.xml models/face_cascade.txt
+"""
+
+import sys
+import xml.etree.ElementTree as ET
+
+
+def main(argv):
+    if len(argv) != 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    root = ET.parse(argv[1]).getroot()
+    cascade = root.find("cascade")
+    if cascade is None or cascade.findtext("featureType", "").strip() != "HAAR":
+        sys.stderr.write("Expected an OpenCV HAAR cascade in the new XML format\n")
+        return 1
+
+    width = int(cascade.findtext("width"))
+    height = int(cascade.findtext("height"))
+    features = []
+    for feature in cascade.find("features"):
+        if feature.findtext("tilted", "0").strip() not in ("0", ""):
+            sys.stderr.write("Tilted features are not supported\n")
+            return 1
+        rects = [r.text.split() for r in feature.find("rects")]
+        features.append(rects)
+
+    lines = ["haar_cascade 1", f"window {width} {height}"]
+    stages = list(cascade.find("stages"))
+    lines.append(f"stages {len(stages)}")
+    for stage in stages:
+        weaks = list(stage.find("weakClassifiers"))
+        threshold = float(stage.findtext("stageThreshold"))
+        lines.append(f"stage {len(weaks)} {threshold!r}")
+        for weak in weaks:
+            nodes = weak.findtext("internalNodes").split()
+            leaves = weak.findtext("leafValues").split()
+            if len(nodes) != 4 or len(leaves) != 2:
+                sys.stderr.write("Only stump (depth-1) weak classifiers are supported\n")
+                return 1
+            rects = features[int(nodes[2])]
+            lines.append(f"weak {float(nodes[3])!r} {float(leaves[0])!r} {float(leaves[1])!r} {len(rects)}")
+            for x, y, w, h, weight in rects:
+                lines.append(f"rect {x} {y} {w} {h} {float(weight)!r}")
+
+    with open(argv[2], "w", encoding="ascii") as out:
+        out.write("\n".join(lines) + "\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,452 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "access_log.h"
+
+#include "http.h"
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACCESS_LOG_PATH_MAX 1024
+#define ACCESS_LOG_RECORD_MAX 1024
+#define ACCESS_LOG_IOV_BATCH 64
+
+/*
+ * Each thread appends records to its own block and publishes them by bumping
+ * `committed`; only the writer reads a block, and only up to `committed`. A
+ * full block is pushed onto the lock-free `retired` stack before the thread
+ * switches to a fresh one, so the writer drains retired blocks first and then
+ * whatever each thread's current block holds, and per-thread order survives.
+ * Only the writer frees blocks, and only ones it has taken off the stack.
+ */
+typedef struct LogBlock {
+    struct LogBlock *next;
+    _Atomic size_t committed;
+    size_t flushed;
+    char data[];
+} LogBlock;
+
+typedef struct {
+    _Atomic(LogBlock *) current;
+    _Atomic uint64_t records;
+    _Atomic uint64_t dropped;
+    bool in_use;
+} LogProducer;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_wake = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static pthread_key_t producer_key;
+static LogProducer producers[ACCESS_LOG_MAX_THREADS];
+static _Atomic size_t producer_count = 0;
+
+static _Atomic bool log_open = false;
+static _Atomic(LogBlock *) retired = NULL;
+static _Atomic size_t pending_blocks = 0;
+static _Atomic uint64_t unregistered_dropped = 0;
+static AccessLogParams params;
+static char log_path[ACCESS_LOG_PATH_MAX];
+static pthread_t writer_thread;
+static bool writer_running = false;
+static int log_fd = -1;
+static size_t file_bytes = 0;
+static AccessLogStats writer_stats;
+
+static _Thread_local LogProducer *local_producer = NULL;
+static _Thread_local bool local_unavailable = false;
+static _Thread_local time_t local_second = (time_t)-1;
+static _Thread_local char local_stamp[32];
+
+static void retire_block(LogBlock *block) {
+    LogBlock *head = atomic_load_explicit(&retired, memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&retired, &head, block, memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/* An exiting thread hands its partly filled block to the writer and frees its slot. */
+static void release_producer(void *arg) {
+    LogProducer *producer = (LogProducer *)arg;
+    LogBlock *block = atomic_exchange_explicit(&producer->current, NULL, memory_order_acq_rel);
+    if (block != NULL) {
+        retire_block(block);
+    }
+    pthread_mutex_lock(&registry_mutex);
+    producer->in_use = false;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void init_registry(void) {
+    pthread_key_create(&producer_key, release_producer);
+}
+
+static LogProducer *acquire_producer(void) {
+    pthread_once(&registry_once, init_registry);
+    pthread_mutex_lock(&registry_mutex);
+    LogProducer *producer = NULL;
+    size_t count = atomic_load_explicit(&producer_count, memory_order_relaxed);
+    for (size_t i = 0; i < count && producer == NULL; i++) {
+        if (!producers[i].in_use) {
+            producer = &producers[i];
+        }
+    }
+    if (producer == NULL && count < ACCESS_LOG_MAX_THREADS) {
+        producer = &producers[count];
+        atomic_store_explicit(&producer_count, count + 1, memory_order_release);
+    }
+    if (producer != NULL) {
+        producer->in_use = true;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (producer != NULL) {
+        pthread_setspecific(producer_key, producer);
+    }
+    return producer;
+}
+
+static LogProducer *thread_producer(void) {
+    if (local_producer == NULL && !local_unavailable) {
+        local_producer = acquire_producer();
+        local_unavailable = local_producer == NULL;
+    }
+    return local_producer;
+}
+
+static LogBlock *new_block(void) {
+    size_t pending = atomic_fetch_add_explicit(&pending_blocks, 1, memory_order_relaxed);
+    LogBlock *block = NULL;
+    if (pending < params.max_pending_blocks) {
+        block = (LogBlock *)malloc(sizeof(LogBlock) + params.block_bytes);
+    }
+    if (block == NULL) {
+        atomic_fetch_sub_explicit(&pending_blocks, 1, memory_order_relaxed);
+        return NULL;
+    }
+    block->next = NULL;
+    atomic_init(&block->committed, 0);
+    block->flushed = 0;
+    return block;
+}
+
+/* gmtime_r() and strftime() run once per second per thread, not per record. */
+static const char *timestamp(long *millis) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (now.tv_sec != local_second) {
+        struct tm tm;
+        gmtime_r(&now.tv_sec, &tm);
+        strftime(local_stamp, sizeof(local_stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+        local_second = now.tv_sec;
+    }
+    *millis = now.tv_nsec / 1000000L;
+    return local_stamp;
+}
+
+static size_t format_record(char *line,
+                            size_t capacity,
+                            const char *method,
+                            const char *path,
+                            const char *stream,
+                            int status,
+                            size_t bytes,
+                            uint64_t latency_us) {
+    char escaped_method[32];
+    char escaped_path[512];
+    char escaped_stream[160];
+    http_json_escape(escaped_method, sizeof(escaped_method), method);
+    http_json_escape(escaped_path, sizeof(escaped_path), path);
+    bool has_stream = stream != NULL && stream[0] != '\0';
+    if (has_stream) {
+        http_json_escape(escaped_stream, sizeof(escaped_stream), stream);
+    }
+    long millis = 0;
+    const char *stamp = timestamp(&millis);
+    int n = snprintf(line, capacity,
+                     "{\"time\":\"%s.%03ldZ\",\"method\":\"%s\",\"path\":\"%s\",\"status\":%d,"
+                     "\"bytes\":%zu,\"latency_us\":%llu,\"stream\":%s%s%s}\n",
+                     stamp, millis, escaped_method, escaped_path, status, bytes,
+                     (unsigned long long)latency_us, has_stream ? "\"" : "",
+                     has_stream ? escaped_stream : "null", has_stream ? "\"" : "");
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
+
+/*
+ * Formats one line into the calling thread's block. Never blocks: if the
+ * writer is so far behind that max_pending_blocks are waiting, the record is
+ * dropped. Callers must be stopped before access_log_close().
+ */
+void access_log_record(const char *method,
+                       const char *path,
+                       const char *stream,
+                       int status,
+                       size_t bytes,
+                       uint64_t latency_us) {
+    if (!atomic_load_explicit(&log_open, memory_order_acquire)) {
+        return;
+    }
+    LogProducer *producer = thread_producer();
+    if (producer == NULL) {
+        atomic_fetch_add_explicit(&unregistered_dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    char line[ACCESS_LOG_RECORD_MAX];
+    size_t length = format_record(line, sizeof(line), method, path, stream, status, bytes,
+                                  latency_us);
+    if (length == 0) {
+        atomic_fetch_add_explicit(&producer->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    LogBlock *block = atomic_load_explicit(&producer->current, memory_order_relaxed);
+    size_t used = block != NULL ? atomic_load_explicit(&block->committed, memory_order_relaxed)
+                                : 0;
+    if (block == NULL || used + length > params.block_bytes) {
+        LogBlock *fresh = new_block();
+        if (fresh == NULL) {
+            atomic_fetch_add_explicit(&producer->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        if (block != NULL) {
+            retire_block(block);
+        }
+        atomic_store_explicit(&producer->current, fresh, memory_order_release);
+        block = fresh;
+        used = 0;
+    }
+    memcpy(block->data + used, line, length);
+    atomic_store_explicit(&block->committed, used + length, memory_order_release);
+    atomic_fetch_add_explicit(&producer->records, 1, memory_order_relaxed);
+}
+
+static int open_log_file(void) {
+    int fd = open(log_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    file_bytes = fd >= 0 && fstat(fd, &st) == 0 ? (size_t)st.st_size : 0;
+    return fd;
+}
+
+/* access.log becomes access.log.1, .1 becomes .2, and so on up to max_files. */
+static void rotate_log_file(void) {
+    close(log_fd);
+    char from[ACCESS_LOG_PATH_MAX + 32];
+    char to[ACCESS_LOG_PATH_MAX + 32];
+    for (size_t i = params.max_files; i > 1; i--) {
+        snprintf(from, sizeof(from), "%s.%zu", log_path, i - 1);
+        snprintf(to, sizeof(to), "%s.%zu", log_path, i);
+        rename(from, to);
+    }
+    if (params.max_files > 0) {
+        snprintf(to, sizeof(to), "%s.1", log_path);
+        rename(log_path, to);
+    } else {
+        unlink(log_path);
+    }
+    log_fd = open_log_file();
+    pthread_mutex_lock(&log_mutex);
+    writer_stats.rotations++;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+static void write_batch(struct iovec *iov, int count) {
+    size_t written = 0;
+    bool failed = log_fd < 0;
+    int first = 0;
+    while (!failed && first < count) {
+        ssize_t n = writev(log_fd, iov + first, count - first);
+        if (n < 0) {
+            failed = errno != EINTR;
+            continue;
+        }
+        written += (size_t)n;
+        /* Skip what a short write took, then resume mid-buffer. */
+        size_t left = (size_t)n;
+        while (first < count && left >= iov[first].iov_len) {
+            left -= iov[first].iov_len;
+            first++;
+        }
+        if (first < count) {
+            iov[first].iov_base = (char *)iov[first].iov_base + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    file_bytes += written;
+    pthread_mutex_lock(&log_mutex);
+    writer_stats.bytes_written += written;
+    writer_stats.writes++;
+    if (failed) {
+        writer_stats.write_errors++;
+    }
+    pthread_mutex_unlock(&log_mutex);
+    if (params.rotate_bytes > 0 && file_bytes >= params.rotate_bytes) {
+        rotate_log_file();
+    }
+}
+
+static void queue_block(LogBlock *block, struct iovec *iov, int *count) {
+    size_t committed = atomic_load_explicit(&block->committed, memory_order_acquire);
+    if (committed <= block->flushed) {
+        return;
+    }
+    iov[*count].iov_base = block->data + block->flushed;
+    iov[*count].iov_len = committed - block->flushed;
+    block->flushed = committed;
+    if (++*count == ACCESS_LOG_IOV_BATCH) {
+        write_batch(iov, *count);
+        *count = 0;
+    }
+}
+
+/*
+ * Current blocks are sampled before the retired stack is taken: a block
+ * retired before its successor was sampled is then sure to be in the stack,
+ * so it is written first.
+ */
+static void flush_pending(void) {
+    LogBlock *current[ACCESS_LOG_MAX_THREADS];
+    size_t count = atomic_load_explicit(&producer_count, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        current[i] = atomic_load_explicit(&producers[i].current, memory_order_acquire);
+    }
+    LogBlock *stack = atomic_exchange_explicit(&retired, NULL, memory_order_acquire);
+    LogBlock *oldest = NULL;
+    while (stack != NULL) {
+        LogBlock *next = stack->next;
+        stack->next = oldest;
+        oldest = stack;
+        stack = next;
+    }
+
+    struct iovec iov[ACCESS_LOG_IOV_BATCH];
+    int iov_count = 0;
+    for (LogBlock *block = oldest; block != NULL; block = block->next) {
+        queue_block(block, iov, &iov_count);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (current[i] != NULL) {
+            queue_block(current[i], iov, &iov_count);
+        }
+    }
+    if (iov_count > 0) {
+        write_batch(iov, iov_count);
+    }
+
+    size_t freed = 0;
+    while (oldest != NULL) {
+        LogBlock *next = oldest->next;
+        free(oldest);
+        oldest = next;
+        freed++;
+    }
+    atomic_fetch_sub_explicit(&pending_blocks, freed, memory_order_relaxed);
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&log_mutex);
+    while (writer_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)(params.flush_ms % 1000u) * 1000000L;
+        deadline.tv_sec += (time_t)(params.flush_ms / 1000u) + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&log_wake, &log_mutex, &deadline);
+        pthread_mutex_unlock(&log_mutex);
+        flush_pending();
+        pthread_mutex_lock(&log_mutex);
+    }
+    pthread_mutex_unlock(&log_mutex);
+    return NULL;
+}
+
+bool access_log_open(const AccessLogParams *in) {
+    if (in->path == NULL || in->path[0] == '\0' ||
+        strlen(in->path) >= sizeof(log_path) || in->block_bytes < ACCESS_LOG_RECORD_MAX ||
+        in->max_pending_blocks == 0 || atomic_load(&log_open)) {
+        return false;
+    }
+    params = *in;
+    snprintf(log_path, sizeof(log_path), "%s", in->path);
+    params.path = log_path;
+    if (params.flush_ms == 0) {
+        params.flush_ms = 1;
+    }
+    log_fd = open_log_file();
+    if (log_fd < 0) {
+        return false;
+    }
+
+    size_t count = atomic_load_explicit(&producer_count, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        atomic_store_explicit(&producers[i].records, 0, memory_order_relaxed);
+        atomic_store_explicit(&producers[i].dropped, 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&unregistered_dropped, 0, memory_order_relaxed);
+    pthread_mutex_lock(&log_mutex);
+    memset(&writer_stats, 0, sizeof(writer_stats));
+    writer_running = true;
+    pthread_mutex_unlock(&log_mutex);
+    if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0) {
+        writer_running = false;
+        close(log_fd);
+        log_fd = -1;
+        return false;
+    }
+    atomic_store_explicit(&log_open, true, memory_order_release);
+    return true;
+}
+
+/* Writes out every record still buffered, then frees the buffers. */
+void access_log_close(void) {
+    if (!atomic_exchange(&log_open, false)) {
+        return;
+    }
+    pthread_mutex_lock(&log_mutex);
+    writer_running = false;
+    pthread_cond_signal(&log_wake);
+    pthread_mutex_unlock(&log_mutex);
+    pthread_join(writer_thread, NULL);
+
+    flush_pending();
+    size_t count = atomic_load_explicit(&producer_count, memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        LogBlock *block = atomic_exchange_explicit(&producers[i].current, NULL,
+                                                   memory_order_acq_rel);
+        if (block != NULL) {
+            free(block);
+            atomic_fetch_sub_explicit(&pending_blocks, 1, memory_order_relaxed);
+        }
+    }
+    close(log_fd);
+    log_fd = -1;
+}
+
+void access_log_stats(AccessLogStats *out) {
+    pthread_mutex_lock(&log_mutex);
+    *out = writer_stats;
+    pthread_mutex_unlock(&log_mutex);
+    out->records = 0;
+    out->dropped = atomic_load_explicit(&unregistered_dropped, memory_order_relaxed);
+    out->threads = atomic_load_explicit(&producer_count, memory_order_acquire);
+    for (size_t i = 0; i < out->threads; i++) {
+        out->records += atomic_load_explicit(&producers[i].records, memory_order_relaxed);
+        out->dropped += atomic_load_explicit(&producers[i].dropped, memory_order_relaxed);
+    }
+    out->pending_blocks = atomic_load_explicit(&pending_blocks, memory_order_relaxed);
+}
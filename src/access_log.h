@@ -0,0 +1,46 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One JSON line per request, appended to `path` by a background writer.
+ * Request threads only format into their own buffer; they never take a lock
+ * or touch the file, and when the writer falls too far behind records are
+ * dropped and counted rather than waited for.
+ */
+typedef struct {
+    const char *path;
+    size_t rotate_bytes;
+    size_t max_files;
+    size_t block_bytes;
+    size_t max_pending_blocks;
+    unsigned flush_ms;
+} AccessLogParams;
+
+typedef struct {
+    uint64_t records;
+    uint64_t dropped;
+    uint64_t bytes_written;
+    uint64_t writes;
+    uint64_t rotations;
+    uint64_t write_errors;
+    size_t pending_blocks;
+    size_t threads;
+} AccessLogStats;
+
+bool access_log_open(const AccessLogParams *params);
+void access_log_close(void);
+
+void access_log_record(const char *method,
+                       const char *path,
+                       const char *stream,
+                       int status,
+                       size_t bytes,
+                       uint64_t latency_us);
+
+void access_log_stats(AccessLogStats *out);
+
+#endif
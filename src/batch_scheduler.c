@@ -0,0 +1,249 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "batch_scheduler.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Weight of the newest batch in the per-item cost average, as 1/N. */
+#define COST_EWMA_SHIFT 3
+
+struct BatchScheduler {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    BatchItem *items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool shutting_down;
+    BatchSchedulerParams params;
+    uint64_t item_cost_us;
+    BatchSchedulerStats stats;
+};
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+BatchScheduler *batch_scheduler_create(const BatchSchedulerParams *params) {
+    if (params == NULL || params->capacity == 0 || params->max_batch == 0 ||
+        params->max_batch > BATCH_SCHEDULER_MAX_BATCH) {
+        return NULL;
+    }
+
+    BatchScheduler *scheduler = (BatchScheduler *)calloc(1, sizeof(*scheduler));
+    if (scheduler == NULL) {
+        return NULL;
+    }
+    scheduler->items = (BatchItem *)calloc(params->capacity, sizeof(*scheduler->items));
+    if (scheduler->items == NULL) {
+        free(scheduler);
+        return NULL;
+    }
+    scheduler->capacity = params->capacity;
+    scheduler->params = *params;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&scheduler->cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&scheduler->mutex, NULL);
+    return scheduler;
+}
+
+void batch_scheduler_free(BatchScheduler *scheduler) {
+    if (scheduler == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&scheduler->mutex);
+    pthread_cond_destroy(&scheduler->cond);
+    free(scheduler->items);
+    free(scheduler);
+}
+
+static BatchItem *slot(BatchScheduler *scheduler, size_t index) {
+    return &scheduler->items[(scheduler->head + index) % scheduler->capacity];
+}
+
+/*
+ * A frame only matters until the same camera sends a newer one, so a queued
+ * frame from the same stream is replaced in place: the stream keeps its turn
+ * and its wait so far, but only its freshest frame is analysed.
+ */
+bool batch_scheduler_submit(BatchScheduler *scheduler,
+                            uint64_t stream,
+                            uint64_t seq,
+                            void *payload,
+                            BatchItem *displaced,
+                            bool *has_displaced) {
+    BatchItem item = {stream, seq, monotonic_us(), payload};
+    *has_displaced = false;
+
+    pthread_mutex_lock(&scheduler->mutex);
+    if (scheduler->shutting_down) {
+        pthread_mutex_unlock(&scheduler->mutex);
+        return false;
+    }
+    scheduler->stats.submitted++;
+
+    for (size_t i = 0; i < scheduler->count; i++) {
+        BatchItem *queued = slot(scheduler, i);
+        if (queued->stream == stream) {
+            *displaced = *queued;
+            *has_displaced = true;
+            item.enqueue_us = queued->enqueue_us;
+            *queued = item;
+            scheduler->stats.replaced++;
+            pthread_mutex_unlock(&scheduler->mutex);
+            return true;
+        }
+    }
+
+    if (scheduler->count == scheduler->capacity) {
+        *displaced = *slot(scheduler, 0);
+        *has_displaced = true;
+        scheduler->head = (scheduler->head + 1) % scheduler->capacity;
+        scheduler->count--;
+        scheduler->stats.evicted++;
+    }
+    *slot(scheduler, scheduler->count) = item;
+    scheduler->count++;
+    pthread_cond_signal(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+    return true;
+}
+
+/*
+ * Largest batch that still lets the oldest queued item finish inside the
+ * latency SLO, given the measured per-item compute cost.
+ */
+static size_t target_batch(const BatchScheduler *scheduler, uint64_t oldest_age_us) {
+    size_t target = scheduler->params.max_batch;
+    if (scheduler->item_cost_us > 0) {
+        uint64_t slo = scheduler->params.latency_slo_us;
+        uint64_t remaining = slo > oldest_age_us ? slo - oldest_age_us : 0;
+        uint64_t fits = remaining / scheduler->item_cost_us;
+        if (fits < target) {
+            target = fits > 0 ? (size_t)fits : 1;
+        }
+    }
+    return target;
+}
+
+/* How long a partial batch may wait for company before it is dispatched anyway. */
+static uint64_t wait_budget(const BatchScheduler *scheduler, size_t target) {
+    uint64_t budget = scheduler->params.max_wait_us;
+    uint64_t compute = scheduler->item_cost_us * target;
+    uint64_t slo = scheduler->params.latency_slo_us;
+    uint64_t slack = slo > compute ? slo - compute : 0;
+    return slack < budget ? slack : budget;
+}
+
+/*
+ * Blocks until a batch is ready: either enough items are queued to fill the
+ * adaptive target, or the oldest item has waited out its budget. Deep queues
+ * therefore dispatch full batches immediately while a lone frame pays at most
+ * max_wait_us. Returns 0 once the scheduler is shut down and drained.
+ */
+size_t batch_scheduler_next(BatchScheduler *scheduler, BatchItem *out, size_t capacity) {
+    if (capacity == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    size_t target = 1;
+    for (;;) {
+        if (scheduler->count == 0) {
+            if (scheduler->shutting_down) {
+                pthread_mutex_unlock(&scheduler->mutex);
+                return 0;
+            }
+            pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+            continue;
+        }
+
+        uint64_t now = monotonic_us();
+        uint64_t oldest = slot(scheduler, 0)->enqueue_us;
+        uint64_t age = now > oldest ? now - oldest : 0;
+        target = target_batch(scheduler, age);
+        if (target > capacity) {
+            target = capacity;
+        }
+        uint64_t budget = wait_budget(scheduler, target);
+        if (scheduler->count >= target || scheduler->shutting_down || age >= budget) {
+            break;
+        }
+
+        uint64_t deadline_us = oldest + budget;
+        struct timespec deadline;
+        deadline.tv_sec = (time_t)(deadline_us / 1000000u);
+        deadline.tv_nsec = (long)(deadline_us % 1000000u) * 1000L;
+        pthread_cond_timedwait(&scheduler->cond, &scheduler->mutex, &deadline);
+    }
+
+    size_t taken = scheduler->count < target ? scheduler->count : target;
+    uint64_t now = monotonic_us();
+    for (size_t i = 0; i < taken; i++) {
+        out[i] = *slot(scheduler, i);
+        uint64_t waited = now > out[i].enqueue_us ? now - out[i].enqueue_us : 0;
+        scheduler->stats.queue_wait_us += waited;
+        if (waited > scheduler->stats.max_queue_wait_us) {
+            scheduler->stats.max_queue_wait_us = waited;
+        }
+    }
+    scheduler->head = (scheduler->head + taken) % scheduler->capacity;
+    scheduler->count -= taken;
+    scheduler->stats.batches++;
+    scheduler->stats.items += taken;
+    scheduler->stats.target_batch = target;
+    if (scheduler->count > 0) {
+        pthread_cond_signal(&scheduler->cond);
+    }
+    pthread_mutex_unlock(&scheduler->mutex);
+    return taken;
+}
+
+void batch_scheduler_complete(BatchScheduler *scheduler, size_t items, uint64_t compute_us) {
+    if (items == 0) {
+        return;
+    }
+    uint64_t cost = compute_us / items;
+    if (cost == 0) {
+        cost = 1;
+    }
+
+    pthread_mutex_lock(&scheduler->mutex);
+    if (scheduler->item_cost_us == 0) {
+        scheduler->item_cost_us = cost;
+    } else {
+        scheduler->item_cost_us += (cost >> COST_EWMA_SHIFT);
+        scheduler->item_cost_us -= (scheduler->item_cost_us >> COST_EWMA_SHIFT);
+        if (scheduler->item_cost_us == 0) {
+            scheduler->item_cost_us = 1;
+        }
+    }
+    scheduler->stats.compute_us += compute_us;
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void batch_scheduler_shutdown(BatchScheduler *scheduler) {
+    pthread_mutex_lock(&scheduler->mutex);
+    scheduler->shutting_down = true;
+    pthread_cond_broadcast(&scheduler->cond);
+    pthread_mutex_unlock(&scheduler->mutex);
+}
+
+void batch_scheduler_stats(BatchScheduler *scheduler, BatchSchedulerStats *out) {
+    pthread_mutex_lock(&scheduler->mutex);
+    *out = scheduler->stats;
+    out->item_cost_us = scheduler->item_cost_us;
+    out->queue_depth = scheduler->count;
+    pthread_mutex_unlock(&scheduler->mutex);
+}
@@ -0,0 +1,55 @@
+#ifndef BATCH_SCHEDULER_H
+#define BATCH_SCHEDULER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BATCH_SCHEDULER_MAX_BATCH 64
+
+typedef struct {
+    size_t capacity;
+    size_t max_batch;
+    uint64_t max_wait_us;
+    uint64_t latency_slo_us;
+} BatchSchedulerParams;
+
+typedef struct {
+    uint64_t stream;
+    uint64_t seq;
+    uint64_t enqueue_us;
+    void *payload;
+} BatchItem;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t replaced;
+    uint64_t evicted;
+    uint64_t batches;
+    uint64_t items;
+    uint64_t queue_wait_us;
+    uint64_t max_queue_wait_us;
+    uint64_t compute_us;
+    uint64_t item_cost_us;
+    size_t target_batch;
+    size_t queue_depth;
+} BatchSchedulerStats;
+
+typedef struct BatchScheduler BatchScheduler;
+
+BatchScheduler *batch_scheduler_create(const BatchSchedulerParams *params);
+void batch_scheduler_free(BatchScheduler *scheduler);
+
+bool batch_scheduler_submit(BatchScheduler *scheduler,
+                            uint64_t stream,
+                            uint64_t seq,
+                            void *payload,
+                            BatchItem *displaced,
+                            bool *has_displaced);
+size_t batch_scheduler_next(BatchScheduler *scheduler, BatchItem *out, size_t capacity);
+void batch_scheduler_complete(BatchScheduler *scheduler, size_t items, uint64_t compute_us);
+void batch_scheduler_shutdown(BatchScheduler *scheduler);
+
+void batch_scheduler_stats(BatchScheduler *scheduler, BatchSchedulerStats *out);
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "embedding.h"
+#include "nn_kernels.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_FACES 2000L
+#define DEFAULT_THREADS 1L
+#define DEFAULT_BATCH 1L
+#define MAX_THREADS 256L
+#define RANDOM_MODEL_SEED 1234u
+
+typedef struct {
+    long faces;
+    long threads;
+    const char *model_path;
+    long batch;
+    const char *save_path;
+} BenchConfig;
+
+typedef struct {
+    const EmbeddingModel *model;
+    EmbeddingPrecision precision;
+    const float *input;
+    long batch;
+    atomic_long *next_face;
+    long total_faces;
+    atomic_long *failures;
+} BenchWorker;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [faces] [threads] [model_path] [batch] [save_path]\n", prog);
+    fprintf(stderr, "Defaults: faces=%ld threads=%ld model=<random default network> batch=%ld\n",
+            DEFAULT_FACES, DEFAULT_THREADS, DEFAULT_BATCH);
+    fprintf(stderr, "save_path writes the model in the packed, mappable format first\n");
+}
+
+static long parse_long(const char *arg, const char *name) {
+    char *end = NULL;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || value <= 0) {
+        fprintf(stderr, "Invalid %s: %s\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static BenchConfig parse_args(int argc, char **argv) {
+    BenchConfig cfg;
+    cfg.faces = (argc > 1) ? parse_long(argv[1], "faces") : DEFAULT_FACES;
+    cfg.threads = (argc > 2) ? parse_long(argv[2], "threads") : DEFAULT_THREADS;
+    cfg.model_path = (argc > 3 && strcmp(argv[3], "-") != 0) ? argv[3] : NULL;
+    cfg.batch = (argc > 4) ? parse_long(argv[4], "batch") : DEFAULT_BATCH;
+    cfg.save_path = (argc > 5) ? argv[5] : NULL;
+    if (argc > 6 || cfg.threads > MAX_THREADS || cfg.batch > EMBEDDING_MAX_BATCH) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return cfg;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static EmbeddingWorkspace *batch_workspace(const EmbeddingModel *model,
+                                           const float *input,
+                                           long batch) {
+    EmbeddingWorkspace *workspace = embedding_workspace_create_batch(model, (size_t)batch);
+    if (workspace == NULL) {
+        return NULL;
+    }
+    int size = embedding_model_input_size(model);
+    size_t input_count =
+        (size_t)size * (size_t)size * (size_t)embedding_model_input_channels(model);
+    for (long b = 0; b < batch; b++) {
+        memcpy(embedding_workspace_input(workspace, (size_t)b), input,
+               input_count * sizeof(float));
+    }
+    return workspace;
+}
+
+static void *worker_main(void *arg) {
+    BenchWorker *ctx = (BenchWorker *)arg;
+    EmbeddingWorkspace *workspace = batch_workspace(ctx->model, ctx->input, ctx->batch);
+    float *embeddings = (float *)malloc((size_t)ctx->batch * EMBEDDING_MAX_DIM * sizeof(float));
+    if (workspace == NULL || embeddings == NULL) {
+        embedding_workspace_free(workspace);
+        free(embeddings);
+        atomic_fetch_add(ctx->failures, 1);
+        return NULL;
+    }
+
+    for (;;) {
+        long first = atomic_fetch_add(ctx->next_face, ctx->batch);
+        if (first >= ctx->total_faces) {
+            break;
+        }
+        long count = ctx->total_faces - first < ctx->batch ? ctx->total_faces - first : ctx->batch;
+        if (!embedding_forward_batch(ctx->model, ctx->precision,
+                                     embedding_workspace_input(workspace, 0), (size_t)count,
+                                     workspace, NULL, embeddings, NULL)) {
+            atomic_fetch_add(ctx->failures, 1);
+        }
+    }
+
+    free(embeddings);
+    embedding_workspace_free(workspace);
+    return NULL;
+}
+
+static double measure_latency_ms(const EmbeddingModel *model,
+                                 EmbeddingPrecision precision,
+                                 const float *input,
+                                 long faces) {
+    EmbeddingWorkspace *workspace = embedding_workspace_create(model);
+    float embedding[EMBEDDING_MAX_DIM];
+    if (workspace == NULL) {
+        return -1.0;
+    }
+    long iterations = faces < 200 ? faces : 200;
+    embedding_forward(model, precision, input, workspace, NULL, embedding);
+
+    double start = monotonic_seconds();
+    for (long i = 0; i < iterations; i++) {
+        embedding_forward(model, precision, input, workspace, NULL, embedding);
+    }
+    double elapsed = monotonic_seconds() - start;
+    embedding_workspace_free(workspace);
+    return elapsed * 1000.0 / (double)iterations;
+}
+
+static bool run_throughput(const BenchConfig *cfg,
+                           const EmbeddingModel *model,
+                           EmbeddingPrecision precision,
+                           const float *input,
+                           double *elapsed_out) {
+    atomic_long next_face = 0;
+    atomic_long failures = 0;
+    BenchWorker ctx = {model, precision, input, cfg->batch, &next_face, cfg->faces, &failures};
+    pthread_t threads[MAX_THREADS];
+
+    double start = monotonic_seconds();
+    long started = 0;
+    for (; started < cfg->threads; started++) {
+        if (pthread_create(&threads[started], NULL, worker_main, &ctx) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    for (long i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    *elapsed_out = monotonic_seconds() - start;
+    return started == cfg->threads && atomic_load(&failures) == 0;
+}
+
+static void report(const BenchConfig *cfg,
+                   const EmbeddingModel *model,
+                   EmbeddingPrecision precision,
+                   const float *input) {
+    const char *name = precision == EMBEDDING_PRECISION_INT8 ? "int8" : "float";
+    double latency_ms = measure_latency_ms(model, precision, input, cfg->faces);
+    double elapsed = 0.0;
+    if (latency_ms < 0.0 || !run_throughput(cfg, model, precision, input, &elapsed)) {
+        fprintf(stderr, "%s benchmark failed\n", name);
+        exit(EXIT_FAILURE);
+    }
+    double faces_per_sec = (double)cfg->faces / elapsed;
+
+    printf("\n%s\n", name);
+    printf("Latency per face: %.3f ms\n", latency_ms);
+    printf("Elapsed time: %.3f sec\n", elapsed);
+    printf("Faces/sec: %.2f\n", faces_per_sec);
+    printf("Faces/sec/core: %.2f\n", faces_per_sec / (double)cfg->threads);
+}
+
+int main(int argc, char **argv) {
+    BenchConfig cfg = parse_args(argc, argv);
+
+    EmbeddingModel *model = NULL;
+    double load_start = monotonic_seconds();
+    if (cfg.model_path != NULL) {
+        model = embedding_model_load(cfg.model_path);
+    } else {
+        EmbeddingSpec spec = embedding_default_spec();
+        model = embedding_model_create_random(&spec, RANDOM_MODEL_SEED);
+    }
+    if (model == NULL) {
+        fprintf(stderr, "Failed to load embedding model\n");
+        return EXIT_FAILURE;
+    }
+    double load_ms = (monotonic_seconds() - load_start) * 1000.0;
+    if (cfg.save_path != NULL && !embedding_model_save(model, cfg.save_path)) {
+        fprintf(stderr, "Failed to save embedding model to %s\n", cfg.save_path);
+        embedding_model_free(model);
+        return EXIT_FAILURE;
+    }
+
+    int size = embedding_model_input_size(model);
+    int channels = embedding_model_input_channels(model);
+    size_t input_count = (size_t)size * (size_t)size * (size_t)channels;
+    float *input = (float *)malloc(input_count * sizeof(float));
+    if (input == NULL) {
+        embedding_model_free(model);
+        return EXIT_FAILURE;
+    }
+    unsigned int seed = 7u;
+    for (size_t i = 0; i < input_count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        input[i] = (float)((seed >> 16) & 0xff) / 128.0f - 1.0f;
+    }
+
+    printf("Embedding benchmark: %ldx%ldx%d input, %zu-dim output\n", (long)size, (long)size,
+           channels, embedding_model_dim(model));
+    printf("Faces: %ld, threads: %ld, batch: %ld, kernels: %s\n", cfg.faces, cfg.threads,
+           cfg.batch, nn_kernel_level_name(nn_kernel_level()));
+    printf("Model load: %.3f ms (%zu KiB mapped)\n", load_ms,
+           embedding_model_mapped_bytes(model) / 1024);
+
+    report(&cfg, model, EMBEDDING_PRECISION_FLOAT, input);
+    report(&cfg, model, EMBEDDING_PRECISION_INT8, input);
+
+    free(input);
+    embedding_model_free(model);
+    return EXIT_SUCCESS;
+}
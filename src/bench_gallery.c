@@ -0,0 +1,203 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gallery.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_GALLERY_SIZE 100000L
+#define DEFAULT_QUERIES 1000L
+#define DEFAULT_K 10L
+#define DEFAULT_DIM 128L
+#define SAMPLES_PER_IDENTITY 4
+#define IDENTITY_SPREAD 0.35f
+
+typedef struct {
+    long gallery_size;
+    long queries;
+    long k;
+    long dim;
+} BenchConfig;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [gallery_size] [queries] [k] [dim]\n", prog);
+    fprintf(stderr, "Defaults: gallery_size=%ld queries=%ld k=%ld dim=%ld\n",
+            DEFAULT_GALLERY_SIZE, DEFAULT_QUERIES, DEFAULT_K, DEFAULT_DIM);
+}
+
+static long parse_long(const char *arg, const char *name) {
+    char *end = NULL;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || value <= 0) {
+        fprintf(stderr, "Invalid %s: %s\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static BenchConfig parse_args(int argc, char **argv) {
+    BenchConfig cfg;
+    cfg.gallery_size = (argc > 1) ? parse_long(argv[1], "gallery_size") : DEFAULT_GALLERY_SIZE;
+    cfg.queries = (argc > 2) ? parse_long(argv[2], "queries") : DEFAULT_QUERIES;
+    cfg.k = (argc > 3) ? parse_long(argv[3], "k") : DEFAULT_K;
+    cfg.dim = (argc > 4) ? parse_long(argv[4], "dim") : DEFAULT_DIM;
+    if (argc > 5 || cfg.k > GALLERY_MAX_K || cfg.dim > GALLERY_MAX_DIM) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return cfg;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static float random_unit(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return (float)((*seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+}
+
+/*
+ * Real embeddings cluster by identity, so each vector is an identity centre
+ * plus noise. Uniform random vectors would make every index look worse than
+ * it does on faces.
+ */
+static void make_sample(const float *centers, long identity, long dim, unsigned int *seed, float *out) {
+    const float *center = centers + identity * dim;
+    for (long d = 0; d < dim; d++) {
+        out[d] = center[d] + IDENTITY_SPREAD * random_unit(seed);
+    }
+}
+
+static double run_queries(Gallery *gallery,
+                          const BenchConfig *cfg,
+                          const float *queries,
+                          GallerySearchMode mode,
+                          GalleryMatch *results) {
+    double start = monotonic_seconds();
+    for (long q = 0; q < cfg->queries; q++) {
+        gallery_search(gallery, queries + q * cfg->dim, (size_t)cfg->k, -1.0f, mode,
+                       results + q * cfg->k);
+    }
+    return monotonic_seconds() - start;
+}
+
+static double recall(const BenchConfig *cfg, const GalleryMatch *exact, const GalleryMatch *approx) {
+    long hits = 0;
+    for (long q = 0; q < cfg->queries; q++) {
+        for (long i = 0; i < cfg->k; i++) {
+            for (long j = 0; j < cfg->k; j++) {
+                if (approx[q * cfg->k + i].id == exact[q * cfg->k + j].id) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    return (double)hits / (double)(cfg->queries * cfg->k);
+}
+
+int main(int argc, char **argv) {
+    BenchConfig cfg = parse_args(argc, argv);
+    long identities = cfg.gallery_size / SAMPLES_PER_IDENTITY + 1;
+
+    float *centers = (float *)malloc(sizeof(float) * (size_t)(identities * cfg.dim));
+    float *queries = (float *)malloc(sizeof(float) * (size_t)(cfg.queries * cfg.dim));
+    float *sample = (float *)malloc(sizeof(float) * (size_t)cfg.dim);
+    GalleryMatch *exact = (GalleryMatch *)calloc((size_t)(cfg.queries * cfg.k), sizeof(*exact));
+    GalleryMatch *approx = (GalleryMatch *)calloc((size_t)(cfg.queries * cfg.k), sizeof(*approx));
+    GalleryParams params = gallery_default_params((size_t)cfg.dim);
+    params.initial_capacity = (size_t)cfg.gallery_size;
+    Gallery *gallery = gallery_create(&params);
+    if (centers == NULL || queries == NULL || sample == NULL || exact == NULL || approx == NULL ||
+        gallery == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    unsigned int seed = 17u;
+    for (long i = 0; i < identities * cfg.dim; i++) {
+        centers[i] = random_unit(&seed);
+    }
+
+    printf("Gallery benchmark: %ld entries, %ld queries, k=%ld, dim=%ld, kernels: %s\n",
+           cfg.gallery_size, cfg.queries, cfg.k, cfg.dim,
+           gallery_kernel_level() == GALLERY_KERNEL_AVX2 ? "avx2" : "scalar");
+
+    double start = monotonic_seconds();
+    for (long i = 0; i < cfg.gallery_size; i++) {
+        long identity = i / SAMPLES_PER_IDENTITY;
+        make_sample(centers, identity, cfg.dim, &seed, sample);
+        if (!gallery_add(gallery, (uint64_t)i, sample)) {
+            fprintf(stderr, "gallery_add failed at %ld\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    double build = monotonic_seconds() - start;
+    printf("Build time: %.3f sec (%.0f inserts/sec)\n", build, (double)cfg.gallery_size / build);
+
+    for (long q = 0; q < cfg.queries; q++) {
+        seed = seed * 1103515245u + 12345u;
+        long identity = (long)((seed >> 4) % (unsigned int)identities);
+        make_sample(centers, identity, cfg.dim, &seed, queries + q * cfg.dim);
+    }
+
+    double exact_elapsed = run_queries(gallery, &cfg, queries, GALLERY_SEARCH_EXACT, exact);
+    printf("\nExact scan\n");
+    printf("Queries/sec: %.2f\n", (double)cfg.queries / exact_elapsed);
+    printf("Latency per query: %.3f ms\n", exact_elapsed * 1000.0 / (double)cfg.queries);
+
+    static const size_t ef_values[] = {16, 32, 64, 128, 256};
+    printf("\nHNSW (M=%zu, ef_construction=%zu)\n", params.hnsw_m, params.hnsw_ef_construction);
+    printf("%8s %12s %12s %10s\n", "ef", "queries/sec", "latency_ms", "recall");
+    for (size_t i = 0; i < sizeof(ef_values) / sizeof(ef_values[0]); i++) {
+        gallery_set_ef_search(gallery, ef_values[i]);
+        double elapsed = run_queries(gallery, &cfg, queries, GALLERY_SEARCH_HNSW, approx);
+        printf("%8zu %12.2f %12.3f %10.4f\n", ef_values[i], (double)cfg.queries / elapsed,
+               elapsed * 1000.0 / (double)cfg.queries, recall(&cfg, exact, approx));
+    }
+
+    /*
+     * Bytes per identity is what a full scan reads per row; the float rows
+     * stay in the gallery and are only touched to re-rank the candidates.
+     */
+    static const size_t rerank_values[] = {1, 2, 4, 8, 16};
+    static const GalleryCodes codes[] = {GALLERY_CODES_INT8, GALLERY_CODES_PQ};
+    static const char *const code_names[] = {"int8", "pq"};
+    printf("\nCompressed scan (k x rerank candidates re-scored on the floats, %zu PQ subspaces)\n",
+           params.pq_subspaces);
+    printf("%8s %10s %8s %12s %12s %10s\n", "codes", "bytes/id", "rerank", "queries/sec",
+           "latency_ms", "recall");
+    printf("%8s %10zu %8s %12.2f %12.3f %10.4f\n", "float", gallery_scan_bytes(gallery), "-",
+           (double)cfg.queries / exact_elapsed, exact_elapsed * 1000.0 / (double)cfg.queries, 1.0);
+    for (size_t c = 0; c < sizeof(codes) / sizeof(codes[0]); c++) {
+        start = monotonic_seconds();
+        if (!gallery_set_codes(gallery, codes[c])) {
+            fprintf(stderr, "gallery_set_codes failed for %s\n", code_names[c]);
+            return EXIT_FAILURE;
+        }
+        double encode = monotonic_seconds() - start;
+        for (size_t i = 0; i < sizeof(rerank_values) / sizeof(rerank_values[0]); i++) {
+            gallery_set_rerank(gallery, rerank_values[i]);
+            double elapsed = run_queries(gallery, &cfg, queries, GALLERY_SEARCH_CODES, approx);
+            printf("%8s %10zu %8zu %12.2f %12.3f %10.4f\n", code_names[c],
+                   gallery_scan_bytes(gallery), rerank_values[i], (double)cfg.queries / elapsed,
+                   elapsed * 1000.0 / (double)cfg.queries, recall(&cfg, exact, approx));
+        }
+        printf("%8s encoded in %.3f sec\n", code_names[c], encode);
+    }
+
+    gallery_free(gallery);
+    free(centers);
+    free(queries);
+    free(sample);
+    free(exact);
+    free(approx);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "binary_ingest.h"
+#include "shm_ingest.h"
+
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FRAMES 10000L
+#define DEFAULT_FRAME_BYTES 65536L
+#define PUBLISH_TIMEOUT_MS 5000
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s shm:<socket path> | tcp:<host>:<port> | <host>:<port> [frames] "
+            "[frame_bytes]\n",
+            prog);
+    fprintf(stderr, "Defaults: frames=%ld frame_bytes=%ld\n", DEFAULT_FRAMES,
+            DEFAULT_FRAME_BYTES);
+}
+
+static long parse_long(const char *arg, const char *name) {
+    char *end = NULL;
+    long value = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || value <= 0) {
+        fprintf(stderr, "Invalid %s: %s\n", name, arg);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static long run_shm(const char *path, const unsigned char *frame, size_t frame_bytes,
+                    long frames) {
+    ShmIngestProducer producer;
+    if (!shm_ingest_connect(path, "bench", &producer)) {
+        fprintf(stderr, "Cannot connect to shared-memory ingest at %s\n", path);
+        return 0;
+    }
+    long sent = 0;
+    while (sent < frames && shm_ingest_publish(&producer, frame, frame_bytes, PUBLISH_TIMEOUT_MS)) {
+        sent++;
+    }
+    shm_ingest_disconnect(&producer);
+    return sent;
+}
+
+static int connect_tcp(const char *host, const char *port) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *it = res; it != NULL && fd < 0; it = it->ai_next) {
+        fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (fd >= 0 && connect(fd, it->ai_addr, it->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const unsigned char *cursor = (const unsigned char *)data;
+    while (length > 0) {
+        ssize_t n = write(fd, cursor, length);
+        if (n <= 0) {
+            return false;
+        }
+        cursor += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+/* One `POST /api/frame` per connection, the way the browser uploader sends frames. */
+static bool post_frame(const char *host, const char *port, const unsigned char *frame,
+                       size_t frame_bytes) {
+    int fd = connect_tcp(host, port);
+    if (fd < 0) {
+        return false;
+    }
+    char head[256];
+    int head_length = snprintf(head, sizeof(head),
+                               "POST /api/frame HTTP/1.1\r\n"
+                               "Host: %s\r\n"
+                               "Content-Type: image/jpeg\r\n"
+                               "Content-Length: %zu\r\n"
+                               "X-Stream-Id: bench\r\n"
+                               "Connection: close\r\n"
+                               "\r\n",
+                               host, frame_bytes);
+    char response[512];
+    bool ok = write_all(fd, head, (size_t)head_length) && write_all(fd, frame, frame_bytes);
+    ssize_t n = ok ? read(fd, response, sizeof(response) - 1) : -1;
+    ok = n > 12 && strncmp(response, "HTTP/1.1 200", 12) == 0;
+    close(fd);
+    return ok;
+}
+
+/* Splits `host:port` into `host` and returns the port, or NULL. */
+static const char *split_target(const char *target, char *host, size_t capacity) {
+    const char *colon = strrchr(target, ':');
+    if (colon == NULL || (size_t)(colon - target) >= capacity) {
+        fprintf(stderr, "Expected host:port, got %s\n", target);
+        return NULL;
+    }
+    memcpy(host, target, (size_t)(colon - target));
+    host[colon - target] = '\0';
+    return colon + 1;
+}
+
+static long run_http(const char *target, const unsigned char *frame, size_t frame_bytes,
+                     long frames) {
+    char host[256];
+    const char *port = split_target(target, host, sizeof(host));
+    long sent = 0;
+    while (port != NULL && sent < frames && post_frame(host, port, frame, frame_bytes)) {
+        sent++;
+    }
+    return sent;
+}
+
+static bool read_exact(int fd, unsigned char *out, size_t length) {
+    while (length > 0) {
+        ssize_t n = read(fd, out, length);
+        if (n <= 0) {
+            return false;
+        }
+        out += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+/* Reads one server message into `body`; returns its type, or 0 if the connection failed. */
+static unsigned read_message(int fd, unsigned char *body, size_t capacity) {
+    unsigned char prefix[BINARY_INGEST_PREFIX_BYTES];
+    if (!read_exact(fd, prefix, sizeof(prefix))) {
+        return 0;
+    }
+    size_t length = (((size_t)prefix[0] << 24) | ((size_t)prefix[1] << 16) |
+                     ((size_t)prefix[2] << 8) | prefix[3]) - 1;
+    if (length > capacity || !read_exact(fd, body, length)) {
+        return 0;
+    }
+    return prefix[4];
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+/* Header and payload in one system call where the socket takes it all. */
+static bool send_frame(int fd, const unsigned char *header, size_t header_length,
+                       const unsigned char *frame, size_t frame_bytes) {
+    struct iovec iov[2] = {{(void *)header, header_length}, {(void *)frame, frame_bytes}};
+    ssize_t n = writev(fd, iov, 2);
+    if (n < 0) {
+        return false;
+    }
+    size_t done = (size_t)n;
+    if (done < header_length) {
+        return write_all(fd, header + done, header_length - done) &&
+               write_all(fd, frame, frame_bytes);
+    }
+    return write_all(fd, frame + (done - header_length), frame_bytes - (done - header_length));
+}
+
+/*
+ * One persistent connection speaking the binary ingest protocol: frames go
+ * out while credits last, then the benchmark waits for CREDIT messages. A
+ * frame counts once the server has returned its credit.
+ */
+static long run_binary(const char *target, const unsigned char *frame, size_t frame_bytes,
+                       long frames) {
+    char host[256];
+    const char *port = split_target(target, host, sizeof(host));
+    int fd = port != NULL ? connect_tcp(host, port) : -1;
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to binary ingest at %s\n", target);
+        return 0;
+    }
+    unsigned char header[BINARY_INGEST_FRAME_FIXED_BYTES + BINARY_INGEST_STREAM_ID_MAX];
+    unsigned char body[16];
+    if (!write_all(fd, header, binary_ingest_encode_hello(header)) ||
+        read_message(fd, body, sizeof(body)) != BINARY_INGEST_WELCOME) {
+        fprintf(stderr, "Binary ingest at %s refused the connection\n", target);
+        close(fd);
+        return 0;
+    }
+    uint32_t window = get_u32(body);
+    uint32_t credits = window;
+    long sent = 0;
+    long published = 0;
+    bool ok = true;
+    while (ok && (sent < frames || credits < window)) {
+        if (sent < frames && credits > 0) {
+            size_t header_length =
+                binary_ingest_encode_frame(header, (uint64_t)sent + 1, 0, "bench", frame_bytes);
+            ok = send_frame(fd, header, header_length, frame, frame_bytes);
+            credits--;
+            sent++;
+            continue;
+        }
+        unsigned type = read_message(fd, body, sizeof(body));
+        if (type == BINARY_INGEST_CREDIT) {
+            credits += get_u32(body);
+            published += get_u32(body);
+        } else {
+            fprintf(stderr, "Binary ingest stopped the benchmark (message 0x%02x)\n", type);
+            ok = false;
+        }
+    }
+    close(fd);
+    return published;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    long frames = argc > 2 ? parse_long(argv[2], "frames") : DEFAULT_FRAMES;
+    long frame_bytes = argc > 3 ? parse_long(argv[3], "frame_bytes") : DEFAULT_FRAME_BYTES;
+
+    unsigned char *frame = (unsigned char *)malloc((size_t)frame_bytes);
+    if (frame == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    /* A JPEG start marker, so the pipeline sees what it would from a camera. */
+    for (long i = 0; i < frame_bytes; i++) {
+        frame[i] = (unsigned char)(i * 31);
+    }
+    frame[0] = 0xFF;
+    if (frame_bytes > 1) {
+        frame[1] = 0xD8;
+    }
+
+    const char *mode = "HTTP POST /api/frame";
+    double start = monotonic_seconds();
+    long sent = 0;
+    if (strncmp(argv[1], "shm:", 4) == 0) {
+        mode = "shared memory";
+        sent = run_shm(argv[1] + 4, frame, (size_t)frame_bytes, frames);
+    } else if (strncmp(argv[1], "tcp:", 4) == 0) {
+        mode = "binary framed TCP";
+        sent = run_binary(argv[1] + 4, frame, (size_t)frame_bytes, frames);
+    } else {
+        sent = run_http(argv[1], frame, (size_t)frame_bytes, frames);
+    }
+    double elapsed = monotonic_seconds() - start;
+    free(frame);
+
+    printf("Ingest benchmark (%s)\n", mode);
+    printf("  frames:        %ld of %ld (%ld bytes each)\n", sent, frames, frame_bytes);
+    printf("  elapsed:       %.3f s\n", elapsed);
+    if (elapsed > 0.0) {
+        printf("  frames/s:      %.0f\n", (double)sent / elapsed);
+        printf("  MiB/s:         %.1f\n",
+               (double)sent * (double)frame_bytes / elapsed / (1024.0 * 1024.0));
+    }
+    return sent == frames ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,405 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "binary_ingest.h"
+
+#include "router.h"
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LISTEN_TAG UINT64_MAX
+#define POLL_EVENTS 32
+#define READS_PER_EVENT 8
+#define INITIAL_BUFFER_BYTES (64 * 1024)
+
+typedef struct {
+    int fd;
+    bool greeted;
+    unsigned char *buffer;
+    size_t capacity;
+    size_t used;
+    uint32_t credits;
+    uint32_t owed;
+    bool has_seq;
+    uint64_t last_seq;
+} Connection;
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static uint32_t window = 0;
+static Connection connections[BINARY_INGEST_MAX_CONNECTIONS];
+static BinaryIngestStats stats;
+
+static void put_u16(unsigned char *out, uint16_t value) {
+    out[0] = (unsigned char)(value >> 8);
+    out[1] = (unsigned char)value;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (24 - 8 * i));
+    }
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(value >> (56 - 8 * i));
+    }
+}
+
+static uint16_t get_u16(const unsigned char *in) {
+    return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+    return ((uint64_t)get_u32(in) << 32) | get_u32(in + 4);
+}
+
+/* Largest message a camera may send: a frame of the current max_frame_bytes. */
+static size_t max_message_bytes(void) {
+    return BINARY_INGEST_FRAME_FIXED_BYTES + BINARY_INGEST_STREAM_ID_MAX + router_max_frame_size();
+}
+
+/* Control messages are tiny; a camera that lets them back up is not reading and is dropped. */
+static bool send_message(Connection *c, unsigned type, const unsigned char *body, size_t length) {
+    unsigned char message[32];
+    put_u32(message, (uint32_t)(length + 1));
+    message[4] = (unsigned char)type;
+    memcpy(message + BINARY_INGEST_PREFIX_BYTES, body, length);
+    size_t total = BINARY_INGEST_PREFIX_BYTES + length;
+    ssize_t n;
+    do {
+        n = send(c->fd, message, total, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)total;
+}
+
+static void close_connection(Connection *c, int status) {
+    if (status != 0) {
+        unsigned char body[2];
+        put_u16(body, (uint16_t)status);
+        send_message(c, BINARY_INGEST_CLOSE, body, sizeof(body));
+        stats.protocol_errors++;
+    }
+    close(c->fd);
+    c->fd = -1;
+    free(c->buffer);
+    c->buffer = NULL;
+    stats.connections--;
+}
+
+static bool flush_credits(Connection *c) {
+    if (c->owed == 0) {
+        return true;
+    }
+    unsigned char body[12];
+    put_u32(body, c->owed);
+    put_u64(body + 4, c->last_seq);
+    c->credits += c->owed;
+    c->owed = 0;
+    return send_message(c, BINARY_INGEST_CREDIT, body, sizeof(body));
+}
+
+static bool handle_hello(Connection *c, const unsigned char *body, size_t length) {
+    if (length != 2 || get_u16(body) != BINARY_INGEST_VERSION) {
+        return false;
+    }
+    unsigned char welcome[8];
+    put_u32(welcome, window);
+    put_u32(welcome + 4, (uint32_t)router_max_frame_size());
+    c->greeted = true;
+    c->credits = window;
+    return send_message(c, BINARY_INGEST_WELCOME, welcome, sizeof(welcome));
+}
+
+/* Publishes the payload from the receive buffer; a refused frame still returns its credit. */
+static bool handle_frame(Connection *c, const unsigned char *body, size_t length) {
+    if (length < 17 || c->credits == 0) {
+        return false;
+    }
+    size_t stream_length = body[16];
+    if (stream_length > BINARY_INGEST_STREAM_ID_MAX || length < 17 + stream_length) {
+        return false;
+    }
+    uint64_t seq = get_u64(body);
+    char stream_id[BINARY_INGEST_STREAM_ID_MAX + 1];
+    memcpy(stream_id, body + 17, stream_length);
+    stream_id[stream_length] = '\0';
+    const unsigned char *payload = body + 17 + stream_length;
+    size_t payload_length = length - 17 - stream_length;
+
+    c->credits--;
+    c->owed++;
+    if (c->has_seq && seq > c->last_seq + 1) {
+        stats.sequence_gaps += seq - c->last_seq - 1;
+    }
+    c->has_seq = true;
+    c->last_seq = seq;
+
+    uint64_t pipeline_seq = 0;
+    int status = router_publish_frame(stream_id, payload, payload_length, &pipeline_seq);
+    if (status == 200) {
+        stats.frames++;
+        stats.bytes += payload_length;
+        return true;
+    }
+    stats.rejected++;
+    unsigned char reject[10];
+    put_u64(reject, seq);
+    put_u16(reject + 8, (uint16_t)status);
+    return send_message(c, BINARY_INGEST_REJECT, reject, sizeof(reject));
+}
+
+/*
+ * Handles every complete message in the buffer, then moves the partial one
+ * (if any) to the front and makes room for all of it. Returns 0, or the
+ * status to close the connection with.
+ */
+static int process_messages(Connection *c) {
+    size_t offset = 0;
+    size_t limit = max_message_bytes();
+    while (c->used - offset >= 4) {
+        uint32_t length = get_u32(c->buffer + offset);
+        if (length == 0 || length > limit) {
+            return length == 0 ? 400 : 413;
+        }
+        if (c->used - offset < 4 + (size_t)length) {
+            break;
+        }
+        unsigned type = c->buffer[offset + 4];
+        const unsigned char *body = c->buffer + offset + BINARY_INGEST_PREFIX_BYTES;
+        bool ok = false;
+        if (!c->greeted) {
+            ok = type == BINARY_INGEST_HELLO && handle_hello(c, body, length - 1);
+        } else if (type == BINARY_INGEST_FRAME) {
+            ok = handle_frame(c, body, length - 1);
+        }
+        if (!ok) {
+            return 400;
+        }
+        offset += 4 + (size_t)length;
+    }
+
+    c->used -= offset;
+    memmove(c->buffer, c->buffer + offset, c->used);
+    size_t needed = c->used >= 4 ? 4 + (size_t)get_u32(c->buffer) : INITIAL_BUFFER_BYTES;
+    if (needed > c->capacity) {
+        unsigned char *grown = (unsigned char *)realloc(c->buffer, needed);
+        if (grown == NULL) {
+            return 500;
+        }
+        c->buffer = grown;
+        c->capacity = needed;
+    }
+    return 0;
+}
+
+/* Reads what the camera has sent, a bounded number of times so one camera cannot hog the thread. */
+static size_t serve(Connection *c) {
+    uint64_t frames_before = stats.frames + stats.rejected;
+    for (int reads = 0; reads < READS_PER_EVENT; reads++) {
+        ssize_t n = recv(c->fd, c->buffer + c->used, c->capacity - c->used, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            close_connection(c, 0);
+            return (size_t)(stats.frames + stats.rejected - frames_before);
+        }
+        c->used += (size_t)n;
+        int status = process_messages(c);
+        if (status != 0) {
+            close_connection(c, status);
+            return (size_t)(stats.frames + stats.rejected - frames_before);
+        }
+    }
+    if (!flush_credits(c)) {
+        close_connection(c, 0);
+    }
+    return (size_t)(stats.frames + stats.rejected - frames_before);
+}
+
+static void accept_connections(void) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                perror("ingest accept");
+            }
+            return;
+        }
+        size_t index = 0;
+        while (index < BINARY_INGEST_MAX_CONNECTIONS && connections[index].fd >= 0) {
+            index++;
+        }
+        int flags = fcntl(fd, F_GETFL, 0);
+        Connection *c = index < BINARY_INGEST_MAX_CONNECTIONS ? &connections[index] : NULL;
+        unsigned char *buffer = c != NULL ? (unsigned char *)malloc(INITIAL_BUFFER_BYTES) : NULL;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = index;
+        if (buffer == NULL || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            unsigned char busy[2 + BINARY_INGEST_PREFIX_BYTES] = {0, 0, 0, 3,
+                                                                  BINARY_INGEST_CLOSE};
+            put_u16(busy + BINARY_INGEST_PREFIX_BYTES, 503);
+            ssize_t n = send(fd, busy, sizeof(busy), MSG_NOSIGNAL | MSG_DONTWAIT);
+            (void)n;
+            free(buffer);
+            close(fd);
+            stats.protocol_errors++;
+            continue;
+        }
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        c->buffer = buffer;
+        c->capacity = INITIAL_BUFFER_BYTES;
+        stats.accepted++;
+        stats.connections++;
+    }
+}
+
+/*
+ * Serves cameras on `listen_fd`, a non-blocking listening socket this module
+ * now owns; each connection may have `credits` frames in flight.
+ */
+bool binary_ingest_start(int listen_fd_in, size_t credits) {
+    if (listen_fd >= 0 || listen_fd_in < 0 || credits == 0 ||
+        credits > BINARY_INGEST_MAX_CREDITS) {
+        return false;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = LISTEN_TAG;
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd_in, &event) != 0) {
+        perror("ingest epoll");
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+            epoll_fd = -1;
+        }
+        return false;
+    }
+    listen_fd = listen_fd_in;
+    window = (uint32_t)credits;
+    memset(&stats, 0, sizeof(stats));
+    for (size_t i = 0; i < BINARY_INGEST_MAX_CONNECTIONS; i++) {
+        connections[i].fd = -1;
+    }
+    return true;
+}
+
+/* Readable when a camera connects or sends; the accept loop polls it with the listeners. */
+int binary_ingest_fd(void) {
+    return epoll_fd;
+}
+
+/* The listening socket, which a hot restart hands over with the HTTP ones. */
+int binary_ingest_listen_fd(void) {
+    return listen_fd;
+}
+
+/* Handles whatever is ready without blocking; returns how many frames arrived. */
+size_t binary_ingest_poll(void) {
+    if (epoll_fd < 0) {
+        return 0;
+    }
+    struct epoll_event events[POLL_EVENTS];
+    int count = epoll_wait(epoll_fd, events, POLL_EVENTS, 0);
+    size_t frames = 0;
+    bool accept_pending = false;
+    for (int i = 0; i < count; i++) {
+        uint64_t tag = events[i].data.u64;
+        if (tag == LISTEN_TAG) {
+            accept_pending = true;
+        } else if (connections[tag].fd >= 0) {
+            frames += serve(&connections[tag]);
+        }
+    }
+    /* After the events, so a slot freed above is not reused while its events are pending. */
+    if (accept_pending) {
+        accept_connections();
+    }
+    return frames;
+}
+
+/* Hangs up on every camera (they reconnect, to the new process after a restart). */
+void binary_ingest_stop(void) {
+    if (listen_fd < 0) {
+        return;
+    }
+    for (size_t i = 0; i < BINARY_INGEST_MAX_CONNECTIONS; i++) {
+        if (connections[i].fd >= 0) {
+            flush_credits(&connections[i]);
+            close_connection(&connections[i], 0);
+        }
+    }
+    close(epoll_fd);
+    epoll_fd = -1;
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+void binary_ingest_stats(BinaryIngestStats *out) {
+    *out = stats;
+}
+
+size_t binary_ingest_format_stats_json(const BinaryIngestStats *in, char *out, size_t capacity) {
+    int n = snprintf(out, capacity,
+                     "{\"connections\":%zu,\"accepted\":%llu,\"frames\":%llu,\"bytes\":%llu,"
+                     "\"rejected\":%llu,\"sequence_gaps\":%llu,\"protocol_errors\":%llu}",
+                     in->connections, (unsigned long long)in->accepted,
+                     (unsigned long long)in->frames, (unsigned long long)in->bytes,
+                     (unsigned long long)in->rejected, (unsigned long long)in->sequence_gaps,
+                     (unsigned long long)in->protocol_errors);
+    return n > 0 && (size_t)n < capacity ? (size_t)n : 0;
+}
+
+size_t binary_ingest_encode_hello(unsigned char *out) {
+    put_u32(out, 3);
+    out[4] = BINARY_INGEST_HELLO;
+    put_u16(out + BINARY_INGEST_PREFIX_BYTES, BINARY_INGEST_VERSION);
+    return BINARY_INGEST_HELLO_BYTES;
+}
+
+/*
+ * Writes a FRAME header for `payload_length` bytes to follow; `out` needs
+ * BINARY_INGEST_FRAME_FIXED_BYTES + BINARY_INGEST_STREAM_ID_MAX bytes.
+ * Returns its length, or 0 if the stream id is too long.
+ */
+size_t binary_ingest_encode_frame(unsigned char *out,
+                                  uint64_t seq,
+                                  uint64_t timestamp_ms,
+                                  const char *stream_id,
+                                  size_t payload_length) {
+    size_t stream_length = strlen(stream_id);
+    if (stream_length > BINARY_INGEST_STREAM_ID_MAX || payload_length > UINT32_MAX / 2) {
+        return 0;
+    }
+    put_u32(out, (uint32_t)(1 + 17 + stream_length + payload_length));
+    out[4] = BINARY_INGEST_FRAME;
+    put_u64(out + BINARY_INGEST_PREFIX_BYTES, seq);
+    put_u64(out + BINARY_INGEST_PREFIX_BYTES + 8, timestamp_ms);
+    out[BINARY_INGEST_PREFIX_BYTES + 16] = (unsigned char)stream_length;
+    memcpy(out + BINARY_INGEST_FRAME_FIXED_BYTES, stream_id, stream_length);
+    return BINARY_INGEST_FRAME_FIXED_BYTES + stream_length;
+}
@@ -0,0 +1,69 @@
+#ifndef BINARY_INGEST_H
+#define BINARY_INGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Length-prefixed binary frame ingest for embedded cameras, on its own
+ * listener (`ingest_listen`). Every message is a big-endian u32 length of
+ * what follows, a u8 type, then the body:
+ *
+ *   camera -> server  HELLO    u16 version
+ *                     FRAME    u64 seq, u64 timestamp ms, u8 stream id length,
+ *                              stream id, payload
+ *   server -> camera  WELCOME  u32 credits, u32 max payload bytes
+ *                     CREDIT   u32 credits returned, u64 last seq published
+ *                     REJECT   u64 seq, u16 HTTP-style status (400/413/500)
+ *                     CLOSE    u16 status, sent before the server hangs up
+ *
+ * Each FRAME spends one credit; a FRAME sent without one ends the
+ * connection. Sequence numbers count up per connection, so a camera that
+ * reconnects can resend what came after the last CREDIT's seq.
+ */
+
+#define BINARY_INGEST_VERSION 1u
+#define BINARY_INGEST_HELLO 0x01u
+#define BINARY_INGEST_FRAME 0x02u
+#define BINARY_INGEST_WELCOME 0x81u
+#define BINARY_INGEST_CREDIT 0x82u
+#define BINARY_INGEST_REJECT 0x83u
+#define BINARY_INGEST_CLOSE 0x84u
+
+#define BINARY_INGEST_PREFIX_BYTES 5
+#define BINARY_INGEST_HELLO_BYTES (BINARY_INGEST_PREFIX_BYTES + 2)
+#define BINARY_INGEST_FRAME_FIXED_BYTES (BINARY_INGEST_PREFIX_BYTES + 17)
+#define BINARY_INGEST_STREAM_ID_MAX 63
+#define BINARY_INGEST_MAX_CREDITS 1024
+
+typedef struct {
+    size_t connections;
+    uint64_t accepted;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t rejected;
+    uint64_t sequence_gaps;
+    uint64_t protocol_errors;
+} BinaryIngestStats;
+
+/* Server side; everything runs on the accept thread. */
+bool binary_ingest_start(int listen_fd, size_t credits);
+int binary_ingest_fd(void);
+int binary_ingest_listen_fd(void);
+size_t binary_ingest_poll(void);
+void binary_ingest_stop(void);
+void binary_ingest_stats(BinaryIngestStats *out);
+size_t binary_ingest_format_stats_json(const BinaryIngestStats *stats,
+                                       char *out,
+                                       size_t capacity);
+
+/* Camera side: message headers; a FRAME header goes out just ahead of its payload. */
+size_t binary_ingest_encode_hello(unsigned char *out);
+size_t binary_ingest_encode_frame(unsigned char *out,
+                                  uint64_t seq,
+                                  uint64_t timestamp_ms,
+                                  const char *stream_id,
+                                  size_t payload_length);
+
+#endif
@@ -0,0 +1,819 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "cluster.h"
+
+#include "frame_store.h"
+#include "pipeline.h"
+#include "router.h"
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RELAY_EPOLL_BATCH 64
+#define RELAY_TICK_MS 1000
+#define WAKE_TAG UINT64_MAX
+#define EDGE_POLL_MS 200
+#define EDGE_HEAD_MAX 1024
+
+typedef struct {
+    uint64_t hash;
+    int node;
+} RingPoint;
+
+/* One relayed frame as a batch record (header, then bytes), shared by its subscribers. */
+typedef struct {
+    size_t refs;
+    size_t length;
+    unsigned char data[];
+} RelayFrame;
+
+/*
+ * A relay connection. Only the newest frame waits behind the one being
+ * written, so a viewer on a slow link skips frames instead of lagging.
+ */
+typedef struct {
+    int fd;
+    uint32_t generation;
+    uint64_t stream;
+    RelayFrame *sending;
+    size_t sent;
+    RelayFrame *pending;
+    uint64_t blocked_since_ms;
+} RelaySubscriber;
+
+/* One stream an edge pulls from its owner, on its own thread. */
+typedef struct {
+    bool used;
+    bool finished;
+    char stream_id[64];
+    pthread_t thread;
+    int fd;
+    _Atomic uint64_t viewed_ms;
+} EdgeWatch;
+
+static const char relay_headers[] = "HTTP/1.1 200 OK\r\n"
+                                    "Content-Type: " FRAME_BATCH_CONTENT_TYPE "\r\n"
+                                    "Cache-Control: no-store\r\n"
+                                    "Connection: close\r\n"
+                                    "X-Accel-Buffering: no\r\n"
+                                    "\r\n";
+
+/* Set by cluster_start() and cleared by cluster_stop(), both on the accept thread. */
+static ListenerSpec nodes[CLUSTER_MAX_NODES];
+static size_t node_count = 0;
+static int self_index = -1;
+static bool edge = false;
+static RingPoint ring[CLUSTER_MAX_NODES * CLUSTER_VNODES];
+static size_t ring_size = 0;
+
+/* Guards the subscribers, the edge watches and the stats. */
+static pthread_mutex_t cluster_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool running;
+static bool thread_started = false;
+static pthread_t relay_thread;
+static int wake_fd = -1;
+static int epoll_fd = -1;
+static RelaySubscriber subscribers[CLUSTER_RELAY_MAX_SUBSCRIBERS];
+static EdgeWatch watches[PIPELINE_MAX_STREAMS];
+static ClusterStats stats;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/* FNV-1a spreads short, similar names unevenly; the splitmix64 finaliser evens them out. */
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static int compare_points(const void *a, const void *b) {
+    const RingPoint *x = (const RingPoint *)a;
+    const RingPoint *y = (const RingPoint *)b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->node - y->node;
+}
+
+/*
+ * CLUSTER_VNODES points per node, hashed from its address, so every node
+ * computes the same ring from the same list in any order, and adding a node
+ * moves only the streams that land on its points.
+ */
+static void build_ring(void) {
+    ring_size = 0;
+    for (size_t i = 0; i < node_count; i++) {
+        char name[160];
+        listener_spec_format(&nodes[i], name, sizeof(name));
+        for (unsigned v = 0; v < CLUSTER_VNODES; v++) {
+            char point[192];
+            snprintf(point, sizeof(point), "%s#%u", name, v);
+            ring[ring_size].hash = mix(pipeline_stream_key(point));
+            ring[ring_size].node = (int)i;
+            ring_size++;
+        }
+    }
+    qsort(ring, ring_size, sizeof(ring[0]), compare_points);
+}
+
+/* The index in `cluster_nodes` of the origin that owns the stream; -1 when standalone. */
+int cluster_owner(const char *stream_id) {
+    if (ring_size == 0) {
+        return -1;
+    }
+    uint64_t hash = mix(pipeline_stream_key(stream_id));
+    size_t low = 0;
+    size_t high = ring_size;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (ring[middle].hash < hash) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return ring[low == ring_size ? 0 : low].node;
+}
+
+size_t cluster_format_node(int index, char *out, size_t capacity) {
+    if (index < 0 || (size_t)index >= node_count) {
+        return 0;
+    }
+    return listener_spec_format(&nodes[index], out, capacity);
+}
+
+bool cluster_is_edge(void) {
+    return edge;
+}
+
+/*
+ * Where a request about `stream_id` belongs when another node owns the
+ * stream: `http://owner` plus the request's path and query. False, with
+ * `out` untouched, when this node should answer itself.
+ */
+bool cluster_redirect_location(const char *stream_id,
+                               const HttpRequest *request,
+                               char *out,
+                               size_t capacity) {
+    int owner = cluster_owner(stream_id);
+    if (owner < 0 || owner == self_index) {
+        return false;
+    }
+    char name[160];
+    listener_spec_format(&nodes[owner], name, sizeof(name));
+    int n = snprintf(out, capacity, "http://%s%s%s%s", name, request->path,
+                     request->query[0] != '\0' ? "?" : "", request->query);
+    if (n < 0 || (size_t)n >= capacity) {
+        return false;
+    }
+    pthread_mutex_lock(&cluster_mutex);
+    stats.redirects++;
+    pthread_mutex_unlock(&cluster_mutex);
+    return true;
+}
+
+static void put_be32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static void put_be64(unsigned char *out, uint64_t value) {
+    put_be32(out, (uint32_t)(value >> 32));
+    put_be32(out + 4, (uint32_t)value);
+}
+
+static uint32_t get_be32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static uint64_t get_be64(const unsigned char *in) {
+    return ((uint64_t)get_be32(in) << 32) | get_be32(in + 4);
+}
+
+static RelayFrame *relay_frame_new(uint64_t time_ms, const unsigned char *data, size_t length) {
+    RelayFrame *frame = (RelayFrame *)malloc(sizeof(*frame) + FRAME_BATCH_HEADER_BYTES + length);
+    if (frame == NULL) {
+        return NULL;
+    }
+    frame->refs = 0;
+    frame->length = FRAME_BATCH_HEADER_BYTES + length;
+    put_be64(frame->data, time_ms);
+    put_be32(frame->data + 8, (uint32_t)length);
+    memcpy(frame->data + FRAME_BATCH_HEADER_BYTES, data, length);
+    return frame;
+}
+
+static void relay_frame_release(RelayFrame *frame) {
+    if (frame != NULL && --frame->refs == 0) {
+        free(frame);
+    }
+}
+
+static void relay_attach(RelaySubscriber *sub, RelayFrame *frame) {
+    frame->refs++;
+    if (sub->sending == NULL) {
+        sub->sending = frame;
+        sub->sent = 0;
+        return;
+    }
+    relay_frame_release(sub->pending);
+    sub->pending = frame;
+}
+
+static void relay_close(RelaySubscriber *sub, bool slow) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sub->fd, NULL);
+    close(sub->fd);
+    sub->fd = -1;
+    relay_frame_release(sub->sending);
+    relay_frame_release(sub->pending);
+    sub->sending = NULL;
+    sub->pending = NULL;
+    stats.relay_subscribers--;
+    if (slow) {
+        stats.relay_dropped_slow++;
+    } else {
+        stats.relay_disconnected++;
+    }
+}
+
+/* Writes what the socket takes without blocking; cluster_mutex is held. */
+static void relay_pump(RelaySubscriber *sub, uint64_t now_ms) {
+    while (sub->fd >= 0 && sub->sending != NULL) {
+        const RelayFrame *frame = sub->sending;
+        ssize_t n = send(sub->fd, frame->data + sub->sent, frame->length - sub->sent,
+                         MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (sub->blocked_since_ms == 0) {
+                    sub->blocked_since_ms = now_ms;
+                }
+                return;
+            }
+            relay_close(sub, false);
+            return;
+        }
+        sub->sent += (size_t)n;
+        sub->blocked_since_ms = 0;
+        if (sub->sent == frame->length) {
+            relay_frame_release(sub->sending);
+            sub->sending = sub->pending;
+            sub->pending = NULL;
+            sub->sent = 0;
+        }
+    }
+}
+
+static void relay_event(RelaySubscriber *sub, uint32_t events) {
+    if (events & EPOLLIN) {
+        /* Relay clients send nothing after the request; drain so a hang-up shows as EOF. */
+        char scratch[256];
+        for (;;) {
+            ssize_t n = recv(sub->fd, scratch, sizeof(scratch), 0);
+            if (n > 0 || (n < 0 && errno == EINTR)) {
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                relay_close(sub, false);
+                return;
+            }
+            break;
+        }
+    }
+    if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        relay_close(sub, false);
+    }
+}
+
+static void *relay_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[RELAY_EPOLL_BATCH];
+    while (atomic_load(&running)) {
+        int n = epoll_wait(epoll_fd, events, RELAY_EPOLL_BATCH, RELAY_TICK_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        pthread_mutex_lock(&cluster_mutex);
+        uint64_t now = monotonic_ms();
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == WAKE_TAG) {
+                uint64_t count;
+                ssize_t ignored = read(wake_fd, &count, sizeof(count));
+                (void)ignored;
+                continue;
+            }
+            /* The generation tells a stale event from one for whoever reused the slot. */
+            RelaySubscriber *sub = &subscribers[(uint32_t)tag];
+            if (sub->fd >= 0 && sub->generation == (uint32_t)(tag >> 32)) {
+                relay_event(sub, events[i].events);
+            }
+        }
+        for (size_t i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS; i++) {
+            RelaySubscriber *sub = &subscribers[i];
+            relay_pump(sub, now);
+            if (sub->fd >= 0 && sub->blocked_since_ms != 0 &&
+                now - sub->blocked_since_ms >= CLUSTER_RELAY_STALL_MS) {
+                relay_close(sub, true);
+            }
+        }
+        pthread_mutex_unlock(&cluster_mutex);
+    }
+    return NULL;
+}
+
+static void wake_relay(void) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+static bool send_all(int fd, const void *data, size_t length) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(fd, bytes + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+static bool seed_subscriber(uint64_t stream,
+                            uint64_t time_ms,
+                            const unsigned char *data,
+                            size_t length,
+                            void *ctx) {
+    (void)stream;
+    RelayFrame *frame = relay_frame_new(time_ms, data, length);
+    if (frame != NULL) {
+        relay_attach((RelaySubscriber *)ctx, frame);
+    }
+    return true;
+}
+
+/*
+ * `GET /api/frames/live`: answers on a dup of the socket with a batch body
+ * that never ends, starting with the stream's newest kept frame, and returns
+ * at once. Returns false, with nothing written, when the relay is full.
+ */
+bool cluster_relay_subscribe(int client_fd, const char *stream_id) {
+    int fd = dup(client_fd);
+    pthread_mutex_lock(&cluster_mutex);
+    RelaySubscriber *sub = NULL;
+    for (size_t i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS && atomic_load(&running); i++) {
+        if (subscribers[i].fd < 0) {
+            sub = &subscribers[i];
+            break;
+        }
+    }
+    if (sub == NULL || fd < 0) {
+        stats.relay_rejected++;
+        pthread_mutex_unlock(&cluster_mutex);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    uint32_t index = (uint32_t)(sub - subscribers);
+    sub->fd = fd;
+    sub->generation++;
+    sub->stream = pipeline_stream_key(stream_id);
+    sub->sent = 0;
+    sub->blocked_since_ms = 0;
+    stats.relay_subscribers++;
+    bool ok = send_all(fd, relay_headers, sizeof(relay_headers) - 1);
+    http_note_response(200, sizeof(relay_headers) - 1);
+    int flags = fcntl(fd, F_GETFL, 0);
+    ok = ok && flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = ((uint64_t)sub->generation << 32) | index;
+    ok = ok && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    if (ok) {
+        stats.relay_accepted++;
+        frame_store_visit_latest(stream_id, seed_subscriber, sub);
+    } else {
+        relay_close(sub, false);
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+    wake_relay();
+    return true;
+}
+
+/* Hands a frame just published on this node to the relay connections of its stream. */
+void cluster_relay_publish(const char *stream_id,
+                           uint64_t time_ms,
+                           const unsigned char *data,
+                           size_t length) {
+    if (!atomic_load(&running)) {
+        return;
+    }
+    uint64_t stream = pipeline_stream_key(stream_id);
+    pthread_mutex_lock(&cluster_mutex);
+    RelayFrame *frame = NULL;
+    for (size_t i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS && stats.relay_subscribers > 0; i++) {
+        RelaySubscriber *sub = &subscribers[i];
+        if (sub->fd < 0 || sub->stream != stream) {
+            continue;
+        }
+        if (frame == NULL && (frame = relay_frame_new(time_ms, data, length)) == NULL) {
+            break;
+        }
+        relay_attach(sub, frame);
+    }
+    if (frame != NULL) {
+        stats.relay_frames++;
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+    if (frame != NULL) {
+        wake_relay();
+    }
+}
+
+static bool edge_should_stop(EdgeWatch *watch) {
+    return !atomic_load(&running) ||
+           monotonic_ms() - atomic_load(&watch->viewed_ms) >= CLUSTER_EDGE_IDLE_MS;
+}
+
+static void edge_sleep(EdgeWatch *watch, unsigned ms) {
+    for (unsigned slept = 0; slept < ms && !edge_should_stop(watch); slept += EDGE_POLL_MS) {
+        struct timespec pause = {0, EDGE_POLL_MS * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/* Reads exactly `length` bytes, giving up when the watch should stop or the peer hangs up. */
+static bool edge_read(EdgeWatch *watch, int fd, void *out, size_t length) {
+    unsigned char *bytes = (unsigned char *)out;
+    size_t used = 0;
+    while (used < length) {
+        ssize_t n = recv(fd, bytes + used, length - used, 0);
+        if (n > 0) {
+            used += (size_t)n;
+            continue;
+        }
+        if (n == 0 ||
+            (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) ||
+            edge_should_stop(watch)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t percent_encode(const char *text, char *out, size_t capacity) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t used = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        bool plain = (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+                     (*p >= '0' && *p <= '9') || *p == '-' || *p == '_' || *p == '.' ||
+                     *p == '~';
+        if (used + (plain ? 1u : 3u) >= capacity) {
+            return 0;
+        }
+        if (plain) {
+            out[used++] = (char)*p;
+        } else {
+            out[used++] = '%';
+            out[used++] = hex[*p >> 4];
+            out[used++] = hex[*p & 15];
+        }
+    }
+    out[used] = '\0';
+    return used;
+}
+
+/* Sends the relay request and reads the response head a byte at a time, leaving the body. */
+static bool edge_request(EdgeWatch *watch, int fd, const ListenerSpec *owner) {
+    char stream[3 * sizeof(watch->stream_id)];
+    char host[160];
+    char request[512];
+    percent_encode(watch->stream_id, stream, sizeof(stream));
+    listener_spec_format(owner, host, sizeof(host));
+    int n = snprintf(request, sizeof(request),
+                     "GET /api/frames/live?stream=%s HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "Connection: close\r\n"
+                     "\r\n",
+                     stream, host);
+    if (n < 0 || (size_t)n >= sizeof(request) || !send_all(fd, request, (size_t)n)) {
+        return false;
+    }
+    char head[EDGE_HEAD_MAX];
+    size_t used = 0;
+    while (used < 4 || memcmp(head + used - 4, "\r\n\r\n", 4) != 0) {
+        if (used == sizeof(head) - 1 || !edge_read(watch, fd, head + used, 1)) {
+            return false;
+        }
+        used++;
+    }
+    return strncmp(head, "HTTP/1.1 200 ", 13) == 0 || strncmp(head, "HTTP/1.0 200 ", 13) == 0;
+}
+
+/*
+ * Keeps each relayed frame newer than the local history has, with the time
+ * the owner stamped it; returns when the relay ends. The recorder orders
+ * records per stream, so owner times never collide with this node's other
+ * streams.
+ */
+static void edge_stream(EdgeWatch *watch, int fd) {
+    unsigned char *buffer = NULL;
+    size_t capacity = 0;
+    unsigned char header[FRAME_BATCH_HEADER_BYTES];
+    while (edge_read(watch, fd, header, sizeof(header))) {
+        uint64_t time_ms = get_be64(header);
+        size_t length = get_be32(header + 8);
+        if (length == 0 || length > router_max_frame_size()) {
+            break;
+        }
+        if (length > capacity) {
+            unsigned char *grown = (unsigned char *)realloc(buffer, length);
+            if (grown == NULL) {
+                break;
+            }
+            buffer = grown;
+            capacity = length;
+        }
+        if (!edge_read(watch, fd, buffer, length)) {
+            break;
+        }
+        if (time_ms > frame_store_last_ms(watch->stream_id)) {
+            frame_store_append(watch->stream_id, time_ms, buffer, length, NULL);
+        }
+        pthread_mutex_lock(&cluster_mutex);
+        stats.edge_frames++;
+        pthread_mutex_unlock(&cluster_mutex);
+    }
+    free(buffer);
+}
+
+/*
+ * Pulls one stream from its owner until no viewer has asked for it for
+ * CLUSTER_EDGE_IDLE_MS, reconnecting after CLUSTER_EDGE_RETRY_MS whenever
+ * the owner is down, refuses, or ends the relay (as it does on restart).
+ */
+static void *edge_main(void *arg) {
+    EdgeWatch *watch = (EdgeWatch *)arg;
+    while (!edge_should_stop(watch)) {
+        const ListenerSpec *owner = &nodes[cluster_owner(watch->stream_id)];
+        int fd = listener_connect(owner, CLUSTER_EDGE_RETRY_MS, EDGE_POLL_MS);
+        bool streaming = false;
+        if (fd >= 0) {
+            pthread_mutex_lock(&cluster_mutex);
+            watch->fd = fd;
+            stats.edge_connects++;
+            pthread_mutex_unlock(&cluster_mutex);
+            streaming = edge_request(watch, fd, owner);
+            if (streaming) {
+                edge_stream(watch, fd);
+            }
+            pthread_mutex_lock(&cluster_mutex);
+            watch->fd = -1;
+            pthread_mutex_unlock(&cluster_mutex);
+            close(fd);
+        }
+        if (!streaming) {
+            pthread_mutex_lock(&cluster_mutex);
+            stats.edge_failures++;
+            pthread_mutex_unlock(&cluster_mutex);
+        }
+        edge_sleep(watch, CLUSTER_EDGE_RETRY_MS);
+    }
+    pthread_mutex_lock(&cluster_mutex);
+    watch->finished = true;
+    pthread_mutex_unlock(&cluster_mutex);
+    return NULL;
+}
+
+/*
+ * On an edge, notes that a viewer wants the stream and starts pulling it
+ * from its owner unless that is already under way. False when this node is
+ * not an edge or already pulls PIPELINE_MAX_STREAMS other streams.
+ */
+bool cluster_edge_watch(const char *stream_id) {
+    if (!edge) {
+        return false;
+    }
+    pthread_mutex_lock(&cluster_mutex);
+    if (!atomic_load(&running)) {
+        pthread_mutex_unlock(&cluster_mutex);
+        return false;
+    }
+    EdgeWatch *free_watch = NULL;
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        EdgeWatch *watch = &watches[i];
+        if (watch->used && !watch->finished && strcmp(watch->stream_id, stream_id) == 0) {
+            atomic_store(&watch->viewed_ms, monotonic_ms());
+            pthread_mutex_unlock(&cluster_mutex);
+            return true;
+        }
+        if (watch->used && watch->finished) {
+            pthread_join(watch->thread, NULL);
+            watch->used = false;
+        }
+        if (!watch->used && free_watch == NULL) {
+            free_watch = watch;
+        }
+    }
+    bool ok = free_watch != NULL && strlen(stream_id) < sizeof(free_watch->stream_id);
+    if (ok) {
+        snprintf(free_watch->stream_id, sizeof(free_watch->stream_id), "%s", stream_id);
+        free_watch->finished = false;
+        free_watch->fd = -1;
+        atomic_store(&free_watch->viewed_ms, monotonic_ms());
+        ok = pthread_create(&free_watch->thread, NULL, edge_main, free_watch) == 0;
+        free_watch->used = ok;
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+    return ok;
+}
+
+static void release_resources(void) {
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    wake_fd = -1;
+    epoll_fd = -1;
+    node_count = 0;
+    ring_size = 0;
+    self_index = -1;
+    edge = false;
+}
+
+/*
+ * `self` is this node's address as written in `nodes`; a node not in the
+ * list (or no `self`) is an edge. Starts the relay thread in every mode.
+ */
+bool cluster_start(const ListenerSpec *nodes_in, size_t count, const ListenerSpec *self) {
+    if (count > CLUSTER_MAX_NODES) {
+        return false;
+    }
+    pthread_mutex_lock(&cluster_mutex);
+    if (atomic_load(&running)) {
+        pthread_mutex_unlock(&cluster_mutex);
+        return false;
+    }
+    node_count = count;
+    self_index = -1;
+    for (size_t i = 0; i < count; i++) {
+        nodes[i] = nodes_in[i];
+        if (self != NULL && listener_spec_equal(self, &nodes[i])) {
+            self_index = (int)i;
+        }
+    }
+    edge = count > 0 && self_index < 0;
+    build_ring();
+    memset(&stats, 0, sizeof(stats));
+    memset(watches, 0, sizeof(watches));
+    for (size_t i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS; i++) {
+        subscribers[i].fd = -1;
+        subscribers[i].sending = NULL;
+        subscribers[i].pending = NULL;
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = wake_fd >= 0 && epoll_fd >= 0;
+    if (ok) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = WAKE_TAG;
+        ok = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) == 0;
+    }
+    if (ok) {
+        atomic_store(&running, true);
+        thread_started = pthread_create(&relay_thread, NULL, relay_main, NULL) == 0;
+        ok = thread_started;
+        if (!ok) {
+            atomic_store(&running, false);
+        }
+    }
+    if (!ok) {
+        release_resources();
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+    return ok;
+}
+
+/* Ends every relay connection and edge pull; viewers and edges reconnect on their own. */
+void cluster_stop(void) {
+    pthread_mutex_lock(&cluster_mutex);
+    bool was_running = atomic_load(&running);
+    atomic_store(&running, false);
+    bool joinable = thread_started;
+    thread_started = false;
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        if (watches[i].used && watches[i].fd >= 0) {
+            shutdown(watches[i].fd, SHUT_RDWR);
+        }
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+    if (!was_running) {
+        return;
+    }
+
+    wake_relay();
+    if (joinable) {
+        pthread_join(relay_thread, NULL);
+    }
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        if (watches[i].used) {
+            pthread_join(watches[i].thread, NULL);
+            watches[i].used = false;
+        }
+    }
+    pthread_mutex_lock(&cluster_mutex);
+    for (size_t i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].fd >= 0) {
+            relay_close(&subscribers[i], false);
+        }
+    }
+    release_resources();
+    pthread_mutex_unlock(&cluster_mutex);
+}
+
+void cluster_stats(ClusterStats *out) {
+    pthread_mutex_lock(&cluster_mutex);
+    *out = stats;
+    out->nodes = node_count;
+    out->self = self_index;
+    out->edge = edge;
+    out->edge_streams = 0;
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        out->edge_streams += watches[i].used && !watches[i].finished ? 1 : 0;
+    }
+    pthread_mutex_unlock(&cluster_mutex);
+}
+
+/*
+ * With `stream_id` set, the object ends with "owner": the node that owns the
+ * stream, or null when there is no cluster. NULL leaves the field out.
+ */
+size_t cluster_format_stats_json(const ClusterStats *stats_in,
+                                 const char *stream_id,
+                                 char *out,
+                                 size_t capacity) {
+    const char *role = stats_in->nodes == 0 ? "standalone" : stats_in->edge ? "edge" : "origin";
+    char node[sizeof(((ListenerSpec *)0)->address) + 8];
+    char owner[sizeof(node) + 16] = "";
+    if (stream_id != NULL) {
+        bool clustered = cluster_format_node(cluster_owner(stream_id), node, sizeof(node)) > 0;
+        snprintf(owner, sizeof(owner), clustered ? ",\"owner\":\"%s\"" : ",\"owner\":null", node);
+    }
+    int n = snprintf(out, capacity,
+                     "{\"role\":\"%s\",\"nodes\":%zu,\"self\":%d,\"redirects\":%llu,"
+                     "\"relay\":{\"subscribers\":%zu,\"accepted\":%llu,\"rejected\":%llu,"
+                     "\"frames\":%llu,\"dropped_slow\":%llu,\"disconnected\":%llu},"
+                     "\"edge\":{\"streams\":%zu,\"connects\":%llu,\"failures\":%llu,"
+                     "\"frames\":%llu}%s}",
+                     role, stats_in->nodes, stats_in->self,
+                     (unsigned long long)stats_in->redirects, stats_in->relay_subscribers,
+                     (unsigned long long)stats_in->relay_accepted,
+                     (unsigned long long)stats_in->relay_rejected,
+                     (unsigned long long)stats_in->relay_frames,
+                     (unsigned long long)stats_in->relay_dropped_slow,
+                     (unsigned long long)stats_in->relay_disconnected, stats_in->edge_streams,
+                     (unsigned long long)stats_in->edge_connects,
+                     (unsigned long long)stats_in->edge_failures,
+                     (unsigned long long)stats_in->edge_frames, owner);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
@@ -0,0 +1,62 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "http.h"
+#include "listener.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Several processes sharing the cameras. Every origin node (`cluster_nodes`)
+ * owns the streams a consistent-hash ring assigns it; a request about a
+ * stream another origin owns is answered with a 307 to that node. A node
+ * whose `cluster_self` is not in the list is an edge: it owns nothing, pulls
+ * each stream its viewers ask for from the owner over one relay connection
+ * (`GET /api/frames/live`) and serves the frames from its own history.
+ */
+
+typedef struct {
+    size_t nodes;
+    int self;
+    bool edge;
+    uint64_t redirects;
+    size_t relay_subscribers;
+    uint64_t relay_accepted;
+    uint64_t relay_rejected;
+    uint64_t relay_frames;
+    uint64_t relay_dropped_slow;
+    uint64_t relay_disconnected;
+    size_t edge_streams;
+    uint64_t edge_connects;
+    uint64_t edge_failures;
+    uint64_t edge_frames;
+} ClusterStats;
+
+/* No nodes runs standalone: this process owns every stream but still relays. */
+bool cluster_start(const ListenerSpec *nodes, size_t node_count, const ListenerSpec *self);
+void cluster_stop(void);
+bool cluster_is_edge(void);
+
+int cluster_owner(const char *stream_id);
+size_t cluster_format_node(int index, char *out, size_t capacity);
+bool cluster_redirect_location(const char *stream_id,
+                               const HttpRequest *request,
+                               char *out,
+                               size_t capacity);
+
+bool cluster_relay_subscribe(int client_fd, const char *stream_id);
+void cluster_relay_publish(const char *stream_id,
+                           uint64_t time_ms,
+                           const unsigned char *data,
+                           size_t length);
+bool cluster_edge_watch(const char *stream_id);
+
+void cluster_stats(ClusterStats *out);
+size_t cluster_format_stats_json(const ClusterStats *stats,
+                                 const char *stream_id,
+                                 char *out,
+                                 size_t capacity);
+
+#endif
@@ -0,0 +1,1144 @@
+/* mincore(2), which reports how much of a mapped model is resident, is not POSIX. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "embedding.h"
+
+#include "nn_kernels.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define EMBEDDING_MAGIC "FEMB"
+#define EMBEDDING_VERSION_STREAM 1u
+#define EMBEDDING_VERSION 2u
+#define MODEL_ALIGNMENT 64
+#define ROW_GRAIN 8
+#define LD_ALIAS_FLOATS 64
+#define LD_PAD_FLOATS 16
+
+static const float landmark_template[FACE_LANDMARK_COUNT][2] = {
+    {38.2946f, 51.6963f},
+    {73.5318f, 51.5014f},
+    {56.0252f, 71.7366f},
+    {41.5493f, 92.3655f},
+    {70.7299f, 92.2041f},
+};
+#define LANDMARK_TEMPLATE_SIZE 112.0f
+
+typedef struct {
+    EmbeddingLayerSpec spec;
+    int in_channels;
+    int in_size;
+    int out_channels;
+    int out_size;
+    int pad;
+    size_t k;
+    size_t k_padded;
+    float *weights;
+    float *bias;
+    int8_t *qweights;
+    float *qscale;
+    int32_t *qrowsum;
+} EmbeddingLayer;
+
+struct EmbeddingModel {
+    int input_size;
+    int input_channels;
+    size_t layer_count;
+    EmbeddingLayer layers[EMBEDDING_MAX_LAYERS];
+    size_t dim;
+    size_t max_activation;
+    size_t max_col;
+    size_t max_colq;
+    size_t max_acc;
+    void *mapping;
+    size_t mapping_length;
+};
+
+/* Per-layer arrays of a packed model file, in the order they are stored. */
+enum {
+    SECTION_WEIGHTS,
+    SECTION_BIAS,
+    SECTION_QWEIGHTS,
+    SECTION_QSCALE,
+    SECTION_QROWSUM,
+    SECTION_COUNT,
+};
+
+/*
+ * Header of a packed (version 2) model file. The layer table repeats the
+ * five fields of version 1; every array the kernels read follows in its own
+ * 64-byte aligned section, int8 rows already padded to `int8_k_align`.
+ */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t input_size;
+    uint32_t input_channels;
+    uint32_t layer_count;
+    uint32_t layers[EMBEDDING_MAX_LAYERS][5];
+    uint32_t int8_k_align;
+    uint64_t file_length;
+    uint64_t section_offsets[EMBEDDING_MAX_LAYERS][SECTION_COUNT];
+} PackedModelHeader;
+
+struct EmbeddingWorkspace {
+    size_t batch_capacity;
+    size_t input_count;
+    float *input;
+    float *activation[2];
+    float *col;
+    uint8_t *colq;
+    uint8_t *quantized;
+    int32_t *acc;
+    float *in_scales;
+    int *zero_points;
+};
+
+/*
+ * A batch of B faces is laid out channel-major with the samples side by
+ * side: channel c of sample b starts at c * (B * area) + b * area. Each
+ * convolution then becomes one GEMM with B times as many columns, which
+ * keeps the weight rows hot in cache across the whole batch.
+ */
+typedef struct {
+    const float *data;
+    size_t sample_stride;
+    size_t channel_stride;
+} ActivationView;
+
+typedef struct {
+    const EmbeddingLayer *layer;
+    const float *col;
+    const uint8_t *colq;
+    int32_t *acc;
+    float *out;
+    size_t n;
+    size_t batch;
+    size_t ld;
+    const float *in_scales;
+    const int *zero_points;
+} LayerTask;
+
+EmbeddingSpec embedding_default_spec(void) {
+    EmbeddingSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.input_size = 64;
+    spec.input_channels = 1;
+    spec.layer_count = 6;
+    spec.layers[0] = (EmbeddingLayerSpec){EMBEDDING_LAYER_CONV, 16, 3, 2, true};
+    spec.layers[1] = (EmbeddingLayerSpec){EMBEDDING_LAYER_CONV, 32, 3, 2, true};
+    spec.layers[2] = (EmbeddingLayerSpec){EMBEDDING_LAYER_CONV, 64, 3, 2, true};
+    spec.layers[3] = (EmbeddingLayerSpec){EMBEDDING_LAYER_CONV, 128, 3, 1, true};
+    spec.layers[4] = (EmbeddingLayerSpec){EMBEDDING_LAYER_GLOBAL_POOL, 0, 0, 0, false};
+    spec.layers[5] = (EmbeddingLayerSpec){EMBEDDING_LAYER_DENSE, 128, 0, 0, false};
+    return spec;
+}
+
+static size_t max_size(size_t a, size_t b) {
+    return a > b ? a : b;
+}
+
+static bool configure_layers(EmbeddingModel *model) {
+    if (model->input_size < 4 || model->input_size > 512 ||
+        (model->input_channels != 1 && model->input_channels != 3) || model->layer_count == 0 ||
+        model->layer_count > EMBEDDING_MAX_LAYERS) {
+        return false;
+    }
+
+    int channels = model->input_channels;
+    int size = model->input_size;
+    model->max_activation = (size_t)channels * (size_t)size * (size_t)size;
+    model->max_col = 0;
+    model->max_colq = 0;
+    model->max_acc = 0;
+
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        EmbeddingLayerSpec *spec = &layer->spec;
+        layer->in_channels = channels;
+        layer->in_size = size;
+
+        switch (spec->type) {
+        case EMBEDDING_LAYER_CONV:
+            if (spec->kernel < 1 || spec->kernel % 2 == 0 || spec->kernel > 7 || spec->stride < 1 ||
+                spec->out_channels < 1 || spec->out_channels > 1024) {
+                return false;
+            }
+            layer->pad = spec->kernel / 2;
+            layer->out_channels = spec->out_channels;
+            layer->out_size = (size + 2 * layer->pad - spec->kernel) / spec->stride + 1;
+            layer->k = (size_t)channels * (size_t)spec->kernel * (size_t)spec->kernel;
+            break;
+        case EMBEDDING_LAYER_DENSE:
+            if (spec->out_channels < 1 || spec->out_channels > 4096) {
+                return false;
+            }
+            spec->kernel = size;
+            spec->stride = 1;
+            layer->pad = 0;
+            layer->out_channels = spec->out_channels;
+            layer->out_size = 1;
+            layer->k = (size_t)channels * (size_t)size * (size_t)size;
+            break;
+        case EMBEDDING_LAYER_GLOBAL_POOL:
+            spec->out_channels = channels;
+            spec->kernel = 0;
+            spec->stride = 0;
+            layer->pad = 0;
+            layer->out_channels = channels;
+            layer->out_size = 1;
+            layer->k = 0;
+            break;
+        default:
+            return false;
+        }
+
+        if (layer->out_size < 1) {
+            return false;
+        }
+
+        size_t n = (size_t)layer->out_size * (size_t)layer->out_size;
+        layer->k_padded = nn_int8_padded_k(layer->k);
+        model->max_col = max_size(model->max_col, layer->k * n);
+        model->max_colq = max_size(model->max_colq, layer->k_padded * n);
+        model->max_acc = max_size(model->max_acc, (size_t)layer->out_channels * n);
+        model->max_activation = max_size(model->max_activation, (size_t)layer->out_channels * n);
+
+        channels = layer->out_channels;
+        size = layer->out_size;
+    }
+
+    model->dim = (size_t)channels * (size_t)size * (size_t)size;
+    return model->dim > 0 && model->dim <= EMBEDDING_MAX_DIM;
+}
+
+static bool layer_has_weights(const EmbeddingLayer *layer) {
+    return layer->spec.type == EMBEDDING_LAYER_CONV || layer->spec.type == EMBEDDING_LAYER_DENSE;
+}
+
+static bool allocate_weights(EmbeddingModel *model) {
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        size_t rows = (size_t)layer->out_channels;
+        layer->weights = (float *)calloc(rows * layer->k, sizeof(float));
+        layer->bias = (float *)calloc(rows, sizeof(float));
+        layer->qweights = (int8_t *)aligned_alloc(NN_INT8_K_ALIGN, rows * layer->k_padded);
+        layer->qscale = (float *)calloc(rows, sizeof(float));
+        layer->qrowsum = (int32_t *)calloc(rows, sizeof(int32_t));
+        if (layer->weights == NULL || layer->bias == NULL || layer->qweights == NULL ||
+            layer->qscale == NULL || layer->qrowsum == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void quantize_weights(EmbeddingModel *model) {
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        for (int row = 0; row < layer->out_channels; row++) {
+            const float *w = layer->weights + (size_t)row * layer->k;
+            int8_t *q = layer->qweights + (size_t)row * layer->k_padded;
+            float max_abs = 0.0f;
+            for (size_t k = 0; k < layer->k; k++) {
+                float v = fabsf(w[k]);
+                if (v > max_abs) {
+                    max_abs = v;
+                }
+            }
+            float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+            int32_t rowsum = 0;
+            for (size_t k = 0; k < layer->k; k++) {
+                long v = lroundf(w[k] / scale);
+                if (v > 127) {
+                    v = 127;
+                } else if (v < -127) {
+                    v = -127;
+                }
+                q[k] = (int8_t)v;
+                rowsum += (int32_t)v;
+            }
+            memset(q + layer->k, 0, layer->k_padded - layer->k);
+            layer->qscale[row] = scale;
+            layer->qrowsum[row] = rowsum;
+        }
+    }
+}
+
+void embedding_model_free(EmbeddingModel *model) {
+    if (model == NULL) {
+        return;
+    }
+    if (model->mapping != NULL) {
+        munmap(model->mapping, model->mapping_length);
+        free(model);
+        return;
+    }
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        free(layer->weights);
+        free(layer->bias);
+        free(layer->qweights);
+        free(layer->qscale);
+        free(layer->qrowsum);
+    }
+    free(model);
+}
+
+/* Lays out a model for `spec`; weight arrays are allocated only when `allocate`. */
+static EmbeddingModel *model_from_spec(const EmbeddingSpec *spec, bool allocate) {
+    EmbeddingModel *model = (EmbeddingModel *)calloc(1, sizeof(*model));
+    if (model == NULL) {
+        return NULL;
+    }
+    model->input_size = spec->input_size;
+    model->input_channels = spec->input_channels;
+    model->layer_count = spec->layer_count;
+    if (spec->layer_count > EMBEDDING_MAX_LAYERS) {
+        free(model);
+        return NULL;
+    }
+    for (size_t i = 0; i < spec->layer_count; i++) {
+        model->layers[i].spec = spec->layers[i];
+    }
+    if (!configure_layers(model)) {
+        model->layer_count = 0;
+        free(model);
+        return NULL;
+    }
+    if (allocate && !allocate_weights(model)) {
+        embedding_model_free(model);
+        return NULL;
+    }
+    return model;
+}
+
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static float random_uniform(uint32_t *state) {
+    return (float)(next_random(state) >> 8) / 16777216.0f * 2.0f - 1.0f;
+}
+
+EmbeddingModel *embedding_model_create_random(const EmbeddingSpec *spec, uint32_t seed) {
+    EmbeddingModel *model = model_from_spec(spec, true);
+    if (model == NULL) {
+        return NULL;
+    }
+
+    uint32_t state = seed != 0 ? seed : 0x9E3779B9u;
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        float limit = sqrtf(6.0f / (float)layer->k);
+        size_t count = (size_t)layer->out_channels * layer->k;
+        for (size_t w = 0; w < count; w++) {
+            layer->weights[w] = random_uniform(&state) * limit;
+        }
+        for (int b = 0; b < layer->out_channels; b++) {
+            layer->bias[b] = random_uniform(&state) * 0.01f;
+        }
+    }
+    quantize_weights(model);
+    return model;
+}
+
+static bool read_u32(FILE *file, uint32_t *value) {
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void section_lengths(const EmbeddingLayer *layer, size_t lengths[SECTION_COUNT]) {
+    size_t rows = (size_t)layer->out_channels;
+    lengths[SECTION_WEIGHTS] = rows * layer->k * sizeof(float);
+    lengths[SECTION_BIAS] = rows * sizeof(float);
+    lengths[SECTION_QWEIGHTS] = rows * layer->k_padded;
+    lengths[SECTION_QSCALE] = rows * sizeof(float);
+    lengths[SECTION_QROWSUM] = rows * sizeof(int32_t);
+}
+
+static bool write_section(FILE *file, const void *data, size_t length, uint64_t *offset) {
+    static const unsigned char zeros[MODEL_ALIGNMENT];
+    size_t padding = align_up(*offset, MODEL_ALIGNMENT) - *offset;
+    if (padding > 0 && fwrite(zeros, 1, padding, file) != padding) {
+        return false;
+    }
+    *offset += padding;
+    if (length > 0 && fwrite(data, 1, length, file) != length) {
+        return false;
+    }
+    *offset += length;
+    return true;
+}
+
+/*
+ * Writes the packed layout: a PackedModelHeader, then each conv/dense layer's
+ * float weights, biases, int8 weights, scales and row sums, one 64-byte
+ * aligned section each, in host byte order. Written to "<path>.tmp" and
+ * renamed over `path`, so a server that has the old file mapped keeps
+ * reading intact pages.
+ */
+bool embedding_model_save(const EmbeddingModel *model, const char *path) {
+    char tmp_path[4096];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        return false;
+    }
+
+    PackedModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EMBEDDING_MAGIC, sizeof(header.magic));
+    header.version = EMBEDDING_VERSION;
+    header.input_size = (uint32_t)model->input_size;
+    header.input_channels = (uint32_t)model->input_channels;
+    header.layer_count = (uint32_t)model->layer_count;
+    header.int8_k_align = NN_INT8_K_ALIGN;
+    uint64_t offset = sizeof(header);
+    for (size_t i = 0; i < model->layer_count; i++) {
+        const EmbeddingLayer *layer = &model->layers[i];
+        header.layers[i][0] = (uint32_t)layer->spec.type;
+        header.layers[i][1] = (uint32_t)layer->spec.out_channels;
+        header.layers[i][2] = (uint32_t)layer->spec.kernel;
+        header.layers[i][3] = (uint32_t)layer->spec.stride;
+        header.layers[i][4] = layer->spec.relu ? 1u : 0u;
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        size_t lengths[SECTION_COUNT];
+        section_lengths(layer, lengths);
+        for (int s = 0; s < SECTION_COUNT; s++) {
+            offset = align_up(offset, MODEL_ALIGNMENT);
+            header.section_offsets[i][s] = offset;
+            offset += lengths[s];
+        }
+    }
+    header.file_length = offset;
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    offset = sizeof(header);
+    for (size_t i = 0; ok && i < model->layer_count; i++) {
+        const EmbeddingLayer *layer = &model->layers[i];
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        const void *data[SECTION_COUNT] = {layer->weights, layer->bias, layer->qweights,
+                                           layer->qscale, layer->qrowsum};
+        size_t lengths[SECTION_COUNT];
+        section_lengths(layer, lengths);
+        for (int s = 0; ok && s < SECTION_COUNT; s++) {
+            ok = write_section(file, data[s], lengths[s], &offset);
+        }
+    }
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+static bool section_fits(const PackedModelHeader *header,
+                         size_t layer,
+                         int section,
+                         size_t length) {
+    uint64_t offset = header->section_offsets[layer][section];
+    return offset % MODEL_ALIGNMENT == 0 && offset <= header->file_length &&
+           length <= header->file_length - offset;
+}
+
+/*
+ * Maps a packed model read-only and shared: the layer arrays point into the
+ * mapping, so loading costs one mmap() and every process serving the same
+ * file shares one copy of the weights in the page cache. Pages fault in as
+ * the first forward passes touch them unless embedding_model_prewarm() runs.
+ */
+static EmbeddingModel *map_packed(int fd, const char *path) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PackedModelHeader)) {
+        fprintf(stderr, "Invalid embedding model header: %s\n", path);
+        return NULL;
+    }
+    size_t length = (size_t)st.st_size;
+    void *mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const PackedModelHeader *header = (const PackedModelHeader *)mapping;
+    EmbeddingSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.input_size = (int)header->input_size;
+    spec.input_channels = (int)header->input_channels;
+    spec.layer_count = header->layer_count;
+    bool valid = header->file_length == length && header->int8_k_align == NN_INT8_K_ALIGN &&
+                 header->layer_count > 0 && header->layer_count <= EMBEDDING_MAX_LAYERS;
+    for (size_t i = 0; valid && i < spec.layer_count; i++) {
+        spec.layers[i].type = (EmbeddingLayerType)header->layers[i][0];
+        spec.layers[i].out_channels = (int)header->layers[i][1];
+        spec.layers[i].kernel = (int)header->layers[i][2];
+        spec.layers[i].stride = (int)header->layers[i][3];
+        spec.layers[i].relu = header->layers[i][4] != 0;
+    }
+    EmbeddingModel *model = valid ? model_from_spec(&spec, false) : NULL;
+    if (model == NULL) {
+        fprintf(stderr, "Invalid embedding model layout: %s\n", path);
+        munmap(mapping, length);
+        return NULL;
+    }
+    model->mapping = mapping;
+    model->mapping_length = length;
+
+    unsigned char *base = (unsigned char *)mapping;
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        size_t lengths[SECTION_COUNT];
+        section_lengths(layer, lengths);
+        for (int s = 0; s < SECTION_COUNT; s++) {
+            if (!section_fits(header, i, s, lengths[s])) {
+                fprintf(stderr, "Truncated embedding model: %s\n", path);
+                embedding_model_free(model);
+                return NULL;
+            }
+        }
+        const uint64_t *offsets = header->section_offsets[i];
+        layer->weights = (float *)(base + offsets[SECTION_WEIGHTS]);
+        layer->bias = (float *)(base + offsets[SECTION_BIAS]);
+        layer->qweights = (int8_t *)(base + offsets[SECTION_QWEIGHTS]);
+        layer->qscale = (float *)(base + offsets[SECTION_QSCALE]);
+        layer->qrowsum = (int32_t *)(base + offsets[SECTION_QROWSUM]);
+    }
+    return model;
+}
+
+/* Reads a version 1 file, which stores float weights only, and quantises them. */
+static EmbeddingModel *read_stream(FILE *file, const char *path) {
+    uint32_t input_size = 0;
+    uint32_t input_channels = 0;
+    uint32_t layer_count = 0;
+    if (!read_u32(file, &input_size) || !read_u32(file, &input_channels) ||
+        !read_u32(file, &layer_count) || layer_count == 0 ||
+        layer_count > EMBEDDING_MAX_LAYERS) {
+        fprintf(stderr, "Invalid embedding model header: %s\n", path);
+        return NULL;
+    }
+
+    EmbeddingSpec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.input_size = (int)input_size;
+    spec.input_channels = (int)input_channels;
+    spec.layer_count = layer_count;
+
+    for (size_t i = 0; i < layer_count; i++) {
+        uint32_t fields[5];
+        for (int f = 0; f < 5; f++) {
+            if (!read_u32(file, &fields[f])) {
+                return NULL;
+            }
+        }
+        spec.layers[i].type = (EmbeddingLayerType)fields[0];
+        spec.layers[i].out_channels = (int)fields[1];
+        spec.layers[i].kernel = (int)fields[2];
+        spec.layers[i].stride = (int)fields[3];
+        spec.layers[i].relu = fields[4] != 0;
+    }
+
+    EmbeddingModel *model = model_from_spec(&spec, true);
+    if (model == NULL) {
+        fprintf(stderr, "Invalid embedding model layout: %s\n", path);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < model->layer_count; i++) {
+        EmbeddingLayer *layer = &model->layers[i];
+        if (!layer_has_weights(layer)) {
+            continue;
+        }
+        size_t count = (size_t)layer->out_channels * layer->k;
+        if (fread(layer->weights, sizeof(float), count, file) != count ||
+            fread(layer->bias, sizeof(float), (size_t)layer->out_channels, file) !=
+                (size_t)layer->out_channels) {
+            fprintf(stderr, "Truncated embedding model: %s\n", path);
+            embedding_model_free(model);
+            return NULL;
+        }
+    }
+    quantize_weights(model);
+    return model;
+}
+
+EmbeddingModel *embedding_model_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    char magic[4];
+    uint32_t version = 0;
+    EmbeddingModel *model = NULL;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, EMBEDDING_MAGIC, 4) != 0 ||
+        !read_u32(file, &version)) {
+        fprintf(stderr, "Invalid embedding model header: %s\n", path);
+    } else if (version == EMBEDDING_VERSION) {
+        model = map_packed(fileno(file), path);
+    } else if (version == EMBEDDING_VERSION_STREAM) {
+        model = read_stream(file, path);
+    } else {
+        fprintf(stderr, "Unsupported embedding model version %u: %s\n", version, path);
+    }
+    fclose(file);
+    return model;
+}
+
+size_t embedding_model_mapped_bytes(const EmbeddingModel *model) {
+    return model->mapping != NULL ? model->mapping_length : 0;
+}
+
+/*
+ * Faults in every page of a mapped model: MADV_WILLNEED starts readahead of
+ * the whole file, then one read per page waits for it. This is what
+ * MAP_POPULATE would do inside mmap(), but it can run on a thread of its own
+ * after the server is listening. Returns the bytes touched, 0 for a model
+ * that lives on the heap.
+ */
+size_t embedding_model_prewarm(const EmbeddingModel *model) {
+    if (model->mapping == NULL) {
+        return 0;
+    }
+    madvise(model->mapping, model->mapping_length, MADV_WILLNEED);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const volatile unsigned char *bytes = (const volatile unsigned char *)model->mapping;
+    for (size_t offset = 0; offset < model->mapping_length; offset += page) {
+        (void)bytes[offset];
+    }
+    return model->mapping_length;
+}
+
+/* Bytes of a mapped model in memory right now, from mincore(2). */
+size_t embedding_model_resident_bytes(const EmbeddingModel *model) {
+    if (model->mapping == NULL) {
+        return 0;
+    }
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = (model->mapping_length + page - 1) / page;
+    unsigned char *resident = (unsigned char *)malloc(pages);
+    if (resident == NULL || mincore(model->mapping, model->mapping_length, resident) != 0) {
+        free(resident);
+        return 0;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < pages; i++) {
+        count += resident[i] & 1u;
+    }
+    free(resident);
+    size_t bytes = count * page;
+    return bytes < model->mapping_length ? bytes : model->mapping_length;
+}
+
+size_t embedding_model_dim(const EmbeddingModel *model) {
+    return model->dim;
+}
+
+int embedding_model_input_size(const EmbeddingModel *model) {
+    return model->input_size;
+}
+
+int embedding_model_input_channels(const EmbeddingModel *model) {
+    return model->input_channels;
+}
+
+void embedding_workspace_free(EmbeddingWorkspace *workspace) {
+    if (workspace == NULL) {
+        return;
+    }
+    free(workspace->input);
+    free(workspace->activation[0]);
+    free(workspace->activation[1]);
+    free(workspace->col);
+    free(workspace->colq);
+    free(workspace->quantized);
+    free(workspace->acc);
+    free(workspace->in_scales);
+    free(workspace->zero_points);
+    free(workspace);
+}
+
+/*
+ * Row stride for a layer's batch-wide matrices. Strides that are a multiple
+ * of 256 bytes map every row of the im2col panel onto the same few cache
+ * sets, which throttles the GEMM once batching makes the rows long, so such
+ * strides get one cache line of padding.
+ */
+static size_t batch_ld(size_t columns) {
+    return columns % LD_ALIAS_FLOATS == 0 ? columns + LD_PAD_FLOATS : columns;
+}
+
+EmbeddingWorkspace *embedding_workspace_create_batch(const EmbeddingModel *model,
+                                                     size_t max_batch) {
+    if (model == NULL || max_batch == 0 || max_batch > EMBEDDING_MAX_BATCH) {
+        return NULL;
+    }
+    EmbeddingWorkspace *workspace = (EmbeddingWorkspace *)calloc(1, sizeof(*workspace));
+    if (workspace == NULL) {
+        return NULL;
+    }
+    size_t colq_bytes = nn_int8_padded_k(model->max_colq > 0 ? model->max_colq : 1) * max_batch;
+    workspace->batch_capacity = max_batch;
+    workspace->input_count = (size_t)model->input_channels * (size_t)model->input_size *
+                             (size_t)model->input_size;
+
+    /* Worst case over every batch size up to max_batch, since the stride padding varies. */
+    size_t activation = model->max_activation * max_batch;
+    size_t col = max_size(model->max_col, 1) * max_batch;
+    for (size_t batch = 1; batch <= max_batch; batch++) {
+        for (size_t i = 0; i < model->layer_count; i++) {
+            const EmbeddingLayer *layer = &model->layers[i];
+            size_t ld = batch_ld((size_t)layer->out_size * (size_t)layer->out_size * batch);
+            activation = max_size(activation, (size_t)layer->out_channels * ld);
+            col = max_size(col, layer->k * ld);
+        }
+    }
+    workspace->input = (float *)malloc(workspace->input_count * max_batch * sizeof(float));
+    workspace->activation[0] = (float *)malloc(activation * sizeof(float));
+    workspace->activation[1] = (float *)malloc(activation * sizeof(float));
+    workspace->col = (float *)malloc(col * sizeof(float));
+    workspace->colq = (uint8_t *)aligned_alloc(NN_INT8_K_ALIGN, colq_bytes);
+    workspace->quantized = (uint8_t *)malloc(max_size(activation, workspace->input_count * max_batch));
+    workspace->acc = (int32_t *)malloc(activation * sizeof(int32_t));
+    workspace->in_scales = (float *)malloc(max_batch * sizeof(float));
+    workspace->zero_points = (int *)malloc(max_batch * sizeof(int));
+    if (workspace->input == NULL || workspace->activation[0] == NULL ||
+        workspace->activation[1] == NULL ||
+        workspace->col == NULL || workspace->colq == NULL || workspace->quantized == NULL ||
+        workspace->acc == NULL || workspace->in_scales == NULL || workspace->zero_points == NULL) {
+        embedding_workspace_free(workspace);
+        return NULL;
+    }
+    return workspace;
+}
+
+EmbeddingWorkspace *embedding_workspace_create(const EmbeddingModel *model) {
+    return embedding_workspace_create_batch(model, 1);
+}
+
+size_t embedding_workspace_batch_capacity(const EmbeddingWorkspace *workspace) {
+    return workspace != NULL ? workspace->batch_capacity : 0;
+}
+
+float *embedding_workspace_input(EmbeddingWorkspace *workspace, size_t index) {
+    if (workspace == NULL || index >= workspace->batch_capacity) {
+        return NULL;
+    }
+    return workspace->input + index * workspace->input_count;
+}
+
+static const float *view_plane(const ActivationView *view, size_t sample, int channel) {
+    return view->data + sample * view->sample_stride + (size_t)channel * view->channel_stride;
+}
+
+/* Writes sample `sample` into columns [sample * n, (sample + 1) * n) of a K x (batch * n) matrix. */
+static void im2col_f32(const EmbeddingLayer *layer,
+                       const ActivationView *in,
+                       size_t sample,
+                       size_t ld,
+                       float *col) {
+    int kernel = layer->spec.kernel;
+    int stride = layer->spec.stride;
+    int in_size = layer->in_size;
+    int out_size = layer->out_size;
+    size_t n = (size_t)out_size * (size_t)out_size;
+
+    for (int c = 0; c < layer->in_channels; c++) {
+        const float *plane = view_plane(in, sample, c);
+        for (int ky = 0; ky < kernel; ky++) {
+            for (int kx = 0; kx < kernel; kx++) {
+                float *row = col + ((size_t)(c * kernel + ky) * (size_t)kernel + (size_t)kx) * ld +
+                             sample * n;
+                for (int oy = 0; oy < out_size; oy++) {
+                    int iy = oy * stride - layer->pad + ky;
+                    for (int ox = 0; ox < out_size; ox++) {
+                        int ix = ox * stride - layer->pad + kx;
+                        bool inside = iy >= 0 && iy < in_size && ix >= 0 && ix < in_size;
+                        row[oy * out_size + ox] =
+                            inside ? plane[(size_t)iy * (size_t)in_size + (size_t)ix] : 0.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Quantized activations share the float layout, so `plane` offsets apply to both. */
+static void im2col_u8_transposed(const EmbeddingLayer *layer,
+                                 const uint8_t *in,
+                                 const ActivationView *view,
+                                 size_t sample,
+                                 uint8_t zero_point,
+                                 uint8_t *colq) {
+    int kernel = layer->spec.kernel;
+    int stride = layer->spec.stride;
+    int in_size = layer->in_size;
+    int out_size = layer->out_size;
+    size_t n = (size_t)out_size * (size_t)out_size;
+
+    for (int oy = 0; oy < out_size; oy++) {
+        for (int ox = 0; ox < out_size; ox++) {
+            uint8_t *row = colq + (sample * n + (size_t)(oy * out_size + ox)) * layer->k_padded;
+            size_t idx = 0;
+            for (int c = 0; c < layer->in_channels; c++) {
+                const uint8_t *plane = in + (view_plane(view, sample, c) - view->data);
+                for (int ky = 0; ky < kernel; ky++) {
+                    int iy = oy * stride - layer->pad + ky;
+                    for (int kx = 0; kx < kernel; kx++) {
+                        int ix = ox * stride - layer->pad + kx;
+                        bool inside = iy >= 0 && iy < in_size && ix >= 0 && ix < in_size;
+                        row[idx++] =
+                            inside ? plane[(size_t)iy * (size_t)in_size + (size_t)ix] : zero_point;
+                    }
+                }
+            }
+            memset(row + idx, 0, layer->k_padded - idx);
+        }
+    }
+}
+
+/* Per-sample dynamic quantization, so batching never changes a face's result. */
+static void quantize_activations(const EmbeddingLayer *layer,
+                                 const ActivationView *view,
+                                 size_t sample,
+                                 uint8_t *out,
+                                 float *scale_out,
+                                 int *zero_point_out) {
+    size_t area = (size_t)layer->in_size * (size_t)layer->in_size;
+    float lo = 0.0f;
+    float hi = 0.0f;
+    for (int c = 0; c < layer->in_channels; c++) {
+        const float *plane = view_plane(view, sample, c);
+        for (size_t i = 0; i < area; i++) {
+            if (plane[i] < lo) {
+                lo = plane[i];
+            }
+            if (plane[i] > hi) {
+                hi = plane[i];
+            }
+        }
+    }
+    float scale = hi > lo ? (hi - lo) / 255.0f : 1.0f;
+    long zero_point = lroundf(-lo / scale);
+    if (zero_point < 0) {
+        zero_point = 0;
+    } else if (zero_point > 255) {
+        zero_point = 255;
+    }
+    float inv_scale = 1.0f / scale;
+    for (int c = 0; c < layer->in_channels; c++) {
+        const float *plane = view_plane(view, sample, c);
+        uint8_t *q = out + (plane - view->data);
+        for (size_t i = 0; i < area; i++) {
+            long v = lroundf(plane[i] * inv_scale) + zero_point;
+            q[i] = (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+    *scale_out = scale;
+    *zero_point_out = (int)zero_point;
+}
+
+static void finish_rows_f32(const EmbeddingLayer *layer,
+                            float *out,
+                            size_t n,
+                            size_t ld,
+                            size_t begin,
+                            size_t end) {
+    for (size_t row = begin; row < end; row++) {
+        float bias = layer->bias[row];
+        float *values = out + row * ld;
+        for (size_t j = 0; j < n; j++) {
+            float v = values[j] + bias;
+            values[j] = (layer->spec.relu && v < 0.0f) ? 0.0f : v;
+        }
+    }
+}
+
+static void conv_rows_f32(size_t begin, size_t end, void *arg) {
+    LayerTask *task = (LayerTask *)arg;
+    const EmbeddingLayer *layer = task->layer;
+    size_t columns = task->n * task->batch;
+    nn_gemm_f32(end - begin, columns, layer->k, layer->weights + begin * layer->k, layer->k,
+                task->col, task->ld, task->out + begin * task->ld, task->ld);
+    finish_rows_f32(layer, task->out, columns, task->ld, begin, end);
+}
+
+static void conv_rows_int8(size_t begin, size_t end, void *arg) {
+    LayerTask *task = (LayerTask *)arg;
+    const EmbeddingLayer *layer = task->layer;
+    size_t columns = task->n * task->batch;
+    nn_gemm_u8s8(end - begin, columns, layer->k_padded, layer->qweights + begin * layer->k_padded,
+                 task->colq, task->acc + begin * task->ld, task->ld);
+
+    for (size_t row = begin; row < end; row++) {
+        float bias = layer->bias[row];
+        for (size_t b = 0; b < task->batch; b++) {
+            float scale = layer->qscale[row] * task->in_scales[b];
+            int32_t correction = task->zero_points[b] * layer->qrowsum[row];
+            const int32_t *acc = task->acc + row * task->ld + b * task->n;
+            float *values = task->out + row * task->ld + b * task->n;
+            for (size_t j = 0; j < task->n; j++) {
+                float v = (float)(acc[j] - correction) * scale + bias;
+                values[j] = (layer->spec.relu && v < 0.0f) ? 0.0f : v;
+            }
+        }
+    }
+}
+
+static void run_global_pool(const EmbeddingLayer *layer,
+                            const ActivationView *in,
+                            size_t batch,
+                            float *out) {
+    size_t area = (size_t)layer->in_size * (size_t)layer->in_size;
+    for (int c = 0; c < layer->in_channels; c++) {
+        for (size_t b = 0; b < batch; b++) {
+            const float *plane = view_plane(in, b, c);
+            double sum = 0.0;
+            for (size_t i = 0; i < area; i++) {
+                sum += plane[i];
+            }
+            float v = (float)(sum / (double)area);
+            out[(size_t)c * batch + b] = (layer->spec.relu && v < 0.0f) ? 0.0f : v;
+        }
+    }
+}
+
+bool embedding_forward_batch(const EmbeddingModel *model,
+                             EmbeddingPrecision precision,
+                             const float *inputs,
+                             size_t count,
+                             EmbeddingWorkspace *workspace,
+                             ThreadPool *pool,
+                             float *out,
+                             bool *valid) {
+    if (model == NULL || inputs == NULL || workspace == NULL || out == NULL || count == 0 ||
+        count > workspace->batch_capacity) {
+        return false;
+    }
+
+    size_t input_area = (size_t)model->input_size * (size_t)model->input_size;
+    ActivationView current = {inputs, workspace->input_count, input_area};
+    int target = 0;
+    for (size_t i = 0; i < model->layer_count; i++) {
+        const EmbeddingLayer *layer = &model->layers[i];
+        float *next = workspace->activation[target];
+        size_t n = (size_t)layer->out_size * (size_t)layer->out_size;
+        size_t ld = n * count;
+
+        if (layer->spec.type == EMBEDDING_LAYER_GLOBAL_POOL) {
+            run_global_pool(layer, &current, count, next);
+        } else {
+            ld = batch_ld(n * count);
+            LayerTask task;
+            memset(&task, 0, sizeof(task));
+            task.layer = layer;
+            task.out = next;
+            task.n = n;
+            task.batch = count;
+            task.ld = ld;
+            if (precision == EMBEDDING_PRECISION_INT8) {
+                for (size_t b = 0; b < count; b++) {
+                    quantize_activations(layer, &current, b, workspace->quantized,
+                                         &workspace->in_scales[b], &workspace->zero_points[b]);
+                    im2col_u8_transposed(layer, workspace->quantized, &current, b,
+                                         (uint8_t)workspace->zero_points[b], workspace->colq);
+                }
+                task.colq = workspace->colq;
+                task.acc = workspace->acc;
+                task.in_scales = workspace->in_scales;
+                task.zero_points = workspace->zero_points;
+                thread_pool_parallel_for(pool, (size_t)layer->out_channels, ROW_GRAIN,
+                                         conv_rows_int8, &task);
+            } else {
+                for (size_t b = 0; b < count; b++) {
+                    im2col_f32(layer, &current, b, ld, workspace->col);
+                }
+                task.col = workspace->col;
+                thread_pool_parallel_for(pool, (size_t)layer->out_channels, ROW_GRAIN,
+                                         conv_rows_f32, &task);
+            }
+        }
+
+        current.data = next;
+        current.sample_stride = n;
+        current.channel_stride = ld;
+        target ^= 1;
+    }
+
+    bool all_valid = true;
+    size_t area = current.sample_stride;
+    for (size_t b = 0; b < count; b++) {
+        float *vector = out + b * model->dim;
+        size_t idx = 0;
+        for (size_t c = 0; c < model->dim / area; c++) {
+            const float *plane = view_plane(&current, b, (int)c);
+            for (size_t i = 0; i < area; i++) {
+                vector[idx++] = plane[i];
+            }
+        }
+
+        double norm = 0.0;
+        for (size_t i = 0; i < model->dim; i++) {
+            norm += (double)vector[i] * vector[i];
+        }
+        float inv = norm > 0.0 ? (float)(1.0 / sqrt(norm)) : 0.0f;
+        for (size_t i = 0; i < model->dim; i++) {
+            vector[i] *= inv;
+        }
+        if (valid != NULL) {
+            valid[b] = norm > 0.0;
+        }
+        all_valid = all_valid && norm > 0.0;
+    }
+    return all_valid;
+}
+
+bool embedding_forward(const EmbeddingModel *model,
+                       EmbeddingPrecision precision,
+                       const float *input,
+                       EmbeddingWorkspace *workspace,
+                       ThreadPool *pool,
+                       float *out) {
+    return embedding_forward_batch(model, precision, input, 1, workspace, pool, out, NULL);
+}
+
+FaceLandmarks face_landmarks_from_box(const FaceBox *box) {
+    FaceLandmarks landmarks;
+    for (int i = 0; i < FACE_LANDMARK_COUNT; i++) {
+        landmarks.x[i] = (float)box->x +
+                         landmark_template[i][0] / LANDMARK_TEMPLATE_SIZE * (float)box->width;
+        landmarks.y[i] = (float)box->y +
+                         landmark_template[i][1] / LANDMARK_TEMPLATE_SIZE * (float)box->height;
+    }
+    return landmarks;
+}
+
+static float sample_bilinear(const uint8_t *plane, int width, int height, size_t stride, float x, float y) {
+    if (x < 0.0f || y < 0.0f || x > (float)(width - 1) || y > (float)(height - 1)) {
+        return 128.0f;
+    }
+    int x0 = (int)x;
+    int y0 = (int)y;
+    int x1 = x0 + 1 < width ? x0 + 1 : x0;
+    int y1 = y0 + 1 < height ? y0 + 1 : y0;
+    float fx = x - (float)x0;
+    float fy = y - (float)y0;
+    const uint8_t *r0 = plane + (size_t)y0 * stride;
+    const uint8_t *r1 = plane + (size_t)y1 * stride;
+    float top = (float)r0[x0] + ((float)r0[x1] - (float)r0[x0]) * fx;
+    float bottom = (float)r1[x0] + ((float)r1[x1] - (float)r1[x0]) * fx;
+    return top + (bottom - top) * fy;
+}
+
+void face_align_crop(const ImageBuffer *image,
+                     const FaceLandmarks *landmarks,
+                     int channels,
+                     int size,
+                     float *out) {
+    float scale = (float)size / LANDMARK_TEMPLATE_SIZE;
+    double mean_dx = 0.0;
+    double mean_dy = 0.0;
+    double mean_sx = 0.0;
+    double mean_sy = 0.0;
+    for (int i = 0; i < FACE_LANDMARK_COUNT; i++) {
+        mean_dx += landmark_template[i][0] * scale;
+        mean_dy += landmark_template[i][1] * scale;
+        mean_sx += landmarks->x[i];
+        mean_sy += landmarks->y[i];
+    }
+    mean_dx /= FACE_LANDMARK_COUNT;
+    mean_dy /= FACE_LANDMARK_COUNT;
+    mean_sx /= FACE_LANDMARK_COUNT;
+    mean_sy /= FACE_LANDMARK_COUNT;
+
+    double num_a = 0.0;
+    double num_b = 0.0;
+    double den = 0.0;
+    for (int i = 0; i < FACE_LANDMARK_COUNT; i++) {
+        double dx = landmark_template[i][0] * scale - mean_dx;
+        double dy = landmark_template[i][1] * scale - mean_dy;
+        double sx = landmarks->x[i] - mean_sx;
+        double sy = landmarks->y[i] - mean_sy;
+        num_a += dx * sx + dy * sy;
+        num_b += dx * sy - dy * sx;
+        den += dx * dx + dy * dy;
+    }
+    double a = den > 0.0 ? num_a / den : 1.0;
+    double b = den > 0.0 ? num_b / den : 0.0;
+    double tx = mean_sx - (a * mean_dx - b * mean_dy);
+    double ty = mean_sy - (b * mean_dx + a * mean_dy);
+
+    const uint8_t *planes[3];
+    if (channels == 3) {
+        planes[0] = image->r;
+        planes[1] = image->g;
+        planes[2] = image->b;
+    } else {
+        planes[0] = image->gray;
+    }
+
+    size_t area = (size_t)size * (size_t)size;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            float src_x = (float)(a * x - b * y + tx);
+            float src_y = (float)(b * x + a * y + ty);
+            for (int c = 0; c < channels; c++) {
+                float v = sample_bilinear(planes[c], image->width, image->height, image->stride,
+                                          src_x, src_y);
+                out[(size_t)c * area + (size_t)y * (size_t)size + (size_t)x] =
+                    (v - 128.0f) / 128.0f;
+            }
+        }
+    }
+}
+
+bool embedding_extract(const EmbeddingModel *model,
+                       EmbeddingPrecision precision,
+                       const ImageBuffer *image,
+                       const FaceLandmarks *landmarks,
+                       EmbeddingWorkspace *workspace,
+                       ThreadPool *pool,
+                       float *out) {
+    if (model == NULL || image == NULL || landmarks == NULL || workspace == NULL) {
+        return false;
+    }
+    face_align_crop(image, landmarks, model->input_channels, model->input_size, workspace->input);
+    return embedding_forward(model, precision, workspace->input, workspace, pool, out);
+}
@@ -0,0 +1,99 @@
+#ifndef EMBEDDING_H
+#define EMBEDDING_H
+
+#include "face_detect.h"
+#include "image.h"
+#include "thread_pool.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EMBEDDING_MAX_DIM 512
+#define EMBEDDING_MAX_LAYERS 16
+#define FACE_LANDMARK_COUNT 5
+#define EMBEDDING_MAX_BATCH 64
+
+typedef enum {
+    EMBEDDING_PRECISION_FLOAT = 0,
+    EMBEDDING_PRECISION_INT8 = 1,
+} EmbeddingPrecision;
+
+typedef enum {
+    EMBEDDING_LAYER_CONV = 1,
+    EMBEDDING_LAYER_GLOBAL_POOL = 2,
+    EMBEDDING_LAYER_DENSE = 3,
+} EmbeddingLayerType;
+
+typedef struct {
+    EmbeddingLayerType type;
+    int out_channels;
+    int kernel;
+    int stride;
+    bool relu;
+} EmbeddingLayerSpec;
+
+typedef struct {
+    int input_size;
+    int input_channels;
+    size_t layer_count;
+    EmbeddingLayerSpec layers[EMBEDDING_MAX_LAYERS];
+} EmbeddingSpec;
+
+typedef struct {
+    float x[FACE_LANDMARK_COUNT];
+    float y[FACE_LANDMARK_COUNT];
+} FaceLandmarks;
+
+typedef struct EmbeddingModel EmbeddingModel;
+typedef struct EmbeddingWorkspace EmbeddingWorkspace;
+
+EmbeddingSpec embedding_default_spec(void);
+EmbeddingModel *embedding_model_create_random(const EmbeddingSpec *spec, uint32_t seed);
+EmbeddingModel *embedding_model_load(const char *path);
+bool embedding_model_save(const EmbeddingModel *model, const char *path);
+void embedding_model_free(EmbeddingModel *model);
+size_t embedding_model_mapped_bytes(const EmbeddingModel *model);
+size_t embedding_model_prewarm(const EmbeddingModel *model);
+size_t embedding_model_resident_bytes(const EmbeddingModel *model);
+size_t embedding_model_dim(const EmbeddingModel *model);
+int embedding_model_input_size(const EmbeddingModel *model);
+int embedding_model_input_channels(const EmbeddingModel *model);
+
+EmbeddingWorkspace *embedding_workspace_create(const EmbeddingModel *model);
+EmbeddingWorkspace *embedding_workspace_create_batch(const EmbeddingModel *model,
+                                                     size_t max_batch);
+void embedding_workspace_free(EmbeddingWorkspace *workspace);
+size_t embedding_workspace_batch_capacity(const EmbeddingWorkspace *workspace);
+float *embedding_workspace_input(EmbeddingWorkspace *workspace, size_t index);
+
+FaceLandmarks face_landmarks_from_box(const FaceBox *box);
+void face_align_crop(const ImageBuffer *image,
+                     const FaceLandmarks *landmarks,
+                     int channels,
+                     int size,
+                     float *out);
+
+bool embedding_forward(const EmbeddingModel *model,
+                       EmbeddingPrecision precision,
+                       const float *input,
+                       EmbeddingWorkspace *workspace,
+                       ThreadPool *pool,
+                       float *out);
+bool embedding_forward_batch(const EmbeddingModel *model,
+                             EmbeddingPrecision precision,
+                             const float *inputs,
+                             size_t count,
+                             EmbeddingWorkspace *workspace,
+                             ThreadPool *pool,
+                             float *out,
+                             bool *valid);
+bool embedding_extract(const EmbeddingModel *model,
+                       EmbeddingPrecision precision,
+                       const ImageBuffer *image,
+                       const FaceLandmarks *landmarks,
+                       EmbeddingWorkspace *workspace,
+                       ThreadPool *pool,
+                       float *out);
+
+#endif
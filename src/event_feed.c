@@ -0,0 +1,627 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "event_feed.h"
+
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EVENT_FEED_EPOLL_BATCH 64
+
+/*
+ * One ring slot. `id` doubles as a sequence lock: the producer zeroes it
+ * before rewriting the frame and stores the new id once the frame is
+ * complete, so a reader that sees the same id before and after its copy
+ * knows the copy is intact.
+ */
+typedef struct {
+    _Atomic uint64_t id;
+    size_t length;
+    char frame[EVENT_FEED_FRAME_MAX];
+} EventSlot;
+
+typedef struct Subscriber {
+    int fd;
+    bool closed;
+    uint64_t next_id;
+    uint64_t blocked_since_ms;
+    size_t pending_offset;
+    size_t pending_length;
+    char pending[EVENT_FEED_FRAME_MAX];
+    struct Subscriber *next;
+} Subscriber;
+
+static const char stream_headers[] = "HTTP/1.1 200 OK\r\n"
+                                     "Content-Type: text/event-stream\r\n"
+                                     "Cache-Control: no-store\r\n"
+                                     "Connection: keep-alive\r\n"
+                                     "X-Accel-Buffering: no\r\n"
+                                     "\r\n";
+static const char keepalive_frame[] = ": keepalive\n\n";
+
+static pthread_mutex_t feed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool running;
+static _Atomic uint64_t drain_deadline_ms = 0;
+static bool thread_started = false;
+static pthread_t feed_thread;
+static EventFeedParams params;
+static EventFeedStats stats;
+static Subscriber *incoming = NULL;
+static size_t subscriber_count = 0;
+
+/* Producers serialise here, so the ring only ever sees one writer at a time. */
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+static EventSlot *ring = NULL;
+static size_t ring_capacity = 0;
+static _Atomic uint64_t last_id;
+static uint64_t first_id = 0;
+static int wake_fd = -1;
+static int epoll_fd = -1;
+
+/* Owned by the feed thread once it is running. */
+static Subscriber **active = NULL;
+static size_t active_count = 0;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static uint64_t wall_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void wake_feed_thread(void) {
+    uint64_t one = 1;
+    ssize_t ignored = write(wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
+
+static bool send_all(int fd, const char *data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+static uint64_t oldest_available(uint64_t newest) {
+    uint64_t oldest = newest >= ring_capacity ? newest - ring_capacity + 1 : 1;
+    return oldest > first_id ? oldest : first_id;
+}
+
+static bool ring_read(uint64_t id, char *out, size_t *length) {
+    EventSlot *slot = &ring[id % ring_capacity];
+    if (atomic_load_explicit(&slot->id, memory_order_acquire) != id) {
+        return false;
+    }
+    size_t n = slot->length;
+    if (n > EVENT_FEED_FRAME_MAX) {
+        return false;
+    }
+    memcpy(out, slot->frame, n);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->id, memory_order_relaxed) != id) {
+        return false;
+    }
+    *length = n;
+    return true;
+}
+
+static void close_subscriber(Subscriber *sub, bool slow) {
+    if (sub->closed) {
+        return;
+    }
+    /* Explicit removal: the accept loop's descriptor may still share this socket. */
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sub->fd, NULL);
+    close(sub->fd);
+    sub->closed = true;
+    pthread_mutex_lock(&feed_mutex);
+    subscriber_count--;
+    if (slow) {
+        stats.dropped_slow++;
+    } else {
+        stats.disconnected++;
+    }
+    pthread_mutex_unlock(&feed_mutex);
+}
+
+/*
+ * Writes as much as the socket takes without blocking. A subscriber whose
+ * cursor has been overwritten in the ring has fallen a whole ring behind
+ * and is dropped; the producer never waits for it.
+ */
+static void pump(Subscriber *sub, uint64_t now_ms) {
+    while (!sub->closed) {
+        if (sub->pending_offset < sub->pending_length) {
+            ssize_t n = send(sub->fd, sub->pending + sub->pending_offset,
+                             sub->pending_length - sub->pending_offset, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    if (sub->blocked_since_ms == 0) {
+                        sub->blocked_since_ms = now_ms;
+                    }
+                    return;
+                }
+                close_subscriber(sub, false);
+                return;
+            }
+            sub->pending_offset += (size_t)n;
+            sub->blocked_since_ms = 0;
+            continue;
+        }
+
+        uint64_t newest = atomic_load_explicit(&last_id, memory_order_acquire);
+        if (sub->next_id > newest) {
+            return;
+        }
+        if (!ring_read(sub->next_id, sub->pending, &sub->pending_length)) {
+            close_subscriber(sub, true);
+            return;
+        }
+        sub->pending_offset = 0;
+        sub->next_id++;
+    }
+}
+
+static void handle_subscriber_event(Subscriber *sub, uint32_t events, uint64_t now_ms) {
+    if (sub->closed) {
+        return;
+    }
+    if (events & EPOLLIN) {
+        /* Subscribers have nothing to say; drain so a closed peer shows up as EOF. */
+        char scratch[256];
+        for (;;) {
+            ssize_t n = recv(sub->fd, scratch, sizeof(scratch), 0);
+            if (n > 0) {
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_subscriber(sub, false);
+                return;
+            }
+            break;
+        }
+    }
+    if (events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+        close_subscriber(sub, false);
+        return;
+    }
+    if (events & EPOLLOUT) {
+        pump(sub, now_ms);
+    }
+}
+
+static void adopt_incoming(void) {
+    pthread_mutex_lock(&feed_mutex);
+    Subscriber *list = incoming;
+    incoming = NULL;
+    pthread_mutex_unlock(&feed_mutex);
+
+    while (list != NULL) {
+        Subscriber *sub = list;
+        list = sub->next;
+        sub->next = NULL;
+        active[active_count++] = sub;
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = sub;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sub->fd, &event) < 0) {
+            close_subscriber(sub, false);
+        }
+    }
+}
+
+/*
+ * Comments keep idle connections alive through proxies and surface dead
+ * peers. A subscriber that has not accepted a byte for `stall_ms` is
+ * dropped even if the ring has not lapped it yet.
+ */
+static void heartbeat(uint64_t now_ms) {
+    for (size_t i = 0; i < active_count; i++) {
+        Subscriber *sub = active[i];
+        if (sub->closed) {
+            continue;
+        }
+        if (sub->blocked_since_ms != 0 && now_ms - sub->blocked_since_ms >= params.stall_ms) {
+            close_subscriber(sub, true);
+            continue;
+        }
+        if (sub->pending_offset >= sub->pending_length) {
+            memcpy(sub->pending, keepalive_frame, sizeof(keepalive_frame) - 1);
+            sub->pending_length = sizeof(keepalive_frame) - 1;
+            sub->pending_offset = 0;
+        }
+        pump(sub, now_ms);
+    }
+}
+
+static void reap_closed(void) {
+    size_t kept = 0;
+    for (size_t i = 0; i < active_count; i++) {
+        if (active[i]->closed) {
+            free(active[i]);
+        } else {
+            active[kept++] = active[i];
+        }
+    }
+    active_count = kept;
+}
+
+/* While draining, a subscriber is closed once it has been sent every event. */
+static void close_caught_up(uint64_t now_ms) {
+    uint64_t newest = atomic_load_explicit(&last_id, memory_order_acquire);
+    for (size_t i = 0; i < active_count; i++) {
+        Subscriber *sub = active[i];
+        pump(sub, now_ms);
+        if (!sub->closed && sub->pending_offset >= sub->pending_length &&
+            sub->next_id > newest) {
+            close_subscriber(sub, false);
+        }
+    }
+}
+
+static void *feed_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[EVENT_FEED_EPOLL_BATCH];
+    uint64_t next_heartbeat = monotonic_ms() + params.heartbeat_ms;
+    while (atomic_load(&running)) {
+        uint64_t now = monotonic_ms();
+        uint64_t draining = atomic_load(&drain_deadline_ms);
+        uint64_t wake_at = draining != 0 && draining < next_heartbeat ? draining : next_heartbeat;
+        int timeout = wake_at > now ? (int)(wake_at - now) : 0;
+        int n = epoll_wait(epoll_fd, events, EVENT_FEED_EPOLL_BATCH, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        now = monotonic_ms();
+        bool woken = false;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                uint64_t count;
+                ssize_t ignored = read(wake_fd, &count, sizeof(count));
+                (void)ignored;
+                woken = true;
+            } else {
+                handle_subscriber_event((Subscriber *)events[i].data.ptr, events[i].events, now);
+            }
+        }
+        if (woken) {
+            adopt_incoming();
+            for (size_t i = 0; i < active_count; i++) {
+                pump(active[i], now);
+            }
+        }
+        if (now >= next_heartbeat) {
+            heartbeat(now);
+            next_heartbeat = now + params.heartbeat_ms;
+        }
+        uint64_t deadline = atomic_load(&drain_deadline_ms);
+        if (deadline != 0) {
+            close_caught_up(now);
+        }
+        reap_closed();
+        if (deadline != 0 && (active_count == 0 || now >= deadline)) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < active_count; i++) {
+        close_subscriber(active[i], false);
+    }
+    reap_closed();
+    return NULL;
+}
+
+static void release_resources(void) {
+    pthread_mutex_lock(&publish_mutex);
+    free(ring);
+    ring = NULL;
+    ring_capacity = 0;
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    wake_fd = -1;
+    epoll_fd = -1;
+    pthread_mutex_unlock(&publish_mutex);
+    free(active);
+    active = NULL;
+    active_count = 0;
+}
+
+/*
+ * Event ids continue from the wall clock in microseconds at start-up, so a
+ * client reconnecting across a restart never mistakes an old id for a new
+ * one and simply resumes from the oldest buffered event.
+ */
+bool event_feed_start(const EventFeedParams *params_in) {
+    if (params_in == NULL || params_in->capacity == 0 || params_in->max_subscribers == 0 ||
+        params_in->heartbeat_ms == 0) {
+        return false;
+    }
+    pthread_mutex_lock(&feed_mutex);
+    if (atomic_load(&running)) {
+        pthread_mutex_unlock(&feed_mutex);
+        return false;
+    }
+    params = *params_in;
+    memset(&stats, 0, sizeof(stats));
+    subscriber_count = 0;
+
+    pthread_mutex_lock(&publish_mutex);
+    ring = (EventSlot *)calloc(params.capacity, sizeof(*ring));
+    ring_capacity = params.capacity;
+    uint64_t base = wall_clock_us();
+    atomic_store(&last_id, base);
+    first_id = base + 1;
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    pthread_mutex_unlock(&publish_mutex);
+    active = (Subscriber **)calloc(params.max_subscribers, sizeof(*active));
+
+    bool ok = ring != NULL && active != NULL && wake_fd >= 0 && epoll_fd >= 0;
+    if (ok) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        ok = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) == 0;
+    }
+    if (ok) {
+        atomic_store(&running, true);
+        thread_started = pthread_create(&feed_thread, NULL, feed_main, NULL) == 0;
+        ok = thread_started;
+        if (!ok) {
+            atomic_store(&running, false);
+        }
+    }
+    pthread_mutex_unlock(&feed_mutex);
+    if (!ok) {
+        release_resources();
+    }
+    return ok;
+}
+
+/*
+ * Stops taking subscribers, keeps writing to the current ones until each has
+ * every event published so far, then closes them; whoever is still behind
+ * after `timeout_ms` is closed anyway. Clients reconnect on their own, which
+ * after a restart lands them on the new process. Then stops the feed.
+ */
+void event_feed_drain(unsigned timeout_ms) {
+    pthread_mutex_lock(&feed_mutex);
+    bool joinable = atomic_load(&running) && thread_started;
+    thread_started = false;
+    atomic_store(&drain_deadline_ms, monotonic_ms() + (timeout_ms > 0 ? timeout_ms : 1));
+    pthread_mutex_unlock(&feed_mutex);
+    if (joinable) {
+        wake_feed_thread();
+        pthread_join(feed_thread, NULL);
+    }
+    event_feed_stop();
+    atomic_store(&drain_deadline_ms, 0);
+}
+
+void event_feed_stop(void) {
+    pthread_mutex_lock(&feed_mutex);
+    bool was_running = atomic_load(&running);
+    atomic_store(&running, false);
+    bool joinable = thread_started;
+    thread_started = false;
+    pthread_mutex_unlock(&feed_mutex);
+    if (!was_running) {
+        return;
+    }
+
+    wake_feed_thread();
+    if (joinable) {
+        pthread_join(feed_thread, NULL);
+    }
+
+    pthread_mutex_lock(&feed_mutex);
+    Subscriber *list = incoming;
+    incoming = NULL;
+    pthread_mutex_unlock(&feed_mutex);
+    while (list != NULL) {
+        Subscriber *next = list->next;
+        close_subscriber(list, false);
+        free(list);
+        list = next;
+    }
+    release_resources();
+}
+
+/*
+ * Appends one event to the ring and wakes the feed thread. `data` must be a
+ * single line. Returns the event id, or 0 when the feed is stopped or the
+ * event does not fit a slot. Never blocks on subscribers.
+ */
+uint64_t event_feed_publish(const char *type, const char *data) {
+    if (type == NULL || data == NULL || strchr(data, '\n') != NULL ||
+        !atomic_load(&running)) {
+        return 0;
+    }
+    char frame[EVENT_FEED_FRAME_MAX];
+    pthread_mutex_lock(&publish_mutex);
+    if (ring == NULL) {
+        pthread_mutex_unlock(&publish_mutex);
+        return 0;
+    }
+    uint64_t id = atomic_load_explicit(&last_id, memory_order_relaxed) + 1;
+    int n = snprintf(frame, sizeof(frame), "id: %llu\nevent: %s\ndata: %s\n\n",
+                     (unsigned long long)id, type, data);
+    if (n < 0 || (size_t)n >= sizeof(frame)) {
+        pthread_mutex_unlock(&publish_mutex);
+        return 0;
+    }
+
+    EventSlot *slot = &ring[id % ring_capacity];
+    atomic_store_explicit(&slot->id, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(slot->frame, frame, (size_t)n);
+    slot->length = (size_t)n;
+    atomic_store_explicit(&slot->id, id, memory_order_release);
+    atomic_store_explicit(&last_id, id, memory_order_release);
+    wake_feed_thread();
+    pthread_mutex_unlock(&publish_mutex);
+    return id;
+}
+
+uint64_t event_feed_publish_recognition(const RecognitionEvent *event) {
+    char data[EVENT_FEED_FRAME_MAX];
+    if (event_feed_format_recognition(event, data, sizeof(data)) == 0) {
+        return 0;
+    }
+    return event_feed_publish("recognition", data);
+}
+
+/*
+ * Starts streaming on a dup of the socket and returns at once; the caller
+ * closes its own descriptor as usual. A `Last-Event-ID` resumes after that
+ * event if it is still buffered, otherwise from the oldest buffered event.
+ * Returns false, with nothing written, when the feed is stopped or full.
+ */
+bool event_feed_subscribe(int client_fd, const HttpRequest *request) {
+    pthread_mutex_lock(&feed_mutex);
+    if (!atomic_load(&running) || atomic_load(&drain_deadline_ms) != 0 ||
+        subscriber_count >= params.max_subscribers) {
+        stats.rejected++;
+        pthread_mutex_unlock(&feed_mutex);
+        return false;
+    }
+    subscriber_count++;
+    pthread_mutex_unlock(&feed_mutex);
+
+    Subscriber *sub = (Subscriber *)calloc(1, sizeof(*sub));
+    int fd = sub != NULL ? dup(client_fd) : -1;
+    if (fd < 0) {
+        free(sub);
+        pthread_mutex_lock(&feed_mutex);
+        subscriber_count--;
+        stats.rejected++;
+        pthread_mutex_unlock(&feed_mutex);
+        return false;
+    }
+    sub->fd = fd;
+
+    char retry[32];
+    int retry_length = snprintf(retry, sizeof(retry), "retry: %d\n\n", EVENT_FEED_RETRY_MS);
+    bool ok = send_all(fd, stream_headers, sizeof(stream_headers) - 1) &&
+              send_all(fd, retry, (size_t)retry_length);
+    http_note_response(200, sizeof(stream_headers) - 1 + (size_t)retry_length);
+    int flags = fcntl(fd, F_GETFL, 0);
+    ok = ok && flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+
+    pthread_mutex_lock(&publish_mutex);
+    uint64_t newest = atomic_load(&last_id);
+    bool resumed = request->has_last_event_id && request->last_event_id < newest;
+    sub->next_id = newest + 1;
+    if (resumed) {
+        uint64_t oldest = oldest_available(newest);
+        sub->next_id = request->last_event_id + 1 > oldest ? request->last_event_id + 1 : oldest;
+    }
+    pthread_mutex_unlock(&publish_mutex);
+
+    pthread_mutex_lock(&feed_mutex);
+    if (!ok || !atomic_load(&running)) {
+        subscriber_count--;
+        stats.disconnected++;
+        pthread_mutex_unlock(&feed_mutex);
+        close(fd);
+        free(sub);
+        return true;
+    }
+    stats.accepted++;
+    stats.resumed += resumed ? 1 : 0;
+    sub->next = incoming;
+    incoming = sub;
+    wake_feed_thread();
+    pthread_mutex_unlock(&feed_mutex);
+    return true;
+}
+
+void event_feed_stats(EventFeedStats *out) {
+    pthread_mutex_lock(&feed_mutex);
+    *out = stats;
+    out->subscribers = subscriber_count;
+    pthread_mutex_unlock(&feed_mutex);
+
+    pthread_mutex_lock(&publish_mutex);
+    if (ring != NULL) {
+        out->last_id = atomic_load(&last_id);
+        out->first_id = oldest_available(out->last_id);
+        out->published = out->last_id - (first_id - 1);
+    }
+    pthread_mutex_unlock(&publish_mutex);
+}
+
+size_t event_feed_format_recognition(const RecognitionEvent *event, char *buffer, size_t capacity) {
+    /* Twice the source size, so escaping never truncates either field. */
+    char stream[2 * sizeof(event->stream)];
+    char name[2 * sizeof(event->identity.name)];
+    http_json_escape(stream, sizeof(stream), event->stream);
+    http_json_escape(name, sizeof(name), event->identity.name);
+    int n = snprintf(buffer, capacity,
+                     "{\"stream\":\"%s\",\"identity\":\"%s\",\"id\":%llu,\"track\":%u,"
+                     "\"similarity\":%.4f,\"frame_seq\":%llu,\"time_ms\":%llu}",
+                     stream, name, (unsigned long long)event->identity.id,
+                     (unsigned)event->track_id, (double)event->similarity,
+                     (unsigned long long)event->frame_seq, (unsigned long long)event->time_ms);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
+
+size_t event_feed_format_stats_json(const EventFeedStats *stats_in, char *buffer, size_t capacity) {
+    int n = snprintf(buffer, capacity,
+                     "{\"published\":%llu,\"first_id\":%llu,\"last_id\":%llu,\"subscribers\":%zu,"
+                     "\"accepted\":%llu,\"rejected\":%llu,\"resumed\":%llu,"
+                     "\"dropped_slow\":%llu,\"disconnected\":%llu}",
+                     (unsigned long long)stats_in->published,
+                     (unsigned long long)stats_in->first_id,
+                     (unsigned long long)stats_in->last_id, stats_in->subscribers,
+                     (unsigned long long)stats_in->accepted,
+                     (unsigned long long)stats_in->rejected,
+                     (unsigned long long)stats_in->resumed,
+                     (unsigned long long)stats_in->dropped_slow,
+                     (unsigned long long)stats_in->disconnected);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
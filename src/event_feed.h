@@ -0,0 +1,54 @@
+#ifndef EVENT_FEED_H
+#define EVENT_FEED_H
+
+#include "gallery_store.h"
+#include "http.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EVENT_FEED_FRAME_MAX 512
+
+typedef struct {
+    size_t capacity;
+    size_t max_subscribers;
+    unsigned heartbeat_ms;
+    unsigned stall_ms;
+} EventFeedParams;
+
+/* "Identity X seen on camera Y at T", published when a face track gains an identity. */
+typedef struct {
+    char stream[64];
+    GalleryIdentity identity;
+    uint32_t track_id;
+    float similarity;
+    uint64_t frame_seq;
+    uint64_t time_ms;
+} RecognitionEvent;
+
+typedef struct {
+    uint64_t published;
+    uint64_t first_id;
+    uint64_t last_id;
+    size_t subscribers;
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t resumed;
+    uint64_t dropped_slow;
+    uint64_t disconnected;
+} EventFeedStats;
+
+bool event_feed_start(const EventFeedParams *params);
+void event_feed_stop(void);
+void event_feed_drain(unsigned timeout_ms);
+
+uint64_t event_feed_publish(const char *type, const char *data);
+uint64_t event_feed_publish_recognition(const RecognitionEvent *event);
+bool event_feed_subscribe(int client_fd, const HttpRequest *request);
+
+void event_feed_stats(EventFeedStats *out);
+size_t event_feed_format_recognition(const RecognitionEvent *event, char *buffer, size_t capacity);
+size_t event_feed_format_stats_json(const EventFeedStats *stats, char *buffer, size_t capacity);
+
+#endif
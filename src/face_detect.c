@@ -0,0 +1,496 @@
+#include "face_detect.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FEATURE_RECTS 3
+#define MAX_CASCADE_STAGES 64
+#define MAX_STAGE_WEAKS 1024
+#define GROUP_EPS 0.2
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+    float weight;
+} HaarRect;
+
+typedef struct {
+    float threshold;
+    float left_value;
+    float right_value;
+    int rect_count;
+    HaarRect rects[MAX_FEATURE_RECTS];
+} WeakClassifier;
+
+typedef struct {
+    float threshold;
+    size_t weak_begin;
+    size_t weak_count;
+} CascadeStage;
+
+struct FaceDetector {
+    int window_width;
+    int window_height;
+    size_t stage_count;
+    CascadeStage *stages;
+    size_t weak_count;
+    WeakClassifier *weaks;
+};
+
+typedef struct {
+    int offset[MAX_FEATURE_RECTS][4];
+    float weight[MAX_FEATURE_RECTS];
+} ScaledFeature;
+
+FaceDetectParams face_detect_default_params(void) {
+    FaceDetectParams params;
+    params.min_size = 24;
+    params.max_size = 0;
+    params.scale_factor = 1.2f;
+    params.min_neighbors = 3;
+    return params;
+}
+
+void face_detector_free(FaceDetector *detector) {
+    if (detector == NULL) {
+        return;
+    }
+    free(detector->stages);
+    free(detector->weaks);
+    free(detector);
+}
+
+static bool expect_keyword(FILE *file, const char *keyword) {
+    char token[32];
+    for (;;) {
+        if (fscanf(file, "%31s", token) != 1) {
+            return false;
+        }
+        if (token[0] != '#') {
+            break;
+        }
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n') {
+        }
+    }
+    return strcmp(token, keyword) == 0;
+}
+
+static bool read_weak(FILE *file, const FaceDetector *detector, WeakClassifier *weak) {
+    if (!expect_keyword(file, "weak") ||
+        fscanf(file, "%f %f %f %d", &weak->threshold, &weak->left_value, &weak->right_value,
+               &weak->rect_count) != 4) {
+        return false;
+    }
+    if (weak->rect_count < 1 || weak->rect_count > MAX_FEATURE_RECTS) {
+        return false;
+    }
+    for (int r = 0; r < weak->rect_count; r++) {
+        HaarRect *rect = &weak->rects[r];
+        if (!expect_keyword(file, "rect") ||
+            fscanf(file, "%d %d %d %d %f", &rect->x, &rect->y, &rect->width, &rect->height,
+                   &rect->weight) != 5) {
+            return false;
+        }
+        if (rect->x < 0 || rect->y < 0 || rect->width <= 0 || rect->height <= 0 ||
+            rect->x + rect->width > detector->window_width ||
+            rect->y + rect->height > detector->window_height) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_cascade(FILE *file, FaceDetector *detector) {
+    int version = 0;
+    if (!expect_keyword(file, "haar_cascade") || fscanf(file, "%d", &version) != 1 ||
+        version != 1) {
+        return false;
+    }
+    if (!expect_keyword(file, "window") ||
+        fscanf(file, "%d %d", &detector->window_width, &detector->window_height) != 2 ||
+        detector->window_width < 4 || detector->window_height < 4) {
+        return false;
+    }
+    int stage_count = 0;
+    if (!expect_keyword(file, "stages") || fscanf(file, "%d", &stage_count) != 1 ||
+        stage_count < 1 || stage_count > MAX_CASCADE_STAGES) {
+        return false;
+    }
+
+    detector->stages = (CascadeStage *)calloc((size_t)stage_count, sizeof(CascadeStage));
+    if (detector->stages == NULL) {
+        return false;
+    }
+    detector->stage_count = (size_t)stage_count;
+
+    size_t weak_capacity = 0;
+    for (size_t s = 0; s < detector->stage_count; s++) {
+        CascadeStage *stage = &detector->stages[s];
+        int weak_count = 0;
+        if (!expect_keyword(file, "stage") ||
+            fscanf(file, "%d %f", &weak_count, &stage->threshold) != 2 || weak_count < 1 ||
+            weak_count > MAX_STAGE_WEAKS) {
+            return false;
+        }
+        stage->weak_begin = detector->weak_count;
+        stage->weak_count = (size_t)weak_count;
+
+        size_t needed = detector->weak_count + (size_t)weak_count;
+        if (needed > weak_capacity) {
+            size_t new_capacity = weak_capacity == 0 ? 64 : weak_capacity;
+            while (new_capacity < needed) {
+                new_capacity *= 2;
+            }
+            WeakClassifier *grown = (WeakClassifier *)realloc(detector->weaks,
+                                                              new_capacity * sizeof(*grown));
+            if (grown == NULL) {
+                return false;
+            }
+            detector->weaks = grown;
+            weak_capacity = new_capacity;
+        }
+
+        for (int w = 0; w < weak_count; w++) {
+            if (!read_weak(file, detector, &detector->weaks[detector->weak_count])) {
+                return false;
+            }
+            detector->weak_count++;
+        }
+    }
+    return true;
+}
+
+FaceDetector *face_detector_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    FaceDetector *detector = (FaceDetector *)calloc(1, sizeof(*detector));
+    if (detector == NULL) {
+        fclose(file);
+        return NULL;
+    }
+
+    bool ok = read_cascade(file, detector);
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Invalid face cascade: %s\n", path);
+        face_detector_free(detector);
+        return NULL;
+    }
+    return detector;
+}
+
+int face_detector_window_width(const FaceDetector *detector) {
+    return detector->window_width;
+}
+
+int face_detector_window_height(const FaceDetector *detector) {
+    return detector->window_height;
+}
+
+static void build_integrals(const uint8_t *gray,
+                            int width,
+                            int height,
+                            size_t stride,
+                            uint32_t *sum,
+                            uint64_t *sqsum) {
+    size_t istride = (size_t)width + 1;
+    memset(sum, 0, istride * sizeof(*sum));
+    memset(sqsum, 0, istride * sizeof(*sqsum));
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = gray + (size_t)y * stride;
+        uint32_t *sum_row = sum + (size_t)(y + 1) * istride;
+        uint64_t *sq_row = sqsum + (size_t)(y + 1) * istride;
+        const uint32_t *sum_prev = sum_row - istride;
+        const uint64_t *sq_prev = sq_row - istride;
+        uint32_t run = 0;
+        uint64_t sq_run = 0;
+        sum_row[0] = 0;
+        sq_row[0] = 0;
+        for (int x = 0; x < width; x++) {
+            run += row[x];
+            sq_run += (uint64_t)row[x] * row[x];
+            sum_row[x + 1] = sum_prev[x + 1] + run;
+            sq_row[x + 1] = sq_prev[x + 1] + sq_run;
+        }
+    }
+}
+
+static inline double rect_sum(const uint32_t *p, const int offset[4]) {
+    return (double)p[offset[0]] - (double)p[offset[1]] - (double)p[offset[2]] + (double)p[offset[3]];
+}
+
+static void scale_features(const FaceDetector *detector,
+                           double scale,
+                           size_t istride,
+                           ScaledFeature *scaled) {
+    for (size_t i = 0; i < detector->weak_count; i++) {
+        const WeakClassifier *weak = &detector->weaks[i];
+        ScaledFeature *out = &scaled[i];
+        double area0 = 0.0;
+        double weighted_rest = 0.0;
+        for (int r = 0; r < weak->rect_count; r++) {
+            const HaarRect *rect = &weak->rects[r];
+            int x = (int)lround(rect->x * scale);
+            int y = (int)lround(rect->y * scale);
+            int w = (int)lround(rect->width * scale);
+            int h = (int)lround(rect->height * scale);
+            if (w < 1) {
+                w = 1;
+            }
+            if (h < 1) {
+                h = 1;
+            }
+            out->offset[r][0] = (int)((size_t)y * istride + (size_t)x);
+            out->offset[r][1] = (int)((size_t)y * istride + (size_t)(x + w));
+            out->offset[r][2] = (int)((size_t)(y + h) * istride + (size_t)x);
+            out->offset[r][3] = (int)((size_t)(y + h) * istride + (size_t)(x + w));
+            out->weight[r] = rect->weight;
+            if (r == 0) {
+                area0 = (double)w * h;
+            } else {
+                weighted_rest += rect->weight * (double)w * h;
+            }
+        }
+        if (weak->rect_count > 1 && area0 > 0.0) {
+            out->weight[0] = (float)(-weighted_rest / area0);
+        }
+        for (int r = weak->rect_count; r < MAX_FEATURE_RECTS; r++) {
+            memset(out->offset[r], 0, sizeof(out->offset[r]));
+            out->weight[r] = 0.0f;
+        }
+    }
+}
+
+static bool evaluate_window(const FaceDetector *detector,
+                            const ScaledFeature *scaled,
+                            const uint32_t *p,
+                            double norm_factor) {
+    for (size_t s = 0; s < detector->stage_count; s++) {
+        const CascadeStage *stage = &detector->stages[s];
+        double stage_sum = 0.0;
+        for (size_t i = stage->weak_begin; i < stage->weak_begin + stage->weak_count; i++) {
+            const WeakClassifier *weak = &detector->weaks[i];
+            const ScaledFeature *feature = &scaled[i];
+            double value = 0.0;
+            for (int r = 0; r < weak->rect_count; r++) {
+                value += feature->weight[r] * rect_sum(p, feature->offset[r]);
+            }
+            stage_sum += value < weak->threshold * norm_factor ? weak->left_value
+                                                                : weak->right_value;
+        }
+        if (stage_sum < stage->threshold) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool boxes_similar(const FaceBox *a, const FaceBox *b) {
+    double delta = GROUP_EPS * (double)((a->width < b->width ? a->width : b->width) +
+                                        (a->height < b->height ? a->height : b->height)) *
+                   0.5;
+    return abs(a->x - b->x) <= delta && abs(a->y - b->y) <= delta &&
+           abs(a->x + a->width - b->x - b->width) <= delta &&
+           abs(a->y + a->height - b->y - b->height) <= delta;
+}
+
+static size_t find_root(size_t *parent, size_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static size_t group_boxes(FaceBox *raw, size_t count, int min_neighbors, FaceBox *out, size_t max_out) {
+    if (count == 0) {
+        return 0;
+    }
+
+    size_t *parent = (size_t *)malloc(count * sizeof(size_t));
+    FaceBox *sums = (FaceBox *)calloc(count, sizeof(FaceBox));
+    if (parent == NULL || sums == NULL) {
+        free(parent);
+        free(sums);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        parent[i] = i;
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            if (boxes_similar(&raw[i], &raw[j])) {
+                size_t ri = find_root(parent, i);
+                size_t rj = find_root(parent, j);
+                if (ri != rj) {
+                    parent[rj] = ri;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        FaceBox *acc = &sums[find_root(parent, i)];
+        acc->x += raw[i].x;
+        acc->y += raw[i].y;
+        acc->width += raw[i].width;
+        acc->height += raw[i].height;
+        acc->neighbors++;
+    }
+
+    size_t grouped = 0;
+    for (size_t i = 0; i < count; i++) {
+        FaceBox *acc = &sums[i];
+        if (acc->neighbors < min_neighbors || acc->neighbors == 0) {
+            continue;
+        }
+        int n = acc->neighbors;
+        FaceBox box = {
+            (acc->x * 2 + n) / (2 * n),
+            (acc->y * 2 + n) / (2 * n),
+            (acc->width * 2 + n) / (2 * n),
+            (acc->height * 2 + n) / (2 * n),
+            n,
+        };
+        raw[grouped++] = box;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < grouped && kept < max_out; i++) {
+        bool nested = false;
+        for (size_t j = 0; j < grouped; j++) {
+            if (i == j || raw[j].neighbors < raw[i].neighbors) {
+                continue;
+            }
+            int dx = (int)lround(raw[j].width * GROUP_EPS);
+            int dy = (int)lround(raw[j].height * GROUP_EPS);
+            if (raw[i].x >= raw[j].x - dx && raw[i].y >= raw[j].y - dy &&
+                raw[i].x + raw[i].width <= raw[j].x + raw[j].width + dx &&
+                raw[i].y + raw[i].height <= raw[j].y + raw[j].height + dy &&
+                (raw[j].neighbors > raw[i].neighbors || j < i)) {
+                nested = true;
+                break;
+            }
+        }
+        if (!nested) {
+            out[kept++] = raw[i];
+        }
+    }
+
+    free(parent);
+    free(sums);
+    return kept;
+}
+
+size_t face_detector_detect(const FaceDetector *detector,
+                            const uint8_t *gray,
+                            int width,
+                            int height,
+                            size_t stride,
+                            const FaceDetectParams *params,
+                            FaceBox *boxes,
+                            size_t max_boxes) {
+    if (detector == NULL || gray == NULL || width <= 0 || height <= 0 || max_boxes == 0) {
+        return 0;
+    }
+
+    FaceDetectParams defaults = face_detect_default_params();
+    if (params == NULL) {
+        params = &defaults;
+    }
+    double scale_factor = params->scale_factor > 1.01f ? params->scale_factor : 1.1;
+
+    size_t istride = (size_t)width + 1;
+    size_t icount = istride * (size_t)(height + 1);
+    uint32_t *sum = (uint32_t *)malloc(icount * sizeof(*sum));
+    uint64_t *sqsum = (uint64_t *)malloc(icount * sizeof(*sqsum));
+    ScaledFeature *scaled = (ScaledFeature *)malloc(detector->weak_count * sizeof(*scaled));
+    size_t raw_capacity = 256;
+    size_t raw_count = 0;
+    FaceBox *raw = (FaceBox *)malloc(raw_capacity * sizeof(*raw));
+    if (sum == NULL || sqsum == NULL || scaled == NULL || raw == NULL) {
+        free(sum);
+        free(sqsum);
+        free(scaled);
+        free(raw);
+        return 0;
+    }
+
+    build_integrals(gray, width, height, stride, sum, sqsum);
+
+    double scale = 1.0;
+    if (params->min_size > detector->window_width) {
+        scale = (double)params->min_size / detector->window_width;
+    }
+
+    for (;; scale *= scale_factor) {
+        int win_w = (int)lround(detector->window_width * scale);
+        int win_h = (int)lround(detector->window_height * scale);
+        if (win_w > width || win_h > height) {
+            break;
+        }
+        if (params->max_size > 0 && (win_w > params->max_size || win_h > params->max_size)) {
+            break;
+        }
+
+        scale_features(detector, scale, istride, scaled);
+
+        int border = (int)lround(scale);
+        int norm_w = win_w - 2 * border;
+        int norm_h = win_h - 2 * border;
+        if (norm_w < 1 || norm_h < 1) {
+            border = 0;
+            norm_w = win_w;
+            norm_h = win_h;
+        }
+        double norm_area = (double)norm_w * norm_h;
+        int step = scale < 2.0 ? 2 : (int)lround(scale);
+
+        for (int y = 0; y + win_h <= height; y += step) {
+            for (int x = 0; x + win_w <= width; x += step) {
+                size_t base = (size_t)y * istride + (size_t)x;
+                size_t n0 = base + (size_t)border * istride + (size_t)border;
+                size_t n1 = n0 + (size_t)norm_w;
+                size_t n2 = n0 + (size_t)norm_h * istride;
+                size_t n3 = n2 + (size_t)norm_w;
+                double window_sum = (double)sum[n0] - sum[n1] - sum[n2] + sum[n3];
+                double window_sq = (double)sqsum[n0] - (double)sqsum[n1] - (double)sqsum[n2] +
+                                   (double)sqsum[n3];
+                double variance = norm_area * window_sq - window_sum * window_sum;
+                double norm_factor = variance > 0.0 ? sqrt(variance) : 1.0;
+
+                if (!evaluate_window(detector, scaled, sum + base, norm_factor)) {
+                    continue;
+                }
+
+                if (raw_count == raw_capacity) {
+                    FaceBox *grown = (FaceBox *)realloc(raw, raw_capacity * 2 * sizeof(*raw));
+                    if (grown == NULL) {
+                        break;
+                    }
+                    raw = grown;
+                    raw_capacity *= 2;
+                }
+                FaceBox box = {x, y, win_w, win_h, 1};
+                raw[raw_count++] = box;
+            }
+        }
+    }
+
+    size_t count = group_boxes(raw, raw_count, params->min_neighbors, boxes, max_boxes);
+
+    free(sum);
+    free(sqsum);
+    free(scaled);
+    free(raw);
+    return count;
+}
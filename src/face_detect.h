@@ -0,0 +1,41 @@
+#ifndef FACE_DETECT_H
+#define FACE_DETECT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+    int neighbors;
+} FaceBox;
+
+typedef struct {
+    int min_size;
+    int max_size;
+    float scale_factor;
+    int min_neighbors;
+} FaceDetectParams;
+
+typedef struct FaceDetector FaceDetector;
+
+FaceDetectParams face_detect_default_params(void);
+
+FaceDetector *face_detector_load(const char *path);
+void face_detector_free(FaceDetector *detector);
+int face_detector_window_width(const FaceDetector *detector);
+int face_detector_window_height(const FaceDetector *detector);
+
+size_t face_detector_detect(const FaceDetector *detector,
+                            const uint8_t *gray,
+                            int width,
+                            int height,
+                            size_t stride,
+                            const FaceDetectParams *params,
+                            FaceBox *boxes,
+                            size_t max_boxes);
+
+#endif
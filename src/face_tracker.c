@@ -0,0 +1,79 @@
+#include "face_tracker.h"
+
+float face_box_iou(const FaceBox *a, const FaceBox *b) {
+    int left = a->x > b->x ? a->x : b->x;
+    int top = a->y > b->y ? a->y : b->y;
+    int right = a->x + a->width < b->x + b->width ? a->x + a->width : b->x + b->width;
+    int bottom = a->y + a->height < b->y + b->height ? a->y + a->height : b->y + b->height;
+    if (right <= left || bottom <= top) {
+        return 0.0f;
+    }
+    double overlap = (double)(right - left) * (double)(bottom - top);
+    double area_a = (double)a->width * (double)a->height;
+    double area_b = (double)b->width * (double)b->height;
+    return (float)(overlap / (area_a + area_b - overlap));
+}
+
+/*
+ * Pairs each current box with at most one previous box, best overlap first.
+ * match[i] is the index of the previous box for current box i, or -1 for a
+ * face that has no predecessor above min_iou. Returns the number of pairs.
+ * Face counts are small, so the quadratic greedy pass beats anything smarter.
+ */
+size_t face_tracker_associate(const FaceBox *previous,
+                              size_t previous_count,
+                              const FaceBox *current,
+                              size_t current_count,
+                              float min_iou,
+                              int *match,
+                              float *match_iou) {
+    if (previous_count > FACE_TRACKER_MAX_FACES) {
+        previous_count = FACE_TRACKER_MAX_FACES;
+    }
+    if (current_count > FACE_TRACKER_MAX_FACES) {
+        current_count = FACE_TRACKER_MAX_FACES;
+    }
+
+    bool previous_taken[FACE_TRACKER_MAX_FACES] = {false};
+    for (size_t i = 0; i < current_count; i++) {
+        match[i] = -1;
+        if (match_iou != NULL) {
+            match_iou[i] = 0.0f;
+        }
+    }
+
+    size_t pairs = 0;
+    for (;;) {
+        float best = min_iou;
+        size_t best_current = 0;
+        size_t best_previous = 0;
+        bool found = false;
+        for (size_t i = 0; i < current_count; i++) {
+            if (match[i] >= 0) {
+                continue;
+            }
+            for (size_t j = 0; j < previous_count; j++) {
+                if (previous_taken[j]) {
+                    continue;
+                }
+                float iou = face_box_iou(&current[i], &previous[j]);
+                if (iou > 0.0f && iou >= best && (!found || iou > best)) {
+                    best = iou;
+                    best_current = i;
+                    best_previous = j;
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            break;
+        }
+        match[best_current] = (int)best_previous;
+        if (match_iou != NULL) {
+            match_iou[best_current] = best;
+        }
+        previous_taken[best_previous] = true;
+        pairs++;
+    }
+    return pairs;
+}
@@ -0,0 +1,20 @@
+#ifndef FACE_TRACKER_H
+#define FACE_TRACKER_H
+
+#include "face_detect.h"
+
+#include <stddef.h>
+
+#define FACE_TRACKER_MAX_FACES 64
+
+float face_box_iou(const FaceBox *a, const FaceBox *b);
+
+size_t face_tracker_associate(const FaceBox *previous,
+                              size_t previous_count,
+                              const FaceBox *current,
+                              size_t current_count,
+                              float min_iou,
+                              int *match,
+                              float *match_iou);
+
+#endif
@@ -0,0 +1,715 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "frame_store.h"
+
+#include "http.h"
+#include "pipeline.h"
+#include "server_config.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORD_MAGIC 0x324d5246u /* "FRM2" */
+#define RECORD_ALIGN 8u
+#define MAX_SEGMENTS 1024
+
+/*
+ * Segment files are preallocated to `segment_bytes` and filled front to back
+ * with 8-byte aligned records; the zero-filled tail reads as magic 0, which
+ * marks the end. Streams share the segments but not a clock (batch frames
+ * carry camera capture times), so times only grow within one stream. Each
+ * segment has a sidecar index holding a (time, offset, stream) entry for a
+ * stream's first record and then one per `index_interval_ms` of that stream,
+ * so a lookup starts at the stream's last entry not after the time and walks
+ * one interval, stepping over other streams' records.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t length;
+    uint64_t time_ms;
+    uint64_t stream;
+} RecordHeader;
+
+typedef struct {
+    uint64_t time_ms;
+    uint64_t offset;
+    uint64_t stream;
+} IndexEntry;
+
+typedef struct {
+    uint64_t first_ms;
+    uint64_t last_ms;
+    int fd;
+    int index_fd;
+    const unsigned char *map;
+    size_t size;
+    size_t end;
+    IndexEntry *index;
+    size_t index_count;
+    size_t index_capacity;
+} Segment;
+
+typedef struct {
+    uint64_t time_ms;
+    size_t length;
+    unsigned char *data;
+} StoredFrame;
+
+typedef struct {
+    bool valid;
+    uint64_t stream;
+    uint64_t last_ms;
+    size_t head;
+    size_t count;
+    size_t bytes;
+    StoredFrame *frames;
+} StreamHistory;
+
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool store_open = false;
+static FrameStoreParams params;
+static FrameStoreStats stats;
+static StreamHistory histories[PIPELINE_MAX_STREAMS];
+
+static char record_dir[MAX_ASSET_PATH_SIZE];
+static Segment segments[MAX_SEGMENTS];
+static size_t segment_count = 0;
+
+static size_t record_size(size_t length) {
+    return (sizeof(RecordHeader) + length + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+static bool segment_path(uint64_t first_ms, const char *suffix, char *out, size_t capacity) {
+    int n = snprintf(out, capacity, "%s/%016llu.%s", record_dir, (unsigned long long)first_ms,
+                     suffix);
+    return n >= 0 && (size_t)n < capacity;
+}
+
+static void segment_reset(Segment *segment) {
+    memset(segment, 0, sizeof(*segment));
+    segment->fd = -1;
+    segment->index_fd = -1;
+}
+
+static void segment_close(Segment *segment) {
+    if (segment->map != NULL) {
+        munmap((void *)segment->map, segment->size);
+    }
+    if (segment->fd >= 0) {
+        close(segment->fd);
+    }
+    if (segment->index_fd >= 0) {
+        close(segment->index_fd);
+    }
+    free(segment->index);
+    segment_reset(segment);
+}
+
+static bool index_push(Segment *segment, const IndexEntry *entry) {
+    if (segment->index_count == segment->index_capacity) {
+        size_t capacity = segment->index_capacity > 0 ? segment->index_capacity * 2 : 64;
+        IndexEntry *grown = (IndexEntry *)realloc(segment->index, capacity * sizeof(*grown));
+        if (grown == NULL) {
+            return false;
+        }
+        segment->index = grown;
+        segment->index_capacity = capacity;
+    }
+    segment->index[segment->index_count++] = *entry;
+    return true;
+}
+
+/* The stream's newest index entry in the segment with a time not after `at_ms`, or NULL. */
+static const IndexEntry *index_find(const Segment *segment, uint64_t stream, uint64_t at_ms) {
+    for (size_t i = segment->index_count; i > 0; i--) {
+        const IndexEntry *entry = &segment->index[i - 1];
+        if (entry->stream == stream && entry->time_ms <= at_ms) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static bool record_at(const Segment *segment, size_t offset, RecordHeader *out) {
+    if (offset + sizeof(RecordHeader) > segment->size) {
+        return false;
+    }
+    memcpy(out, segment->map + offset, sizeof(*out));
+    return out->magic == RECORD_MAGIC && offset + record_size(out->length) <= segment->size;
+}
+
+/*
+ * Maps an existing segment and finds its end by walking records from the
+ * last indexed offset, so reopening costs one short walk per segment. An
+ * index entry not matching its record ends the index, and the file is cut
+ * back to the entries kept so later appends follow them.
+ */
+static bool segment_load(uint64_t first_ms, Segment *segment) {
+    char path[MAX_ASSET_PATH_SIZE];
+    char index_path[MAX_ASSET_PATH_SIZE];
+    if (!segment_path(first_ms, "frames", path, sizeof(path)) ||
+        !segment_path(first_ms, "index", index_path, sizeof(index_path))) {
+        return false;
+    }
+    segment_reset(segment);
+    segment->first_ms = first_ms;
+    segment->fd = open(path, O_RDWR | O_CLOEXEC);
+    segment->index_fd = open(index_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    if (segment->fd < 0 || segment->index_fd < 0 || fstat(segment->fd, &st) != 0 ||
+        st.st_size < (off_t)sizeof(RecordHeader)) {
+        return false;
+    }
+    segment->size = (size_t)st.st_size;
+    void *map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, segment->fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    segment->map = (const unsigned char *)map;
+
+    IndexEntry entry;
+    while (read(segment->index_fd, &entry, sizeof(entry)) == (ssize_t)sizeof(entry)) {
+        RecordHeader header;
+        if (!record_at(segment, (size_t)entry.offset, &header) ||
+            header.stream != entry.stream || header.time_ms != entry.time_ms ||
+            !index_push(segment, &entry)) {
+            break;
+        }
+    }
+    if (ftruncate(segment->index_fd, (off_t)(segment->index_count * sizeof(entry))) != 0) {
+        return false;
+    }
+
+    size_t offset = segment->index_count > 0
+                        ? (size_t)segment->index[segment->index_count - 1].offset
+                        : 0;
+    segment->last_ms = first_ms;
+    RecordHeader header;
+    while (record_at(segment, offset, &header)) {
+        segment->last_ms = header.time_ms;
+        offset += record_size(header.length);
+    }
+    segment->end = offset;
+    return true;
+}
+
+static bool segment_create(uint64_t first_ms, Segment *segment) {
+    char path[MAX_ASSET_PATH_SIZE];
+    char index_path[MAX_ASSET_PATH_SIZE];
+    segment_reset(segment);
+    int fd = -1;
+    for (int attempt = 0;; attempt++, first_ms++) {
+        if (!segment_path(first_ms, "frames", path, sizeof(path))) {
+            return false;
+        }
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            break;
+        }
+        /* Two segments opened in the same millisecond: name the second one a tick later. */
+        if (errno != EEXIST || attempt == 16) {
+            perror("frame segment open");
+            return false;
+        }
+    }
+    segment->first_ms = first_ms;
+    segment->last_ms = first_ms;
+    segment->fd = fd;
+    segment->size = params.segment_bytes;
+    /* Reserve the blocks up front so appends never extend the file. */
+    if (posix_fallocate(fd, 0, (off_t)segment->size) != 0 &&
+        ftruncate(fd, (off_t)segment->size) != 0) {
+        perror("frame segment allocate");
+        unlink(path);
+        return false;
+    }
+    void *map = mmap(NULL, segment->size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED || !segment_path(first_ms, "index", index_path, sizeof(index_path))) {
+        if (map != MAP_FAILED) {
+            munmap(map, segment->size);
+        }
+        unlink(path);
+        return false;
+    }
+    segment->map = (const unsigned char *)map;
+    segment->index_fd =
+        open(index_path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (segment->index_fd < 0) {
+        unlink(path);
+        return false;
+    }
+    return true;
+}
+
+static void drop_oldest_segment(void) {
+    char path[MAX_ASSET_PATH_SIZE];
+    Segment *oldest = &segments[0];
+    if (segment_path(oldest->first_ms, "frames", path, sizeof(path))) {
+        unlink(path);
+    }
+    if (segment_path(oldest->first_ms, "index", path, sizeof(path))) {
+        unlink(path);
+    }
+    segment_close(oldest);
+    memmove(&segments[0], &segments[1], (segment_count - 1) * sizeof(Segment));
+    segment_count--;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static bool recorder_open(const char *directory) {
+    int n = snprintf(record_dir, sizeof(record_dir), "%s", directory);
+    if (n < 0 || (size_t)n >= sizeof(record_dir)) {
+        return false;
+    }
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        perror("frame record mkdir");
+        return false;
+    }
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        perror("frame record opendir");
+        return false;
+    }
+    uint64_t found[MAX_SEGMENTS];
+    size_t found_count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && found_count < MAX_SEGMENTS) {
+        char *end = NULL;
+        unsigned long long first_ms = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name && strcmp(end, ".frames") == 0) {
+            found[found_count++] = (uint64_t)first_ms;
+        }
+    }
+    closedir(dir);
+    qsort(found, found_count, sizeof(found[0]), compare_u64);
+
+    for (size_t i = 0; i < found_count; i++) {
+        Segment *segment = &segments[segment_count];
+        if (!segment_load(found[i], segment)) {
+            fprintf(stderr, "Skipping unreadable frame segment %016llu\n",
+                    (unsigned long long)found[i]);
+            segment_close(segment);
+            continue;
+        }
+        segment_count++;
+    }
+    while (segment_count > params.max_segments) {
+        drop_oldest_segment();
+    }
+    return true;
+}
+
+static bool record_frame(uint64_t stream, uint64_t time_ms, const unsigned char *data,
+                         size_t length) {
+    size_t size = record_size(length);
+    if (size > params.segment_bytes) {
+        return false;
+    }
+    Segment *active = segment_count > 0 ? &segments[segment_count - 1] : NULL;
+    if (active == NULL || active->end + size > active->size) {
+        if (segment_count == params.max_segments) {
+            drop_oldest_segment();
+        }
+        /* Named after its first frame, but always after the segment before it. */
+        uint64_t first_ms = time_ms;
+        if (segment_count > 0 && first_ms <= segments[segment_count - 1].first_ms) {
+            first_ms = segments[segment_count - 1].first_ms + 1;
+        }
+        active = &segments[segment_count];
+        if (!segment_create(first_ms, active)) {
+            segment_close(active);
+            return false;
+        }
+        segment_count++;
+    }
+
+    /* Payload first: a header on disk always has its bytes behind it. */
+    RecordHeader header = {RECORD_MAGIC, (uint32_t)length, time_ms, stream};
+    off_t offset = (off_t)active->end;
+    if (pwrite(active->fd, data, length, offset + (off_t)sizeof(header)) != (ssize_t)length ||
+        pwrite(active->fd, &header, sizeof(header), offset) != (ssize_t)sizeof(header)) {
+        return false;
+    }
+    const IndexEntry *last = index_find(active, stream, UINT64_MAX);
+    if (last == NULL || time_ms >= last->time_ms + params.index_interval_ms) {
+        IndexEntry entry = {time_ms, (uint64_t)active->end, stream};
+        if (index_push(active, &entry)) {
+            ssize_t written = write(active->index_fd, &entry, sizeof(entry));
+            (void)written;
+        }
+    }
+    active->end += size;
+    active->last_ms = time_ms;
+    return true;
+}
+
+static StreamHistory *history_for(uint64_t stream, bool create) {
+    StreamHistory *oldest = &histories[0];
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        StreamHistory *history = &histories[i];
+        if (history->valid && history->stream == stream) {
+            return history;
+        }
+        if (!history->valid) {
+            if (oldest->valid) {
+                oldest = history;
+            }
+        } else if (oldest->valid && history->last_ms < oldest->last_ms) {
+            oldest = history;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    /* The stream idle longest gives up its slot and its frames. */
+    while (oldest->count > 0) {
+        StoredFrame *frame = &oldest->frames[oldest->head];
+        free(frame->data);
+        oldest->head = (oldest->head + 1) % params.max_frames;
+        oldest->count--;
+        stats.evicted++;
+    }
+    oldest->valid = true;
+    oldest->stream = stream;
+    oldest->last_ms = 0;
+    oldest->bytes = 0;
+    oldest->head = 0;
+    return oldest;
+}
+
+static void history_append(StreamHistory *history,
+                           uint64_t time_ms,
+                           const unsigned char *data,
+                           size_t length) {
+    history->last_ms = time_ms;
+    if (length > params.stream_bytes) {
+        return;
+    }
+    while (history->count > 0 &&
+           (history->count == params.max_frames || history->bytes + length > params.stream_bytes)) {
+        StoredFrame *frame = &history->frames[history->head];
+        history->bytes -= frame->length;
+        free(frame->data);
+        frame->data = NULL;
+        history->head = (history->head + 1) % params.max_frames;
+        history->count--;
+        stats.evicted++;
+    }
+    unsigned char *copy = (unsigned char *)malloc(length);
+    if (copy == NULL) {
+        return;
+    }
+    memcpy(copy, data, length);
+    StoredFrame *slot = &history->frames[(history->head + history->count) % params.max_frames];
+    slot->time_ms = time_ms;
+    slot->length = length;
+    slot->data = copy;
+    history->count++;
+    history->bytes += length;
+}
+
+/* Newest frame of the stream at or before `at_ms`, or NULL. */
+static const StoredFrame *history_find(const StreamHistory *history, uint64_t at_ms) {
+    for (size_t i = history->count; i > 0; i--) {
+        const StoredFrame *frame = &history->frames[(history->head + i - 1) % params.max_frames];
+        if (frame->time_ms <= at_ms) {
+            return frame;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Searches one segment for the newest record of `stream` at or before
+ * `at_ms`, walking from the stream's last index entry not after it until the
+ * stream's next record is later. Other streams' times say nothing about
+ * this one, so their records are only stepped over. The stream's first
+ * record in a segment is always indexed: no entry means no such record here.
+ */
+static bool segment_find(const Segment *segment,
+                         uint64_t stream,
+                         uint64_t at_ms,
+                         size_t *offset_out,
+                         RecordHeader *header_out) {
+    const IndexEntry *entry = index_find(segment, stream, at_ms);
+    if (entry == NULL) {
+        return false;
+    }
+    bool found = false;
+    size_t offset = (size_t)entry->offset;
+    RecordHeader header;
+    while (offset < segment->end && record_at(segment, offset, &header)) {
+        if (header.stream == stream) {
+            if (header.time_ms > at_ms) {
+                break;
+            }
+            *offset_out = offset;
+            *header_out = header;
+            found = true;
+        }
+        offset += record_size(header.length);
+    }
+    return found;
+}
+
+bool frame_store_open(const FrameStoreParams *params_in) {
+    if (params_in == NULL || params_in->stream_bytes == 0 || params_in->max_frames == 0) {
+        return false;
+    }
+    bool recording = params_in->record_dir != NULL && params_in->record_dir[0] != '\0';
+    if (recording && (params_in->segment_bytes < 2 * sizeof(RecordHeader) ||
+                      params_in->max_segments == 0 || params_in->max_segments > MAX_SEGMENTS)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    if (store_open) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    params = *params_in;
+    params.record_dir = NULL;
+    memset(&stats, 0, sizeof(stats));
+    memset(histories, 0, sizeof(histories));
+    bool ok = true;
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS && ok; i++) {
+        histories[i].frames = (StoredFrame *)calloc(params.max_frames, sizeof(StoredFrame));
+        ok = histories[i].frames != NULL;
+    }
+    segment_count = 0;
+    if (ok && recording) {
+        ok = recorder_open(params_in->record_dir);
+        stats.recording = ok;
+    }
+    if (!ok) {
+        while (segment_count > 0) {
+            segment_close(&segments[--segment_count]);
+        }
+        for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+            free(histories[i].frames);
+            histories[i].frames = NULL;
+        }
+    }
+    store_open = ok;
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+void frame_store_close(void) {
+    pthread_mutex_lock(&store_mutex);
+    if (!store_open) {
+        pthread_mutex_unlock(&store_mutex);
+        return;
+    }
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        StreamHistory *history = &histories[i];
+        for (size_t j = 0; j < history->count; j++) {
+            free(history->frames[(history->head + j) % params.max_frames].data);
+        }
+        free(history->frames);
+        memset(history, 0, sizeof(*history));
+    }
+    while (segment_count > 0) {
+        segment_close(&segments[--segment_count]);
+    }
+    store_open = false;
+    pthread_mutex_unlock(&store_mutex);
+}
+
+/*
+ * Keeps the frame in its stream's in-memory history and, when recording,
+ * appends it to the active segment. Returns false when the frame was not
+ * kept: the store is closed, or the frame is older than the stream's newest,
+ * which would break the per-stream ordering lookups rely on. A kept frame
+ * the recorder could not write sets `*record_failed` when it is not NULL.
+ */
+bool frame_store_append(const char *stream_id,
+                        uint64_t time_ms,
+                        const unsigned char *data,
+                        size_t length,
+                        bool *record_failed) {
+    if (record_failed != NULL) {
+        *record_failed = false;
+    }
+    if (data == NULL || length == 0 || length > UINT32_MAX) {
+        return false;
+    }
+    uint64_t stream = pipeline_stream_key(stream_id);
+    pthread_mutex_lock(&store_mutex);
+    StreamHistory *history = store_open ? history_for(stream, true) : NULL;
+    if (history == NULL || time_ms < history->last_ms) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    history_append(history, time_ms, data, length);
+    stats.appended++;
+    if (stats.recording) {
+        if (record_frame(stream, time_ms, data, length)) {
+            stats.recorded++;
+        } else {
+            stats.record_failures++;
+            if (record_failed != NULL) {
+                *record_failed = true;
+            }
+        }
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return true;
+}
+
+/*
+ * Answers with the newest frame of the stream taken at or before `at_ms`:
+ * from memory when the history still holds it, otherwise straight from the
+ * recorded segment with sendfile(). Returns 200 once a response is written,
+ * or 404 (nothing written) when no such frame is kept.
+ */
+int frame_store_serve(int client_fd, const char *stream_id, uint64_t at_ms) {
+    uint64_t stream = pipeline_stream_key(stream_id);
+    char headers[128];
+    pthread_mutex_lock(&store_mutex);
+    if (!store_open) {
+        pthread_mutex_unlock(&store_mutex);
+        return 404;
+    }
+
+    StreamHistory *history = history_for(stream, false);
+    const StoredFrame *frame = history != NULL ? history_find(history, at_ms) : NULL;
+    if (frame != NULL) {
+        unsigned char *copy = (unsigned char *)malloc(frame->length);
+        if (copy == NULL) {
+            pthread_mutex_unlock(&store_mutex);
+            return 500;
+        }
+        size_t length = frame->length;
+        memcpy(copy, frame->data, length);
+        snprintf(headers, sizeof(headers), "Cache-Control: no-store\r\nX-Frame-Time: %llu\r\n",
+                 (unsigned long long)frame->time_ms);
+        stats.served_memory++;
+        pthread_mutex_unlock(&store_mutex);
+        send_http_response(client_fd, "200 OK", "image/jpeg", copy, length, headers);
+        free(copy);
+        return 200;
+    }
+
+    for (size_t i = segment_count; i > 0; i--) {
+        const Segment *segment = &segments[i - 1];
+        size_t offset = 0;
+        RecordHeader header;
+        if (segment_find(segment, stream, at_ms, &offset, &header)) {
+            /* A dup keeps the file readable even if retention drops the segment meanwhile. */
+            int fd = dup(segment->fd);
+            stats.served_disk++;
+            pthread_mutex_unlock(&store_mutex);
+            if (fd < 0) {
+                return 500;
+            }
+            snprintf(headers, sizeof(headers),
+                     "Cache-Control: no-store\r\nX-Frame-Time: %llu\r\n",
+                     (unsigned long long)header.time_ms);
+            send_http_file_response(client_fd, "200 OK", "image/jpeg", fd,
+                                    (off_t)(offset + sizeof(RecordHeader)), header.length,
+                                    headers);
+            close(fd);
+            return 200;
+        }
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return 404;
+}
+
+/*
+ * Walks the in-memory history of every stream, for handing it to a new
+ * process on restart. Holds the store lock throughout, so the walk sees one
+ * consistent state; a closed store has nothing to walk. Returns false if
+ * `visit` stopped the walk.
+ */
+bool frame_store_export(FrameStoreVisitor visit, void *ctx) {
+    pthread_mutex_lock(&store_mutex);
+    bool ok = true;
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS && store_open && ok; i++) {
+        const StreamHistory *history = &histories[i];
+        for (size_t j = 0; j < history->count && ok; j++) {
+            const StoredFrame *frame = &history->frames[(history->head + j) % params.max_frames];
+            ok = visit(history->stream, frame->time_ms, frame->data, frame->length, ctx);
+        }
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+/* Puts an exported frame back into memory; it was recorded (if at all) when first appended. */
+bool frame_store_restore(uint64_t stream,
+                         uint64_t time_ms,
+                         const unsigned char *data,
+                         size_t length) {
+    if (data == NULL || length == 0 || length > UINT32_MAX) {
+        return false;
+    }
+    pthread_mutex_lock(&store_mutex);
+    bool ok = store_open;
+    if (ok) {
+        history_append(history_for(stream, true), time_ms, data, length);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+/*
+ * Time of the newest frame appended to the stream, or 0 if it has none in
+ * memory. frame_store_append() refuses frames with an earlier time.
+ */
+uint64_t frame_store_last_ms(const char *stream_id) {
+    uint64_t stream = pipeline_stream_key(stream_id);
+    pthread_mutex_lock(&store_mutex);
+    const StreamHistory *history = store_open ? history_for(stream, false) : NULL;
+    uint64_t last_ms = history != NULL ? history->last_ms : 0;
+    pthread_mutex_unlock(&store_mutex);
+    return last_ms;
+}
+
+/* Hands the stream's newest kept frame to `visit`, under the store lock; false if there is none. */
+bool frame_store_visit_latest(const char *stream_id, FrameStoreVisitor visit, void *ctx) {
+    uint64_t stream = pipeline_stream_key(stream_id);
+    pthread_mutex_lock(&store_mutex);
+    const StreamHistory *history = store_open ? history_for(stream, false) : NULL;
+    bool found = history != NULL && history->count > 0;
+    if (found) {
+        size_t newest = (history->head + history->count - 1) % params.max_frames;
+        const StoredFrame *frame = &history->frames[newest];
+        visit(stream, frame->time_ms, frame->data, frame->length, ctx);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return found;
+}
+
+void frame_store_stats(FrameStoreStats *out) {
+    pthread_mutex_lock(&store_mutex);
+    *out = stats;
+    out->streams = 0;
+    out->frames = 0;
+    out->bytes = 0;
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        if (histories[i].valid) {
+            out->streams++;
+            out->frames += histories[i].count;
+            out->bytes += histories[i].bytes;
+        }
+    }
+    out->segments = segment_count;
+    pthread_mutex_unlock(&store_mutex);
+}
@@ -0,0 +1,57 @@
+#ifndef FRAME_STORE_H
+#define FRAME_STORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    size_t stream_bytes;
+    size_t max_frames;
+    const char *record_dir;
+    size_t segment_bytes;
+    size_t max_segments;
+    unsigned index_interval_ms;
+} FrameStoreParams;
+
+typedef struct {
+    size_t streams;
+    size_t frames;
+    size_t bytes;
+    uint64_t appended;
+    uint64_t evicted;
+    bool recording;
+    size_t segments;
+    uint64_t recorded;
+    uint64_t record_failures;
+    uint64_t served_memory;
+    uint64_t served_disk;
+} FrameStoreStats;
+
+bool frame_store_open(const FrameStoreParams *params);
+void frame_store_close(void);
+
+bool frame_store_append(const char *stream_id,
+                        uint64_t time_ms,
+                        const unsigned char *data,
+                        size_t length,
+                        bool *record_failed);
+int frame_store_serve(int client_fd, const char *stream_id, uint64_t at_ms);
+uint64_t frame_store_last_ms(const char *stream_id);
+
+/* Called oldest first per stream; returning false stops the walk. */
+typedef bool (*FrameStoreVisitor)(uint64_t stream,
+                                  uint64_t time_ms,
+                                  const unsigned char *data,
+                                  size_t length,
+                                  void *ctx);
+bool frame_store_export(FrameStoreVisitor visit, void *ctx);
+bool frame_store_visit_latest(const char *stream_id, FrameStoreVisitor visit, void *ctx);
+bool frame_store_restore(uint64_t stream,
+                         uint64_t time_ms,
+                         const unsigned char *data,
+                         size_t length);
+
+void frame_store_stats(FrameStoreStats *out);
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "frame_variants.h"
+
+#include "http.h"
+#include "image.h"
+#include "jpeg_decode.h"
+#include "jpeg_encode.h"
+#include "server_config.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * One entry per requested width of the current frame. The first request for a
+ * width builds it outside the lock while later requests for the same width wait
+ * on `variants_ready`, so a size costs one encode however many viewers ask.
+ * Entries are reference counted: invalidation unlinks them at once and the last
+ * viewer still sending one frees it.
+ */
+typedef struct {
+    int width;
+    int out_width;
+    int out_height;
+    unsigned char *data;
+    size_t length;
+    bool ready;
+    bool failed;
+    bool passthrough;
+    bool cached;
+    unsigned refs;
+} Variant;
+
+static pthread_mutex_t variants_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t variants_ready = PTHREAD_COND_INITIALIZER;
+static Variant *variants[FRAME_VARIANT_SLOTS];
+static size_t variant_count = 0;
+static FrameVariantStats stats;
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static void variant_free(Variant *variant) {
+    free(variant->data);
+    free(variant);
+}
+
+/* Decodes with DCT scaling plus the SIMD resize, then re-encodes the smaller image. */
+static void build_variant(Variant *variant, const unsigned char *frame, size_t length) {
+    if (!jpeg_decode_available() || !jpeg_encode_available()) {
+        variant->passthrough = true;
+        return;
+    }
+
+    int src_width = 0;
+    int src_height = 0;
+    if (!jpeg_decode_size(frame, length, &src_width, &src_height)) {
+        variant->failed = true;
+        return;
+    }
+    if (src_width <= variant->width) {
+        variant->passthrough = true;
+        variant->out_width = src_width;
+        variant->out_height = src_height;
+        return;
+    }
+    image_fit_size(src_width, src_height, variant->width, src_height, &variant->out_width,
+                   &variant->out_height);
+
+    ImageBuffer image;
+    memset(&image, 0, sizeof(image));
+    image.stride = align_up((size_t)variant->out_width, IMAGE_ALIGNMENT);
+    image.capacity_width = variant->out_width;
+    image.capacity_height = variant->out_height;
+    size_t plane_size = image.stride * (size_t)variant->out_height;
+    uint8_t *block = (uint8_t *)aligned_alloc(IMAGE_ALIGNMENT, plane_size * 4);
+    if (block == NULL) {
+        variant->failed = true;
+        return;
+    }
+    image.gray = block;
+    image.r = block + plane_size;
+    image.g = block + plane_size * 2;
+    image.b = block + plane_size * 3;
+
+    if (!jpeg_decode_frame(frame, length, variant->out_width, variant->out_height, &image,
+                           NULL) ||
+        !jpeg_encode_image(&image, FRAME_VARIANT_QUALITY, &variant->data, &variant->length)) {
+        variant->failed = true;
+    }
+    free(block);
+}
+
+static void variant_release(Variant *variant) {
+    pthread_mutex_lock(&variants_mutex);
+    variant->refs--;
+    bool unused = variant->refs == 0 && !variant->cached;
+    if (unused) {
+        stats.freed++;
+    }
+    pthread_mutex_unlock(&variants_mutex);
+    if (unused) {
+        variant_free(variant);
+    }
+}
+
+void frame_variants_invalidate(void) {
+    Variant *unused[FRAME_VARIANT_SLOTS];
+    size_t unused_count = 0;
+    pthread_mutex_lock(&variants_mutex);
+    for (size_t i = 0; i < variant_count; i++) {
+        Variant *variant = variants[i];
+        variant->cached = false;
+        stats.bytes -= variant->length;
+        if (variant->refs == 0) {
+            unused[unused_count++] = variant;
+            stats.freed++;
+        }
+        variants[i] = NULL;
+    }
+    variant_count = 0;
+    stats.generation++;
+    pthread_mutex_unlock(&variants_mutex);
+    for (size_t i = 0; i < unused_count; i++) {
+        variant_free(unused[i]);
+    }
+}
+
+/*
+ * Answers with `frame` (the currently published JPEG) scaled down to `width`
+ * pixels wide, building and caching that size on first use. A frame already
+ * no wider than `width` is sent as is. Returns 200 once a response is written,
+ * or 400/422/500 (nothing written).
+ */
+int frame_variants_serve(int client_fd, const unsigned char *frame, size_t length, int width) {
+    if (width < FRAME_VARIANT_MIN_WIDTH || width > FRAME_VARIANT_MAX_WIDTH) {
+        return 400;
+    }
+
+    bool build = false;
+    pthread_mutex_lock(&variants_mutex);
+    stats.requests++;
+    Variant *variant = NULL;
+    for (size_t i = 0; i < variant_count; i++) {
+        if (variants[i]->width == width) {
+            variant = variants[i];
+            break;
+        }
+    }
+    if (variant != NULL) {
+        variant->refs++;
+        if (variant->ready) {
+            stats.hits++;
+        } else {
+            stats.waits++;
+            while (!variant->ready) {
+                pthread_cond_wait(&variants_ready, &variants_mutex);
+            }
+        }
+    } else {
+        variant = (Variant *)calloc(1, sizeof(*variant));
+        if (variant == NULL) {
+            pthread_mutex_unlock(&variants_mutex);
+            return 500;
+        }
+        variant->width = width;
+        variant->refs = 1;
+        /* With every slot taken, the size is built for this request only. */
+        if (variant_count < FRAME_VARIANT_SLOTS) {
+            variant->cached = true;
+            variants[variant_count++] = variant;
+        } else {
+            stats.uncached++;
+        }
+        build = true;
+    }
+    pthread_mutex_unlock(&variants_mutex);
+
+    if (build) {
+        build_variant(variant, frame, length);
+        pthread_mutex_lock(&variants_mutex);
+        variant->ready = true;
+        if (variant->failed) {
+            stats.failures++;
+        } else {
+            stats.builds++;
+        }
+        if (variant->cached) {
+            stats.bytes += variant->length;
+        }
+        pthread_cond_broadcast(&variants_ready);
+        pthread_mutex_unlock(&variants_mutex);
+    }
+
+    if (variant->failed) {
+        variant_release(variant);
+        return 422;
+    }
+    const unsigned char *body = variant->passthrough ? frame : variant->data;
+    size_t body_length = variant->passthrough ? length : variant->length;
+    send_http_response(client_fd, "200 OK", "image/jpeg", body, body_length,
+                       "Cache-Control: no-store\r\n");
+    variant_release(variant);
+    return 200;
+}
+
+void frame_variants_stats(FrameVariantStats *out) {
+    pthread_mutex_lock(&variants_mutex);
+    *out = stats;
+    out->variants = variant_count;
+    pthread_mutex_unlock(&variants_mutex);
+}
@@ -0,0 +1,27 @@
+#ifndef FRAME_VARIANTS_H
+#define FRAME_VARIANTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t generation;
+    size_t variants;
+    size_t bytes;
+    uint64_t requests;
+    uint64_t hits;
+    uint64_t waits;
+    uint64_t builds;
+    uint64_t failures;
+    uint64_t uncached;
+    uint64_t freed;
+} FrameVariantStats;
+
+/* Drops the variants of the current frame; call whenever a new frame is published. */
+void frame_variants_invalidate(void);
+
+int frame_variants_serve(int client_fd, const unsigned char *frame, size_t length, int width);
+
+void frame_variants_stats(FrameVariantStats *out);
+
+#endif
@@ -0,0 +1,1702 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gallery.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GALLERY_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define GALLERY_HAVE_X86 0
+#endif
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+#define VECTOR_ALIGNMENT 32
+#define VECTOR_LANES 8
+#define LINK_LOCK_STRIPES 1024
+#define MAX_LEVEL 15
+#define EMPTY_ENTRY UINT64_MAX
+#define NO_UPPER_LINKS UINT32_MAX
+#define FLAG_DELETED 0x01u
+#define INT8_LANES 16
+#define INT8_LEVELS 127.0f
+#define PQ_CENTROIDS 256
+#define PQ_BLOCK 8
+#define PQ_TRAIN_ROWS 16384
+#define PQ_TRAIN_ITERATIONS 8
+
+#define SNAPSHOT_MAGIC "FGALLERY"
+#define SNAPSHOT_VERSION 1u
+#define SNAPSHOT_ALIGNMENT 64
+
+enum {
+    SECTION_IDS,
+    SECTION_VECTORS,
+    SECTION_LEVELS,
+    SECTION_FLAGS,
+    SECTION_LINKS0,
+    SECTION_UPPER_OFFSETS,
+    SECTION_UPPER_POOL,
+    SECTION_META,
+    SECTION_COUNT,
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t dim;
+    uint32_t stride;
+    uint32_t m;
+    uint32_t ef_construction;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t deleted;
+    uint64_t entry;
+    uint64_t upper_used;
+    uint64_t file_length;
+    uint64_t section_offsets[SECTION_COUNT];
+    uint64_t section_lengths[SECTION_COUNT];
+} SnapshotHeader;
+
+typedef float (*DotFn)(const float *a, const float *b, size_t padded_dim);
+
+typedef struct {
+    float distance;
+    uint32_t node;
+} HeapItem;
+
+typedef struct {
+    HeapItem *items;
+    size_t count;
+    size_t capacity;
+} Heap;
+
+/*
+ * Shared/exclusive gate around the storage arrays. Searches and the linking
+ * half of an insert hold it shared; growing the arrays holds it exclusively.
+ * Unlike a default pthread_rwlock it lets a waiting grower in ahead of new
+ * readers, so a steady search load cannot starve inserts.
+ */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t readers;
+    bool writer_waiting;
+    bool writer_active;
+} StorageGate;
+
+typedef struct SearchScratch {
+    uint32_t *visited;
+    size_t visited_capacity;
+    uint32_t epoch;
+    Heap candidates;
+    Heap results;
+    uint32_t *neighbors;
+    size_t neighbors_capacity;
+    float *lut;
+    size_t lut_capacity;
+    struct SearchScratch *next;
+} SearchScratch;
+
+struct Gallery {
+    size_t dim;
+    size_t stride;
+    size_t m;
+    size_t m0;
+    size_t ef_construction;
+    atomic_size_t ef_search;
+    size_t exact_search_limit;
+    size_t pq_subspaces;
+    atomic_size_t rerank;
+    double level_mult;
+    uint32_t rng;
+
+    StorageGate storage_gate;
+    pthread_mutex_t insert_mutex;
+    pthread_mutex_t link_locks[LINK_LOCK_STRIPES];
+
+    size_t capacity;
+    atomic_size_t count;
+    atomic_size_t deleted;
+    uint64_t *ids;
+    float *vectors;
+    uint8_t *levels;
+    uint8_t *flags;
+    uint32_t *links0;
+    uint32_t *upper_offsets;
+    uint32_t *upper_pool;
+    size_t upper_used;
+    size_t upper_capacity;
+    _Atomic uint64_t entry;
+
+    /*
+     * Compressed rows, always on the heap. int8 rows are code_stride bytes
+     * with one scale each; PQ codes are stored PQ_BLOCK rows at a time, one
+     * byte per row per subspace, so a scan loads eight rows' codes at once.
+     */
+    GalleryCodes codes;
+    size_t code_stride;
+    int8_t *int8_codes;
+    float *int8_scales;
+    uint8_t *pq_codes;
+    float *pq_codebook;
+
+    void *mapping;
+    size_t mapping_length;
+    bool arrays_mapped;
+    bool upper_mapped;
+
+    pthread_mutex_t scratch_mutex;
+    SearchScratch *scratch_free;
+};
+
+static atomic_int kernel_level = -1;
+
+static void gate_init(StorageGate *gate) {
+    pthread_mutex_init(&gate->mutex, NULL);
+    pthread_cond_init(&gate->cond, NULL);
+    gate->readers = 0;
+    gate->writer_waiting = false;
+    gate->writer_active = false;
+}
+
+static void gate_destroy(StorageGate *gate) {
+    pthread_cond_destroy(&gate->cond);
+    pthread_mutex_destroy(&gate->mutex);
+}
+
+static void gate_enter_shared(StorageGate *gate) {
+    pthread_mutex_lock(&gate->mutex);
+    while (gate->writer_waiting || gate->writer_active) {
+        pthread_cond_wait(&gate->cond, &gate->mutex);
+    }
+    gate->readers++;
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static void gate_leave_shared(StorageGate *gate) {
+    pthread_mutex_lock(&gate->mutex);
+    if (--gate->readers == 0 && gate->writer_waiting) {
+        pthread_cond_broadcast(&gate->cond);
+    }
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+/* Only called with insert_mutex held, so there is at most one writer. */
+static void gate_enter_exclusive(StorageGate *gate) {
+    pthread_mutex_lock(&gate->mutex);
+    gate->writer_waiting = true;
+    while (gate->readers > 0) {
+        pthread_cond_wait(&gate->cond, &gate->mutex);
+    }
+    gate->writer_waiting = false;
+    gate->writer_active = true;
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static void gate_leave_exclusive(StorageGate *gate) {
+    pthread_mutex_lock(&gate->mutex);
+    gate->writer_active = false;
+    pthread_cond_broadcast(&gate->cond);
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static GalleryKernelLevel detect_kernel_level(void) {
+#if GALLERY_HAVE_X86
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return GALLERY_KERNEL_AVX2;
+    }
+#endif
+    return GALLERY_KERNEL_SCALAR;
+}
+
+GalleryKernelLevel gallery_kernel_level(void) {
+    int level = atomic_load(&kernel_level);
+    if (level < 0) {
+        level = (int)detect_kernel_level();
+        atomic_store(&kernel_level, level);
+    }
+    return (GalleryKernelLevel)level;
+}
+
+GalleryKernelLevel gallery_set_kernel_level(GalleryKernelLevel level) {
+    GalleryKernelLevel supported = detect_kernel_level();
+    if (level > supported) {
+        level = supported;
+    }
+    atomic_store(&kernel_level, (int)level);
+    return level;
+}
+
+static float dot_scalar(const float *a, const float *b, size_t dim) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#if GALLERY_HAVE_X86
+AVX2_TARGET static float hsum256(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+    return _mm_cvtss_f32(lo);
+}
+
+/* padded_dim is a multiple of VECTOR_LANES; rows are zero-padded to it. */
+AVX2_TARGET static float dot_padded_avx2(const float *a, const float *b, size_t padded_dim) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= padded_dim; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    if (i < padded_dim) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    return hsum256(_mm256_add_ps(acc0, acc1));
+}
+
+AVX2_TARGET static float dot_avx2(const float *a, const float *b, size_t dim) {
+    size_t padded = dim / VECTOR_LANES * VECTOR_LANES;
+    float sum = padded > 0 ? dot_padded_avx2(a, b, padded) : 0.0f;
+    for (size_t i = padded; i < dim; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+/* Four rows per pass so each query load feeds four FMAs. */
+AVX2_TARGET static void dot4_padded_avx2(const float *query,
+                                         const float *rows,
+                                         size_t stride,
+                                         float *out) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    const float *r0 = rows;
+    const float *r1 = rows + stride;
+    const float *r2 = rows + stride * 2;
+    const float *r3 = rows + stride * 3;
+    for (size_t i = 0; i < stride; i += VECTOR_LANES) {
+        __m256 q = _mm256_load_ps(query + i);
+        acc0 = _mm256_fmadd_ps(q, _mm256_load_ps(r0 + i), acc0);
+        acc1 = _mm256_fmadd_ps(q, _mm256_load_ps(r1 + i), acc1);
+        acc2 = _mm256_fmadd_ps(q, _mm256_load_ps(r2 + i), acc2);
+        acc3 = _mm256_fmadd_ps(q, _mm256_load_ps(r3 + i), acc3);
+    }
+    out[0] = hsum256(acc0);
+    out[1] = hsum256(acc1);
+    out[2] = hsum256(acc2);
+    out[3] = hsum256(acc3);
+}
+
+AVX2_TARGET static __m256i widen_int8(const int8_t *in) {
+    return _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)in));
+}
+
+AVX2_TARGET static int32_t hsum_epi32(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+/* Four int8 rows per pass, as dot4_padded_avx2 does for floats. */
+AVX2_TARGET static void dot4_int8_avx2(const int8_t *query,
+                                       const int8_t *rows,
+                                       size_t stride,
+                                       int32_t *out) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+    for (size_t i = 0; i < stride; i += INT8_LANES) {
+        __m256i q = widen_int8(query + i);
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(q, widen_int8(rows + i)));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(q, widen_int8(rows + stride + i)));
+        acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(q, widen_int8(rows + stride * 2 + i)));
+        acc3 = _mm256_add_epi32(acc3, _mm256_madd_epi16(q, widen_int8(rows + stride * 3 + i)));
+    }
+    out[0] = hsum_epi32(acc0);
+    out[1] = hsum_epi32(acc1);
+    out[2] = hsum_epi32(acc2);
+    out[3] = hsum_epi32(acc3);
+}
+
+/* One PQ block: each subspace turns eight codes into eight table gathers. */
+AVX2_TARGET static void pq_block_avx2(const uint8_t *block,
+                                      const float *lut,
+                                      size_t subspaces,
+                                      float *out) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t s = 0;
+    for (; s + 2 <= subspaces; s += 2) {
+        __m256i index0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(block)));
+        __m256i index1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(block + PQ_BLOCK)));
+        acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(lut, index0, 4));
+        acc1 = _mm256_add_ps(acc1, _mm256_i32gather_ps(lut + PQ_CENTROIDS, index1, 4));
+        block += 2 * PQ_BLOCK;
+        lut += 2 * PQ_CENTROIDS;
+    }
+    if (s < subspaces) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)block));
+        acc0 = _mm256_add_ps(acc0, _mm256_i32gather_ps(lut, index, 4));
+    }
+    _mm256_storeu_ps(out, _mm256_add_ps(acc0, acc1));
+}
+#endif
+
+static int32_t dot_int8_scalar(const int8_t *a, const int8_t *b, size_t length) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        sum += (int32_t)a[i] * b[i];
+    }
+    return sum;
+}
+
+float gallery_dot(const float *a, const float *b, size_t dim) {
+#if GALLERY_HAVE_X86
+    if (gallery_kernel_level() == GALLERY_KERNEL_AVX2) {
+        return dot_avx2(a, b, dim);
+    }
+#endif
+    return dot_scalar(a, b, dim);
+}
+
+static DotFn select_dot(void) {
+#if GALLERY_HAVE_X86
+    if (gallery_kernel_level() == GALLERY_KERNEL_AVX2) {
+        return dot_padded_avx2;
+    }
+#endif
+    return dot_scalar;
+}
+
+/* Max-heap on distance: the root is the farthest item. */
+static bool heap_reserve(Heap *heap, size_t capacity) {
+    if (heap->capacity >= capacity) {
+        return true;
+    }
+    size_t next = heap->capacity > 0 ? heap->capacity : 64;
+    while (next < capacity) {
+        next *= 2;
+    }
+    HeapItem *items = (HeapItem *)realloc(heap->items, next * sizeof(*items));
+    if (items == NULL) {
+        return false;
+    }
+    heap->items = items;
+    heap->capacity = next;
+    return true;
+}
+
+static bool heap_push(Heap *heap, float distance, uint32_t node) {
+    if (!heap_reserve(heap, heap->count + 1)) {
+        return false;
+    }
+    size_t i = heap->count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap->items[parent].distance >= distance) {
+            break;
+        }
+        heap->items[i] = heap->items[parent];
+        i = parent;
+    }
+    heap->items[i].distance = distance;
+    heap->items[i].node = node;
+    return true;
+}
+
+static HeapItem heap_pop(Heap *heap) {
+    HeapItem top = heap->items[0];
+    HeapItem last = heap->items[--heap->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = i * 2 + 1;
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && heap->items[child + 1].distance > heap->items[child].distance) {
+            child++;
+        }
+        if (heap->items[child].distance <= last.distance) {
+            break;
+        }
+        heap->items[i] = heap->items[child];
+        i = child;
+    }
+    if (heap->count > 0) {
+        heap->items[i] = last;
+    }
+    return top;
+}
+
+static int compare_items(const void *a, const void *b) {
+    float da = ((const HeapItem *)a)->distance;
+    float db = ((const HeapItem *)b)->distance;
+    return (da > db) - (da < db);
+}
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+GalleryParams gallery_default_params(size_t dim) {
+    GalleryParams params;
+    params.dim = dim;
+    params.initial_capacity = 1024;
+    params.hnsw_m = 16;
+    params.hnsw_ef_construction = 200;
+    params.hnsw_ef_search = 64;
+    params.exact_search_limit = 10000;
+    params.pq_subspaces = dim % 4 == 0 ? dim / 4 : dim;
+    params.rerank = 8;
+    params.seed = 42;
+    return params;
+}
+
+static void *copy_array(const void *array, size_t used_bytes, size_t new_bytes, size_t alignment) {
+    void *copy = alignment > 0 ? aligned_alloc(alignment, new_bytes) : malloc(new_bytes);
+    if (copy != NULL && used_bytes > 0) {
+        memcpy(copy, array, used_bytes);
+    }
+    return copy;
+}
+
+/* Code arrays never live in a mapping, so unlike the rest they can be realloc'd. */
+static bool grow_codes(Gallery *gallery, size_t capacity) {
+    size_t rows = capacity > 0 ? capacity : 1;
+    if (gallery->codes == GALLERY_CODES_INT8) {
+        int8_t *codes = (int8_t *)realloc(gallery->int8_codes, rows * gallery->code_stride);
+        if (codes == NULL) {
+            return false;
+        }
+        gallery->int8_codes = codes;
+        float *scales = (float *)realloc(gallery->int8_scales, rows * sizeof(*scales));
+        if (scales == NULL) {
+            return false;
+        }
+        gallery->int8_scales = scales;
+    } else if (gallery->codes == GALLERY_CODES_PQ) {
+        uint8_t *codes = (uint8_t *)realloc(gallery->pq_codes,
+                                            align_up(rows, PQ_BLOCK) * gallery->pq_subspaces);
+        if (codes == NULL) {
+            return false;
+        }
+        gallery->pq_codes = codes;
+    }
+    return true;
+}
+
+static void free_codes(Gallery *gallery) {
+    free(gallery->int8_codes);
+    free(gallery->int8_scales);
+    free(gallery->pq_codes);
+    free(gallery->pq_codebook);
+    gallery->int8_codes = NULL;
+    gallery->int8_scales = NULL;
+    gallery->pq_codes = NULL;
+    gallery->pq_codebook = NULL;
+    gallery->codes = GALLERY_CODES_NONE;
+}
+
+/*
+ * Arrays are always copied rather than realloc'd: after gallery_map() they
+ * point into the snapshot mapping, which must not be passed to free().
+ */
+static bool grow_storage(Gallery *gallery, size_t capacity) {
+    if (!grow_codes(gallery, capacity)) {
+        return false;
+    }
+    size_t count = atomic_load(&gallery->count);
+    size_t row_bytes = gallery->stride * sizeof(float);
+    size_t link_words = gallery->m0 + 1;
+    uint64_t *ids = (uint64_t *)copy_array(gallery->ids, count * sizeof(*ids),
+                                           capacity * sizeof(*ids), 0);
+    float *vectors = (float *)copy_array(gallery->vectors, count * row_bytes, capacity * row_bytes,
+                                         VECTOR_ALIGNMENT);
+    uint8_t *levels = (uint8_t *)copy_array(gallery->levels, count, capacity, 0);
+    uint8_t *flags = (uint8_t *)copy_array(gallery->flags, count, capacity, 0);
+    uint32_t *links0 = (uint32_t *)copy_array(gallery->links0,
+                                              count * link_words * sizeof(*links0),
+                                              capacity * link_words * sizeof(*links0), 0);
+    uint32_t *upper_offsets = (uint32_t *)copy_array(gallery->upper_offsets,
+                                                     count * sizeof(*upper_offsets),
+                                                     capacity * sizeof(*upper_offsets), 0);
+    if (ids == NULL || vectors == NULL || levels == NULL || flags == NULL || links0 == NULL ||
+        upper_offsets == NULL) {
+        free(ids);
+        free(vectors);
+        free(levels);
+        free(flags);
+        free(links0);
+        free(upper_offsets);
+        return false;
+    }
+
+    if (!gallery->arrays_mapped) {
+        free(gallery->ids);
+        free(gallery->vectors);
+        free(gallery->levels);
+        free(gallery->flags);
+        free(gallery->links0);
+        free(gallery->upper_offsets);
+    }
+    gallery->ids = ids;
+    gallery->vectors = vectors;
+    gallery->levels = levels;
+    gallery->flags = flags;
+    gallery->links0 = links0;
+    gallery->upper_offsets = upper_offsets;
+    gallery->arrays_mapped = false;
+    gallery->capacity = capacity;
+    return true;
+}
+
+static bool reserve_upper_pool(Gallery *gallery, size_t words) {
+    if (gallery->upper_used + words <= gallery->upper_capacity) {
+        return true;
+    }
+    size_t capacity = gallery->upper_capacity > 0 ? gallery->upper_capacity * 2 : 1024;
+    while (capacity < gallery->upper_used + words) {
+        capacity *= 2;
+    }
+    uint32_t *pool = (uint32_t *)copy_array(gallery->upper_pool,
+                                            gallery->upper_used * sizeof(*pool),
+                                            capacity * sizeof(*pool), 0);
+    if (pool == NULL) {
+        return false;
+    }
+    if (!gallery->upper_mapped) {
+        free(gallery->upper_pool);
+    }
+    gallery->upper_pool = pool;
+    gallery->upper_mapped = false;
+    gallery->upper_capacity = capacity;
+    return true;
+}
+
+static Gallery *gallery_alloc(const GalleryParams *params) {
+    Gallery *gallery = (Gallery *)calloc(1, sizeof(*gallery));
+    if (gallery == NULL) {
+        return NULL;
+    }
+    gallery->dim = params->dim;
+    gallery->stride = align_up(params->dim, VECTOR_LANES);
+    gallery->m = params->hnsw_m;
+    gallery->m0 = params->hnsw_m * 2;
+    gallery->ef_construction = params->hnsw_ef_construction;
+    atomic_init(&gallery->ef_search, params->hnsw_ef_search > 0 ? params->hnsw_ef_search : 1);
+    gallery->exact_search_limit = params->exact_search_limit;
+    gallery->pq_subspaces = params->pq_subspaces;
+    atomic_init(&gallery->rerank, params->rerank > 0 ? params->rerank : 1);
+    gallery->code_stride = align_up(params->dim, INT8_LANES);
+    gallery->level_mult = 1.0 / log((double)params->hnsw_m);
+    gallery->rng = params->seed != 0 ? params->seed : 1u;
+    atomic_init(&gallery->count, 0);
+    atomic_init(&gallery->deleted, 0);
+    atomic_init(&gallery->entry, EMPTY_ENTRY);
+
+    gate_init(&gallery->storage_gate);
+    pthread_mutex_init(&gallery->insert_mutex, NULL);
+    pthread_mutex_init(&gallery->scratch_mutex, NULL);
+    for (size_t i = 0; i < LINK_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&gallery->link_locks[i], NULL);
+    }
+    return gallery;
+}
+
+static bool valid_params(const GalleryParams *params) {
+    return params != NULL && params->dim > 0 && params->dim <= GALLERY_MAX_DIM &&
+           params->hnsw_m >= 2 && params->hnsw_m <= GALLERY_MAX_K &&
+           params->hnsw_ef_construction > 0 && params->pq_subspaces > 0 &&
+           params->pq_subspaces <= params->dim && params->dim % params->pq_subspaces == 0;
+}
+
+Gallery *gallery_create(const GalleryParams *params) {
+    if (!valid_params(params)) {
+        return NULL;
+    }
+
+    Gallery *gallery = gallery_alloc(params);
+    if (gallery == NULL) {
+        return NULL;
+    }
+
+    size_t capacity = params->initial_capacity > 0 ? params->initial_capacity : 1;
+    if (!grow_storage(gallery, capacity)) {
+        gallery_free(gallery);
+        return NULL;
+    }
+    return gallery;
+}
+
+static void free_scratch(SearchScratch *scratch) {
+    free(scratch->visited);
+    free(scratch->candidates.items);
+    free(scratch->results.items);
+    free(scratch->neighbors);
+    free(scratch->lut);
+    free(scratch);
+}
+
+void gallery_free(Gallery *gallery) {
+    if (gallery == NULL) {
+        return;
+    }
+    while (gallery->scratch_free != NULL) {
+        SearchScratch *next = gallery->scratch_free->next;
+        free_scratch(gallery->scratch_free);
+        gallery->scratch_free = next;
+    }
+    if (!gallery->arrays_mapped) {
+        free(gallery->ids);
+        free(gallery->vectors);
+        free(gallery->levels);
+        free(gallery->flags);
+        free(gallery->links0);
+        free(gallery->upper_offsets);
+    }
+    if (!gallery->upper_mapped) {
+        free(gallery->upper_pool);
+    }
+    free_codes(gallery);
+    if (gallery->mapping != NULL) {
+        munmap(gallery->mapping, gallery->mapping_length);
+    }
+    for (size_t i = 0; i < LINK_LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&gallery->link_locks[i]);
+    }
+    pthread_mutex_destroy(&gallery->scratch_mutex);
+    pthread_mutex_destroy(&gallery->insert_mutex);
+    gate_destroy(&gallery->storage_gate);
+    free(gallery);
+}
+
+size_t gallery_size(Gallery *gallery) {
+    if (gallery == NULL) {
+        return 0;
+    }
+    return atomic_load(&gallery->count) - atomic_load(&gallery->deleted);
+}
+
+size_t gallery_deleted_count(Gallery *gallery) {
+    return gallery != NULL ? atomic_load(&gallery->deleted) : 0;
+}
+
+size_t gallery_dim(const Gallery *gallery) {
+    return gallery != NULL ? gallery->dim : 0;
+}
+
+void gallery_set_ef_search(Gallery *gallery, size_t ef_search) {
+    atomic_store(&gallery->ef_search, ef_search > 0 ? ef_search : 1);
+}
+
+void gallery_set_rerank(Gallery *gallery, size_t rerank) {
+    atomic_store(&gallery->rerank, rerank > 0 ? rerank : 1);
+}
+
+/* Caller holds storage_gate shared, so capacity is stable for the whole search. */
+static SearchScratch *acquire_scratch(Gallery *gallery) {
+    pthread_mutex_lock(&gallery->scratch_mutex);
+    SearchScratch *scratch = gallery->scratch_free;
+    if (scratch != NULL) {
+        gallery->scratch_free = scratch->next;
+    }
+    pthread_mutex_unlock(&gallery->scratch_mutex);
+
+    if (scratch == NULL) {
+        scratch = (SearchScratch *)calloc(1, sizeof(*scratch));
+        if (scratch == NULL) {
+            return NULL;
+        }
+    }
+    if (scratch->visited_capacity < gallery->capacity) {
+        uint32_t *visited = (uint32_t *)calloc(gallery->capacity, sizeof(*visited));
+        if (visited == NULL) {
+            free_scratch(scratch);
+            return NULL;
+        }
+        free(scratch->visited);
+        scratch->visited = visited;
+        scratch->visited_capacity = gallery->capacity;
+        scratch->epoch = 0;
+    }
+    if (scratch->neighbors_capacity < gallery->m0 + 1) {
+        uint32_t *neighbors = (uint32_t *)realloc(scratch->neighbors,
+                                                  (gallery->m0 + 1) * sizeof(*neighbors));
+        if (neighbors == NULL) {
+            free_scratch(scratch);
+            return NULL;
+        }
+        scratch->neighbors = neighbors;
+        scratch->neighbors_capacity = gallery->m0 + 1;
+    }
+    scratch->candidates.count = 0;
+    scratch->results.count = 0;
+    return scratch;
+}
+
+static void release_scratch(Gallery *gallery, SearchScratch *scratch) {
+    pthread_mutex_lock(&gallery->scratch_mutex);
+    scratch->next = gallery->scratch_free;
+    gallery->scratch_free = scratch;
+    pthread_mutex_unlock(&gallery->scratch_mutex);
+}
+
+static const float *row(const Gallery *gallery, uint32_t node) {
+    return gallery->vectors + (size_t)node * gallery->stride;
+}
+
+static uint32_t *link_list(const Gallery *gallery, uint32_t node, int level) {
+    if (level == 0) {
+        return gallery->links0 + (size_t)node * (gallery->m0 + 1);
+    }
+    return gallery->upper_pool + gallery->upper_offsets[node] +
+           (size_t)(level - 1) * (gallery->m + 1);
+}
+
+static pthread_mutex_t *link_lock(Gallery *gallery, uint32_t node) {
+    return &gallery->link_locks[node % LINK_LOCK_STRIPES];
+}
+
+static size_t copy_links(Gallery *gallery, uint32_t node, int level, uint32_t *out) {
+    pthread_mutex_lock(link_lock(gallery, node));
+    const uint32_t *links = link_list(gallery, node, level);
+    size_t count = links[0];
+    memcpy(out, links + 1, count * sizeof(*out));
+    pthread_mutex_unlock(link_lock(gallery, node));
+    return count;
+}
+
+static float distance(DotFn dot, const Gallery *gallery, const float *query, uint32_t node) {
+    return 1.0f - dot(query, row(gallery, node), gallery->stride);
+}
+
+static uint32_t greedy_descend(Gallery *gallery,
+                               DotFn dot,
+                               SearchScratch *scratch,
+                               const float *query,
+                               uint32_t node,
+                               int from_level,
+                               int to_level) {
+    float best = distance(dot, gallery, query, node);
+    for (int level = from_level; level > to_level; level--) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            size_t count = copy_links(gallery, node, level, scratch->neighbors);
+            for (size_t i = 0; i < count; i++) {
+                uint32_t candidate = scratch->neighbors[i];
+                float d = distance(dot, gallery, query, candidate);
+                if (d < best) {
+                    best = d;
+                    node = candidate;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return node;
+}
+
+static bool is_deleted(const Gallery *gallery, uint32_t node) {
+    return (gallery->flags[node] & FLAG_DELETED) != 0;
+}
+
+/*
+ * Standard HNSW layer search. Leaves up to ef nearest nodes in
+ * scratch->results (max-heap, farthest on top). Deleted nodes are still
+ * walked through, so the graph stays connected, but with skip_deleted they
+ * never enter the results.
+ */
+static bool search_layer(Gallery *gallery,
+                         DotFn dot,
+                         SearchScratch *scratch,
+                         const float *query,
+                         uint32_t entry,
+                         size_t ef,
+                         int level,
+                         bool skip_deleted) {
+    Heap *candidates = &scratch->candidates;
+    Heap *results = &scratch->results;
+    candidates->count = 0;
+    results->count = 0;
+    scratch->epoch++;
+    if (scratch->epoch == 0) {
+        memset(scratch->visited, 0, scratch->visited_capacity * sizeof(*scratch->visited));
+        scratch->epoch = 1;
+    }
+
+    float d = distance(dot, gallery, query, entry);
+    scratch->visited[entry] = scratch->epoch;
+    if (!heap_push(candidates, -d, entry)) {
+        return false;
+    }
+    if ((!skip_deleted || !is_deleted(gallery, entry)) && !heap_push(results, d, entry)) {
+        return false;
+    }
+
+    while (candidates->count > 0) {
+        HeapItem closest = heap_pop(candidates);
+        if (results->count >= ef && -closest.distance > results->items[0].distance) {
+            break;
+        }
+        size_t count = copy_links(gallery, closest.node, level, scratch->neighbors);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t neighbor = scratch->neighbors[i];
+            if (scratch->visited[neighbor] == scratch->epoch) {
+                continue;
+            }
+            scratch->visited[neighbor] = scratch->epoch;
+            float nd = distance(dot, gallery, query, neighbor);
+            if (results->count < ef || nd < results->items[0].distance) {
+                if (!heap_push(candidates, -nd, neighbor)) {
+                    return false;
+                }
+                if (skip_deleted && is_deleted(gallery, neighbor)) {
+                    continue;
+                }
+                if (!heap_push(results, nd, neighbor)) {
+                    return false;
+                }
+                if (results->count > ef) {
+                    heap_pop(results);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * HNSW neighbour heuristic: walk candidates nearest-first and keep one only
+ * if it is closer to the base than to every neighbour already kept. Keeps
+ * links spread across clusters instead of piling into the nearest one.
+ */
+static size_t select_neighbors(const Gallery *gallery,
+                               DotFn dot,
+                               HeapItem *sorted,
+                               size_t count,
+                               size_t max_links,
+                               uint32_t *out) {
+    size_t selected = 0;
+    for (size_t i = 0; i < count && selected < max_links; i++) {
+        const float *candidate = row(gallery, sorted[i].node);
+        bool keep = true;
+        for (size_t j = 0; j < selected; j++) {
+            if (distance(dot, gallery, candidate, out[j]) < sorted[i].distance) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            out[selected++] = sorted[i].node;
+        }
+    }
+    return selected;
+}
+
+static void add_reverse_link(Gallery *gallery, DotFn dot, uint32_t node, uint32_t link, int level) {
+    size_t max_links = level == 0 ? gallery->m0 : gallery->m;
+    pthread_mutex_lock(link_lock(gallery, node));
+    uint32_t *links = link_list(gallery, node, level);
+    if (links[0] < max_links) {
+        links[links[0] + 1] = link;
+        links[0]++;
+        pthread_mutex_unlock(link_lock(gallery, node));
+        return;
+    }
+
+    HeapItem pool[2 * GALLERY_MAX_K + 1];
+    size_t count = 0;
+    const float *base = row(gallery, node);
+    for (size_t i = 0; i < links[0]; i++) {
+        pool[count].node = links[i + 1];
+        pool[count].distance = distance(dot, gallery, base, links[i + 1]);
+        count++;
+    }
+    pool[count].node = link;
+    pool[count].distance = distance(dot, gallery, base, link);
+    count++;
+    qsort(pool, count, sizeof(pool[0]), compare_items);
+    links[0] = (uint32_t)select_neighbors(gallery, dot, pool, count, max_links, links + 1);
+    pthread_mutex_unlock(link_lock(gallery, node));
+}
+
+static int random_level(Gallery *gallery) {
+    gallery->rng ^= gallery->rng << 13;
+    gallery->rng ^= gallery->rng >> 17;
+    gallery->rng ^= gallery->rng << 5;
+    double uniform = ((double)gallery->rng + 1.0) / 4294967297.0;
+    int level = (int)(-log(uniform) * gallery->level_mult);
+    return level > MAX_LEVEL ? MAX_LEVEL : level;
+}
+
+static void normalize_into(const float *in, size_t dim, size_t stride, float *out) {
+    double norm = 0.0;
+    for (size_t i = 0; i < dim; i++) {
+        norm += (double)in[i] * in[i];
+    }
+    float inv = norm > 0.0 ? (float)(1.0 / sqrt(norm)) : 0.0f;
+    for (size_t i = 0; i < dim; i++) {
+        out[i] = in[i] * inv;
+    }
+    for (size_t i = dim; i < stride; i++) {
+        out[i] = 0.0f;
+    }
+}
+
+static size_t nearest_centroid(const float *centroids, const float *x, size_t sub_dim) {
+    size_t best = 0;
+    float best_distance = INFINITY;
+    for (size_t c = 0; c < PQ_CENTROIDS; c++) {
+        const float *centroid = centroids + c * sub_dim;
+        float d = 0.0f;
+        for (size_t i = 0; i < sub_dim; i++) {
+            float delta = x[i] - centroid[i];
+            d += delta * delta;
+        }
+        if (d < best_distance) {
+            best_distance = d;
+            best = c;
+        }
+    }
+    return best;
+}
+
+/* Rows are unit length, so a symmetric scale fills the int8 range without an offset. */
+static void encode_row(Gallery *gallery, uint32_t node) {
+    const float *values = row(gallery, node);
+    if (gallery->codes == GALLERY_CODES_INT8) {
+        int8_t *code = gallery->int8_codes + (size_t)node * gallery->code_stride;
+        float max = 0.0f;
+        for (size_t i = 0; i < gallery->dim; i++) {
+            max = fabsf(values[i]) > max ? fabsf(values[i]) : max;
+        }
+        float scale = max / INT8_LEVELS;
+        for (size_t i = 0; i < gallery->dim; i++) {
+            code[i] = scale > 0.0f ? (int8_t)lrintf(values[i] / scale) : 0;
+        }
+        memset(code + gallery->dim, 0, gallery->code_stride - gallery->dim);
+        gallery->int8_scales[node] = scale;
+    } else if (gallery->codes == GALLERY_CODES_PQ) {
+        size_t sub_dim = gallery->dim / gallery->pq_subspaces;
+        uint8_t *block = gallery->pq_codes + (size_t)(node / PQ_BLOCK) * gallery->pq_subspaces *
+                                                 PQ_BLOCK;
+        for (size_t s = 0; s < gallery->pq_subspaces; s++) {
+            const float *centroids = gallery->pq_codebook + s * PQ_CENTROIDS * sub_dim;
+            block[s * PQ_BLOCK + node % PQ_BLOCK] =
+                (uint8_t)nearest_centroid(centroids, values + s * sub_dim, sub_dim);
+        }
+    }
+}
+
+/*
+ * k-means per subspace over up to PQ_TRAIN_ROWS rows spread evenly across
+ * the gallery. A centroid left empty is moved onto a random training row.
+ */
+static bool train_pq(Gallery *gallery, size_t count) {
+    size_t sub_dim = gallery->dim / gallery->pq_subspaces;
+    size_t rows = count < PQ_TRAIN_ROWS ? count : PQ_TRAIN_ROWS;
+    float *sums = (float *)malloc(PQ_CENTROIDS * sub_dim * sizeof(*sums));
+    size_t *sizes = (size_t *)malloc(PQ_CENTROIDS * sizeof(*sizes));
+    if (sums == NULL || sizes == NULL) {
+        free(sums);
+        free(sizes);
+        return false;
+    }
+
+    uint32_t rng = gallery->rng;
+    for (size_t s = 0; s < gallery->pq_subspaces; s++) {
+        float *centroids = gallery->pq_codebook + s * PQ_CENTROIDS * sub_dim;
+        for (size_t c = 0; c < PQ_CENTROIDS; c++) {
+            size_t sample = rows >= PQ_CENTROIDS ? c * rows / PQ_CENTROIDS : c % rows;
+            const float *x = row(gallery, (uint32_t)(sample * count / rows)) + s * sub_dim;
+            memcpy(centroids + c * sub_dim, x, sub_dim * sizeof(float));
+        }
+        for (int iteration = 0; iteration < PQ_TRAIN_ITERATIONS; iteration++) {
+            memset(sums, 0, PQ_CENTROIDS * sub_dim * sizeof(*sums));
+            memset(sizes, 0, PQ_CENTROIDS * sizeof(*sizes));
+            for (size_t r = 0; r < rows; r++) {
+                const float *x = row(gallery, (uint32_t)(r * count / rows)) + s * sub_dim;
+                size_t c = nearest_centroid(centroids, x, sub_dim);
+                sizes[c]++;
+                for (size_t i = 0; i < sub_dim; i++) {
+                    sums[c * sub_dim + i] += x[i];
+                }
+            }
+            for (size_t c = 0; c < PQ_CENTROIDS; c++) {
+                float *centroid = centroids + c * sub_dim;
+                if (sizes[c] == 0) {
+                    rng = rng * 1103515245u + 12345u;
+                    size_t sample = (rng >> 8) % rows;
+                    const float *x = row(gallery, (uint32_t)(sample * count / rows)) + s * sub_dim;
+                    memcpy(centroid, x, sub_dim * sizeof(float));
+                    continue;
+                }
+                for (size_t i = 0; i < sub_dim; i++) {
+                    centroid[i] = sums[c * sub_dim + i] / (float)sizes[c];
+                }
+            }
+        }
+    }
+    free(sums);
+    free(sizes);
+    return true;
+}
+
+/*
+ * Running out of memory part-way leaves the node with fewer links; it is still
+ * stored and found by exact scans, so the insert itself does not fail.
+ */
+static void link_new_node(Gallery *gallery, uint32_t node, int node_level) {
+    uint64_t entry = atomic_load(&gallery->entry);
+    if (entry == EMPTY_ENTRY) {
+        atomic_store(&gallery->entry, ((uint64_t)node_level << 32) | node);
+        return;
+    }
+    uint32_t entry_node = (uint32_t)entry;
+    int max_level = (int)(entry >> 32);
+
+    DotFn dot = select_dot();
+    SearchScratch *scratch = acquire_scratch(gallery);
+    if (scratch == NULL) {
+        return;
+    }
+
+    const float *query = row(gallery, node);
+    uint32_t current = greedy_descend(gallery, dot, scratch, query, entry_node, max_level,
+                                      node_level);
+    uint32_t selected[GALLERY_MAX_K];
+    bool ok = true;
+    for (int level = node_level < max_level ? node_level : max_level; level >= 0; level--) {
+        if (!search_layer(gallery, dot, scratch, query, current, gallery->ef_construction, level,
+                          false)) {
+            ok = false;
+            break;
+        }
+        Heap *results = &scratch->results;
+        qsort(results->items, results->count, sizeof(HeapItem), compare_items);
+        size_t count = select_neighbors(gallery, dot, results->items, results->count, gallery->m,
+                                        selected);
+        current = results->items[0].node;
+
+        pthread_mutex_lock(link_lock(gallery, node));
+        uint32_t *links = link_list(gallery, node, level);
+        memcpy(links + 1, selected, count * sizeof(*selected));
+        links[0] = (uint32_t)count;
+        pthread_mutex_unlock(link_lock(gallery, node));
+
+        for (size_t i = 0; i < count; i++) {
+            add_reverse_link(gallery, dot, selected[i], node, level);
+        }
+    }
+    release_scratch(gallery, scratch);
+
+    if (ok && node_level > max_level) {
+        atomic_store(&gallery->entry, ((uint64_t)node_level << 32) | node);
+    }
+}
+
+bool gallery_add(Gallery *gallery, uint64_t id, const float *embedding) {
+    if (gallery == NULL || embedding == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&gallery->insert_mutex);
+    size_t node = atomic_load(&gallery->count);
+    if (node >= UINT32_MAX) {
+        pthread_mutex_unlock(&gallery->insert_mutex);
+        return false;
+    }
+    int level = random_level(gallery);
+    size_t upper_words = (size_t)level * (gallery->m + 1);
+    if (node == gallery->capacity || gallery->upper_used + upper_words > gallery->upper_capacity) {
+        gate_enter_exclusive(&gallery->storage_gate);
+        size_t capacity = gallery->capacity * 2 > 16 ? gallery->capacity * 2 : 16;
+        bool grown = (node < gallery->capacity || grow_storage(gallery, capacity)) &&
+                     reserve_upper_pool(gallery, upper_words);
+        gate_leave_exclusive(&gallery->storage_gate);
+        if (!grown) {
+            pthread_mutex_unlock(&gallery->insert_mutex);
+            return false;
+        }
+    }
+
+    /* Searches run concurrently from here on; the node is not reachable yet. */
+    gate_enter_shared(&gallery->storage_gate);
+    normalize_into(embedding, gallery->dim, gallery->stride,
+                   gallery->vectors + node * gallery->stride);
+    encode_row(gallery, (uint32_t)node);
+    gallery->ids[node] = id;
+    gallery->levels[node] = (uint8_t)level;
+    gallery->flags[node] = 0;
+    gallery->links0[node * (gallery->m0 + 1)] = 0;
+    if (level > 0) {
+        gallery->upper_offsets[node] = (uint32_t)gallery->upper_used;
+        memset(gallery->upper_pool + gallery->upper_used, 0, upper_words * sizeof(uint32_t));
+        gallery->upper_used += upper_words;
+    } else {
+        gallery->upper_offsets[node] = NO_UPPER_LINKS;
+    }
+
+    link_new_node(gallery, (uint32_t)node, level);
+    atomic_store(&gallery->count, node + 1);
+    gate_leave_shared(&gallery->storage_gate);
+    pthread_mutex_unlock(&gallery->insert_mutex);
+    return true;
+}
+
+/*
+ * Builds the codes for every stored row, training PQ codebooks on them
+ * first. Inserts and searches wait until it is done; rows added afterwards
+ * are encoded as they arrive.
+ */
+bool gallery_set_codes(Gallery *gallery, GalleryCodes codes) {
+    if (gallery == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&gallery->insert_mutex);
+    gate_enter_exclusive(&gallery->storage_gate);
+    size_t count = atomic_load(&gallery->count);
+    free_codes(gallery);
+    bool ok = true;
+    if (codes == GALLERY_CODES_PQ) {
+        gallery->pq_codebook = (float *)malloc(PQ_CENTROIDS * gallery->dim * sizeof(float));
+        ok = count > 0 && gallery->pq_codebook != NULL && train_pq(gallery, count);
+    }
+    if (ok && codes != GALLERY_CODES_NONE) {
+        gallery->codes = codes;
+        ok = grow_codes(gallery, gallery->capacity);
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        encode_row(gallery, (uint32_t)i);
+    }
+    if (!ok) {
+        free_codes(gallery);
+    }
+    gate_leave_exclusive(&gallery->storage_gate);
+    pthread_mutex_unlock(&gallery->insert_mutex);
+    return ok;
+}
+
+GalleryCodes gallery_codes(Gallery *gallery) {
+    if (gallery == NULL) {
+        return GALLERY_CODES_NONE;
+    }
+    gate_enter_shared(&gallery->storage_gate);
+    GalleryCodes codes = gallery->codes;
+    gate_leave_shared(&gallery->storage_gate);
+    return codes;
+}
+
+/* Bytes a full scan reads per row: the float row, or its codes when there are any. */
+size_t gallery_scan_bytes(Gallery *gallery) {
+    switch (gallery_codes(gallery)) {
+    case GALLERY_CODES_INT8:
+        return gallery->code_stride + sizeof(float);
+    case GALLERY_CODES_PQ:
+        return gallery->pq_subspaces;
+    default:
+        return gallery != NULL ? gallery->stride * sizeof(float) : 0;
+    }
+}
+
+/* Gives a fresh gallery the same kind of codes, reusing trained codebooks. */
+static bool copy_codes(Gallery *to, const Gallery *from) {
+    if (from->codes == GALLERY_CODES_PQ) {
+        size_t length = PQ_CENTROIDS * from->dim * sizeof(float);
+        to->pq_codebook = (float *)malloc(length);
+        if (to->pq_codebook == NULL) {
+            return false;
+        }
+        memcpy(to->pq_codebook, from->pq_codebook, length);
+    }
+    to->codes = from->codes;
+    if (!grow_codes(to, to->capacity)) {
+        free_codes(to);
+        return false;
+    }
+    return true;
+}
+
+static void offer_result(Heap *results, size_t k, float d, uint32_t node) {
+    if (results->count < k) {
+        heap_push(results, d, node);
+    } else if (d < results->items[0].distance) {
+        heap_pop(results);
+        heap_push(results, d, node);
+    }
+}
+
+static void scan_exact(Gallery *gallery, const float *query, size_t count, size_t k, Heap *results) {
+#if GALLERY_HAVE_X86
+    if (gallery_kernel_level() == GALLERY_KERNEL_AVX2) {
+        size_t i = 0;
+        float dots[4];
+        for (; i + 4 <= count; i += 4) {
+            dot4_padded_avx2(query, row(gallery, (uint32_t)i), gallery->stride, dots);
+            for (size_t j = 0; j < 4; j++) {
+                if (!is_deleted(gallery, (uint32_t)(i + j))) {
+                    offer_result(results, k, 1.0f - dots[j], (uint32_t)(i + j));
+                }
+            }
+        }
+        for (; i < count; i++) {
+            if (is_deleted(gallery, (uint32_t)i)) {
+                continue;
+            }
+            float d = 1.0f - dot_padded_avx2(query, row(gallery, (uint32_t)i), gallery->stride);
+            offer_result(results, k, d, (uint32_t)i);
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        if (is_deleted(gallery, (uint32_t)i)) {
+            continue;
+        }
+        float d = 1.0f - dot_scalar(query, row(gallery, (uint32_t)i), gallery->stride);
+        offer_result(results, k, d, (uint32_t)i);
+    }
+}
+
+static void scan_int8(Gallery *gallery, const float *query, size_t count, size_t n, Heap *out) {
+    _Alignas(VECTOR_ALIGNMENT) int8_t code[GALLERY_MAX_DIM];
+    float max = 0.0f;
+    for (size_t i = 0; i < gallery->dim; i++) {
+        max = fabsf(query[i]) > max ? fabsf(query[i]) : max;
+    }
+    float scale = max / INT8_LEVELS;
+    for (size_t i = 0; i < gallery->dim; i++) {
+        code[i] = scale > 0.0f ? (int8_t)lrintf(query[i] / scale) : 0;
+    }
+    memset(code + gallery->dim, 0, gallery->code_stride - gallery->dim);
+
+    size_t i = 0;
+#if GALLERY_HAVE_X86
+    if (gallery_kernel_level() == GALLERY_KERNEL_AVX2) {
+        int32_t dots[4];
+        for (; i + 4 <= count; i += 4) {
+            dot4_int8_avx2(code, gallery->int8_codes + i * gallery->code_stride,
+                           gallery->code_stride, dots);
+            for (size_t j = 0; j < 4; j++) {
+                if (!is_deleted(gallery, (uint32_t)(i + j))) {
+                    float similarity = scale * gallery->int8_scales[i + j] * (float)dots[j];
+                    offer_result(out, n, 1.0f - similarity, (uint32_t)(i + j));
+                }
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (is_deleted(gallery, (uint32_t)i)) {
+            continue;
+        }
+        const int8_t *row_code = gallery->int8_codes + i * gallery->code_stride;
+        float similarity = scale * gallery->int8_scales[i] *
+                           (float)dot_int8_scalar(code, row_code, gallery->code_stride);
+        offer_result(out, n, 1.0f - similarity, (uint32_t)i);
+    }
+}
+
+/*
+ * Asymmetric distance: the query stays float and is turned into one table
+ * per subspace of its dot product with every centroid, so scoring a row is
+ * one lookup and add per subspace.
+ */
+static void scan_pq(Gallery *gallery, const float *lut, size_t count, size_t n, Heap *out) {
+    size_t subspaces = gallery->pq_subspaces;
+    size_t block_bytes = subspaces * PQ_BLOCK;
+    size_t i = 0;
+#if GALLERY_HAVE_X86
+    if (gallery_kernel_level() == GALLERY_KERNEL_AVX2) {
+        float dots[PQ_BLOCK];
+        for (; i + PQ_BLOCK <= count; i += PQ_BLOCK) {
+            pq_block_avx2(gallery->pq_codes + i / PQ_BLOCK * block_bytes, lut, subspaces, dots);
+            for (size_t j = 0; j < PQ_BLOCK; j++) {
+                if (!is_deleted(gallery, (uint32_t)(i + j))) {
+                    offer_result(out, n, 1.0f - dots[j], (uint32_t)(i + j));
+                }
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (is_deleted(gallery, (uint32_t)i)) {
+            continue;
+        }
+        const uint8_t *block = gallery->pq_codes + i / PQ_BLOCK * block_bytes + i % PQ_BLOCK;
+        float similarity = 0.0f;
+        for (size_t s = 0; s < subspaces; s++) {
+            similarity += lut[s * PQ_CENTROIDS + block[s * PQ_BLOCK]];
+        }
+        offer_result(out, n, 1.0f - similarity, (uint32_t)i);
+    }
+}
+
+/*
+ * Scans the codes for the best k x rerank rows into scratch->candidates,
+ * then re-scores just those on the float rows for the k results.
+ */
+static bool scan_codes(Gallery *gallery,
+                       SearchScratch *scratch,
+                       const float *query,
+                       size_t count,
+                       size_t k) {
+    size_t n = k * atomic_load(&gallery->rerank);
+    Heap *candidates = &scratch->candidates;
+    if (!heap_reserve(candidates, n + 1) || !heap_reserve(&scratch->results, k + 1)) {
+        return false;
+    }
+    if (gallery->codes == GALLERY_CODES_INT8) {
+        scan_int8(gallery, query, count, n, candidates);
+    } else {
+        size_t sub_dim = gallery->dim / gallery->pq_subspaces;
+        size_t entries = gallery->pq_subspaces * PQ_CENTROIDS;
+        if (scratch->lut_capacity < entries) {
+            float *lut = (float *)realloc(scratch->lut, entries * sizeof(*lut));
+            if (lut == NULL) {
+                return false;
+            }
+            scratch->lut = lut;
+            scratch->lut_capacity = entries;
+        }
+        for (size_t e = 0; e < entries; e++) {
+            const float *sub_query = query + e / PQ_CENTROIDS * sub_dim;
+            scratch->lut[e] = dot_scalar(sub_query, gallery->pq_codebook + e * sub_dim, sub_dim);
+        }
+        scan_pq(gallery, scratch->lut, count, n, candidates);
+    }
+
+    DotFn dot = select_dot();
+    for (size_t i = 0; i < candidates->count; i++) {
+        uint32_t node = candidates->items[i].node;
+        offer_result(&scratch->results, k, distance(dot, gallery, query, node), node);
+    }
+    return true;
+}
+
+size_t gallery_search(Gallery *gallery,
+                      const float *query,
+                      size_t k,
+                      float min_similarity,
+                      GallerySearchMode mode,
+                      GalleryMatch *out) {
+    if (gallery == NULL || query == NULL || out == NULL || k == 0) {
+        return 0;
+    }
+    if (k > GALLERY_MAX_K) {
+        k = GALLERY_MAX_K;
+    }
+
+    _Alignas(VECTOR_ALIGNMENT) float normalized[GALLERY_MAX_DIM];
+    normalize_into(query, gallery->dim, gallery->stride, normalized);
+
+    gate_enter_shared(&gallery->storage_gate);
+    size_t count = atomic_load(&gallery->count);
+    uint64_t entry = atomic_load(&gallery->entry);
+    if (count == 0 || entry == EMPTY_ENTRY) {
+        gate_leave_shared(&gallery->storage_gate);
+        return 0;
+    }
+    if (mode == GALLERY_SEARCH_AUTO) {
+        mode = count <= gallery->exact_search_limit ? GALLERY_SEARCH_EXACT : GALLERY_SEARCH_HNSW;
+    }
+    if (mode == GALLERY_SEARCH_CODES && gallery->codes == GALLERY_CODES_NONE) {
+        mode = GALLERY_SEARCH_EXACT;
+    }
+
+    SearchScratch *scratch = acquire_scratch(gallery);
+    if (scratch == NULL) {
+        gate_leave_shared(&gallery->storage_gate);
+        return 0;
+    }
+
+    Heap *results = &scratch->results;
+    if (mode == GALLERY_SEARCH_EXACT) {
+        if (!heap_reserve(results, k + 1)) {
+            results->count = 0;
+        } else {
+            scan_exact(gallery, normalized, count, k, results);
+        }
+    } else if (mode == GALLERY_SEARCH_CODES) {
+        if (!scan_codes(gallery, scratch, normalized, count, k)) {
+            results->count = 0;
+        }
+    } else {
+        DotFn dot = select_dot();
+        size_t ef = atomic_load(&gallery->ef_search);
+        if (ef < k) {
+            ef = k;
+        }
+        uint32_t start = greedy_descend(gallery, dot, scratch, normalized, (uint32_t)entry,
+                                        (int)(entry >> 32), 0);
+        if (!search_layer(gallery, dot, scratch, normalized, start, ef, 0, true)) {
+            results->count = 0;
+        }
+    }
+
+    qsort(results->items, results->count, sizeof(HeapItem), compare_items);
+    size_t found = 0;
+    for (size_t i = 0; i < results->count && found < k; i++) {
+        float similarity = 1.0f - results->items[i].distance;
+        if (similarity < min_similarity) {
+            break;
+        }
+        out[found].id = gallery->ids[results->items[i].node];
+        out[found].similarity = similarity;
+        found++;
+    }
+    release_scratch(gallery, scratch);
+    gate_leave_shared(&gallery->storage_gate);
+    return found;
+}
+
+size_t gallery_remove(Gallery *gallery, uint64_t id) {
+    if (gallery == NULL) {
+        return 0;
+    }
+    pthread_mutex_lock(&gallery->insert_mutex);
+    gate_enter_exclusive(&gallery->storage_gate);
+    size_t count = atomic_load(&gallery->count);
+    size_t removed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (gallery->ids[i] == id && (gallery->flags[i] & FLAG_DELETED) == 0) {
+            gallery->flags[i] |= FLAG_DELETED;
+            removed++;
+        }
+    }
+    atomic_fetch_add(&gallery->deleted, removed);
+    gate_leave_exclusive(&gallery->storage_gate);
+    pthread_mutex_unlock(&gallery->insert_mutex);
+    return removed;
+}
+
+Gallery *gallery_compact(Gallery *gallery) {
+    if (gallery == NULL) {
+        return NULL;
+    }
+    GalleryParams params = gallery_default_params(gallery->dim);
+    params.hnsw_m = gallery->m;
+    params.hnsw_ef_construction = gallery->ef_construction;
+    params.hnsw_ef_search = atomic_load(&gallery->ef_search);
+    params.exact_search_limit = gallery->exact_search_limit;
+    params.pq_subspaces = gallery->pq_subspaces;
+    params.rerank = atomic_load(&gallery->rerank);
+
+    pthread_mutex_lock(&gallery->insert_mutex);
+    size_t count = atomic_load(&gallery->count);
+    params.initial_capacity = count - atomic_load(&gallery->deleted);
+    Gallery *compacted = gallery_create(&params);
+    if (compacted != NULL && gallery->codes != GALLERY_CODES_NONE &&
+        !copy_codes(compacted, gallery)) {
+        gallery_free(compacted);
+        compacted = NULL;
+    }
+    for (size_t i = 0; i < count && compacted != NULL; i++) {
+        if (is_deleted(gallery, (uint32_t)i)) {
+            continue;
+        }
+        if (!gallery_add(compacted, gallery->ids[i], row(gallery, (uint32_t)i))) {
+            gallery_free(compacted);
+            compacted = NULL;
+        }
+    }
+    pthread_mutex_unlock(&gallery->insert_mutex);
+    return compacted;
+}
+
+static bool write_section(FILE *file, const void *data, size_t length, uint64_t *offset) {
+    static const unsigned char zeros[SNAPSHOT_ALIGNMENT];
+    size_t padding = align_up(*offset, SNAPSHOT_ALIGNMENT) - *offset;
+    if (padding > 0 && fwrite(zeros, 1, padding, file) != padding) {
+        return false;
+    }
+    *offset += padding;
+    if (length > 0 && fwrite(data, 1, length, file) != length) {
+        return false;
+    }
+    *offset += length;
+    return true;
+}
+
+/*
+ * Snapshot layout: a SnapshotHeader followed by one 64-byte aligned section
+ * per storage array, in host byte order, so gallery_map() can point the
+ * arrays straight into the mapping. Written to "<path>.tmp", synced, then
+ * renamed over the old snapshot.
+ */
+bool gallery_save(Gallery *gallery, const char *path, const void *meta, size_t meta_length) {
+    if (gallery == NULL || path == NULL) {
+        return false;
+    }
+    char tmp_path[1024];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&gallery->insert_mutex);
+    gate_enter_shared(&gallery->storage_gate);
+    size_t count = atomic_load(&gallery->count);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.dim = (uint32_t)gallery->dim;
+    header.stride = (uint32_t)gallery->stride;
+    header.m = (uint32_t)gallery->m;
+    header.ef_construction = (uint32_t)gallery->ef_construction;
+    header.count = count;
+    header.deleted = atomic_load(&gallery->deleted);
+    header.entry = atomic_load(&gallery->entry);
+    header.upper_used = gallery->upper_used;
+
+    const void *data[SECTION_COUNT] = {
+        gallery->ids,    gallery->vectors,       gallery->levels,     gallery->flags,
+        gallery->links0, gallery->upper_offsets, gallery->upper_pool, meta,
+    };
+    header.section_lengths[SECTION_IDS] = count * sizeof(uint64_t);
+    header.section_lengths[SECTION_VECTORS] = count * gallery->stride * sizeof(float);
+    header.section_lengths[SECTION_LEVELS] = count;
+    header.section_lengths[SECTION_FLAGS] = count;
+    header.section_lengths[SECTION_LINKS0] = count * (gallery->m0 + 1) * sizeof(uint32_t);
+    header.section_lengths[SECTION_UPPER_OFFSETS] = count * sizeof(uint32_t);
+    header.section_lengths[SECTION_UPPER_POOL] = gallery->upper_used * sizeof(uint32_t);
+    header.section_lengths[SECTION_META] = meta != NULL ? meta_length : 0;
+
+    uint64_t offset = sizeof(header);
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        offset = align_up(offset, SNAPSHOT_ALIGNMENT);
+        header.section_offsets[i] = offset;
+        offset += header.section_lengths[i];
+    }
+    header.file_length = offset;
+
+    FILE *file = fopen(tmp_path, "wb");
+    bool ok = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1;
+    offset = sizeof(header);
+    for (int i = 0; ok && i < SECTION_COUNT; i++) {
+        ok = write_section(file, data[i], header.section_lengths[i], &offset);
+    }
+    gate_leave_shared(&gallery->storage_gate);
+    pthread_mutex_unlock(&gallery->insert_mutex);
+
+    if (file != NULL) {
+        ok = fflush(file) == 0 && fsync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+static bool section_fits(const SnapshotHeader *header, int section, size_t expected) {
+    uint64_t offset = header->section_offsets[section];
+    uint64_t length = header->section_lengths[section];
+    return length == expected && offset % SNAPSHOT_ALIGNMENT == 0 && offset <= header->file_length &&
+           length <= header->file_length - offset;
+}
+
+/*
+ * Maps a snapshot copy-on-write. Nothing is parsed or re-inserted: the
+ * storage arrays point into the mapping, so startup cost is one mmap()
+ * plus page faults as searches touch the data. The first insert that
+ * needs more room copies the arrays to the heap.
+ */
+Gallery *gallery_map(const char *path, const void **meta, size_t *meta_length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t length = (size_t)st.st_size;
+    void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const SnapshotHeader *header = (const SnapshotHeader *)mapping;
+    GalleryParams params = gallery_default_params(header->dim);
+    params.hnsw_m = header->m;
+    params.hnsw_ef_construction = header->ef_construction;
+    size_t count = (size_t)header->count;
+    size_t m0 = (size_t)header->m * 2;
+    bool valid = memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+                 header->version == SNAPSHOT_VERSION && header->file_length == length &&
+                 valid_params(&params) && header->stride == align_up(header->dim, VECTOR_LANES) &&
+                 count < UINT32_MAX && header->deleted <= count &&
+                 (header->entry == EMPTY_ENTRY || (uint32_t)header->entry < count) &&
+                 section_fits(header, SECTION_IDS, count * sizeof(uint64_t)) &&
+                 section_fits(header, SECTION_VECTORS, count * header->stride * sizeof(float)) &&
+                 section_fits(header, SECTION_LEVELS, count) &&
+                 section_fits(header, SECTION_FLAGS, count) &&
+                 section_fits(header, SECTION_LINKS0, count * (m0 + 1) * sizeof(uint32_t)) &&
+                 section_fits(header, SECTION_UPPER_OFFSETS, count * sizeof(uint32_t)) &&
+                 section_fits(header, SECTION_UPPER_POOL, header->upper_used * sizeof(uint32_t)) &&
+                 section_fits(header, SECTION_META, header->section_lengths[SECTION_META]);
+    Gallery *gallery = valid ? gallery_alloc(&params) : NULL;
+    if (gallery == NULL) {
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    unsigned char *base = (unsigned char *)mapping;
+    gallery->mapping = mapping;
+    gallery->mapping_length = length;
+    gallery->arrays_mapped = true;
+    gallery->upper_mapped = true;
+    gallery->capacity = count;
+    gallery->ids = (uint64_t *)(base + header->section_offsets[SECTION_IDS]);
+    gallery->vectors = (float *)(base + header->section_offsets[SECTION_VECTORS]);
+    gallery->levels = base + header->section_offsets[SECTION_LEVELS];
+    gallery->flags = base + header->section_offsets[SECTION_FLAGS];
+    gallery->links0 = (uint32_t *)(base + header->section_offsets[SECTION_LINKS0]);
+    gallery->upper_offsets = (uint32_t *)(base + header->section_offsets[SECTION_UPPER_OFFSETS]);
+    gallery->upper_pool = (uint32_t *)(base + header->section_offsets[SECTION_UPPER_POOL]);
+    gallery->upper_used = (size_t)header->upper_used;
+    gallery->upper_capacity = gallery->upper_used;
+    gallery->rng ^= (uint32_t)count * 2654435761u;
+    atomic_store(&gallery->count, count);
+    atomic_store(&gallery->deleted, (size_t)header->deleted);
+    atomic_store(&gallery->entry, header->entry);
+
+    if (meta != NULL) {
+        *meta = base + header->section_offsets[SECTION_META];
+    }
+    if (meta_length != NULL) {
+        *meta_length = (size_t)header->section_lengths[SECTION_META];
+    }
+    return gallery;
+}
@@ -0,0 +1,82 @@
+#ifndef GALLERY_H
+#define GALLERY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GALLERY_MAX_DIM 512
+#define GALLERY_MAX_K 64
+
+typedef enum {
+    GALLERY_KERNEL_SCALAR = 0,
+    GALLERY_KERNEL_AVX2 = 1,
+} GalleryKernelLevel;
+
+typedef enum {
+    GALLERY_SEARCH_AUTO = 0,
+    GALLERY_SEARCH_EXACT = 1,
+    GALLERY_SEARCH_HNSW = 2,
+    GALLERY_SEARCH_CODES = 3,
+} GallerySearchMode;
+
+/*
+ * Compressed copies of the rows that GALLERY_SEARCH_CODES scans instead of
+ * the floats: int8 is one byte per dimension plus a scale, PQ one byte per
+ * subspace. The best k x rerank candidates are re-scored on the floats.
+ */
+typedef enum {
+    GALLERY_CODES_NONE = 0,
+    GALLERY_CODES_INT8 = 1,
+    GALLERY_CODES_PQ = 2,
+} GalleryCodes;
+
+typedef struct {
+    size_t dim;
+    size_t initial_capacity;
+    size_t hnsw_m;
+    size_t hnsw_ef_construction;
+    size_t hnsw_ef_search;
+    size_t exact_search_limit;
+    size_t pq_subspaces;
+    size_t rerank;
+    uint32_t seed;
+} GalleryParams;
+
+typedef struct {
+    uint64_t id;
+    float similarity;
+} GalleryMatch;
+
+typedef struct Gallery Gallery;
+
+GalleryKernelLevel gallery_kernel_level(void);
+GalleryKernelLevel gallery_set_kernel_level(GalleryKernelLevel level);
+float gallery_dot(const float *a, const float *b, size_t dim);
+
+GalleryParams gallery_default_params(size_t dim);
+Gallery *gallery_create(const GalleryParams *params);
+void gallery_free(Gallery *gallery);
+size_t gallery_size(Gallery *gallery);
+size_t gallery_deleted_count(Gallery *gallery);
+size_t gallery_dim(const Gallery *gallery);
+void gallery_set_ef_search(Gallery *gallery, size_t ef_search);
+void gallery_set_rerank(Gallery *gallery, size_t rerank);
+bool gallery_set_codes(Gallery *gallery, GalleryCodes codes);
+GalleryCodes gallery_codes(Gallery *gallery);
+size_t gallery_scan_bytes(Gallery *gallery);
+
+bool gallery_add(Gallery *gallery, uint64_t id, const float *embedding);
+size_t gallery_search(Gallery *gallery,
+                      const float *query,
+                      size_t k,
+                      float min_similarity,
+                      GallerySearchMode mode,
+                      GalleryMatch *out);
+size_t gallery_remove(Gallery *gallery, uint64_t id);
+Gallery *gallery_compact(Gallery *gallery);
+
+bool gallery_save(Gallery *gallery, const char *path, const void *meta, size_t meta_length);
+Gallery *gallery_map(const char *path, const void **meta, size_t *meta_length);
+
+#endif
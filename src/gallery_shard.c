@@ -0,0 +1,861 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gallery_shard.h"
+
+#include "gallery.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SERVE_EPOLL_BATCH 32
+#define SERVE_READS_PER_EVENT 8
+#define WAKE_TAG UINT64_MAX
+#define LISTEN_TAG (UINT64_MAX - 1)
+#define QUERY_FIXED_BYTES 16
+#define QUERY_MAX_BYTES (GALLERY_SHARD_PREFIX_BYTES + QUERY_FIXED_BYTES + GALLERY_MAX_DIM * 4)
+#define RESULT_FIXED_BYTES 12
+#define MATCH_MAX_BYTES (17 + GALLERY_NAME_MAX)
+#define RESULT_MAX_BYTES \
+    (GALLERY_SHARD_PREFIX_BYTES + RESULT_FIXED_BYTES + GALLERY_MAX_K * MATCH_MAX_BYTES)
+#define MAX_PENDING (GALLERY_MAX_SHARDS * 2)
+
+/* A coordinator connection; queries are small, so each fits the fixed buffer. */
+typedef struct {
+    int fd;
+    size_t used;
+    unsigned char buffer[QUERY_MAX_BYTES];
+} ServeConnection;
+
+/* Connections to one replica left open between searches. */
+typedef struct {
+    ListenerSpec spec;
+    int idle[GALLERY_SHARD_POOL];
+    size_t idle_count;
+} Replica;
+
+typedef struct {
+    Replica replicas[GALLERY_SHARD_MAX_REPLICAS];
+    size_t replica_count;
+} Shard;
+
+/*
+ * A query not yet answered. Every step is non-blocking: the connect, the
+ * send and the reply, which builds up in `reply` as it arrives.
+ */
+typedef struct {
+    int fd;
+    size_t shard;
+    size_t replica;
+    bool hedge;
+    bool connecting;
+    size_t sent;
+    size_t received;
+    unsigned char reply[RESULT_MAX_BYTES];
+} Pending;
+
+/* Shard side: set by gallery_shard_serve_start() and cleared by the stop, on the accept thread. */
+static int serve_listen_fd = -1;
+static int serve_epoll_fd = -1;
+static int serve_wake_fd = -1;
+static atomic_bool serving;
+static pthread_t serve_thread;
+static ServeConnection serve_connections[GALLERY_SHARD_MAX_CONNECTIONS];
+
+/* Guards the shard list, the idle connections and the stats. */
+static pthread_mutex_t shard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Shard shards[GALLERY_MAX_SHARDS];
+static size_t shard_count = 0;
+static atomic_uint timeout_ms = GALLERY_SHARD_TIMEOUT_MS;
+static atomic_uint hedge_ms = GALLERY_SHARD_HEDGE_MS;
+static _Atomic uint64_t next_query_id = 1;
+static GalleryShardStats stats;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static void put_u16(unsigned char *out, uint16_t value) {
+    out[0] = (unsigned char)(value >> 8);
+    out[1] = (unsigned char)value;
+}
+
+static void put_u32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char)(value >> (24 - 8 * i));
+    }
+}
+
+static void put_u64(unsigned char *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char)(value >> (56 - 8 * i));
+    }
+}
+
+static uint16_t get_u16(const unsigned char *in) {
+    return (uint16_t)((in[0] << 8) | in[1]);
+}
+
+static uint32_t get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static uint64_t get_u64(const unsigned char *in) {
+    return ((uint64_t)get_u32(in) << 32) | get_u32(in + 4);
+}
+
+static uint32_t float_bits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bits_float(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Searches the local gallery and encodes the RESULT; returns its length. */
+static size_t answer_query(uint64_t id,
+                           size_t k,
+                           float min_similarity,
+                           const unsigned char *embedding,
+                           size_t dim,
+                           unsigned char *out) {
+    GalleryStoreStats gallery;
+    gallery_store_stats(&gallery);
+    GalleryStoreMatch matches[GALLERY_MAX_K];
+    size_t count = 0;
+    int status = 200;
+    if (gallery.dim == 0) {
+        status = 503;
+    } else if (dim != gallery.dim || k == 0) {
+        status = 400;
+    } else {
+        float query[GALLERY_MAX_DIM];
+        for (size_t i = 0; i < dim; i++) {
+            query[i] = bits_float(get_u32(embedding + 4 * i));
+        }
+        count = gallery_store_search(query, k, min_similarity, matches);
+    }
+
+    size_t used = GALLERY_SHARD_PREFIX_BYTES;
+    put_u64(out + used, id);
+    put_u16(out + used + 8, (uint16_t)status);
+    put_u16(out + used + 10, (uint16_t)count);
+    used += RESULT_FIXED_BYTES;
+    for (size_t i = 0; i < count; i++) {
+        const GalleryIdentity *identity = &matches[i].identity;
+        size_t name_length = strlen(identity->name);
+        put_u64(out + used, identity->id);
+        put_u32(out + used + 8, float_bits(matches[i].similarity));
+        put_u32(out + used + 12, (uint32_t)identity->entries);
+        out[used + 16] = (unsigned char)name_length;
+        memcpy(out + used + 17, identity->name, name_length);
+        used += 17 + name_length;
+    }
+    put_u32(out, (uint32_t)(used - 4));
+    out[4] = GALLERY_SHARD_RESULT;
+    return used;
+}
+
+static void serve_close(ServeConnection *c) {
+    epoll_ctl(serve_epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    pthread_mutex_lock(&shard_mutex);
+    stats.serve_connections--;
+    pthread_mutex_unlock(&shard_mutex);
+}
+
+/*
+ * Answers every complete QUERY in the buffer and keeps the partial one.
+ * False when the coordinator broke the protocol or stopped reading.
+ */
+static bool serve_queries(ServeConnection *c) {
+    size_t offset = 0;
+    bool ok = true;
+    while (ok && c->used - offset >= 4) {
+        uint32_t length = get_u32(c->buffer + offset);
+        if (length <= QUERY_FIXED_BYTES || 4 + (size_t)length > QUERY_MAX_BYTES) {
+            ok = false;
+            break;
+        }
+        if (c->used - offset < 4 + (size_t)length) {
+            break;
+        }
+        const unsigned char *body = c->buffer + offset + GALLERY_SHARD_PREFIX_BYTES;
+        size_t dim = get_u16(body + 14);
+        if (c->buffer[offset + 4] != GALLERY_SHARD_QUERY ||
+            length != 1 + QUERY_FIXED_BYTES + 4 * dim) {
+            ok = false;
+            break;
+        }
+        unsigned char reply[RESULT_MAX_BYTES];
+        size_t reply_length = answer_query(get_u64(body), get_u16(body + 8),
+                                           bits_float(get_u32(body + 10)),
+                                           body + QUERY_FIXED_BYTES, dim, reply);
+        pthread_mutex_lock(&shard_mutex);
+        stats.served++;
+        pthread_mutex_unlock(&shard_mutex);
+        /* Replies are small; a coordinator that lets them back up is not reading. */
+        ssize_t n;
+        do {
+            n = send(c->fd, reply, reply_length, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } while (n < 0 && errno == EINTR);
+        ok = n == (ssize_t)reply_length;
+        offset += 4 + (size_t)length;
+    }
+    c->used -= offset;
+    memmove(c->buffer, c->buffer + offset, c->used);
+    return ok;
+}
+
+static void serve_event(ServeConnection *c) {
+    for (int reads = 0; reads < SERVE_READS_PER_EVENT; reads++) {
+        ssize_t n = recv(c->fd, c->buffer + c->used, sizeof(c->buffer) - c->used, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            serve_close(c);
+            return;
+        }
+        c->used += (size_t)n;
+        if (!serve_queries(c)) {
+            serve_close(c);
+            return;
+        }
+    }
+}
+
+static void serve_accept(void) {
+    for (;;) {
+        int fd = accept(serve_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                perror("gallery shard accept");
+            }
+            return;
+        }
+        size_t index = 0;
+        while (index < GALLERY_SHARD_MAX_CONNECTIONS && serve_connections[index].fd >= 0) {
+            index++;
+        }
+        int flags = fcntl(fd, F_GETFL, 0);
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = index;
+        if (index == GALLERY_SHARD_MAX_CONNECTIONS || flags < 0 ||
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0 ||
+            epoll_ctl(serve_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        serve_connections[index].fd = fd;
+        serve_connections[index].used = 0;
+        pthread_mutex_lock(&shard_mutex);
+        stats.serve_connections++;
+        pthread_mutex_unlock(&shard_mutex);
+    }
+}
+
+static void *serve_main(void *arg) {
+    (void)arg;
+    struct epoll_event events[SERVE_EPOLL_BATCH];
+    while (atomic_load(&serving)) {
+        int n = epoll_wait(serve_epoll_fd, events, SERVE_EPOLL_BATCH, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        bool accept_pending = false;
+        for (int i = 0; i < n; i++) {
+            uint64_t tag = events[i].data.u64;
+            if (tag == LISTEN_TAG) {
+                accept_pending = true;
+            } else if (tag != WAKE_TAG && serve_connections[tag].fd >= 0) {
+                serve_event(&serve_connections[tag]);
+            }
+        }
+        /* After the events, so a slot freed above is not reused while its events are pending. */
+        if (accept_pending) {
+            serve_accept();
+        }
+    }
+    return NULL;
+}
+
+static bool watch(int fd, uint64_t tag) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = tag;
+    return epoll_ctl(serve_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void serve_release(void) {
+    if (serve_wake_fd >= 0) {
+        close(serve_wake_fd);
+    }
+    if (serve_epoll_fd >= 0) {
+        close(serve_epoll_fd);
+    }
+    serve_wake_fd = -1;
+    serve_epoll_fd = -1;
+}
+
+/*
+ * Answers coordinators on `listen_fd`, a non-blocking listening socket this
+ * module now owns, from the local gallery.
+ */
+bool gallery_shard_serve_start(int listen_fd) {
+    if (serve_listen_fd >= 0 || listen_fd < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < GALLERY_SHARD_MAX_CONNECTIONS; i++) {
+        serve_connections[i].fd = -1;
+    }
+    serve_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    serve_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = serve_wake_fd >= 0 && serve_epoll_fd >= 0 && watch(serve_wake_fd, WAKE_TAG) &&
+              watch(listen_fd, LISTEN_TAG);
+    if (ok) {
+        atomic_store(&serving, true);
+        ok = pthread_create(&serve_thread, NULL, serve_main, NULL) == 0;
+        if (!ok) {
+            atomic_store(&serving, false);
+        }
+    }
+    if (!ok) {
+        perror("gallery shard");
+        serve_release();
+        return false;
+    }
+    serve_listen_fd = listen_fd;
+    return true;
+}
+
+/* The listening socket, which a hot restart hands over with the HTTP ones. */
+int gallery_shard_listen_fd(void) {
+    return serve_listen_fd;
+}
+
+/* Hangs up on every coordinator; they reconnect on their next search. */
+void gallery_shard_serve_stop(void) {
+    if (serve_listen_fd < 0) {
+        return;
+    }
+    atomic_store(&serving, false);
+    uint64_t one = 1;
+    ssize_t ignored = write(serve_wake_fd, &one, sizeof(one));
+    (void)ignored;
+    pthread_join(serve_thread, NULL);
+    for (size_t i = 0; i < GALLERY_SHARD_MAX_CONNECTIONS; i++) {
+        if (serve_connections[i].fd >= 0) {
+            serve_close(&serve_connections[i]);
+        }
+    }
+    serve_release();
+    close(serve_listen_fd);
+    serve_listen_fd = -1;
+}
+
+/* Replaces the shard list; nothing connects until the first search. */
+bool gallery_shards_start(const GalleryShardSpec *specs, size_t count) {
+    if (count > GALLERY_MAX_SHARDS) {
+        return false;
+    }
+    gallery_shards_stop();
+    pthread_mutex_lock(&shard_mutex);
+    for (size_t i = 0; i < count; i++) {
+        if (specs[i].replica_count == 0 ||
+            specs[i].replica_count > GALLERY_SHARD_MAX_REPLICAS) {
+            pthread_mutex_unlock(&shard_mutex);
+            return false;
+        }
+        shards[i].replica_count = specs[i].replica_count;
+        for (size_t r = 0; r < specs[i].replica_count; r++) {
+            shards[i].replicas[r].spec = specs[i].replicas[r];
+            shards[i].replicas[r].idle_count = 0;
+        }
+    }
+    shard_count = count;
+    pthread_mutex_unlock(&shard_mutex);
+    return true;
+}
+
+/* Both live: a SIGHUP changes them for the next search. A hedge of 0 never hedges. */
+void gallery_shards_set_deadlines(unsigned timeout, unsigned hedge) {
+    atomic_store(&timeout_ms, timeout > 0 ? timeout : 1);
+    atomic_store(&hedge_ms, hedge);
+}
+
+/* Closes the idle connections; searches still running close theirs when done. */
+void gallery_shards_stop(void) {
+    pthread_mutex_lock(&shard_mutex);
+    for (size_t i = 0; i < shard_count; i++) {
+        for (size_t r = 0; r < shards[i].replica_count; r++) {
+            Replica *replica = &shards[i].replicas[r];
+            while (replica->idle_count > 0) {
+                close(replica->idle[--replica->idle_count]);
+            }
+        }
+    }
+    shard_count = 0;
+    pthread_mutex_unlock(&shard_mutex);
+}
+
+/* An idle connection with something to read was closed by the shard (or is out of step). */
+static bool idle_connection_usable(int fd) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+/*
+ * A non-blocking connection to the replica, pooled or new; -1 if it cannot
+ * be reached. A new one may still be connecting, which `*connecting` says.
+ */
+static int acquire(size_t shard, size_t replica, bool *connecting) {
+    *connecting = false;
+    for (;;) {
+        pthread_mutex_lock(&shard_mutex);
+        Replica *r = &shards[shard].replicas[replica];
+        int fd = r->idle_count > 0 ? r->idle[--r->idle_count] : -1;
+        pthread_mutex_unlock(&shard_mutex);
+        if (fd < 0) {
+            break;
+        }
+        if (idle_connection_usable(fd)) {
+            return fd;
+        }
+        close(fd);
+    }
+    bool connected = false;
+    int fd = listener_connect_start(&shards[shard].replicas[replica].spec, &connected);
+    *connecting = !connected;
+    pthread_mutex_lock(&shard_mutex);
+    if (fd >= 0) {
+        stats.connects++;
+    } else {
+        stats.errors++;
+    }
+    pthread_mutex_unlock(&shard_mutex);
+    return fd;
+}
+
+/* Pools a connection whose last reply has been read; closes it once the pool is full. */
+static void release(size_t shard, size_t replica, int fd) {
+    pthread_mutex_lock(&shard_mutex);
+    Replica *r = &shards[shard].replicas[replica];
+    bool kept = shard < shard_count && r->idle_count < GALLERY_SHARD_POOL;
+    if (kept) {
+        r->idle[r->idle_count++] = fd;
+    }
+    pthread_mutex_unlock(&shard_mutex);
+    if (!kept) {
+        close(fd);
+    }
+}
+
+static size_t encode_query(unsigned char *out,
+                           uint64_t id,
+                           const float *query,
+                           size_t dim,
+                           size_t k,
+                           float min_similarity) {
+    size_t length = GALLERY_SHARD_PREFIX_BYTES + QUERY_FIXED_BYTES + 4 * dim;
+    put_u32(out, (uint32_t)(length - 4));
+    out[4] = GALLERY_SHARD_QUERY;
+    unsigned char *body = out + GALLERY_SHARD_PREFIX_BYTES;
+    put_u64(body, id);
+    put_u16(body + 8, (uint16_t)k);
+    put_u32(body + 10, float_bits(min_similarity));
+    put_u16(body + 14, (uint16_t)dim);
+    for (size_t i = 0; i < dim; i++) {
+        put_u32(body + QUERY_FIXED_BYTES + 4 * i, float_bits(query[i]));
+    }
+    return length;
+}
+
+/*
+ * Decodes a complete RESULT for query `id`. Returns its status, or 0 when
+ * the connection cannot be used again. Matches go into JSON answers, so a
+ * name the local store would refuse or a similarity that is not a finite
+ * number makes the whole reply malformed.
+ */
+static int parse_result(const unsigned char *message,
+                        uint64_t id,
+                        GalleryStoreMatch *out,
+                        size_t *count) {
+    size_t length = get_u32(message);
+    const unsigned char *body = message + GALLERY_SHARD_PREFIX_BYTES;
+    const unsigned char *end = message + 4 + length;
+    int status = get_u16(body + 8);
+    size_t matches = get_u16(body + 10);
+    if (get_u64(body) != id || matches > GALLERY_MAX_K || (status != 200 && matches != 0)) {
+        return 0;
+    }
+    const unsigned char *cursor = body + RESULT_FIXED_BYTES;
+    for (size_t i = 0; i < matches; i++) {
+        if (end - cursor < 17 || cursor[16] > GALLERY_NAME_MAX || end - cursor < 17 + cursor[16]) {
+            return 0;
+        }
+        GalleryStoreMatch *match = &out[i];
+        memset(match, 0, sizeof(*match));
+        match->identity.id = get_u64(cursor);
+        match->similarity = bits_float(get_u32(cursor + 8));
+        match->identity.entries = get_u32(cursor + 12);
+        memcpy(match->identity.name, cursor + 17, cursor[16]);
+        if (!gallery_valid_identity_name(match->identity.name) || !isfinite(match->similarity)) {
+            return 0;
+        }
+        cursor += 17 + cursor[16];
+    }
+    *count = matches;
+    return cursor == end ? status : 0;
+}
+
+/* Inserts `match` into the best-first `best` if it is among the top `k`. */
+static void keep_best(GalleryStoreMatch *best,
+                      size_t *count,
+                      size_t k,
+                      const GalleryStoreMatch *match) {
+    size_t at = *count;
+    while (at > 0 && best[at - 1].similarity < match->similarity) {
+        at--;
+    }
+    if (at >= k) {
+        return;
+    }
+    size_t last = *count < k ? *count : k - 1;
+    memmove(best + at + 1, best + at, (last - at) * sizeof(*best));
+    best[at] = *match;
+    if (*count < k) {
+        (*count)++;
+    }
+}
+
+/* One search across the shards; the state a single call needs. */
+typedef struct {
+    const unsigned char *message;
+    size_t message_length;
+    Pending pending[MAX_PENDING];
+    size_t pending_count;
+    bool answered[GALLERY_MAX_SHARDS];
+    bool hedged[GALLERY_MAX_SHARDS];
+    uint64_t queries;
+} Gather;
+
+/* Sends what the socket takes of the query now; false when the connection failed. */
+static bool send_query(const Gather *g, Pending *p) {
+    while (p->sent < g->message_length) {
+        ssize_t n = send(p->fd, g->message + p->sent, g->message_length - p->sent,
+                         MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        p->sent += (size_t)n;
+    }
+    return true;
+}
+
+/* The bytes the reply needs in all: its prefix until that is in, then the length it gives. */
+static size_t reply_length(const Pending *p) {
+    return p->received < GALLERY_SHARD_PREFIX_BYTES ? GALLERY_SHARD_PREFIX_BYTES
+                                                    : 4 + (size_t)get_u32(p->reply);
+}
+
+/*
+ * Moves a query on once poll() reports its socket: finishes the connect,
+ * sends the rest of the query, or reads what has arrived of the reply, never
+ * past it. Returns the reply's status once it is complete, -1 while it is
+ * not, or 0 when the connection failed or broke the protocol.
+ */
+static int advance(const Gather *g,
+                   Pending *p,
+                   uint64_t id,
+                   GalleryStoreMatch *out,
+                   size_t *count) {
+    if (p->connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+            return 0;
+        }
+        p->connecting = false;
+    }
+    if (p->sent < g->message_length) {
+        return send_query(g, p) ? -1 : 0;
+    }
+    for (;;) {
+        size_t wanted = reply_length(p);
+        if (p->received >= GALLERY_SHARD_PREFIX_BYTES &&
+            (p->reply[4] != GALLERY_SHARD_RESULT || wanted < 5 + RESULT_FIXED_BYTES ||
+             wanted > sizeof(p->reply))) {
+            return 0;
+        }
+        if (p->received == wanted) {
+            return parse_result(p->reply, id, out, count);
+        }
+        ssize_t n = recv(p->fd, p->reply + p->received, wanted - p->received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return -1;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p->received += (size_t)n;
+    }
+}
+
+static bool dispatch(Gather *g, size_t shard, size_t replica, bool hedge) {
+    if (g->pending_count == MAX_PENDING) {
+        return false;
+    }
+    bool connecting = false;
+    int fd = acquire(shard, replica, &connecting);
+    if (fd < 0) {
+        return false;
+    }
+    Pending *p = &g->pending[g->pending_count];
+    p->fd = fd;
+    p->shard = shard;
+    p->replica = replica;
+    p->hedge = hedge;
+    p->connecting = connecting;
+    p->sent = 0;
+    p->received = 0;
+    if (!connecting && !send_query(g, p)) {
+        close(fd);
+        pthread_mutex_lock(&shard_mutex);
+        stats.errors++;
+        pthread_mutex_unlock(&shard_mutex);
+        return false;
+    }
+    g->pending_count++;
+    g->queries++;
+    return true;
+}
+
+/* The second try for a shard goes to its next replica, or the same one on another connection. */
+static void hedge_shard(Gather *g, size_t shard, size_t replica_count, GalleryShardReport *report) {
+    g->hedged[shard] = true;
+    report->hedged++;
+    dispatch(g, shard, 1 % replica_count, true);
+}
+
+static bool shard_pending(const Gather *g, size_t shard) {
+    for (size_t i = 0; i < g->pending_count; i++) {
+        if (g->pending[i].fd >= 0 && g->pending[i].shard == shard) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* A reply still owed on a connection would be read as the next query's, so it is closed. */
+static void abandon_shard(Gather *g, size_t shard) {
+    for (size_t i = 0; i < g->pending_count; i++) {
+        if (g->pending[i].fd >= 0 && g->pending[i].shard == shard) {
+            close(g->pending[i].fd);
+            g->pending[i].fd = -1;
+        }
+    }
+}
+
+static void compact_pending(Gather *g) {
+    size_t kept = 0;
+    for (size_t i = 0; i < g->pending_count; i++) {
+        if (g->pending[i].fd >= 0) {
+            g->pending[kept++] = g->pending[i];
+        }
+    }
+    g->pending_count = kept;
+}
+
+/*
+ * The `k` most similar identities across every shard, best first. Waits at
+ * most `gallery_shard_timeout_ms`; a shard that misses it is left out and
+ * counted in `report`. With no shards configured this is
+ * gallery_store_search().
+ */
+size_t gallery_shards_search(const float *query,
+                             size_t dim,
+                             size_t k,
+                             float min_similarity,
+                             GalleryStoreMatch *out,
+                             GalleryShardReport *report) {
+    GalleryShardReport unused;
+    report = report != NULL ? report : &unused;
+    memset(report, 0, sizeof(*report));
+    if (k > GALLERY_MAX_K) {
+        k = GALLERY_MAX_K;
+    }
+    pthread_mutex_lock(&shard_mutex);
+    size_t count = shard_count;
+    size_t replicas[GALLERY_MAX_SHARDS];
+    for (size_t i = 0; i < count; i++) {
+        replicas[i] = shards[i].replica_count;
+    }
+    pthread_mutex_unlock(&shard_mutex);
+    if (count == 0) {
+        return gallery_store_search(query, k, min_similarity, out);
+    }
+    if (query == NULL || out == NULL || k == 0 || dim == 0 || dim > GALLERY_MAX_DIM) {
+        return 0;
+    }
+
+    unsigned char message[QUERY_MAX_BYTES];
+    uint64_t id = atomic_fetch_add(&next_query_id, 1);
+    Gather g;
+    memset(&g, 0, sizeof(g));
+    g.message = message;
+    g.message_length = encode_query(message, id, query, dim, k, min_similarity);
+    unsigned timeout = atomic_load(&timeout_ms);
+    unsigned hedge = atomic_load(&hedge_ms);
+    uint64_t start = monotonic_ms();
+    uint64_t deadline = start + timeout;
+    uint64_t hedge_at = hedge > 0 && hedge < timeout ? start + hedge : 0;
+    report->shards = count;
+    for (size_t s = 0; s < count; s++) {
+        if (!dispatch(&g, s, 0, false)) {
+            hedge_shard(&g, s, replicas[s], report);
+        }
+    }
+
+    size_t found = 0;
+    uint64_t errors = 0;
+    uint64_t hedge_wins = 0;
+    while (report->answered < count && g.pending_count > 0) {
+        uint64_t now = monotonic_ms();
+        if (now >= deadline) {
+            break;
+        }
+        if (hedge_at != 0 && now >= hedge_at) {
+            hedge_at = 0;
+            for (size_t s = 0; s < count; s++) {
+                if (!g.answered[s] && !g.hedged[s]) {
+                    hedge_shard(&g, s, replicas[s], report);
+                }
+            }
+        }
+        struct pollfd fds[MAX_PENDING];
+        for (size_t i = 0; i < g.pending_count; i++) {
+            const Pending *p = &g.pending[i];
+            bool writing = p->connecting || p->sent < g.message_length;
+            fds[i] = (struct pollfd){p->fd, writing ? POLLOUT : POLLIN, 0};
+        }
+        uint64_t wake = hedge_at != 0 ? hedge_at : deadline;
+        int ready = poll(fds, g.pending_count, (int)(wake - now));
+        if (ready < 0 && errno != EINTR) {
+            break;
+        }
+        for (size_t i = 0; ready > 0 && i < g.pending_count; i++) {
+            Pending *p = &g.pending[i];
+            if (fds[i].revents == 0 || p->fd < 0) {
+                continue;
+            }
+            GalleryStoreMatch matches[GALLERY_MAX_K];
+            size_t match_count = 0;
+            int status = advance(&g, p, id, matches, &match_count);
+            if (status < 0) {
+                continue;
+            }
+            if (status == 0) {
+                close(p->fd);
+            } else {
+                release(p->shard, p->replica, p->fd);
+            }
+            p->fd = -1;
+            if (status != 200) {
+                errors++;
+                /* A refusal or a broken connection is retried once, without waiting to hedge. */
+                if (!g.answered[p->shard] && !g.hedged[p->shard] && !shard_pending(&g, p->shard)) {
+                    hedge_shard(&g, p->shard, replicas[p->shard], report);
+                }
+                continue;
+            }
+            g.answered[p->shard] = true;
+            report->answered++;
+            hedge_wins += p->hedge ? 1 : 0;
+            for (size_t m = 0; m < match_count; m++) {
+                keep_best(out, &found, k, &matches[m]);
+            }
+            abandon_shard(&g, p->shard);
+        }
+        compact_pending(&g);
+    }
+
+    uint64_t timeouts = 0;
+    for (size_t s = 0; s < count; s++) {
+        if (!g.answered[s] && shard_pending(&g, s)) {
+            timeouts++;
+        }
+        abandon_shard(&g, s);
+    }
+    pthread_mutex_lock(&shard_mutex);
+    stats.searches++;
+    stats.partial += report->answered < count ? 1 : 0;
+    stats.queries += g.queries;
+    stats.hedges += report->hedged;
+    stats.hedge_wins += hedge_wins;
+    stats.timeouts += timeouts;
+    stats.errors += errors;
+    pthread_mutex_unlock(&shard_mutex);
+    return found;
+}
+
+void gallery_shard_stats(GalleryShardStats *out) {
+    pthread_mutex_lock(&shard_mutex);
+    *out = stats;
+    out->shards = shard_count;
+    out->idle_connections = 0;
+    for (size_t i = 0; i < shard_count; i++) {
+        for (size_t r = 0; r < shards[i].replica_count; r++) {
+            out->idle_connections += shards[i].replicas[r].idle_count;
+        }
+    }
+    pthread_mutex_unlock(&shard_mutex);
+}
+
+size_t gallery_shard_format_stats_json(const GalleryShardStats *in, char *out, size_t capacity) {
+    int n = snprintf(out, capacity,
+                     "{\"shards\":%zu,\"idle_connections\":%zu,\"searches\":%llu,"
+                     "\"partial\":%llu,\"queries\":%llu,\"hedges\":%llu,\"hedge_wins\":%llu,"
+                     "\"timeouts\":%llu,\"errors\":%llu,\"connects\":%llu,"
+                     "\"serving\":{\"connections\":%zu,\"queries\":%llu}}",
+                     in->shards, in->idle_connections, (unsigned long long)in->searches,
+                     (unsigned long long)in->partial, (unsigned long long)in->queries,
+                     (unsigned long long)in->hedges, (unsigned long long)in->hedge_wins,
+                     (unsigned long long)in->timeouts, (unsigned long long)in->errors,
+                     (unsigned long long)in->connects, in->serve_connections,
+                     (unsigned long long)in->served);
+    return n > 0 && (size_t)n < capacity ? (size_t)n : 0;
+}
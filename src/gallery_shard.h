@@ -0,0 +1,82 @@
+#ifndef GALLERY_SHARD_H
+#define GALLERY_SHARD_H
+
+#include "gallery_store.h"
+#include "listener.h"
+#include "server_config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A gallery split across processes. A shard serves searches of its own
+ * gallery on `gallery_shard_listen`; a coordinator (`gallery_shards`) sends
+ * each query to every shard at once over connections it keeps open, merges
+ * the top-k, and answers with whatever arrived by `gallery_shard_timeout_ms`.
+ * A shard that has not answered by `gallery_shard_hedge_ms` gets the query
+ * again on its next replica (or a second connection when it has one).
+ *
+ * Messages are a big-endian u32 length of what follows, a u8 type, then:
+ *
+ *   coordinator -> shard  QUERY   u64 id, u16 k, u32 min similarity, u16 dim,
+ *                                 dim x u32 embedding
+ *   shard -> coordinator  RESULT  u64 id, u16 status (200/400/503), u16 count,
+ *                                 count x (u64 identity id, u32 similarity,
+ *                                 u32 entries, u8 name length, name)
+ *
+ * Floats travel as their IEEE-754 bits.
+ */
+
+#define GALLERY_SHARD_QUERY 0x11u
+#define GALLERY_SHARD_RESULT 0x91u
+#define GALLERY_SHARD_PREFIX_BYTES 5
+
+/* One shard: the processes holding the same part of the gallery, primary first. */
+typedef struct {
+    ListenerSpec replicas[GALLERY_SHARD_MAX_REPLICAS];
+    size_t replica_count;
+} GalleryShardSpec;
+
+/* What one search reached: shards asked, shards that answered in time, hedges sent. */
+typedef struct {
+    size_t shards;
+    size_t answered;
+    size_t hedged;
+} GalleryShardReport;
+
+typedef struct {
+    size_t shards;
+    size_t idle_connections;
+    uint64_t searches;
+    uint64_t partial;
+    uint64_t queries;
+    uint64_t hedges;
+    uint64_t hedge_wins;
+    uint64_t timeouts;
+    uint64_t errors;
+    uint64_t connects;
+    size_t serve_connections;
+    uint64_t served;
+} GalleryShardStats;
+
+/* Shard side: one thread answers every coordinator connection. */
+bool gallery_shard_serve_start(int listen_fd);
+int gallery_shard_listen_fd(void);
+void gallery_shard_serve_stop(void);
+
+/* Coordinator side; no shards searches the local gallery. */
+bool gallery_shards_start(const GalleryShardSpec *shards, size_t count);
+void gallery_shards_set_deadlines(unsigned timeout_ms, unsigned hedge_ms);
+void gallery_shards_stop(void);
+size_t gallery_shards_search(const float *query,
+                             size_t dim,
+                             size_t k,
+                             float min_similarity,
+                             GalleryStoreMatch *out,
+                             GalleryShardReport *report);
+
+void gallery_shard_stats(GalleryShardStats *out);
+size_t gallery_shard_format_stats_json(const GalleryShardStats *stats, char *out, size_t capacity);
+
+#endif
@@ -0,0 +1,808 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gallery_store.h"
+
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_MAGIC 0x474c4f47u /* "GLOG" */
+#define LOG_RECORD_ADD 1u
+#define LOG_RECORD_REMOVE 2u
+#define META_VERSION 1u
+#define MAX_LOG_RECORD (sizeof(LogRecordHeader) + GALLERY_NAME_MAX + GALLERY_MAX_DIM * sizeof(float) + 4)
+
+/*
+ * Every mutation is appended to gallery.log and fdatasync'd before it is
+ * applied. The compactor periodically writes the whole index (vectors and
+ * HNSW graph) to gallery.snapshot and truncates the log, so startup is one
+ * mmap plus a short replay instead of re-inserting every vector.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t seq;
+    uint64_t id;
+    uint32_t name_length;
+    uint32_t payload_length;
+} LogRecordHeader;
+
+typedef struct {
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t last_seq;
+    uint64_t next_id;
+    uint64_t identity_count;
+} MetaHeader;
+
+typedef struct {
+    uint64_t id;
+    uint64_t entries;
+    uint32_t name_length;
+} MetaIdentity;
+
+static pthread_mutex_t store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool store_open = false;
+static size_t store_dim = 0;
+static char snapshot_path[MAX_ASSET_PATH_SIZE];
+static char log_path[MAX_ASSET_PATH_SIZE];
+static int log_fd = -1;
+static uint64_t next_seq = 1;
+static uint64_t next_id = 1;
+static uint64_t log_records = 0;
+static uint64_t compactions = 0;
+static uint64_t load_us = 0;
+static bool snapshot_mapped = false;
+
+/*
+ * Identity ids start at 1 and are never reused, so the table is indexed by
+ * id - 1 and a deleted identity leaves an empty slot.
+ */
+static GalleryIdentity *identities = NULL;
+static size_t identity_slots = 0;
+static size_t identity_capacity = 0;
+static size_t live_identities = 0;
+
+/*
+ * Searches run without store_mutex. The compactor publishes a rebuilt
+ * gallery in the other generation slot, then waits for readers still
+ * holding the previous generation to drain before freeing it.
+ */
+static pthread_mutex_t swap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t swap_cond = PTHREAD_COND_INITIALIZER;
+static Gallery *current = NULL;
+static Gallery *generations[2] = {NULL, NULL};
+static size_t generation_readers[2] = {0, 0};
+static unsigned generation = 0;
+
+static pthread_mutex_t compactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t compactor_thread;
+static bool compactor_running = false;
+static bool compactor_wakeup = false;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t length) {
+    static uint32_t table[256];
+    static atomic_bool table_ready = false;
+    if (!atomic_load_explicit(&table_ready, memory_order_acquire)) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1u) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        atomic_store_explicit(&table_ready, true, memory_order_release);
+    }
+
+    const unsigned char *bytes = (const unsigned char *)data;
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xffu] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+bool gallery_valid_identity_name(const char *name) {
+    if (name == NULL) {
+        return false;
+    }
+    size_t length = 0;
+    for (; name[length] != '\0'; length++) {
+        char c = name[length];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                  c == '_' || c == '-' || c == '.';
+        if (!ok || length >= GALLERY_NAME_MAX) {
+            return false;
+        }
+    }
+    return length > 0 && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+static GalleryIdentity *identity_by_id(uint64_t id) {
+    if (id == 0 || id > identity_slots || identities[id - 1].name[0] == '\0') {
+        return NULL;
+    }
+    return &identities[id - 1];
+}
+
+static GalleryIdentity *identity_by_name(const char *name) {
+    for (size_t i = 0; i < identity_slots; i++) {
+        if (identities[i].name[0] != '\0' && strcmp(identities[i].name, name) == 0) {
+            return &identities[i];
+        }
+    }
+    return NULL;
+}
+
+/* Caller holds store_mutex; takes table_mutex because searches read the table. */
+static GalleryIdentity *identity_slot(uint64_t id) {
+    if (id == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&table_mutex);
+    if (id > identity_capacity) {
+        size_t capacity = identity_capacity > 0 ? identity_capacity : 64;
+        while (capacity < id) {
+            capacity *= 2;
+        }
+        GalleryIdentity *grown =
+            (GalleryIdentity *)realloc(identities, capacity * sizeof(*identities));
+        if (grown == NULL) {
+            pthread_mutex_unlock(&table_mutex);
+            return NULL;
+        }
+        memset(grown + identity_capacity, 0,
+               (capacity - identity_capacity) * sizeof(*identities));
+        identities = grown;
+        identity_capacity = capacity;
+    }
+    if (id > identity_slots) {
+        identity_slots = (size_t)id;
+    }
+    pthread_mutex_unlock(&table_mutex);
+    return &identities[id - 1];
+}
+
+static void identity_set(GalleryIdentity *slot, uint64_t id, const char *name, size_t entries) {
+    pthread_mutex_lock(&table_mutex);
+    if (slot->name[0] == '\0' && name[0] != '\0') {
+        live_identities++;
+    } else if (slot->name[0] != '\0' && name[0] == '\0') {
+        live_identities--;
+    }
+    slot->id = id;
+    snprintf(slot->name, sizeof(slot->name), "%s", name);
+    slot->entries = entries;
+    pthread_mutex_unlock(&table_mutex);
+}
+
+static void reset_table(void) {
+    pthread_mutex_lock(&table_mutex);
+    free(identities);
+    identities = NULL;
+    identity_slots = 0;
+    identity_capacity = 0;
+    live_identities = 0;
+    pthread_mutex_unlock(&table_mutex);
+}
+
+static Gallery *acquire_gallery(unsigned *slot) {
+    pthread_mutex_lock(&swap_mutex);
+    *slot = generation & 1u;
+    Gallery *gallery = generations[*slot];
+    if (gallery != NULL) {
+        generation_readers[*slot]++;
+    }
+    pthread_mutex_unlock(&swap_mutex);
+    return gallery;
+}
+
+static void release_gallery(unsigned slot) {
+    pthread_mutex_lock(&swap_mutex);
+    if (--generation_readers[slot] == 0) {
+        pthread_cond_broadcast(&swap_cond);
+    }
+    pthread_mutex_unlock(&swap_mutex);
+}
+
+/* Caller holds store_mutex, so no writer touches either gallery meanwhile. */
+static void publish_gallery(Gallery *replacement) {
+    pthread_mutex_lock(&swap_mutex);
+    unsigned previous = generation & 1u;
+    generations[previous ^ 1u] = replacement;
+    generation++;
+    current = replacement;
+    while (generation_readers[previous] > 0) {
+        pthread_cond_wait(&swap_cond, &swap_mutex);
+    }
+    Gallery *retired = generations[previous];
+    generations[previous] = NULL;
+    pthread_mutex_unlock(&swap_mutex);
+    gallery_free(retired);
+}
+
+static bool append_record(uint32_t type, uint64_t id, const char *name, const float *embedding) {
+    unsigned char record[MAX_LOG_RECORD];
+    LogRecordHeader header;
+    header.magic = LOG_MAGIC;
+    header.type = type;
+    header.seq = next_seq;
+    header.id = id;
+    header.name_length = (uint32_t)strlen(name);
+    header.payload_length = embedding != NULL ? (uint32_t)(store_dim * sizeof(float)) : 0;
+
+    size_t used = 0;
+    memcpy(record, &header, sizeof(header));
+    used += sizeof(header);
+    memcpy(record + used, name, header.name_length);
+    used += header.name_length;
+    if (embedding != NULL) {
+        memcpy(record + used, embedding, header.payload_length);
+        used += header.payload_length;
+    }
+    uint32_t crc = crc32_update(0, record, used);
+    memcpy(record + used, &crc, sizeof(crc));
+    used += sizeof(crc);
+
+    /* One write per record: a crash leaves at most a torn tail, never a torn middle. */
+    size_t written = 0;
+    while (written < used) {
+        ssize_t n = write(log_fd, record + written, used - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("gallery log write");
+            return false;
+        }
+        written += (size_t)n;
+    }
+    if (fdatasync(log_fd) != 0) {
+        perror("gallery log fdatasync");
+        return false;
+    }
+    next_seq++;
+    log_records++;
+    return true;
+}
+
+static void wake_compactor(void) {
+    pthread_mutex_lock(&compactor_mutex);
+    compactor_wakeup = true;
+    pthread_cond_signal(&compactor_cond);
+    pthread_mutex_unlock(&compactor_mutex);
+}
+
+static bool apply_add(uint64_t id, const char *name, const float *embedding) {
+    GalleryIdentity *slot = identity_slot(id);
+    if (slot == NULL || !gallery_add(current, id, embedding)) {
+        return false;
+    }
+    if (id >= next_id) {
+        next_id = id + 1;
+    }
+    size_t entries = slot->name[0] != '\0' ? slot->entries + 1 : 1;
+    identity_set(slot, id, name, entries);
+    return true;
+}
+
+static void apply_remove(uint64_t id) {
+    GalleryIdentity *slot = identity_by_id(id);
+    gallery_remove(current, id);
+    if (slot != NULL) {
+        identity_set(slot, id, "", 0);
+    }
+}
+
+static bool read_exact(FILE *file, void *buffer, size_t length) {
+    return fread(buffer, 1, length, file) == length;
+}
+
+/*
+ * Applies every record newer than the snapshot. A record that fails its
+ * length or CRC check is a write torn by a crash; it and anything after it
+ * are cut off so the next append starts at a clean boundary.
+ */
+static bool replay_log(uint64_t snapshot_seq) {
+    FILE *file = fdopen(dup(log_fd), "rb");
+    if (file == NULL) {
+        perror("gallery log open");
+        return false;
+    }
+
+    unsigned char *record = (unsigned char *)malloc(MAX_LOG_RECORD);
+    if (record == NULL) {
+        fclose(file);
+        return false;
+    }
+
+    bool ok = true;
+    long good_end = 0;
+    for (;;) {
+        LogRecordHeader header;
+        if (!read_exact(file, &header, sizeof(header))) {
+            break;
+        }
+        if (header.magic != LOG_MAGIC || header.name_length == 0 ||
+            header.name_length > GALLERY_NAME_MAX ||
+            (header.type == LOG_RECORD_ADD && header.payload_length != store_dim * sizeof(float)) ||
+            (header.type == LOG_RECORD_REMOVE && header.payload_length != 0) ||
+            (header.type != LOG_RECORD_ADD && header.type != LOG_RECORD_REMOVE)) {
+            break;
+        }
+
+        size_t body = header.name_length + header.payload_length;
+        uint32_t stored_crc = 0;
+        memcpy(record, &header, sizeof(header));
+        if (!read_exact(file, record + sizeof(header), body) ||
+            !read_exact(file, &stored_crc, sizeof(stored_crc)) ||
+            crc32_update(0, record, sizeof(header) + body) != stored_crc) {
+            break;
+        }
+
+        char name[GALLERY_NAME_MAX + 1];
+        memcpy(name, record + sizeof(header), header.name_length);
+        name[header.name_length] = '\0';
+        if (header.seq > snapshot_seq) {
+            if (header.type == LOG_RECORD_ADD) {
+                float embedding[GALLERY_MAX_DIM];
+                memcpy(embedding, record + sizeof(header) + header.name_length,
+                       header.payload_length);
+                if (!apply_add(header.id, name, embedding)) {
+                    ok = false;
+                    break;
+                }
+            } else {
+                apply_remove(header.id);
+            }
+        }
+        if (header.seq >= next_seq) {
+            next_seq = header.seq + 1;
+        }
+        log_records++;
+        good_end = ftell(file);
+    }
+
+    if (ok && fseek(file, 0, SEEK_END) == 0 && ftell(file) > good_end) {
+        fprintf(stderr, "Gallery log: discarding %ld bytes of torn tail\n",
+                ftell(file) - good_end);
+        if (ftruncate(log_fd, (off_t)good_end) != 0) {
+            perror("gallery log truncate");
+            ok = false;
+        }
+    }
+    free(record);
+    fclose(file);
+    return ok;
+}
+
+static unsigned char *encode_meta(size_t *length_out) {
+    size_t length = sizeof(MetaHeader);
+    for (size_t i = 0; i < identity_slots; i++) {
+        if (identities[i].name[0] != '\0') {
+            length += sizeof(MetaIdentity) + strlen(identities[i].name);
+        }
+    }
+
+    unsigned char *meta = (unsigned char *)malloc(length);
+    if (meta == NULL) {
+        return NULL;
+    }
+    MetaHeader header;
+    memset(&header, 0, sizeof(header));
+    header.version = META_VERSION;
+    header.last_seq = next_seq - 1;
+    header.next_id = next_id;
+    header.identity_count = live_identities;
+    memcpy(meta, &header, sizeof(header));
+
+    size_t used = sizeof(header);
+    for (size_t i = 0; i < identity_slots; i++) {
+        if (identities[i].name[0] == '\0') {
+            continue;
+        }
+        MetaIdentity entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.id = identities[i].id;
+        entry.entries = identities[i].entries;
+        entry.name_length = (uint32_t)strlen(identities[i].name);
+        memcpy(meta + used, &entry, sizeof(entry));
+        used += sizeof(entry);
+        memcpy(meta + used, identities[i].name, entry.name_length);
+        used += entry.name_length;
+    }
+    *length_out = used;
+    return meta;
+}
+
+static bool decode_meta(const unsigned char *meta, size_t length, uint64_t *last_seq) {
+    MetaHeader header;
+    if (length < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, meta, sizeof(header));
+    if (header.version != META_VERSION) {
+        return false;
+    }
+
+    size_t used = sizeof(header);
+    for (uint64_t i = 0; i < header.identity_count; i++) {
+        MetaIdentity entry;
+        if (length - used < sizeof(entry)) {
+            return false;
+        }
+        memcpy(&entry, meta + used, sizeof(entry));
+        used += sizeof(entry);
+        if (entry.name_length == 0 || entry.name_length > GALLERY_NAME_MAX ||
+            length - used < entry.name_length) {
+            return false;
+        }
+        char name[GALLERY_NAME_MAX + 1];
+        memcpy(name, meta + used, entry.name_length);
+        name[entry.name_length] = '\0';
+        used += entry.name_length;
+
+        GalleryIdentity *slot = identity_slot(entry.id);
+        if (slot == NULL) {
+            return false;
+        }
+        identity_set(slot, entry.id, name, (size_t)entry.entries);
+    }
+    *last_seq = header.last_seq;
+    next_seq = header.last_seq + 1;
+    if (header.next_id > next_id) {
+        next_id = header.next_id;
+    }
+    return true;
+}
+
+/* Caller holds store_mutex. */
+static bool compact_locked(void) {
+    size_t deleted = gallery_deleted_count(current);
+    if (deleted > 0 && deleted * GALLERY_COMPACT_DELETED_DIVISOR >= gallery_size(current) + deleted) {
+        Gallery *rebuilt = gallery_compact(current);
+        if (rebuilt != NULL) {
+            publish_gallery(rebuilt);
+        }
+    }
+
+    size_t meta_length = 0;
+    unsigned char *meta = encode_meta(&meta_length);
+    if (meta == NULL) {
+        return false;
+    }
+    bool ok = gallery_save(current, snapshot_path, meta, meta_length);
+    free(meta);
+    if (!ok) {
+        fprintf(stderr, "Gallery snapshot failed: %s\n", snapshot_path);
+        return false;
+    }
+
+    /* The snapshot now covers every record, so the log can restart empty. */
+    if (ftruncate(log_fd, 0) != 0 || fsync(log_fd) != 0) {
+        perror("gallery log truncate");
+        return false;
+    }
+    log_records = 0;
+    compactions++;
+    return true;
+}
+
+static void *compactor_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&compactor_mutex);
+    while (compactor_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += GALLERY_COMPACT_INTERVAL_SEC;
+        while (compactor_running && !compactor_wakeup) {
+            if (pthread_cond_timedwait(&compactor_cond, &compactor_mutex, &deadline) ==
+                ETIMEDOUT) {
+                break;
+            }
+        }
+        compactor_wakeup = false;
+        if (!compactor_running) {
+            break;
+        }
+        pthread_mutex_unlock(&compactor_mutex);
+
+        pthread_mutex_lock(&store_mutex);
+        if (store_open && log_records > 0) {
+            compact_locked();
+        }
+        pthread_mutex_unlock(&store_mutex);
+
+        pthread_mutex_lock(&compactor_mutex);
+    }
+    pthread_mutex_unlock(&compactor_mutex);
+    return NULL;
+}
+
+static void close_locked(void) {
+    publish_gallery(NULL);
+    if (log_fd >= 0) {
+        close(log_fd);
+        log_fd = -1;
+    }
+    reset_table();
+    store_open = false;
+}
+
+bool gallery_store_open(const char *directory, size_t dim) {
+    if (directory == NULL || dim == 0 || dim > GALLERY_MAX_DIM) {
+        return false;
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    if (store_open) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    uint64_t start = monotonic_us();
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        perror("gallery mkdir");
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    int n1 = snprintf(snapshot_path, sizeof(snapshot_path), "%s/gallery.snapshot", directory);
+    int n2 = snprintf(log_path, sizeof(log_path), "%s/gallery.log", directory);
+    if (n1 < 0 || (size_t)n1 >= sizeof(snapshot_path) || n2 < 0 ||
+        (size_t)n2 >= sizeof(log_path)) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+
+    store_dim = dim;
+    next_seq = 1;
+    next_id = 1;
+    log_records = 0;
+    compactions = 0;
+    snapshot_mapped = false;
+    uint64_t snapshot_seq = 0;
+
+    const void *meta = NULL;
+    size_t meta_length = 0;
+    Gallery *gallery = gallery_map(snapshot_path, &meta, &meta_length);
+    if (gallery != NULL) {
+        if (gallery_dim(gallery) != dim ||
+            !decode_meta((const unsigned char *)meta, meta_length, &snapshot_seq)) {
+            fprintf(stderr, "Gallery snapshot %s does not match %zu-dim embeddings\n",
+                    snapshot_path, dim);
+            gallery_free(gallery);
+            reset_table();
+            pthread_mutex_unlock(&store_mutex);
+            return false;
+        }
+        snapshot_mapped = true;
+    } else if (access(snapshot_path, F_OK) == 0) {
+        /* Refuse to start empty over a snapshot we cannot read; that would lose it at the next compaction. */
+        fprintf(stderr, "Gallery snapshot %s is unreadable\n", snapshot_path);
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    } else {
+        GalleryParams params = gallery_default_params(dim);
+        gallery = gallery_create(&params);
+        if (gallery == NULL) {
+            pthread_mutex_unlock(&store_mutex);
+            return false;
+        }
+    }
+    publish_gallery(gallery);
+
+    log_fd = open(log_path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (log_fd < 0 || !replay_log(snapshot_seq)) {
+        if (log_fd < 0) {
+            perror("gallery log open");
+        }
+        close_locked();
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    load_us = monotonic_us() - start;
+    store_open = true;
+    pthread_mutex_unlock(&store_mutex);
+
+    pthread_mutex_lock(&compactor_mutex);
+    compactor_running = true;
+    compactor_wakeup = false;
+    pthread_mutex_unlock(&compactor_mutex);
+    if (pthread_create(&compactor_thread, NULL, compactor_main, NULL) != 0) {
+        perror("pthread_create");
+        compactor_running = false;
+    }
+    return true;
+}
+
+void gallery_store_close(void) {
+    pthread_mutex_lock(&compactor_mutex);
+    bool joined = compactor_running;
+    compactor_running = false;
+    pthread_cond_signal(&compactor_cond);
+    pthread_mutex_unlock(&compactor_mutex);
+    if (joined) {
+        pthread_join(compactor_thread, NULL);
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    if (store_open) {
+        if (log_records > 0) {
+            compact_locked();
+        }
+        close_locked();
+    }
+    pthread_mutex_unlock(&store_mutex);
+}
+
+bool gallery_store_is_open(void) {
+    pthread_mutex_lock(&store_mutex);
+    bool result = store_open;
+    pthread_mutex_unlock(&store_mutex);
+    return result;
+}
+
+bool gallery_store_enroll(const char *name, const float *embedding, GalleryIdentity *out) {
+    if (!gallery_valid_identity_name(name) || embedding == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    if (!store_open) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    GalleryIdentity *existing = identity_by_name(name);
+    uint64_t id = existing != NULL ? existing->id : next_id;
+    bool ok = append_record(LOG_RECORD_ADD, id, name, embedding) && apply_add(id, name, embedding);
+    if (ok && out != NULL) {
+        *out = *identity_by_id(id);
+    }
+    bool compact_due = log_records >= GALLERY_COMPACT_LOG_RECORDS;
+    pthread_mutex_unlock(&store_mutex);
+
+    if (compact_due) {
+        wake_compactor();
+    }
+    return ok;
+}
+
+bool gallery_store_remove(const char *name, GalleryIdentity *out) {
+    if (!gallery_valid_identity_name(name)) {
+        return false;
+    }
+
+    pthread_mutex_lock(&store_mutex);
+    GalleryIdentity *existing = store_open ? identity_by_name(name) : NULL;
+    if (existing == NULL) {
+        pthread_mutex_unlock(&store_mutex);
+        return false;
+    }
+    GalleryIdentity removed = *existing;
+    bool ok = append_record(LOG_RECORD_REMOVE, removed.id, name, NULL);
+    if (ok) {
+        apply_remove(removed.id);
+        if (out != NULL) {
+            *out = removed;
+        }
+    }
+    bool compact_due = log_records >= GALLERY_COMPACT_LOG_RECORDS;
+    pthread_mutex_unlock(&store_mutex);
+
+    if (compact_due) {
+        wake_compactor();
+    }
+    return ok;
+}
+
+size_t gallery_store_search(const float *query,
+                            size_t k,
+                            float min_similarity,
+                            GalleryStoreMatch *out) {
+    if (query == NULL || out == NULL || k == 0) {
+        return 0;
+    }
+    if (k > GALLERY_MAX_K) {
+        k = GALLERY_MAX_K;
+    }
+
+    unsigned slot = 0;
+    Gallery *gallery = acquire_gallery(&slot);
+    if (gallery == NULL) {
+        return 0;
+    }
+    GalleryMatch matches[GALLERY_MAX_K];
+    size_t found =
+        gallery_search(gallery, query, k, min_similarity, GALLERY_SEARCH_AUTO, matches);
+    release_gallery(slot);
+
+    size_t count = 0;
+    pthread_mutex_lock(&table_mutex);
+    for (size_t i = 0; i < found; i++) {
+        const GalleryIdentity *identity = identity_by_id(matches[i].id);
+        if (identity == NULL) {
+            continue;
+        }
+        out[count].identity = *identity;
+        out[count].similarity = matches[i].similarity;
+        count++;
+    }
+    pthread_mutex_unlock(&table_mutex);
+    return count;
+}
+
+bool gallery_store_compact(void) {
+    pthread_mutex_lock(&store_mutex);
+    bool ok = store_open && compact_locked();
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+void gallery_store_stats(GalleryStoreStats *out) {
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&store_mutex);
+    if (store_open) {
+        out->dim = store_dim;
+        out->entries = gallery_size(current);
+        out->deleted = gallery_deleted_count(current);
+        out->identities = live_identities;
+        out->log_records = log_records;
+        out->compactions = compactions;
+        out->load_us = load_us;
+        out->snapshot_mapped = snapshot_mapped;
+    }
+    pthread_mutex_unlock(&store_mutex);
+}
+
+size_t gallery_store_format_identities_json(char *buffer, size_t capacity) {
+    size_t used = 0;
+    int n = snprintf(buffer, capacity, "{\"identities\":[");
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    used = (size_t)n;
+
+    pthread_mutex_lock(&table_mutex);
+    bool first = true;
+    for (size_t i = 0; i < identity_slots; i++) {
+        const GalleryIdentity *identity = &identities[i];
+        if (identity->name[0] == '\0') {
+            continue;
+        }
+        /* Names are restricted to [A-Za-z0-9_.-], so they need no escaping. */
+        n = snprintf(buffer + used, capacity - used,
+                     "%s{\"identity\":\"%s\",\"id\":%llu,\"entries\":%zu}", first ? "" : ",",
+                     identity->name, (unsigned long long)identity->id, identity->entries);
+        if (n < 0 || (size_t)n >= capacity - used) {
+            pthread_mutex_unlock(&table_mutex);
+            return 0;
+        }
+        used += (size_t)n;
+        first = false;
+    }
+    pthread_mutex_unlock(&table_mutex);
+
+    n = snprintf(buffer + used, capacity - used, "]}");
+    if (n < 0 || (size_t)n >= capacity - used) {
+        return 0;
+    }
+    return used + (size_t)n;
+}
@@ -0,0 +1,50 @@
+#ifndef GALLERY_STORE_H
+#define GALLERY_STORE_H
+
+#include "gallery.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GALLERY_NAME_MAX 63
+
+typedef struct {
+    uint64_t id;
+    char name[GALLERY_NAME_MAX + 1];
+    size_t entries;
+} GalleryIdentity;
+
+typedef struct {
+    GalleryIdentity identity;
+    float similarity;
+} GalleryStoreMatch;
+
+typedef struct {
+    size_t dim;
+    size_t entries;
+    size_t deleted;
+    size_t identities;
+    uint64_t log_records;
+    uint64_t compactions;
+    uint64_t load_us;
+    bool snapshot_mapped;
+} GalleryStoreStats;
+
+bool gallery_store_open(const char *directory, size_t dim);
+void gallery_store_close(void);
+bool gallery_store_is_open(void);
+
+bool gallery_valid_identity_name(const char *name);
+bool gallery_store_enroll(const char *name, const float *embedding, GalleryIdentity *out);
+bool gallery_store_remove(const char *name, GalleryIdentity *out);
+size_t gallery_store_search(const float *query,
+                            size_t k,
+                            float min_similarity,
+                            GalleryStoreMatch *out);
+
+bool gallery_store_compact(void);
+void gallery_store_stats(GalleryStoreStats *out);
+size_t gallery_store_format_identities_json(char *buffer, size_t capacity);
+
+#endif
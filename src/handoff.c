@@ -0,0 +1,369 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "handoff.h"
+
+#include "router.h"
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define HANDOFF_READY 'R'
+#define HANDOFF_LISTENER 'L'
+#define HANDOFF_ACK 'A'
+
+enum { RECORD_LATEST = 1, RECORD_FRAME = 2, RECORD_END = 3 };
+
+/* Host byte order: both ends are the same binary family on the same machine. */
+typedef struct {
+    uint32_t kind;
+    uint32_t length;
+    uint64_t stream;
+    uint64_t time_ms;
+} HandoffRecord;
+
+typedef struct PendingFrame {
+    struct PendingFrame *next;
+    uint64_t stream;
+    uint64_t time_ms;
+    size_t length;
+    unsigned char data[];
+} PendingFrame;
+
+extern char **environ;
+
+static bool send_all(int fd, const void *buffer, size_t length) {
+    const unsigned char *data = (const unsigned char *)buffer;
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, void *buffer, size_t length) {
+    unsigned char *data = (unsigned char *)buffer;
+    size_t received = 0;
+    while (received < length) {
+        ssize_t n = recv(fd, data + received, length - received, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        received += (size_t)n;
+    }
+    return true;
+}
+
+static bool wait_readable(int fd, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int n;
+    do {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    return n > 0;
+}
+
+static bool send_record(int sock,
+                        uint32_t kind,
+                        uint64_t stream,
+                        uint64_t time_ms,
+                        const unsigned char *data,
+                        size_t length) {
+    HandoffRecord record = {kind, (uint32_t)length, stream, time_ms};
+    return length <= UINT32_MAX && send_all(sock, &record, sizeof(record)) &&
+           (length == 0 || send_all(sock, data, length));
+}
+
+static bool send_frame(uint64_t stream,
+                       uint64_t time_ms,
+                       const unsigned char *data,
+                       size_t length,
+                       void *ctx) {
+    return send_record(*(const int *)ctx, RECORD_FRAME, stream, time_ms, data, length);
+}
+
+static bool send_listeners(int sock, const int *listen_fds, size_t count) {
+    if (count == 0 || count > MAX_HANDOFF_SOCKETS) {
+        return false;
+    }
+    char tag = HANDOFF_LISTENER;
+    struct iovec iov = {&tag, 1};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKETS)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), listen_fds, sizeof(int) * count);
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == 1;
+}
+
+/* Returns how many listening sockets arrived (stored in `listen_fds`), 0 on failure. */
+static size_t receive_listeners(int sock, int *listen_fds, size_t capacity) {
+    char tag = 0;
+    struct iovec iov = {&tag, 1};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_SOCKETS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len < CMSG_LEN(sizeof(int))) {
+        return 0;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    bool ok = tag == HANDOFF_LISTENER && count <= capacity;
+    for (size_t i = 0; i < count; i++) {
+        int fd = -1;
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        if (ok) {
+            listen_fds[i] = fd;
+        } else {
+            close(fd);
+        }
+    }
+    return ok ? count : 0;
+}
+
+/*
+ * Starts `exe_path` (normally the path this binary was started from, which an
+ * upgrade will have replaced) with the same arguments and HANDOFF_ENV naming
+ * its end of a new socket pair. Every other descriptor is closed in the child
+ * so it cannot hold client sockets of this process open.
+ */
+bool handoff_spawn(const char *exe_path, char *const argv[], HandoffChild *child) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        perror("socketpair");
+        return false;
+    }
+
+    /* Everything the child needs is prepared here: after fork() it may only make syscalls. */
+    size_t env_count = 0;
+    while (environ[env_count] != NULL) {
+        env_count++;
+    }
+    char **envp = (char **)malloc((env_count + 2) * sizeof(*envp));
+    char handoff_var[64];
+    snprintf(handoff_var, sizeof(handoff_var), "%s=%d", HANDOFF_ENV, fds[1]);
+    struct rlimit limit;
+    int max_fd = getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+                     ? (int)limit.rlim_cur
+                     : 65536;
+    pid_t pid = -1;
+    if (envp != NULL) {
+        size_t used = 0;
+        for (size_t i = 0; i < env_count; i++) {
+            if (strncmp(environ[i], HANDOFF_ENV "=", sizeof(HANDOFF_ENV)) != 0) {
+                envp[used++] = environ[i];
+            }
+        }
+        envp[used++] = handoff_var;
+        envp[used] = NULL;
+        pid = fork();
+    }
+    if (pid == 0) {
+        for (int fd = 3; fd < max_fd; fd++) {
+            if (fd != fds[1]) {
+                close(fd);
+            }
+        }
+        fcntl(fds[1], F_SETFD, 0);
+        execve(exe_path, argv, envp);
+        _exit(127);
+    }
+    free(envp);
+    close(fds[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(fds[0]);
+        return false;
+    }
+    child->pid = pid;
+    child->sock = fds[0];
+    return true;
+}
+
+/*
+ * Runs on the accept thread once the child's socket turns readable. Hands
+ * over the listeners, the latest frame and the frame history, and closes the
+ * frame store so the child can open the recorder. From the moment the
+ * listeners are sent this process must not accept again unless this returns
+ * false, in which case the frame store has been reopened (history empty).
+ */
+bool handoff_serve(HandoffChild *child,
+                   const int *listen_fds,
+                   size_t listen_count,
+                   const FrameStoreParams *frame_params) {
+    char byte = 0;
+    if (!recv_all(child->sock, &byte, 1) || byte != HANDOFF_READY ||
+        !send_listeners(child->sock, listen_fds, listen_count)) {
+        return false;
+    }
+    size_t latest_length = 0;
+    const unsigned char *latest = router_latest_frame(&latest_length);
+    bool ok = send_record(child->sock, RECORD_LATEST, 0, 0, latest, latest_length) &&
+              frame_store_export(send_frame, &child->sock);
+    frame_store_close();
+    ok = ok && send_record(child->sock, RECORD_END, 0, 0, NULL, 0) &&
+         wait_readable(child->sock, HANDOFF_TIMEOUT_MS) && recv_all(child->sock, &byte, 1) &&
+         byte == HANDOFF_ACK;
+    if (!ok) {
+        frame_store_open(frame_params);
+        return false;
+    }
+    /* The child is the server now; nothing here may signal or wait for it. */
+    close(child->sock);
+    child->sock = -1;
+    child->pid = -1;
+    return true;
+}
+
+/* The child failed or stalled before taking over: make sure it never serves. */
+void handoff_abandon(HandoffChild *child) {
+    if (child->sock >= 0) {
+        close(child->sock);
+        child->sock = -1;
+    }
+    if (child->pid > 0) {
+        kill(child->pid, SIGKILL);
+        waitpid(child->pid, NULL, 0);
+        child->pid = -1;
+    }
+}
+
+/* The socket a restarting parent passed down, or -1 when started normally. */
+int handoff_inherited_socket(void) {
+    const char *value = getenv(HANDOFF_ENV);
+    if (value == NULL) {
+        return -1;
+    }
+    char *end = NULL;
+    long fd = strtol(value, &end, 10);
+    unsetenv(HANDOFF_ENV);
+    if (end == value || *end != '\0' || fd < 3 || fd > INT32_MAX) {
+        return -1;
+    }
+    fcntl((int)fd, F_SETFD, FD_CLOEXEC);
+    return (int)fd;
+}
+
+static void free_pending(PendingFrame *list) {
+    while (list != NULL) {
+        PendingFrame *next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+/*
+ * The new process's half: asks for the listeners, restores the latest frame,
+ * opens the frame store once the old process has closed it, and puts the
+ * history back. Frames are buffered until then. Returns how many listening
+ * sockets were stored in `listen_fds`, or 0 (the old process then keeps
+ * serving).
+ */
+size_t handoff_take_over(int sock,
+                         const FrameStoreParams *frame_params,
+                         int *listen_fds,
+                         size_t capacity) {
+    char byte = HANDOFF_READY;
+    size_t listen_count = send_all(sock, &byte, 1) ? receive_listeners(sock, listen_fds, capacity)
+                                                   : 0;
+    PendingFrame *head = NULL;
+    PendingFrame **tail = &head;
+    bool done = false;
+    bool ok = listen_count > 0;
+    while (ok && !done) {
+        HandoffRecord record;
+        ok = recv_all(sock, &record, sizeof(record));
+        if (!ok || record.kind == RECORD_END) {
+            done = ok;
+            continue;
+        }
+        PendingFrame *frame = (PendingFrame *)malloc(sizeof(PendingFrame) + record.length);
+        ok = frame != NULL && recv_all(sock, frame->data, record.length);
+        if (!ok) {
+            free(frame);
+            continue;
+        }
+        frame->next = NULL;
+        frame->stream = record.stream;
+        frame->time_ms = record.time_ms;
+        frame->length = record.length;
+        if (record.kind == RECORD_LATEST) {
+            router_restore_latest_frame(frame->data, frame->length);
+            free(frame);
+        } else {
+            *tail = frame;
+            tail = &frame->next;
+        }
+    }
+
+    if (ok) {
+        if (frame_store_open(frame_params)) {
+            for (const PendingFrame *frame = head; frame != NULL; frame = frame->next) {
+                frame_store_restore(frame->stream, frame->time_ms, frame->data, frame->length);
+            }
+        } else {
+            fprintf(stderr, "Frame history disabled: cannot open %s\n",
+                    frame_params->record_dir != NULL ? frame_params->record_dir : "");
+        }
+        byte = HANDOFF_ACK;
+        ok = send_all(sock, &byte, 1);
+    }
+    free_pending(head);
+    close(sock);
+    if (!ok) {
+        for (size_t i = 0; i < listen_count; i++) {
+            close(listen_fds[i]);
+        }
+        listen_count = 0;
+    }
+    return listen_count;
+}
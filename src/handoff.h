@@ -0,0 +1,37 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "frame_store.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Hot restart. The running server starts a new copy of its binary with one
+ * end of a Unix socket pair; once the new process has loaded everything it
+ * asks for the listening sockets, which travel over SCM_RIGHTS, followed by
+ * the latest frame and the in-memory frame history. The listening sockets
+ * never close, so connections arriving meanwhile wait in their backlogs.
+ */
+typedef struct {
+    pid_t pid;
+    int sock;
+} HandoffChild;
+
+#define HANDOFF_ENV "WEB_SERVER_HANDOFF_FD"
+
+bool handoff_spawn(const char *exe_path, char *const argv[], HandoffChild *child);
+bool handoff_serve(HandoffChild *child,
+                   const int *listen_fds,
+                   size_t listen_count,
+                   const FrameStoreParams *frame_params);
+void handoff_abandon(HandoffChild *child);
+
+int handoff_inherited_socket(void);
+size_t handoff_take_over(int sock,
+                         const FrameStoreParams *frame_params,
+                         int *listen_fds,
+                         size_t capacity);
+
+#endif
@@ -1,16 +1,39 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "http.h"
 
+#include "perf_counters.h"
 #include "server_config.h"
+#include "trace.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/sendfile.h>
+#include <time.h>
 #include <unistd.h>
 
+static _Thread_local bool response_sent = false;
+static _Thread_local int response_status = 0;
+static _Thread_local size_t response_bytes = 0;
+
+/* Changed by a config reload while requests may be read on other threads. */
+static _Atomic size_t max_request_bytes = MAX_REQUEST_SIZE;
+static _Atomic size_t max_header_bytes = MAX_HEADER_SIZE;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
 static bool send_all(int client_fd, const void *buffer, size_t length) {
     const unsigned char *data = (const unsigned char *)buffer;
     size_t total = 0;
@@ -28,12 +51,11 @@ static bool send_all(int client_fd, const void *buffer, size_t length) {
     return true;
 }
 
-void send_http_response(int client_fd,
-                        const char *status,
-                        const char *content_type,
-                        const void *body,
-                        size_t body_length,
-                        const char *extra_headers) {
+static bool send_http_headers(int client_fd,
+                              const char *status,
+                              const char *content_type,
+                              size_t body_length,
+                              const char *extra_headers) {
     char header[1024];
     int n = snprintf(
         header,
@@ -50,15 +72,160 @@ void send_http_response(int client_fd,
         extra_headers != NULL ? extra_headers : "");
 
     if (n < 0 || (size_t)n >= sizeof(header)) {
-        return;
+        return false;
     }
+    http_note_response((int)strtol(status, NULL, 10), (size_t)n + body_length);
+    return send_all(client_fd, header, (size_t)n);
+}
 
-    if (!send_all(client_fd, header, (size_t)n)) {
-        return;
-    }
-    if (body != NULL && body_length > 0) {
+void http_response_reset(void) {
+    response_sent = false;
+}
+
+/* Responses written by hand (the event stream) report themselves here. */
+void http_note_response(int status, size_t bytes) {
+    response_sent = true;
+    response_status = status;
+    response_bytes = bytes;
+}
+
+/*
+ * The status and size of the last response this thread sent since
+ * http_response_reset(); false if it sent none (the request was handed on).
+ */
+bool http_last_response(int *status, size_t *bytes) {
+    *status = response_status;
+    *bytes = response_bytes;
+    return response_sent;
+}
+
+void send_http_response(int client_fd,
+                        const char *status,
+                        const char *content_type,
+                        const void *body,
+                        size_t body_length,
+                        const char *extra_headers) {
+    TRACE_START(send_start);
+    PERF_START(perf_send);
+    if (send_http_headers(client_fd, status, content_type, body_length, extra_headers) &&
+        body != NULL && body_length > 0) {
         (void)send_all(client_fd, body, body_length);
     }
+    TRACE_END("send", send_start);
+    PERF_END(PERF_STAGE_SEND, perf_send);
+}
+
+static bool send_file_body(int client_fd, int file_fd, off_t offset, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = sendfile(client_fd, file_fd, &offset, length - sent);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("sendfile");
+            return false;
+        }
+        if (n == 0) {
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+/* Like send_http_response(), but the body is copied from a file by the kernel. */
+bool send_http_file_response(int client_fd,
+                             const char *status,
+                             const char *content_type,
+                             int file_fd,
+                             off_t offset,
+                             size_t length,
+                             const char *extra_headers) {
+    TRACE_START(send_start);
+    PERF_START(perf_send);
+    bool ok = send_http_headers(client_fd, status, content_type, length, extra_headers) &&
+              send_file_body(client_fd, file_fd, offset, length);
+    TRACE_END("send", send_start);
+    PERF_END(PERF_STAGE_SEND, perf_send);
+    return ok;
+}
+
+/*
+ * Copies `text` into `out` as the body of a JSON string: quotes and
+ * backslashes are escaped and control bytes dropped. Text that does not fit
+ * is cut before the first character that would overflow, never inside an
+ * escape, and `out` is always terminated. Returns the length written.
+ */
+size_t http_json_escape(char *out, size_t capacity, const char *text) {
+    size_t used = 0;
+    for (const unsigned char *p = (const unsigned char *)text; *p != '\0'; p++) {
+        if (*p < 0x20) {
+            continue;
+        }
+        bool escape = *p == '"' || *p == '\\';
+        if (used + (escape ? 2u : 1u) >= capacity) {
+            break;
+        }
+        if (escape) {
+            out[used++] = '\\';
+        }
+        out[used++] = (char)*p;
+    }
+    out[used] = '\0';
+    return used;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Copies the percent-decoded value of query parameter `name` into `out`.
+ * Returns false when the parameter is absent or its value does not fit.
+ */
+bool http_query_param(const HttpRequest *request, const char *name, char *out, size_t capacity) {
+    size_t name_length = strlen(name);
+    const char *cursor = request->query;
+    while (*cursor != '\0') {
+        const char *end = strchr(cursor, '&');
+        if (end == NULL) {
+            end = cursor + strlen(cursor);
+        }
+        if ((size_t)(end - cursor) >= name_length && strncmp(cursor, name, name_length) == 0 &&
+            (cursor[name_length] == '=' || cursor + name_length == end)) {
+            const char *value = cursor + name_length + (cursor + name_length < end ? 1 : 0);
+            size_t used = 0;
+            while (value < end) {
+                if (used + 1 >= capacity) {
+                    return false;
+                }
+                int high = 0;
+                int low = 0;
+                if (*value == '%' && end - value >= 3 && (high = hex_value(value[1])) >= 0 &&
+                    (low = hex_value(value[2])) >= 0) {
+                    out[used++] = (char)(high * 16 + low);
+                    value += 3;
+                } else {
+                    out[used++] = *value == '+' ? ' ' : *value;
+                    value++;
+                }
+            }
+            out[used] = '\0';
+            return true;
+        }
+        cursor = *end == '&' ? end + 1 : end;
+    }
+    return false;
 }
 
 void send_error_response(int client_fd, int status_code) {
@@ -81,12 +248,36 @@ void send_error_response(int client_fd, int status_code) {
                            sizeof(body) - 1, NULL);
         break;
     }
+    case 408: {
+        static const char body[] = "Request Timeout";
+        send_http_response(client_fd, "408 Request Timeout", "text/plain; charset=utf-8", body,
+                           sizeof(body) - 1, NULL);
+        break;
+    }
     case 413: {
         static const char body[] = "Payload Too Large";
         send_http_response(client_fd, "413 Payload Too Large", "text/plain; charset=utf-8", body,
                            sizeof(body) - 1, NULL);
         break;
     }
+    case 415: {
+        static const char body[] = "Unsupported Media Type";
+        send_http_response(client_fd, "415 Unsupported Media Type", "text/plain; charset=utf-8",
+                           body, sizeof(body) - 1, NULL);
+        break;
+    }
+    case 422: {
+        static const char body[] = "Unprocessable Entity";
+        send_http_response(client_fd, "422 Unprocessable Entity", "text/plain; charset=utf-8",
+                           body, sizeof(body) - 1, NULL);
+        break;
+    }
+    case 503: {
+        static const char body[] = "Service Unavailable";
+        send_http_response(client_fd, "503 Service Unavailable", "text/plain; charset=utf-8",
+                           body, sizeof(body) - 1, NULL);
+        break;
+    }
     default: {
         static const char body[] = "Internal Server Error";
         send_http_response(client_fd, "500 Internal Server Error", "text/plain; charset=utf-8",
@@ -153,6 +344,7 @@ static bool parse_request_headers(const unsigned char *raw,
     char *query = strchr(request->path, '?');
     if (query != NULL) {
         *query = '\0';
+        snprintf(request->query, sizeof(request->query), "%s", query + 1);
     }
 
     char *cursor = line_end + 2;
@@ -181,6 +373,19 @@ static bool parse_request_headers(const unsigned char *raw,
         } else if (strncasecmp(cursor, "Content-Type:", 13) == 0) {
             const char *value = trim_whitespace(cursor + 13);
             snprintf(request->content_type, sizeof(request->content_type), "%s", value);
+        } else if (strncasecmp(cursor, "X-Stream-Id:", 12) == 0) {
+            const char *value = trim_whitespace(cursor + 12);
+            snprintf(request->stream_id, sizeof(request->stream_id), "%s", value);
+        } else if (strncasecmp(cursor, "Last-Event-ID:", 14) == 0) {
+            const char *value = trim_whitespace(cursor + 14);
+            errno = 0;
+            char *end = NULL;
+            unsigned long long parsed = strtoull(value, &end, 10);
+            /* A malformed id is ignored, as EventSource servers are expected to. */
+            if (errno == 0 && end != value && *trim_whitespace(end) == '\0') {
+                request->has_last_event_id = true;
+                request->last_event_id = (uint64_t)parsed;
+            }
         }
 
         if (next == NULL) {
@@ -193,20 +398,35 @@ static bool parse_request_headers(const unsigned char *raw,
     return true;
 }
 
-bool read_http_request(int client_fd, HttpRequest *request, int *status_code) {
-    memset(request, 0, sizeof(*request));
-    unsigned char header_buffer[MAX_HEADER_SIZE];
+/* A read timed out (SO_RCVTIMEO on the listener) rather than failed. */
+static int read_error_status(void) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 408;
+    }
+    perror("read");
+    return 400;
+}
+
+/*
+ * Reads up to the end of the headers and parses them. Body bytes that
+ * arrived with the headers are kept in `body` (`body_length` of the
+ * `content_length`).
+ */
+static bool read_head(int client_fd,
+                      unsigned char *header_buffer,
+                      size_t header_capacity,
+                      HttpRequest *request,
+                      int *status_code) {
     size_t total_read = 0;
     size_t header_end = SIZE_MAX;
 
-    while (total_read < sizeof(header_buffer)) {
-        ssize_t n = read(client_fd, header_buffer + total_read, sizeof(header_buffer) - total_read);
+    while (total_read < header_capacity) {
+        ssize_t n = read(client_fd, header_buffer + total_read, header_capacity - total_read);
         if (n < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("read");
-            *status_code = 400;
+            *status_code = read_error_status();
             return false;
         }
         if (n == 0) {
@@ -230,45 +450,49 @@ bool read_http_request(int client_fd, HttpRequest *request, int *status_code) {
         return false;
     }
 
-    if (request->content_length > MAX_REQUEST_SIZE) {
-        *status_code = 413;
-        return false;
-    }
-
     size_t body_start = header_end + 4;
     size_t initial_body_bytes = total_read > body_start ? total_read - body_start : 0;
-    request->body_length = request->content_length;
-
-    if (request->body_length == 0) {
-        request->body = NULL;
+    if (initial_body_bytes > request->content_length) {
+        initial_body_bytes = request->content_length;
+    }
+    if (initial_body_bytes == 0) {
         return true;
     }
-
-    request->body = (unsigned char *)malloc(request->body_length);
+    request->body = (unsigned char *)malloc(initial_body_bytes);
     if (request->body == NULL) {
         *status_code = 500;
         return false;
     }
+    memcpy(request->body, header_buffer + body_start, initial_body_bytes);
+    request->body_length = initial_body_bytes;
+    return true;
+}
 
-    if (initial_body_bytes > request->body_length) {
-        initial_body_bytes = request->body_length;
+static bool read_body(int client_fd, HttpRequest *request, int *status_code) {
+    if (request->content_length >
+        atomic_load_explicit(&max_request_bytes, memory_order_relaxed)) {
+        *status_code = 413;
+        return false;
+    }
+    if (request->content_length == request->body_length) {
+        return true;
     }
-    if (initial_body_bytes > 0) {
-        memcpy(request->body, header_buffer + body_start, initial_body_bytes);
+
+    unsigned char *body = (unsigned char *)realloc(request->body, request->content_length);
+    if (body == NULL) {
+        *status_code = 500;
+        return false;
     }
+    request->body = body;
 
-    size_t copied = initial_body_bytes;
-    while (copied < request->body_length) {
-        ssize_t n = read(client_fd, request->body + copied, request->body_length - copied);
+    size_t copied = request->body_length;
+    while (copied < request->content_length) {
+        ssize_t n = read(client_fd, request->body + copied, request->content_length - copied);
         if (n < 0) {
             if (errno == EINTR) {
                 continue;
             }
-            perror("read");
-            *status_code = 400;
-            free(request->body);
-            request->body = NULL;
-            request->body_length = 0;
+            *status_code = read_error_status();
             return false;
         }
         if (n == 0) {
@@ -276,15 +500,112 @@ bool read_http_request(int client_fd, HttpRequest *request, int *status_code) {
         }
         copied += (size_t)n;
     }
+    request->body_length = copied;
 
-    if (copied < request->body_length) {
+    if (copied < request->content_length) {
         *status_code = 400;
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Reads the request line and headers only, leaving the body on the socket
+ * for a handler that streams it (see HttpBodyReader). Complete it with
+ * read_http_request_body() otherwise.
+ */
+bool read_http_request_head(int client_fd, HttpRequest *request, int *status_code) {
+    TRACE_START(read_start);
+    PERF_START(perf_read);
+    uint64_t start = monotonic_us();
+    memset(request, 0, sizeof(*request));
+    size_t header_capacity = atomic_load_explicit(&max_header_bytes, memory_order_relaxed);
+    unsigned char *header_buffer = (unsigned char *)malloc(header_capacity);
+    if (header_buffer == NULL) {
+        *status_code = 500;
+        TRACE_END("read", read_start);
+        PERF_END(PERF_STAGE_READ, perf_read);
+        return false;
+    }
+    bool ok = read_head(client_fd, header_buffer, header_capacity, request, status_code);
+    free(header_buffer);
+    request->read_us = monotonic_us() - start;
+    TRACE_END("read", read_start);
+    PERF_END(PERF_STAGE_READ, perf_read);
+    return ok;
+}
+
+/* Reads the rest of the body into `body`, within the request size limit. */
+bool read_http_request_body(int client_fd, HttpRequest *request, int *status_code) {
+    TRACE_START(read_start);
+    PERF_START(perf_read);
+    uint64_t start = monotonic_us();
+    bool ok = read_body(client_fd, request, status_code);
+    if (!ok) {
         free(request->body);
         request->body = NULL;
         request->body_length = 0;
-        return false;
     }
+    request->read_us += monotonic_us() - start;
+    TRACE_END("read", read_start);
+    PERF_END(PERF_STAGE_READ, perf_read);
+    return ok;
+}
 
+bool read_http_request(int client_fd, HttpRequest *request, int *status_code) {
+    return read_http_request_head(client_fd, request, status_code) &&
+           read_http_request_body(client_fd, request, status_code);
+}
+
+/* Reads from the body bytes `request` already holds, then from the socket. */
+void http_body_reader_init(HttpBodyReader *reader, int client_fd, const HttpRequest *request) {
+    reader->fd = client_fd;
+    reader->buffered = request->body;
+    reader->buffered_length = request->body_length;
+    reader->remaining = request->content_length;
+}
+
+/*
+ * Copies exactly `length` bytes of the body to `out` (or discards them when
+ * `out` is NULL). False with a status when the body is shorter, the client
+ * stopped sending (408) or the read failed.
+ */
+bool http_body_read(HttpBodyReader *reader, void *out, size_t length, int *status_code) {
+    unsigned char *cursor = (unsigned char *)out;
+    if (length > reader->remaining) {
+        *status_code = 400;
+        return false;
+    }
+    while (length > 0) {
+        size_t n = 0;
+        if (reader->buffered_length > 0) {
+            n = length < reader->buffered_length ? length : reader->buffered_length;
+            if (cursor != NULL) {
+                memcpy(cursor, reader->buffered, n);
+            }
+            reader->buffered += n;
+            reader->buffered_length -= n;
+        } else {
+            unsigned char scratch[4096];
+            unsigned char *into = cursor != NULL ? cursor : scratch;
+            size_t want = cursor != NULL || length < sizeof(scratch) ? length : sizeof(scratch);
+            ssize_t got = read(reader->fd, into, want);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                *status_code = got < 0 ? read_error_status() : 400;
+                return false;
+            }
+            n = (size_t)got;
+        }
+        if (cursor != NULL) {
+            cursor += n;
+        }
+        length -= n;
+        reader->remaining -= n;
+    }
     return true;
 }
 
@@ -293,3 +614,13 @@ void free_http_request(HttpRequest *request) {
     request->body = NULL;
     request->body_length = 0;
 }
+
+/* Limits for requests read from now on; zero keeps the current value. */
+void http_set_limits(size_t max_request, size_t max_header) {
+    if (max_request > 0) {
+        atomic_store_explicit(&max_request_bytes, max_request, memory_order_relaxed);
+    }
+    if (max_header > 0) {
+        atomic_store_explicit(&max_header_bytes, max_header, memory_order_relaxed);
+    }
+}
@@ -3,18 +3,29 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 typedef struct {
     char method[8];
     char path[256];
+    char query[256];
     char content_type[128];
+    char stream_id[64];
+    bool has_last_event_id;
+    uint64_t last_event_id;
     size_t content_length;
+    /* All `content_length` bytes, or after read_http_request_head() only those read so far. */
     unsigned char *body;
     size_t body_length;
+    uint64_t read_us;
 } HttpRequest;
 
 bool read_http_request(int client_fd, HttpRequest *request, int *status_code);
+bool read_http_request_head(int client_fd, HttpRequest *request, int *status_code);
+bool read_http_request_body(int client_fd, HttpRequest *request, int *status_code);
 void free_http_request(HttpRequest *request);
+void http_set_limits(size_t max_request, size_t max_header);
 
 void send_http_response(int client_fd,
                         const char *status,
@@ -23,6 +34,32 @@ void send_http_response(int client_fd,
                         size_t body_length,
                         const char *extra_headers);
 
+bool send_http_file_response(int client_fd,
+                             const char *status,
+                             const char *content_type,
+                             int file_fd,
+                             off_t offset,
+                             size_t length,
+                             const char *extra_headers);
+
 void send_error_response(int client_fd, int status_code);
 
+void http_response_reset(void);
+void http_note_response(int status, size_t bytes);
+bool http_last_response(int *status, size_t *bytes);
+
+/* A request body consumed piece by piece instead of held in memory. */
+typedef struct {
+    int fd;
+    const unsigned char *buffered;
+    size_t buffered_length;
+    size_t remaining;
+} HttpBodyReader;
+
+void http_body_reader_init(HttpBodyReader *reader, int client_fd, const HttpRequest *request);
+bool http_body_read(HttpBodyReader *reader, void *out, size_t length, int *status_code);
+
+bool http_query_param(const HttpRequest *request, const char *name, char *out, size_t capacity);
+size_t http_json_escape(char *out, size_t capacity, const char *text);
+
 #endif
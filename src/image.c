@@ -0,0 +1,522 @@
+#include "image.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IMAGE_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define IMAGE_HAVE_X86 0
+#endif
+
+#define COEF_CR_R 359
+#define COEF_CB_G 88
+#define COEF_CR_G 183
+#define COEF_CB_B 454
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ImageBuffer *pool_buffers = NULL;
+static ImageBuffer *pool_free_list = NULL;
+static size_t pool_count = 0;
+static size_t pool_free_count = 0;
+
+static atomic_int kernel_level = -1;
+
+static size_t align_up(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void image_pool_shutdown(void) {
+    pthread_mutex_lock(&pool_mutex);
+    for (size_t i = 0; i < pool_count; i++) {
+        free(pool_buffers[i].gray);
+    }
+    free(pool_buffers);
+    pool_buffers = NULL;
+    pool_free_list = NULL;
+    pool_count = 0;
+    pool_free_count = 0;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+bool image_pool_init(size_t count, int max_width, int max_height) {
+    if (count == 0 || max_width <= 0 || max_height <= 0) {
+        return false;
+    }
+
+    image_pool_shutdown();
+
+    ImageBuffer *buffers = (ImageBuffer *)calloc(count, sizeof(*buffers));
+    if (buffers == NULL) {
+        return false;
+    }
+
+    size_t stride = align_up((size_t)max_width, IMAGE_ALIGNMENT);
+    size_t plane_size = stride * (size_t)max_height;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *block = (uint8_t *)aligned_alloc(IMAGE_ALIGNMENT, plane_size * 4);
+        if (block == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                free(buffers[j].gray);
+            }
+            free(buffers);
+            return false;
+        }
+        ImageBuffer *image = &buffers[i];
+        image->stride = stride;
+        image->capacity_width = max_width;
+        image->capacity_height = max_height;
+        image->gray = block;
+        image->r = block + plane_size;
+        image->g = block + plane_size * 2;
+        image->b = block + plane_size * 3;
+        image->next_free = (i + 1 < count) ? &buffers[i + 1] : NULL;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    pool_buffers = buffers;
+    pool_free_list = &buffers[0];
+    pool_count = count;
+    pool_free_count = count;
+    pthread_mutex_unlock(&pool_mutex);
+    return true;
+}
+
+ImageBuffer *image_pool_acquire(void) {
+    pthread_mutex_lock(&pool_mutex);
+    ImageBuffer *image = pool_free_list;
+    if (image != NULL) {
+        pool_free_list = image->next_free;
+        image->next_free = NULL;
+        image->width = 0;
+        image->height = 0;
+        pool_free_count--;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return image;
+}
+
+void image_pool_release(ImageBuffer *image) {
+    if (image == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool_mutex);
+    image->next_free = pool_free_list;
+    pool_free_list = image;
+    pool_free_count++;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+size_t image_pool_available(void) {
+    pthread_mutex_lock(&pool_mutex);
+    size_t available = pool_free_count;
+    pthread_mutex_unlock(&pool_mutex);
+    return available;
+}
+
+static ImageKernelLevel detect_kernel_level(void) {
+#if IMAGE_HAVE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return IMAGE_KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return IMAGE_KERNEL_SSSE3;
+    }
+#endif
+    return IMAGE_KERNEL_SCALAR;
+}
+
+ImageKernelLevel image_kernel_level(void) {
+    int level = atomic_load(&kernel_level);
+    if (level < 0) {
+        level = (int)detect_kernel_level();
+        atomic_store(&kernel_level, level);
+    }
+    return (ImageKernelLevel)level;
+}
+
+ImageKernelLevel image_set_kernel_level(ImageKernelLevel level) {
+    ImageKernelLevel supported = detect_kernel_level();
+    if (level > supported) {
+        level = supported;
+    }
+    atomic_store(&kernel_level, (int)level);
+    return level;
+}
+
+static inline int fixed_mul(int value, int coef) {
+    return ((value * 128) * coef + (1 << 14)) >> 15;
+}
+
+static inline uint8_t clamp_u8(int value) {
+    if (value < 0) {
+        return 0;
+    }
+    if (value > 255) {
+        return 255;
+    }
+    return (uint8_t)value;
+}
+
+static void ycc_to_planes_scalar(const uint8_t *ycc,
+                                 int width,
+                                 uint8_t *gray,
+                                 uint8_t *r,
+                                 uint8_t *g,
+                                 uint8_t *b) {
+    for (int x = 0; x < width; x++) {
+        int y = ycc[x * 3];
+        int cb = ycc[x * 3 + 1] - 128;
+        int cr = ycc[x * 3 + 2] - 128;
+        gray[x] = (uint8_t)y;
+        r[x] = clamp_u8(y + fixed_mul(cr, COEF_CR_R));
+        g[x] = clamp_u8(y - fixed_mul(cb, COEF_CB_G) - fixed_mul(cr, COEF_CR_G));
+        b[x] = clamp_u8(y + fixed_mul(cb, COEF_CB_B));
+    }
+}
+
+#if IMAGE_HAVE_X86
+static const int8_t shuffle_y[3][16] = {
+    {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13},
+};
+static const int8_t shuffle_cb[3][16] = {
+    {1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14},
+};
+static const int8_t shuffle_cr[3][16] = {
+    {2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+    {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15},
+};
+
+__attribute__((target("ssse3"))) static inline __m128i deinterleave3(__m128i v0,
+                                                                      __m128i v1,
+                                                                      __m128i v2,
+                                                                      const int8_t mask[3][16]) {
+    __m128i a = _mm_shuffle_epi8(v0, _mm_loadu_si128((const __m128i *)mask[0]));
+    __m128i b = _mm_shuffle_epi8(v1, _mm_loadu_si128((const __m128i *)mask[1]));
+    __m128i c = _mm_shuffle_epi8(v2, _mm_loadu_si128((const __m128i *)mask[2]));
+    return _mm_or_si128(_mm_or_si128(a, b), c);
+}
+
+__attribute__((target("ssse3"))) static void ycc_to_planes_ssse3(const uint8_t *ycc,
+                                                                  int width,
+                                                                  uint8_t *gray,
+                                                                  uint8_t *r,
+                                                                  uint8_t *g,
+                                                                  uint8_t *b) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i cr_r = _mm_set1_epi16(COEF_CR_R);
+    const __m128i cb_g = _mm_set1_epi16(COEF_CB_G);
+    const __m128i cr_g = _mm_set1_epi16(COEF_CR_G);
+    const __m128i cb_b = _mm_set1_epi16(COEF_CB_B);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *src = ycc + x * 3;
+        __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i y8 = deinterleave3(v0, v1, v2, shuffle_y);
+        __m128i cb8 = deinterleave3(v0, v1, v2, shuffle_cb);
+        __m128i cr8 = deinterleave3(v0, v1, v2, shuffle_cr);
+        _mm_storeu_si128((__m128i *)(gray + x), y8);
+
+        __m128i out_r[2];
+        __m128i out_g[2];
+        __m128i out_b[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i y16 = half == 0 ? _mm_unpacklo_epi8(y8, zero) : _mm_unpackhi_epi8(y8, zero);
+            __m128i cb16 = half == 0 ? _mm_unpacklo_epi8(cb8, zero) : _mm_unpackhi_epi8(cb8, zero);
+            __m128i cr16 = half == 0 ? _mm_unpacklo_epi8(cr8, zero) : _mm_unpackhi_epi8(cr8, zero);
+            cb16 = _mm_slli_epi16(_mm_sub_epi16(cb16, bias), 7);
+            cr16 = _mm_slli_epi16(_mm_sub_epi16(cr16, bias), 7);
+            out_r[half] = _mm_add_epi16(y16, _mm_mulhrs_epi16(cr16, cr_r));
+            out_g[half] = _mm_sub_epi16(
+                _mm_sub_epi16(y16, _mm_mulhrs_epi16(cb16, cb_g)), _mm_mulhrs_epi16(cr16, cr_g));
+            out_b[half] = _mm_add_epi16(y16, _mm_mulhrs_epi16(cb16, cb_b));
+        }
+        _mm_storeu_si128((__m128i *)(r + x), _mm_packus_epi16(out_r[0], out_r[1]));
+        _mm_storeu_si128((__m128i *)(g + x), _mm_packus_epi16(out_g[0], out_g[1]));
+        _mm_storeu_si128((__m128i *)(b + x), _mm_packus_epi16(out_b[0], out_b[1]));
+    }
+
+    if (x < width) {
+        ycc_to_planes_scalar(ycc + x * 3, width - x, gray + x, r + x, g + x, b + x);
+    }
+}
+
+__attribute__((target("avx2"))) static inline __m128i pack_u8_avx2(__m256i value) {
+    __m256i packed = _mm256_packus_epi16(value, value);
+    return _mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, 0x08));
+}
+
+__attribute__((target("avx2"))) static void ycc_to_planes_avx2(const uint8_t *ycc,
+                                                                int width,
+                                                                uint8_t *gray,
+                                                                uint8_t *r,
+                                                                uint8_t *g,
+                                                                uint8_t *b) {
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i cr_r = _mm256_set1_epi16(COEF_CR_R);
+    const __m256i cb_g = _mm256_set1_epi16(COEF_CB_G);
+    const __m256i cr_g = _mm256_set1_epi16(COEF_CR_G);
+    const __m256i cb_b = _mm256_set1_epi16(COEF_CB_B);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t *src = ycc + x * 3;
+        __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(src + 32));
+        __m128i y8 = deinterleave3(v0, v1, v2, shuffle_y);
+        __m128i cb8 = deinterleave3(v0, v1, v2, shuffle_cb);
+        __m128i cr8 = deinterleave3(v0, v1, v2, shuffle_cr);
+        _mm_storeu_si128((__m128i *)(gray + x), y8);
+
+        __m256i y16 = _mm256_cvtepu8_epi16(y8);
+        __m256i cb16 = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_cvtepu8_epi16(cb8), bias), 7);
+        __m256i cr16 = _mm256_slli_epi16(_mm256_sub_epi16(_mm256_cvtepu8_epi16(cr8), bias), 7);
+
+        __m256i out_r = _mm256_add_epi16(y16, _mm256_mulhrs_epi16(cr16, cr_r));
+        __m256i out_g = _mm256_sub_epi16(_mm256_sub_epi16(y16, _mm256_mulhrs_epi16(cb16, cb_g)),
+                                         _mm256_mulhrs_epi16(cr16, cr_g));
+        __m256i out_b = _mm256_add_epi16(y16, _mm256_mulhrs_epi16(cb16, cb_b));
+
+        _mm_storeu_si128((__m128i *)(r + x), pack_u8_avx2(out_r));
+        _mm_storeu_si128((__m128i *)(g + x), pack_u8_avx2(out_g));
+        _mm_storeu_si128((__m128i *)(b + x), pack_u8_avx2(out_b));
+    }
+
+    if (x < width) {
+        ycc_to_planes_scalar(ycc + x * 3, width - x, gray + x, r + x, g + x, b + x);
+    }
+}
+#endif
+
+void image_ycc_to_planes(const uint8_t *ycc,
+                         int width,
+                         uint8_t *gray,
+                         uint8_t *r,
+                         uint8_t *g,
+                         uint8_t *b) {
+#if IMAGE_HAVE_X86
+    switch (image_kernel_level()) {
+    case IMAGE_KERNEL_AVX2:
+        ycc_to_planes_avx2(ycc, width, gray, r, g, b);
+        return;
+    case IMAGE_KERNEL_SSSE3:
+        ycc_to_planes_ssse3(ycc, width, gray, r, g, b);
+        return;
+    default:
+        break;
+    }
+#endif
+    ycc_to_planes_scalar(ycc, width, gray, r, g, b);
+}
+
+static void blend_rows_scalar(const int16_t *row0,
+                              const int16_t *row1,
+                              int weight,
+                              uint8_t *dst,
+                              int width) {
+    for (int x = 0; x < width; x++) {
+        int diff = row1[x] - row0[x];
+        int value = row0[x] + ((diff * 64 * weight * 2 + (1 << 14)) >> 15);
+        dst[x] = clamp_u8(value);
+    }
+}
+
+#if IMAGE_HAVE_X86
+__attribute__((target("ssse3"))) static void blend_rows_ssse3(const int16_t *row0,
+                                                               const int16_t *row1,
+                                                               int weight,
+                                                               uint8_t *dst,
+                                                               int width) {
+    const __m128i w = _mm_set1_epi16((int16_t)(weight * 2));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + x));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + x + 8));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + x));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + x + 8));
+        __m128i d0 = _mm_slli_epi16(_mm_sub_epi16(b0, a0), 6);
+        __m128i d1 = _mm_slli_epi16(_mm_sub_epi16(b1, a1), 6);
+        __m128i v0 = _mm_add_epi16(a0, _mm_mulhrs_epi16(d0, w));
+        __m128i v1 = _mm_add_epi16(a1, _mm_mulhrs_epi16(d1, w));
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(v0, v1));
+    }
+    if (x < width) {
+        blend_rows_scalar(row0 + x, row1 + x, weight, dst + x, width - x);
+    }
+}
+
+__attribute__((target("avx2"))) static void blend_rows_avx2(const int16_t *row0,
+                                                             const int16_t *row1,
+                                                             int weight,
+                                                             uint8_t *dst,
+                                                             int width) {
+    const __m256i w = _mm256_set1_epi16((int16_t)(weight * 2));
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(row0 + x));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(row0 + x + 16));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(row1 + x));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(row1 + x + 16));
+        __m256i d0 = _mm256_slli_epi16(_mm256_sub_epi16(b0, a0), 6);
+        __m256i d1 = _mm256_slli_epi16(_mm256_sub_epi16(b1, a1), 6);
+        __m256i v0 = _mm256_add_epi16(a0, _mm256_mulhrs_epi16(d0, w));
+        __m256i v1 = _mm256_add_epi16(a1, _mm256_mulhrs_epi16(d1, w));
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), 0xD8);
+        _mm256_storeu_si256((__m256i *)(dst + x), packed);
+    }
+    if (x < width) {
+        blend_rows_scalar(row0 + x, row1 + x, weight, dst + x, width - x);
+    }
+}
+#endif
+
+static void blend_rows(const int16_t *row0, const int16_t *row1, int weight, uint8_t *dst, int width) {
+#if IMAGE_HAVE_X86
+    switch (image_kernel_level()) {
+    case IMAGE_KERNEL_AVX2:
+        blend_rows_avx2(row0, row1, weight, dst, width);
+        return;
+    case IMAGE_KERNEL_SSSE3:
+        blend_rows_ssse3(row0, row1, weight, dst, width);
+        return;
+    default:
+        break;
+    }
+#endif
+    blend_rows_scalar(row0, row1, weight, dst, width);
+}
+
+static void compute_taps(int src_size, int dst_size, int *index, int *weight) {
+    for (int i = 0; i < dst_size; i++) {
+        long pos = ((long)(2 * i + 1) * src_size * 256) / (2L * dst_size) - 128;
+        if (pos < 0) {
+            pos = 0;
+        }
+        int i0 = (int)(pos >> 8);
+        int w = (int)(pos & 255);
+        if (i0 >= src_size - 1) {
+            i0 = src_size - 1;
+            w = 0;
+        }
+        index[i] = i0;
+        weight[i] = w;
+    }
+}
+
+static void resample_row(const uint8_t *src,
+                         int src_width,
+                         const int *x_index,
+                         const int *x_weight,
+                         int16_t *out,
+                         int dst_width) {
+    for (int x = 0; x < dst_width; x++) {
+        int x0 = x_index[x];
+        int x1 = x0 + 1 < src_width ? x0 + 1 : x0;
+        int w = x_weight[x];
+        out[x] = (int16_t)((src[x0] * (256 - w) + src[x1] * w + 128) >> 8);
+    }
+}
+
+void image_resize_plane(const uint8_t *src,
+                        int src_width,
+                        int src_height,
+                        size_t src_stride,
+                        uint8_t *dst,
+                        int dst_width,
+                        int dst_height,
+                        size_t dst_stride) {
+    if (src_width <= 0 || src_height <= 0 || dst_width <= 0 || dst_height <= 0) {
+        return;
+    }
+
+    if (src_width == dst_width && src_height == dst_height) {
+        for (int y = 0; y < dst_height; y++) {
+            memcpy(dst + (size_t)y * dst_stride, src + (size_t)y * src_stride, (size_t)dst_width);
+        }
+        return;
+    }
+
+    int *taps = (int *)malloc(sizeof(int) * (size_t)(dst_width * 2 + dst_height * 2));
+    int16_t *rows = (int16_t *)malloc(sizeof(int16_t) * (size_t)dst_width * 2);
+    if (taps == NULL || rows == NULL) {
+        free(taps);
+        free(rows);
+        return;
+    }
+    int *x_index = taps;
+    int *x_weight = taps + dst_width;
+    int *y_index = taps + dst_width * 2;
+    int *y_weight = y_index + dst_height;
+    compute_taps(src_width, dst_width, x_index, x_weight);
+    compute_taps(src_height, dst_height, y_index, y_weight);
+
+    int16_t *row_buf[2] = {rows, rows + dst_width};
+    int cached_row[2] = {-1, -1};
+
+    for (int y = 0; y < dst_height; y++) {
+        int y0 = y_index[y];
+        int y1 = y0 + 1 < src_height ? y0 + 1 : y0;
+
+        if (cached_row[0] != y0) {
+            if (cached_row[1] == y0) {
+                int16_t *tmp = row_buf[0];
+                row_buf[0] = row_buf[1];
+                row_buf[1] = tmp;
+                cached_row[0] = y0;
+                cached_row[1] = -1;
+            } else {
+                resample_row(src + (size_t)y0 * src_stride, src_width, x_index, x_weight,
+                             row_buf[0], dst_width);
+                cached_row[0] = y0;
+            }
+        }
+        if (cached_row[1] != y1) {
+            resample_row(src + (size_t)y1 * src_stride, src_width, x_index, x_weight, row_buf[1],
+                         dst_width);
+            cached_row[1] = y1;
+        }
+
+        blend_rows(row_buf[0], row_buf[1], y_weight[y], dst + (size_t)y * dst_stride, dst_width);
+    }
+
+    free(taps);
+    free(rows);
+}
+
+void image_fit_size(int src_width,
+                    int src_height,
+                    int max_width,
+                    int max_height,
+                    int *out_width,
+                    int *out_height) {
+    if (src_width <= max_width && src_height <= max_height) {
+        *out_width = src_width;
+        *out_height = src_height;
+        return;
+    }
+
+    long scaled_height = (long)src_height * max_width / src_width;
+    if (scaled_height <= max_height) {
+        *out_width = max_width;
+        *out_height = scaled_height > 0 ? (int)scaled_height : 1;
+        return;
+    }
+
+    long scaled_width = (long)src_width * max_height / src_height;
+    *out_width = scaled_width > 0 ? (int)scaled_width : 1;
+    *out_height = max_height;
+}
@@ -0,0 +1,61 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define IMAGE_ALIGNMENT 64
+
+typedef enum {
+    IMAGE_KERNEL_SCALAR = 0,
+    IMAGE_KERNEL_SSSE3 = 1,
+    IMAGE_KERNEL_AVX2 = 2,
+} ImageKernelLevel;
+
+typedef struct ImageBuffer {
+    int width;
+    int height;
+    size_t stride;
+    int capacity_width;
+    int capacity_height;
+    uint8_t *gray;
+    uint8_t *r;
+    uint8_t *g;
+    uint8_t *b;
+    struct ImageBuffer *next_free;
+} ImageBuffer;
+
+bool image_pool_init(size_t count, int max_width, int max_height);
+void image_pool_shutdown(void);
+ImageBuffer *image_pool_acquire(void);
+void image_pool_release(ImageBuffer *image);
+size_t image_pool_available(void);
+
+ImageKernelLevel image_kernel_level(void);
+ImageKernelLevel image_set_kernel_level(ImageKernelLevel level);
+
+void image_ycc_to_planes(const uint8_t *ycc,
+                         int width,
+                         uint8_t *gray,
+                         uint8_t *r,
+                         uint8_t *g,
+                         uint8_t *b);
+
+void image_resize_plane(const uint8_t *src,
+                        int src_width,
+                        int src_height,
+                        size_t src_stride,
+                        uint8_t *dst,
+                        int dst_width,
+                        int dst_height,
+                        size_t dst_stride);
+
+void image_fit_size(int src_width,
+                    int src_height,
+                    int max_width,
+                    int max_height,
+                    int *out_width,
+                    int *out_height);
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "jpeg_decode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+#endif
+
+#define MAX_DECODE_DIMENSION 8192
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+#ifdef HAVE_LIBJPEG
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf jump;
+} DecodeErrorManager;
+
+static void on_decode_error(j_common_ptr cinfo) {
+    DecodeErrorManager *err = (DecodeErrorManager *)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static void on_decode_message(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+static int choose_scale_denom(int src_width, int src_height, int want_width, int want_height) {
+    static const int denoms[] = {8, 4, 2};
+    for (size_t i = 0; i < sizeof(denoms) / sizeof(denoms[0]); i++) {
+        int denom = denoms[i];
+        int scaled_width = (src_width + denom - 1) / denom;
+        int scaled_height = (src_height + denom - 1) / denom;
+        if (scaled_width >= want_width && scaled_height >= want_height) {
+            return denom;
+        }
+    }
+    return 1;
+}
+
+static bool decode_scaled(struct jpeg_decompress_struct *cinfo,
+                          DecodeErrorManager *err,
+                          int target_width,
+                          int target_height,
+                          ImageBuffer *out,
+                          JpegDecodeStats *stats,
+                          uint8_t **scratch_out) {
+    if (setjmp(err->jump) != 0) {
+        return false;
+    }
+
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK) {
+        return false;
+    }
+
+    int src_width = (int)cinfo->image_width;
+    int src_height = (int)cinfo->image_height;
+    if (src_width <= 0 || src_height <= 0 || src_width > MAX_DECODE_DIMENSION ||
+        src_height > MAX_DECODE_DIMENSION) {
+        return false;
+    }
+
+    int max_width = target_width < out->capacity_width ? target_width : out->capacity_width;
+    int max_height = target_height < out->capacity_height ? target_height : out->capacity_height;
+    int out_width = 0;
+    int out_height = 0;
+    image_fit_size(src_width, src_height, max_width, max_height, &out_width, &out_height);
+
+    bool grayscale = cinfo->num_components == 1;
+    cinfo->out_color_space = grayscale ? JCS_GRAYSCALE : JCS_YCbCr;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = (unsigned int)choose_scale_denom(src_width, src_height, out_width,
+                                                          out_height);
+    cinfo->dct_method = JDCT_ISLOW;
+    cinfo->do_fancy_upsampling = FALSE;
+
+    jpeg_start_decompress(cinfo);
+
+    int width = (int)cinfo->output_width;
+    int height = (int)cinfo->output_height;
+    size_t plane_size = (size_t)width * (size_t)height;
+    size_t row_bytes = (size_t)width * (size_t)cinfo->output_components;
+    uint8_t *scratch = (uint8_t *)malloc(plane_size * 4 + row_bytes + 64);
+    if (scratch == NULL) {
+        return false;
+    }
+    *scratch_out = scratch;
+
+    uint8_t *planes[4] = {scratch, scratch + plane_size, scratch + plane_size * 2,
+                          scratch + plane_size * 3};
+    uint8_t *row = scratch + plane_size * 4;
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+        size_t y = cinfo->output_scanline;
+        JSAMPROW rows[1] = {row};
+        if (jpeg_read_scanlines(cinfo, rows, 1) != 1) {
+            return false;
+        }
+        size_t offset = y * (size_t)width;
+        if (grayscale) {
+            for (int p = 0; p < 4; p++) {
+                memcpy(planes[p] + offset, row, (size_t)width);
+            }
+        } else {
+            image_ycc_to_planes(row, width, planes[0] + offset, planes[1] + offset,
+                                planes[2] + offset, planes[3] + offset);
+        }
+    }
+    jpeg_finish_decompress(cinfo);
+
+    uint8_t *dst_planes[4] = {out->gray, out->r, out->g, out->b};
+    for (int p = 0; p < 4; p++) {
+        image_resize_plane(planes[p], width, height, (size_t)width, dst_planes[p], out_width,
+                           out_height, out->stride);
+    }
+
+    out->width = out_width;
+    out->height = out_height;
+    if (stats != NULL) {
+        stats->source_width = src_width;
+        stats->source_height = src_height;
+        stats->scaled_width = width;
+        stats->scaled_height = height;
+        stats->scale_denom = (int)cinfo->scale_denom;
+    }
+    return true;
+}
+#endif
+
+bool jpeg_decode_available(void) {
+#ifdef HAVE_LIBJPEG
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef HAVE_LIBJPEG
+static bool read_size(struct jpeg_decompress_struct *cinfo,
+                      DecodeErrorManager *err,
+                      int *width,
+                      int *height) {
+    if (setjmp(err->jump) != 0) {
+        return false;
+    }
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK) {
+        return false;
+    }
+    *width = (int)cinfo->image_width;
+    *height = (int)cinfo->image_height;
+    return *width > 0 && *height > 0 && *width <= MAX_DECODE_DIMENSION &&
+           *height <= MAX_DECODE_DIMENSION;
+}
+#endif
+
+bool jpeg_decode_size(const unsigned char *data, size_t length, int *width, int *height) {
+    if (data == NULL || length < 4 || width == NULL || height == NULL) {
+        return false;
+    }
+    if (data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+#ifdef HAVE_LIBJPEG
+    struct jpeg_decompress_struct cinfo;
+    DecodeErrorManager err;
+    cinfo.err = jpeg_std_error(&err.base);
+    err.base.error_exit = on_decode_error;
+    err.base.output_message = on_decode_message;
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, (unsigned long)length);
+    bool ok = read_size(&cinfo, &err, width, height);
+    jpeg_destroy_decompress(&cinfo);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool jpeg_decode_frame(const unsigned char *data,
+                       size_t length,
+                       int target_width,
+                       int target_height,
+                       ImageBuffer *out,
+                       JpegDecodeStats *stats) {
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(*stats));
+    }
+    if (data == NULL || length < 4 || out == NULL || target_width <= 0 || target_height <= 0) {
+        return false;
+    }
+    if (data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+#ifdef HAVE_LIBJPEG
+    uint64_t start = monotonic_us();
+
+    struct jpeg_decompress_struct cinfo;
+    DecodeErrorManager err;
+    cinfo.err = jpeg_std_error(&err.base);
+    err.base.error_exit = on_decode_error;
+    err.base.output_message = on_decode_message;
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, (unsigned long)length);
+
+    uint8_t *scratch = NULL;
+    bool ok = decode_scaled(&cinfo, &err, target_width, target_height, out, stats, &scratch);
+    jpeg_destroy_decompress(&cinfo);
+    free(scratch);
+
+    if (ok && stats != NULL) {
+        stats->decode_us = monotonic_us() - start;
+    }
+    return ok;
+#else
+    (void)target_width;
+    (void)target_height;
+    return false;
+#endif
+}
@@ -0,0 +1,29 @@
+#ifndef JPEG_DECODE_H
+#define JPEG_DECODE_H
+
+#include "image.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    int source_width;
+    int source_height;
+    int scaled_width;
+    int scaled_height;
+    int scale_denom;
+    uint64_t decode_us;
+} JpegDecodeStats;
+
+bool jpeg_decode_available(void);
+/* Reads only the JPEG header to report the full-size image dimensions. */
+bool jpeg_decode_size(const unsigned char *data, size_t length, int *width, int *height);
+bool jpeg_decode_frame(const unsigned char *data,
+                       size_t length,
+                       int target_width,
+                       int target_height,
+                       ImageBuffer *out,
+                       JpegDecodeStats *stats);
+
+#endif
@@ -0,0 +1,111 @@
+#include "jpeg_encode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+#endif
+
+#ifdef HAVE_LIBJPEG
+typedef struct {
+    struct jpeg_error_mgr base;
+    jmp_buf jump;
+} EncodeErrorManager;
+
+static void on_encode_error(j_common_ptr cinfo) {
+    EncodeErrorManager *err = (EncodeErrorManager *)cinfo->err;
+    longjmp(err->jump, 1);
+}
+
+static void on_encode_message(j_common_ptr cinfo) {
+    (void)cinfo;
+}
+
+static bool encode_planes(struct jpeg_compress_struct *cinfo,
+                          EncodeErrorManager *err,
+                          const ImageBuffer *image,
+                          int quality,
+                          uint8_t *row) {
+    if (setjmp(err->jump) != 0) {
+        return false;
+    }
+
+    cinfo->image_width = (JDIMENSION)image->width;
+    cinfo->image_height = (JDIMENSION)image->height;
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_RGB;
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, quality, TRUE);
+    cinfo->dct_method = JDCT_ISLOW;
+    jpeg_start_compress(cinfo, TRUE);
+
+    while (cinfo->next_scanline < cinfo->image_height) {
+        size_t offset = (size_t)cinfo->next_scanline * image->stride;
+        for (int x = 0; x < image->width; x++) {
+            row[x * 3] = image->r[offset + (size_t)x];
+            row[x * 3 + 1] = image->g[offset + (size_t)x];
+            row[x * 3 + 2] = image->b[offset + (size_t)x];
+        }
+        JSAMPROW rows[1] = {row};
+        jpeg_write_scanlines(cinfo, rows, 1);
+    }
+    jpeg_finish_compress(cinfo);
+    return true;
+}
+#endif
+
+bool jpeg_encode_available(void) {
+#ifdef HAVE_LIBJPEG
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool jpeg_encode_image(const ImageBuffer *image,
+                       int quality,
+                       unsigned char **out,
+                       size_t *out_length) {
+    if (out == NULL || out_length == NULL) {
+        return false;
+    }
+    *out = NULL;
+    *out_length = 0;
+    if (image == NULL || image->width <= 0 || image->height <= 0) {
+        return false;
+    }
+
+#ifdef HAVE_LIBJPEG
+    uint8_t *row = (uint8_t *)malloc((size_t)image->width * 3);
+    if (row == NULL) {
+        return false;
+    }
+
+    struct jpeg_compress_struct cinfo;
+    EncodeErrorManager err;
+    cinfo.err = jpeg_std_error(&err.base);
+    err.base.error_exit = on_encode_error;
+    err.base.output_message = on_encode_message;
+    jpeg_create_compress(&cinfo);
+
+    unsigned char *buffer = NULL;
+    unsigned long length = 0;
+    jpeg_mem_dest(&cinfo, &buffer, &length);
+    bool ok = encode_planes(&cinfo, &err, image, quality, row);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+
+    if (!ok) {
+        free(buffer);
+        return false;
+    }
+    *out = buffer;
+    *out_length = (size_t)length;
+    return true;
+#else
+    (void)quality;
+    return false;
+#endif
+}
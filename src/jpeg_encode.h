@@ -0,0 +1,17 @@
+#ifndef JPEG_ENCODE_H
+#define JPEG_ENCODE_H
+
+#include "image.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+bool jpeg_encode_available(void);
+
+/* Encodes the R/G/B planes of `image` as a baseline JPEG; `*out` is malloc'd. */
+bool jpeg_encode_image(const ImageBuffer *image,
+                       int quality,
+                       unsigned char **out,
+                       size_t *out_length);
+
+#endif
@@ -0,0 +1,316 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "listener.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+
+static bool parse_port(const char *text, int *port) {
+    char *end = NULL;
+    errno = 0;
+    long value = strtol(text, &end, 10);
+    if (errno != 0 || end == text || *end != '\0' || value < 0 || value > 65535) {
+        return false;
+    }
+    *port = (int)value;
+    return true;
+}
+
+/* A bare port listens on every IPv4 address, as `web_server 8080` always has. */
+bool listener_spec_parse(const char *text, ListenerSpec *out) {
+    memset(out, 0, sizeof(*out));
+    if (strncmp(text, "unix:", 5) == 0) {
+        size_t length = strlen(text + 5);
+        if (length == 0 || length >= sizeof(out->address)) {
+            return false;
+        }
+        out->family = LISTENER_UNIX;
+        memcpy(out->address, text + 5, length + 1);
+        return true;
+    }
+
+    const char *port = NULL;
+    size_t host_length = 0;
+    if (text[0] == '[') {
+        const char *close = strchr(text, ']');
+        if (close == NULL || close[1] != ':') {
+            return false;
+        }
+        out->family = LISTENER_TCP6;
+        text++;
+        host_length = (size_t)(close - text);
+        port = close + 2;
+    } else {
+        const char *colon = strrchr(text, ':');
+        out->family = LISTENER_TCP4;
+        host_length = colon != NULL ? (size_t)(colon - text) : 0;
+        port = colon != NULL ? colon + 1 : text;
+    }
+    if (host_length >= sizeof(out->address) || !parse_port(port, &out->port)) {
+        return false;
+    }
+    memcpy(out->address, text, host_length);
+    out->address[host_length] = '\0';
+    if (host_length == 0) {
+        snprintf(out->address, sizeof(out->address), "%s",
+                 out->family == LISTENER_TCP6 ? "::" : "0.0.0.0");
+    }
+
+    unsigned char probe[sizeof(struct in6_addr)];
+    return inet_pton(out->family == LISTENER_TCP6 ? AF_INET6 : AF_INET, out->address, probe) == 1;
+}
+
+size_t listener_spec_format(const ListenerSpec *spec, char *out, size_t capacity) {
+    int n;
+    switch (spec->family) {
+    case LISTENER_UNIX:
+        n = snprintf(out, capacity, "unix:%s", spec->address);
+        break;
+    case LISTENER_TCP6:
+        n = snprintf(out, capacity, "[%s]:%d", spec->address, spec->port);
+        break;
+    default:
+        n = snprintf(out, capacity, "%s:%d", spec->address, spec->port);
+        break;
+    }
+    return n > 0 && (size_t)n < capacity ? (size_t)n : 0;
+}
+
+bool listener_spec_equal(const ListenerSpec *a, const ListenerSpec *b) {
+    return a->family == b->family && a->port == b->port && strcmp(a->address, b->address) == 0;
+}
+
+/* Fills `addr` for `spec`; returns its length, or 0 if the spec is unusable. */
+static socklen_t spec_address(const ListenerSpec *spec, struct sockaddr_storage *addr) {
+    memset(addr, 0, sizeof(*addr));
+    if (spec->family == LISTENER_UNIX) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, spec->address, sizeof(un->sun_path));
+        return (socklen_t)sizeof(*un);
+    }
+    if (spec->family == LISTENER_TCP6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons((uint16_t)spec->port);
+        return inet_pton(AF_INET6, spec->address, &in6->sin6_addr) == 1
+                   ? (socklen_t)sizeof(*in6)
+                   : 0;
+    }
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)spec->port);
+    return inet_pton(AF_INET, spec->address, &in->sin_addr) == 1 ? (socklen_t)sizeof(*in) : 0;
+}
+
+static bool set_int(int fd, int level, int name, int value, const char *label) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+        fprintf(stderr, "setsockopt(%s=%d): %s\n", label, value, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static bool set_timeout(int fd, int name, unsigned timeout_ms, const char *label) {
+    struct timeval tv = {(time_t)(timeout_ms / 1000u), (suseconds_t)(timeout_ms % 1000u) * 1000};
+    if (setsockopt(fd, SOL_SOCKET, name, &tv, sizeof(tv)) != 0) {
+        fprintf(stderr, "setsockopt(%s=%u ms): %s\n", label, timeout_ms, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/* Returns false if any option was refused (busy polling needs CAP_NET_ADMIN); the rest are set. */
+static bool apply_options(int fd, const ListenerSpec *spec, const SocketOptions *options) {
+    bool ok = true;
+    if (options->send_buffer > 0) {
+        ok &= set_int(fd, SOL_SOCKET, SO_SNDBUF, options->send_buffer, "SO_SNDBUF");
+    }
+    if (options->receive_buffer > 0) {
+        ok &= set_int(fd, SOL_SOCKET, SO_RCVBUF, options->receive_buffer, "SO_RCVBUF");
+    }
+    ok &= set_timeout(fd, SO_RCVTIMEO, options->read_timeout_ms, "SO_RCVTIMEO");
+    ok &= set_timeout(fd, SO_SNDTIMEO, options->write_timeout_ms, "SO_SNDTIMEO");
+    if (spec->family != LISTENER_UNIX) {
+        ok &= set_int(fd, IPPROTO_TCP, TCP_NODELAY, options->tcp_nodelay ? 1 : 0, "TCP_NODELAY");
+        ok &= set_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, options->defer_accept_s,
+                      "TCP_DEFER_ACCEPT");
+        if (options->busy_poll_us > 0) {
+            ok &= set_int(fd, SOL_SOCKET, SO_BUSY_POLL, options->busy_poll_us, "SO_BUSY_POLL");
+        }
+    }
+    return ok;
+}
+
+/*
+ * Applies `options` to a listening socket that is already serving:
+ * connections accepted from then on get the new values, and calling listen()
+ * again resizes the backlog.
+ */
+bool listener_configure(int fd, const ListenerSpec *spec, const SocketOptions *options) {
+    bool ok = apply_options(fd, spec, options);
+    if (listen(fd, options->backlog) != 0) {
+        perror("listen");
+        return false;
+    }
+    return ok;
+}
+
+/* A stale socket file from a previous run would make bind() fail; anything else is kept. */
+static void remove_stale_socket(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+}
+
+/*
+ * Creates, binds and starts listening on a non-blocking socket for `spec`.
+ * IPv6 listeners are IPv6-only so `0.0.0.0:p` and `[::]:p` can both be
+ * configured. Returns the descriptor, or -1 after printing why.
+ */
+int listener_open(const ListenerSpec *spec, const SocketOptions *options) {
+    struct sockaddr_storage addr;
+    socklen_t addr_length = spec_address(spec, &addr);
+    if (addr_length == 0) {
+        return -1;
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    bool ok = true;
+    if (spec->family == LISTENER_UNIX) {
+        remove_stale_socket(spec->address);
+    } else {
+        ok = set_int(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR") &&
+             (spec->family != LISTENER_TCP6 ||
+              set_int(fd, IPPROTO_IPV6, IPV6_V6ONLY, 1, "IPV6_V6ONLY"));
+    }
+    if (ok && bind(fd, (struct sockaddr *)&addr, addr_length) != 0) {
+        char name[160];
+        listener_spec_format(spec, name, sizeof(name));
+        fprintf(stderr, "bind %s: %s\n", name, strerror(errno));
+        ok = false;
+    }
+    if (ok) {
+        apply_options(fd, spec, options);
+        if (listen(fd, options->backlog) != 0) {
+            perror("listen");
+            ok = false;
+        }
+    }
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Connects a blocking client socket to `spec`, for talking to another
+ * server. `timeout_ms` bounds the connect and each later send; reads time
+ * out after `read_timeout_ms` so a caller can look up between them.
+ * Returns the descriptor, or -1 (quietly: peers come and go).
+ */
+int listener_connect(const ListenerSpec *spec, unsigned timeout_ms, unsigned read_timeout_ms) {
+    struct sockaddr_storage addr;
+    socklen_t addr_length = spec_address(spec, &addr);
+    if (addr_length == 0) {
+        return -1;
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    /* Linux applies the send timeout to connect() as well. */
+    bool ok = set_timeout(fd, SO_SNDTIMEO, timeout_ms, "SO_SNDTIMEO") &&
+              set_timeout(fd, SO_RCVTIMEO, read_timeout_ms, "SO_RCVTIMEO") &&
+              connect(fd, (struct sockaddr *)&addr, addr_length) == 0;
+    if (ok && spec->family != LISTENER_UNIX) {
+        set_int(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (!ok) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Starts a non-blocking connect to `spec`, for callers that wait in poll().
+ * Sets `*connected` when the connection is already up; otherwise it is in
+ * progress and is done once the socket polls writable (SO_ERROR says how).
+ * Returns the descriptor, or -1 when the connect failed at once.
+ */
+int listener_connect_start(const ListenerSpec *spec, bool *connected) {
+    struct sockaddr_storage addr;
+    socklen_t addr_length = spec_address(spec, &addr);
+    if (addr_length == 0) {
+        return -1;
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (spec->family != LISTENER_UNIX) {
+        set_int(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    *connected = connect(fd, (struct sockaddr *)&addr, addr_length) == 0;
+    if (!*connected && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* True if `fd` is a socket bound where `spec` asks; a spec port of 0 matches any port. */
+bool listener_matches(int fd, const ListenerSpec *spec) {
+    struct sockaddr_storage wanted;
+    struct sockaddr_storage bound;
+    socklen_t bound_length = sizeof(bound);
+    if (spec_address(spec, &wanted) == 0 ||
+        getsockname(fd, (struct sockaddr *)&bound, &bound_length) != 0 ||
+        bound.ss_family != wanted.ss_family) {
+        return false;
+    }
+    if (wanted.ss_family == AF_UNIX) {
+        return strcmp(((struct sockaddr_un *)&bound)->sun_path,
+                      ((struct sockaddr_un *)&wanted)->sun_path) == 0;
+    }
+    if (wanted.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)&bound;
+        const struct sockaddr_in6 *b = (const struct sockaddr_in6 *)&wanted;
+        return memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0 &&
+               (spec->port == 0 || a->sin6_port == b->sin6_port);
+    }
+    const struct sockaddr_in *a = (const struct sockaddr_in *)&bound;
+    const struct sockaddr_in *b = (const struct sockaddr_in *)&wanted;
+    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
+           (spec->port == 0 || a->sin_port == b->sin_port);
+}
+
+void listener_remove_path(const ListenerSpec *spec) {
+    if (spec->family == LISTENER_UNIX) {
+        remove_stale_socket(spec->address);
+    }
+}
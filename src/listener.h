@@ -0,0 +1,48 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+
+typedef enum {
+    LISTENER_TCP4,
+    LISTENER_TCP6,
+    LISTENER_UNIX,
+} ListenerFamily;
+
+/* `0.0.0.0:8080`, `[::1]:8080` or `unix:/run/web_server.sock`; addresses are numeric. */
+typedef struct {
+    ListenerFamily family;
+    char address[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int port;
+} ListenerSpec;
+
+/*
+ * Set on the listening socket, which accepted connections inherit, so they
+ * cost nothing per request and a reload only has to touch the listeners.
+ * Zero leaves the kernel default; TCP options are skipped for Unix sockets.
+ */
+typedef struct {
+    int backlog;
+    bool tcp_nodelay;
+    int defer_accept_s;
+    int send_buffer;
+    int receive_buffer;
+    int busy_poll_us;
+    unsigned read_timeout_ms;
+    unsigned write_timeout_ms;
+} SocketOptions;
+
+bool listener_spec_parse(const char *text, ListenerSpec *out);
+size_t listener_spec_format(const ListenerSpec *spec, char *out, size_t capacity);
+bool listener_spec_equal(const ListenerSpec *a, const ListenerSpec *b);
+
+int listener_open(const ListenerSpec *spec, const SocketOptions *options);
+int listener_connect(const ListenerSpec *spec, unsigned timeout_ms, unsigned read_timeout_ms);
+int listener_connect_start(const ListenerSpec *spec, bool *connected);
+bool listener_configure(int fd, const ListenerSpec *spec, const SocketOptions *options);
+bool listener_matches(int fd, const ListenerSpec *spec);
+void listener_remove_path(const ListenerSpec *spec);
+
+#endif
@@ -2,132 +2,614 @@
 #define _POSIX_C_SOURCE 200809L
 #endif
 
+#include "access_log.h"
+#include "binary_ingest.h"
+#include "cluster.h"
+#include "embedding.h"
+#include "event_feed.h"
+#include "face_detect.h"
+#include "frame_store.h"
+#include "frame_variants.h"
+#include "gallery_shard.h"
+#include "gallery_store.h"
+#include "handoff.h"
 #include "http.h"
+#include "image.h"
+#include "listener.h"
+#include "model_warmup.h"
+#include "perf_counters.h"
+#include "pipeline.h"
+#include "recognize.h"
 #include "router.h"
+#include "runtime_config.h"
 #include "server_config.h"
+#include "shm_ingest.h"
 #include "static_assets.h"
+#include "trace.h"
 
-#include <arpa/inet.h>
 #include <errno.h>
-#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 static volatile sig_atomic_t keep_running = 1;
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t restart_requested = 0;
 
-static void handle_sigint(int signum) {
-    (void)signum;
-    keep_running = 0;
+typedef struct {
+    ListenerSpec specs[MAX_LISTENERS];
+    int fds[MAX_LISTENERS];
+    size_t count;
+} Listeners;
+
+/* SIGINT/SIGTERM drain and exit; SIGHUP reloads the config; SIGUSR2 hands over to a new process. */
+static void handle_signal(int signum) {
+    if (signum == SIGHUP) {
+        reload_requested = 1;
+    } else if (signum == SIGUSR2) {
+        restart_requested = 1;
+    } else {
+        keep_running = 0;
+    }
+}
+
+static bool install_signal_handlers(void) {
+    static const int signals[] = {SIGINT, SIGTERM, SIGHUP, SIGUSR2};
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_signal;
+    /* No SA_RESTART: a blocked accept() or poll() must return to see the flag. */
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (sigaction(signals[i], &sa, NULL) < 0) {
+            perror("sigaction");
+            return false;
+        }
+    }
+    return true;
 }
 
-static int parse_port(int argc, char **argv) {
-    if (argc < 2) {
-        return DEFAULT_PORT;
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/* Requests handed to another thread (recognition) are logged there instead. */
+static void log_request(const HttpRequest *request, uint64_t accepted_us) {
+    int status = 0;
+    size_t bytes = 0;
+    if (http_last_response(&status, &bytes)) {
+        access_log_record(request->method, request->path, request->stream_id, status, bytes,
+                          monotonic_us() - accepted_us);
     }
+}
 
-    char *end = NULL;
-    long port = strtol(argv[1], &end, 10);
-    if (end == argv[1] || *end != '\0' || port < 1 || port > 65535) {
-        fprintf(stderr, "Invalid port: %s\n", argv[1]);
-        exit(EXIT_FAILURE);
+static void serve_connection(int client_fd, uint64_t accepted_us) {
+    trace_request_begin();
+    TRACE_START(request_start);
+    http_response_reset();
+    HttpRequest request;
+    int status_code = 400;
+    /* Batch uploads are parsed as they arrive, so their body is left to the handler. */
+    if (!read_http_request_head(client_fd, &request, &status_code) ||
+        (!router_streams_body(&request) &&
+         !read_http_request_body(client_fd, &request, &status_code))) {
+        send_error_response(client_fd, status_code);
+        free_http_request(&request);
+        close(client_fd);
+        log_request(&request, accepted_us);
+        TRACE_END("request", request_start);
+        return;
     }
 
-    return (int)port;
+    TRACE_START(handle_start);
+    PERF_START(perf_handle);
+    handle_request(client_fd, &request);
+    TRACE_END("handle", handle_start);
+    PERF_END(PERF_STAGE_HANDLE, perf_handle);
+    free_http_request(&request);
+    close(client_fd);
+    log_request(&request, accepted_us);
+    TRACE_END("request", request_start);
 }
 
-static int create_listening_socket(int port) {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        perror("socket");
-        return -1;
+/*
+ * Serves up to `limit` connections already queued on a non-blocking listener.
+ * Returns how many, or -1 if accept() failed for a reason other than an
+ * empty queue or a signal.
+ */
+static int accept_batch(int server_fd, int limit) {
+    int served = 0;
+    while (served < limit) {
+        int client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                break;
+            }
+            if (errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            return -1;
+        }
+        /* Accepted sockets do not inherit O_NONBLOCK on Linux. */
+        serve_connection(client_fd, monotonic_us());
+        served++;
     }
+    return served;
+}
 
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt");
-        close(server_fd);
-        return -1;
+/*
+ * After SIGTERM nothing hands the backlog on, so connections the kernel has
+ * already queued are answered before the listeners close instead of reset.
+ */
+static void drain_backlog(const Listeners *listeners, uint64_t deadline_us) {
+    for (size_t i = 0; i < listeners->count; i++) {
+        while (monotonic_us() < deadline_us && accept_batch(listeners->fds[i], 1) > 0) {
+        }
     }
+}
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons((uint16_t)port);
+/*
+ * Blocks until a listener, the restarting child or one of the ingests is
+ * readable, marking which in `ready` / `child_ready` / `ingest_ready` (shared
+ * memory, then binary); false when interrupted by a signal.
+ */
+static bool wait_for_connections(const Listeners *listeners,
+                                 int child_sock,
+                                 bool *ready,
+                                 bool *child_ready,
+                                 bool *ingest_ready) {
+    struct pollfd fds[MAX_LISTENERS + 3];
+    for (size_t i = 0; i < listeners->count; i++) {
+        fds[i] = (struct pollfd){listeners->fds[i], POLLIN, 0};
+    }
+    fds[listeners->count] = (struct pollfd){child_sock, POLLIN, 0};
+    fds[listeners->count + 1] = (struct pollfd){shm_ingest_fd(), POLLIN, 0};
+    fds[listeners->count + 2] = (struct pollfd){binary_ingest_fd(), POLLIN, 0};
+    if (poll(fds, listeners->count + 3, -1) < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < listeners->count; i++) {
+        ready[i] = fds[i].revents != 0;
+    }
+    *child_ready = child_sock >= 0 && fds[listeners->count].revents != 0;
+    ingest_ready[0] = fds[listeners->count + 1].revents != 0;
+    ingest_ready[1] = fds[listeners->count + 2].revents != 0;
+    return true;
+}
 
-    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        close(server_fd);
-        return -1;
+static void close_listeners(Listeners *listeners, bool remove_paths) {
+    for (size_t i = 0; i < listeners->count; i++) {
+        close(listeners->fds[i]);
+        if (remove_paths) {
+            listener_remove_path(&listeners->specs[i]);
+        }
     }
+    listeners->count = 0;
+}
 
-    if (listen(server_fd, BACKLOG) < 0) {
-        perror("listen");
-        close(server_fd);
-        return -1;
+static bool open_listeners(const RuntimeConfig *config, Listeners *listeners) {
+    listeners->count = 0;
+    for (size_t i = 0; i < config->listener_count; i++) {
+        int fd = listener_open(&config->listeners[i], &config->socket);
+        if (fd < 0) {
+            close_listeners(listeners, true);
+            return false;
+        }
+        listeners->specs[listeners->count] = config->listeners[i];
+        listeners->fds[listeners->count++] = fd;
     }
+    return true;
+}
 
-    return server_fd;
+/*
+ * The inherited socket bound to `spec` (with the new socket options), or a
+ * new one if the previous process was not listening there; -1 on failure.
+ */
+static int adopt_listener(const RuntimeConfig *config,
+                          const ListenerSpec *spec,
+                          int *inherited,
+                          size_t inherited_count) {
+    for (size_t j = 0; j < inherited_count; j++) {
+        if (inherited[j] >= 0 && listener_matches(inherited[j], spec)) {
+            int fd = inherited[j];
+            inherited[j] = -1;
+            int flags = fcntl(fd, F_GETFL, 0);
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+            listener_configure(fd, spec, &config->socket);
+            return fd;
+        }
+    }
+    return listener_open(spec, &config->socket);
+}
+
+/*
+ * After a hot restart: keeps each inherited socket this config still asks
+ * for, opens the addresses that are new, and closes the rest. False if
+ * nothing is left to listen on.
+ */
+static bool adopt_listeners(const RuntimeConfig *config,
+                            int *inherited,
+                            size_t inherited_count,
+                            Listeners *listeners) {
+    listeners->count = 0;
+    for (size_t i = 0; i < config->listener_count; i++) {
+        const ListenerSpec *spec = &config->listeners[i];
+        int fd = adopt_listener(config, spec, inherited, inherited_count);
+        if (fd >= 0) {
+            listeners->specs[listeners->count] = *spec;
+            listeners->fds[listeners->count++] = fd;
+        }
+    }
+    for (size_t j = 0; j < inherited_count; j++) {
+        if (inherited[j] >= 0) {
+            close(inherited[j]);
+        }
+    }
+    return listeners->count > 0;
+}
+
+static void print_listeners(const Listeners *listeners) {
+    for (size_t i = 0; i < listeners->count; i++) {
+        char name[160];
+        listener_spec_format(&listeners->specs[i], name, sizeof(name));
+        printf("Server listening on %s%s\n",
+               listeners->specs[i].family == LISTENER_UNIX ? "" : "http://", name);
+    }
+}
+
+static void apply_live_config(const RuntimeConfig *config, const Listeners *listeners) {
+    http_set_limits(config->max_request_bytes, config->max_header_bytes);
+    router_set_max_frame_size(config->max_frame_bytes);
+    for (size_t i = 0; i < listeners->count; i++) {
+        listener_configure(listeners->fds[i], &listeners->specs[i], &config->socket);
+    }
+    if (binary_ingest_listen_fd() >= 0) {
+        listener_configure(binary_ingest_listen_fd(), &config->ingest_listener, &config->socket);
+    }
+    if (gallery_shard_listen_fd() >= 0) {
+        listener_configure(gallery_shard_listen_fd(), &config->gallery_shard_listener,
+                           &config->socket);
+    }
+    gallery_shards_set_deadlines(config->gallery_shard_timeout_ms, config->gallery_shard_hedge_ms);
+    perf_counters_set_enabled(config->perf_counters);
+}
+
+/* SIGHUP: re-reads the config file and arguments; a bad file keeps the running config. */
+static void reload_config(RuntimeConfig *config,
+                          int argc,
+                          char **argv,
+                          const Listeners *listeners) {
+    RuntimeConfig loaded;
+    if (!runtime_config_load(&loaded, argc, argv)) {
+        fprintf(stderr, "Reload failed: keeping the current configuration\n");
+        return;
+    }
+    char skipped[512];
+    runtime_config_merge_live(config, &loaded, skipped, sizeof(skipped));
+    apply_live_config(config, listeners);
+    printf("Configuration reloaded%s\n", config->config_path[0] != '\0' ? " from file" : "");
+    if (skipped[0] != '\0') {
+        fprintf(stderr, "Not applied until restart (SIGUSR2): %s\n", skipped);
+    }
+}
+
+/* Each event subscriber holds a socket open, which the default soft limit of 1024 cannot cover. */
+static void raise_descriptor_limit(rlim_t wanted) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur >= wanted) {
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max != RLIM_INFINITY && limit.rlim_max < wanted ? limit.rlim_max
+                                                                                 : wanted;
+    if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        perror("setrlimit");
+    }
 }
 
 int main(int argc, char **argv) {
-    int port = parse_port(argc, argv);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            runtime_config_print_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+    }
+    RuntimeConfig config;
+    if (!runtime_config_load(&config, argc, argv)) {
+        fprintf(stderr, "See %s --help\n", argv[0]);
+        return EXIT_FAILURE;
+    }
 
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = handle_sigint;
-    if (sigaction(SIGINT, &sa, NULL) < 0) {
-        perror("sigaction");
+    if (!install_signal_handlers()) {
         return EXIT_FAILURE;
     }
 
-    int server_fd = create_listening_socket(port);
-    if (server_fd < 0) {
+    /* The path is resolved now: on restart it names whatever binary an upgrade put there. */
+    char exe_path[MAX_ASSET_PATH_SIZE];
+    ssize_t exe_length = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    if (exe_length <= 0) {
+        snprintf(exe_path, sizeof(exe_path), "%s", argv[0]);
+    } else {
+        exe_path[exe_length] = '\0';
+    }
+
+    /* A process started by a hot restart gets its listeners once everything below is loaded. */
+    int handoff_sock = handoff_inherited_socket();
+    Listeners listeners = {.count = 0};
+    if (handoff_sock < 0 && !open_listeners(&config, &listeners)) {
         return EXIT_FAILURE;
     }
+    http_set_limits(config.max_request_bytes, config.max_header_bytes);
+    router_set_max_frame_size(config.max_frame_bytes);
 
     if (!load_static_assets()) {
-        close(server_fd);
+        close_listeners(&listeners, true);
+        return EXIT_FAILURE;
+    }
+
+    if (!image_pool_init(config.image_pool_size, DETECTOR_INPUT_WIDTH, DETECTOR_INPUT_HEIGHT)) {
+        fprintf(stderr, "Failed to allocate image buffers\n");
+        free_static_assets();
+        close_listeners(&listeners, true);
         return EXIT_FAILURE;
     }
 
-    printf("Server listening on http://0.0.0.0:%d\n", port);
+    FaceDetector *detector = face_detector_load(FACE_CASCADE_PATH);
+    if (detector == NULL) {
+        fprintf(stderr, "Face detection disabled: no cascade at %s\n", FACE_CASCADE_PATH);
+    }
 
-    while (keep_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    EmbeddingModel *embedder = embedding_model_load(FACE_EMBEDDING_MODEL_PATH);
+    if (embedder == NULL) {
+        fprintf(stderr, "Face embeddings disabled: no model at %s\n", FACE_EMBEDDING_MODEL_PATH);
+    } else if (embedding_model_mapped_bytes(embedder) > 0) {
+        printf("Embedding model: %zu KiB mapped from %s%s\n",
+               embedding_model_mapped_bytes(embedder) / 1024, FACE_EMBEDDING_MODEL_PATH,
+               config.model_prewarm ? ", prewarming" : "");
+    }
+    model_warmup_start(embedder, config.model_prewarm);
 
-        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0) {
-            if (errno == EINTR) {
-                continue;
+    PipelineEngines engines = {detector, embedder, EMBEDDING_PRECISION_INT8};
+    if (!pipeline_start(&engines, config.pipeline_workers, config.pipeline_queue_depth)) {
+        fprintf(stderr, "Failed to start recognition pipeline\n");
+        model_warmup_wait();
+        embedding_model_free(embedder);
+        face_detector_free(detector);
+        image_pool_shutdown();
+        free_static_assets();
+        close_listeners(&listeners, true);
+        return EXIT_FAILURE;
+    }
+
+    size_t gallery_dim = embedder != NULL ? embedding_model_dim(embedder) : GALLERY_DEFAULT_DIM;
+    if (gallery_store_open(GALLERY_DIR, gallery_dim)) {
+        GalleryStoreStats gallery_stats;
+        gallery_store_stats(&gallery_stats);
+        printf("Gallery: %zu identities, %zu entries loaded from %s in %.3f ms (%s)\n",
+               gallery_stats.identities, gallery_stats.entries, GALLERY_DIR,
+               (double)gallery_stats.load_us / 1000.0,
+               gallery_stats.snapshot_mapped ? "mapped snapshot" : "log only");
+    } else {
+        fprintf(stderr, "Gallery disabled: cannot open %s\n", GALLERY_DIR);
+    }
+
+    if (!recognize_start(config.recognize_workers, config.recognize_max_in_flight)) {
+        fprintf(stderr, "Recognition endpoint disabled: cannot start compute pool\n");
+    }
+
+    FrameStoreParams frame_params = {FRAME_HISTORY_STREAM_BYTES, FRAME_HISTORY_MAX_FRAMES,
+                                     FRAME_RECORD_DIR, FRAME_RECORD_SEGMENT_BYTES,
+                                     FRAME_RECORD_MAX_SEGMENTS, FRAME_RECORD_INDEX_INTERVAL_MS};
+    if (handoff_sock < 0 && !frame_store_open(&frame_params)) {
+        fprintf(stderr, "Frame history disabled: cannot open %s\n", FRAME_RECORD_DIR);
+    }
+
+    raise_descriptor_limit(config.event_feed_max_subscribers + CLUSTER_RELAY_MAX_SUBSCRIBERS + 256);
+    EventFeedParams feed_params = {config.event_feed_capacity, config.event_feed_max_subscribers,
+                                   config.event_feed_heartbeat_ms, config.event_feed_stall_ms};
+    if (!event_feed_start(&feed_params)) {
+        fprintf(stderr, "Event feed disabled: cannot start subscriber thread\n");
+    }
+
+    AccessLogParams log_params = {ACCESS_LOG_PATH, ACCESS_LOG_ROTATE_BYTES, ACCESS_LOG_MAX_FILES,
+                                  ACCESS_LOG_BLOCK_BYTES, ACCESS_LOG_MAX_PENDING_BLOCKS,
+                                  ACCESS_LOG_FLUSH_MS};
+    if (ACCESS_LOG_PATH[0] != '\0' && !access_log_open(&log_params)) {
+        fprintf(stderr, "Access log disabled: cannot open %s\n", ACCESS_LOG_PATH);
+    }
+
+    int exit_code = EXIT_SUCCESS;
+    int ingest_fd = -1;
+    int shard_fd = -1;
+    if (handoff_sock >= 0) {
+        /* The previous process keeps serving until the models are resident here. */
+        model_warmup_wait();
+        int inherited[MAX_HANDOFF_SOCKETS];
+        size_t inherited_count =
+            handoff_take_over(handoff_sock, &frame_params, inherited, MAX_HANDOFF_SOCKETS);
+        if (inherited_count > 0 && config.ingest_listener_set) {
+            ingest_fd = adopt_listener(&config, &config.ingest_listener, inherited,
+                                       inherited_count);
+        }
+        if (inherited_count > 0 && config.gallery_shard_listener_set) {
+            shard_fd = adopt_listener(&config, &config.gallery_shard_listener, inherited,
+                                      inherited_count);
+        }
+        if (inherited_count == 0 ||
+            !adopt_listeners(&config, inherited, inherited_count, &listeners)) {
+            fprintf(stderr, "Restart failed: no listening socket from the previous process\n");
+            keep_running = 0;
+            exit_code = EXIT_FAILURE;
+        } else {
+            puts("Server took over from the previous process");
+        }
+    }
+    print_listeners(&listeners);
+    /* After a take-over, so frames are not published before the frame store is restored. */
+    if (keep_running && config.shm_ingest_path[0] != '\0') {
+        if (shm_ingest_open(config.shm_ingest_path, config.shm_ingest_slots,
+                            config.max_frame_bytes)) {
+            printf("Shared-memory ingest on unix:%s\n", config.shm_ingest_path);
+        } else {
+            fprintf(stderr, "Shared-memory ingest disabled: cannot listen on %s\n",
+                    config.shm_ingest_path);
+        }
+    }
+    if (keep_running && config.ingest_listener_set) {
+        if (ingest_fd < 0) {
+            ingest_fd = listener_open(&config.ingest_listener, &config.socket);
+        }
+        char name[160];
+        listener_spec_format(&config.ingest_listener, name, sizeof(name));
+        if (ingest_fd >= 0 && binary_ingest_start(ingest_fd, config.ingest_credits)) {
+            printf("Binary ingest on %s\n", name);
+        } else {
+            fprintf(stderr, "Binary ingest disabled: cannot listen on %s\n", name);
+            if (ingest_fd >= 0) {
+                close(ingest_fd);
             }
-            perror("accept");
-            break;
         }
+    } else if (ingest_fd >= 0) {
+        close(ingest_fd);
+    }
+    if (keep_running &&
+        cluster_start(config.cluster_nodes, config.cluster_node_count,
+                      config.cluster_self_set ? &config.cluster_self : NULL)) {
+        ClusterStats cluster;
+        cluster_stats(&cluster);
+        if (cluster.edge) {
+            printf("Cluster: edge of %zu origin nodes\n", cluster.nodes);
+        } else if (cluster.nodes > 0) {
+            printf("Cluster: origin node %d of %zu\n", cluster.self + 1, cluster.nodes);
+        }
+    } else if (keep_running) {
+        fprintf(stderr, "Frame relay disabled: cannot start relay thread\n");
+    }
+    if (keep_running && config.gallery_shard_listener_set) {
+        if (shard_fd < 0) {
+            shard_fd = listener_open(&config.gallery_shard_listener, &config.socket);
+        }
+        char name[160];
+        listener_spec_format(&config.gallery_shard_listener, name, sizeof(name));
+        if (shard_fd >= 0 && gallery_shard_serve_start(shard_fd)) {
+            printf("Gallery shard on %s\n", name);
+        } else {
+            fprintf(stderr, "Gallery shard disabled: cannot listen on %s\n", name);
+            if (shard_fd >= 0) {
+                close(shard_fd);
+            }
+        }
+    } else if (shard_fd >= 0) {
+        close(shard_fd);
+    }
+    gallery_shards_set_deadlines(config.gallery_shard_timeout_ms, config.gallery_shard_hedge_ms);
+    if (config.gallery_shard_count > 0 &&
+        gallery_shards_start(config.gallery_shards, config.gallery_shard_count)) {
+        printf("Gallery: searching %zu shards\n", config.gallery_shard_count);
+    }
+    perf_counters_set_enabled(config.perf_counters);
+    trace_set_thread_name("accept");
+    perf_set_thread_name("accept");
 
-        HttpRequest request;
-        int status_code = 400;
-        if (!read_http_request(client_fd, &request, &status_code)) {
-            send_error_response(client_fd, status_code);
-            free_http_request(&request);
-            close(client_fd);
+    HandoffChild child = {-1, -1};
+    bool handed_off = false;
+    while (keep_running && !handed_off) {
+        if (reload_requested) {
+            reload_requested = 0;
+            reload_config(&config, argc, argv, &listeners);
+        }
+        if (restart_requested) {
+            restart_requested = 0;
+            if (child.sock < 0 && handoff_spawn(exe_path, argv, &child)) {
+                printf("Restarting: started %s as pid %d\n", exe_path, (int)child.pid);
+            }
+        }
+        bool ready[MAX_LISTENERS];
+        bool child_ready = false;
+        bool ingest_ready[2] = {false, false};
+        if (!wait_for_connections(&listeners, child.sock, ready, &child_ready, ingest_ready)) {
             continue;
         }
-
-        handle_request(client_fd, &request);
-        free_http_request(&request);
-        close(client_fd);
+        if (ingest_ready[0]) {
+            shm_ingest_poll();
+        }
+        if (ingest_ready[1]) {
+            binary_ingest_poll();
+        }
+        if (child_ready) {
+            int handoff_fds[MAX_HANDOFF_SOCKETS];
+            memcpy(handoff_fds, listeners.fds, listeners.count * sizeof(int));
+            size_t handoff_count = listeners.count;
+            if (binary_ingest_listen_fd() >= 0) {
+                handoff_fds[handoff_count++] = binary_ingest_listen_fd();
+            }
+            if (gallery_shard_listen_fd() >= 0) {
+                handoff_fds[handoff_count++] = gallery_shard_listen_fd();
+            }
+            handed_off = handoff_serve(&child, handoff_fds, handoff_count, &frame_params);
+            if (!handed_off) {
+                fprintf(stderr, "Restart failed: pid %d did not take over\n", (int)child.pid);
+                handoff_abandon(&child);
+            }
+            continue;
+        }
+        bool failed = false;
+        for (size_t i = 0; i < listeners.count; i++) {
+            if (ready[i] && accept_batch(listeners.fds[i], ACCEPT_BATCH) < 0) {
+                failed = true;
+            }
+        }
+        if (failed) {
+            break;
+        }
     }
 
+    /* Drain: in-flight work finishes, streams close cleanly, all within the deadline. */
+    uint64_t deadline_us = monotonic_us() + (uint64_t)config.shutdown_drain_ms * 1000u;
+    if (!handed_off) {
+        drain_backlog(&listeners, deadline_us);
+    }
+    /* A handed-over Unix socket path belongs to the new process now. */
+    close_listeners(&listeners, !handed_off);
+    shm_ingest_close(!handed_off);
+    if (binary_ingest_listen_fd() >= 0) {
+        binary_ingest_stop();
+        if (!handed_off) {
+            listener_remove_path(&config.ingest_listener);
+        }
+    }
+    if (gallery_shard_listen_fd() >= 0) {
+        gallery_shard_serve_stop();
+        if (!handed_off) {
+            listener_remove_path(&config.gallery_shard_listener);
+        }
+    }
+    handoff_abandon(&child);
+    cluster_stop();
+    recognize_stop();
+    uint64_t now_us = monotonic_us();
+    event_feed_drain(now_us < deadline_us ? (unsigned)((deadline_us - now_us) / 1000u) : 0);
+    frame_store_close();
+    frame_variants_invalidate();
+    gallery_store_close();
+    pipeline_stop();
+    gallery_shards_stop();
+    model_warmup_wait();
+    embedding_model_free(embedder);
+    face_detector_free(detector);
+    image_pool_shutdown();
     free_static_assets();
-    close(server_fd);
-    puts("Server stopped.");
-    return EXIT_SUCCESS;
+    access_log_close();
+    puts(handed_off ? "Server handed over and stopped." : "Server stopped.");
+    return exit_code;
 }
@@ -0,0 +1,93 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "model_warmup.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+static const EmbeddingModel *warm_model = NULL;
+static bool warm_prewarm = false;
+static atomic_bool warm_ready = false;
+static atomic_ullong warm_us = 0;
+static pthread_t warm_thread;
+static bool warm_thread_running = false;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static void fault_in(void) {
+    uint64_t start = monotonic_us();
+    embedding_model_prewarm(warm_model);
+    atomic_store(&warm_us, monotonic_us() - start);
+    atomic_store(&warm_ready, true);
+}
+
+static void *warm_main(void *arg) {
+    (void)arg;
+    fault_in();
+    return NULL;
+}
+
+/*
+ * Marks the models loaded. A mapped model with `prewarm` is faulted in on a
+ * thread of its own (inline if none can be started) and the server is ready
+ * once that finishes; otherwise it is ready now and pages load on demand.
+ * `model` may be NULL when embeddings are disabled.
+ */
+void model_warmup_start(const EmbeddingModel *model, bool prewarm) {
+    model_warmup_wait();
+    warm_model = model;
+    warm_prewarm = prewarm;
+    atomic_store(&warm_us, 0);
+    if (model == NULL || !prewarm || embedding_model_mapped_bytes(model) == 0) {
+        atomic_store(&warm_ready, true);
+        return;
+    }
+    atomic_store(&warm_ready, false);
+    warm_thread_running = pthread_create(&warm_thread, NULL, warm_main, NULL) == 0;
+    if (!warm_thread_running) {
+        fault_in();
+    }
+}
+
+/* Blocks until a prewarm in progress is done; call before freeing the model. */
+void model_warmup_wait(void) {
+    if (warm_thread_running) {
+        pthread_join(warm_thread, NULL);
+        warm_thread_running = false;
+    }
+}
+
+bool model_warmup_ready(void) {
+    return atomic_load(&warm_ready);
+}
+
+void model_warmup_stats(ModelWarmupStats *out) {
+    out->ready = atomic_load(&warm_ready);
+    out->prewarm = warm_prewarm;
+    out->mapped_bytes = warm_model != NULL ? embedding_model_mapped_bytes(warm_model) : 0;
+    out->resident_bytes = warm_model != NULL ? embedding_model_resident_bytes(warm_model) : 0;
+    out->warm_us = atomic_load(&warm_us);
+}
+
+size_t model_warmup_format_stats_json(const ModelWarmupStats *stats,
+                                      char *buffer,
+                                      size_t capacity) {
+    int n = snprintf(buffer, capacity,
+                     "{\"ready\":%s,\"prewarm\":%s,\"mapped_bytes\":%zu,\"resident_bytes\":%zu,"
+                     "\"warm_ms\":%.3f}",
+                     stats->ready ? "true" : "false", stats->prewarm ? "true" : "false",
+                     stats->mapped_bytes, stats->resident_bytes,
+                     (double)stats->warm_us / 1000.0);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
@@ -0,0 +1,33 @@
+#ifndef MODEL_WARMUP_H
+#define MODEL_WARMUP_H
+
+#include "embedding.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Readiness of the recognition models. A packed embedding model is mapped
+ * lazily, so its pages fault in from disk during the first recognitions.
+ * With prewarm on, a background thread faults the whole file in after the
+ * listeners open, and `GET /api/ready` answers 503 until it has finished.
+ */
+typedef struct {
+    bool ready;
+    bool prewarm;
+    size_t mapped_bytes;
+    size_t resident_bytes;
+    uint64_t warm_us;
+} ModelWarmupStats;
+
+void model_warmup_start(const EmbeddingModel *model, bool prewarm);
+void model_warmup_wait(void);
+bool model_warmup_ready(void);
+
+void model_warmup_stats(ModelWarmupStats *out);
+size_t model_warmup_format_stats_json(const ModelWarmupStats *stats,
+                                      char *buffer,
+                                      size_t capacity);
+
+#endif
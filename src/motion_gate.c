@@ -0,0 +1,139 @@
+#include "motion_gate.h"
+
+#include "image.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTION_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define MOTION_HAVE_X86 0
+#endif
+
+static int cell_edge(int cell, int cells, int extent) {
+    return (int)((long)cell * extent / cells);
+}
+
+/*
+ * Box-averages the gray plane onto the grid. Averaging over whole cells (10x10
+ * pixels at the detector input size) makes the signature insensitive to
+ * sensor noise and JPEG ringing, so only real scene changes move it.
+ */
+void motion_signature_compute(const uint8_t *gray,
+                              int width,
+                              int height,
+                              size_t stride,
+                              MotionSignature *out) {
+    memset(out, 0, sizeof(*out));
+    if (gray == NULL || width <= 0 || height <= 0) {
+        return;
+    }
+
+    uint32_t sums[MOTION_GRID_WIDTH];
+    for (int cy = 0; cy < MOTION_GRID_HEIGHT; cy++) {
+        int y0 = cell_edge(cy, MOTION_GRID_HEIGHT, height);
+        int y1 = cell_edge(cy + 1, MOTION_GRID_HEIGHT, height);
+        if (y1 <= y0) {
+            y1 = y0 + 1 < height ? y0 + 1 : height;
+        }
+        memset(sums, 0, sizeof(sums));
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *row = gray + (size_t)y * stride;
+            for (int cx = 0; cx < MOTION_GRID_WIDTH; cx++) {
+                int x0 = cell_edge(cx, MOTION_GRID_WIDTH, width);
+                int x1 = cell_edge(cx + 1, MOTION_GRID_WIDTH, width);
+                if (x1 <= x0) {
+                    x1 = x0 + 1 < width ? x0 + 1 : width;
+                }
+                uint32_t sum = 0;
+                for (int x = x0; x < x1; x++) {
+                    sum += row[x];
+                }
+                sums[cx] += sum;
+            }
+        }
+        for (int cx = 0; cx < MOTION_GRID_WIDTH; cx++) {
+            int x0 = cell_edge(cx, MOTION_GRID_WIDTH, width);
+            int x1 = cell_edge(cx + 1, MOTION_GRID_WIDTH, width);
+            if (x1 <= x0) {
+                x1 = x0 + 1 < width ? x0 + 1 : width;
+            }
+            uint32_t area = (uint32_t)(x1 - x0) * (uint32_t)(y1 - y0);
+            out->cells[cy * MOTION_GRID_WIDTH + cx] =
+                area > 0 ? (uint8_t)((sums[cx] + area / 2) / area) : 0;
+        }
+    }
+}
+
+static size_t changed_cells_scalar(const uint8_t *a,
+                                   const uint8_t *b,
+                                   size_t count,
+                                   int threshold) {
+    size_t changed = 0;
+    for (size_t i = 0; i < count; i++) {
+        int diff = (int)a[i] - (int)b[i];
+        if (diff > threshold || -diff > threshold) {
+            changed++;
+        }
+    }
+    return changed;
+}
+
+#if MOTION_HAVE_X86
+__attribute__((target("ssse3"))) static size_t changed_cells_ssse3(const uint8_t *a,
+                                                                   const uint8_t *b,
+                                                                   size_t count,
+                                                                   int threshold) {
+    const __m128i limit = _mm_set1_epi8((char)threshold);
+    const __m128i zero = _mm_setzero_si128();
+    size_t changed = 0;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+        __m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(diff, limit), zero);
+        changed += 16 - (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(still));
+    }
+    return changed + changed_cells_scalar(a + i, b + i, count - i, threshold);
+}
+
+__attribute__((target("avx2"))) static size_t changed_cells_avx2(const uint8_t *a,
+                                                                 const uint8_t *b,
+                                                                 size_t count,
+                                                                 int threshold) {
+    const __m256i limit = _mm256_set1_epi8((char)threshold);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t changed = 0;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+        __m256i still = _mm256_cmpeq_epi8(_mm256_subs_epu8(diff, limit), zero);
+        changed += 32 - (size_t)__builtin_popcount((unsigned)_mm256_movemask_epi8(still));
+    }
+    return changed + changed_cells_scalar(a + i, b + i, count - i, threshold);
+}
+#endif
+
+/* Counts cells whose mean moved by more than `threshold` gray levels. */
+size_t motion_changed_cells(const MotionSignature *a, const MotionSignature *b, int threshold) {
+    if (threshold < 0) {
+        threshold = 0;
+    } else if (threshold > 255) {
+        threshold = 255;
+    }
+#if MOTION_HAVE_X86
+    switch (image_kernel_level()) {
+    case IMAGE_KERNEL_AVX2:
+        return changed_cells_avx2(a->cells, b->cells, MOTION_GRID_CELLS, threshold);
+    case IMAGE_KERNEL_SSSE3:
+        return changed_cells_ssse3(a->cells, b->cells, MOTION_GRID_CELLS, threshold);
+    default:
+        break;
+    }
+#endif
+    return changed_cells_scalar(a->cells, b->cells, MOTION_GRID_CELLS, threshold);
+}
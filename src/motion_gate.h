@@ -0,0 +1,24 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MOTION_GRID_WIDTH 32
+#define MOTION_GRID_HEIGHT 24
+#define MOTION_GRID_CELLS (MOTION_GRID_WIDTH * MOTION_GRID_HEIGHT)
+
+/* Mean gray level of each cell of a fixed grid laid over the frame. */
+typedef struct {
+    uint8_t cells[MOTION_GRID_CELLS];
+} MotionSignature;
+
+void motion_signature_compute(const uint8_t *gray,
+                              int width,
+                              int height,
+                              size_t stride,
+                              MotionSignature *out);
+
+size_t motion_changed_cells(const MotionSignature *a, const MotionSignature *b, int threshold);
+
+#endif
@@ -0,0 +1,383 @@
+#include "nn_kernels.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NN_HAVE_X86 1
+#include <immintrin.h>
+#else
+#define NN_HAVE_X86 0
+#endif
+
+/*
+ * Column panel width for the float GEMM. The micro-kernels stream all of B
+ * once per four rows of A, so B is cut into k x 256 panels that stay in L2
+ * while every row block passes over them; batched inference widens n well
+ * past what fits otherwise.
+ */
+#define GEMM_PANEL_COLS 256
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx512bw,avx512vnni,avx2,fma")))
+
+static atomic_int kernel_level = -1;
+
+static NnKernelLevel detect_kernel_level(void) {
+#if NN_HAVE_X86
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vnni")) {
+        return NN_KERNEL_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return NN_KERNEL_AVX2;
+    }
+#endif
+    return NN_KERNEL_SCALAR;
+}
+
+NnKernelLevel nn_kernel_level(void) {
+    int level = atomic_load(&kernel_level);
+    if (level < 0) {
+        level = (int)detect_kernel_level();
+        atomic_store(&kernel_level, level);
+    }
+    return (NnKernelLevel)level;
+}
+
+NnKernelLevel nn_set_kernel_level(NnKernelLevel level) {
+    NnKernelLevel supported = detect_kernel_level();
+    if (level > supported) {
+        level = supported;
+    }
+    atomic_store(&kernel_level, (int)level);
+    return level;
+}
+
+const char *nn_kernel_level_name(NnKernelLevel level) {
+    switch (level) {
+    case NN_KERNEL_AVX512:
+        return "avx512";
+    case NN_KERNEL_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+size_t nn_int8_padded_k(size_t k) {
+    return (k + NN_INT8_K_ALIGN - 1) / NN_INT8_K_ALIGN * NN_INT8_K_ALIGN;
+}
+
+static void gemm_f32_scalar(size_t m,
+                            size_t n,
+                            size_t k,
+                            const float *a,
+                            size_t lda,
+                            const float *b,
+                            size_t ldb,
+                            float *c,
+                            size_t ldc) {
+    for (size_t i = 0; i < m; i++) {
+        float *c_row = c + i * ldc;
+        memset(c_row, 0, n * sizeof(float));
+        for (size_t kk = 0; kk < k; kk++) {
+            float av = a[i * lda + kk];
+            const float *b_row = b + kk * ldb;
+            for (size_t j = 0; j < n; j++) {
+                c_row[j] += av * b_row[j];
+            }
+        }
+    }
+}
+
+static void gemm_f32_tail_cols(size_t rows,
+                               size_t j_begin,
+                               size_t n,
+                               size_t k,
+                               const float *a,
+                               size_t lda,
+                               const float *b,
+                               size_t ldb,
+                               float *c,
+                               size_t ldc) {
+    for (size_t r = 0; r < rows; r++) {
+        for (size_t j = j_begin; j < n; j++) {
+            float sum = 0.0f;
+            for (size_t kk = 0; kk < k; kk++) {
+                sum += a[r * lda + kk] * b[kk * ldb + j];
+            }
+            c[r * ldc + j] = sum;
+        }
+    }
+}
+
+static void u8s8_scalar(size_t m,
+                        size_t n,
+                        size_t k_padded,
+                        const int8_t *a,
+                        const uint8_t *bt,
+                        int32_t *c,
+                        size_t ldc) {
+    for (size_t j = 0; j < n; j++) {
+        const uint8_t *b_row = bt + j * k_padded;
+        for (size_t i = 0; i < m; i++) {
+            const int8_t *a_row = a + i * k_padded;
+            int32_t sum = 0;
+            for (size_t kk = 0; kk < k_padded; kk++) {
+                sum += (int32_t)a_row[kk] * (int32_t)b_row[kk];
+            }
+            c[i * ldc + j] = sum;
+        }
+    }
+}
+
+#if NN_HAVE_X86
+AVX2_TARGET static void gemm_f32_avx2(size_t m,
+                                      size_t n,
+                                      size_t k,
+                                      const float *a,
+                                      size_t lda,
+                                      const float *b,
+                                      size_t ldb,
+                                      float *c,
+                                      size_t ldc) {
+    size_t i = 0;
+    while (i < m) {
+        size_t rows = m - i >= 4 ? 4 : m - i;
+        const float *a_block = a + i * lda;
+        float *c_block = c + i * ldc;
+
+        size_t j = 0;
+        for (; j + 16 <= n; j += 16) {
+            __m256 acc[4][2];
+            for (size_t r = 0; r < 4; r++) {
+                acc[r][0] = _mm256_setzero_ps();
+                acc[r][1] = _mm256_setzero_ps();
+            }
+            for (size_t kk = 0; kk < k; kk++) {
+                const float *b_row = b + kk * ldb + j;
+                __m256 b0 = _mm256_loadu_ps(b_row);
+                __m256 b1 = _mm256_loadu_ps(b_row + 8);
+                for (size_t r = 0; r < rows; r++) {
+                    __m256 av = _mm256_broadcast_ss(a_block + r * lda + kk);
+                    acc[r][0] = _mm256_fmadd_ps(av, b0, acc[r][0]);
+                    acc[r][1] = _mm256_fmadd_ps(av, b1, acc[r][1]);
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                _mm256_storeu_ps(c_block + r * ldc + j, acc[r][0]);
+                _mm256_storeu_ps(c_block + r * ldc + j + 8, acc[r][1]);
+            }
+        }
+        for (; j + 8 <= n; j += 8) {
+            __m256 acc[4];
+            for (size_t r = 0; r < 4; r++) {
+                acc[r] = _mm256_setzero_ps();
+            }
+            for (size_t kk = 0; kk < k; kk++) {
+                __m256 b0 = _mm256_loadu_ps(b + kk * ldb + j);
+                for (size_t r = 0; r < rows; r++) {
+                    __m256 av = _mm256_broadcast_ss(a_block + r * lda + kk);
+                    acc[r] = _mm256_fmadd_ps(av, b0, acc[r]);
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                _mm256_storeu_ps(c_block + r * ldc + j, acc[r]);
+            }
+        }
+        if (j < n) {
+            gemm_f32_tail_cols(rows, j, n, k, a_block, lda, b, ldb, c_block, ldc);
+        }
+        i += rows;
+    }
+}
+
+AVX2_TARGET static inline int32_t hsum_epi32_avx2(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+}
+
+AVX2_TARGET static void u8s8_avx2(size_t m,
+                                  size_t n,
+                                  size_t k_padded,
+                                  const int8_t *a,
+                                  const uint8_t *bt,
+                                  int32_t *c,
+                                  size_t ldc) {
+    for (size_t j = 0; j < n; j++) {
+        const uint8_t *b_row = bt + j * k_padded;
+        size_t i = 0;
+        while (i < m) {
+            size_t rows = m - i >= 4 ? 4 : m - i;
+            __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                              _mm256_setzero_si256(), _mm256_setzero_si256()};
+            for (size_t kk = 0; kk < k_padded; kk += 16) {
+                __m256i bv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(b_row + kk)));
+                for (size_t r = 0; r < rows; r++) {
+                    const int8_t *a_row = a + (i + r) * k_padded + kk;
+                    __m256i av = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *)a_row));
+                    acc[r] = _mm256_add_epi32(acc[r], _mm256_madd_epi16(av, bv));
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                c[(i + r) * ldc + j] = hsum_epi32_avx2(acc[r]);
+            }
+            i += rows;
+        }
+    }
+}
+
+AVX512_TARGET static void gemm_f32_avx512(size_t m,
+                                          size_t n,
+                                          size_t k,
+                                          const float *a,
+                                          size_t lda,
+                                          const float *b,
+                                          size_t ldb,
+                                          float *c,
+                                          size_t ldc) {
+    size_t i = 0;
+    while (i < m) {
+        size_t rows = m - i >= 4 ? 4 : m - i;
+        const float *a_block = a + i * lda;
+        float *c_block = c + i * ldc;
+
+        size_t j = 0;
+        for (; j + 32 <= n; j += 32) {
+            __m512 acc[4][2];
+            for (size_t r = 0; r < 4; r++) {
+                acc[r][0] = _mm512_setzero_ps();
+                acc[r][1] = _mm512_setzero_ps();
+            }
+            for (size_t kk = 0; kk < k; kk++) {
+                const float *b_row = b + kk * ldb + j;
+                __m512 b0 = _mm512_loadu_ps(b_row);
+                __m512 b1 = _mm512_loadu_ps(b_row + 16);
+                for (size_t r = 0; r < rows; r++) {
+                    __m512 av = _mm512_set1_ps(a_block[r * lda + kk]);
+                    acc[r][0] = _mm512_fmadd_ps(av, b0, acc[r][0]);
+                    acc[r][1] = _mm512_fmadd_ps(av, b1, acc[r][1]);
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                _mm512_storeu_ps(c_block + r * ldc + j, acc[r][0]);
+                _mm512_storeu_ps(c_block + r * ldc + j + 16, acc[r][1]);
+            }
+        }
+        for (; j + 16 <= n; j += 16) {
+            __m512 acc[4];
+            for (size_t r = 0; r < 4; r++) {
+                acc[r] = _mm512_setzero_ps();
+            }
+            for (size_t kk = 0; kk < k; kk++) {
+                __m512 b0 = _mm512_loadu_ps(b + kk * ldb + j);
+                for (size_t r = 0; r < rows; r++) {
+                    acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(a_block[r * lda + kk]), b0, acc[r]);
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                _mm512_storeu_ps(c_block + r * ldc + j, acc[r]);
+            }
+        }
+        if (j < n) {
+            __mmask16 mask = (__mmask16)((1u << (n - j)) - 1u);
+            __m512 acc[4];
+            for (size_t r = 0; r < 4; r++) {
+                acc[r] = _mm512_setzero_ps();
+            }
+            for (size_t kk = 0; kk < k; kk++) {
+                __m512 b0 = _mm512_maskz_loadu_ps(mask, b + kk * ldb + j);
+                for (size_t r = 0; r < rows; r++) {
+                    acc[r] = _mm512_fmadd_ps(_mm512_set1_ps(a_block[r * lda + kk]), b0, acc[r]);
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                _mm512_mask_storeu_ps(c_block + r * ldc + j, mask, acc[r]);
+            }
+        }
+        i += rows;
+    }
+}
+
+AVX512_TARGET static void u8s8_avx512(size_t m,
+                                      size_t n,
+                                      size_t k_padded,
+                                      const int8_t *a,
+                                      const uint8_t *bt,
+                                      int32_t *c,
+                                      size_t ldc) {
+    for (size_t j = 0; j < n; j++) {
+        const uint8_t *b_row = bt + j * k_padded;
+        size_t i = 0;
+        while (i < m) {
+            size_t rows = m - i >= 4 ? 4 : m - i;
+            __m512i acc[4] = {_mm512_setzero_si512(), _mm512_setzero_si512(),
+                              _mm512_setzero_si512(), _mm512_setzero_si512()};
+            for (size_t kk = 0; kk < k_padded; kk += 64) {
+                __m512i bv = _mm512_loadu_si512((const void *)(b_row + kk));
+                for (size_t r = 0; r < rows; r++) {
+                    __m512i av = _mm512_loadu_si512((const void *)(a + (i + r) * k_padded + kk));
+                    acc[r] = _mm512_dpbusd_epi32(acc[r], bv, av);
+                }
+            }
+            for (size_t r = 0; r < rows; r++) {
+                c[(i + r) * ldc + j] = _mm512_reduce_add_epi32(acc[r]);
+            }
+            i += rows;
+        }
+    }
+}
+#endif
+
+void nn_gemm_f32(size_t m,
+                 size_t n,
+                 size_t k,
+                 const float *a,
+                 size_t lda,
+                 const float *b,
+                 size_t ldb,
+                 float *c,
+                 size_t ldc) {
+    NnKernelLevel level = nn_kernel_level();
+    for (size_t j = 0; j < n; j += GEMM_PANEL_COLS) {
+        size_t cols = n - j < GEMM_PANEL_COLS ? n - j : GEMM_PANEL_COLS;
+#if NN_HAVE_X86
+        if (level == NN_KERNEL_AVX512) {
+            gemm_f32_avx512(m, cols, k, a, lda, b + j, ldb, c + j, ldc);
+            continue;
+        }
+        if (level == NN_KERNEL_AVX2) {
+            gemm_f32_avx2(m, cols, k, a, lda, b + j, ldb, c + j, ldc);
+            continue;
+        }
+#endif
+        (void)level;
+        gemm_f32_scalar(m, cols, k, a, lda, b + j, ldb, c + j, ldc);
+    }
+}
+
+void nn_gemm_u8s8(size_t m,
+                  size_t n,
+                  size_t k_padded,
+                  const int8_t *a,
+                  const uint8_t *bt,
+                  int32_t *c,
+                  size_t ldc) {
+#if NN_HAVE_X86
+    switch (nn_kernel_level()) {
+    case NN_KERNEL_AVX512:
+        u8s8_avx512(m, n, k_padded, a, bt, c, ldc);
+        return;
+    case NN_KERNEL_AVX2:
+        u8s8_avx2(m, n, k_padded, a, bt, c, ldc);
+        return;
+    default:
+        break;
+    }
+#endif
+    u8s8_scalar(m, n, k_padded, a, bt, c, ldc);
+}
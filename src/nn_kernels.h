@@ -0,0 +1,39 @@
+#ifndef NN_KERNELS_H
+#define NN_KERNELS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NN_INT8_K_ALIGN 64
+
+typedef enum {
+    NN_KERNEL_SCALAR = 0,
+    NN_KERNEL_AVX2 = 1,
+    NN_KERNEL_AVX512 = 2,
+} NnKernelLevel;
+
+NnKernelLevel nn_kernel_level(void);
+NnKernelLevel nn_set_kernel_level(NnKernelLevel level);
+const char *nn_kernel_level_name(NnKernelLevel level);
+
+size_t nn_int8_padded_k(size_t k);
+
+void nn_gemm_f32(size_t m,
+                 size_t n,
+                 size_t k,
+                 const float *a,
+                 size_t lda,
+                 const float *b,
+                 size_t ldb,
+                 float *c,
+                 size_t ldc);
+
+void nn_gemm_u8s8(size_t m,
+                  size_t n,
+                  size_t k_padded,
+                  const int8_t *a,
+                  const uint8_t *bt,
+                  int32_t *c,
+                  size_t ldc);
+
+#endif
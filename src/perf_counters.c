@@ -0,0 +1,359 @@
+/* perf_event_open(2) has no libc wrapper; syscall() needs the GNU feature set. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "perf_counters.h"
+
+#include "server_config.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define PERF_THREAD_NAME_MAX 32
+
+typedef struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} EventSpec;
+
+/* The first event leads the group; it is a software clock so the group opens anywhere. */
+static const EventSpec event_specs[PERF_EVENT_COUNT] = {
+    {"cpu_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+static const char *const stage_names[PERF_STAGE_COUNT] = {
+    "read", "handle", "send", "decode", "detect", "embed", "search",
+};
+
+/*
+ * One per thread that has measured a stage. Only the owning thread adds to
+ * the totals, so the exporter reads them without a lock. Like trace rings, a
+ * slot outlives its thread: the descriptors are closed at exit and the next
+ * new thread takes the slot over, totals included.
+ */
+typedef struct {
+    bool in_use;
+    bool available;
+    uint32_t tid;
+    char name[PERF_THREAD_NAME_MAX];
+    int fds[PERF_EVENT_COUNT];
+    int positions[PERF_EVENT_COUNT];
+    size_t opened;
+    _Atomic uint64_t calls[PERF_STAGE_COUNT];
+    _Atomic uint64_t totals[PERF_STAGE_COUNT][PERF_EVENT_COUNT];
+} PerfThread;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_key;
+static PerfThread *threads[PERF_MAX_THREADS];
+static size_t thread_count = 0;
+static uint32_t next_tid = 1;
+static atomic_bool enabled = false;
+static _Atomic uint64_t samples = 0;
+static atomic_int open_error = 0;
+
+static _Thread_local PerfThread *local_thread = NULL;
+static _Thread_local bool local_unavailable = false;
+static _Thread_local char local_name[PERF_THREAD_NAME_MAX];
+
+static void close_counters(PerfThread *thread) {
+    for (size_t i = 0; i < PERF_EVENT_COUNT; i++) {
+        if (thread->fds[i] >= 0) {
+            close(thread->fds[i]);
+            thread->fds[i] = -1;
+        }
+    }
+    thread->opened = 0;
+}
+
+static void release_thread(void *arg) {
+    PerfThread *thread = (PerfThread *)arg;
+    pthread_mutex_lock(&registry_mutex);
+    close_counters(thread);
+    thread->in_use = false;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void init_registry(void) {
+    pthread_key_create(&thread_key, release_thread);
+}
+
+static int open_event(const EventSpec *spec, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = spec->type;
+    attr.config = spec->config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    long fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0) {
+        atomic_store_explicit(&open_error, errno, memory_order_relaxed);
+    }
+    return (int)fd;
+}
+
+/*
+ * Counts only the calling thread, in user space (which is all an unprivileged
+ * process may count under the default perf_event_paranoid). Events after the
+ * leader are optional: virtual machines and containers often expose no
+ * hardware counters at all.
+ */
+static void open_counters(PerfThread *thread) {
+    for (size_t i = 0; i < PERF_EVENT_COUNT; i++) {
+        thread->fds[i] = -1;
+        thread->positions[i] = -1;
+    }
+    thread->opened = 0;
+    thread->fds[0] = open_event(&event_specs[0], -1);
+    if (thread->fds[0] < 0) {
+        thread->available = false;
+        return;
+    }
+    thread->positions[0] = (int)thread->opened++;
+    for (size_t i = 1; i < PERF_EVENT_COUNT; i++) {
+        thread->fds[i] = open_event(&event_specs[i], thread->fds[0]);
+        if (thread->fds[i] >= 0) {
+            thread->positions[i] = (int)thread->opened++;
+        }
+    }
+    thread->available = true;
+}
+
+/* Finds this thread a slot on its first measured stage; NULL once every slot is taken. */
+static PerfThread *acquire_thread(void) {
+    pthread_once(&registry_once, init_registry);
+    pthread_mutex_lock(&registry_mutex);
+    PerfThread *thread = NULL;
+    for (size_t i = 0; i < thread_count && thread == NULL; i++) {
+        if (!threads[i]->in_use) {
+            thread = threads[i];
+        }
+    }
+    if (thread == NULL && thread_count < PERF_MAX_THREADS) {
+        thread = (PerfThread *)calloc(1, sizeof(*thread));
+        if (thread != NULL) {
+            threads[thread_count++] = thread;
+        }
+    }
+    if (thread != NULL) {
+        thread->in_use = true;
+        thread->tid = next_tid++;
+        if (local_name[0] != '\0') {
+            snprintf(thread->name, sizeof(thread->name), "%s", local_name);
+        } else {
+            snprintf(thread->name, sizeof(thread->name), "thread-%u", (unsigned)thread->tid);
+        }
+        open_counters(thread);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (thread != NULL) {
+        pthread_setspecific(thread_key, thread);
+    }
+    return thread;
+}
+
+static PerfThread *this_thread(void) {
+    if (local_thread == NULL && !local_unavailable) {
+        local_thread = acquire_thread();
+        local_unavailable = local_thread == NULL || !local_thread->available;
+    }
+    return local_unavailable ? NULL : local_thread;
+}
+
+/* One read(2) returns every counter in the group, in the order they were opened. */
+static bool read_counters(const PerfThread *thread, uint64_t *values) {
+    uint64_t buffer[1 + PERF_EVENT_COUNT];
+    ssize_t n = read(thread->fds[0], buffer, sizeof(buffer));
+    if (n < (ssize_t)sizeof(uint64_t) || buffer[0] != thread->opened) {
+        return false;
+    }
+    for (size_t i = 0; i < PERF_EVENT_COUNT; i++) {
+        values[i] = thread->positions[i] >= 0 ? buffer[1 + thread->positions[i]] : 0;
+    }
+    return true;
+}
+
+void perf_counters_set_enabled(bool on) {
+    atomic_store(&enabled, on);
+}
+
+bool perf_counters_enabled(void) {
+    return atomic_load(&enabled);
+}
+
+void perf_stage_begin(PerfSample *start) {
+    start->valid = false;
+    if (!atomic_load_explicit(&enabled, memory_order_relaxed)) {
+        return;
+    }
+    PerfThread *thread = this_thread();
+    start->valid = thread != NULL && read_counters(thread, start->values);
+}
+
+void perf_stage_end(PerfStage stage, const PerfSample *start) {
+    if (!start->valid || stage >= PERF_STAGE_COUNT) {
+        return;
+    }
+    PerfThread *thread = local_thread;
+    uint64_t now[PERF_EVENT_COUNT];
+    if (!read_counters(thread, now)) {
+        return;
+    }
+    for (size_t i = 0; i < PERF_EVENT_COUNT; i++) {
+        if (thread->positions[i] >= 0 && now[i] >= start->values[i]) {
+            atomic_fetch_add_explicit(&thread->totals[stage][i], now[i] - start->values[i],
+                                      memory_order_relaxed);
+        }
+    }
+    atomic_fetch_add_explicit(&thread->calls[stage], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&samples, 1, memory_order_relaxed);
+}
+
+/* Kept until the thread measures something, so naming a thread opens no counters. */
+void perf_set_thread_name(const char *name) {
+    snprintf(local_name, sizeof(local_name), "%s", name);
+    if (local_thread != NULL) {
+        pthread_mutex_lock(&registry_mutex);
+        snprintf(local_thread->name, sizeof(local_thread->name), "%s", name);
+        pthread_mutex_unlock(&registry_mutex);
+    }
+}
+
+const char *perf_stage_name(PerfStage stage) {
+    return stage < PERF_STAGE_COUNT ? stage_names[stage] : "unknown";
+}
+
+static bool append(char *buffer, size_t capacity, size_t *used, const char *text, size_t length) {
+    if (*used + length >= capacity) {
+        return false;
+    }
+    memcpy(buffer + *used, text, length);
+    *used += length;
+    buffer[*used] = '\0';
+    return true;
+}
+
+static bool append_stage(char *buffer,
+                         size_t capacity,
+                         size_t *used,
+                         const PerfThread *thread,
+                         size_t stage,
+                         bool first) {
+    char text[PERF_JSON_STAGE_BYTES];
+    int n = snprintf(text, sizeof(text), "%s\"%s\":{\"calls\":%llu", first ? "" : ",",
+                     stage_names[stage],
+                     (unsigned long long)atomic_load_explicit(&thread->calls[stage],
+                                                              memory_order_relaxed));
+    for (size_t i = 0; i < PERF_EVENT_COUNT && n > 0 && (size_t)n < sizeof(text); i++) {
+        if (thread->positions[i] < 0) {
+            n += snprintf(text + n, sizeof(text) - (size_t)n, ",\"%s\":null", event_specs[i].name);
+            continue;
+        }
+        uint64_t total = atomic_load_explicit(&thread->totals[stage][i], memory_order_relaxed);
+        n += snprintf(text + n, sizeof(text) - (size_t)n, ",\"%s\":%llu", event_specs[i].name,
+                      (unsigned long long)total);
+    }
+    return n > 0 && (size_t)n + 1 < sizeof(text) && append(buffer, capacity, used, text,
+                                                            (size_t)n) &&
+           append(buffer, capacity, used, "}", 1);
+}
+
+/*
+ * Writes `{"enabled":..,"events":[..],"error":..,"threads":[..]}`: per thread
+ * its name, whether counters opened, and for every stage it has measured the
+ * call count and each event's total (null when the kernel refused it).
+ * Stages nest (`handle` includes `send`), so they do not add up. Threads
+ * that do not fit are left out. Returns the length, 0 if the header does not fit.
+ */
+size_t perf_counters_format_json(char *buffer, size_t capacity) {
+    static const char close[] = "]}";
+    if (capacity < sizeof(close)) {
+        return 0;
+    }
+    size_t limit = capacity - (sizeof(close) - 1);
+    size_t used = 0;
+    int error = atomic_load_explicit(&open_error, memory_order_relaxed);
+    char text[512];
+    int n = snprintf(text, sizeof(text), "{\"enabled\":%s,\"events\":[",
+                     atomic_load(&enabled) ? "true" : "false");
+    for (size_t i = 0; i < PERF_EVENT_COUNT && n > 0 && (size_t)n < sizeof(text); i++) {
+        n += snprintf(text + n, sizeof(text) - (size_t)n, "%s\"%s\"", i > 0 ? "," : "",
+                      event_specs[i].name);
+    }
+    char error_text[128];
+    snprintf(error_text, sizeof(error_text), error != 0 ? "\"%s\"" : "null",
+             error != 0 ? strerror(error) : "");
+    if (n > 0 && (size_t)n < sizeof(text)) {
+        n += snprintf(text + n, sizeof(text) - (size_t)n, "],\"error\":%s,\"threads\":[",
+                      error_text);
+    }
+    if (n <= 0 || (size_t)n >= sizeof(text) || !append(buffer, limit, &used, text, (size_t)n)) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+    bool room = true;
+    for (size_t t = 0; t < thread_count && room; t++) {
+        const PerfThread *thread = threads[t];
+        size_t mark = used;
+        n = snprintf(text, sizeof(text), "%s{\"name\":\"%s\",\"tid\":%u,\"available\":%s,"
+                     "\"stages\":{",
+                     t > 0 ? "," : "", thread->name, (unsigned)thread->tid,
+                     thread->available ? "true" : "false");
+        room = n > 0 && (size_t)n < sizeof(text) && append(buffer, limit, &used, text, (size_t)n);
+        bool first = true;
+        for (size_t stage = 0; stage < PERF_STAGE_COUNT && room; stage++) {
+            if (atomic_load_explicit(&thread->calls[stage], memory_order_relaxed) == 0) {
+                continue;
+            }
+            room = append_stage(buffer, limit, &used, thread, stage, first);
+            first = false;
+        }
+        room = room && append(buffer, limit, &used, "}}", 2);
+        if (!room) {
+            used = mark;
+            buffer[used] = '\0';
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    append(buffer, capacity, &used, close, sizeof(close) - 1);
+    return used;
+}
+
+size_t perf_counters_json_capacity(void) {
+    pthread_mutex_lock(&registry_mutex);
+    size_t count = thread_count;
+    pthread_mutex_unlock(&registry_mutex);
+    return 512 + count * (128 + PERF_STAGE_COUNT * PERF_JSON_STAGE_BYTES);
+}
+
+void perf_counters_stats(PerfCounterStats *out) {
+    out->enabled = atomic_load(&enabled);
+    pthread_mutex_lock(&registry_mutex);
+    out->threads = thread_count;
+    out->unavailable_threads = 0;
+    for (size_t i = 0; i < thread_count; i++) {
+        if (!threads[i]->available) {
+            out->unavailable_threads++;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    out->samples = atomic_load_explicit(&samples, memory_order_relaxed);
+}
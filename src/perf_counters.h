@@ -0,0 +1,103 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CPU event counts per pipeline stage per thread, from perf_event_open(2),
+ * exported as JSON at `GET /debug/perf`. Each thread opens one counter group
+ * on its first measured stage: CPU time (a software event, so it works where
+ * hardware counters do not), cycles, instructions, last-level cache misses and
+ * branch misses. Events the kernel refuses are reported as null; a thread that
+ * cannot open any counts nothing. Counting is off until enabled with the live
+ * `perf_counters` option, and costs two read(2) calls per stage while on.
+ *
+ * Built with WEB_SERVER_PERF_COUNTERS; without it every call below is an
+ * empty inline function and PERF_* expand to nothing.
+ */
+
+typedef enum {
+    PERF_STAGE_READ = 0,
+    PERF_STAGE_HANDLE,
+    PERF_STAGE_SEND,
+    PERF_STAGE_DECODE,
+    PERF_STAGE_DETECT,
+    PERF_STAGE_EMBED,
+    PERF_STAGE_SEARCH,
+    PERF_STAGE_COUNT,
+} PerfStage;
+
+typedef enum {
+    PERF_EVENT_CPU_NS = 0,
+    PERF_EVENT_CYCLES,
+    PERF_EVENT_INSTRUCTIONS,
+    PERF_EVENT_LLC_MISSES,
+    PERF_EVENT_BRANCH_MISSES,
+    PERF_EVENT_COUNT,
+} PerfEvent;
+
+/* Counter values when a stage began; `valid` is false when nothing was read. */
+typedef struct {
+    bool valid;
+    uint64_t values[PERF_EVENT_COUNT];
+} PerfSample;
+
+typedef struct {
+    bool enabled;
+    size_t threads;
+    size_t unavailable_threads;
+    uint64_t samples;
+} PerfCounterStats;
+
+#ifdef WEB_SERVER_PERF_COUNTERS
+
+void perf_counters_set_enabled(bool enabled);
+bool perf_counters_enabled(void);
+void perf_stage_begin(PerfSample *start);
+void perf_stage_end(PerfStage stage, const PerfSample *start);
+void perf_set_thread_name(const char *name);
+
+const char *perf_stage_name(PerfStage stage);
+size_t perf_counters_format_json(char *buffer, size_t capacity);
+size_t perf_counters_json_capacity(void);
+void perf_counters_stats(PerfCounterStats *out);
+
+#define PERF_START(var)                                                                         \
+    PerfSample var;                                                                             \
+    perf_stage_begin(&var)
+#define PERF_END(stage, var) perf_stage_end(stage, &var)
+
+#else
+
+static inline void perf_counters_set_enabled(bool enabled) {
+    (void)enabled;
+}
+static inline bool perf_counters_enabled(void) {
+    return false;
+}
+static inline void perf_set_thread_name(const char *name) {
+    (void)name;
+}
+static inline size_t perf_counters_format_json(char *buffer, size_t capacity) {
+    (void)buffer;
+    (void)capacity;
+    return 0;
+}
+static inline size_t perf_counters_json_capacity(void) {
+    return 0;
+}
+static inline void perf_counters_stats(PerfCounterStats *out) {
+    out->enabled = false;
+    out->threads = 0;
+    out->unavailable_threads = 0;
+    out->samples = 0;
+}
+
+#define PERF_START(var) ((void)0)
+#define PERF_END(stage, var) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,877 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "pipeline.h"
+
+#include "batch_scheduler.h"
+#include "event_feed.h"
+#include "face_tracker.h"
+#include "gallery_shard.h"
+#include "http.h"
+#include "image.h"
+#include "jpeg_decode.h"
+#include "motion_gate.h"
+#include "perf_counters.h"
+#include "server_config.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PIPELINE_WORKERS 64
+
+typedef struct {
+    char stream_id[PIPELINE_STREAM_ID_MAX];
+    uint64_t trace_id;
+    uint64_t trace_queued;
+    size_t length;
+    unsigned char data[];
+} FrameJob;
+
+/* Face crops gathered across the frames of a batch and embedded together. */
+typedef struct {
+    EmbeddingWorkspace *workspace;
+    size_t capacity;
+    size_t count;
+    float *outputs;
+    bool valid[PIPELINE_EMBED_BATCH];
+    PipelineResult *owners[PIPELINE_EMBED_BATCH];
+    PipelineFace *faces[PIPELINE_EMBED_BATCH];
+} FaceBatch;
+
+/*
+ * What the gate remembers per stream: the signature of the last frame that
+ * went through detection, and the newest result with its tracks.
+ */
+typedef struct {
+    bool valid;
+    uint64_t stream;
+    uint64_t seq;
+    unsigned frames_since_keyframe;
+    MotionSignature signature;
+    PipelineResult result;
+} StreamState;
+
+typedef struct {
+    BatchItem items[PIPELINE_MAX_BATCH];
+    PipelineResult results[PIPELINE_MAX_BATCH];
+    MotionSignature signatures[PIPELINE_MAX_BATCH];
+    bool analyzed[PIPELINE_MAX_BATCH];
+    bool keyframe[PIPELINE_MAX_BATCH];
+    StreamState previous;
+    FaceBatch *faces;
+} WorkerState;
+
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static BatchScheduler *scheduler = NULL;
+static bool running = false;
+static uint64_t next_seq = 0;
+static PipelineStats stats;
+
+static pthread_t workers[MAX_PIPELINE_WORKERS];
+static size_t worker_count = 0;
+static PipelineEngines engines;
+
+static pthread_mutex_t result_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t result_cond = PTHREAD_COND_INITIALIZER;
+static PipelineResult latest_result;
+static uint64_t completed_seq = 0;
+
+static pthread_mutex_t stream_mutex = PTHREAD_MUTEX_INITIALIZER;
+static StreamState *stream_states = NULL;
+static atomic_uint next_track_id;
+
+/* Face batches for synchronous extraction, reused across requests. */
+static pthread_mutex_t spare_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FaceBatch *spare_batches[MAX_PIPELINE_WORKERS];
+static size_t spare_count = 0;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static void mark_completed(uint64_t seq, const PipelineResult *result) {
+    pthread_mutex_lock(&result_mutex);
+    if (result != NULL && result->seq > latest_result.seq) {
+        latest_result = *result;
+    }
+    if (seq > completed_seq) {
+        completed_seq = seq;
+    }
+    pthread_cond_broadcast(&result_cond);
+    pthread_mutex_unlock(&result_mutex);
+}
+
+static void scale_box(FaceBox *box, double sx, double sy) {
+    box->x = (int)(box->x * sx + 0.5);
+    box->y = (int)(box->y * sy + 0.5);
+    box->width = (int)(box->width * sx + 0.5);
+    box->height = (int)(box->height * sy + 0.5);
+}
+
+static FaceBatch *face_batch_create(size_t capacity) {
+    if (engines.embedder == NULL) {
+        return NULL;
+    }
+    FaceBatch *batch = (FaceBatch *)calloc(1, sizeof(*batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->capacity = capacity;
+    batch->workspace = embedding_workspace_create_batch(engines.embedder, capacity);
+    batch->outputs =
+        (float *)malloc(capacity * embedding_model_dim(engines.embedder) * sizeof(float));
+    if (batch->workspace == NULL || batch->outputs == NULL) {
+        embedding_workspace_free(batch->workspace);
+        free(batch->outputs);
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+static void face_batch_free(FaceBatch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    embedding_workspace_free(batch->workspace);
+    free(batch->outputs);
+    free(batch);
+}
+
+/*
+ * Runs one forward pass over every queued crop and hands each face its
+ * embedding. The pass time is split evenly between the faces so per-frame
+ * embed_ms still adds up to the work actually done for that frame.
+ */
+static void face_batch_flush(FaceBatch *batch) {
+    if (batch == NULL || batch->count == 0) {
+        return;
+    }
+    size_t dim = embedding_model_dim(engines.embedder);
+    TRACE_START(trace_start);
+    PERF_START(perf_embed);
+    uint64_t embed_start = monotonic_us();
+    bool ok = embedding_forward_batch(engines.embedder, engines.embedding_precision,
+                                      embedding_workspace_input(batch->workspace, 0),
+                                      batch->count, batch->workspace, NULL, batch->outputs,
+                                      batch->valid);
+    uint64_t share = (monotonic_us() - embed_start) / batch->count;
+
+    for (size_t i = 0; i < batch->count; i++) {
+        PipelineFace *face = batch->faces[i];
+        face->has_embedding = ok && batch->valid[i];
+        if (face->has_embedding) {
+            memcpy(face->embedding, batch->outputs + i * dim, dim * sizeof(float));
+        }
+        batch->owners[i]->embed_us += share;
+    }
+    batch->count = 0;
+    TRACE_END("embed", trace_start);
+    PERF_END(PERF_STAGE_EMBED, perf_embed);
+}
+
+static void face_batch_add(FaceBatch *batch,
+                           const ImageBuffer *image,
+                           const FaceBox *box,
+                           PipelineResult *owner,
+                           PipelineFace *face) {
+    if (batch->count == batch->capacity) {
+        face_batch_flush(batch);
+    }
+    FaceLandmarks landmarks = face_landmarks_from_box(box);
+    face_align_crop(image, &landmarks, embedding_model_input_channels(engines.embedder),
+                    embedding_model_input_size(engines.embedder),
+                    embedding_workspace_input(batch->workspace, batch->count));
+    batch->owners[batch->count] = owner;
+    batch->faces[batch->count] = face;
+    batch->count++;
+}
+
+static bool stream_state_load(uint64_t stream, StreamState *out) {
+    bool found = false;
+    pthread_mutex_lock(&stream_mutex);
+    for (size_t i = 0; stream_states != NULL && i < PIPELINE_MAX_STREAMS; i++) {
+        if (stream_states[i].valid && stream_states[i].stream == stream) {
+            *out = stream_states[i];
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&stream_mutex);
+    return found;
+}
+
+/*
+ * Folds a finished frame into its stream's state. A gated frame leaves the
+ * signature alone so slow drift still accumulates against the last analysed
+ * frame. When the table is full the stream idle the longest is forgotten.
+ */
+static void stream_state_store(uint64_t stream,
+                               const MotionSignature *signature,
+                               const PipelineResult *result,
+                               bool keyframe) {
+    pthread_mutex_lock(&stream_mutex);
+    if (stream_states == NULL) {
+        pthread_mutex_unlock(&stream_mutex);
+        return;
+    }
+    StreamState *slot = NULL;
+    StreamState *oldest = &stream_states[0];
+    for (size_t i = 0; i < PIPELINE_MAX_STREAMS; i++) {
+        StreamState *candidate = &stream_states[i];
+        if (candidate->valid && candidate->stream == stream) {
+            slot = candidate;
+            break;
+        }
+        if (!candidate->valid) {
+            if (oldest->valid) {
+                oldest = candidate;
+            }
+        } else if (oldest->valid && candidate->seq < oldest->seq) {
+            oldest = candidate;
+        }
+    }
+
+    if (slot == NULL) {
+        slot = oldest;
+        slot->valid = true;
+        slot->stream = stream;
+        slot->seq = 0;
+        keyframe = true;
+    }
+    if (result->seq > slot->seq) {
+        slot->seq = result->seq;
+        if (!result->motion_skipped) {
+            slot->signature = *signature;
+        }
+        slot->frames_since_keyframe = keyframe ? 0 : slot->frames_since_keyframe + 1;
+        slot->result = *result;
+    }
+    pthread_mutex_unlock(&stream_mutex);
+}
+
+static bool frame_unchanged(const StreamState *previous,
+                            const MotionSignature *signature,
+                            const PipelineResult *result) {
+    return previous->result.frame_width == result->frame_width &&
+           previous->result.frame_height == result->frame_height &&
+           motion_changed_cells(&previous->signature, signature, MOTION_CELL_THRESHOLD) <
+               MOTION_MIN_CHANGED_CELLS;
+}
+
+static void reuse_previous_faces(const StreamState *previous, PipelineResult *result) {
+    result->motion_skipped = true;
+    result->face_count = previous->result.face_count;
+    result->embedding_dim = previous->result.embedding_dim;
+    for (size_t i = 0; i < result->face_count; i++) {
+        result->faces[i] = previous->result.faces[i];
+        result->faces[i].embedding_reused = result->faces[i].has_embedding;
+    }
+}
+
+/*
+ * Carries track ids and identities over from the previous frame. A face that
+ * barely moved also keeps its embedding; anything new or moved is queued for
+ * embedding.
+ */
+static void track_faces(const StreamState *previous,
+                        bool allow_reuse,
+                        const ImageBuffer *image,
+                        const FaceBox *boxes,
+                        FaceBatch *faces,
+                        PipelineResult *result) {
+    int match[PIPELINE_MAX_FACES];
+    float iou[PIPELINE_MAX_FACES];
+    size_t count = result->face_count;
+    for (size_t i = 0; i < count; i++) {
+        match[i] = -1;
+    }
+    if (previous != NULL) {
+        FaceBox previous_boxes[PIPELINE_MAX_FACES];
+        for (size_t j = 0; j < previous->result.face_count; j++) {
+            previous_boxes[j] = previous->result.faces[j].box;
+        }
+        FaceBox current_boxes[PIPELINE_MAX_FACES];
+        for (size_t i = 0; i < count; i++) {
+            current_boxes[i] = result->faces[i].box;
+        }
+        face_tracker_associate(previous_boxes, previous->result.face_count, current_boxes, count,
+                               FACE_TRACK_MIN_IOU, match, iou);
+    }
+
+    if (faces != NULL) {
+        result->embedding_dim = embedding_model_dim(engines.embedder);
+    }
+    for (size_t i = 0; i < count; i++) {
+        PipelineFace *face = &result->faces[i];
+        const PipelineFace *before = match[i] >= 0 ? &previous->result.faces[match[i]] : NULL;
+        face->track_id =
+            before != NULL ? before->track_id : atomic_fetch_add(&next_track_id, 1) + 1;
+        if (before != NULL) {
+            face->identified = before->identified;
+            face->identity = before->identity;
+            face->similarity = before->similarity;
+        }
+
+        if (allow_reuse && before != NULL && before->has_embedding &&
+            iou[i] >= FACE_TRACK_REUSE_IOU &&
+            result->embedding_dim == previous->result.embedding_dim) {
+            face->has_embedding = true;
+            face->embedding_reused = true;
+            memcpy(face->embedding, before->embedding, result->embedding_dim * sizeof(float));
+        } else if (faces != NULL) {
+            face_batch_add(faces, image, &boxes[i], result, face);
+        }
+    }
+}
+
+/*
+ * Decodes and detects one frame. With a previous state for the stream, a
+ * frame whose motion signature barely changed skips detection and reuses the
+ * previous faces outright, and detected faces inherit tracks (and, if they
+ * did not move, embeddings). Face crops are queued on `faces` rather than
+ * embedded here, so the caller must flush the batch before reading
+ * embeddings from `result`.
+ */
+static bool analyze_frame(const unsigned char *data,
+                          size_t length,
+                          const StreamState *previous,
+                          bool allow_reuse,
+                          FaceBatch *faces,
+                          PipelineResult *result,
+                          MotionSignature *signature) {
+    ImageBuffer *image = image_pool_acquire();
+    if (image == NULL) {
+        return false;
+    }
+
+    JpegDecodeStats decode_stats;
+    TRACE_START(decode_start);
+    PERF_START(perf_decode);
+    bool decoded = jpeg_decode_frame(data, length, DETECTOR_INPUT_WIDTH, DETECTOR_INPUT_HEIGHT,
+                                     image, &decode_stats);
+    TRACE_END("decode", decode_start);
+    PERF_END(PERF_STAGE_DECODE, perf_decode);
+    if (!decoded) {
+        image_pool_release(image);
+        return false;
+    }
+
+    memset(result, 0, sizeof(*result));
+    result->frame_width = decode_stats.source_width;
+    result->frame_height = decode_stats.source_height;
+    result->decode_us = decode_stats.decode_us;
+
+    if (signature != NULL) {
+        motion_signature_compute(image->gray, image->width, image->height, image->stride,
+                                 signature);
+        if (previous != NULL && allow_reuse && frame_unchanged(previous, signature, result)) {
+            reuse_previous_faces(previous, result);
+            image_pool_release(image);
+            return true;
+        }
+    }
+
+    if (engines.detector != NULL) {
+        FaceBox boxes[PIPELINE_MAX_FACES];
+        FaceDetectParams params = face_detect_default_params();
+        TRACE_START(trace_start);
+        PERF_START(perf_detect);
+        uint64_t detect_start = monotonic_us();
+        size_t count = face_detector_detect(engines.detector, image->gray, image->width,
+                                            image->height, image->stride, &params, boxes,
+                                            PIPELINE_MAX_FACES);
+        result->detect_us = monotonic_us() - detect_start;
+        TRACE_END("detect", trace_start);
+        PERF_END(PERF_STAGE_DETECT, perf_detect);
+        result->face_count = count;
+
+        double sx = (double)decode_stats.source_width / image->width;
+        double sy = (double)decode_stats.source_height / image->height;
+        for (size_t i = 0; i < count; i++) {
+            result->faces[i].box = boxes[i];
+            scale_box(&result->faces[i].box, sx, sy);
+        }
+        track_faces(previous, allow_reuse, image, boxes, faces, result);
+    }
+
+    image_pool_release(image);
+    return true;
+}
+
+/*
+ * Looks freshly embedded faces up in the gallery; a reused embedding keeps the
+ * identity its track already had. An event goes out only when a track gains
+ * or changes identity, so someone standing in view is announced once rather
+ * than on every frame.
+ */
+static size_t identify_faces(const char *stream_id, PipelineResult *result) {
+    GalleryStoreStats gallery;
+    gallery_store_stats(&gallery);
+    if (gallery.dim == 0 || gallery.dim != result->embedding_dim) {
+        return 0;
+    }
+    size_t identified = 0;
+    for (size_t i = 0; i < result->face_count; i++) {
+        PipelineFace *face = &result->faces[i];
+        if (!face->has_embedding || face->embedding_reused) {
+            continue;
+        }
+        uint64_t known = face->identified ? face->identity.id : 0;
+        GalleryStoreMatch match;
+        face->identified =
+            gallery_shards_search(face->embedding, result->embedding_dim, 1,
+                                  RECOGNIZE_MIN_SIMILARITY, &match, NULL) == 1;
+        if (!face->identified) {
+            memset(&face->identity, 0, sizeof(face->identity));
+            face->similarity = 0.0f;
+            continue;
+        }
+        face->identity = match.identity;
+        face->similarity = match.similarity;
+        identified++;
+        if (match.identity.id != known) {
+            RecognitionEvent event;
+            memset(&event, 0, sizeof(event));
+            snprintf(event.stream, sizeof(event.stream), "%s", stream_id);
+            event.identity = match.identity;
+            event.track_id = face->track_id;
+            event.similarity = match.similarity;
+            event.frame_seq = result->seq;
+            event.time_ms = wall_clock_ms();
+            event_feed_publish_recognition(&event);
+        }
+    }
+    return identified;
+}
+
+static void process_batch(WorkerState *state, size_t count) {
+    TRACE_START(batch_start);
+    uint64_t compute_start = monotonic_us();
+    for (size_t i = 0; i < count; i++) {
+        const BatchItem *item = &state->items[i];
+        const FrameJob *job = (const FrameJob *)item->payload;
+        /* Per-frame spans carry the id of the POST that submitted the frame. */
+        trace_set_request(job->trace_id);
+        TRACE_SPAN("queue", job->trace_queued, batch_start, job->trace_id);
+        const StreamState *previous = NULL;
+        if (stream_state_load(item->stream, &state->previous)) {
+            previous = &state->previous;
+        }
+        state->keyframe[i] =
+            previous == NULL || previous->frames_since_keyframe >= MOTION_KEYFRAME_INTERVAL;
+        state->analyzed[i] = analyze_frame(job->data, job->length, previous, !state->keyframe[i],
+                                           state->faces, &state->results[i],
+                                           &state->signatures[i]);
+        state->results[i].seq = item->seq;
+    }
+    trace_set_request(0);
+    face_batch_flush(state->faces);
+    size_t identified = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (state->analyzed[i] && !state->results[i].motion_skipped) {
+            const FrameJob *job = (const FrameJob *)state->items[i].payload;
+            TRACE_START(identify_start);
+            PERF_START(perf_search);
+            identified += identify_faces(job->stream_id, &state->results[i]);
+            TRACE_END_ID("identify", identify_start, job->trace_id);
+            PERF_END(PERF_STAGE_SEARCH, perf_search);
+        }
+    }
+    batch_scheduler_complete(scheduler, count, monotonic_us() - compute_start);
+    TRACE_END("batch", batch_start);
+
+    size_t processed = 0;
+    size_t skipped = 0;
+    size_t reused = 0;
+    size_t computed = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!state->analyzed[i]) {
+            continue;
+        }
+        const PipelineResult *result = &state->results[i];
+        processed++;
+        skipped += result->motion_skipped ? 1 : 0;
+        for (size_t f = 0; f < result->face_count; f++) {
+            reused += result->faces[f].embedding_reused ? 1 : 0;
+            computed += result->faces[f].has_embedding && !result->faces[f].embedding_reused;
+        }
+        stream_state_store(state->items[i].stream, &state->signatures[i], result,
+                           state->keyframe[i]);
+    }
+    pthread_mutex_lock(&state_mutex);
+    stats.processed += processed;
+    stats.decode_failures += count - processed;
+    stats.motion_skipped += skipped;
+    stats.embeddings_reused += reused;
+    stats.embeddings_computed += computed;
+    stats.identifications += identified;
+    pthread_mutex_unlock(&state_mutex);
+
+    for (size_t i = 0; i < count; i++) {
+        mark_completed(state->items[i].seq, state->analyzed[i] ? &state->results[i] : NULL);
+        free(state->items[i].payload);
+    }
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    WorkerState *state = (WorkerState *)calloc(1, sizeof(*state));
+    if (state == NULL) {
+        return NULL;
+    }
+    state->faces = face_batch_create(PIPELINE_EMBED_BATCH);
+    trace_set_thread_name("pipeline");
+    perf_set_thread_name("pipeline");
+    for (;;) {
+        size_t count = batch_scheduler_next(scheduler, state->items, PIPELINE_MAX_BATCH);
+        if (count == 0) {
+            break;
+        }
+        process_batch(state, count);
+    }
+    face_batch_free(state->faces);
+    free(state);
+    return NULL;
+}
+
+bool pipeline_start(const PipelineEngines *engines_in, size_t workers_requested, size_t capacity) {
+    if (workers_requested == 0 || workers_requested > MAX_PIPELINE_WORKERS || capacity == 0) {
+        return false;
+    }
+
+    pthread_mutex_lock(&state_mutex);
+    if (running) {
+        pthread_mutex_unlock(&state_mutex);
+        return false;
+    }
+    BatchSchedulerParams params;
+    params.capacity = capacity;
+    params.max_batch = capacity < PIPELINE_MAX_BATCH ? capacity : PIPELINE_MAX_BATCH;
+    params.max_wait_us = PIPELINE_BATCH_WAIT_US;
+    params.latency_slo_us = PIPELINE_LATENCY_SLO_US;
+    scheduler = batch_scheduler_create(&params);
+    if (scheduler == NULL) {
+        pthread_mutex_unlock(&state_mutex);
+        return false;
+    }
+    pthread_mutex_lock(&stream_mutex);
+    stream_states = (StreamState *)calloc(PIPELINE_MAX_STREAMS, sizeof(*stream_states));
+    pthread_mutex_unlock(&stream_mutex);
+    if (stream_states == NULL) {
+        batch_scheduler_free(scheduler);
+        scheduler = NULL;
+        pthread_mutex_unlock(&state_mutex);
+        return false;
+    }
+    memset(&stats, 0, sizeof(stats));
+    stats.queue_capacity = capacity;
+    stats.workers = workers_requested;
+    if (engines_in != NULL) {
+        engines = *engines_in;
+    } else {
+        memset(&engines, 0, sizeof(engines));
+    }
+    running = true;
+    pthread_mutex_unlock(&state_mutex);
+
+    for (worker_count = 0; worker_count < workers_requested; worker_count++) {
+        if (pthread_create(&workers[worker_count], NULL, worker_main, NULL) != 0) {
+            perror("pthread_create");
+            pipeline_stop();
+            return false;
+        }
+    }
+    return true;
+}
+
+void pipeline_stop(void) {
+    pthread_mutex_lock(&state_mutex);
+    running = false;
+    if (scheduler != NULL) {
+        batch_scheduler_shutdown(scheduler);
+    }
+    pthread_mutex_unlock(&state_mutex);
+
+    /* Workers drain whatever is still queued before they exit. */
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    worker_count = 0;
+
+    pthread_mutex_lock(&state_mutex);
+    batch_scheduler_free(scheduler);
+    scheduler = NULL;
+    pthread_mutex_unlock(&state_mutex);
+
+    pthread_mutex_lock(&stream_mutex);
+    free(stream_states);
+    stream_states = NULL;
+    pthread_mutex_unlock(&stream_mutex);
+
+    pthread_mutex_lock(&spare_mutex);
+    while (spare_count > 0) {
+        face_batch_free(spare_batches[--spare_count]);
+    }
+    pthread_mutex_unlock(&spare_mutex);
+
+    pthread_mutex_lock(&state_mutex);
+    memset(&engines, 0, sizeof(engines));
+    pthread_mutex_unlock(&state_mutex);
+}
+
+bool pipeline_running(void) {
+    pthread_mutex_lock(&state_mutex);
+    bool result = running;
+    pthread_mutex_unlock(&state_mutex);
+    return result;
+}
+
+uint64_t pipeline_stream_key(const char *stream_id) {
+    if (stream_id == NULL || stream_id[0] == '\0') {
+        return 0;
+    }
+    uint64_t hash = 1469598103934665603ull;
+    for (const unsigned char *p = (const unsigned char *)stream_id; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/*
+ * Queues a frame for analysis. A frame still waiting from the same stream is
+ * superseded by this one; when the queue is full the oldest frame of any
+ * stream is evicted. Either way the displaced frame completes with no result.
+ * A NULL or empty `stream_id` is the default stream.
+ */
+bool pipeline_submit_frame(const char *stream_id,
+                           const unsigned char *data,
+                           size_t length,
+                           uint64_t *seq_out) {
+    if (data == NULL || length == 0) {
+        return false;
+    }
+
+    FrameJob *job = (FrameJob *)malloc(sizeof(FrameJob) + length);
+    if (job == NULL) {
+        return false;
+    }
+    uint64_t stream = pipeline_stream_key(stream_id);
+    snprintf(job->stream_id, sizeof(job->stream_id), "%s", stream_id != NULL ? stream_id : "");
+    job->trace_id = trace_current_request();
+    job->trace_queued = trace_clock();
+    job->length = length;
+    memcpy(job->data, data, length);
+
+    BatchItem displaced;
+    bool has_displaced = false;
+    pthread_mutex_lock(&state_mutex);
+    if (!running) {
+        pthread_mutex_unlock(&state_mutex);
+        free(job);
+        return false;
+    }
+    uint64_t seq = ++next_seq;
+    batch_scheduler_submit(scheduler, stream, seq, job, &displaced, &has_displaced);
+    stats.submitted++;
+    if (has_displaced) {
+        if (displaced.stream == stream) {
+            stats.stale_dropped++;
+        } else {
+            stats.dropped++;
+        }
+    }
+    pthread_mutex_unlock(&state_mutex);
+
+    if (has_displaced) {
+        mark_completed(displaced.seq, NULL);
+        free(displaced.payload);
+    }
+    if (seq_out != NULL) {
+        *seq_out = seq;
+    }
+    return true;
+}
+
+/*
+ * Runs decode, detection and embedding on the calling thread, bypassing the
+ * frame queue. Enrollment needs the result for this exact image, not the
+ * latest frame, and must never be dropped by queue eviction.
+ */
+bool pipeline_extract_faces(const unsigned char *data, size_t length, PipelineResult *out) {
+    if (data == NULL || length == 0 || out == NULL) {
+        return false;
+    }
+
+    FaceBatch *faces = NULL;
+    if (engines.embedder != NULL) {
+        pthread_mutex_lock(&spare_mutex);
+        if (spare_count > 0) {
+            faces = spare_batches[--spare_count];
+        }
+        pthread_mutex_unlock(&spare_mutex);
+        if (faces == NULL) {
+            faces = face_batch_create(PIPELINE_EMBED_BATCH);
+        }
+    }
+
+    bool ok = analyze_frame(data, length, NULL, false, faces, out, NULL);
+    face_batch_flush(faces);
+
+    if (faces != NULL) {
+        pthread_mutex_lock(&spare_mutex);
+        if (spare_count < MAX_PIPELINE_WORKERS) {
+            spare_batches[spare_count++] = faces;
+            faces = NULL;
+        }
+        pthread_mutex_unlock(&spare_mutex);
+        face_batch_free(faces);
+    }
+    return ok;
+}
+
+bool pipeline_wait_for_seq(uint64_t seq, int timeout_ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&result_mutex);
+    int rc = 0;
+    while (completed_seq < seq && rc != ETIMEDOUT) {
+        rc = pthread_cond_timedwait(&result_cond, &result_mutex, &deadline);
+    }
+    bool done = completed_seq >= seq;
+    pthread_mutex_unlock(&result_mutex);
+    return done;
+}
+
+void pipeline_latest_result(PipelineResult *out) {
+    pthread_mutex_lock(&result_mutex);
+    *out = latest_result;
+    pthread_mutex_unlock(&result_mutex);
+}
+
+void pipeline_stats(PipelineStats *out) {
+    pthread_mutex_lock(&state_mutex);
+    *out = stats;
+    if (scheduler != NULL) {
+        BatchSchedulerStats batching;
+        batch_scheduler_stats(scheduler, &batching);
+        out->queue_depth = batching.queue_depth;
+        out->batches = batching.batches;
+        out->batched_frames = batching.items;
+        out->target_batch = batching.target_batch;
+        out->queue_wait_us = batching.queue_wait_us;
+        out->max_queue_wait_us = batching.max_queue_wait_us;
+        out->compute_us = batching.compute_us;
+        out->frame_cost_us = batching.item_cost_us;
+    }
+    pthread_mutex_unlock(&state_mutex);
+}
+
+size_t pipeline_format_stats_json(const PipelineStats *stats_in, char *buffer, size_t capacity) {
+    double frames = stats_in->batched_frames > 0 ? (double)stats_in->batched_frames : 1.0;
+    double batches = stats_in->batches > 0 ? (double)stats_in->batches : 1.0;
+    int n = snprintf(buffer, capacity,
+                     "{\"submitted\":%llu,\"processed\":%llu,\"dropped\":%llu,"
+                     "\"stale_dropped\":%llu,\"decode_failures\":%llu,\"motion_skipped\":%llu,"
+                     "\"embeddings_reused\":%llu,\"embeddings_computed\":%llu,"
+                     "\"identifications\":%llu,\"queue_depth\":%zu,\"queue_capacity\":%zu,"
+                     "\"workers\":%zu,"
+                     "\"batches\":%llu,\"mean_batch\":%.2f,\"target_batch\":%zu,"
+                     "\"mean_queue_wait_ms\":%.3f,\"max_queue_wait_ms\":%.3f,"
+                     "\"mean_compute_ms\":%.3f,\"frame_cost_ms\":%.3f}",
+                     (unsigned long long)stats_in->submitted,
+                     (unsigned long long)stats_in->processed,
+                     (unsigned long long)stats_in->dropped,
+                     (unsigned long long)stats_in->stale_dropped,
+                     (unsigned long long)stats_in->decode_failures,
+                     (unsigned long long)stats_in->motion_skipped,
+                     (unsigned long long)stats_in->embeddings_reused,
+                     (unsigned long long)stats_in->embeddings_computed,
+                     (unsigned long long)stats_in->identifications, stats_in->queue_depth,
+                     stats_in->queue_capacity, stats_in->workers,
+                     (unsigned long long)stats_in->batches,
+                     (double)stats_in->batched_frames / batches, stats_in->target_batch,
+                     (double)stats_in->queue_wait_us / frames / 1000.0,
+                     (double)stats_in->max_queue_wait_us / 1000.0,
+                     (double)stats_in->compute_us / frames / 1000.0,
+                     (double)stats_in->frame_cost_us / 1000.0);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
+
+/*
+ * Buffer size that always fits pipeline_format_faces_json(): the header,
+ * then per face five numbers of up to 11 characters, the keys and a name
+ * escaped to at most twice its length.
+ */
+size_t pipeline_faces_json_capacity(const PipelineResult *result) {
+    return 256 + result->face_count * (2 * GALLERY_NAME_MAX + 128);
+}
+
+size_t pipeline_format_faces_json(const PipelineResult *result, char *buffer, size_t capacity) {
+    size_t used = 0;
+    int n = snprintf(buffer, capacity,
+                     "{\"seq\":%llu,\"width\":%d,\"height\":%d,\"decode_ms\":%.3f,"
+                     "\"detect_ms\":%.3f,\"embed_ms\":%.3f,\"motion_skipped\":%s,\"faces\":[",
+                     (unsigned long long)result->seq, result->frame_width, result->frame_height,
+                     (double)result->decode_us / 1000.0, (double)result->detect_us / 1000.0,
+                     (double)result->embed_us / 1000.0, result->motion_skipped ? "true" : "false");
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    used = (size_t)n;
+
+    for (size_t i = 0; i < result->face_count; i++) {
+        const PipelineFace *face = &result->faces[i];
+        const FaceBox *box = &face->box;
+        if (face->identified) {
+            char name[2 * sizeof(face->identity.name)];
+            http_json_escape(name, sizeof(name), face->identity.name);
+            n = snprintf(buffer + used, capacity - used,
+                         "%s{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"track\":%u,"
+                         "\"identity\":\"%s\"}",
+                         i > 0 ? "," : "", box->x, box->y, box->width, box->height,
+                         (unsigned)face->track_id, name);
+        } else {
+            n = snprintf(buffer + used, capacity - used,
+                         "%s{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"track\":%u}",
+                         i > 0 ? "," : "", box->x, box->y, box->width, box->height,
+                         (unsigned)face->track_id);
+        }
+        if (n < 0 || (size_t)n >= capacity - used) {
+            return 0;
+        }
+        used += (size_t)n;
+    }
+
+    n = snprintf(buffer + used, capacity - used, "]}");
+    if (n < 0 || (size_t)n >= capacity - used) {
+        return 0;
+    }
+    return used + (size_t)n;
+}
@@ -0,0 +1,85 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "embedding.h"
+#include "face_detect.h"
+#include "gallery_store.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define PIPELINE_MAX_FACES 32
+#define PIPELINE_STREAM_ID_MAX 64
+
+typedef struct {
+    const FaceDetector *detector;
+    const EmbeddingModel *embedder;
+    EmbeddingPrecision embedding_precision;
+} PipelineEngines;
+
+typedef struct {
+    FaceBox box;
+    uint32_t track_id;
+    bool has_embedding;
+    bool embedding_reused;
+    bool identified;
+    GalleryIdentity identity;
+    float similarity;
+    float embedding[EMBEDDING_MAX_DIM];
+} PipelineFace;
+
+typedef struct {
+    uint64_t seq;
+    int frame_width;
+    int frame_height;
+    uint64_t decode_us;
+    uint64_t detect_us;
+    uint64_t embed_us;
+    bool motion_skipped;
+    size_t embedding_dim;
+    size_t face_count;
+    PipelineFace faces[PIPELINE_MAX_FACES];
+} PipelineResult;
+
+typedef struct {
+    uint64_t submitted;
+    uint64_t dropped;
+    uint64_t stale_dropped;
+    uint64_t processed;
+    uint64_t decode_failures;
+    uint64_t motion_skipped;
+    uint64_t embeddings_reused;
+    uint64_t embeddings_computed;
+    uint64_t identifications;
+    size_t queue_depth;
+    size_t queue_capacity;
+    size_t workers;
+    uint64_t batches;
+    uint64_t batched_frames;
+    size_t target_batch;
+    uint64_t queue_wait_us;
+    uint64_t max_queue_wait_us;
+    uint64_t compute_us;
+    uint64_t frame_cost_us;
+} PipelineStats;
+
+bool pipeline_start(const PipelineEngines *engines, size_t worker_count, size_t queue_capacity);
+void pipeline_stop(void);
+bool pipeline_running(void);
+
+uint64_t pipeline_stream_key(const char *stream_id);
+bool pipeline_submit_frame(const char *stream_id,
+                           const unsigned char *data,
+                           size_t length,
+                           uint64_t *seq_out);
+bool pipeline_extract_faces(const unsigned char *data, size_t length, PipelineResult *out);
+bool pipeline_wait_for_seq(uint64_t seq, int timeout_ms);
+
+void pipeline_latest_result(PipelineResult *out);
+void pipeline_stats(PipelineStats *out);
+size_t pipeline_format_stats_json(const PipelineStats *stats, char *buffer, size_t capacity);
+size_t pipeline_format_faces_json(const PipelineResult *result, char *buffer, size_t capacity);
+size_t pipeline_faces_json_capacity(const PipelineResult *result);
+
+#endif
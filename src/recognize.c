@@ -0,0 +1,280 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "recognize.h"
+
+#include "access_log.h"
+#include "gallery_shard.h"
+#include "perf_counters.h"
+#include "server_config.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    int client_fd;
+    uint64_t trace_id;
+    uint64_t trace_submitted;
+    uint64_t read_us;
+    uint64_t submitted_us;
+    char method[8];
+    char path[256];
+    char stream_id[64];
+    size_t length;
+    unsigned char data[];
+} RecognizeJob;
+
+static pthread_mutex_t recognize_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThreadPool *compute_pool = NULL;
+static size_t in_flight_limit = 0;
+static RecognizeStats stats;
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+bool recognize_start(size_t worker_count, size_t max_in_flight) {
+    if (worker_count == 0 || max_in_flight == 0) {
+        return false;
+    }
+    pthread_mutex_lock(&recognize_mutex);
+    if (compute_pool != NULL) {
+        pthread_mutex_unlock(&recognize_mutex);
+        return false;
+    }
+    compute_pool = thread_pool_create(worker_count, max_in_flight);
+    in_flight_limit = max_in_flight;
+    memset(&stats, 0, sizeof(stats));
+    bool ok = compute_pool != NULL;
+    pthread_mutex_unlock(&recognize_mutex);
+    return ok;
+}
+
+/* Requests already accepted are answered before the pool goes away. */
+void recognize_stop(void) {
+    pthread_mutex_lock(&recognize_mutex);
+    ThreadPool *pool = compute_pool;
+    compute_pool = NULL;
+    in_flight_limit = 0;
+    pthread_mutex_unlock(&recognize_mutex);
+    thread_pool_destroy(pool);
+}
+
+static void search_faces(const PipelineResult *faces, RecognizeResult *out) {
+    GalleryStoreStats gallery;
+    gallery_store_stats(&gallery);
+    TRACE_START(trace_start);
+    PERF_START(perf_search);
+    uint64_t search_start = monotonic_us();
+    for (size_t i = 0; i < faces->face_count; i++) {
+        const PipelineFace *face = &faces->faces[i];
+        RecognizedFace *recognized = &out->faces[i];
+        recognized->box = face->box;
+        if (!face->has_embedding || gallery.dim == 0 || gallery.dim != faces->embedding_dim) {
+            continue;
+        }
+        GalleryStoreMatch match;
+        if (gallery_shards_search(face->embedding, faces->embedding_dim, 1,
+                                  RECOGNIZE_MIN_SIMILARITY, &match, NULL) == 1) {
+            recognized->identified = true;
+            recognized->identity = match.identity;
+            recognized->similarity = match.similarity;
+        }
+    }
+    out->search_us = monotonic_us() - search_start;
+    TRACE_END("search", trace_start);
+    PERF_END(PERF_STAGE_SEARCH, perf_search);
+    out->face_count = faces->face_count;
+}
+
+/*
+ * Decode, detect, embed and search one image on the calling thread. Returns
+ * the HTTP status: 200, 422 when the body is not a decodable JPEG, 500 when
+ * out of memory.
+ */
+int recognize_frame(const unsigned char *data, size_t length, RecognizeResult *out) {
+    memset(out, 0, sizeof(*out));
+    PipelineResult *faces = (PipelineResult *)malloc(sizeof(*faces));
+    if (faces == NULL) {
+        return 500;
+    }
+    if (!pipeline_extract_faces(data, length, faces)) {
+        free(faces);
+        return 422;
+    }
+    out->frame_width = faces->frame_width;
+    out->frame_height = faces->frame_height;
+    out->decode_us = faces->decode_us;
+    out->detect_us = faces->detect_us;
+    out->embed_us = faces->embed_us;
+    search_faces(faces, out);
+    free(faces);
+    return 200;
+}
+
+/* Logged here rather than by the accept loop, which answered nothing. */
+static void finish_job(RecognizeJob *job) {
+    int status = 0;
+    size_t bytes = 0;
+    if (http_last_response(&status, &bytes)) {
+        access_log_record(job->method, job->path, job->stream_id, status, bytes,
+                          job->read_us + (monotonic_us() - job->submitted_us));
+    }
+    close(job->client_fd);
+    free(job);
+    pthread_mutex_lock(&recognize_mutex);
+    stats.in_flight--;
+    stats.completed++;
+    pthread_mutex_unlock(&recognize_mutex);
+}
+
+static void run_job(void *arg) {
+    RecognizeJob *job = (RecognizeJob *)arg;
+    uint64_t started_us = monotonic_us();
+    http_response_reset();
+    trace_set_thread_name("recognize");
+    perf_set_thread_name("recognize");
+    trace_set_request(job->trace_id);
+    TRACE_START(trace_start);
+    TRACE_SPAN("queue", job->trace_submitted, trace_start, job->trace_id);
+    RecognizeResult *result = (RecognizeResult *)malloc(sizeof(*result));
+    int status = result != NULL ? recognize_frame(job->data, job->length, result) : 500;
+    TRACE_END("recognize", trace_start);
+    if (status != 200) {
+        send_error_response(job->client_fd, status);
+        free(result);
+        finish_job(job);
+        return;
+    }
+    result->read_us = job->read_us;
+    result->queue_us = started_us - job->submitted_us;
+    result->total_us = job->read_us + (monotonic_us() - job->submitted_us);
+
+    size_t capacity = 256 + result->face_count * (GALLERY_NAME_MAX + 160);
+    char *body = (char *)malloc(capacity);
+    size_t body_length = body != NULL ? recognize_format_json(result, body, capacity) : 0;
+    char timing[256];
+    char headers[384];
+    if (body_length == 0 || recognize_format_server_timing(result, timing, sizeof(timing)) == 0) {
+        send_error_response(job->client_fd, 500);
+    } else {
+        snprintf(headers, sizeof(headers), "Cache-Control: no-store\r\nServer-Timing: %s\r\n",
+                 timing);
+        send_http_response(job->client_fd, "200 OK", "application/json", body, body_length,
+                           headers);
+    }
+    free(body);
+    free(result);
+    finish_job(job);
+}
+
+/*
+ * Hands the request to the compute pool and returns at once, so the accept
+ * loop keeps relaying frames. The pool answers on a dup of the socket; the
+ * caller closes its own descriptor as usual. Returns false when
+ * `max_in_flight` requests are already queued or running.
+ */
+bool recognize_submit(int client_fd, const HttpRequest *request) {
+    RecognizeJob *job = (RecognizeJob *)malloc(sizeof(RecognizeJob) + request->body_length);
+    if (job == NULL) {
+        return false;
+    }
+    job->trace_id = trace_current_request();
+    job->read_us = request->read_us;
+    memcpy(job->method, request->method, sizeof(job->method));
+    memcpy(job->path, request->path, sizeof(job->path));
+    memcpy(job->stream_id, request->stream_id, sizeof(job->stream_id));
+    job->length = request->body_length;
+    memcpy(job->data, request->body, request->body_length);
+
+    pthread_mutex_lock(&recognize_mutex);
+    if (compute_pool == NULL || stats.in_flight >= in_flight_limit) {
+        stats.rejected++;
+        pthread_mutex_unlock(&recognize_mutex);
+        free(job);
+        return false;
+    }
+    job->client_fd = dup(client_fd);
+    job->submitted_us = monotonic_us();
+    job->trace_submitted = trace_clock();
+    if (job->client_fd < 0 || !thread_pool_submit(compute_pool, run_job, job)) {
+        stats.rejected++;
+        pthread_mutex_unlock(&recognize_mutex);
+        if (job->client_fd >= 0) {
+            close(job->client_fd);
+        }
+        free(job);
+        return false;
+    }
+    stats.in_flight++;
+    stats.accepted++;
+    pthread_mutex_unlock(&recognize_mutex);
+    return true;
+}
+
+void recognize_stats(RecognizeStats *out) {
+    pthread_mutex_lock(&recognize_mutex);
+    *out = stats;
+    pthread_mutex_unlock(&recognize_mutex);
+}
+
+size_t recognize_format_json(const RecognizeResult *result, char *buffer, size_t capacity) {
+    int n = snprintf(buffer, capacity, "{\"width\":%d,\"height\":%d,\"faces\":[",
+                     result->frame_width, result->frame_height);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    size_t used = (size_t)n;
+
+    for (size_t i = 0; i < result->face_count; i++) {
+        const RecognizedFace *face = &result->faces[i];
+        const FaceBox *box = &face->box;
+        if (face->identified) {
+            n = snprintf(buffer + used, capacity - used,
+                         "%s{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"identity\":\"%s\",\"id\":%llu,"
+                         "\"similarity\":%.4f}",
+                         i > 0 ? "," : "", box->x, box->y, box->width, box->height,
+                         face->identity.name, (unsigned long long)face->identity.id,
+                         (double)face->similarity);
+        } else {
+            n = snprintf(buffer + used, capacity - used,
+                         "%s{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d,\"identity\":null}",
+                         i > 0 ? "," : "", box->x, box->y, box->width, box->height);
+        }
+        if (n < 0 || (size_t)n >= capacity - used) {
+            return 0;
+        }
+        used += (size_t)n;
+    }
+
+    n = snprintf(buffer + used, capacity - used, "]}");
+    if (n < 0 || (size_t)n >= capacity - used) {
+        return 0;
+    }
+    return used + (size_t)n;
+}
+
+size_t recognize_format_server_timing(const RecognizeResult *result,
+                                      char *buffer,
+                                      size_t capacity) {
+    int n = snprintf(buffer, capacity,
+                     "read;dur=%.3f, queue;dur=%.3f, decode;dur=%.3f, detect;dur=%.3f, "
+                     "embed;dur=%.3f, search;dur=%.3f, total;dur=%.3f",
+                     (double)result->read_us / 1000.0, (double)result->queue_us / 1000.0,
+                     (double)result->decode_us / 1000.0, (double)result->detect_us / 1000.0,
+                     (double)result->embed_us / 1000.0, (double)result->search_us / 1000.0,
+                     (double)result->total_us / 1000.0);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
@@ -0,0 +1,52 @@
+#ifndef RECOGNIZE_H
+#define RECOGNIZE_H
+
+#include "gallery_store.h"
+#include "http.h"
+#include "pipeline.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    FaceBox box;
+    bool identified;
+    GalleryIdentity identity;
+    float similarity;
+} RecognizedFace;
+
+typedef struct {
+    int frame_width;
+    int frame_height;
+    uint64_t read_us;
+    uint64_t queue_us;
+    uint64_t decode_us;
+    uint64_t detect_us;
+    uint64_t embed_us;
+    uint64_t search_us;
+    uint64_t total_us;
+    size_t face_count;
+    RecognizedFace faces[PIPELINE_MAX_FACES];
+} RecognizeResult;
+
+typedef struct {
+    uint64_t accepted;
+    uint64_t rejected;
+    uint64_t completed;
+    size_t in_flight;
+} RecognizeStats;
+
+bool recognize_start(size_t worker_count, size_t max_in_flight);
+void recognize_stop(void);
+
+bool recognize_submit(int client_fd, const HttpRequest *request);
+int recognize_frame(const unsigned char *data, size_t length, RecognizeResult *out);
+
+void recognize_stats(RecognizeStats *out);
+size_t recognize_format_json(const RecognizeResult *result, char *buffer, size_t capacity);
+size_t recognize_format_server_timing(const RecognizeResult *result,
+                                      char *buffer,
+                                      size_t capacity);
+
+#endif
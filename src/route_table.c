@@ -0,0 +1,303 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "route_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const method_names[] = {"GET", "HEAD", "POST", "PUT", "DELETE", "PATCH",
+                                           "OPTIONS"};
+#define METHOD_COUNT (sizeof(method_names) / sizeof(method_names[0]))
+
+/*
+ * One path segment. Literal children are kept sorted so a lookup is a binary
+ * search per segment; at most one `{param}` child matches any other
+ * non-empty segment. A node with a non-zero method mask ends a route.
+ */
+typedef struct RouteNode {
+    char *segment;
+    size_t segment_length;
+    struct RouteNode **children;
+    size_t child_count;
+    struct RouteNode *param;
+    unsigned methods;
+    RouteHandler handlers[METHOD_COUNT];
+    const void *contexts[METHOD_COUNT];
+} RouteNode;
+
+struct RouteTable {
+    RouteNode root;
+};
+
+static int compare_segment(const char *segment, size_t length, const RouteNode *node) {
+    size_t common = length < node->segment_length ? length : node->segment_length;
+    int order = memcmp(segment, node->segment, common);
+    if (order != 0) {
+        return order;
+    }
+    return length < node->segment_length ? -1 : length > node->segment_length ? 1 : 0;
+}
+
+/* Returns the index of the child equal to `segment`, or where it would be inserted. */
+static size_t search_children(const RouteNode *node,
+                              const char *segment,
+                              size_t length,
+                              bool *found) {
+    size_t low = 0;
+    size_t high = node->child_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int order = compare_segment(segment, length, node->children[mid]);
+        if (order == 0) {
+            *found = true;
+            return mid;
+        }
+        if (order < 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
+    }
+    *found = false;
+    return low;
+}
+
+static RouteNode *new_node(const char *segment, size_t length) {
+    RouteNode *node = (RouteNode *)calloc(1, sizeof(*node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->segment = strndup(segment, length);
+    if (node->segment == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->segment_length = length;
+    return node;
+}
+
+static RouteNode *literal_child(RouteNode *node, const char *segment, size_t length) {
+    bool found = false;
+    size_t at = search_children(node, segment, length, &found);
+    if (found) {
+        return node->children[at];
+    }
+    RouteNode **grown =
+        (RouteNode **)realloc(node->children, (node->child_count + 1) * sizeof(*grown));
+    if (grown == NULL) {
+        return NULL;
+    }
+    node->children = grown;
+    RouteNode *child = new_node(segment, length);
+    if (child == NULL) {
+        return NULL;
+    }
+    memmove(&grown[at + 1], &grown[at], (node->child_count - at) * sizeof(*grown));
+    grown[at] = child;
+    node->child_count++;
+    return child;
+}
+
+/* `{name}` children must agree on the name, or one path would bind two names. */
+static RouteNode *param_child(RouteNode *node, const char *name, size_t length) {
+    if (node->param == NULL) {
+        node->param = new_node(name, length);
+        return node->param;
+    }
+    if (node->param->segment_length != length || memcmp(node->param->segment, name, length) != 0) {
+        return NULL;
+    }
+    return node->param;
+}
+
+static void free_children(RouteNode *node) {
+    for (size_t i = 0; i < node->child_count; i++) {
+        free_children(node->children[i]);
+        free(node->children[i]);
+    }
+    if (node->param != NULL) {
+        free_children(node->param);
+        free(node->param);
+    }
+    free(node->children);
+    free(node->segment);
+}
+
+RouteTable *route_table_create(void) {
+    return (RouteTable *)calloc(1, sizeof(RouteTable));
+}
+
+void route_table_free(RouteTable *table) {
+    if (table != NULL) {
+        free_children(&table->root);
+        free(table);
+    }
+}
+
+/*
+ * Registers `handler` for `methods` on `pattern`, a path whose segments are
+ * literals or `{name}` captures (`/api/gallery/{identity}`). Fails on a
+ * malformed pattern, a method already taken on the same path, or a capture
+ * renamed where another route already put one.
+ */
+bool route_table_add(RouteTable *table,
+                     unsigned methods,
+                     const char *pattern,
+                     RouteHandler handler,
+                     const void *context) {
+    if (pattern[0] != '/' || methods == 0 || (methods >> METHOD_COUNT) != 0 || handler == NULL) {
+        fprintf(stderr, "Invalid route: %s\n", pattern);
+        return false;
+    }
+    RouteNode *node = &table->root;
+    size_t param_count = 0;
+    const char *segment = pattern + 1;
+    for (;;) {
+        const char *slash = strchr(segment, '/');
+        size_t length = slash != NULL ? (size_t)(slash - segment) : strlen(segment);
+        if (length >= 2 && segment[0] == '{' && segment[length - 1] == '}') {
+            if (++param_count > ROUTE_MAX_PARAMS || length == 2) {
+                fprintf(stderr, "Invalid route: %s\n", pattern);
+                return false;
+            }
+            node = param_child(node, segment + 1, length - 2);
+        } else {
+            node = literal_child(node, segment, length);
+        }
+        if (node == NULL) {
+            fprintf(stderr, "Route conflicts with an earlier one: %s\n", pattern);
+            return false;
+        }
+        if (slash == NULL) {
+            break;
+        }
+        segment = slash + 1;
+    }
+
+    if ((node->methods & methods) != 0) {
+        fprintf(stderr, "Route registered twice: %s\n", pattern);
+        return false;
+    }
+    node->methods |= methods;
+    for (size_t i = 0; i < METHOD_COUNT; i++) {
+        if ((methods & (1u << i)) != 0) {
+            node->handlers[i] = handler;
+            node->contexts[i] = context;
+        }
+    }
+    return true;
+}
+
+/* Literal segments win over captures; a capture is tried only if the literal branch dead-ends. */
+static const RouteNode *match_path(const RouteNode *node, const char *path, RouteMatch *match) {
+    const char *slash = strchr(path, '/');
+    size_t length = slash != NULL ? (size_t)(slash - path) : strlen(path);
+
+    bool found = false;
+    size_t at = search_children(node, path, length, &found);
+    if (found) {
+        const RouteNode *child = node->children[at];
+        const RouteNode *end = slash != NULL ? match_path(child, slash + 1, match)
+                                             : (child->methods != 0 ? child : NULL);
+        if (end != NULL) {
+            return end;
+        }
+    }
+
+    if (node->param == NULL || length == 0 || match->param_count == ROUTE_MAX_PARAMS) {
+        return NULL;
+    }
+    size_t slot = match->param_count++;
+    match->params[slot].name = node->param->segment;
+    match->params[slot].value = path;
+    match->params[slot].length = length;
+    const RouteNode *end = slash != NULL ? match_path(node->param, slash + 1, match)
+                                         : (node->param->methods != 0 ? node->param : NULL);
+    if (end == NULL) {
+        match->param_count = slot;
+    }
+    return end;
+}
+
+/*
+ * Resolves `method path`: 200 with the handler, context and captures in
+ * `match`, 405 with the path's methods in `match->allowed`, or 404. The cost
+ * follows the depth of the path, not the number of routes.
+ */
+int route_table_lookup(const RouteTable *table,
+                       const char *method,
+                       const char *path,
+                       RouteMatch *match) {
+    memset(match, 0, sizeof(*match));
+    if (path[0] != '/') {
+        return 404;
+    }
+    const RouteNode *node = match_path(&table->root, path + 1, match);
+    if (node == NULL) {
+        match->param_count = 0;
+        return 404;
+    }
+    match->allowed = node->methods;
+    unsigned mask = route_method_mask(method);
+    if ((node->methods & mask) == 0) {
+        return 405;
+    }
+    for (size_t i = 0; i < METHOD_COUNT; i++) {
+        if (mask == 1u << i) {
+            match->handler = node->handlers[i];
+            match->context = node->contexts[i];
+            break;
+        }
+    }
+    return 200;
+}
+
+/* The mask bit for a request method, or 0 for one no route can register. */
+unsigned route_method_mask(const char *method) {
+    for (size_t i = 0; i < METHOD_COUNT; i++) {
+        if (strcmp(method, method_names[i]) == 0) {
+            return 1u << i;
+        }
+    }
+    return 0;
+}
+
+/* Formats an `Allow` header value such as `GET, POST`; returns its length, 0 if truncated. */
+size_t route_format_allow(unsigned methods, char *out, size_t capacity) {
+    size_t used = 0;
+    if (capacity > 0) {
+        out[0] = '\0';
+    }
+    for (size_t i = 0; i < METHOD_COUNT; i++) {
+        if ((methods & (1u << i)) == 0) {
+            continue;
+        }
+        int n = snprintf(out + used, capacity - used, "%s%s", used > 0 ? ", " : "",
+                         method_names[i]);
+        if (n < 0 || (size_t)n >= capacity - used) {
+            return 0;
+        }
+        used += (size_t)n;
+    }
+    return used;
+}
+
+/* Copies the capture `name` into `out`; false if the route has none or it does not fit. */
+bool route_param(const RouteMatch *match, const char *name, char *out, size_t capacity) {
+    for (size_t i = 0; i < match->param_count; i++) {
+        const RouteParam *param = &match->params[i];
+        if (strcmp(param->name, name) != 0) {
+            continue;
+        }
+        if (param->length >= capacity) {
+            return false;
+        }
+        memcpy(out, param->value, param->length);
+        out[param->length] = '\0';
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,58 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include "http.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ROUTE_MAX_PARAMS 4
+
+/* Method masks; a route registers the union of the methods it answers. */
+enum {
+    ROUTE_GET = 1u << 0,
+    ROUTE_HEAD = 1u << 1,
+    ROUTE_POST = 1u << 2,
+    ROUTE_PUT = 1u << 3,
+    ROUTE_DELETE = 1u << 4,
+    ROUTE_PATCH = 1u << 5,
+    ROUTE_OPTIONS = 1u << 6,
+};
+
+/* A `{name}` segment of the matched pattern; `value` points into the request path. */
+typedef struct {
+    const char *name;
+    const char *value;
+    size_t length;
+} RouteParam;
+
+typedef struct RouteMatch RouteMatch;
+typedef void (*RouteHandler)(int client_fd, const HttpRequest *request, const RouteMatch *match);
+
+struct RouteMatch {
+    RouteHandler handler;
+    const void *context;
+    unsigned allowed;
+    RouteParam params[ROUTE_MAX_PARAMS];
+    size_t param_count;
+};
+
+typedef struct RouteTable RouteTable;
+
+RouteTable *route_table_create(void);
+void route_table_free(RouteTable *table);
+bool route_table_add(RouteTable *table,
+                     unsigned methods,
+                     const char *pattern,
+                     RouteHandler handler,
+                     const void *context);
+int route_table_lookup(const RouteTable *table,
+                       const char *method,
+                       const char *path,
+                       RouteMatch *match);
+
+unsigned route_method_mask(const char *method);
+size_t route_format_allow(unsigned methods, char *out, size_t capacity);
+bool route_param(const RouteMatch *match, const char *name, char *out, size_t capacity);
+
+#endif
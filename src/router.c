@@ -1,55 +1,1047 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "router.h"
 
+#include "binary_ingest.h"
+#include "cluster.h"
+#include "event_feed.h"
+#include "frame_store.h"
+#include "frame_variants.h"
+#include "gallery_shard.h"
+#include "gallery_store.h"
+#include "model_warmup.h"
+#include "perf_counters.h"
+#include "pipeline.h"
+#include "recognize.h"
+#include "route_table.h"
+#include "shm_ingest.h"
 #include "server_config.h"
 #include "static_assets.h"
+#include "upload_advice.h"
+#include "trace.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
-static unsigned char latest_frame[MAX_FRAME_SIZE];
+/* Only the accept thread touches the latest frame; the buffer grows to the largest seen. */
+static unsigned char *latest_frame = NULL;
+static size_t latest_frame_capacity = 0;
 static size_t latest_frame_size = 0;
+static _Atomic size_t max_frame_bytes = MAX_FRAME_SIZE;
 
-void handle_request(int client_fd, const HttpRequest *request) {
-    if (strcmp(request->method, "GET") == 0) {
-        if (serve_static_asset(client_fd, request->path)) {
-            return;
+static size_t max_frame_size(void) {
+    return atomic_load_explicit(&max_frame_bytes, memory_order_relaxed);
+}
+
+static bool store_latest_frame(const unsigned char *data, size_t length) {
+    if (length > latest_frame_capacity) {
+        unsigned char *grown = (unsigned char *)realloc(latest_frame, length);
+        if (grown == NULL) {
+            return false;
         }
+        latest_frame = grown;
+        latest_frame_capacity = length;
+    }
+    if (length > 0) {
+        memcpy(latest_frame, data, length);
+    }
+    latest_frame_size = length;
+    frame_variants_invalidate();
+    return true;
+}
+
+static uint64_t wall_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+/*
+ * In a cluster, answers a request about a stream another node owns with a
+ * 307 to that node, which repeats a POST there body and all. Whatever is
+ * left of a streamed body is read first so the client sees the answer.
+ * Returns true once it has answered.
+ */
+static bool redirect_to_owner(int client_fd, const HttpRequest *request, const char *stream) {
+    char location[600];
+    if (!cluster_redirect_location(stream, request, location, sizeof(location))) {
+        return false;
+    }
+    if (request->body_length < request->content_length) {
+        HttpBodyReader reader;
+        http_body_reader_init(&reader, client_fd, request);
+        int status = 200;
+        http_body_read(&reader, NULL, reader.remaining, &status);
+    }
+    char headers[sizeof(location) + 64];
+    snprintf(headers, sizeof(headers), "Location: %s\r\nCache-Control: no-store\r\n", location);
+    static const char body[] = "Temporary Redirect";
+    send_http_response(client_fd, "307 Temporary Redirect", "text/plain; charset=utf-8", body,
+                       sizeof(body) - 1, headers);
+    return true;
+}
+
+/* The `stream` query parameter, or else the X-Stream-Id header; true if it was in the query. */
+static bool request_stream(const HttpRequest *request, char *out, size_t capacity) {
+    if (http_query_param(request, "stream", out, capacity)) {
+        return true;
     }
+    snprintf(out, capacity, "%s", request->stream_id);
+    return false;
+}
+
+/* `GET /api/frame?at=<unix ms>[&stream=<id>]`: a past frame from the history or recorder. */
+static void handle_frame_at(int client_fd, const char *stream, const char *at) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long at_ms = strtoull(at, &end, 10);
+    if (errno != 0 || end == at || *end != '\0') {
+        send_error_response(client_fd, 400);
+        return;
+    }
+    int status = frame_store_serve(client_fd, stream, (uint64_t)at_ms);
+    if (status != 200) {
+        send_error_response(client_fd, status);
+    }
+}
+
+/*
+ * `GET /api/frame?stream=<id>`: that stream's newest frame. An edge serves it
+ * from what it relays from the owner, which it starts pulling on first ask,
+ * so the first requests may find nothing yet (204).
+ */
+static void handle_stream_latest(int client_fd, const HttpRequest *request, const char *stream) {
+    if (cluster_is_edge()) {
+        cluster_edge_watch(stream);
+    } else if (redirect_to_owner(client_fd, request, stream)) {
+        return;
+    }
+    int status = frame_store_serve(client_fd, stream, UINT64_MAX);
+    if (status == 404) {
+        send_http_response(client_fd, "204 No Content", "text/plain; charset=utf-8", NULL, 0,
+                           "Cache-Control: no-store\r\n");
+    } else if (status != 200) {
+        send_error_response(client_fd, status);
+    }
+}
 
-    if (strcmp(request->path, "/api/frame") == 0 && strcmp(request->method, "POST") == 0) {
-        if (request->body_length == 0) {
-            send_error_response(client_fd, 400);
-            return;
+/* `GET /api/frame?w=<px>`: the latest frame scaled down, shared by every viewer of that size. */
+static void handle_frame_variant(int client_fd, const char *width) {
+    char *end = NULL;
+    errno = 0;
+    long value = strtol(width, &end, 10);
+    if (errno != 0 || end == width || *end != '\0' || value <= 0 || value > INT_MAX) {
+        send_error_response(client_fd, 400);
+        return;
+    }
+    int status = frame_variants_serve(client_fd, latest_frame, latest_frame_size, (int)value);
+    if (status != 200) {
+        send_error_response(client_fd, status);
+    }
+}
+
+/* `GET /debug/trace`: recent spans of every thread as Chrome trace-event JSON. */
+static void handle_debug_trace(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    size_t capacity = trace_json_capacity();
+    if (capacity == 0) {
+        send_error_response(client_fd, 404);
+        return;
+    }
+    char *body = (char *)malloc(capacity);
+    size_t body_length = body != NULL ? trace_format_json(body, capacity) : 0;
+    if (body_length == 0) {
+        free(body);
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+    free(body);
+}
+
+/* `GET /debug/perf`: CPU event totals per stage per thread (see perf_counters.h). */
+static void handle_debug_perf(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    size_t capacity = perf_counters_json_capacity();
+    if (capacity == 0) {
+        send_error_response(client_fd, 404);
+        return;
+    }
+    char *body = (char *)malloc(capacity);
+    size_t body_length = body != NULL ? perf_counters_format_json(body, capacity) : 0;
+    if (body_length == 0) {
+        free(body);
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+    free(body);
+}
+
+static bool content_type_is(const HttpRequest *request, const char *type) {
+    size_t length = strlen(type);
+    return strncasecmp(request->content_type, type, length) == 0 &&
+           (request->content_type[length] == '\0' || request->content_type[length] == ';');
+}
+
+static bool parse_json_embedding(const HttpRequest *request, size_t dim, float *out) {
+    char *text = (char *)malloc(request->body_length + 1);
+    if (text == NULL) {
+        return false;
+    }
+    memcpy(text, request->body, request->body_length);
+    text[request->body_length] = '\0';
+
+    bool ok = false;
+    size_t count = 0;
+    const char *cursor = strstr(text, "\"embedding\"");
+    cursor = cursor != NULL ? strchr(cursor, '[') : NULL;
+    while (cursor != NULL) {
+        cursor++;
+        char *end = NULL;
+        float value = strtof(cursor, &end);
+        if (end == cursor || count == dim) {
+            break;
+        }
+        out[count++] = value;
+        cursor = end;
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n') {
+            cursor++;
         }
-        if (request->body_length > MAX_FRAME_SIZE) {
-            send_error_response(client_fd, 413);
-            return;
+        if (*cursor == ']') {
+            ok = count == dim;
+            break;
         }
+        if (*cursor != ',') {
+            break;
+        }
+    }
+    free(text);
+    return ok;
+}
 
-        memcpy(latest_frame, request->body, request->body_length);
-        latest_frame_size = request->body_length;
+/* Picks the largest detected face, which is the enrollee in a typical portrait. */
+static int embedding_from_image(const HttpRequest *request, size_t dim, float *out) {
+    PipelineResult *result = (PipelineResult *)malloc(sizeof(*result));
+    if (result == NULL) {
+        return 500;
+    }
+    if (!pipeline_extract_faces(request->body, request->body_length, result)) {
+        free(result);
+        return 422;
+    }
+    if (result->embedding_dim != dim) {
+        int status = result->face_count > 0 ? 503 : 422;
+        free(result);
+        return status;
+    }
 
-        static const char body[] = "{\"ok\":true}";
-        send_http_response(client_fd, "200 OK", "application/json", body, sizeof(body) - 1,
-                           "Cache-Control: no-store\r\n");
+    const PipelineFace *best = NULL;
+    for (size_t i = 0; i < result->face_count; i++) {
+        const PipelineFace *face = &result->faces[i];
+        if (face->has_embedding &&
+            (best == NULL ||
+             face->box.width * face->box.height > best->box.width * best->box.height)) {
+            best = face;
+        }
+    }
+    int status = 422;
+    if (best != NULL) {
+        memcpy(out, best->embedding, dim * sizeof(float));
+        status = 200;
+    }
+    free(result);
+    return status;
+}
+
+static void handle_gallery_list(int client_fd,
+                                const HttpRequest *request,
+                                const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    GalleryStoreStats stats;
+    gallery_store_stats(&stats);
+    if (stats.dim == 0) {
+        send_error_response(client_fd, 503);
+        return;
+    }
+    size_t capacity = 64 + stats.identities * (GALLERY_NAME_MAX + 64);
+    char *body = (char *)malloc(capacity);
+    if (body == NULL) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    size_t body_length = gallery_store_format_identities_json(body, capacity);
+    if (body_length == 0) {
+        free(body);
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+    free(body);
+}
+
+/* `{identity}` of `/api/gallery/{identity}`; sends 400 and returns false if it is not a name. */
+static bool identity_param(int client_fd, const RouteMatch *match, char *name, size_t capacity) {
+    if (!route_param(match, "identity", name, capacity) || !gallery_valid_identity_name(name)) {
+        send_error_response(client_fd, 400);
+        return false;
+    }
+    return true;
+}
+
+static bool gallery_ready(int client_fd, size_t *dim) {
+    GalleryStoreStats stats;
+    gallery_store_stats(&stats);
+    if (stats.dim == 0) {
+        send_error_response(client_fd, 503);
+        return false;
+    }
+    *dim = stats.dim;
+    return true;
+}
+
+static void handle_gallery_remove(int client_fd,
+                                  const HttpRequest *request,
+                                  const RouteMatch *match) {
+    (void)request;
+    char name[GALLERY_NAME_MAX + 1];
+    size_t dim = 0;
+    if (!identity_param(client_fd, match, name, sizeof(name)) || !gallery_ready(client_fd, &dim)) {
+        return;
+    }
+
+    GalleryIdentity identity;
+    if (!gallery_store_remove(name, &identity)) {
+        send_error_response(client_fd, 404);
+        return;
+    }
+    char body[256];
+    int n = snprintf(body, sizeof(body), "{\"identity\":\"%s\",\"removed\":%zu}", name,
+                     identity.entries);
+    send_http_response(client_fd, "200 OK", "application/json", body, (size_t)n,
+                       "Cache-Control: no-store\r\n");
+}
+
+/* The embedding a body gives: a face photo, `dim` raw floats, or `{"embedding":[...]}`. */
+static int request_embedding(const HttpRequest *request, size_t dim, float *out) {
+    if (request->body_length == 0) {
+        return 400;
+    }
+    if (request->body_length > max_frame_size()) {
+        return 413;
+    }
+    if (content_type_is(request, "image/jpeg")) {
+        return embedding_from_image(request, dim, out);
+    }
+    if (content_type_is(request, "application/octet-stream")) {
+        if (request->body_length != dim * sizeof(float)) {
+            return 400;
+        }
+        memcpy(out, request->body, request->body_length);
+        return 200;
+    }
+    if (content_type_is(request, "application/json")) {
+        return parse_json_embedding(request, dim, out) ? 200 : 400;
+    }
+    return 400;
+}
+
+static void handle_gallery_enroll(int client_fd,
+                                  const HttpRequest *request,
+                                  const RouteMatch *match) {
+    char name[GALLERY_NAME_MAX + 1];
+    size_t dim = 0;
+    if (!identity_param(client_fd, match, name, sizeof(name)) || !gallery_ready(client_fd, &dim)) {
+        return;
+    }
+
+    float embedding[GALLERY_MAX_DIM];
+    int status = request_embedding(request, dim, embedding);
+    if (status != 200) {
+        send_error_response(client_fd, status);
         return;
     }
 
-    if (strcmp(request->path, "/api/frame") == 0 && strcmp(request->method, "GET") == 0) {
-        if (latest_frame_size == 0) {
-            send_http_response(client_fd, "204 No Content", "text/plain; charset=utf-8", NULL, 0,
-                               "Cache-Control: no-store\r\n");
-            return;
+    GalleryIdentity identity;
+    if (!gallery_store_enroll(name, embedding, &identity)) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    char body[256];
+    int n = snprintf(body, sizeof(body), "{\"identity\":\"%s\",\"id\":%llu,\"entries\":%zu}",
+                     identity.name, (unsigned long long)identity.id, identity.entries);
+    send_http_response(client_fd, "201 Created", "application/json", body, (size_t)n,
+                       "Cache-Control: no-store\r\n");
+}
+
+/* `?k=` (1 to GALLERY_MAX_K, default 5) and `?min=` (-1 to 1) of a search; false if invalid. */
+static bool search_params(const HttpRequest *request, size_t *k, float *min_similarity) {
+    char text[32];
+    char *end = NULL;
+    *k = 5;
+    *min_similarity = RECOGNIZE_MIN_SIMILARITY;
+    if (http_query_param(request, "k", text, sizeof(text))) {
+        unsigned long value = strtoul(text, &end, 10);
+        if (end == text || *end != '\0' || text[0] == '-' || value == 0 || value > GALLERY_MAX_K) {
+            return false;
+        }
+        *k = (size_t)value;
+    }
+    if (http_query_param(request, "min", text, sizeof(text))) {
+        float value = strtof(text, &end);
+        if (end == text || *end != '\0' || !(value >= -1.0f && value <= 1.0f)) {
+            return false;
+        }
+        *min_similarity = value;
+    }
+    return true;
+}
+
+/* Formats the search answer; 0 if it does not fit. */
+static size_t format_search_json(const GalleryStoreMatch *matches,
+                                 size_t found,
+                                 const GalleryShardReport *report,
+                                 uint64_t search_us,
+                                 char *buffer,
+                                 size_t capacity) {
+    int n = snprintf(buffer, capacity, "{\"matches\":[");
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    size_t used = (size_t)n;
+    for (size_t i = 0; i < found; i++) {
+        const GalleryIdentity *identity = &matches[i].identity;
+        char name[2 * sizeof(identity->name)];
+        http_json_escape(name, sizeof(name), identity->name);
+        n = snprintf(buffer + used, capacity - used,
+                     "%s{\"identity\":\"%s\",\"id\":%llu,\"entries\":%zu,\"similarity\":%.4f}",
+                     i > 0 ? "," : "", name, (unsigned long long)identity->id,
+                     identity->entries, (double)matches[i].similarity);
+        if (n < 0 || (size_t)n >= capacity - used) {
+            return 0;
         }
+        used += (size_t)n;
+    }
+    n = snprintf(buffer + used, capacity - used,
+                 "],\"shards\":%zu,\"answered\":%zu,\"hedged\":%zu,\"search_us\":%llu}",
+                 report->shards, report->answered, report->hedged,
+                 (unsigned long long)search_us);
+    if (n < 0 || (size_t)n >= capacity - used) {
+        return 0;
+    }
+    return used + (size_t)n;
+}
 
-        send_http_response(client_fd, "200 OK", "image/jpeg", latest_frame, latest_frame_size,
+/*
+ * `POST /api/search?k=&min=`: the identities closest to an embedding (or
+ * the largest face in a photo), from every gallery shard when this process
+ * coordinates some, with how many of them answered in time.
+ */
+static void handle_gallery_search(int client_fd,
+                                  const HttpRequest *request,
+                                  const RouteMatch *match) {
+    (void)match;
+    size_t dim = 0;
+    if (!gallery_ready(client_fd, &dim)) {
+        return;
+    }
+    size_t k = 0;
+    float min_similarity = 0.0f;
+    float embedding[GALLERY_MAX_DIM];
+    int status = search_params(request, &k, &min_similarity)
+                     ? request_embedding(request, dim, embedding)
+                     : 400;
+    if (status != 200) {
+        send_error_response(client_fd, status);
+        return;
+    }
+
+    GalleryStoreMatch matches[GALLERY_MAX_K];
+    GalleryShardReport report;
+    uint64_t start_us = monotonic_us();
+    size_t found = gallery_shards_search(embedding, dim, k, min_similarity, matches, &report);
+    uint64_t search_us = monotonic_us() - start_us;
+    /* Escaped names take up to twice their length; a similarity fits in 64 characters. */
+    char body[128 + GALLERY_MAX_K * (2 * GALLERY_NAME_MAX + 160)];
+    size_t length = format_search_json(matches, found, &report, search_us, body, sizeof(body));
+    if (length == 0) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, length,
+                       "Cache-Control: no-store\r\n");
+}
+
+static void handle_search_stats(int client_fd,
+                                const HttpRequest *request,
+                                const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    GalleryShardStats stats;
+    gallery_shard_stats(&stats);
+    char body[512];
+    size_t body_length = gallery_shard_format_stats_json(&stats, body, sizeof(body));
+    if (body_length == 0) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+}
+
+static void handle_frame_upload(int client_fd,
+                                const HttpRequest *request,
+                                const RouteMatch *match) {
+    (void)match;
+    if (redirect_to_owner(client_fd, request, request->stream_id)) {
+        return;
+    }
+    uint64_t seq = 0;
+    int status =
+        router_publish_frame(request->stream_id, request->body, request->body_length, &seq);
+    if (status != 200) {
+        send_error_response(client_fd, status);
+        return;
+    }
+
+    char headers[128] = "Cache-Control: no-store\r\n";
+    if (seq != 0) {
+        snprintf(headers, sizeof(headers),
+                 "Cache-Control: no-store\r\n"
+                 "X-Frame-Seq: %llu\r\n",
+                 (unsigned long long)seq);
+    }
+
+    /* The uploader paces itself by this: see upload_advice.h. */
+    UploadAdvice advice;
+    upload_advice_for_stream(request->stream_id, &advice);
+    char advice_json[96];
+    char body[128];
+    size_t advice_length = upload_advice_format_json(&advice, advice_json, sizeof(advice_json));
+    int body_length = advice_length > 0 ? snprintf(body, sizeof(body),
+                                                   "{\"ok\":true,\"advice\":%s}", advice_json)
+                                        : -1;
+    if (body_length < 0 || (size_t)body_length >= sizeof(body)) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, (size_t)body_length,
+                       headers);
+}
+
+static uint32_t read_be32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static uint64_t read_be64(const unsigned char *in) {
+    return ((uint64_t)read_be32(in) << 32) | read_be32(in + 4);
+}
+
+/*
+ * Status of one batch frame before its bytes are read; 200 means keep it.
+ * A frame no newer than the stream's newest is refused, so a camera that
+ * resends a batch after losing the response does not store it twice.
+ */
+static int batch_frame_status(size_t length, uint64_t time_ms, uint64_t last_ms) {
+    if (length == 0) {
+        return 400;
+    }
+    if (length > max_frame_size()) {
+        return 413;
+    }
+    return last_ms != 0 && time_ms <= last_ms ? 409 : 200;
+}
+
+/*
+ * `POST /api/frames/batch`: frames a camera buffered while its uplink was
+ * down, as FRAME_BATCH_CONTENT_TYPE records (big-endian u64 capture time in
+ * unix ms, u32 length, bytes). The body is read one frame at a time, never
+ * whole. Each frame goes into the stream's history in order; only the newest
+ * becomes the latest frame and goes to the pipeline. The answer has a status
+ * per frame: 200 stored, 400 empty, 409 not newer than the stream's newest,
+ * 413 over max_frame_bytes, 500 not stored. A frame is stored once it is in
+ * the history; one the recorder failed to write is still 200 and is counted
+ * in "unrecorded" instead. Only 200 frames can become the newest, so a 500
+ * frame is in neither the history nor the live view. A malformed or cut-off
+ * body is refused as a whole, though frames before the fault stay stored.
+ */
+static void handle_frame_batch(int client_fd,
+                               const HttpRequest *request,
+                               const RouteMatch *match) {
+    (void)match;
+    if (!content_type_is(request, FRAME_BATCH_CONTENT_TYPE)) {
+        send_error_response(client_fd, 415);
+        return;
+    }
+    if (request->content_length == 0 || request->content_length > FRAME_BATCH_MAX_BYTES) {
+        send_error_response(client_fd, request->content_length == 0 ? 400 : 413);
+        return;
+    }
+    if (redirect_to_owner(client_fd, request, request->stream_id)) {
+        return;
+    }
+
+    HttpBodyReader reader;
+    http_body_reader_init(&reader, client_fd, request);
+    uint64_t last_ms = frame_store_last_ms(request->stream_id);
+    unsigned short acks[FRAME_BATCH_MAX_FRAMES];
+    size_t count = 0;
+    size_t stored = 0;
+    size_t unrecorded = 0;
+    /* Two buffers: the newest kept frame and the one being read. */
+    unsigned char *buffers[2] = {NULL, NULL};
+    size_t capacities[2] = {0, 0};
+    size_t lengths[2] = {0, 0};
+    int newest = -1;
+    int status = 200;
+    while (status == 200 && reader.remaining > 0) {
+        unsigned char header[FRAME_BATCH_HEADER_BYTES];
+        if (count == FRAME_BATCH_MAX_FRAMES) {
+            status = 413;
+            break;
+        }
+        if (!http_body_read(&reader, header, sizeof(header), &status)) {
+            break;
+        }
+        uint64_t time_ms = read_be64(header);
+        size_t length = read_be32(header + 8);
+        int slot = newest == 0 ? 1 : 0;
+        int ack = batch_frame_status(length, time_ms, last_ms);
+        if (ack == 200 && length > capacities[slot]) {
+            unsigned char *grown = (unsigned char *)realloc(buffers[slot], length);
+            if (grown != NULL) {
+                buffers[slot] = grown;
+                capacities[slot] = length;
+            } else {
+                ack = 500;
+            }
+        }
+        if (!http_body_read(&reader, ack == 200 ? buffers[slot] : NULL, length, &status)) {
+            break;
+        }
+        bool record_failed = false;
+        if (ack == 200 &&
+            !frame_store_append(request->stream_id, time_ms, buffers[slot], length,
+                                &record_failed)) {
+            ack = 500;
+        }
+        if (ack == 200) {
+            stored++;
+            unrecorded += record_failed ? 1 : 0;
+            last_ms = time_ms;
+            lengths[slot] = length;
+            newest = slot;
+        }
+        acks[count++] = (unsigned short)ack;
+    }
+
+    uint64_t seq = 0;
+    if (status == 200 && newest >= 0) {
+        const unsigned char *frame = buffers[newest];
+        if (!store_latest_frame(frame, lengths[newest]) ||
+            !pipeline_submit_frame(request->stream_id, frame, lengths[newest], &seq)) {
+            seq = 0;
+        }
+        cluster_relay_publish(request->stream_id, last_ms, frame, lengths[newest]);
+    }
+    free(buffers[0]);
+    free(buffers[1]);
+    if (status != 200) {
+        send_error_response(client_fd, status);
+        return;
+    }
+
+    char body[FRAME_BATCH_MAX_FRAMES * 4 + 192];
+    size_t used = (size_t)snprintf(body, sizeof(body),
+                                   "{\"frames\":%zu,\"stored\":%zu,\"latest_ms\":%llu,"
+                                   "\"seq\":%llu,\"unrecorded\":%zu,\"acks\":[",
+                                   count, stored, newest >= 0 ? (unsigned long long)last_ms : 0ull,
+                                   (unsigned long long)seq, unrecorded);
+    for (size_t i = 0; i < count; i++) {
+        used += (size_t)snprintf(body + used, sizeof(body) - used, "%s%u", i > 0 ? "," : "",
+                                 (unsigned)acks[i]);
+    }
+    used += (size_t)snprintf(body + used, sizeof(body) - used, "]}");
+    char headers[128] = "Cache-Control: no-store\r\n";
+    if (seq != 0) {
+        snprintf(headers, sizeof(headers),
+                 "Cache-Control: no-store\r\n"
+                 "X-Frame-Seq: %llu\r\n",
+                 (unsigned long long)seq);
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, used, headers);
+}
+
+static void handle_frame_get(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)match;
+    char stream[sizeof(request->stream_id)];
+    bool stream_given = request_stream(request, stream, sizeof(stream));
+    char at[32];
+    if (http_query_param(request, "at", at, sizeof(at))) {
+        if (!redirect_to_owner(client_fd, request, stream)) {
+            handle_frame_at(client_fd, stream, at);
+        }
+        return;
+    }
+    if (stream_given) {
+        handle_stream_latest(client_fd, request, stream);
+        return;
+    }
+    if (latest_frame_size == 0) {
+        send_http_response(client_fd, "204 No Content", "text/plain; charset=utf-8", NULL, 0,
                            "Cache-Control: no-store\r\n");
         return;
     }
 
-    if (strcmp(request->path, "/api/frame") == 0) {
-        send_error_response(client_fd, 405);
+    char width[16];
+    if (http_query_param(request, "w", width, sizeof(width))) {
+        handle_frame_variant(client_fd, width);
+        return;
+    }
+
+    send_http_response(client_fd, "200 OK", "image/jpeg", latest_frame, latest_frame_size,
+                       "Cache-Control: no-store\r\n");
+}
+
+static void handle_frame_faces(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    PipelineResult result;
+    pipeline_latest_result(&result);
+    size_t capacity = pipeline_faces_json_capacity(&result);
+    char *body = (char *)malloc(capacity);
+    size_t body_length = body != NULL ? pipeline_format_faces_json(&result, body, capacity) : 0;
+    if (body_length == 0) {
+        free(body);
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+    free(body);
+}
+
+static void handle_recognize(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)match;
+    if (request->body_length == 0) {
+        send_error_response(client_fd, 400);
+        return;
+    }
+    if (request->body_length > max_frame_size()) {
+        send_error_response(client_fd, 413);
+        return;
+    }
+    if (request->content_type[0] != '\0' && !content_type_is(request, "image/jpeg")) {
+        send_error_response(client_fd, 415);
+        return;
+    }
+    if (!recognize_submit(client_fd, request)) {
+        static const char body[] = "Service Unavailable";
+        send_http_response(client_fd, "503 Service Unavailable", "text/plain; charset=utf-8",
+                           body, sizeof(body) - 1, "Retry-After: 1\r\n");
+    }
+}
+
+static void handle_pipeline_stats(int client_fd,
+                                  const HttpRequest *request,
+                                  const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    PipelineStats stats;
+    pipeline_stats(&stats);
+    char body[1024];
+    size_t body_length = pipeline_format_stats_json(&stats, body, sizeof(body));
+    if (body_length == 0) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+}
+
+/* 200 once the models are loaded and, with prewarm, resident; 503 until then. */
+static void handle_ready(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    ModelWarmupStats stats;
+    model_warmup_stats(&stats);
+    char body[256];
+    size_t body_length = model_warmup_format_stats_json(&stats, body, sizeof(body));
+    if (body_length == 0) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, stats.ready ? "200 OK" : "503 Service Unavailable",
+                       "application/json", body, body_length,
+                       stats.ready ? "Cache-Control: no-store\r\n"
+                                   : "Cache-Control: no-store\r\nRetry-After: 1\r\n");
+}
+
+static void handle_events(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)match;
+    if (!event_feed_subscribe(client_fd, request)) {
+        static const char body[] = "Service Unavailable";
+        send_http_response(client_fd, "503 Service Unavailable", "text/plain; charset=utf-8",
+                           body, sizeof(body) - 1, "Retry-After: 5\r\n");
+    }
+}
+
+static void handle_events_stats(int client_fd,
+                                const HttpRequest *request,
+                                const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    EventFeedStats stats;
+    event_feed_stats(&stats);
+    char body[512];
+    size_t body_length = event_feed_format_stats_json(&stats, body, sizeof(body));
+    if (body_length == 0) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+}
+
+/*
+ * `GET /api/frames/live?stream=<id>`: from now on every frame the stream
+ * gets here, as one endless FRAME_BATCH_CONTENT_TYPE body. Edges pull
+ * streams with it; it lives on the stream's owner.
+ */
+static void handle_frames_live(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)match;
+    char stream[sizeof(request->stream_id)];
+    request_stream(request, stream, sizeof(stream));
+    if (redirect_to_owner(client_fd, request, stream)) {
+        return;
+    }
+    if (!cluster_relay_subscribe(client_fd, stream)) {
+        static const char body[] = "Service Unavailable";
+        send_http_response(client_fd, "503 Service Unavailable", "text/plain; charset=utf-8",
+                           body, sizeof(body) - 1, "Retry-After: 5\r\n");
+    }
+}
+
+/* `GET /api/cluster[?stream=<id>]`: this node's role and relay counters, and the stream's owner. */
+static void handle_cluster_stats(int client_fd,
+                                 const HttpRequest *request,
+                                 const RouteMatch *match) {
+    (void)match;
+    ClusterStats stats;
+    cluster_stats(&stats);
+    char stream[sizeof(request->stream_id)];
+    bool has_stream = http_query_param(request, "stream", stream, sizeof(stream));
+    char body[1024];
+    size_t body_length =
+        cluster_format_stats_json(&stats, has_stream ? stream : NULL, body, sizeof(body));
+    if (body_length == 0) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, body_length,
+                       "Cache-Control: no-store\r\n");
+}
+
+static void handle_ingest_stats(int client_fd,
+                                const HttpRequest *request,
+                                const RouteMatch *match) {
+    (void)request;
+    (void)match;
+    ShmIngestStats shm;
+    shm_ingest_stats(&shm);
+    BinaryIngestStats binary;
+    binary_ingest_stats(&binary);
+    char shm_json[256];
+    char binary_json[256];
+    char body[600];
+    int body_length = -1;
+    if (shm_ingest_format_stats_json(&shm, shm_json, sizeof(shm_json)) > 0 &&
+        binary_ingest_format_stats_json(&binary, binary_json, sizeof(binary_json)) > 0) {
+        body_length = snprintf(body, sizeof(body), "{\"shm\":%s,\"binary\":%s}", shm_json,
+                               binary_json);
+    }
+    if (body_length <= 0 || (size_t)body_length >= sizeof(body)) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+    send_http_response(client_fd, "200 OK", "application/json", body, (size_t)body_length,
+                       "Cache-Control: no-store\r\n");
+}
+
+static void handle_static_asset(int client_fd,
+                                const HttpRequest *request,
+                                const RouteMatch *match) {
+    (void)request;
+    send_static_asset(client_fd, (const StaticAsset *)match->context);
+}
+
+typedef struct {
+    unsigned methods;
+    const char *pattern;
+    RouteHandler handler;
+} RouteDefinition;
+
+static const RouteDefinition api_routes[] = {
+    {ROUTE_POST, "/api/frame", handle_frame_upload},
+    {ROUTE_POST, "/api/frames/batch", handle_frame_batch},
+    {ROUTE_GET, "/api/frames/live", handle_frames_live},
+    {ROUTE_GET, "/api/frame", handle_frame_get},
+    {ROUTE_GET, "/api/frame/faces", handle_frame_faces},
+    {ROUTE_POST, "/api/recognize", handle_recognize},
+    {ROUTE_GET, "/api/pipeline/stats", handle_pipeline_stats},
+    {ROUTE_GET, "/api/ready", handle_ready},
+    {ROUTE_GET, "/api/events", handle_events},
+    {ROUTE_GET, "/api/events/stats", handle_events_stats},
+    {ROUTE_GET, "/api/ingest/stats", handle_ingest_stats},
+    {ROUTE_GET, "/api/cluster", handle_cluster_stats},
+    {ROUTE_GET, "/debug/trace", handle_debug_trace},
+    {ROUTE_GET, "/debug/perf", handle_debug_perf},
+    {ROUTE_GET, "/api/gallery", handle_gallery_list},
+    {ROUTE_POST, "/api/gallery/{identity}", handle_gallery_enroll},
+    {ROUTE_DELETE, "/api/gallery/{identity}", handle_gallery_remove},
+    {ROUTE_POST, "/api/search", handle_gallery_search},
+    {ROUTE_GET, "/api/search/stats", handle_search_stats},
+};
+
+static RouteTable *routes = NULL;
+static pthread_once_t routes_once = PTHREAD_ONCE_INIT;
+
+/* Built once, on the first request: the static assets, then every API route. */
+static void build_routes(void) {
+    RouteTable *table = route_table_create();
+    bool ok = table != NULL;
+    const StaticAsset *asset = NULL;
+    for (size_t i = 0; ok && (asset = static_asset_at(i)) != NULL; i++) {
+        ok = route_table_add(table, ROUTE_GET, static_asset_url_path(asset), handle_static_asset,
+                             asset);
+    }
+    size_t route_count = sizeof(api_routes) / sizeof(api_routes[0]);
+    for (size_t i = 0; ok && i < route_count; i++) {
+        ok = route_table_add(table, api_routes[i].methods, api_routes[i].pattern,
+                             api_routes[i].handler, NULL);
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to build the route table\n");
+        route_table_free(table);
+        return;
+    }
+    routes = table;
+}
+
+static void send_method_not_allowed(int client_fd, unsigned allowed) {
+    char methods[64];
+    char headers[96];
+    route_format_allow(allowed, methods, sizeof(methods));
+    snprintf(headers, sizeof(headers), "Allow: %s\r\n", methods);
+    static const char body[] = "Method Not Allowed";
+    send_http_response(client_fd, "405 Method Not Allowed", "text/plain; charset=utf-8", body,
+                       sizeof(body) - 1, headers);
+}
+
+void handle_request(int client_fd, const HttpRequest *request) {
+    pthread_once(&routes_once, build_routes);
+    if (routes == NULL) {
+        send_error_response(client_fd, 500);
         return;
     }
 
-    send_error_response(client_fd, 404);
+    RouteMatch match;
+    int status = route_table_lookup(routes, request->method, request->path, &match);
+    if (status == 200) {
+        match.handler(client_fd, request, &match);
+    } else if (status == 405) {
+        send_method_not_allowed(client_fd, match.allowed);
+    } else {
+        send_error_response(client_fd, status);
+    }
+}
+
+/*
+ * True for requests whose handler reads the body itself: the caller reads
+ * their head with read_http_request_head() and leaves the body on the socket.
+ */
+bool router_streams_body(const HttpRequest *request) {
+    pthread_once(&routes_once, build_routes);
+    RouteMatch match;
+    return routes != NULL &&
+           route_table_lookup(routes, request->method, request->path, &match) == 200 &&
+           match.handler == handle_frame_batch;
+}
+
+/*
+ * Publishes an uploaded frame as the latest frame, into its stream's history
+ * and onto the pipeline queue; `seq` is its pipeline sequence number, or 0 if
+ * the pipeline did not take it. Returns 200, or the status to refuse it with.
+ * Also relayed to the stream's live subscribers (edge nodes).
+ * Accept thread only: `POST /api/frame` and the shared-memory and binary ingests.
+ */
+int router_publish_frame(const char *stream_id,
+                         const unsigned char *data,
+                         size_t length,
+                         uint64_t *seq) {
+    *seq = 0;
+    if (length == 0) {
+        return 400;
+    }
+    if (length > max_frame_size()) {
+        return 413;
+    }
+    if (!store_latest_frame(data, length)) {
+        return 500;
+    }
+    /* A batch may have stamped the stream's newest frame ahead of this clock. */
+    uint64_t now_ms = wall_clock_ms();
+    uint64_t last_ms = frame_store_last_ms(stream_id);
+    if (now_ms < last_ms) {
+        now_ms = last_ms;
+    }
+    frame_store_append(stream_id, now_ms, data, length, NULL);
+    cluster_relay_publish(stream_id, now_ms, data, length);
+    if (!pipeline_submit_frame(stream_id, data, length, seq)) {
+        *seq = 0;
+    }
+    return 200;
+}
+
+/* The frame `GET /api/frame` answers with; only the accept thread changes it. */
+const unsigned char *router_latest_frame(size_t *length) {
+    *length = latest_frame_size;
+    return latest_frame;
+}
+
+/* Takes over the latest frame from a previous process after a restart. */
+void router_restore_latest_frame(const unsigned char *data, size_t length) {
+    store_latest_frame(data, length);
+}
+
+/* Uploads larger than this are refused with 413 from the next request on. */
+void router_set_max_frame_size(size_t max_bytes) {
+    if (max_bytes > 0) {
+        atomic_store_explicit(&max_frame_bytes, max_bytes, memory_order_relaxed);
+    }
+}
+
+size_t router_max_frame_size(void) {
+    return max_frame_size();
 }
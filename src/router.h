@@ -3,6 +3,24 @@
 
 #include "http.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* `POST /api/frames/batch` bodies: per frame a big-endian u64 time (unix ms), u32 length, bytes. */
+#define FRAME_BATCH_CONTENT_TYPE "application/x-frame-batch"
+#define FRAME_BATCH_HEADER_BYTES 12
+
 void handle_request(int client_fd, const HttpRequest *request);
+bool router_streams_body(const HttpRequest *request);
+int router_publish_frame(const char *stream_id,
+                         const unsigned char *data,
+                         size_t length,
+                         uint64_t *seq);
+
+const unsigned char *router_latest_frame(size_t *length);
+void router_restore_latest_frame(const unsigned char *data, size_t length);
+void router_set_max_frame_size(size_t max_bytes);
+size_t router_max_frame_size(void);
 
 #endif
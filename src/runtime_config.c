@@ -0,0 +1,612 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "runtime_config.h"
+
+#include "binary_ingest.h"
+#include "shm_ingest.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define CONFIG_LINE_SIZE 1024
+
+typedef enum {
+    OPTION_SIZE,
+    OPTION_INT,
+    OPTION_MS,
+    OPTION_BOOL,
+} OptionType;
+
+/* `live` options are applied by a SIGHUP reload; the others only at startup. */
+typedef struct {
+    const char *key;
+    OptionType type;
+    size_t offset;
+    bool live;
+    unsigned long long min;
+    unsigned long long max;
+} ConfigOption;
+
+#define FIELD(name) offsetof(RuntimeConfig, name)
+
+static const ConfigOption options[] = {
+    {"backlog", OPTION_INT, FIELD(socket.backlog), true, 1, 65535},
+    {"tcp_nodelay", OPTION_BOOL, FIELD(socket.tcp_nodelay), true, 0, 1},
+    {"tcp_defer_accept_s", OPTION_INT, FIELD(socket.defer_accept_s), true, 0, 3600},
+    {"socket_send_buffer", OPTION_INT, FIELD(socket.send_buffer), true, 0, INT_MAX / 2},
+    {"socket_receive_buffer", OPTION_INT, FIELD(socket.receive_buffer), true, 0, INT_MAX / 2},
+    {"busy_poll_us", OPTION_INT, FIELD(socket.busy_poll_us), true, 0, 1000000},
+    {"read_timeout_ms", OPTION_MS, FIELD(socket.read_timeout_ms), true, 0, 3600000},
+    {"write_timeout_ms", OPTION_MS, FIELD(socket.write_timeout_ms), true, 0, 3600000},
+    {"max_request_bytes", OPTION_SIZE, FIELD(max_request_bytes), true, 1024, 1ull << 30},
+    {"max_header_bytes", OPTION_SIZE, FIELD(max_header_bytes), true, 1024, 1u << 20},
+    {"max_frame_bytes", OPTION_SIZE, FIELD(max_frame_bytes), true, 1024, 1ull << 30},
+    {"shutdown_drain_ms", OPTION_MS, FIELD(shutdown_drain_ms), true, 0, 3600000},
+    {"image_pool_size", OPTION_SIZE, FIELD(image_pool_size), false, 1, 1024},
+    {"pipeline_workers", OPTION_SIZE, FIELD(pipeline_workers), false, 1, 64},
+    {"pipeline_queue_depth", OPTION_SIZE, FIELD(pipeline_queue_depth), false, 1, 65536},
+    {"recognize_workers", OPTION_SIZE, FIELD(recognize_workers), false, 1, 256},
+    {"recognize_max_in_flight", OPTION_SIZE, FIELD(recognize_max_in_flight), false, 1, 65536},
+    {"event_feed_capacity", OPTION_SIZE, FIELD(event_feed_capacity), false, 2, 1u << 20},
+    {"event_feed_max_subscribers", OPTION_SIZE, FIELD(event_feed_max_subscribers), false, 1,
+     1u << 20},
+    {"event_feed_heartbeat_ms", OPTION_MS, FIELD(event_feed_heartbeat_ms), false, 10, 3600000},
+    {"event_feed_stall_ms", OPTION_MS, FIELD(event_feed_stall_ms), false, 10, 3600000},
+    {"shm_ingest_slots", OPTION_SIZE, FIELD(shm_ingest_slots), false, 1, SHM_INGEST_MAX_SLOTS},
+    {"ingest_credits", OPTION_SIZE, FIELD(ingest_credits), false, 1, BINARY_INGEST_MAX_CREDITS},
+    {"gallery_shard_timeout_ms", OPTION_MS, FIELD(gallery_shard_timeout_ms), true, 1, 60000},
+    {"gallery_shard_hedge_ms", OPTION_MS, FIELD(gallery_shard_hedge_ms), true, 0, 60000},
+    {"perf_counters", OPTION_BOOL, FIELD(perf_counters), true, 0, 1},
+    {"model_prewarm", OPTION_BOOL, FIELD(model_prewarm), false, 0, 1},
+};
+
+#define OPTION_COUNT (sizeof(options) / sizeof(options[0]))
+
+void runtime_config_defaults(RuntimeConfig *config) {
+    memset(config, 0, sizeof(*config));
+    config->listeners[0].family = LISTENER_TCP4;
+    snprintf(config->listeners[0].address, sizeof(config->listeners[0].address), "0.0.0.0");
+    config->listeners[0].port = DEFAULT_PORT;
+    config->listener_count = 1;
+    config->socket.backlog = BACKLOG;
+    config->socket.tcp_nodelay = true;
+    config->socket.read_timeout_ms = READ_TIMEOUT_MS;
+    config->socket.write_timeout_ms = WRITE_TIMEOUT_MS;
+    config->max_request_bytes = MAX_REQUEST_SIZE;
+    config->max_header_bytes = MAX_HEADER_SIZE;
+    config->max_frame_bytes = MAX_FRAME_SIZE;
+    config->shutdown_drain_ms = SHUTDOWN_DRAIN_MS;
+    config->image_pool_size = IMAGE_POOL_SIZE;
+    config->pipeline_workers = PIPELINE_WORKERS;
+    config->pipeline_queue_depth = PIPELINE_QUEUE_DEPTH;
+    config->recognize_workers = RECOGNIZE_WORKERS;
+    config->recognize_max_in_flight = RECOGNIZE_MAX_IN_FLIGHT;
+    config->event_feed_capacity = EVENT_FEED_CAPACITY;
+    config->event_feed_max_subscribers = EVENT_FEED_MAX_SUBSCRIBERS;
+    config->event_feed_heartbeat_ms = EVENT_FEED_HEARTBEAT_MS;
+    config->event_feed_stall_ms = EVENT_FEED_STALL_MS;
+    config->shm_ingest_slots = SHM_INGEST_SLOTS;
+    config->ingest_credits = BINARY_INGEST_CREDITS;
+    config->gallery_shard_timeout_ms = GALLERY_SHARD_TIMEOUT_MS;
+    config->gallery_shard_hedge_ms = GALLERY_SHARD_HEDGE_MS;
+    config->model_prewarm = true;
+}
+
+static const ConfigOption *find_option(const char *key) {
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        if (strcmp(options[i].key, key) == 0) {
+            return &options[i];
+        }
+    }
+    return NULL;
+}
+
+/* Sizes take an optional k/m/g suffix (powers of 1024). */
+static bool parse_number(const char *text, bool allow_suffix, unsigned long long *out) {
+    char *end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno != 0 || end == text || text[0] == '-') {
+        return false;
+    }
+    unsigned shift = 0;
+    if (allow_suffix && *end != '\0' && end[1] == '\0') {
+        switch (tolower((unsigned char)*end)) {
+        case 'k':
+            shift = 10;
+            break;
+        case 'm':
+            shift = 20;
+            break;
+        case 'g':
+            shift = 30;
+            break;
+        default:
+            return false;
+        }
+        end++;
+    }
+    if (*end != '\0' || value > (ULLONG_MAX >> shift)) {
+        return false;
+    }
+    *out = value << shift;
+    return true;
+}
+
+static bool parse_bool(const char *text, bool *out) {
+    static const char *const yes[] = {"1", "on", "true", "yes"};
+    static const char *const no[] = {"0", "off", "false", "no"};
+    for (size_t i = 0; i < sizeof(yes) / sizeof(yes[0]); i++) {
+        if (strcasecmp(text, yes[i]) == 0 || strcasecmp(text, no[i]) == 0) {
+            *out = strcasecmp(text, yes[i]) == 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool set_option(const ConfigOption *option, RuntimeConfig *config, const char *value) {
+    char *field = (char *)config + option->offset;
+    if (option->type == OPTION_BOOL) {
+        return parse_bool(value, (bool *)field);
+    }
+    unsigned long long number = 0;
+    if (!parse_number(value, option->type != OPTION_MS, &number) || number < option->min ||
+        number > option->max) {
+        return false;
+    }
+    if (option->type == OPTION_SIZE) {
+        *(size_t *)field = (size_t)number;
+    } else if (option->type == OPTION_MS) {
+        *(unsigned *)field = (unsigned)number;
+    } else {
+        *(int *)field = (int)number;
+    }
+    return true;
+}
+
+/* An address to connect to; a wildcard one only makes sense to listen on. */
+static bool parse_remote(const char *text, ListenerSpec *out) {
+    return listener_spec_parse(text, out) && strcmp(out->address, "0.0.0.0") != 0 &&
+           strcmp(out->address, "::") != 0;
+}
+
+/* Cluster nodes are named in HTTP redirects, so a Unix socket cannot be one. */
+static bool parse_node(const char *text, ListenerSpec *out) {
+    return parse_remote(text, out) && out->family != LISTENER_UNIX;
+}
+
+/*
+ * Copies the next `delimiter`-separated item of `*cursor`, trimmed (and
+ * truncated to fit), into `item` and moves past it. False if it is empty or
+ * did not fit.
+ */
+static bool next_item(const char **cursor, char delimiter, char *item, size_t capacity) {
+    const char *start = *cursor;
+    const char *end = strchr(start, delimiter);
+    size_t length = end != NULL ? (size_t)(end - start) : strlen(start);
+    *cursor = end != NULL ? end + 1 : start + length;
+    while (length > 0 && isspace((unsigned char)*start)) {
+        start++;
+        length--;
+    }
+    while (length > 0 && isspace((unsigned char)start[length - 1])) {
+        length--;
+    }
+    snprintf(item, capacity, "%.*s", (int)length, start);
+    return length > 0 && length < capacity;
+}
+
+/* Comma-separated `host:port` of every origin, identical on every node; empty for none. */
+static bool parse_cluster_nodes(RuntimeConfig *config, const char *value, const char *where) {
+    size_t count = 0;
+    const char *cursor = value;
+    while (*cursor != '\0') {
+        char item[sizeof(config->cluster_nodes[0].address) + 16];
+        bool ok = next_item(&cursor, ',', item, sizeof(item));
+        if (count == CLUSTER_MAX_NODES) {
+            fprintf(stderr, "%sat most %d cluster nodes\n", where, CLUSTER_MAX_NODES);
+            return false;
+        }
+        if (!ok || !parse_node(item, &config->cluster_nodes[count])) {
+            fprintf(stderr, "%sinvalid cluster node '%s'\n", where, item);
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (listener_spec_equal(&config->cluster_nodes[i], &config->cluster_nodes[count])) {
+                fprintf(stderr, "%scluster node '%s' listed twice\n", where, item);
+                return false;
+            }
+        }
+        count++;
+    }
+    config->cluster_node_count = count;
+    return true;
+}
+
+/* `a|b, c`: shards separated by commas, and each one's replicas by `|`, primary first. */
+static bool parse_gallery_shards(RuntimeConfig *config, const char *value, const char *where) {
+    size_t count = 0;
+    const char *cursor = value;
+    while (*cursor != '\0') {
+        char group[CONFIG_LINE_SIZE];
+        bool ok = next_item(&cursor, ',', group, sizeof(group));
+        if (count == GALLERY_MAX_SHARDS) {
+            fprintf(stderr, "%sat most %d gallery shards\n", where, GALLERY_MAX_SHARDS);
+            return false;
+        }
+        GalleryShardSpec *shard = &config->gallery_shards[count];
+        shard->replica_count = 0;
+        const char *replica = group;
+        while (ok && *replica != '\0') {
+            char item[sizeof(shard->replicas[0].address) + 16];
+            ok = shard->replica_count < GALLERY_SHARD_MAX_REPLICAS &&
+                 next_item(&replica, '|', item, sizeof(item)) &&
+                 parse_remote(item, &shard->replicas[shard->replica_count++]);
+        }
+        if (!ok || shard->replica_count == 0) {
+            fprintf(stderr, "%sinvalid gallery shard '%s'\n", where, group);
+            return false;
+        }
+        count++;
+    }
+    config->gallery_shard_count = count;
+    return true;
+}
+
+/*
+ * `replace_listeners` is set by the caller at the start of each source, so
+ * the first `listen` in a file (or on the command line) replaces the
+ * listeners configured before it and later ones add to them.
+ */
+static bool apply(RuntimeConfig *config,
+                  const char *key,
+                  const char *value,
+                  bool *replace_listeners,
+                  const char *where) {
+    if (strcmp(key, "listen") == 0) {
+        ListenerSpec spec;
+        if (!listener_spec_parse(value, &spec)) {
+            fprintf(stderr, "%sinvalid listen address '%s'\n", where, value);
+            return false;
+        }
+        if (*replace_listeners) {
+            config->listener_count = 0;
+            *replace_listeners = false;
+        }
+        if (config->listener_count == MAX_LISTENERS) {
+            fprintf(stderr, "%sat most %d listen addresses\n", where, MAX_LISTENERS);
+            return false;
+        }
+        config->listeners[config->listener_count++] = spec;
+        return true;
+    }
+    if (strcmp(key, "shm_ingest") == 0) {
+        /* A socket path; empty turns the shared-memory ingest off. */
+        if (strlen(value) >= sizeof(config->shm_ingest_path)) {
+            fprintf(stderr, "%sshm_ingest path too long\n", where);
+            return false;
+        }
+        snprintf(config->shm_ingest_path, sizeof(config->shm_ingest_path), "%s", value);
+        return true;
+    }
+    if (strcmp(key, "ingest_listen") == 0) {
+        /* One address for binary camera connections; empty turns it off. */
+        config->ingest_listener_set = value[0] != '\0';
+        if (config->ingest_listener_set && !listener_spec_parse(value, &config->ingest_listener)) {
+            fprintf(stderr, "%sinvalid ingest_listen address '%s'\n", where, value);
+            config->ingest_listener_set = false;
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(key, "cluster_nodes") == 0) {
+        return parse_cluster_nodes(config, value, where);
+    }
+    if (strcmp(key, "cluster_self") == 0) {
+        /* This node's address as written in cluster_nodes; empty (or absent there) is an edge. */
+        config->cluster_self_set = value[0] != '\0';
+        if (config->cluster_self_set && !parse_node(value, &config->cluster_self)) {
+            fprintf(stderr, "%sinvalid cluster_self address '%s'\n", where, value);
+            config->cluster_self_set = false;
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(key, "gallery_shard_listen") == 0) {
+        /* Where coordinators reach this process's gallery; empty turns it off. */
+        config->gallery_shard_listener_set = value[0] != '\0';
+        if (config->gallery_shard_listener_set &&
+            !listener_spec_parse(value, &config->gallery_shard_listener)) {
+            fprintf(stderr, "%sinvalid gallery_shard_listen address '%s'\n", where, value);
+            config->gallery_shard_listener_set = false;
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(key, "gallery_shards") == 0) {
+        return parse_gallery_shards(config, value, where);
+    }
+    const ConfigOption *option = find_option(key);
+    if (option == NULL) {
+        fprintf(stderr, "%sunknown option '%s'\n", where, key);
+        return false;
+    }
+    if (!set_option(option, config, value)) {
+        fprintf(stderr, "%sinvalid value '%s' for %s\n", where, value, key);
+        return false;
+    }
+    return true;
+}
+
+bool runtime_config_set(RuntimeConfig *config, const char *key, const char *value) {
+    bool replace_listeners = false;
+    return apply(config, key, value, &replace_listeners, "");
+}
+
+static char *trim(char *text) {
+    while (isspace((unsigned char)*text)) {
+        text++;
+    }
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+/* `key = value` per line; `#` starts a comment. Every bad line is reported before failing. */
+bool runtime_config_load_file(RuntimeConfig *config, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "config %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[CONFIG_LINE_SIZE];
+    char where[MAX_ASSET_PATH_SIZE + 32];
+    bool replace_listeners = true;
+    bool ok = true;
+    for (unsigned number = 1; fgets(line, sizeof(line), file) != NULL; number++) {
+        snprintf(where, sizeof(where), "%s:%u: ", path, number);
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        char *key = trim(line);
+        if (*key == '\0') {
+            continue;
+        }
+        char *equals = strchr(key, '=');
+        if (equals == NULL) {
+            fprintf(stderr, "%sexpected key = value\n", where);
+            ok = false;
+            continue;
+        }
+        *equals = '\0';
+        ok &= apply(config, trim(key), trim(equals + 1), &replace_listeners, where);
+    }
+    fclose(file);
+    return ok;
+}
+
+/* `--max-frame-bytes` and `--max_frame_bytes` name the same option. */
+static void option_key(const char *arg, size_t length, char *out, size_t capacity) {
+    size_t used = 0;
+    for (size_t i = 0; i < length && used + 1 < capacity; i++) {
+        out[used++] = arg[i] == '-' ? '_' : arg[i];
+    }
+    out[used] = '\0';
+}
+
+/*
+ * Every pipeline and recognize worker holds one pooled image while it decodes,
+ * plus one for a handler thread; a smaller pool fails decodes under load.
+ */
+static bool check_image_pool(const RuntimeConfig *config) {
+    size_t needed = config->pipeline_workers + config->recognize_workers + 1;
+    if (config->image_pool_size < needed) {
+        fprintf(stderr, "image_pool_size %zu is below pipeline_workers + recognize_workers + 1"
+                        " (%zu)\n", config->image_pool_size, needed);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Defaults, then `--config FILE`, then every other argument in order:
+ * `--key=value`, `--key value`, or a bare port for `web_server 8080`.
+ */
+bool runtime_config_load(RuntimeConfig *config, int argc, char **argv) {
+    runtime_config_defaults(config);
+    for (int i = 1; i < argc; i++) {
+        const char *path = NULL;
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (strncmp(argv[i], "--config=", 9) == 0) {
+            path = argv[i] + 9;
+        }
+        if (path != NULL) {
+            snprintf(config->config_path, sizeof(config->config_path), "%s", path);
+        }
+    }
+    if (config->config_path[0] != '\0' && !runtime_config_load_file(config, config->config_path)) {
+        return false;
+    }
+
+    bool replace_listeners = true;
+    bool ok = true;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--config") == 0) {
+            if (++i == argc) {
+                fprintf(stderr, "argument: --config needs a file\n");
+                ok = false;
+            }
+            continue;
+        }
+        if (strncmp(arg, "--config=", 9) == 0) {
+            continue;
+        }
+        if (strncmp(arg, "--", 2) != 0) {
+            ok &= apply(config, "listen", arg, &replace_listeners, "argument: ");
+            continue;
+        }
+        const char *equals = strchr(arg + 2, '=');
+        const char *value = equals != NULL ? equals + 1 : (i + 1 < argc ? argv[i + 1] : NULL);
+        char key[64];
+        option_key(arg + 2, equals != NULL ? (size_t)(equals - arg - 2) : strlen(arg + 2), key,
+                   sizeof(key));
+        if (value == NULL) {
+            fprintf(stderr, "argument: %s needs a value\n", arg);
+            ok = false;
+            continue;
+        }
+        if (equals == NULL) {
+            i++;
+        }
+        ok &= apply(config, key, value, &replace_listeners, "argument: ");
+    }
+    return ok && check_image_pool(config);
+}
+
+static size_t option_width(const ConfigOption *option) {
+    switch (option->type) {
+    case OPTION_SIZE:
+        return sizeof(size_t);
+    case OPTION_MS:
+        return sizeof(unsigned);
+    case OPTION_BOOL:
+        return sizeof(bool);
+    default:
+        return sizeof(int);
+    }
+}
+
+static bool gallery_shards_equal(const RuntimeConfig *a, const RuntimeConfig *b) {
+    if (a->gallery_shard_count != b->gallery_shard_count) {
+        return false;
+    }
+    for (size_t i = 0; i < a->gallery_shard_count; i++) {
+        const GalleryShardSpec *x = &a->gallery_shards[i];
+        const GalleryShardSpec *y = &b->gallery_shards[i];
+        if (x->replica_count != y->replica_count) {
+            return false;
+        }
+        for (size_t r = 0; r < x->replica_count; r++) {
+            if (!listener_spec_equal(&x->replicas[r], &y->replicas[r])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* Keys that no longer fit are left out whole, so the list never ends mid-name. */
+static void append_key(char *out, size_t capacity, size_t *used, const char *key) {
+    size_t separator = *used > 0 ? 2 : 0;
+    size_t length = strlen(key);
+    if (separator + length >= capacity - *used) {
+        return;
+    }
+    memcpy(out + *used, ", ", separator);
+    memcpy(out + *used + separator, key, length + 1);
+    *used += separator + length;
+}
+
+/*
+ * A SIGHUP reload: copies the live settings of `loaded` into `running`, and
+ * names in `skipped` (comma-separated) the changed ones that need a restart,
+ * which `running` keeps as they are. Returns the length of `skipped`.
+ */
+size_t runtime_config_merge_live(RuntimeConfig *running,
+                                 const RuntimeConfig *loaded,
+                                 char *skipped,
+                                 size_t capacity) {
+    size_t used = 0;
+    skipped[0] = '\0';
+    bool listeners_changed = running->listener_count != loaded->listener_count;
+    for (size_t i = 0; i < running->listener_count && !listeners_changed; i++) {
+        listeners_changed = !listener_spec_equal(&running->listeners[i], &loaded->listeners[i]);
+    }
+    if (listeners_changed) {
+        append_key(skipped, capacity, &used, "listen");
+    }
+    if (strcmp(running->shm_ingest_path, loaded->shm_ingest_path) != 0) {
+        append_key(skipped, capacity, &used, "shm_ingest");
+    }
+    if (running->ingest_listener_set != loaded->ingest_listener_set ||
+        (running->ingest_listener_set &&
+         !listener_spec_equal(&running->ingest_listener, &loaded->ingest_listener))) {
+        append_key(skipped, capacity, &used, "ingest_listen");
+    }
+    bool nodes_changed = running->cluster_node_count != loaded->cluster_node_count;
+    for (size_t i = 0; i < running->cluster_node_count && !nodes_changed; i++) {
+        nodes_changed =
+            !listener_spec_equal(&running->cluster_nodes[i], &loaded->cluster_nodes[i]);
+    }
+    if (nodes_changed) {
+        append_key(skipped, capacity, &used, "cluster_nodes");
+    }
+    if (running->cluster_self_set != loaded->cluster_self_set ||
+        (running->cluster_self_set &&
+         !listener_spec_equal(&running->cluster_self, &loaded->cluster_self))) {
+        append_key(skipped, capacity, &used, "cluster_self");
+    }
+    if (running->gallery_shard_listener_set != loaded->gallery_shard_listener_set ||
+        (running->gallery_shard_listener_set &&
+         !listener_spec_equal(&running->gallery_shard_listener, &loaded->gallery_shard_listener))) {
+        append_key(skipped, capacity, &used, "gallery_shard_listen");
+    }
+    if (!gallery_shards_equal(running, loaded)) {
+        append_key(skipped, capacity, &used, "gallery_shards");
+    }
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        char *to = (char *)running + options[i].offset;
+        const char *from = (const char *)loaded + options[i].offset;
+        size_t width = option_width(&options[i]);
+        if (options[i].live) {
+            memcpy(to, from, width);
+        } else if (memcmp(to, from, width) != 0) {
+            append_key(skipped, capacity, &used, options[i].key);
+        }
+    }
+    return used;
+}
+
+void runtime_config_print_usage(const char *program) {
+    RuntimeConfig defaults;
+    runtime_config_defaults(&defaults);
+    printf("Usage: %s [port] [--config FILE] [--key=value ...]\n\n", program);
+    printf("  --listen=ADDR  (repeatable) 0.0.0.0:%d, [::]:8080, unix:/path/to/socket\n",
+           DEFAULT_PORT);
+    printf("  --shm_ingest=PATH  Unix socket for shared-memory frame producers (off)\n");
+    printf("  --ingest_listen=ADDR  binary framed ingest for cameras, e.g. 0.0.0.0:9090 (off)\n");
+    printf("  --cluster_nodes=ADDR,...  origin nodes sharing the streams (standalone)\n");
+    printf("  --cluster_self=ADDR  this node's entry in cluster_nodes; not listed is an edge\n");
+    printf("  --gallery_shard_listen=ADDR  serve gallery searches to a coordinator (off)\n");
+    printf("  --gallery_shards=ADDR[|ADDR],...  search these shards, not the local gallery\n");
+    for (size_t i = 0; i < OPTION_COUNT; i++) {
+        const char *field = (const char *)&defaults + options[i].offset;
+        char value[32];
+        if (options[i].type == OPTION_BOOL) {
+            snprintf(value, sizeof(value), "%s", *(const bool *)field ? "on" : "off");
+        } else if (options[i].type == OPTION_SIZE) {
+            snprintf(value, sizeof(value), "%zu", *(const size_t *)field);
+        } else if (options[i].type == OPTION_MS) {
+            snprintf(value, sizeof(value), "%u", *(const unsigned *)field);
+        } else {
+            snprintf(value, sizeof(value), "%d", *(const int *)field);
+        }
+        printf("  --%s=%s%s\n", options[i].key, value, options[i].live ? "  (reloads)" : "");
+    }
+    printf("\nConfig files hold the same keys as `key = value` lines. SIGHUP reloads the\n"
+           "settings marked (reloads); SIGUSR2 restarts in place to apply the rest.\n");
+}
@@ -0,0 +1,65 @@
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include "gallery_shard.h"
+#include "listener.h"
+#include "server_config.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Deployment tunables. Defaults come from server_config.h, then the
+ * `--config` file (`key = value` lines), then `--key=value` arguments. Keys
+ * marked live in runtime_config.c take effect on SIGHUP; the rest need a
+ * restart (SIGUSR2 hands over to a process that reads them afresh).
+ */
+typedef struct {
+    char config_path[MAX_ASSET_PATH_SIZE];
+    ListenerSpec listeners[MAX_LISTENERS];
+    size_t listener_count;
+    SocketOptions socket;
+    size_t max_request_bytes;
+    size_t max_header_bytes;
+    size_t max_frame_bytes;
+    unsigned shutdown_drain_ms;
+    size_t image_pool_size;
+    size_t pipeline_workers;
+    size_t pipeline_queue_depth;
+    size_t recognize_workers;
+    size_t recognize_max_in_flight;
+    size_t event_feed_capacity;
+    size_t event_feed_max_subscribers;
+    unsigned event_feed_heartbeat_ms;
+    unsigned event_feed_stall_ms;
+    char shm_ingest_path[sizeof(((ListenerSpec *)0)->address)];
+    size_t shm_ingest_slots;
+    ListenerSpec ingest_listener;
+    bool ingest_listener_set;
+    size_t ingest_credits;
+    ListenerSpec cluster_nodes[CLUSTER_MAX_NODES];
+    size_t cluster_node_count;
+    ListenerSpec cluster_self;
+    bool cluster_self_set;
+    ListenerSpec gallery_shard_listener;
+    bool gallery_shard_listener_set;
+    GalleryShardSpec gallery_shards[GALLERY_MAX_SHARDS];
+    size_t gallery_shard_count;
+    unsigned gallery_shard_timeout_ms;
+    unsigned gallery_shard_hedge_ms;
+    bool perf_counters;
+    bool model_prewarm;
+} RuntimeConfig;
+
+void runtime_config_defaults(RuntimeConfig *config);
+bool runtime_config_set(RuntimeConfig *config, const char *key, const char *value);
+bool runtime_config_load_file(RuntimeConfig *config, const char *path);
+bool runtime_config_load(RuntimeConfig *config, int argc, char **argv);
+
+size_t runtime_config_merge_live(RuntimeConfig *running,
+                                 const RuntimeConfig *loaded,
+                                 char *skipped,
+                                 size_t capacity);
+void runtime_config_print_usage(const char *program);
+
+#endif
@@ -7,9 +7,109 @@
 #define MAX_FRAME_SIZE (2 * 1024 * 1024)
 #define MAX_ASSET_PATH_SIZE 1024
 #define MAX_HEADER_SIZE 16384
+#define MAX_LISTENERS 8
+#define ACCEPT_BATCH 64
+#define READ_TIMEOUT_MS 10000
+#define WRITE_TIMEOUT_MS 10000
+#define DETECTOR_INPUT_WIDTH 320
+#define DETECTOR_INPUT_HEIGHT 240
+#define IMAGE_POOL_SIZE 8
+#define PIPELINE_WORKERS 2
+#define PIPELINE_QUEUE_DEPTH 8
+#define PIPELINE_MAX_BATCH 4
+#define PIPELINE_EMBED_BATCH 8
+#define PIPELINE_BATCH_WAIT_US 2000
+#define PIPELINE_LATENCY_SLO_US 150000
+#define PIPELINE_MAX_STREAMS 16
+#define UPLOAD_MIN_INTERVAL_MS 66
+#define UPLOAD_MAX_INTERVAL_MS 2000
+#define UPLOAD_ADVICE_WINDOW_MS 500
+#define UPLOAD_ADVICE_IDLE_MS 5000
+#define UPLOAD_ADVICE_MAX_STREAMS 64
+#define UPLOAD_TARGET_BUSY_PERCENT 80
+#define MOTION_CELL_THRESHOLD 12
+#define MOTION_MIN_CHANGED_CELLS 4
+#define MOTION_KEYFRAME_INTERVAL 50
+#define FACE_TRACK_MIN_IOU 0.3f
+#define FACE_TRACK_REUSE_IOU 0.7f
+#define RECOGNIZE_WORKERS 2
+#define RECOGNIZE_MAX_IN_FLIGHT 4
+#define RECOGNIZE_MIN_SIMILARITY 0.5f
+#define EVENT_FEED_CAPACITY 1024
+#define EVENT_FEED_MAX_SUBSCRIBERS 4096
+#define EVENT_FEED_HEARTBEAT_MS 15000
+#define EVENT_FEED_STALL_MS 30000
+#define EVENT_FEED_RETRY_MS 2000
+#define FRAME_HISTORY_STREAM_BYTES (8 * 1024 * 1024)
+#define FRAME_HISTORY_MAX_FRAMES 256
+#define FRAME_RECORD_SEGMENT_BYTES (64 * 1024 * 1024)
+#define FRAME_RECORD_MAX_SEGMENTS 16
+#define FRAME_RECORD_INDEX_INTERVAL_MS 1000
+#define FRAME_VARIANT_SLOTS 4
+#define FRAME_VARIANT_MIN_WIDTH 16
+#define FRAME_VARIANT_MAX_WIDTH 1920
+#define FRAME_VARIANT_QUALITY 80
+#define TRACE_RING_SPANS 2048
+#define TRACE_MAX_THREADS 64
+#define TRACE_JSON_EVENT_BYTES 160
+#define PERF_MAX_THREADS 64
+#define PERF_JSON_STAGE_BYTES 256
+#define ACCESS_LOG_ROTATE_BYTES (64 * 1024 * 1024)
+#define ACCESS_LOG_MAX_FILES 8
+#define ACCESS_LOG_BLOCK_BYTES (64 * 1024)
+#define ACCESS_LOG_MAX_PENDING_BLOCKS 256
+#define ACCESS_LOG_FLUSH_MS 100
+#define ACCESS_LOG_MAX_THREADS 64
+#define SHUTDOWN_DRAIN_MS 10000
+#define HANDOFF_TIMEOUT_MS 30000
+#define SHM_INGEST_SLOTS 8
+#define SHM_INGEST_MAX_PRODUCERS 16
+#define FRAME_BATCH_MAX_FRAMES 1024
+#define FRAME_BATCH_MAX_BYTES (256 * 1024 * 1024)
+#define BINARY_INGEST_CREDITS 8
+#define BINARY_INGEST_MAX_CONNECTIONS 64
+/* The HTTP listeners plus the binary ingest and gallery shard listeners. */
+#define MAX_HANDOFF_SOCKETS (MAX_LISTENERS + 2)
+#define CLUSTER_MAX_NODES 16
+#define CLUSTER_VNODES 64
+#define CLUSTER_RELAY_MAX_SUBSCRIBERS 64
+#define CLUSTER_RELAY_STALL_MS 5000
+#define CLUSTER_EDGE_IDLE_MS 30000
+#define CLUSTER_EDGE_RETRY_MS 1000
+#define GALLERY_DEFAULT_DIM 128
+#define GALLERY_COMPACT_LOG_RECORDS 4096
+#define GALLERY_COMPACT_INTERVAL_SEC 60
+#define GALLERY_COMPACT_DELETED_DIVISOR 4
+#define GALLERY_MAX_SHARDS 16
+#define GALLERY_SHARD_MAX_REPLICAS 4
+#define GALLERY_SHARD_POOL 8
+#define GALLERY_SHARD_MAX_CONNECTIONS 64
+#define GALLERY_SHARD_TIMEOUT_MS 200
+#define GALLERY_SHARD_HEDGE_MS 20
 
 #ifndef WEB_ROOT_DIR
 #define WEB_ROOT_DIR "web"
 #endif
 
+#ifndef MODEL_DIR
+#define MODEL_DIR "models"
+#endif
+
+#ifndef GALLERY_DIR
+#define GALLERY_DIR "gallery-data"
+#endif
+
+/* Empty disables the on-disk frame recorder; in-memory history is always kept. */
+#ifndef FRAME_RECORD_DIR
+#define FRAME_RECORD_DIR ""
+#endif
+
+/* Empty disables the access log. */
+#ifndef ACCESS_LOG_PATH
+#define ACCESS_LOG_PATH "access.log"
+#endif
+
+#define FACE_CASCADE_PATH MODEL_DIR "/face_cascade.txt"
+#define FACE_EMBEDDING_MODEL_PATH MODEL_DIR "/face_embedding.bin"
+
 #endif
@@ -0,0 +1,498 @@
+/* memfd_create(), file seals and accept4() are Linux extensions. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "shm_ingest.h"
+
+#include "listener.h"
+#include "router.h"
+#include "server_config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define LISTEN_TAG UINT64_MAX
+#define POLL_EVENTS 32
+
+typedef struct {
+    int control_fd;
+    int ready_fd;
+    int free_fd;
+    ShmIngestRing *ring;
+    size_t ring_bytes;
+    uint64_t tail;
+    char stream_id[SHM_INGEST_STREAM_ID_SIZE];
+} Producer;
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static ListenerSpec listen_spec;
+static size_t ring_slots = 0;
+static size_t ring_slot_bytes = 0;
+static Producer producers[SHM_INGEST_MAX_PRODUCERS];
+static ShmIngestStats stats;
+
+static size_t ring_size(size_t slot_count, size_t slot_bytes) {
+    return SHM_INGEST_HEADER_BYTES + slot_count * slot_bytes;
+}
+
+static const unsigned char *slot_data(const ShmIngestRing *ring, size_t slot_bytes, size_t index) {
+    return (const unsigned char *)ring + SHM_INGEST_HEADER_BYTES + index * slot_bytes;
+}
+
+static bool watch(int fd, uint64_t tag) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = tag;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+static void close_fd(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+/*
+ * The producer holds its own descriptors for the same eventfds, so closing
+ * ours would not end their epoll registration (epoll(7)): a producer still
+ * signalling would keep the epoll fd readable forever. Unwatch them first.
+ */
+static void drop_producer(Producer *producer) {
+    if (producer->control_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, producer->control_fd, NULL);
+    }
+    if (producer->ready_fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, producer->ready_fd, NULL);
+    }
+    close_fd(&producer->control_fd);
+    close_fd(&producer->ready_fd);
+    close_fd(&producer->free_fd);
+    if (producer->ring != NULL) {
+        munmap(producer->ring, producer->ring_bytes);
+        producer->ring = NULL;
+    }
+    stats.producers--;
+}
+
+/*
+ * The memfd is sealed against resizing before the producer sees it, so it
+ * cannot truncate the ring under the server's mapping (which would SIGBUS).
+ */
+static int create_ring(size_t ring_bytes) {
+    int fd = memfd_create("web_server-ingest", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        perror("memfd_create");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)ring_bytes) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        perror("shm ingest ring");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_layout(int sock, const ShmIngestLayout *layout, const int *fds, size_t count) {
+    struct iovec iov = {(void *)layout, sizeof(*layout)};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * 3)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (count > 0) {
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+    return sendmsg(sock, &msg, MSG_NOSIGNAL) == (ssize_t)sizeof(*layout);
+}
+
+/* Answers a hello with the ring; false drops the producer. */
+static bool attach_producer(Producer *producer, size_t index) {
+    ShmIngestHello hello;
+    ssize_t n = recv(producer->control_fd, &hello, sizeof(hello), 0);
+    if (n != (ssize_t)sizeof(hello) || hello.magic != SHM_INGEST_MAGIC ||
+        hello.version != SHM_INGEST_VERSION) {
+        return false;
+    }
+    memcpy(producer->stream_id, hello.stream_id, sizeof(producer->stream_id));
+    producer->stream_id[sizeof(producer->stream_id) - 1] = '\0';
+
+    size_t ring_bytes = ring_size(ring_slots, ring_slot_bytes);
+    int memfd = create_ring(ring_bytes);
+    if (memfd < 0) {
+        return false;
+    }
+    void *mapping = mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    producer->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    producer->free_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mapping != MAP_FAILED) {
+        producer->ring = (ShmIngestRing *)mapping;
+        producer->ring_bytes = ring_bytes;
+    }
+    ShmIngestLayout layout = {SHM_INGEST_MAGIC, (uint32_t)ring_slots, ring_slot_bytes, ring_bytes};
+    int fds[3] = {memfd, producer->ready_fd, producer->free_fd};
+    bool ok = producer->ring != NULL && producer->ready_fd >= 0 && producer->free_fd >= 0 &&
+              watch(producer->ready_fd, (uint64_t)index * 2 + 1) &&
+              send_layout(producer->control_fd, &layout, fds, 3);
+    close(memfd);
+    if (ok) {
+        producer->tail = 0;
+        stats.connected++;
+    }
+    return ok;
+}
+
+static void accept_producers(void) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+                errno != ECONNABORTED) {
+                perror("shm ingest accept");
+            }
+            return;
+        }
+        size_t index = 0;
+        while (index < SHM_INGEST_MAX_PRODUCERS && producers[index].control_fd >= 0) {
+            index++;
+        }
+        if (index == SHM_INGEST_MAX_PRODUCERS) {
+            ShmIngestLayout refused = {SHM_INGEST_MAGIC, 0, 0, 0};
+            send_layout(fd, &refused, NULL, 0);
+            close(fd);
+            stats.dropped_producers++;
+            continue;
+        }
+        Producer *producer = &producers[index];
+        memset(producer, 0, sizeof(*producer));
+        producer->control_fd = fd;
+        producer->ready_fd = -1;
+        producer->free_fd = -1;
+        stats.producers++;
+        if (!watch(fd, (uint64_t)index * 2)) {
+            drop_producer(producer);
+        }
+    }
+}
+
+/*
+ * Publishes every slot the producer has filled, straight from the mapping,
+ * then tells it how many slots are free again. A `head` more than a ring
+ * ahead of `tail` can only come from a broken producer, which is dropped.
+ */
+static size_t consume(Producer *producer) {
+    uint64_t wakeups = 0;
+    ssize_t n = read(producer->ready_fd, &wakeups, sizeof(wakeups));
+    (void)n;
+    ShmIngestRing *ring = producer->ring;
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head - producer->tail > ring_slots) {
+        fprintf(stderr, "shm ingest: producer '%s' overran its ring\n", producer->stream_id);
+        drop_producer(producer);
+        stats.dropped_producers++;
+        return 0;
+    }
+
+    uint64_t published = 0;
+    while (producer->tail != head) {
+        size_t index = (size_t)(producer->tail % ring_slots);
+        uint32_t length = ring->slots[index].length;
+        uint64_t seq = 0;
+        if (length > 0 && length <= ring_slot_bytes &&
+            router_publish_frame(producer->stream_id, slot_data(ring, ring_slot_bytes, index),
+                                 length, &seq) == 200) {
+            stats.frames++;
+            stats.bytes += length;
+        } else {
+            stats.rejected++;
+        }
+        producer->tail++;
+        atomic_store_explicit(&ring->tail, producer->tail, memory_order_release);
+        published++;
+    }
+    if (published > 0) {
+        n = write(producer->free_fd, &published, sizeof(published));
+        (void)n;
+    }
+    return (size_t)published;
+}
+
+/*
+ * Starts listening for producers on the Unix socket `path`; each one gets a
+ * ring of `slot_count` slots of `slot_bytes`. A stale socket file is
+ * replaced, as for the HTTP listeners.
+ */
+bool shm_ingest_open(const char *path, size_t slot_count, size_t slot_bytes) {
+    if (listen_fd >= 0 || slot_count == 0 || slot_count > SHM_INGEST_MAX_SLOTS ||
+        slot_bytes == 0 || slot_bytes > UINT32_MAX) {
+        return false;
+    }
+    memset(&listen_spec, 0, sizeof(listen_spec));
+    listen_spec.family = LISTENER_UNIX;
+    size_t path_length = strlen(path);
+    if (path_length == 0 || path_length >= sizeof(listen_spec.address)) {
+        return false;
+    }
+    memcpy(listen_spec.address, path, path_length + 1);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, path_length + 1);
+    listener_remove_path(&listen_spec);
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = listen_fd >= 0 && epoll_fd >= 0;
+    if (ok && (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+               listen(listen_fd, SHM_INGEST_MAX_PRODUCERS) != 0)) {
+        fprintf(stderr, "shm ingest %s: %s\n", path, strerror(errno));
+        ok = false;
+    }
+    ok = ok && watch(listen_fd, LISTEN_TAG);
+    if (!ok) {
+        close_fd(&listen_fd);
+        close_fd(&epoll_fd);
+        return false;
+    }
+
+    ring_slots = slot_count;
+    ring_slot_bytes = slot_bytes;
+    memset(&stats, 0, sizeof(stats));
+    for (size_t i = 0; i < SHM_INGEST_MAX_PRODUCERS; i++) {
+        producers[i].control_fd = -1;
+    }
+    return true;
+}
+
+/* Readable whenever a producer connects, says hello, hangs up or has published frames. */
+int shm_ingest_fd(void) {
+    return epoll_fd;
+}
+
+/* Handles whatever is ready without blocking; returns how many slots were consumed. */
+size_t shm_ingest_poll(void) {
+    if (epoll_fd < 0) {
+        return 0;
+    }
+    struct epoll_event events[POLL_EVENTS];
+    int count = epoll_wait(epoll_fd, events, POLL_EVENTS, 0);
+    size_t consumed = 0;
+    bool accept_pending = false;
+    for (int i = 0; i < count; i++) {
+        uint64_t tag = events[i].data.u64;
+        if (tag == LISTEN_TAG) {
+            accept_pending = true;
+            continue;
+        }
+        Producer *producer = &producers[tag / 2];
+        if (producer->control_fd < 0) {
+            continue;
+        }
+        if (tag % 2 == 1) {
+            if (producer->ring != NULL) {
+                consumed += consume(producer);
+            }
+        } else if (producer->ring == NULL) {
+            if (!attach_producer(producer, (size_t)(tag / 2))) {
+                drop_producer(producer);
+                stats.dropped_producers++;
+            }
+        } else {
+            /* Anything after the hello, including EOF, ends the session. */
+            consumed += consume(producer);
+            if (producer->control_fd >= 0) {
+                drop_producer(producer);
+            }
+        }
+    }
+    /* After the events, so a slot freed above is not reused while its events are pending. */
+    if (accept_pending) {
+        accept_producers();
+    }
+    return consumed;
+}
+
+void shm_ingest_close(bool remove_path) {
+    if (listen_fd < 0) {
+        return;
+    }
+    for (size_t i = 0; i < SHM_INGEST_MAX_PRODUCERS; i++) {
+        if (producers[i].control_fd >= 0) {
+            drop_producer(&producers[i]);
+        }
+    }
+    close_fd(&listen_fd);
+    close_fd(&epoll_fd);
+    if (remove_path) {
+        listener_remove_path(&listen_spec);
+    }
+}
+
+void shm_ingest_stats(ShmIngestStats *out) {
+    *out = stats;
+}
+
+size_t shm_ingest_format_stats_json(const ShmIngestStats *in, char *out, size_t capacity) {
+    int n = snprintf(out, capacity,
+                     "{\"producers\":%zu,\"connected\":%llu,\"frames\":%llu,\"bytes\":%llu,"
+                     "\"rejected\":%llu,\"dropped_producers\":%llu}",
+                     in->producers, (unsigned long long)in->connected,
+                     (unsigned long long)in->frames, (unsigned long long)in->bytes,
+                     (unsigned long long)in->rejected, (unsigned long long)in->dropped_producers);
+    return n > 0 && (size_t)n < capacity ? (size_t)n : 0;
+}
+
+static bool receive_layout(int sock, ShmIngestLayout *layout, int *fds) {
+    struct iovec iov = {layout, sizeof(*layout)};
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * 3)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    struct cmsghdr *cmsg = n == (ssize_t)sizeof(*layout) ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return false;
+    }
+    size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+        int fd = -1;
+        memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        if (i < 3) {
+            fds[i] = fd;
+        } else {
+            close(fd);
+        }
+    }
+    return count >= 3;
+}
+
+/* Connects to the server at `path` and maps the ring it hands over. */
+bool shm_ingest_connect(const char *path, const char *stream_id, ShmIngestProducer *producer) {
+    memset(producer, 0, sizeof(*producer));
+    producer->ready_fd = -1;
+    producer->free_fd = -1;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    producer->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (producer->sock < 0 ||
+        connect(producer->sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close_fd(&producer->sock);
+        return false;
+    }
+
+    ShmIngestHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = SHM_INGEST_MAGIC;
+    hello.version = SHM_INGEST_VERSION;
+    snprintf(hello.stream_id, sizeof(hello.stream_id), "%s", stream_id);
+    ShmIngestLayout layout;
+    int fds[3] = {-1, -1, -1};
+    bool ok = send(producer->sock, &hello, sizeof(hello), MSG_NOSIGNAL) == (ssize_t)sizeof(hello) &&
+              receive_layout(producer->sock, &layout, fds) && layout.magic == SHM_INGEST_MAGIC &&
+              layout.slot_count > 0 && layout.slot_count <= SHM_INGEST_MAX_SLOTS &&
+              layout.ring_bytes == ring_size(layout.slot_count, layout.slot_bytes);
+    struct stat st;
+    ok = ok && fstat(fds[0], &st) == 0 && (uint64_t)st.st_size >= layout.ring_bytes;
+    if (ok) {
+        void *mapping =
+            mmap(NULL, layout.ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        ok = mapping != MAP_FAILED;
+        if (ok) {
+            producer->ring = (ShmIngestRing *)mapping;
+            producer->ring_bytes = layout.ring_bytes;
+            producer->slot_count = layout.slot_count;
+            producer->slot_bytes = layout.slot_bytes;
+            producer->head = atomic_load_explicit(&producer->ring->head, memory_order_relaxed);
+        }
+    }
+    close_fd(&fds[0]);
+    producer->ready_fd = fds[1];
+    producer->free_fd = fds[2];
+    if (!ok) {
+        shm_ingest_disconnect(producer);
+    }
+    return ok;
+}
+
+/*
+ * Copies one frame into the next slot and signals the server. When every slot
+ * is still in use, waits up to `timeout_ms` for one to be freed; false if none
+ * was, the frame is larger than a slot, or the server hung up.
+ */
+bool shm_ingest_publish(ShmIngestProducer *producer,
+                        const unsigned char *data,
+                        size_t length,
+                        int timeout_ms) {
+    if (producer->ring == NULL || length == 0 || length > producer->slot_bytes) {
+        return false;
+    }
+    ShmIngestRing *ring = producer->ring;
+    while (producer->head - atomic_load_explicit(&ring->tail, memory_order_acquire) >=
+           producer->slot_count) {
+        struct pollfd fds[2] = {{producer->free_fd, POLLIN, 0}, {producer->sock, POLLIN, 0}};
+        int ready = poll(fds, 2, timeout_ms);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ready <= 0 || fds[1].revents != 0) {
+            return false;
+        }
+        uint64_t freed = 0;
+        ssize_t n = read(producer->free_fd, &freed, sizeof(freed));
+        (void)n;
+    }
+
+    size_t index = (size_t)(producer->head % producer->slot_count);
+    memcpy((unsigned char *)ring + SHM_INGEST_HEADER_BYTES + index * producer->slot_bytes, data,
+           length);
+    ring->slots[index].length = (uint32_t)length;
+    producer->head++;
+    atomic_store_explicit(&ring->head, producer->head, memory_order_release);
+    uint64_t one = 1;
+    return write(producer->ready_fd, &one, sizeof(one)) == (ssize_t)sizeof(one);
+}
+
+void shm_ingest_disconnect(ShmIngestProducer *producer) {
+    if (producer->ring != NULL) {
+        munmap(producer->ring, producer->ring_bytes);
+        producer->ring = NULL;
+    }
+    close_fd(&producer->ready_fd);
+    close_fd(&producer->free_fd);
+    close_fd(&producer->sock);
+}
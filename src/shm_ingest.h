@@ -0,0 +1,92 @@
+#ifndef SHM_INGEST_H
+#define SHM_INGEST_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Local frame ingest for camera agents on the same host. A producer connects
+ * to a Unix SOCK_SEQPACKET socket and sends a ShmIngestHello; the server
+ * answers with a ShmIngestLayout and, via SCM_RIGHTS, a sealed memfd holding
+ * a ShmIngestRing followed by the slots, an eventfd the producer writes after
+ * publishing and one the server writes after freeing slots.
+ *
+ * The producer copies a frame into slot `head % slot_count`, stores its
+ * length, advances `head` (release) and writes 1 to the ready eventfd. The
+ * server publishes each slot up to `head` straight from the mapping and
+ * advances `tail`. Nothing is parsed and no socket carries frame bytes.
+ */
+
+#define SHM_INGEST_MAGIC 0x4d485346u /* "FSHM" */
+#define SHM_INGEST_VERSION 1u
+#define SHM_INGEST_MAX_SLOTS 64
+#define SHM_INGEST_HEADER_BYTES 4096
+#define SHM_INGEST_STREAM_ID_SIZE 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    char stream_id[SHM_INGEST_STREAM_ID_SIZE];
+} ShmIngestHello;
+
+/* `slot_count` 0 means the server refused the producer (and sent no descriptors). */
+typedef struct {
+    uint32_t magic;
+    uint32_t slot_count;
+    uint64_t slot_bytes;
+    uint64_t ring_bytes;
+} ShmIngestLayout;
+
+typedef struct {
+    uint32_t length;
+    uint32_t reserved;
+} ShmIngestSlot;
+
+/* At offset 0 of the memfd; slot i starts at SHM_INGEST_HEADER_BYTES + i * slot_bytes. */
+typedef struct {
+    _Atomic uint64_t head;
+    char head_pad[56];
+    _Atomic uint64_t tail;
+    char tail_pad[56];
+    ShmIngestSlot slots[SHM_INGEST_MAX_SLOTS];
+} ShmIngestRing;
+
+typedef struct {
+    size_t producers;
+    uint64_t connected;
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t rejected;
+    uint64_t dropped_producers;
+} ShmIngestStats;
+
+/* Server side; everything runs on the accept thread. */
+bool shm_ingest_open(const char *path, size_t slot_count, size_t slot_bytes);
+int shm_ingest_fd(void);
+size_t shm_ingest_poll(void);
+void shm_ingest_close(bool remove_path);
+void shm_ingest_stats(ShmIngestStats *out);
+size_t shm_ingest_format_stats_json(const ShmIngestStats *stats, char *out, size_t capacity);
+
+/* Producer side, for agents written in C (and the tests). */
+typedef struct {
+    int sock;
+    int ready_fd;
+    int free_fd;
+    ShmIngestRing *ring;
+    size_t ring_bytes;
+    uint32_t slot_count;
+    size_t slot_bytes;
+    uint64_t head;
+} ShmIngestProducer;
+
+bool shm_ingest_connect(const char *path, const char *stream_id, ShmIngestProducer *producer);
+bool shm_ingest_publish(ShmIngestProducer *producer,
+                        const unsigned char *data,
+                        size_t length,
+                        int timeout_ms);
+void shm_ingest_disconnect(ShmIngestProducer *producer);
+
+#endif
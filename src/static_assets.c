@@ -7,13 +7,13 @@
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct {
+struct StaticAsset {
     const char *url_path;
     const char *file_name;
     const char *content_type;
     unsigned char *contents;
     size_t contents_len;
-} StaticAsset;
+};
 
 static StaticAsset static_assets[] = {
     {"/", "index.html", "text/html; charset=utf-8", NULL, 0},
@@ -99,22 +99,33 @@ bool load_static_assets(void) {
     return true;
 }
 
+/* The asset at `index` of the table, or NULL past its end; the router registers each one. */
+const StaticAsset *static_asset_at(size_t index) {
+    size_t asset_count = sizeof(static_assets) / sizeof(static_assets[0]);
+    return index < asset_count ? &static_assets[index] : NULL;
+}
+
+const char *static_asset_url_path(const StaticAsset *asset) {
+    return asset->url_path;
+}
+
+void send_static_asset(int client_fd, const StaticAsset *asset) {
+    if (asset->contents == NULL) {
+        send_error_response(client_fd, 500);
+        return;
+    }
+
+    send_http_response(client_fd, "200 OK", asset->content_type, asset->contents,
+                       asset->contents_len, "Cache-Control: no-store\r\n");
+}
+
 bool serve_static_asset(int client_fd, const char *path) {
     size_t asset_count = sizeof(static_assets) / sizeof(static_assets[0]);
     for (size_t i = 0; i < asset_count; i++) {
-        const StaticAsset *asset = &static_assets[i];
-        if (strcmp(path, asset->url_path) != 0) {
-            continue;
-        }
-
-        if (asset->contents == NULL) {
-            send_error_response(client_fd, 500);
+        if (strcmp(path, static_assets[i].url_path) == 0) {
+            send_static_asset(client_fd, &static_assets[i]);
             return true;
         }
-
-        send_http_response(client_fd, "200 OK", asset->content_type, asset->contents,
-                           asset->contents_len, "Cache-Control: no-store\r\n");
-        return true;
     }
 
     return false;
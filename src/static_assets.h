@@ -2,9 +2,16 @@
 #define STATIC_ASSETS_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+typedef struct StaticAsset StaticAsset;
 
 bool load_static_assets(void);
 void free_static_assets(void);
 bool serve_static_asset(int client_fd, const char *path);
 
+const StaticAsset *static_asset_at(size_t index);
+const char *static_asset_url_path(const StaticAsset *asset);
+void send_static_asset(int client_fd, const StaticAsset *asset);
+
 #endif
@@ -0,0 +1,225 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    ThreadPoolTask task;
+    void *arg;
+} PoolTask;
+
+struct ThreadPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    PoolTask *tasks;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    bool stopping;
+    size_t thread_count;
+    pthread_t *threads;
+};
+
+typedef struct {
+    ThreadPoolRangeFn fn;
+    void *arg;
+    size_t count;
+    size_t grain;
+    size_t chunk_count;
+    atomic_size_t next_chunk;
+    atomic_int refs;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t chunks_done;
+} ParallelJob;
+
+static void *pool_worker_main(void *arg) {
+    ThreadPool *pool = (ThreadPool *)arg;
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->count == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        if (pool->count == 0 && pool->stopping) {
+            pthread_mutex_unlock(&pool->mutex);
+            break;
+        }
+        PoolTask task = pool->tasks[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task.task(task.arg);
+    }
+    return NULL;
+}
+
+ThreadPool *thread_pool_create(size_t thread_count, size_t queue_capacity) {
+    if (thread_count == 0 || queue_capacity == 0) {
+        return NULL;
+    }
+
+    ThreadPool *pool = (ThreadPool *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->tasks = (PoolTask *)calloc(queue_capacity, sizeof(*pool->tasks));
+    pool->threads = (pthread_t *)calloc(thread_count, sizeof(*pool->threads));
+    if (pool->tasks == NULL || pool->threads == NULL) {
+        free(pool->tasks);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    pool->capacity = queue_capacity;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (size_t i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_worker_main, pool) != 0) {
+            perror("pthread_create");
+            thread_pool_destroy(pool);
+            return NULL;
+        }
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(ThreadPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (size_t i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+    free(pool->tasks);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t thread_pool_size(const ThreadPool *pool) {
+    return pool != NULL ? pool->thread_count : 0;
+}
+
+size_t thread_pool_pending(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    size_t pending = pool->count;
+    pthread_mutex_unlock(&pool->mutex);
+    return pending;
+}
+
+bool thread_pool_submit(ThreadPool *pool, ThreadPoolTask task, void *arg) {
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->stopping || pool->count == pool->capacity) {
+        pthread_mutex_unlock(&pool->mutex);
+        return false;
+    }
+    PoolTask *slot = &pool->tasks[(pool->head + pool->count) % pool->capacity];
+    slot->task = task;
+    slot->arg = arg;
+    pool->count++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return true;
+}
+
+static void release_job(ParallelJob *job) {
+    if (atomic_fetch_sub(&job->refs, 1) == 1) {
+        pthread_mutex_destroy(&job->mutex);
+        pthread_cond_destroy(&job->cond);
+        free(job);
+    }
+}
+
+static void run_chunks(ParallelJob *job) {
+    size_t done = 0;
+    for (;;) {
+        size_t chunk = atomic_fetch_add(&job->next_chunk, 1);
+        if (chunk >= job->chunk_count) {
+            break;
+        }
+        size_t begin = chunk * job->grain;
+        size_t end = begin + job->grain < job->count ? begin + job->grain : job->count;
+        job->fn(begin, end, job->arg);
+        done++;
+    }
+
+    if (done > 0) {
+        pthread_mutex_lock(&job->mutex);
+        job->chunks_done += done;
+        if (job->chunks_done == job->chunk_count) {
+            pthread_cond_broadcast(&job->cond);
+        }
+        pthread_mutex_unlock(&job->mutex);
+    }
+}
+
+static void parallel_helper(void *arg) {
+    ParallelJob *job = (ParallelJob *)arg;
+    run_chunks(job);
+    release_job(job);
+}
+
+void thread_pool_parallel_for(ThreadPool *pool,
+                              size_t count,
+                              size_t grain,
+                              ThreadPoolRangeFn fn,
+                              void *arg) {
+    if (count == 0) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    size_t chunk_count = (count + grain - 1) / grain;
+    if (pool == NULL || pool->thread_count == 0 || chunk_count == 1) {
+        fn(0, count, arg);
+        return;
+    }
+
+    ParallelJob *job = (ParallelJob *)calloc(1, sizeof(*job));
+    if (job == NULL) {
+        fn(0, count, arg);
+        return;
+    }
+    job->fn = fn;
+    job->arg = arg;
+    job->count = count;
+    job->grain = grain;
+    job->chunk_count = chunk_count;
+    atomic_init(&job->next_chunk, 0);
+    atomic_init(&job->refs, 1);
+    pthread_mutex_init(&job->mutex, NULL);
+    pthread_cond_init(&job->cond, NULL);
+
+    size_t helpers = chunk_count - 1 < pool->thread_count ? chunk_count - 1 : pool->thread_count;
+    for (size_t i = 0; i < helpers; i++) {
+        atomic_fetch_add(&job->refs, 1);
+        if (!thread_pool_submit(pool, parallel_helper, job)) {
+            atomic_fetch_sub(&job->refs, 1);
+            break;
+        }
+    }
+
+    run_chunks(job);
+
+    pthread_mutex_lock(&job->mutex);
+    while (job->chunks_done < job->chunk_count) {
+        pthread_cond_wait(&job->cond, &job->mutex);
+    }
+    pthread_mutex_unlock(&job->mutex);
+    release_job(job);
+}
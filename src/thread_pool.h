@@ -0,0 +1,24 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct ThreadPool ThreadPool;
+
+typedef void (*ThreadPoolTask)(void *arg);
+typedef void (*ThreadPoolRangeFn)(size_t begin, size_t end, void *arg);
+
+ThreadPool *thread_pool_create(size_t thread_count, size_t queue_capacity);
+void thread_pool_destroy(ThreadPool *pool);
+size_t thread_pool_size(const ThreadPool *pool);
+size_t thread_pool_pending(ThreadPool *pool);
+
+bool thread_pool_submit(ThreadPool *pool, ThreadPoolTask task, void *arg);
+void thread_pool_parallel_for(ThreadPool *pool,
+                              size_t count,
+                              size_t grain,
+                              ThreadPoolRangeFn fn,
+                              void *arg);
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "trace.h"
+
+#include "server_config.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TRACE_HAVE_TSC 1
+#include <x86intrin.h>
+#else
+#define TRACE_HAVE_TSC 0
+#endif
+
+#define TRACE_THREAD_NAME_MAX 32
+
+/*
+ * Each thread owns one ring and is its only writer, so recording is a few
+ * plain stores and no lock. A slot's `seq` is zero while it is rewritten and
+ * its position plus one afterwards; the exporter copies a slot and keeps it
+ * only if `seq` read the same before and after. Rings outlive their threads:
+ * when a thread exits its ring is handed to the next new thread, spans intact.
+ */
+typedef struct {
+    _Atomic uint64_t seq;
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+    uint64_t id;
+    uint32_t tid;
+} TraceSpan;
+
+typedef struct {
+    _Atomic uint64_t head;
+    bool in_use;
+    uint32_t tid;
+    char name[TRACE_THREAD_NAME_MAX];
+    TraceSpan spans[TRACE_RING_SPANS];
+} TraceRing;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+static uint64_t anchor_ticks = 0;
+static uint64_t anchor_ns = 0;
+static pthread_key_t ring_key;
+static TraceRing *rings[TRACE_MAX_THREADS];
+static size_t ring_count = 0;
+static uint32_t next_tid = 1;
+static _Atomic uint64_t next_request_id = 1;
+static _Atomic uint64_t dropped = 0;
+
+static _Thread_local TraceRing *local_ring = NULL;
+static _Thread_local bool local_unavailable = false;
+static _Thread_local uint64_t local_request = 0;
+
+static void release_ring(void *arg) {
+    TraceRing *ring = (TraceRing *)arg;
+    pthread_mutex_lock(&registry_mutex);
+    ring->in_use = false;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Pairs a tick with CLOCK_MONOTONIC; export measures the tick rate against it. */
+static void init_registry(void) {
+    pthread_key_create(&ring_key, release_ring);
+    anchor_ticks = trace_clock();
+    anchor_ns = monotonic_ns();
+}
+
+/* Finds this thread a ring on its first span; NULL once every slot is taken. */
+static TraceRing *acquire_ring(void) {
+    pthread_once(&registry_once, init_registry);
+    pthread_mutex_lock(&registry_mutex);
+    TraceRing *ring = NULL;
+    for (size_t i = 0; i < ring_count && ring == NULL; i++) {
+        if (!rings[i]->in_use) {
+            ring = rings[i];
+        }
+    }
+    if (ring == NULL && ring_count < TRACE_MAX_THREADS) {
+        ring = (TraceRing *)calloc(1, sizeof(*ring));
+        if (ring != NULL) {
+            rings[ring_count++] = ring;
+        }
+    }
+    if (ring != NULL) {
+        ring->in_use = true;
+        ring->tid = next_tid++;
+        snprintf(ring->name, sizeof(ring->name), "thread-%u", (unsigned)ring->tid);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (ring != NULL) {
+        pthread_setspecific(ring_key, ring);
+    }
+    return ring;
+}
+
+static TraceRing *thread_ring(void) {
+    if (local_ring == NULL && !local_unavailable) {
+        local_ring = acquire_ring();
+        local_unavailable = local_ring == NULL;
+    }
+    return local_ring;
+}
+
+/*
+ * The TSC costs a few nanoseconds to read where clock_gettime() can cost tens
+ * (more under some hypervisors); it is assumed invariant, as on any x86 CPU
+ * of the last decade.
+ */
+uint64_t trace_clock(void) {
+#if TRACE_HAVE_TSC
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+void trace_record(const char *name, uint64_t start, uint64_t end, uint64_t id) {
+    TraceRing *ring = thread_ring();
+    if (ring == NULL) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        return;
+    }
+    uint64_t position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    TraceSpan *span = &ring->spans[position % TRACE_RING_SPANS];
+    atomic_store_explicit(&span->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    span->name = name;
+    span->start = start;
+    span->end = end > start ? end : start;
+    span->id = id;
+    span->tid = ring->tid;
+    atomic_store_explicit(&span->seq, position + 1, memory_order_release);
+    atomic_store_explicit(&ring->head, position + 1, memory_order_release);
+}
+
+uint64_t trace_request_begin(void) {
+    local_request = atomic_fetch_add_explicit(&next_request_id, 1, memory_order_relaxed);
+    return local_request;
+}
+
+void trace_set_request(uint64_t id) {
+    local_request = id;
+}
+
+uint64_t trace_current_request(void) {
+    return local_request;
+}
+
+void trace_set_thread_name(const char *name) {
+    TraceRing *ring = thread_ring();
+    if (ring == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&registry_mutex);
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static bool read_span(const TraceRing *ring, uint64_t position, TraceSpan *out) {
+    const TraceSpan *span = &ring->spans[position % TRACE_RING_SPANS];
+    uint64_t before = atomic_load_explicit(&span->seq, memory_order_acquire);
+    if (before != position + 1) {
+        return false;
+    }
+    out->name = span->name;
+    out->start = span->start;
+    out->end = span->end;
+    out->id = span->id;
+    out->tid = span->tid;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&span->seq, memory_order_relaxed) == before;
+}
+
+static double measure_ns_per_tick(void) {
+#if TRACE_HAVE_TSC
+    uint64_t ticks = trace_clock();
+    uint64_t ns = monotonic_ns();
+    if (ticks > anchor_ticks && ns > anchor_ns) {
+        return (double)(ns - anchor_ns) / (double)(ticks - anchor_ticks);
+    }
+#endif
+    return 1.0;
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks, double ns_per_tick) {
+    double ns = (double)anchor_ns + (double)(int64_t)(ticks - anchor_ticks) * ns_per_tick;
+    return ns > 0.0 ? (uint64_t)ns : 0;
+}
+
+static bool append(char *buffer, size_t capacity, size_t *used, const char *text, size_t length) {
+    if (*used + length >= capacity) {
+        return false;
+    }
+    memcpy(buffer + *used, text, length);
+    *used += length;
+    buffer[*used] = '\0';
+    return true;
+}
+
+/*
+ * Writes `{"traceEvents":[...]}`: one thread-name metadata event per ring,
+ * then every span still in the rings as a complete ("X") event with times
+ * in microseconds. Spans that do not fit are left out, so the output stays
+ * valid JSON at any capacity of at least 32 bytes. Returns the length.
+ */
+size_t trace_format_json(char *buffer, size_t capacity) {
+    static const char open[] = "{\"traceEvents\":[";
+    static const char close[] = "]}";
+    size_t used = 0;
+    if (capacity < sizeof(open) + sizeof(close) ||
+        !append(buffer, capacity, &used, open, sizeof(open) - 1)) {
+        return 0;
+    }
+    /* Keep room for the closing brackets whatever happens below. */
+    size_t limit = capacity - (sizeof(close) - 1);
+    pthread_once(&registry_once, init_registry);
+    double ns_per_tick = measure_ns_per_tick();
+
+    TraceRing *snapshot[TRACE_MAX_THREADS];
+    char names[TRACE_MAX_THREADS][TRACE_THREAD_NAME_MAX];
+    uint32_t tids[TRACE_MAX_THREADS];
+    pthread_mutex_lock(&registry_mutex);
+    size_t count = ring_count;
+    for (size_t i = 0; i < count; i++) {
+        snapshot[i] = rings[i];
+        tids[i] = rings[i]->tid;
+        memcpy(names[i], rings[i]->name, sizeof(names[i]));
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    char event[256];
+    bool first = true;
+    bool room = true;
+    for (size_t i = 0; i < count && room; i++) {
+        int n = snprintf(event, sizeof(event),
+                         "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                         "\"args\":{\"name\":\"%s\"}}",
+                         first ? "" : ",", (unsigned)tids[i], names[i]);
+        room = n > 0 && (size_t)n < sizeof(event) &&
+               append(buffer, limit, &used, event, (size_t)n);
+        first = false;
+    }
+
+    for (size_t i = 0; i < count && room; i++) {
+        const TraceRing *ring = snapshot[i];
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t begin = head > TRACE_RING_SPANS ? head - TRACE_RING_SPANS : 0;
+        for (uint64_t position = begin; position < head && room; position++) {
+            TraceSpan span;
+            if (!read_span(ring, position, &span)) {
+                continue;
+            }
+            uint64_t start = ticks_to_ns(span.start, ns_per_tick);
+            uint64_t duration = ticks_to_ns(span.end, ns_per_tick) - start;
+            int n = snprintf(event, sizeof(event),
+                             "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                             "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"args\":{\"request\":%llu}}",
+                             first ? "" : ",", span.name, (unsigned)span.tid,
+                             (unsigned long long)(start / 1000u), (unsigned)(start % 1000u),
+                             (unsigned long long)(duration / 1000u),
+                             (unsigned)(duration % 1000u), (unsigned long long)span.id);
+            room = n > 0 && (size_t)n < sizeof(event) &&
+                   append(buffer, limit, &used, event, (size_t)n);
+            first = false;
+        }
+    }
+
+    append(buffer, capacity, &used, close, sizeof(close) - 1);
+    return used;
+}
+
+/* Enough room for every span the rings can currently hold. */
+size_t trace_json_capacity(void) {
+    pthread_mutex_lock(&registry_mutex);
+    size_t count = ring_count;
+    pthread_mutex_unlock(&registry_mutex);
+    return 64 + count * (TRACE_RING_SPANS + 1) * TRACE_JSON_EVENT_BYTES;
+}
+
+void trace_stats(TraceStats *out) {
+    pthread_mutex_lock(&registry_mutex);
+    out->threads = ring_count;
+    out->recorded = 0;
+    for (size_t i = 0; i < ring_count; i++) {
+        out->recorded += atomic_load_explicit(&rings[i]->head, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    out->dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+}
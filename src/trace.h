@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Request-scoped spans recorded into per-thread rings and exported as Chrome
+ * trace-event JSON (`GET /debug/trace`). Built with WEB_SERVER_TRACING; without
+ * it every call below is an empty inline function and TRACE_* expand to nothing
+ * (their arguments are not evaluated).
+ */
+
+typedef struct {
+    size_t threads;
+    uint64_t recorded;
+    uint64_t dropped;
+} TraceStats;
+
+#ifdef WEB_SERVER_TRACING
+
+/* Timestamps are opaque ticks (the TSC on x86), converted only at export. */
+uint64_t trace_clock(void);
+void trace_record(const char *name, uint64_t start, uint64_t end, uint64_t id);
+
+uint64_t trace_request_begin(void);
+void trace_set_request(uint64_t id);
+uint64_t trace_current_request(void);
+void trace_set_thread_name(const char *name);
+
+size_t trace_format_json(char *buffer, size_t capacity);
+size_t trace_json_capacity(void);
+void trace_stats(TraceStats *out);
+
+/* `name` must be a string literal: rings keep the pointer, not a copy. */
+#define TRACE_SPAN(name, start, end, id) trace_record(name, start, end, id)
+#define TRACE_START(var) uint64_t var = trace_clock()
+#define TRACE_END(name, var) trace_record(name, var, trace_clock(), trace_current_request())
+#define TRACE_END_ID(name, var, id) trace_record(name, var, trace_clock(), id)
+
+#else
+
+static inline uint64_t trace_clock(void) {
+    return 0;
+}
+
+static inline uint64_t trace_request_begin(void) {
+    return 0;
+}
+static inline void trace_set_request(uint64_t id) {
+    (void)id;
+}
+static inline uint64_t trace_current_request(void) {
+    return 0;
+}
+static inline void trace_set_thread_name(const char *name) {
+    (void)name;
+}
+static inline size_t trace_format_json(char *buffer, size_t capacity) {
+    (void)buffer;
+    (void)capacity;
+    return 0;
+}
+static inline size_t trace_json_capacity(void) {
+    return 0;
+}
+static inline void trace_stats(TraceStats *out) {
+    out->threads = 0;
+    out->recorded = 0;
+    out->dropped = 0;
+}
+
+#define TRACE_SPAN(name, start, end, id) ((void)0)
+#define TRACE_START(var) ((void)0)
+#define TRACE_END(name, var) ((void)0)
+#define TRACE_END_ID(name, var, id) ((void)0)
+
+#endif
+
+#endif
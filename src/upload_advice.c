@@ -0,0 +1,192 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "upload_advice.h"
+
+#include "pipeline.h"
+#include "server_config.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define OVERLOADED_QUEUE_FILL 0.5
+#define IDLE_QUEUE_FILL 0.25
+
+/* Upload sizes from best to cheapest; the last one is what the detector reads. */
+static const struct {
+    unsigned max_width;
+    unsigned quality;
+} levels[] = {
+    {640, 70},
+    {480, 60},
+    {DETECTOR_INPUT_WIDTH, 50},
+};
+#define LEVEL_COUNT (sizeof(levels) / sizeof(levels[0]))
+
+typedef struct {
+    uint64_t stream;
+    uint64_t last_seen_ms;
+    uint64_t last_adjust_ms;
+    unsigned interval_ms;
+    size_t level;
+} StreamAdvice;
+
+static pthread_mutex_t advice_mutex = PTHREAD_MUTEX_INITIALIZER;
+static StreamAdvice streams[UPLOAD_ADVICE_MAX_STREAMS];
+static uint64_t sample_ms = 0;
+static uint64_t sample_compute_us = 0;
+static double sampled_busy = 0.0;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/*
+ * Reads the pipeline's load. Busy is the share of worker time spent on
+ * batches over the last UPLOAD_ADVICE_WINDOW_MS, so it is measured rather
+ * than estimated from frame counts; it is refreshed once per window.
+ */
+static void sample_load(uint64_t now_ms, UploadLoad *out) {
+    PipelineStats stats;
+    pipeline_stats(&stats);
+    if (sample_ms == 0 || stats.compute_us < sample_compute_us) {
+        sample_ms = now_ms;
+        sample_compute_us = stats.compute_us;
+    } else if (now_ms - sample_ms >= UPLOAD_ADVICE_WINDOW_MS && stats.workers > 0) {
+        double available_us = (double)(now_ms - sample_ms) * 1000.0 * (double)stats.workers;
+        sampled_busy = (double)(stats.compute_us - sample_compute_us) / available_us;
+        sampled_busy = sampled_busy < 1.0 ? sampled_busy : 1.0;
+        sample_ms = now_ms;
+        sample_compute_us = stats.compute_us;
+    }
+    out->busy = sampled_busy;
+    out->queue_fill =
+        stats.queue_capacity > 0 ? (double)stats.queue_depth / (double)stats.queue_capacity : 0.0;
+    out->frame_cost_us = stats.frame_cost_us;
+    out->workers = stats.workers;
+}
+
+/* The stream's slot; an unknown stream takes a free slot or the least recently seen one. */
+static StreamAdvice *find_stream(uint64_t stream, uint64_t now_ms, bool *created) {
+    StreamAdvice *oldest = &streams[0];
+    for (size_t i = 0; i < UPLOAD_ADVICE_MAX_STREAMS; i++) {
+        if (streams[i].last_seen_ms != 0 && streams[i].stream == stream) {
+            *created = false;
+            return &streams[i];
+        }
+        if (streams[i].last_seen_ms < oldest->last_seen_ms) {
+            oldest = &streams[i];
+        }
+    }
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->stream = stream;
+    oldest->last_adjust_ms = now_ms;
+    *created = true;
+    return oldest;
+}
+
+static size_t active_streams(uint64_t now_ms) {
+    size_t count = 0;
+    for (size_t i = 0; i < UPLOAD_ADVICE_MAX_STREAMS; i++) {
+        if (streams[i].last_seen_ms != 0 &&
+            now_ms - streams[i].last_seen_ms < UPLOAD_ADVICE_IDLE_MS) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Smallest interval that keeps the pipeline under the target busy share if
+ * every active stream uploaded at it: frame cost times streams, spread over
+ * the workers.
+ */
+static unsigned fair_interval_ms(const UploadLoad *load, size_t streams_active) {
+    if (load->frame_cost_us == 0 || load->workers == 0) {
+        return UPLOAD_MIN_INTERVAL_MS;
+    }
+    double interval_us = (double)load->frame_cost_us * (double)streams_active * 100.0 /
+                         ((double)load->workers * UPLOAD_TARGET_BUSY_PERCENT);
+    double interval_ms = interval_us / 1000.0;
+    if (interval_ms < UPLOAD_MIN_INTERVAL_MS) {
+        return UPLOAD_MIN_INTERVAL_MS;
+    }
+    return interval_ms > UPLOAD_MAX_INTERVAL_MS ? UPLOAD_MAX_INTERVAL_MS : (unsigned)interval_ms;
+}
+
+/*
+ * Advice for one upload of `stream_id` under `load`. A stream's advice moves
+ * at most one step per UPLOAD_ADVICE_WINDOW_MS, so a burst of uploads does
+ * not ratchet it all the way down before the load has had time to change.
+ */
+void upload_advice_compute(const char *stream_id,
+                           const UploadLoad *load,
+                           uint64_t now_ms,
+                           UploadAdvice *out) {
+    double target = UPLOAD_TARGET_BUSY_PERCENT / 100.0;
+    bool overloaded = load->busy > target || load->queue_fill >= OVERLOADED_QUEUE_FILL;
+    bool idle = load->busy < target * 0.75 && load->queue_fill < IDLE_QUEUE_FILL;
+
+    pthread_mutex_lock(&advice_mutex);
+    bool created = false;
+    StreamAdvice *entry = find_stream(pipeline_stream_key(stream_id), now_ms, &created);
+    entry->last_seen_ms = now_ms;
+    unsigned floor_ms = fair_interval_ms(load, active_streams(now_ms));
+    if (created) {
+        entry->interval_ms = floor_ms;
+    } else if (now_ms - entry->last_adjust_ms >= UPLOAD_ADVICE_WINDOW_MS &&
+               (overloaded || idle)) {
+        entry->last_adjust_ms = now_ms;
+        if (overloaded && entry->level + 1 < LEVEL_COUNT) {
+            entry->level++;
+        } else if (overloaded) {
+            entry->interval_ms += entry->interval_ms / 2;
+        } else if (entry->interval_ms > floor_ms) {
+            entry->interval_ms -= entry->interval_ms / 5;
+        } else if (entry->level > 0) {
+            entry->level--;
+        }
+    }
+    if (entry->interval_ms < floor_ms) {
+        entry->interval_ms = floor_ms;
+    }
+    if (entry->interval_ms > UPLOAD_MAX_INTERVAL_MS) {
+        entry->interval_ms = UPLOAD_MAX_INTERVAL_MS;
+    }
+    out->interval_ms = entry->interval_ms;
+    out->max_width = levels[entry->level].max_width;
+    out->quality = levels[entry->level].quality;
+    pthread_mutex_unlock(&advice_mutex);
+}
+
+void upload_advice_for_stream(const char *stream_id, UploadAdvice *out) {
+    uint64_t now_ms = monotonic_ms();
+    UploadLoad load;
+    pthread_mutex_lock(&advice_mutex);
+    sample_load(now_ms, &load);
+    pthread_mutex_unlock(&advice_mutex);
+    upload_advice_compute(stream_id, &load, now_ms, out);
+}
+
+void upload_advice_reset(void) {
+    pthread_mutex_lock(&advice_mutex);
+    memset(streams, 0, sizeof(streams));
+    sample_ms = 0;
+    sample_compute_us = 0;
+    sampled_busy = 0.0;
+    pthread_mutex_unlock(&advice_mutex);
+}
+
+size_t upload_advice_format_json(const UploadAdvice *advice, char *buffer, size_t capacity) {
+    int n = snprintf(buffer, capacity, "{\"interval_ms\":%u,\"max_width\":%u,\"quality\":%u}",
+                     advice->interval_ms, advice->max_width, advice->quality);
+    if (n < 0 || (size_t)n >= capacity) {
+        return 0;
+    }
+    return (size_t)n;
+}
@@ -0,0 +1,37 @@
+#ifndef UPLOAD_ADVICE_H
+#define UPLOAD_ADVICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * How often, how large and at what JPEG quality a camera should upload,
+ * returned with every `POST /api/frame`. The advice follows pipeline load:
+ * under pressure a stream first drops resolution and quality, then its frame
+ * rate; with headroom it regains frame rate first, then quality. Every
+ * stream's interval is kept at or above its fair share of the pipeline.
+ */
+typedef struct {
+    unsigned interval_ms;
+    unsigned max_width;
+    unsigned quality;
+} UploadAdvice;
+
+/* Pipeline load as the advice sees it. */
+typedef struct {
+    double busy;
+    double queue_fill;
+    uint64_t frame_cost_us;
+    size_t workers;
+} UploadLoad;
+
+void upload_advice_for_stream(const char *stream_id, UploadAdvice *out);
+void upload_advice_compute(const char *stream_id,
+                           const UploadLoad *load,
+                           uint64_t now_ms,
+                           UploadAdvice *out);
+void upload_advice_reset(void);
+size_t upload_advice_format_json(const UploadAdvice *advice, char *buffer, size_t capacity);
+
+#endif
@@ -0,0 +1,273 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "access_log.h"
+#include "http.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_DIR "test_access_log_data"
+#define LOG_PATH LOG_DIR "/access.log"
+#define WRITERS 8
+#define RECORDS_PER_WRITER 20000
+
+static void remove_log_dir(void) {
+    DIR *dir = opendir(LOG_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char path[512];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", LOG_DIR, entry->d_name);
+            remove(path);
+        }
+    }
+    closedir(dir);
+    rmdir(LOG_DIR);
+}
+
+static AccessLogParams test_params(void) {
+    AccessLogParams params;
+    memset(&params, 0, sizeof(params));
+    params.path = LOG_PATH;
+    params.block_bytes = 4096;
+    params.max_pending_blocks = 1024;
+    params.flush_ms = 5;
+    return params;
+}
+
+/* Returns the file's contents, NUL-terminated; NULL if it does not exist. */
+static char *read_file(const char *path, size_t *length_out) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    struct stat st;
+    assert(fstat(fileno(file), &st) == 0);
+    char *data = (char *)malloc((size_t)st.st_size + 1);
+    assert(data != NULL);
+    size_t length = fread(data, 1, (size_t)st.st_size, file);
+    data[length] = '\0';
+    fclose(file);
+    if (length_out != NULL) {
+        *length_out = length;
+    }
+    return data;
+}
+
+static size_t count_lines(const char *text) {
+    size_t lines = 0;
+    for (const char *p = strchr(text, '\n'); p != NULL; p = strchr(p + 1, '\n')) {
+        lines++;
+    }
+    return lines;
+}
+
+/* Points just past `field` within [line, end), or NULL. */
+static char *find_field(char *line, const char *end, const char *field) {
+    size_t length = strlen(field);
+    for (char *p = line; p + length <= end; p++) {
+        if (memcmp(p, field, length) == 0) {
+            return p + length;
+        }
+    }
+    return NULL;
+}
+
+static void test_records_are_json_lines(void) {
+    remove_log_dir();
+    mkdir(LOG_DIR, 0755);
+    AccessLogParams params = test_params();
+    assert(access_log_open(&params));
+    assert(!access_log_open(&params));
+    access_log_record("POST", "/api/frame", "door", 200, 31, 412);
+    access_log_record("GET", "/a\"b\\c\n", "", 404, 0, 7);
+    access_log_close();
+    access_log_record("GET", "/after-close", NULL, 200, 1, 1);
+
+    char *log = read_file(LOG_PATH, NULL);
+    assert(log != NULL);
+    assert(count_lines(log) == 2);
+    assert(strncmp(log, "{\"time\":\"", 9) == 0);
+    /* 2026-10-18T09:15:02.123Z */
+    assert(log[13] == '-' && log[19] == 'T' && log[28] == '.' && log[32] == 'Z');
+    assert_contains(log, "\",\"method\":\"POST\",\"path\":\"/api/frame\",\"status\":200,"
+                         "\"bytes\":31,\"latency_us\":412,\"stream\":\"door\"}\n");
+    assert_contains(log, "\"method\":\"GET\",\"path\":\"/a\\\"b\\\\c\",\"status\":404,"
+                         "\"bytes\":0,\"latency_us\":7,\"stream\":null}\n");
+    assert(strstr(log, "after-close") == NULL);
+    free(log);
+
+    AccessLogStats stats;
+    access_log_stats(&stats);
+    assert(stats.records == 2 && stats.dropped == 0 && stats.pending_blocks == 0);
+    assert(stats.bytes_written > 0 && stats.write_errors == 0);
+    remove_log_dir();
+}
+
+static void *write_records(void *arg) {
+    int writer = (int)(size_t)arg;
+    char path[64];
+    for (int i = 0; i < RECORDS_PER_WRITER; i++) {
+        snprintf(path, sizeof(path), "/w/%d/%d", writer, i);
+        access_log_record("GET", path, "cam", 200, (size_t)i, 1);
+    }
+    return NULL;
+}
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Exiting threads hand over their last block; every record lands once, in order per thread. */
+static void test_threads_keep_their_order(void) {
+    remove_log_dir();
+    mkdir(LOG_DIR, 0755);
+    AccessLogParams params = test_params();
+    params.max_pending_blocks = 65536;
+    assert(access_log_open(&params));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_t threads[WRITERS];
+    for (size_t i = 0; i < WRITERS; i++) {
+        assert(pthread_create(&threads[i], NULL, write_records, (void *)i) == 0);
+    }
+    for (size_t i = 0; i < WRITERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = seconds_since(&start);
+    access_log_close();
+    printf("access log: %d records from %d threads in %.3f s (%.0f records/s)\n",
+           WRITERS * RECORDS_PER_WRITER, WRITERS, elapsed,
+           (double)(WRITERS * RECORDS_PER_WRITER) / elapsed);
+
+    AccessLogStats stats;
+    access_log_stats(&stats);
+    assert(stats.dropped == 0);
+    assert(stats.pending_blocks == 0);
+
+    char *log = read_file(LOG_PATH, NULL);
+    assert(log != NULL);
+    assert(count_lines(log) == (size_t)WRITERS * RECORDS_PER_WRITER);
+    /* Walked line by line: strstr()/sscanf() over the whole log would go quadratic. */
+    int next[WRITERS] = {0};
+    for (char *line = log, *end = strchr(line, '\n'); end != NULL;
+         line = end + 1, end = strchr(line, '\n')) {
+        char *path = find_field(line, end, "\"path\":\"/w/");
+        assert(path != NULL);
+        long writer = strtol(path, &path, 10);
+        assert(*path == '/' && writer >= 0 && writer < WRITERS);
+        long seq = strtol(path + 1, &path, 10);
+        assert(*path == '"' && seq == next[writer]);
+        next[writer]++;
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        assert(next[i] == RECORDS_PER_WRITER);
+    }
+    free(log);
+    remove_log_dir();
+}
+
+static void test_rotation_keeps_max_files(void) {
+    remove_log_dir();
+    mkdir(LOG_DIR, 0755);
+    AccessLogParams params = test_params();
+    params.rotate_bytes = 8192;
+    params.max_files = 2;
+    assert(access_log_open(&params));
+    char path[64];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(path, sizeof(path), "/r/%d", i);
+        access_log_record("GET", path, NULL, 200, 0, 0);
+        if (i % 100 == 0) {
+            struct timespec pause = {0, 10 * 1000000L};
+            nanosleep(&pause, NULL);
+        }
+    }
+    access_log_close();
+
+    AccessLogStats stats;
+    access_log_stats(&stats);
+    assert(stats.rotations >= 2);
+    size_t newest_length = 0;
+    char *newest = read_file(LOG_PATH, &newest_length);
+    char *first = read_file(LOG_PATH ".1", NULL);
+    char *second = read_file(LOG_PATH ".2", NULL);
+    assert(newest != NULL && first != NULL && second != NULL);
+    assert(read_file(LOG_PATH ".3", NULL) == NULL);
+    /* The last write may itself have triggered a rotation. */
+    assert(strstr(newest, "\"path\":\"/r/1999\"") != NULL ||
+           (newest_length == 0 && strstr(first, "\"path\":\"/r/1999\"") != NULL));
+    assert(strstr(first, "\"path\":\"/r/0\"") == NULL);
+    free(newest);
+    free(first);
+    free(second);
+    remove_log_dir();
+}
+
+/* With the writer asleep and no block to spare, records are dropped, never waited for. */
+static void test_backlog_drops_instead_of_blocking(void) {
+    remove_log_dir();
+    mkdir(LOG_DIR, 0755);
+    AccessLogParams params = test_params();
+    params.block_bytes = 1024;
+    params.max_pending_blocks = 1;
+    params.flush_ms = 60000;
+    assert(access_log_open(&params));
+    for (int i = 0; i < 100; i++) {
+        access_log_record("GET", "/drop", NULL, 200, 0, 0);
+    }
+    AccessLogStats stats;
+    access_log_stats(&stats);
+    assert(stats.dropped > 0 && stats.records + stats.dropped == 100);
+    assert(stats.pending_blocks == 1);
+    access_log_close();
+
+    char *log = read_file(LOG_PATH, NULL);
+    assert(log != NULL && count_lines(log) == stats.records);
+    free(log);
+    assert(!access_log_open(&(AccessLogParams){"", 0, 0, 4096, 1, 5}));
+    remove_log_dir();
+}
+
+static void test_response_info(void) {
+    int fds[2];
+    make_socket_pair(fds);
+    int status = 0;
+    size_t bytes = 0;
+    http_response_reset();
+    assert(!http_last_response(&status, &bytes));
+    send_error_response(fds[0], 404);
+    close(fds[0]);
+    char response[1024];
+    size_t n = read_all_or_fail(fds[1], response, sizeof(response));
+    close(fds[1]);
+    assert(http_last_response(&status, &bytes));
+    assert(status == 404 && bytes == n);
+}
+
+int main(void) {
+    test_records_are_json_lines();
+    test_threads_keep_their_order();
+    test_rotation_keeps_max_files();
+    test_backlog_drops_instead_of_blocking();
+    test_response_info();
+    puts("test_access_log: OK");
+    return 0;
+}
@@ -0,0 +1,209 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "batch_scheduler.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static BatchScheduler *make_scheduler(size_t capacity,
+                                      size_t max_batch,
+                                      uint64_t max_wait_us,
+                                      uint64_t slo_us) {
+    BatchSchedulerParams params = {capacity, max_batch, max_wait_us, slo_us};
+    BatchScheduler *scheduler = batch_scheduler_create(&params);
+    assert(scheduler != NULL);
+    return scheduler;
+}
+
+static void submit(BatchScheduler *scheduler, uint64_t stream, uint64_t seq, BatchItem *displaced,
+                   bool *has_displaced) {
+    assert(batch_scheduler_submit(scheduler, stream, seq, (void *)(uintptr_t)seq, displaced,
+                                  has_displaced));
+}
+
+static void test_rejects_bad_params(void) {
+    BatchSchedulerParams params = {0, 4, 1000, 10000};
+    assert(batch_scheduler_create(&params) == NULL);
+    params.capacity = 4;
+    params.max_batch = BATCH_SCHEDULER_MAX_BATCH + 1;
+    assert(batch_scheduler_create(&params) == NULL);
+}
+
+static void test_newer_frame_replaces_stale_one(void) {
+    BatchScheduler *scheduler = make_scheduler(8, 4, 0, 100000);
+    BatchItem displaced;
+    bool has_displaced;
+
+    submit(scheduler, 1, 1, &displaced, &has_displaced);
+    assert(!has_displaced);
+    submit(scheduler, 2, 2, &displaced, &has_displaced);
+    assert(!has_displaced);
+    submit(scheduler, 1, 3, &displaced, &has_displaced);
+    assert(has_displaced && displaced.seq == 1 && displaced.stream == 1);
+
+    /* Stream 1 keeps its place at the head, but with the newer frame. */
+    BatchItem batch[4];
+    size_t count = batch_scheduler_next(scheduler, batch, 4);
+    assert(count == 2);
+    assert(batch[0].stream == 1 && batch[0].seq == 3);
+    assert(batch[1].stream == 2 && batch[1].seq == 2);
+    assert(batch[0].enqueue_us <= batch[1].enqueue_us);
+
+    BatchSchedulerStats stats;
+    batch_scheduler_stats(scheduler, &stats);
+    assert(stats.submitted == 3 && stats.replaced == 1 && stats.evicted == 0);
+    assert(stats.batches == 1 && stats.items == 2 && stats.queue_depth == 0);
+    batch_scheduler_free(scheduler);
+}
+
+static void test_full_queue_evicts_oldest(void) {
+    BatchScheduler *scheduler = make_scheduler(2, 2, 0, 100000);
+    BatchItem displaced;
+    bool has_displaced;
+
+    submit(scheduler, 1, 1, &displaced, &has_displaced);
+    submit(scheduler, 2, 2, &displaced, &has_displaced);
+    submit(scheduler, 3, 3, &displaced, &has_displaced);
+    assert(has_displaced && displaced.seq == 1);
+
+    BatchItem batch[2];
+    assert(batch_scheduler_next(scheduler, batch, 2) == 2);
+    assert(batch[0].seq == 2 && batch[1].seq == 3);
+
+    BatchSchedulerStats stats;
+    batch_scheduler_stats(scheduler, &stats);
+    assert(stats.evicted == 1 && stats.replaced == 0);
+    batch_scheduler_free(scheduler);
+}
+
+static void test_deep_queue_dispatches_full_batches(void) {
+    BatchScheduler *scheduler = make_scheduler(16, 4, 1000000, 10000000);
+    BatchItem displaced;
+    bool has_displaced;
+    for (uint64_t seq = 1; seq <= 10; seq++) {
+        submit(scheduler, seq, seq, &displaced, &has_displaced);
+    }
+
+    /* A full batch is ready, so the long wait budget is never spent. */
+    BatchItem batch[8];
+    uint64_t start = monotonic_us();
+    assert(batch_scheduler_next(scheduler, batch, 8) == 4);
+    assert(batch[0].seq == 1 && batch[3].seq == 4);
+    assert(batch_scheduler_next(scheduler, batch, 8) == 4);
+    assert(batch[0].seq == 5);
+    assert(monotonic_us() - start < 500000);
+
+    /* The caller's buffer bounds the batch too. */
+    assert(batch_scheduler_next(scheduler, batch, 1) == 1);
+    assert(batch[0].seq == 9);
+    batch_scheduler_free(scheduler);
+}
+
+static void test_partial_batch_waits_for_deadline(void) {
+    BatchScheduler *scheduler = make_scheduler(8, 4, 20000, 1000000);
+    BatchItem displaced;
+    bool has_displaced;
+    submit(scheduler, 1, 1, &displaced, &has_displaced);
+
+    BatchItem batch[4];
+    uint64_t start = monotonic_us();
+    assert(batch_scheduler_next(scheduler, batch, 4) == 1);
+    uint64_t waited = monotonic_us() - start;
+    assert(waited >= 15000);
+    assert(waited < 1000000);
+
+    BatchSchedulerStats stats;
+    batch_scheduler_stats(scheduler, &stats);
+    assert(stats.queue_wait_us >= 15000);
+    assert(stats.max_queue_wait_us == stats.queue_wait_us);
+    batch_scheduler_free(scheduler);
+}
+
+static void test_slo_shrinks_target_batch(void) {
+    BatchScheduler *scheduler = make_scheduler(16, 8, 0, 40000);
+    BatchItem displaced;
+    bool has_displaced;
+    BatchItem batch[8];
+
+    /* 10ms per item against a 40ms SLO leaves room for at most four. */
+    batch_scheduler_complete(scheduler, 2, 20000);
+    for (uint64_t seq = 1; seq <= 8; seq++) {
+        submit(scheduler, seq, seq, &displaced, &has_displaced);
+    }
+    size_t count = batch_scheduler_next(scheduler, batch, 8);
+    assert(count >= 1 && count <= 4);
+
+    BatchSchedulerStats stats;
+    batch_scheduler_stats(scheduler, &stats);
+    assert(stats.item_cost_us == 10000);
+    assert(stats.target_batch == count);
+    assert(stats.compute_us == 20000);
+
+    /* Cheaper batches pull the average down and the target back up. */
+    for (int i = 0; i < 64; i++) {
+        batch_scheduler_complete(scheduler, 8, 8000);
+    }
+    batch_scheduler_stats(scheduler, &stats);
+    assert(stats.item_cost_us < 2000);
+    while (stats.queue_depth < 8) {
+        submit(scheduler, 100 + stats.queue_depth, 100 + stats.queue_depth, &displaced,
+               &has_displaced);
+        batch_scheduler_stats(scheduler, &stats);
+    }
+    assert(batch_scheduler_next(scheduler, batch, 8) == 8);
+    batch_scheduler_free(scheduler);
+}
+
+static void *consume_all(void *arg) {
+    BatchScheduler *scheduler = (BatchScheduler *)arg;
+    BatchItem batch[4];
+    size_t total = 0;
+    size_t count;
+    while ((count = batch_scheduler_next(scheduler, batch, 4)) > 0) {
+        total += count;
+    }
+    return (void *)(uintptr_t)total;
+}
+
+static void test_shutdown_drains_then_stops(void) {
+    BatchScheduler *scheduler = make_scheduler(8, 4, 10000000, 100000000);
+    BatchItem displaced;
+    bool has_displaced;
+    submit(scheduler, 1, 1, &displaced, &has_displaced);
+    submit(scheduler, 2, 2, &displaced, &has_displaced);
+
+    pthread_t consumer;
+    assert(pthread_create(&consumer, NULL, consume_all, scheduler) == 0);
+    batch_scheduler_shutdown(scheduler);
+    void *total = NULL;
+    pthread_join(consumer, &total);
+    assert((uintptr_t)total == 2);
+
+    assert(!batch_scheduler_submit(scheduler, 3, 3, NULL, &displaced, &has_displaced));
+    BatchItem batch[4];
+    assert(batch_scheduler_next(scheduler, batch, 4) == 0);
+    batch_scheduler_free(scheduler);
+}
+
+int main(void) {
+    test_rejects_bad_params();
+    test_newer_frame_replaces_stale_one();
+    test_full_queue_evicts_oldest();
+    test_deep_queue_dispatches_full_batches();
+    test_partial_batch_waits_for_deadline();
+    test_slo_shrinks_target_batch();
+    test_shutdown_drains_then_stops();
+    puts("test_batch_scheduler: OK");
+    return 0;
+}
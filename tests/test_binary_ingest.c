@@ -0,0 +1,210 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "binary_ingest.h"
+#include "frame_store.h"
+#include "listener.h"
+#include "router.h"
+#include "server_config.h"
+
+#include "test_utils.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CREDITS 2
+
+static struct sockaddr_in server_addr;
+
+/* The server runs on this thread too, so it only makes progress here. */
+static void pump(void) {
+    for (int i = 0; i < 5; i++) {
+        struct pollfd pfd = {binary_ingest_fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 20) > 0) {
+            binary_ingest_poll();
+        }
+    }
+}
+
+static void start_server(void) {
+    FrameStoreParams params = memory_params(1 << 16);
+    params.max_frames = 256;
+    assert(frame_store_open(&params));
+    SocketOptions options;
+    memset(&options, 0, sizeof(options));
+    options.backlog = 16;
+    ListenerSpec spec;
+    assert(listener_spec_parse("127.0.0.1:0", &spec));
+    int listen_fd = listener_open(&spec, &options);
+    assert(listen_fd >= 0);
+    socklen_t length = sizeof(server_addr);
+    assert(getsockname(listen_fd, (struct sockaddr *)&server_addr, &length) == 0);
+    assert(binary_ingest_start(listen_fd, CREDITS));
+    assert(binary_ingest_listen_fd() == listen_fd);
+}
+
+static void stop_server(void) {
+    binary_ingest_stop();
+    assert(binary_ingest_fd() == -1 && binary_ingest_listen_fd() == -1);
+    assert(binary_ingest_poll() == 0);
+    frame_store_close();
+}
+
+static int connect_camera(bool hello) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct timeval timeout = {2, 0};
+    assert(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    assert(connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0);
+    if (hello) {
+        unsigned char message[BINARY_INGEST_HELLO_BYTES];
+        write_all_or_fail(fd, message, binary_ingest_encode_hello(message));
+    }
+    pump();
+    return fd;
+}
+
+static void send_frame(int fd, uint64_t seq, const char *stream_id, const char *payload) {
+    unsigned char message[BINARY_INGEST_FRAME_FIXED_BYTES + BINARY_INGEST_STREAM_ID_MAX];
+    size_t length = binary_ingest_encode_frame(message, seq, 1000 + seq, stream_id,
+                                               strlen(payload));
+    assert(length > 0);
+    write_all_or_fail(fd, message, length);
+    write_all_or_fail(fd, payload, strlen(payload));
+}
+
+/* Reads one server message; returns its type with the body in `body`. */
+static unsigned read_message(int fd, unsigned char *body, size_t capacity) {
+    unsigned char prefix[BINARY_INGEST_PREFIX_BYTES];
+    assert(read_all_or_fail(fd, (char *)prefix, sizeof(prefix)) == sizeof(prefix));
+    size_t length = get_u32(prefix) - 1;
+    assert(length <= capacity);
+    assert(read_all_or_fail(fd, (char *)body, length) == length);
+    return prefix[4];
+}
+
+static void expect_close(int fd, uint16_t status) {
+    unsigned char body[16];
+    assert(read_message(fd, body, sizeof(body)) == BINARY_INGEST_CLOSE);
+    assert(((body[0] << 8) | body[1]) == status);
+    char byte;
+    assert(read(fd, &byte, 1) == 0);
+    close(fd);
+}
+
+/* Reads CREDIT messages until `wanted` credits have come back. */
+static void expect_credits(int fd, uint32_t wanted, uint64_t last_seq) {
+    uint32_t credits = 0;
+    unsigned char body[16];
+    while (credits < wanted) {
+        assert(read_message(fd, body, sizeof(body)) == BINARY_INGEST_CREDIT);
+        credits += get_u32(body);
+    }
+    assert(credits == wanted && get_u64(body + 4) == last_seq);
+}
+
+static void test_frames_and_credits(void) {
+    start_server();
+    int camera = connect_camera(true);
+    unsigned char body[16];
+    assert(read_message(camera, body, sizeof(body)) == BINARY_INGEST_WELCOME);
+    assert(get_u32(body) == CREDITS && get_u32(body + 4) == MAX_FRAME_SIZE);
+
+    /* A full window, then the credits come back once the frames are published. */
+    send_frame(camera, 1, "door", "door-frame-1");
+    send_frame(camera, 2, "door", "door-frame-2");
+    pump();
+    expect_credits(camera, 2, 2);
+    size_t length = 0;
+    const unsigned char *latest = router_latest_frame(&length);
+    assert(length == 12 && memcmp(latest, "door-frame-2", 12) == 0);
+    char response[1024];
+    assert(serve_frame("door", UINT64_MAX / 2, response, sizeof(response)) == 200);
+    assert_contains(response, "door-frame-2");
+
+    /* Frames 3 and 4 never arrived; a refused frame is reported and its credit returned. */
+    send_frame(camera, 5, "door", "door-frame-5");
+    pump();
+    expect_credits(camera, 1, 5);
+    router_set_max_frame_size(4);
+    send_frame(camera, 6, "door", "door-frame-6");
+    pump();
+    router_set_max_frame_size(MAX_FRAME_SIZE);
+    assert(read_message(camera, body, sizeof(body)) == BINARY_INGEST_REJECT);
+    assert(get_u64(body) == 6 && ((body[8] << 8) | body[9]) == 413);
+    expect_credits(camera, 1, 6);
+
+    BinaryIngestStats stats;
+    binary_ingest_stats(&stats);
+    assert(stats.connections == 1 && stats.accepted == 1);
+    assert(stats.frames == 3 && stats.bytes == 36 && stats.rejected == 1);
+    assert(stats.sequence_gaps == 2 && stats.protocol_errors == 0);
+    char json[256];
+    assert(binary_ingest_format_stats_json(&stats, json, sizeof(json)) > 0);
+    assert_contains(json, "\"connections\":1,\"accepted\":1,\"frames\":3");
+
+    /* Hanging up frees the connection. */
+    close(camera);
+    pump();
+    binary_ingest_stats(&stats);
+    assert(stats.connections == 0);
+    stop_server();
+}
+
+static void test_protocol_errors(void) {
+    start_server();
+
+    /* A frame before the hello. */
+    int camera = connect_camera(false);
+    send_frame(camera, 1, "door", "early");
+    pump();
+    expect_close(camera, 400);
+
+    /* One frame more than the window allows. */
+    camera = connect_camera(true);
+    unsigned char body[16];
+    assert(read_message(camera, body, sizeof(body)) == BINARY_INGEST_WELCOME);
+    for (uint64_t seq = 1; seq <= CREDITS + 1; seq++) {
+        send_frame(camera, seq, "door", "too-many");
+    }
+    pump();
+    expect_close(camera, 400);
+
+    /* A length larger than any frame could be. */
+    camera = connect_camera(true);
+    assert(read_message(camera, body, sizeof(body)) == BINARY_INGEST_WELCOME);
+    unsigned char huge[BINARY_INGEST_PREFIX_BYTES] = {0xff, 0xff, 0xff, 0xff,
+                                                      BINARY_INGEST_FRAME};
+    write_all_or_fail(camera, huge, sizeof(huge));
+    pump();
+    expect_close(camera, 413);
+
+    BinaryIngestStats stats;
+    binary_ingest_stats(&stats);
+    assert(stats.connections == 0 && stats.accepted == 3);
+    assert(stats.frames == CREDITS && stats.protocol_errors == 3);
+    stop_server();
+
+    unsigned char header[BINARY_INGEST_FRAME_FIXED_BYTES + BINARY_INGEST_STREAM_ID_MAX];
+    char long_id[BINARY_INGEST_STREAM_ID_MAX + 2];
+    memset(long_id, 'x', sizeof(long_id) - 1);
+    long_id[sizeof(long_id) - 1] = '\0';
+    assert(binary_ingest_encode_frame(header, 1, 1, long_id, 10) == 0);
+    assert(!binary_ingest_start(-1, CREDITS));
+}
+
+int main(void) {
+    test_frames_and_credits();
+    test_protocol_errors();
+    puts("test_binary_ingest: OK");
+    return 0;
+}
@@ -0,0 +1,318 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "cluster.h"
+#include "frame_store.h"
+#include "listener.h"
+#include "router.h"
+#include "server_config.h"
+
+#include "test_utils.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STREAMS 3000
+#define RECORD_DIR "test_cluster_data"
+
+static ListenerSpec node(const char *text) {
+    ListenerSpec spec;
+    assert(listener_spec_parse(text, &spec));
+    return spec;
+}
+
+static void open_store(void) {
+    FrameStoreParams params = memory_params(1 << 16);
+    params.max_frames = 64;
+    assert(frame_store_open(&params));
+}
+
+static void sleep_ms(long ms) {
+    struct timespec pause = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&pause, NULL);
+}
+
+/* The owner of every test stream, by node address, so rings from different lists compare. */
+static void owners(char names[][32]) {
+    for (int i = 0; i < STREAMS; i++) {
+        char stream[32];
+        snprintf(stream, sizeof(stream), "camera-%d", i);
+        assert(cluster_format_node(cluster_owner(stream), names[i], 32) > 0);
+    }
+}
+
+static void test_ring(void) {
+    static char three[STREAMS][32];
+    static char reordered[STREAMS][32];
+    static char four[STREAMS][32];
+    ListenerSpec nodes[4] = {node("127.0.0.1:19001"), node("127.0.0.1:19002"),
+                             node("127.0.0.1:19003"), node("127.0.0.1:19004")};
+
+    assert(cluster_start(nodes, 3, &nodes[0]));
+    assert(!cluster_is_edge());
+    owners(three);
+    int counts[3] = {0, 0, 0};
+    for (int i = 0; i < STREAMS; i++) {
+        counts[three[i][14] - '1']++;
+    }
+    for (int i = 0; i < 3; i++) {
+        assert(counts[i] > STREAMS / 5);
+    }
+    cluster_stop();
+
+    /* Every node builds the same ring whatever order it lists the others in. */
+    ListenerSpec shuffled[3] = {nodes[2], nodes[0], nodes[1]};
+    assert(cluster_start(shuffled, 3, &shuffled[1]));
+    owners(reordered);
+    cluster_stop();
+    for (int i = 0; i < STREAMS; i++) {
+        assert(strcmp(three[i], reordered[i]) == 0);
+    }
+
+    /* A fourth node takes about a quarter of the streams, and only from the others. */
+    assert(cluster_start(nodes, 4, &nodes[3]));
+    owners(four);
+    cluster_stop();
+    int moved = 0;
+    for (int i = 0; i < STREAMS; i++) {
+        if (strcmp(three[i], four[i]) != 0) {
+            assert(strcmp(four[i], "127.0.0.1:19004") == 0);
+            moved++;
+        }
+    }
+    assert(moved > STREAMS / 8 && moved < STREAMS * 3 / 8);
+}
+
+static void test_redirects(void) {
+    ListenerSpec nodes[2] = {node("127.0.0.1:19001"), node("127.0.0.1:19002")};
+    HttpRequest request;
+    memset(&request, 0, sizeof(request));
+    snprintf(request.path, sizeof(request.path), "/api/frame");
+    snprintf(request.query, sizeof(request.query), "stream=door&at=5");
+    char location[256];
+
+    assert(cluster_start(NULL, 0, NULL));
+    assert(cluster_owner("door") == -1);
+    assert(!cluster_redirect_location("door", &request, location, sizeof(location)));
+    ClusterStats standalone;
+    cluster_stats(&standalone);
+    char json[512];
+    assert(cluster_format_stats_json(&standalone, "door", json, sizeof(json)) > 0);
+    assert_contains(json, "\"frames\":0},\"owner\":null}");
+    cluster_stop();
+
+    assert(cluster_start(nodes, 2, &nodes[0]));
+    int owner = cluster_owner("door");
+    assert(owner == 0 || owner == 1);
+    cluster_stop();
+
+    /* The node that owns the stream answers; the other points at it. */
+    assert(cluster_start(nodes, 2, &nodes[owner]));
+    assert(!cluster_redirect_location("door", &request, location, sizeof(location)));
+    cluster_stop();
+    assert(cluster_start(nodes, 2, &nodes[1 - owner]));
+    assert(cluster_redirect_location("door", &request, location, sizeof(location)));
+    char expected[128];
+    snprintf(expected, sizeof(expected), "http://127.0.0.1:1900%d/api/frame?stream=door&at=5",
+             owner + 1);
+    assert(strcmp(location, expected) == 0);
+    ClusterStats stats;
+    cluster_stats(&stats);
+    assert(stats.nodes == 2 && stats.self == 1 - owner && !stats.edge && stats.redirects == 1);
+    assert(cluster_format_stats_json(&stats, NULL, json, sizeof(json)) > 0);
+    assert_contains(json, "{\"role\":\"origin\",\"nodes\":2,");
+    assert(strstr(json, "owner") == NULL);
+    size_t length = cluster_format_stats_json(&stats, "door", json, sizeof(json));
+    assert(length == strlen(json));
+    snprintf(expected, sizeof(expected), ",\"owner\":\"127.0.0.1:1900%d\"}", owner + 1);
+    assert(strcmp(json + length - strlen(expected), expected) == 0);
+    assert(cluster_format_stats_json(&stats, "door", json, length) == 0);
+    cluster_stop();
+
+    /* A node missing from the list is an edge and owns nothing. */
+    ListenerSpec outsider = node("127.0.0.1:19009");
+    assert(cluster_start(nodes, 2, &outsider));
+    assert(cluster_is_edge());
+    assert(cluster_redirect_location("door", &request, location, sizeof(location)));
+    cluster_stop();
+    assert(!cluster_is_edge());
+}
+
+static void read_head(int fd, char *head, size_t capacity) {
+    size_t used = 0;
+    while (used < 4 || memcmp(head + used - 4, "\r\n\r\n", 4) != 0) {
+        assert(used + 1 < capacity);
+        assert(read_all_or_fail(fd, head + used, 1) == 1);
+        used++;
+    }
+    head[used] = '\0';
+}
+
+static void expect_record(int fd, uint64_t time_ms, const char *data) {
+    unsigned char header[FRAME_BATCH_HEADER_BYTES];
+    assert(read_all_or_fail(fd, (char *)header, sizeof(header)) == sizeof(header));
+    assert(get_u64(header) == time_ms);
+    assert(get_u32(header + 8) == strlen(data));
+    char body[64];
+    assert(read_all_or_fail(fd, body, strlen(data)) == strlen(data));
+    assert(memcmp(body, data, strlen(data)) == 0);
+}
+
+static void write_record(int fd, uint64_t time_ms, const char *data) {
+    unsigned char header[FRAME_BATCH_HEADER_BYTES];
+    put_u64(header, time_ms);
+    put_u32(header + 8, (uint32_t)strlen(data));
+    write_all_or_fail(fd, header, sizeof(header));
+    write_all_or_fail(fd, data, strlen(data));
+}
+
+static void test_relay(void) {
+    open_store();
+    assert(cluster_start(NULL, 0, NULL));
+    assert(frame_store_append("door", 1000, (const unsigned char *)"seed", 4, NULL));
+
+    /* A subscriber starts with the newest kept frame, then gets each new one of its stream. */
+    int fds[2];
+    make_socket_pair(fds);
+    struct timeval timeout = {2, 0};
+    assert(setsockopt(fds[1], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    assert(cluster_relay_subscribe(fds[0], "door"));
+    close(fds[0]);
+    char head[512];
+    read_head(fds[1], head, sizeof(head));
+    assert_contains(head, "HTTP/1.1 200 OK\r\n");
+    assert_contains(head, "Content-Type: " FRAME_BATCH_CONTENT_TYPE "\r\n");
+    expect_record(fds[1], 1000, "seed");
+    cluster_relay_publish("yard", 1500, (const unsigned char *)"other", 5);
+    cluster_relay_publish("door", 2000, (const unsigned char *)"next", 4);
+    expect_record(fds[1], 2000, "next");
+
+    ClusterStats stats;
+    cluster_stats(&stats);
+    assert(stats.relay_subscribers == 1 && stats.relay_accepted == 1);
+    assert(stats.relay_frames == 1);
+    char json[512];
+    assert(cluster_format_stats_json(&stats, NULL, json, sizeof(json)) > 0);
+    assert_contains(json, "{\"role\":\"standalone\",\"nodes\":0,\"self\":-1");
+
+    /* Hanging up frees the slot. */
+    close(fds[1]);
+    for (int i = 0; i < 100 && stats.relay_subscribers > 0; i++) {
+        sleep_ms(10);
+        cluster_stats(&stats);
+    }
+    assert(stats.relay_subscribers == 0 && stats.relay_disconnected == 1);
+
+    /* A full relay refuses without writing anything. */
+    int held[CLUSTER_RELAY_MAX_SUBSCRIBERS][2];
+    for (int i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS; i++) {
+        make_socket_pair(held[i]);
+        assert(cluster_relay_subscribe(held[i][0], "yard"));
+    }
+    make_socket_pair(fds);
+    assert(!cluster_relay_subscribe(fds[0], "yard"));
+    close_pair(fds);
+    cluster_stats(&stats);
+    assert(stats.relay_rejected == 1);
+    cluster_stop();
+    for (int i = 0; i < CLUSTER_RELAY_MAX_SUBSCRIBERS; i++) {
+        close_pair(held[i]);
+    }
+    assert(!cluster_relay_subscribe(-1, "door"));
+    frame_store_close();
+}
+
+/* An edge pulls a stream from its owner, played here by the test, and keeps what is newer. */
+static void test_edge(void) {
+    /* Recorded only, next to a stream whose frames are far newer than the owner's. */
+    FrameStoreParams params = memory_params(4);
+    params.record_dir = RECORD_DIR;
+    params.segment_bytes = 4096;
+    params.max_segments = 2;
+    params.index_interval_ms = 100;
+    assert(frame_store_open(&params));
+    assert(frame_store_append("lobby", 50000, (const unsigned char *)"lobby", 5, NULL));
+    SocketOptions options;
+    memset(&options, 0, sizeof(options));
+    options.backlog = 4;
+    ListenerSpec spec = node("127.0.0.1:0");
+    int listen_fd = listener_open(&spec, &options);
+    assert(listen_fd >= 0);
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    assert(getsockname(listen_fd, (struct sockaddr *)&addr, &length) == 0);
+    spec.port = ntohs(addr.sin_port);
+
+    assert(cluster_start(&spec, 1, NULL));
+    assert(cluster_is_edge());
+    assert(cluster_edge_watch("front door"));
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    assert(poll(&pfd, 1, 2000) == 1);
+    int origin = accept(listen_fd, NULL, NULL);
+    assert(origin >= 0);
+    char head[512];
+    read_head(origin, head, sizeof(head));
+    assert_contains(head, "GET /api/frames/live?stream=front%20door HTTP/1.1\r\n");
+
+    static const char ok[] = "HTTP/1.1 200 OK\r\nContent-Type: " FRAME_BATCH_CONTENT_TYPE
+                             "\r\nConnection: close\r\n\r\n";
+    write_all_or_fail(origin, ok, sizeof(ok) - 1);
+    write_record(origin, 10, "first");
+    write_record(origin, 5, "stale");
+    write_record(origin, 20, "second");
+    ClusterStats stats;
+    cluster_stats(&stats);
+    for (int i = 0; i < 200 && stats.edge_frames < 3; i++) {
+        sleep_ms(10);
+        cluster_stats(&stats);
+    }
+    assert(stats.edge_frames == 3 && stats.edge_connects == 1 && stats.edge_streams == 1);
+    assert(frame_store_last_ms("front door") == 20);
+    FrameStoreStats store;
+    frame_store_stats(&store);
+    assert(store.appended == 3 && store.recorded == 3);
+    char response[1024];
+    assert(serve_frame("front door", 15, response, sizeof(response)) == 200);
+    assert_contains(response, "X-Frame-Time: 10\r\n");
+    assert_contains(response, "first");
+    assert(serve_frame("front door", 99, response, sizeof(response)) == 200);
+    assert_contains(response, "second");
+
+    /* Asking again reuses the pull. */
+    assert(cluster_edge_watch("front door"));
+    cluster_stats(&stats);
+    assert(stats.edge_streams == 1);
+    char json[512];
+    assert(cluster_format_stats_json(&stats, NULL, json, sizeof(json)) > 0);
+    assert_contains(json, "\"role\":\"edge\"");
+
+    cluster_stop();
+    char byte;
+    assert(read(origin, &byte, 1) == 0);
+    close(origin);
+    close(listen_fd);
+    assert(!cluster_edge_watch("front door"));
+    frame_store_close();
+    remove(RECORD_DIR "/0000000000050000.frames");
+    remove(RECORD_DIR "/0000000000050000.index");
+    rmdir(RECORD_DIR);
+}
+
+int main(void) {
+    test_ring();
+    test_redirects();
+    test_relay();
+    test_edge();
+    puts("test_cluster: OK");
+    return 0;
+}
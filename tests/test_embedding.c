@@ -0,0 +1,250 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "embedding.h"
+#include "nn_kernels.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MODEL_PATH "test_embedding_model.bin"
+
+static float *make_input(const EmbeddingModel *model, unsigned int seed) {
+    int size = embedding_model_input_size(model);
+    size_t count = (size_t)size * (size_t)size * (size_t)embedding_model_input_channels(model);
+    float *input = (float *)malloc(count * sizeof(float));
+    assert(input != NULL);
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        input[i] = (float)((seed >> 16) & 0xff) / 128.0f - 1.0f;
+    }
+    return input;
+}
+
+static double dot(const float *a, const float *b, size_t n) {
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        sum += (double)a[i] * b[i];
+    }
+    return sum;
+}
+
+static void test_rejects_bad_models(void) {
+    assert(embedding_model_load("does-not-exist.bin") == NULL);
+
+    FILE *file = fopen(MODEL_PATH, "wb");
+    assert(file != NULL);
+    assert(fwrite("FEMB", 1, 4, file) == 4);
+    fclose(file);
+    assert(embedding_model_load(MODEL_PATH) == NULL);
+    remove(MODEL_PATH);
+
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *model = embedding_model_create_random(&spec, 1);
+    assert(model != NULL && embedding_model_save(model, MODEL_PATH));
+    embedding_model_free(model);
+    file = fopen(MODEL_PATH, "r+b");
+    assert(file != NULL);
+    assert(fseek(file, 0, SEEK_END) == 0);
+    long length = ftell(file);
+    fclose(file);
+    assert(truncate(MODEL_PATH, length - 1) == 0);
+    assert(embedding_model_load(MODEL_PATH) == NULL);
+    remove(MODEL_PATH);
+
+    spec.layers[spec.layer_count - 1].out_channels = EMBEDDING_MAX_DIM + 1;
+    assert(embedding_model_create_random(&spec, 1) == NULL);
+}
+
+static void test_save_load_roundtrip(void) {
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *model = embedding_model_create_random(&spec, 42);
+    assert(model != NULL);
+    assert(embedding_model_dim(model) == 128);
+    assert(embedding_model_save(model, MODEL_PATH));
+
+    EmbeddingModel *loaded = embedding_model_load(MODEL_PATH);
+    remove(MODEL_PATH);
+    assert(loaded != NULL);
+    assert(embedding_model_dim(loaded) == embedding_model_dim(model));
+    assert(embedding_model_input_size(loaded) == spec.input_size);
+    assert(embedding_model_mapped_bytes(model) == 0);
+    size_t mapped = embedding_model_mapped_bytes(loaded);
+    assert(mapped > 0);
+    assert(embedding_model_prewarm(loaded) == mapped);
+    assert(embedding_model_resident_bytes(loaded) == mapped);
+
+    EmbeddingWorkspace *workspace = embedding_workspace_create(model);
+    assert(workspace != NULL);
+    float *input = make_input(model, 5);
+    float original[EMBEDDING_MAX_DIM];
+    float reloaded[EMBEDDING_MAX_DIM];
+    assert(embedding_forward(model, EMBEDDING_PRECISION_FLOAT, input, workspace, NULL, original));
+    assert(embedding_forward(loaded, EMBEDDING_PRECISION_FLOAT, input, workspace, NULL, reloaded));
+    assert(memcmp(original, reloaded, embedding_model_dim(model) * sizeof(float)) == 0);
+    /* The int8 weights come from the file as stored, not quantised again. */
+    assert(embedding_forward(model, EMBEDDING_PRECISION_INT8, input, workspace, NULL, original));
+    assert(embedding_forward(loaded, EMBEDDING_PRECISION_INT8, input, workspace, NULL, reloaded));
+    assert(memcmp(original, reloaded, embedding_model_dim(model) * sizeof(float)) == 0);
+
+    free(input);
+    embedding_workspace_free(workspace);
+    embedding_model_free(loaded);
+    embedding_model_free(model);
+}
+
+static void test_int8_tracks_float(void) {
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *model = embedding_model_create_random(&spec, 7);
+    assert(model != NULL);
+    EmbeddingWorkspace *workspace = embedding_workspace_create(model);
+    assert(workspace != NULL);
+    size_t dim = embedding_model_dim(model);
+
+    for (unsigned int seed = 1; seed <= 4; seed++) {
+        float *input = make_input(model, seed);
+        float reference[EMBEDDING_MAX_DIM];
+        float quantized[EMBEDDING_MAX_DIM];
+        assert(embedding_forward(model, EMBEDDING_PRECISION_FLOAT, input, workspace, NULL,
+                                 reference));
+        assert(embedding_forward(model, EMBEDDING_PRECISION_INT8, input, workspace, NULL,
+                                 quantized));
+        assert(fabs(dot(reference, reference, dim) - 1.0) < 1e-4);
+        assert(fabs(dot(quantized, quantized, dim) - 1.0) < 1e-4);
+        assert(dot(reference, quantized, dim) > 0.98);
+        free(input);
+    }
+
+    embedding_workspace_free(workspace);
+    embedding_model_free(model);
+}
+
+static void test_kernels_and_pool_agree(void) {
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *model = embedding_model_create_random(&spec, 11);
+    assert(model != NULL);
+    EmbeddingWorkspace *workspace = embedding_workspace_create(model);
+    ThreadPool *pool = thread_pool_create(3, 16);
+    assert(workspace != NULL && pool != NULL);
+    float *input = make_input(model, 3);
+    size_t dim = embedding_model_dim(model);
+
+    NnKernelLevel native = nn_kernel_level();
+    nn_set_kernel_level(NN_KERNEL_SCALAR);
+    float scalar_float[EMBEDDING_MAX_DIM];
+    float scalar_int8[EMBEDDING_MAX_DIM];
+    assert(embedding_forward(model, EMBEDDING_PRECISION_FLOAT, input, workspace, NULL,
+                             scalar_float));
+    assert(embedding_forward(model, EMBEDDING_PRECISION_INT8, input, workspace, NULL,
+                             scalar_int8));
+    nn_set_kernel_level(native);
+
+    float pooled_float[EMBEDDING_MAX_DIM];
+    float pooled_int8[EMBEDDING_MAX_DIM];
+    assert(embedding_forward(model, EMBEDDING_PRECISION_FLOAT, input, workspace, pool,
+                             pooled_float));
+    assert(embedding_forward(model, EMBEDDING_PRECISION_INT8, input, workspace, pool,
+                             pooled_int8));
+
+    assert(memcmp(scalar_int8, pooled_int8, dim * sizeof(float)) == 0);
+    for (size_t i = 0; i < dim; i++) {
+        assert(fabsf(scalar_float[i] - pooled_float[i]) < 1e-4f);
+    }
+
+    free(input);
+    thread_pool_destroy(pool);
+    embedding_workspace_free(workspace);
+    embedding_model_free(model);
+}
+
+static void test_batch_matches_single(void) {
+    enum { BATCH = 5 };
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *model = embedding_model_create_random(&spec, 13);
+    assert(model != NULL);
+    EmbeddingWorkspace *single = embedding_workspace_create(model);
+    EmbeddingWorkspace *batched = embedding_workspace_create_batch(model, BATCH);
+    assert(single != NULL && batched != NULL);
+    assert(embedding_workspace_batch_capacity(batched) == BATCH);
+    assert(embedding_workspace_input(batched, BATCH) == NULL);
+    assert(embedding_workspace_create_batch(model, 0) == NULL);
+
+    size_t dim = embedding_model_dim(model);
+    int size = embedding_model_input_size(model);
+    size_t input_count = (size_t)size * (size_t)size;
+    for (size_t b = 0; b < BATCH; b++) {
+        float *input = make_input(model, 100u + (unsigned int)b);
+        memcpy(embedding_workspace_input(batched, b), input, input_count * sizeof(float));
+        free(input);
+    }
+
+    static float batch_out[BATCH * EMBEDDING_MAX_DIM];
+    bool valid[BATCH];
+    float expected[EMBEDDING_MAX_DIM];
+    for (int p = 0; p < 2; p++) {
+        EmbeddingPrecision precision = p == 0 ? EMBEDDING_PRECISION_FLOAT : EMBEDDING_PRECISION_INT8;
+        assert(embedding_forward_batch(model, precision, embedding_workspace_input(batched, 0),
+                                       BATCH, batched, NULL, batch_out, valid));
+        assert(!embedding_forward_batch(model, precision, embedding_workspace_input(batched, 0),
+                                        BATCH + 1, batched, NULL, batch_out, valid));
+        for (size_t b = 0; b < BATCH; b++) {
+            assert(valid[b]);
+            assert(embedding_forward(model, precision, embedding_workspace_input(batched, b),
+                                     single, NULL, expected));
+            for (size_t i = 0; i < dim; i++) {
+                assert(fabsf(batch_out[b * dim + i] - expected[i]) < 1e-5f);
+            }
+        }
+    }
+
+    embedding_workspace_free(single);
+    embedding_workspace_free(batched);
+    embedding_model_free(model);
+}
+
+static void test_align_crop_identity(void) {
+    enum { SIZE = 112 };
+    assert(image_pool_init(1, SIZE, SIZE));
+    ImageBuffer *image = image_pool_acquire();
+    assert(image != NULL);
+    image->width = SIZE;
+    image->height = SIZE;
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            image->gray[(size_t)y * image->stride + (size_t)x] = (uint8_t)(x * 2 + y);
+        }
+    }
+
+    FaceBox box = {0, 0, SIZE, SIZE, 0};
+    FaceLandmarks landmarks = face_landmarks_from_box(&box);
+    float *crop = (float *)malloc(SIZE * SIZE * sizeof(float));
+    assert(crop != NULL);
+    face_align_crop(image, &landmarks, 1, SIZE, crop);
+    for (int y = 0; y < SIZE; y++) {
+        for (int x = 0; x < SIZE; x++) {
+            float expected = ((float)(uint8_t)(x * 2 + y) - 128.0f) / 128.0f;
+            assert(fabsf(crop[y * SIZE + x] - expected) < 0.02f);
+        }
+    }
+
+    free(crop);
+    image_pool_release(image);
+    image_pool_shutdown();
+}
+
+int main(void) {
+    test_rejects_bad_models();
+    test_save_load_roundtrip();
+    test_int8_tracks_float();
+    test_kernels_and_pool_agree();
+    test_batch_matches_single();
+    test_align_crop_identity();
+    puts("test_embedding: OK");
+    return 0;
+}
@@ -0,0 +1,263 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "event_feed.h"
+#include "router.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static EventFeedParams small_params(size_t capacity, size_t max_subscribers) {
+    EventFeedParams params;
+    params.capacity = capacity;
+    params.max_subscribers = max_subscribers;
+    params.heartbeat_ms = 50;
+    params.stall_ms = 200;
+    return params;
+}
+
+/* Appends whatever arrives on `fd` to `buffer` until `needle` shows up. */
+static void read_until(int fd, char *buffer, size_t capacity, size_t *used, const char *needle) {
+    for (int attempt = 0; attempt < 200 && strstr(buffer, needle) == NULL; attempt++) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, 20) <= 0) {
+            continue;
+        }
+        ssize_t n = read(fd, buffer + *used, capacity - 1 - *used);
+        assert(n > 0);
+        *used += (size_t)n;
+        buffer[*used] = '\0';
+    }
+    assert_contains(buffer, needle);
+}
+
+static int subscribe(const HttpRequest *request) {
+    int fds[2];
+    make_socket_pair(fds);
+    handle_request(fds[0], request);
+    close(fds[0]);
+    return fds[1];
+}
+
+static void wait_for_stats(EventFeedStats *stats, uint64_t dropped_slow, uint64_t disconnected) {
+    for (int attempt = 0; attempt < 200; attempt++) {
+        event_feed_stats(stats);
+        if (stats->dropped_slow >= dropped_slow && stats->disconnected >= disconnected) {
+            return;
+        }
+        struct timespec pause = {0, 10 * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+    assert(!"event feed stats never caught up");
+}
+
+static void test_format_recognition(void) {
+    RecognitionEvent event;
+    memset(&event, 0, sizeof(event));
+    snprintf(event.stream, sizeof(event.stream), "front \"door\"");
+    snprintf(event.identity.name, sizeof(event.identity.name), "alice");
+    event.identity.id = 3;
+    event.track_id = 12;
+    event.similarity = 0.875f;
+    event.frame_seq = 40;
+    event.time_ms = 1700000000123ull;
+
+    char json[256];
+    size_t n = event_feed_format_recognition(&event, json, sizeof(json));
+    assert(n == strlen(json));
+    assert(strcmp(json, "{\"stream\":\"front \\\"door\\\"\",\"identity\":\"alice\",\"id\":3,"
+                        "\"track\":12,\"similarity\":0.8750,\"frame_seq\":40,"
+                        "\"time_ms\":1700000000123}") == 0);
+    assert(event_feed_format_recognition(&event, json, 32) == 0);
+}
+
+static void test_stopped_feed_rejects(void) {
+    assert(event_feed_publish("recognition", "{}") == 0);
+    char response[1024];
+    HttpRequest request = make_request("GET", "/api/events");
+    int fd = subscribe(&request);
+    size_t n = read_all_or_fail(fd, response, sizeof(response) - 1);
+    response[n] = '\0';
+    close(fd);
+    assert_contains(response, "HTTP/1.1 503 Service Unavailable");
+
+    HttpRequest post = make_request("POST", "/api/events");
+    fd = subscribe(&post);
+    n = read_all_or_fail(fd, response, sizeof(response) - 1);
+    response[n] = '\0';
+    close(fd);
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+}
+
+static void test_stream_and_resume(void) {
+    EventFeedParams params = small_params(8, 4);
+    assert(event_feed_start(&params));
+    assert(event_feed_publish("recognition", "{\"n\":0}") != 0);
+
+    /* A fresh subscriber only sees what is published after it joined. */
+    HttpRequest request = make_request("GET", "/api/events");
+    int live = subscribe(&request);
+    char buffer[4096] = "";
+    size_t used = 0;
+    read_until(live, buffer, sizeof(buffer), &used, "retry: ");
+    assert_contains(buffer, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n");
+
+    uint64_t first = event_feed_publish("recognition", "{\"n\":1}");
+    uint64_t second = event_feed_publish("recognition", "{\"n\":2}");
+    assert(first != 0 && second == first + 1);
+    assert(event_feed_publish("recognition", "two\nlines") == 0);
+    char expected[128];
+    snprintf(expected, sizeof(expected), "id: %llu\nevent: recognition\ndata: {\"n\":2}\n\n",
+             (unsigned long long)second);
+    read_until(live, buffer, sizeof(buffer), &used, expected);
+    assert(strstr(buffer, "{\"n\":0}") == NULL);
+    read_until(live, buffer, sizeof(buffer), &used, ": keepalive\n\n");
+
+    /* Reconnecting with Last-Event-ID replays only what was missed. */
+    HttpRequest resume = make_request("GET", "/api/events");
+    resume.has_last_event_id = true;
+    resume.last_event_id = first;
+    int resumed = subscribe(&resume);
+    char replay[4096] = "";
+    size_t replay_used = 0;
+    read_until(resumed, replay, sizeof(replay), &replay_used, "{\"n\":2}");
+    assert(strstr(replay, "{\"n\":1}") == NULL);
+
+    /* An id older than the ring resumes from the oldest buffered event. */
+    HttpRequest stale = make_request("GET", "/api/events");
+    stale.has_last_event_id = true;
+    stale.last_event_id = 1;
+    int restarted = subscribe(&stale);
+    char backlog[4096] = "";
+    size_t backlog_used = 0;
+    read_until(restarted, backlog, sizeof(backlog), &backlog_used, "{\"n\":2}");
+    assert_contains(backlog, "{\"n\":0}");
+
+    /* The subscriber limit turns further clients away. */
+    int extra = subscribe(&request);
+    HttpRequest over = make_request("GET", "/api/events");
+    int rejected = subscribe(&over);
+    char response[1024];
+    size_t n = read_all_or_fail(rejected, response, sizeof(response) - 1);
+    response[n] = '\0';
+    assert_contains(response, "HTTP/1.1 503 Service Unavailable");
+    close(rejected);
+
+    EventFeedStats stats;
+    event_feed_stats(&stats);
+    assert(stats.subscribers == 4 && stats.rejected == 1 && stats.resumed == 2);
+    assert(stats.published == 3 && stats.last_id == second);
+
+    close(extra);
+    close(restarted);
+    wait_for_stats(&stats, 0, 2);
+    assert(stats.subscribers == 2);
+
+    event_feed_stop();
+    n = read_all_or_fail(live, buffer, sizeof(buffer) - 1);
+    close(live);
+    close(resumed);
+    event_feed_stats(&stats);
+    assert(stats.subscribers == 0);
+}
+
+static void test_slow_subscribers_dropped(void) {
+    EventFeedParams params = small_params(8, 4);
+    params.heartbeat_ms = 1000;
+    assert(event_feed_start(&params));
+
+    /* Never reads: it falls a whole ring behind and is cut loose. */
+    int fds[2];
+    make_socket_pair(fds);
+    int size = 4096;
+    assert(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    assert(setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == 0);
+    HttpRequest request = make_request("GET", "/api/events");
+    handle_request(fds[0], &request);
+
+    char data[400];
+    memset(data, 'x', sizeof(data) - 1);
+    data[sizeof(data) - 1] = '\0';
+    EventFeedStats stats;
+    for (int i = 0; i < 400; i++) {
+        assert(event_feed_publish("filler", data) != 0);
+        event_feed_stats(&stats);
+        if (stats.dropped_slow > 0) {
+            break;
+        }
+        struct timespec pause = {0, 1000000L};
+        nanosleep(&pause, NULL);
+    }
+    wait_for_stats(&stats, 1, 0);
+    assert(stats.subscribers == 0);
+    close_pair(fds);
+    event_feed_stop();
+
+    /* A peer that stops reading is dropped after stall_ms even without new events. */
+    params = small_params(1024, 4);
+    assert(event_feed_start(&params));
+    make_socket_pair(fds);
+    assert(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == 0);
+    assert(setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == 0);
+    handle_request(fds[0], &request);
+    for (int i = 0; i < 64; i++) {
+        assert(event_feed_publish("filler", data) != 0);
+    }
+    wait_for_stats(&stats, 1, 0);
+    assert(stats.subscribers == 0);
+    close_pair(fds);
+    event_feed_stop();
+}
+
+/* Draining delivers what was published, then closes each stream at its end. */
+static void test_drain_closes_caught_up_streams(void) {
+    EventFeedParams params = small_params(64, 4);
+    params.heartbeat_ms = 60000;
+    assert(event_feed_start(&params));
+    HttpRequest request = make_request("GET", "/api/events");
+    int fd = subscribe(&request);
+    char buffer[4096] = "";
+    size_t used = 0;
+    read_until(fd, buffer, sizeof(buffer), &used, "retry: ");
+    assert(event_feed_publish("recognition", "{\"last\":true}") != 0);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    event_feed_drain(5000);
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(end.tv_sec - start.tv_sec < 2);
+
+    size_t n = read_all_or_fail(fd, buffer + used, sizeof(buffer) - 1 - used);
+    buffer[used + n] = '\0';
+    close(fd);
+    assert_contains(buffer, "data: {\"last\":true}\n\n");
+    EventFeedStats stats;
+    event_feed_stats(&stats);
+    assert(stats.subscribers == 0);
+
+    /* A drained feed is stopped: new subscribers are turned away. */
+    fd = subscribe(&request);
+    n = read_all_or_fail(fd, buffer, sizeof(buffer) - 1);
+    buffer[n] = '\0';
+    close(fd);
+    assert_contains(buffer, "HTTP/1.1 503 Service Unavailable");
+}
+
+int main(void) {
+    test_format_recognition();
+    test_stopped_feed_rejects();
+    test_stream_and_resume();
+    test_slow_subscribers_dropped();
+    test_drain_closes_caught_up_streams();
+    puts("test_event_feed: OK");
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "face_detect.h"
+
+#include "test_image_utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CASCADE_PATH "test_face_detect_cascade.txt"
+
+static bool has_box_near(const FaceBox *boxes, size_t count, int cx, int cy, int tolerance) {
+    for (size_t i = 0; i < count; i++) {
+        int bx = boxes[i].x + boxes[i].width / 2;
+        int by = boxes[i].y + boxes[i].height / 2;
+        if (abs(bx - cx) <= tolerance && abs(by - cy) <= tolerance) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void test_load_rejects_bad_cascades(void) {
+    assert(face_detector_load("does-not-exist.txt") == NULL);
+
+    write_test_file(CASCADE_PATH, "haar_cascade 2\nwindow 20 20\n");
+    assert(face_detector_load(CASCADE_PATH) == NULL);
+
+    write_test_file(CASCADE_PATH,
+                    "haar_cascade 1\nwindow 20 20\nstages 1\nstage 1 0.5\n"
+                    "weak -0.1 1.0 -1.0 1\nrect 15 15 10 10 1\n");
+    assert(face_detector_load(CASCADE_PATH) == NULL);
+    remove(CASCADE_PATH);
+}
+
+static void test_detects_synthetic_pattern(void) {
+    write_test_file(CASCADE_PATH, test_square_cascade);
+    FaceDetector *detector = face_detector_load(CASCADE_PATH);
+    remove(CASCADE_PATH);
+    assert(detector != NULL);
+    assert(face_detector_window_width(detector) == 20);
+    assert(face_detector_window_height(detector) == 20);
+
+    enum { W = 160, H = 120 };
+    uint8_t *image = make_test_gray_image(W, H, 220);
+    fill_test_rect(image, W, 60, 40, 40, 40, 20);
+
+    FaceBox boxes[16];
+    FaceDetectParams params = face_detect_default_params();
+    size_t count = face_detector_detect(detector, image, W, H, W, &params, boxes, 16);
+    assert(count >= 1);
+    assert(has_box_near(boxes, count, 80, 60, 8));
+    for (size_t i = 0; i < count; i++) {
+        assert(boxes[i].neighbors >= params.min_neighbors);
+        assert(boxes[i].x >= 0 && boxes[i].y >= 0);
+        assert(boxes[i].x + boxes[i].width <= W + 2 && boxes[i].y + boxes[i].height <= H + 2);
+    }
+
+    free(image);
+    face_detector_free(detector);
+}
+
+static void test_uniform_image_has_no_detections(void) {
+    write_test_file(CASCADE_PATH, test_square_cascade);
+    FaceDetector *detector = face_detector_load(CASCADE_PATH);
+    remove(CASCADE_PATH);
+    assert(detector != NULL);
+
+    enum { W = 96, H = 96 };
+    uint8_t *image = make_test_gray_image(W, H, 128);
+    FaceBox boxes[4];
+    assert(face_detector_detect(detector, image, W, H, W, NULL, boxes, 4) == 0);
+
+    free(image);
+    face_detector_free(detector);
+}
+
+int main(void) {
+    test_load_rejects_bad_cascades();
+    test_detects_synthetic_pattern();
+    test_uniform_image_has_no_detections();
+    puts("test_face_detect: OK");
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "face_tracker.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+static void test_box_iou(void) {
+    FaceBox a = {0, 0, 10, 10, 0};
+    FaceBox b = {5, 0, 10, 10, 0};
+    FaceBox far = {50, 50, 10, 10, 0};
+    assert(fabsf(face_box_iou(&a, &a) - 1.0f) < 1e-6f);
+    assert(fabsf(face_box_iou(&a, &b) - 50.0f / 150.0f) < 1e-6f);
+    assert(face_box_iou(&a, &far) == 0.0f);
+}
+
+static void test_associates_best_overlap_first(void) {
+    FaceBox previous[3] = {
+        {0, 0, 100, 100, 0},
+        {200, 0, 100, 100, 0},
+        {400, 400, 50, 50, 0},
+    };
+    FaceBox current[3] = {
+        {210, 5, 100, 100, 0},
+        {10, 0, 100, 100, 0},
+        {600, 0, 100, 100, 0},
+    };
+    int match[3];
+    float iou[3];
+    assert(face_tracker_associate(previous, 3, current, 3, 0.3f, match, iou) == 2);
+    assert(match[0] == 1 && match[1] == 0 && match[2] == -1);
+    assert(iou[1] > 0.8f && iou[2] == 0.0f);
+}
+
+static void test_each_previous_box_used_once(void) {
+    FaceBox previous[1] = {{0, 0, 100, 100, 0}};
+    FaceBox current[2] = {
+        {20, 0, 100, 100, 0},
+        {5, 0, 100, 100, 0},
+    };
+    int match[2];
+    assert(face_tracker_associate(previous, 1, current, 2, 0.3f, match, NULL) == 1);
+    assert(match[0] == -1 && match[1] == 0);
+
+    assert(face_tracker_associate(previous, 1, current, 2, 0.99f, match, NULL) == 0);
+    assert(match[0] == -1 && match[1] == -1);
+}
+
+int main(void) {
+    test_box_iou();
+    test_associates_best_overlap_first();
+    test_each_previous_box_used_once();
+    puts("test_face_tracker: OK");
+    return 0;
+}
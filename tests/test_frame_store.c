@@ -0,0 +1,254 @@
+#include "frame_store.h"
+#include "router.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_DIR "test_frame_store_data"
+
+static void make_frame(int index, unsigned char *out, size_t length) {
+    memset(out, 'a' + index % 26, length);
+    snprintf((char *)out, length, "frame-%03d", index);
+}
+
+static void remove_record_dir(void) {
+    DIR *dir = opendir(RECORD_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    char path[512];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", RECORD_DIR, entry->d_name);
+            remove(path);
+        }
+    }
+    closedir(dir);
+    rmdir(RECORD_DIR);
+}
+
+static void test_memory_history(void) {
+    unsigned char frame[400];
+    make_frame(0, frame, sizeof(frame));
+    assert(!frame_store_append("cam", 100, frame, sizeof(frame), NULL));
+
+    FrameStoreParams params = memory_params(1000);
+    assert(frame_store_open(&params));
+    for (int i = 0; i < 3; i++) {
+        make_frame(i, frame, sizeof(frame));
+        assert(frame_store_append("cam", 100 + 100 * (uint64_t)i, frame, sizeof(frame), NULL));
+    }
+    make_frame(9, frame, sizeof(frame));
+    assert(frame_store_append("lobby", 150, frame, sizeof(frame), NULL));
+
+    char response[4096];
+    assert(serve_frame("cam", 250, response, sizeof(response)) == 200);
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "Content-Type: image/jpeg");
+    assert_contains(response, "X-Frame-Time: 200\r\n");
+    assert_contains(response, "frame-001");
+
+    /* The byte budget only holds two frames, so the first one is gone. */
+    assert(serve_frame("cam", 150, response, sizeof(response)) == 404);
+    assert(serve_frame("cam", 5000, response, sizeof(response)) == 200);
+    assert_contains(response, "frame-002");
+    assert(serve_frame("lobby", 199, response, sizeof(response)) == 200);
+    assert_contains(response, "frame-009");
+    assert(serve_frame("yard", 5000, response, sizeof(response)) == 404);
+    assert(frame_store_last_ms("cam") == 300 && frame_store_last_ms("lobby") == 150);
+    assert(frame_store_last_ms("yard") == 0);
+
+    FrameStoreStats stats;
+    frame_store_stats(&stats);
+    assert(stats.streams == 2 && stats.frames == 3 && stats.evicted == 1);
+    assert(!stats.recording && stats.served_memory == 3);
+    frame_store_close();
+}
+
+static void test_recorded_segments(void) {
+    remove_record_dir();
+    /* Frames larger than the in-memory budget are only recorded. */
+    FrameStoreParams params = memory_params(16);
+    params.record_dir = RECORD_DIR;
+    params.segment_bytes = 4096;
+    params.max_segments = 3;
+    params.index_interval_ms = 100;
+    assert(frame_store_open(&params));
+
+    unsigned char frame[300];
+    for (int i = 0; i < 40; i++) {
+        make_frame(i, frame, sizeof(frame));
+        const char *stream = i % 2 == 0 ? "door" : "yard";
+        assert(frame_store_append(stream, 1000 + 50 * (uint64_t)i, frame, sizeof(frame), NULL));
+    }
+    FrameStoreStats stats;
+    frame_store_stats(&stats);
+    assert(stats.recording && stats.recorded == 40 && stats.segments == 3);
+
+    char response[4096];
+    assert(serve_frame("door", 1000 + 50 * 30 + 10, response, sizeof(response)) == 200);
+    assert_contains(response, "X-Frame-Time: 2500\r\n");
+    assert_contains(response, "Content-Length: 300\r\n");
+    assert_contains(response, "frame-030");
+    assert(serve_frame("yard", 1000 + 50 * 30 + 10, response, sizeof(response)) == 200);
+    assert_contains(response, "frame-029");
+    /* The oldest segment has been recycled. */
+    assert(serve_frame("door", 1000 + 50 * 2, response, sizeof(response)) == 404);
+    frame_store_close();
+
+    /* Reopening finds the segments, their indexes and the append position. */
+    assert(frame_store_open(&params));
+    frame_store_stats(&stats);
+    assert(stats.segments == 3);
+    assert(serve_frame("yard", 1000 + 50 * 35, response, sizeof(response)) == 200);
+    assert_contains(response, "frame-035");
+    make_frame(40, frame, sizeof(frame));
+    assert(frame_store_append("door", 3000, frame, sizeof(frame), NULL));
+    assert(serve_frame("door", 3000, response, sizeof(response)) == 200);
+    assert_contains(response, "frame-040");
+    frame_store_stats(&stats);
+    assert(stats.served_disk == 2 && stats.served_memory == 0);
+
+    /* A frame the recorder cannot write is still kept, and the failure reported. */
+    unsigned char oversized[5000];
+    make_frame(41, oversized, sizeof(oversized));
+    bool record_failed = false;
+    assert(frame_store_append("door", 3100, oversized, sizeof(oversized), &record_failed));
+    assert(record_failed);
+    assert(frame_store_append("door", 3200, frame, sizeof(frame), &record_failed));
+    assert(!record_failed);
+    frame_store_stats(&stats);
+    assert(stats.record_failures == 1);
+    frame_store_close();
+    remove_record_dir();
+}
+
+static void test_interleaved_streams(void) {
+    remove_record_dir();
+    FrameStoreParams params = memory_params(16);
+    params.record_dir = RECORD_DIR;
+    params.segment_bytes = 4096;
+    params.max_segments = 4;
+    params.index_interval_ms = 100;
+    assert(frame_store_open(&params));
+
+    /* A live stream on the wall clock, then a camera's backdated batch after it. */
+    unsigned char frame[300];
+    for (int i = 0; i < 8; i++) {
+        make_frame(i, frame, sizeof(frame));
+        assert(frame_store_append("door", 50000 + 50 * (uint64_t)i, frame, sizeof(frame), NULL));
+    }
+    for (int i = 0; i < 8; i++) {
+        make_frame(10 + i, frame, sizeof(frame));
+        assert(frame_store_append("yard", 1000 + 50 * (uint64_t)i, frame, sizeof(frame), NULL));
+        make_frame(20 + i, frame, sizeof(frame));
+        assert(frame_store_append("door", 50400 + 50 * (uint64_t)i, frame, sizeof(frame), NULL));
+    }
+    /* Older than the stream's newest: kept nowhere. */
+    assert(!frame_store_append("yard", 1100, frame, sizeof(frame), NULL));
+    assert(frame_store_last_ms("yard") == 1350);
+
+    FrameStoreStats stats;
+    frame_store_stats(&stats);
+    assert(stats.recorded == 24 && stats.segments == 2);
+    char response[4096];
+    for (int pass = 0; pass < 2; pass++) {
+        assert(serve_frame("yard", 1120, response, sizeof(response)) == 200);
+        assert_contains(response, "X-Frame-Time: 1100\r\n");
+        assert_contains(response, "frame-012");
+        assert(serve_frame("yard", 9999, response, sizeof(response)) == 200);
+        assert_contains(response, "frame-017");
+        assert(serve_frame("yard", 999, response, sizeof(response)) == 404);
+        assert(serve_frame("door", 50399, response, sizeof(response)) == 200);
+        assert_contains(response, "frame-007");
+        assert(serve_frame("door", 50760, response, sizeof(response)) == 200);
+        assert_contains(response, "frame-027");
+        /* The segment a backdated frame opened still sorts after the older one. */
+        frame_store_close();
+        assert(frame_store_open(&params));
+    }
+    frame_store_stats(&stats);
+    assert(stats.segments == 2);
+    frame_store_close();
+    remove_record_dir();
+}
+
+static void test_frame_route_query(void) {
+    FrameStoreParams params = memory_params(4096);
+    assert(frame_store_open(&params));
+
+    unsigned char body[] = "jpeg-bytes";
+    HttpRequest post;
+    memset(&post, 0, sizeof(post));
+    snprintf(post.method, sizeof(post.method), "POST");
+    snprintf(post.path, sizeof(post.path), "/api/frame");
+    snprintf(post.stream_id, sizeof(post.stream_id), "door");
+    post.body = body;
+    post.body_length = sizeof(body) - 1;
+    int fds[2];
+    char response[4096];
+    make_socket_pair(fds);
+    handle_request(fds[0], &post);
+    close_pair(fds);
+
+    HttpRequest get;
+    memset(&get, 0, sizeof(get));
+    snprintf(get.method, sizeof(get.method), "GET");
+    snprintf(get.path, sizeof(get.path), "/api/frame");
+    snprintf(get.query, sizeof(get.query), "stream=door&at=99999999999999");
+    make_socket_pair(fds);
+    handle_request(fds[0], &get);
+    close(fds[0]);
+    size_t n = read_all_or_fail(fds[1], response, sizeof(response) - 1);
+    response[n] = '\0';
+    close(fds[1]);
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "jpeg-bytes");
+
+    snprintf(get.query, sizeof(get.query), "at=soon");
+    make_socket_pair(fds);
+    handle_request(fds[0], &get);
+    close(fds[0]);
+    n = read_all_or_fail(fds[1], response, sizeof(response) - 1);
+    response[n] = '\0';
+    close(fds[1]);
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    snprintf(get.query, sizeof(get.query), "at=1");
+    make_socket_pair(fds);
+    handle_request(fds[0], &get);
+    close(fds[0]);
+    n = read_all_or_fail(fds[1], response, sizeof(response) - 1);
+    response[n] = '\0';
+    close(fds[1]);
+    assert_contains(response, "HTTP/1.1 404 Not Found");
+
+    /* A live upload after a batch frame stamped ahead of the clock is not older than it. */
+    assert(frame_store_append("door", 4102444800000ull, body, 4, NULL));
+    unsigned char live[] = "live-bytes";
+    post.body = live;
+    post.body_length = sizeof(live) - 1;
+    make_socket_pair(fds);
+    handle_request(fds[0], &post);
+    close_pair(fds);
+    assert(serve_frame("door", 4102444800000ull, response, sizeof(response)) == 200);
+    assert_contains(response, "X-Frame-Time: 4102444800000\r\n");
+    assert_contains(response, "live-bytes");
+    frame_store_close();
+}
+
+int main(void) {
+    test_memory_history();
+    test_recorded_segments();
+    test_interleaved_streams();
+    test_frame_route_query();
+    puts("test_frame_store: OK");
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include "frame_variants.h"
+#include "image.h"
+#include "jpeg_decode.h"
+#include "router.h"
+
+#include "test_image_utils.h"
+#include "test_utils.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RESPONSE_CAPACITY (512 * 1024)
+#define VIEWERS 8
+
+typedef struct {
+    char *data;
+    size_t length;
+    const unsigned char *body;
+    size_t body_length;
+} Response;
+
+static void split_response(Response *response) {
+    response->data[response->length] = '\0';
+    char *end = strstr(response->data, "\r\n\r\n");
+    assert(end != NULL);
+    response->body = (const unsigned char *)end + 4;
+    response->body_length = response->length - (size_t)(end + 4 - response->data);
+}
+
+static int serve(const unsigned char *frame, size_t length, int width, Response *response) {
+    int fds[2];
+    make_socket_pair(fds);
+    int status = frame_variants_serve(fds[0], frame, length, width);
+    close(fds[0]);
+    response->length = read_all_or_fail(fds[1], response->data, RESPONSE_CAPACITY - 1);
+    close(fds[1]);
+    if (status == 200) {
+        split_response(response);
+    }
+    return status;
+}
+
+static void route(const HttpRequest *request, Response *response) {
+    int fds[2];
+    make_socket_pair(fds);
+    handle_request(fds[0], request);
+    close(fds[0]);
+    response->length = read_all_or_fail(fds[1], response->data, RESPONSE_CAPACITY - 1);
+    response->data[response->length] = '\0';
+    close(fds[1]);
+}
+
+static void test_rejects_bad_widths(void) {
+    static const unsigned char frame[] = "not-a-jpeg";
+    Response response = {malloc(RESPONSE_CAPACITY), 0, NULL, 0};
+    assert(response.data != NULL);
+    assert(serve(frame, sizeof(frame) - 1, 8, &response) == 400);
+    assert(serve(frame, sizeof(frame) - 1, 100000, &response) == 400);
+    assert(response.length == 0);
+    frame_variants_invalidate();
+    free(response.data);
+}
+
+#ifdef HAVE_LIBJPEG
+static unsigned char *encode_solid_rgb(int width, int height, unsigned long *size_out) {
+    uint8_t *pixels = (uint8_t *)malloc((size_t)width * (size_t)height * 3);
+    assert(pixels != NULL);
+    for (int i = 0; i < width * height; i++) {
+        pixels[i * 3] = 200;
+        pixels[i * 3 + 1] = 60;
+        pixels[i * 3 + 2] = 30;
+    }
+    unsigned char *jpeg = encode_test_jpeg(pixels, width, height, 3, size_out);
+    free(pixels);
+    return jpeg;
+}
+
+static int abs_diff(int a, int b) {
+    return a > b ? a - b : b - a;
+}
+
+static void test_variant_built_once_and_shared(void) {
+    frame_variants_invalidate();
+    FrameVariantStats before;
+    frame_variants_stats(&before);
+
+    unsigned long size = 0;
+    unsigned char *frame = encode_solid_rgb(640, 480, &size);
+    Response response = {malloc(RESPONSE_CAPACITY), 0, NULL, 0};
+    assert(response.data != NULL);
+
+    assert(serve(frame, size, 160, &response) == 200);
+    assert_contains(response.data, "HTTP/1.1 200 OK");
+    assert_contains(response.data, "Content-Type: image/jpeg");
+    int width = 0;
+    int height = 0;
+    assert(jpeg_decode_size(response.body, response.body_length, &width, &height));
+    assert(width == 160 && height == 120);
+    assert(response.body_length < size);
+
+    assert(image_pool_init(1, 160, 120));
+    ImageBuffer *image = image_pool_acquire();
+    assert(jpeg_decode_frame(response.body, response.body_length, 160, 120, image, NULL));
+    size_t center = (size_t)60 * image->stride + 80;
+    assert(abs_diff(image->r[center], 200) <= 6);
+    assert(abs_diff(image->g[center], 60) <= 6);
+    assert(abs_diff(image->b[center], 30) <= 6);
+    image_pool_release(image);
+    image_pool_shutdown();
+
+    /* The second viewer gets the cached bytes. */
+    size_t first_length = response.body_length;
+    assert(serve(frame, size, 160, &response) == 200);
+    assert(response.body_length == first_length);
+
+    /* Asking for at least the full width sends the frame untouched. */
+    assert(serve(frame, size, 640, &response) == 200);
+    assert(response.body_length == size && memcmp(response.body, frame, size) == 0);
+
+    FrameVariantStats stats;
+    frame_variants_stats(&stats);
+    assert(stats.builds - before.builds == 2 && stats.hits - before.hits == 1);
+    assert(stats.variants == 2 && stats.bytes == first_length);
+
+    /* A new frame supersedes every variant. */
+    frame_variants_invalidate();
+    frame_variants_stats(&stats);
+    assert(stats.variants == 0 && stats.bytes == 0);
+    assert(stats.freed - before.freed == 2 && stats.generation == before.generation + 1);
+
+    /* Beyond the slot limit a size is still served, just not kept. */
+    static const int widths[] = {64, 96, 128, 192, 256};
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        assert(serve(frame, size, widths[i], &response) == 200);
+        assert(jpeg_decode_size(response.body, response.body_length, &width, &height));
+        assert(width == widths[i] && height == widths[i] * 3 / 4);
+    }
+    frame_variants_stats(&stats);
+    assert(stats.variants == 4 && stats.uncached - before.uncached == 1);
+    frame_variants_invalidate();
+
+    free(response.data);
+    free(frame);
+}
+
+typedef struct {
+    const unsigned char *frame;
+    size_t length;
+    int status;
+    size_t body_length;
+} Viewer;
+
+static void *view(void *arg) {
+    Viewer *viewer = (Viewer *)arg;
+    Response response = {malloc(RESPONSE_CAPACITY), 0, NULL, 0};
+    assert(response.data != NULL);
+    viewer->status = serve(viewer->frame, viewer->length, 320, &response);
+    viewer->body_length = response.body_length;
+    free(response.data);
+    return NULL;
+}
+
+static void test_concurrent_viewers_share_one_encode(void) {
+    unsigned long size = 0;
+    unsigned char *frame = encode_solid_rgb(1280, 960, &size);
+    FrameVariantStats before;
+    frame_variants_stats(&before);
+
+    pthread_t threads[VIEWERS];
+    Viewer viewers[VIEWERS];
+    for (int i = 0; i < VIEWERS; i++) {
+        viewers[i] = (Viewer){frame, size, 0, 0};
+        assert(pthread_create(&threads[i], NULL, view, &viewers[i]) == 0);
+    }
+    for (int i = 0; i < VIEWERS; i++) {
+        pthread_join(threads[i], NULL);
+        assert(viewers[i].status == 200);
+        assert(viewers[i].body_length == viewers[0].body_length);
+    }
+
+    FrameVariantStats stats;
+    frame_variants_stats(&stats);
+    assert(stats.builds - before.builds == 1);
+    assert(stats.hits + stats.waits - before.hits - before.waits == VIEWERS - 1);
+    frame_variants_invalidate();
+    free(frame);
+}
+
+static void test_frame_route_width(void) {
+    unsigned long size = 0;
+    unsigned char *frame = encode_solid_rgb(320, 240, &size);
+    Response response = {malloc(RESPONSE_CAPACITY), 0, NULL, 0};
+    assert(response.data != NULL);
+
+    HttpRequest post;
+    memset(&post, 0, sizeof(post));
+    snprintf(post.method, sizeof(post.method), "POST");
+    snprintf(post.path, sizeof(post.path), "/api/frame");
+    post.body = frame;
+    post.body_length = size;
+    route(&post, &response);
+
+    HttpRequest get;
+    memset(&get, 0, sizeof(get));
+    snprintf(get.method, sizeof(get.method), "GET");
+    snprintf(get.path, sizeof(get.path), "/api/frame");
+    snprintf(get.query, sizeof(get.query), "w=80");
+    route(&get, &response);
+    split_response(&response);
+    int width = 0;
+    int height = 0;
+    assert(jpeg_decode_size(response.body, response.body_length, &width, &height));
+    assert(width == 80 && height == 60);
+
+    snprintf(get.query, sizeof(get.query), "w=wide");
+    route(&get, &response);
+    assert_contains(response.data, "HTTP/1.1 400 Bad Request");
+
+    /* A frame that does not decode is refused once and remembered. */
+    static unsigned char broken[] = "\xFF\xD8garbage";
+    post.body = broken;
+    post.body_length = sizeof(broken) - 1;
+    route(&post, &response);
+    snprintf(get.query, sizeof(get.query), "w=80");
+    route(&get, &response);
+    assert_contains(response.data, "HTTP/1.1 422 Unprocessable Entity");
+    route(&get, &response);
+    assert_contains(response.data, "HTTP/1.1 422 Unprocessable Entity");
+    FrameVariantStats stats;
+    frame_variants_stats(&stats);
+    assert(stats.variants == 1 && stats.failures == 1);
+
+    frame_variants_invalidate();
+    free(response.data);
+    free(frame);
+}
+#endif
+
+int main(void) {
+    test_rejects_bad_widths();
+#ifdef HAVE_LIBJPEG
+    test_variant_built_once_and_shared();
+    test_concurrent_viewers_share_one_encode();
+    test_frame_route_width();
+    puts("test_frame_variants: OK");
+#else
+    puts("test_frame_variants: OK (libjpeg not available, variant tests skipped)");
+#endif
+    return 0;
+}
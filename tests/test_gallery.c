@@ -0,0 +1,403 @@
+#include "gallery.h"
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIM 64
+#define SNAPSHOT_PATH "test_gallery_snapshot.bin"
+
+static void random_vector(float *out, size_t dim, unsigned int *seed) {
+    for (size_t i = 0; i < dim; i++) {
+        *seed = *seed * 1103515245u + 12345u;
+        out[i] = (float)((*seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+    }
+}
+
+static void test_dot_simd_matches_scalar(void) {
+    float a[37];
+    float b[37];
+    unsigned int seed = 1;
+    random_vector(a, 37, &seed);
+    random_vector(b, 37, &seed);
+
+    gallery_set_kernel_level(GALLERY_KERNEL_SCALAR);
+    float expected = gallery_dot(a, b, 37);
+    if (gallery_set_kernel_level(GALLERY_KERNEL_AVX2) == GALLERY_KERNEL_AVX2) {
+        assert(fabsf(gallery_dot(a, b, 37) - expected) < 1e-4f);
+    }
+}
+
+static void test_rejects_bad_params(void) {
+    GalleryParams params = gallery_default_params(0);
+    assert(gallery_create(&params) == NULL);
+    params = gallery_default_params(GALLERY_MAX_DIM + 1);
+    assert(gallery_create(&params) == NULL);
+    params = gallery_default_params(DIM);
+    params.hnsw_m = 1;
+    assert(gallery_create(&params) == NULL);
+}
+
+static void test_exact_search_and_threshold(void) {
+    GalleryParams params = gallery_default_params(DIM);
+    params.initial_capacity = 4;
+    Gallery *gallery = gallery_create(&params);
+    assert(gallery != NULL);
+
+    GalleryMatch matches[GALLERY_MAX_K];
+    float query[DIM];
+    unsigned int seed = 3;
+    random_vector(query, DIM, &seed);
+    assert(gallery_search(gallery, query, 5, -1.0f, GALLERY_SEARCH_AUTO, matches) == 0);
+
+    float vectors[50][DIM];
+    for (uint64_t i = 0; i < 50; i++) {
+        random_vector(vectors[i], DIM, &seed);
+        assert(gallery_add(gallery, 1000 + i, vectors[i]));
+    }
+    assert(gallery_size(gallery) == 50);
+    assert(gallery_dim(gallery) == DIM);
+
+    for (uint64_t i = 0; i < 50; i++) {
+        float scaled[DIM];
+        for (size_t d = 0; d < DIM; d++) {
+            scaled[d] = vectors[i][d] * 3.0f;
+        }
+        size_t found = gallery_search(gallery, scaled, 3, -1.0f, GALLERY_SEARCH_EXACT, matches);
+        assert(found == 3);
+        assert(matches[0].id == 1000 + i);
+        assert(fabsf(matches[0].similarity - 1.0f) < 1e-4f);
+        assert(matches[0].similarity >= matches[1].similarity);
+        assert(matches[1].similarity >= matches[2].similarity);
+    }
+
+    size_t found = gallery_search(gallery, vectors[7], 10, 0.99f, GALLERY_SEARCH_EXACT, matches);
+    assert(found == 1 && matches[0].id == 1007);
+
+    gallery_free(gallery);
+}
+
+static void test_hnsw_recall(void) {
+    enum { COUNT = 3000, QUERIES = 100, K = 10 };
+    GalleryParams params = gallery_default_params(DIM);
+    params.initial_capacity = 256;
+    params.hnsw_ef_construction = 100;
+    Gallery *gallery = gallery_create(&params);
+    assert(gallery != NULL);
+
+    float *vectors = (float *)malloc(sizeof(float) * COUNT * DIM);
+    assert(vectors != NULL);
+    unsigned int seed = 11;
+    for (size_t i = 0; i < COUNT; i++) {
+        random_vector(vectors + i * DIM, DIM, &seed);
+        assert(gallery_add(gallery, i, vectors + i * DIM));
+    }
+
+    gallery_set_ef_search(gallery, 128);
+    size_t hits = 0;
+    for (size_t q = 0; q < QUERIES; q++) {
+        float query[DIM];
+        random_vector(query, DIM, &seed);
+        GalleryMatch exact[K];
+        GalleryMatch approx[K];
+        assert(gallery_search(gallery, query, K, -1.0f, GALLERY_SEARCH_EXACT, exact) == K);
+        assert(gallery_search(gallery, query, K, -1.0f, GALLERY_SEARCH_HNSW, approx) == K);
+        for (size_t i = 0; i < K; i++) {
+            for (size_t j = 0; j < K; j++) {
+                if (approx[i].id == exact[j].id) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    assert((double)hits / (QUERIES * K) >= 0.9);
+
+    for (size_t i = 0; i < 20; i++) {
+        GalleryMatch match;
+        assert(gallery_search(gallery, vectors + i * 97 * DIM, 1, 0.0f, GALLERY_SEARCH_HNSW,
+                              &match) == 1);
+        assert(match.id == i * 97);
+    }
+
+    free(vectors);
+    gallery_free(gallery);
+}
+
+static double codes_recall(Gallery *gallery, size_t queries, unsigned int seed) {
+    enum { K = 10 };
+    size_t hits = 0;
+    for (size_t q = 0; q < queries; q++) {
+        float query[DIM];
+        random_vector(query, DIM, &seed);
+        GalleryMatch exact[K];
+        GalleryMatch approx[K];
+        assert(gallery_search(gallery, query, K, -1.0f, GALLERY_SEARCH_EXACT, exact) == K);
+        assert(gallery_search(gallery, query, K, -1.0f, GALLERY_SEARCH_CODES, approx) == K);
+        assert(approx[0].similarity <= exact[0].similarity + 1e-5f);
+        for (size_t i = 0; i < K; i++) {
+            for (size_t j = 0; j < K; j++) {
+                if (approx[i].id == exact[j].id) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    return (double)hits / (double)(queries * K);
+}
+
+static void test_compressed_codes(void) {
+    enum { COUNT = 2000 };
+    GalleryParams params = gallery_default_params(DIM);
+    params.initial_capacity = 100;
+    params.hnsw_ef_construction = 32;
+    Gallery *gallery = gallery_create(&params);
+    assert(gallery != NULL);
+    assert(gallery_codes(gallery) == GALLERY_CODES_NONE);
+    assert(gallery_scan_bytes(gallery) == DIM * sizeof(float));
+    assert(!gallery_set_codes(gallery, GALLERY_CODES_PQ));
+
+    float *vectors = (float *)malloc(sizeof(float) * COUNT * DIM);
+    assert(vectors != NULL);
+    unsigned int seed = 31;
+    for (size_t i = 0; i < COUNT / 2; i++) {
+        random_vector(vectors + i * DIM, DIM, &seed);
+        assert(gallery_add(gallery, i, vectors + i * DIM));
+    }
+
+    /* Without codes the mode is an exact scan. */
+    GalleryMatch match;
+    assert(gallery_search(gallery, vectors, 1, 0.0f, GALLERY_SEARCH_CODES, &match) == 1);
+    assert(match.id == 0 && fabsf(match.similarity - 1.0f) < 1e-4f);
+
+    static const GalleryCodes kinds[] = {GALLERY_CODES_INT8, GALLERY_CODES_PQ};
+    for (size_t kind = 0; kind < 2; kind++) {
+        assert(gallery_set_codes(gallery, kinds[kind]));
+        assert(gallery_codes(gallery) == kinds[kind]);
+    }
+    assert(gallery_scan_bytes(gallery) == params.pq_subspaces);
+
+    /* Rows added after training are encoded with the same codebooks; growth keeps the codes. */
+    for (size_t i = COUNT / 2; i < COUNT; i++) {
+        random_vector(vectors + i * DIM, DIM, &seed);
+        assert(gallery_add(gallery, i, vectors + i * DIM));
+    }
+    for (size_t kind = 0; kind < 2; kind++) {
+        if (kind == 0) {
+            assert(gallery_set_codes(gallery, GALLERY_CODES_INT8));
+            assert(gallery_scan_bytes(gallery) == DIM + sizeof(float));
+        } else {
+            assert(gallery_set_codes(gallery, GALLERY_CODES_PQ));
+        }
+        for (size_t i = 0; i < COUNT; i += 37) {
+            assert(gallery_search(gallery, vectors + i * DIM, 1, 0.0f, GALLERY_SEARCH_CODES,
+                                  &match) == 1);
+            assert(match.id == i && fabsf(match.similarity - 1.0f) < 1e-4f);
+        }
+        double recall = codes_recall(gallery, 50, 41);
+        assert(recall >= (kind == 0 ? 0.95 : 0.8));
+
+        /* Both kernel levels agree. */
+        GalleryKernelLevel level = gallery_kernel_level();
+        gallery_set_kernel_level(GALLERY_KERNEL_SCALAR);
+        assert(codes_recall(gallery, 50, 41) == recall);
+        gallery_set_kernel_level(level);
+    }
+
+    /* Fewer re-ranked candidates trade recall away. */
+    gallery_set_rerank(gallery, 1);
+    double narrow = codes_recall(gallery, 50, 41);
+    gallery_set_rerank(gallery, 8);
+    assert(narrow <= codes_recall(gallery, 50, 41));
+
+    assert(gallery_remove(gallery, 74) == 1);
+    GalleryMatch matches[GALLERY_MAX_K];
+    size_t found = gallery_search(gallery, vectors + 74 * DIM, GALLERY_MAX_K, -1.0f,
+                                  GALLERY_SEARCH_CODES, matches);
+    assert(found == GALLERY_MAX_K);
+    for (size_t i = 0; i < found; i++) {
+        assert(matches[i].id != 74);
+    }
+
+    Gallery *compacted = gallery_compact(gallery);
+    assert(compacted != NULL && gallery_codes(compacted) == GALLERY_CODES_PQ);
+    assert(gallery_search(compacted, vectors + 75 * DIM, 1, 0.0f, GALLERY_SEARCH_CODES,
+                          &match) == 1);
+    assert(match.id == 75);
+    gallery_free(compacted);
+
+    assert(gallery_set_codes(gallery, GALLERY_CODES_NONE));
+    assert(gallery_scan_bytes(gallery) == DIM * sizeof(float));
+    free(vectors);
+    gallery_free(gallery);
+}
+
+static void test_remove_hides_entries(void) {
+    GalleryParams params = gallery_default_params(DIM);
+    Gallery *gallery = gallery_create(&params);
+    assert(gallery != NULL);
+
+    float vectors[200][DIM];
+    unsigned int seed = 21;
+    for (uint64_t i = 0; i < 200; i++) {
+        random_vector(vectors[i], DIM, &seed);
+        assert(gallery_add(gallery, i % 20, vectors[i]));
+    }
+    assert(gallery_remove(gallery, 3) == 10);
+    assert(gallery_remove(gallery, 3) == 0);
+    assert(gallery_size(gallery) == 190);
+    assert(gallery_deleted_count(gallery) == 10);
+
+    GalleryMatch matches[GALLERY_MAX_K];
+    for (size_t mode = GALLERY_SEARCH_EXACT; mode <= GALLERY_SEARCH_HNSW; mode++) {
+        size_t found = gallery_search(gallery, vectors[3], GALLERY_MAX_K, -1.0f,
+                                      (GallerySearchMode)mode, matches);
+        assert(found > 0);
+        for (size_t i = 0; i < found; i++) {
+            assert(matches[i].id != 3);
+        }
+    }
+
+    Gallery *compacted = gallery_compact(gallery);
+    assert(compacted != NULL);
+    assert(gallery_size(compacted) == 190);
+    assert(gallery_deleted_count(compacted) == 0);
+    size_t found = gallery_search(compacted, vectors[4], 1, 0.0f, GALLERY_SEARCH_HNSW, matches);
+    assert(found == 1 && matches[0].id == 4);
+
+    gallery_free(compacted);
+    gallery_free(gallery);
+}
+
+static void test_snapshot_roundtrip(void) {
+    enum { COUNT = 500 };
+    GalleryParams params = gallery_default_params(DIM);
+    params.hnsw_ef_construction = 64;
+    Gallery *gallery = gallery_create(&params);
+    assert(gallery != NULL);
+
+    float *vectors = (float *)malloc(sizeof(float) * (COUNT + 1) * DIM);
+    assert(vectors != NULL);
+    unsigned int seed = 31;
+    for (size_t i = 0; i < COUNT + 1; i++) {
+        random_vector(vectors + i * DIM, DIM, &seed);
+    }
+    for (size_t i = 0; i < COUNT; i++) {
+        assert(gallery_add(gallery, i, vectors + i * DIM));
+    }
+    assert(gallery_remove(gallery, 7) == 1);
+
+    static const char meta[] = "identities";
+    assert(gallery_save(gallery, SNAPSHOT_PATH, meta, sizeof(meta)));
+
+    const void *mapped_meta = NULL;
+    size_t mapped_meta_length = 0;
+    Gallery *mapped = gallery_map(SNAPSHOT_PATH, &mapped_meta, &mapped_meta_length);
+    remove(SNAPSHOT_PATH);
+    assert(mapped != NULL);
+    assert(mapped_meta_length == sizeof(meta));
+    assert(memcmp(mapped_meta, meta, sizeof(meta)) == 0);
+    assert(gallery_size(mapped) == COUNT - 1);
+    assert(gallery_dim(mapped) == DIM);
+
+    for (size_t q = 0; q < 20; q++) {
+        const float *query = vectors + q * 13 * DIM;
+        GalleryMatch expected[10];
+        GalleryMatch actual[10];
+        size_t expected_count =
+            gallery_search(gallery, query, 10, -1.0f, GALLERY_SEARCH_HNSW, expected);
+        size_t actual_count = gallery_search(mapped, query, 10, -1.0f, GALLERY_SEARCH_HNSW, actual);
+        assert(expected_count == actual_count);
+        for (size_t i = 0; i < expected_count; i++) {
+            assert(expected[i].id == actual[i].id);
+        }
+    }
+
+    assert(gallery_add(mapped, COUNT, vectors + COUNT * DIM));
+    GalleryMatch match;
+    assert(gallery_search(mapped, vectors + COUNT * DIM, 1, 0.0f, GALLERY_SEARCH_HNSW, &match) == 1);
+    assert(match.id == COUNT);
+    assert(gallery_size(mapped) == COUNT);
+
+    FILE *file = fopen(SNAPSHOT_PATH, "wb");
+    assert(file != NULL);
+    assert(fwrite("FGALLERY", 1, 8, file) == 8);
+    fclose(file);
+    assert(gallery_map(SNAPSHOT_PATH, NULL, NULL) == NULL);
+    remove(SNAPSHOT_PATH);
+    assert(gallery_map(SNAPSHOT_PATH, NULL, NULL) == NULL);
+
+    free(vectors);
+    gallery_free(mapped);
+    gallery_free(gallery);
+}
+
+typedef struct {
+    Gallery *gallery;
+    atomic_bool *done;
+    atomic_long *searches;
+} ReaderContext;
+
+static void *reader_main(void *arg) {
+    ReaderContext *ctx = (ReaderContext *)arg;
+    unsigned int seed = 99;
+    while (!atomic_load(ctx->done)) {
+        float query[DIM];
+        GalleryMatch matches[5];
+        random_vector(query, DIM, &seed);
+        size_t found = gallery_search(ctx->gallery, query, 5, -1.0f, GALLERY_SEARCH_HNSW, matches);
+        for (size_t i = 0; i < found; i++) {
+            assert(matches[i].id < 2000);
+        }
+        atomic_fetch_add(ctx->searches, 1);
+    }
+    return NULL;
+}
+
+static void test_concurrent_reads_during_inserts(void) {
+    GalleryParams params = gallery_default_params(DIM);
+    params.initial_capacity = 8;
+    params.hnsw_ef_construction = 64;
+    Gallery *gallery = gallery_create(&params);
+    assert(gallery != NULL);
+
+    atomic_bool done = false;
+    atomic_long searches = 0;
+    ReaderContext ctx = {gallery, &done, &searches};
+    pthread_t readers[3];
+    for (size_t i = 0; i < 3; i++) {
+        assert(pthread_create(&readers[i], NULL, reader_main, &ctx) == 0);
+    }
+
+    unsigned int seed = 5;
+    for (uint64_t i = 0; i < 2000; i++) {
+        float vector[DIM];
+        random_vector(vector, DIM, &seed);
+        assert(gallery_add(gallery, i, vector));
+    }
+    atomic_store(&done, true);
+    for (size_t i = 0; i < 3; i++) {
+        pthread_join(readers[i], NULL);
+    }
+    assert(gallery_size(gallery) == 2000);
+    assert(atomic_load(&searches) > 0);
+    gallery_free(gallery);
+}
+
+int main(void) {
+    test_dot_simd_matches_scalar();
+    test_rejects_bad_params();
+    test_exact_search_and_threshold();
+    test_hnsw_recall();
+    test_compressed_codes();
+    test_remove_hides_entries();
+    test_snapshot_roundtrip();
+    test_concurrent_reads_during_inserts();
+    puts("test_gallery: OK");
+    return 0;
+}
@@ -0,0 +1,330 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gallery_shard.h"
+#include "listener.h"
+
+#include "test_utils.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DIM 8
+#define STORE_DIR "test_gallery_shard_data"
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+static void axis(float *out, size_t index, float weight) {
+    memset(out, 0, DIM * sizeof(float));
+    out[index] = 1.0f;
+    out[(index + 1) % DIM] = weight;
+}
+
+/* A listener on a free loopback port; `spec` gets the port. */
+static int open_listener(ListenerSpec *spec, const char *address) {
+    SocketOptions options;
+    memset(&options, 0, sizeof(options));
+    options.backlog = 8;
+    assert(listener_spec_parse(address, spec));
+    int fd = listener_open(spec, &options);
+    assert(fd >= 0);
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *)&addr, &length) == 0);
+    spec->port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static GalleryShardSpec shard_of(const ListenerSpec *first, const ListenerSpec *second) {
+    GalleryShardSpec shard;
+    memset(&shard, 0, sizeof(shard));
+    shard.replicas[0] = *first;
+    shard.replica_count = 1;
+    if (second != NULL) {
+        shard.replicas[1] = *second;
+        shard.replica_count = 2;
+    }
+    return shard;
+}
+
+static void enroll(const char *name, size_t index) {
+    float embedding[DIM];
+    axis(embedding, index, 0.0f);
+    GalleryIdentity identity;
+    assert(gallery_store_enroll(name, embedding, &identity));
+}
+
+static void test_local(void) {
+    float query[DIM];
+    axis(query, 0, 0.1f);
+    GalleryStoreMatch matches[4];
+    GalleryShardReport report;
+    assert(gallery_shards_search(query, DIM, 4, 0.5f, matches, &report) == 1);
+    assert(strcmp(matches[0].identity.name, "alice") == 0);
+    assert(report.shards == 0 && report.answered == 0);
+}
+
+/* Two shards served by the same process merge best-first and keep their connections. */
+static void test_merge(const ListenerSpec *server) {
+    GalleryShardSpec specs[2] = {shard_of(server, NULL), shard_of(server, NULL)};
+    assert(gallery_shards_start(specs, 2));
+    float query[DIM];
+    axis(query, 0, 0.4f);
+    GalleryStoreMatch matches[8];
+    GalleryShardReport report;
+    for (int i = 0; i < 3; i++) {
+        assert(gallery_shards_search(query, DIM, 3, 0.1f, matches, &report) == 3);
+        assert(report.shards == 2 && report.answered == 2 && report.hedged == 0);
+        assert(strcmp(matches[0].identity.name, "alice") == 0);
+        assert(strcmp(matches[1].identity.name, "alice") == 0);
+        assert(strcmp(matches[2].identity.name, "bob") == 0);
+        assert(matches[1].similarity >= matches[2].similarity);
+        assert(matches[0].identity.entries == 1 && matches[0].identity.id == 1);
+    }
+    GalleryShardStats stats;
+    gallery_shard_stats(&stats);
+    assert(stats.shards == 2 && stats.connects == 2 && stats.idle_connections == 2);
+    assert(stats.searches == 3 && stats.queries == 6 && stats.partial == 0);
+    assert(stats.served == 6);
+    char json[512];
+    assert(gallery_shard_format_stats_json(&stats, json, sizeof(json)) > 0);
+    assert_contains(json, "{\"shards\":2,\"idle_connections\":2,\"searches\":3,");
+
+    /* A query of the wrong size gets a 400, which the coordinator counts as an error. */
+    float wide[DIM * 2];
+    memset(wide, 0, sizeof(wide));
+    assert(gallery_shards_search(wide, DIM * 2, 1, 0.1f, matches, &report) == 0);
+    assert(report.answered == 0);
+    gallery_shards_stop();
+}
+
+/* A primary that never answers is hedged to its replica well before the deadline. */
+static void test_hedge(const ListenerSpec *server) {
+    ListenerSpec silent;
+    int silent_fd = open_listener(&silent, "127.0.0.1:0");
+    GalleryShardSpec specs[1] = {shard_of(&silent, server)};
+    assert(gallery_shards_start(specs, 1));
+    gallery_shards_set_deadlines(2000, 20);
+    GalleryShardStats before;
+    gallery_shard_stats(&before);
+
+    float query[DIM];
+    axis(query, 1, 0.1f);
+    GalleryStoreMatch matches[2];
+    GalleryShardReport report;
+    uint64_t start = monotonic_ms();
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, &report) == 1);
+    assert(monotonic_ms() - start < 1000);
+    assert(strcmp(matches[0].identity.name, "bob") == 0);
+    assert(report.answered == 1 && report.hedged == 1);
+    GalleryShardStats after;
+    gallery_shard_stats(&after);
+    assert(after.hedges == before.hedges + 1 && after.hedge_wins == before.hedge_wins + 1);
+    gallery_shards_stop();
+
+    /* With no replica and no hedge, a silent shard is dropped at the deadline. */
+    GalleryShardSpec split[2] = {shard_of(server, NULL), shard_of(&silent, NULL)};
+    assert(gallery_shards_start(split, 2));
+    gallery_shards_set_deadlines(100, 0);
+    start = monotonic_ms();
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, &report) == 1);
+    uint64_t elapsed = monotonic_ms() - start;
+    assert(elapsed >= 100 && elapsed < 1000);
+    assert(report.shards == 2 && report.answered == 1 && report.hedged == 0);
+    gallery_shard_stats(&after);
+    assert(after.timeouts == before.timeouts + 1 && after.partial == before.partial + 1);
+    gallery_shards_stop();
+    close(silent_fd);
+
+    /* A replica that refuses the connection fails over at once. */
+    ListenerSpec gone;
+    close(open_listener(&gone, "127.0.0.1:0"));
+    GalleryShardSpec failover[1] = {shard_of(&gone, server)};
+    assert(gallery_shards_start(failover, 1));
+    gallery_shards_set_deadlines(2000, 1000);
+    start = monotonic_ms();
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, &report) == 1);
+    assert(monotonic_ms() - start < 500);
+    assert(report.answered == 1 && report.hedged == 1);
+    gallery_shards_stop();
+}
+
+/* A replica that takes the query and, late, sends the first bytes of a reply and no more. */
+static void *reply_partially(void *arg) {
+    int listen_fd = *(int *)arg;
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    assert(poll(&pfd, 1, 2000) == 1);
+    int fd = accept(listen_fd, NULL, NULL);
+    assert(fd >= 0);
+    unsigned char query[256];
+    assert(read(fd, query, sizeof(query)) > 0);
+    struct timespec pause = {0, 200 * 1000000L};
+    nanosleep(&pause, NULL);
+    unsigned char partial[3] = {0};
+    write_all_or_fail(fd, partial, sizeof(partial));
+    *(int *)arg = fd;
+    return NULL;
+}
+
+/* A shard stuck mid-reply is dropped at the deadline, not a read timeout after it. */
+static void test_stalled_reply(const ListenerSpec *server) {
+    ListenerSpec stalled;
+    int listen_fd = open_listener(&stalled, "127.0.0.1:0");
+    int client_fd = listen_fd;
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, reply_partially, &client_fd) == 0);
+    GalleryShardSpec specs[2] = {shard_of(server, NULL), shard_of(&stalled, NULL)};
+    assert(gallery_shards_start(specs, 2));
+    gallery_shards_set_deadlines(300, 0);
+    GalleryShardStats before;
+    gallery_shard_stats(&before);
+
+    float query[DIM];
+    axis(query, 0, 0.1f);
+    GalleryStoreMatch matches[1];
+    GalleryShardReport report;
+    uint64_t start = monotonic_ms();
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, &report) == 1);
+    uint64_t elapsed = monotonic_ms() - start;
+    assert(elapsed >= 300 && elapsed < 450);
+    assert(report.shards == 2 && report.answered == 1);
+    assert(strcmp(matches[0].identity.name, "alice") == 0);
+    GalleryShardStats after;
+    gallery_shard_stats(&after);
+    assert(after.timeouts == before.timeouts + 1 && after.idle_connections == 1);
+    pthread_join(thread, NULL);
+    gallery_shards_stop();
+    close(client_fd);
+    close(listen_fd);
+}
+
+/* A shard that answers its query with one match named `ev"l`, closest of all. */
+static void *reply_forged(void *arg) {
+    int listen_fd = *(int *)arg;
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    assert(poll(&pfd, 1, 2000) == 1);
+    int fd = accept(listen_fd, NULL, NULL);
+    assert(fd >= 0);
+    unsigned char query[256];
+    assert(read(fd, query, sizeof(query)) >= GALLERY_SHARD_PREFIX_BYTES + 8);
+    static const char name[] = "ev\"l";
+    unsigned char reply[64] = {0};
+    size_t length = GALLERY_SHARD_PREFIX_BYTES + 12 + 17 + strlen(name);
+    put_u32(reply, (uint32_t)(length - 4));
+    reply[4] = GALLERY_SHARD_RESULT;
+    unsigned char *body = reply + GALLERY_SHARD_PREFIX_BYTES;
+    put_u64(body, get_u64(query + GALLERY_SHARD_PREFIX_BYTES));
+    body[9] = 200;
+    body[11] = 1;
+    float similarity = 1.0f;
+    uint32_t bits;
+    memcpy(&bits, &similarity, sizeof(bits));
+    put_u64(body + 12, 7);
+    put_u32(body + 20, bits);
+    put_u32(body + 24, 1);
+    body[28] = (unsigned char)strlen(name);
+    memcpy(body + 29, name, strlen(name));
+    write_all_or_fail(fd, reply, length);
+    *(int *)arg = fd;
+    return NULL;
+}
+
+/* A reply whose name the store would refuse is dropped, so it never reaches a JSON answer. */
+static void test_forged_name(const ListenerSpec *server) {
+    ListenerSpec forged;
+    int listen_fd = open_listener(&forged, "127.0.0.1:0");
+    int client_fd = listen_fd;
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, reply_forged, &client_fd) == 0);
+    GalleryShardSpec specs[2] = {shard_of(server, NULL), shard_of(&forged, NULL)};
+    assert(gallery_shards_start(specs, 2));
+    gallery_shards_set_deadlines(1000, 0);
+
+    float query[DIM];
+    axis(query, 0, 0.1f);
+    GalleryStoreMatch matches[1];
+    GalleryShardReport report;
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, &report) == 1);
+    assert(report.shards == 2 && report.answered == 1);
+    assert(strcmp(matches[0].identity.name, "alice") == 0);
+    pthread_join(thread, NULL);
+    gallery_shards_stop();
+    close(client_fd);
+    close(listen_fd);
+}
+
+/* A restarted shard closes the pooled connection; the next search reconnects. */
+static void test_reconnect(ListenerSpec *server) {
+    GalleryShardSpec specs[1] = {shard_of(server, NULL)};
+    assert(gallery_shards_start(specs, 1));
+    gallery_shards_set_deadlines(1000, 0);
+    float query[DIM];
+    axis(query, 0, 0.1f);
+    GalleryStoreMatch matches[1];
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, NULL) == 1);
+
+    gallery_shard_serve_stop();
+    char address[64];
+    snprintf(address, sizeof(address), "127.0.0.1:%d", server->port);
+    ListenerSpec again;
+    assert(gallery_shard_serve_start(open_listener(&again, address)));
+    GalleryShardReport report;
+    assert(gallery_shards_search(query, DIM, 1, 0.5f, matches, &report) == 1);
+    assert(report.answered == 1);
+    gallery_shards_stop();
+}
+
+/* Frames that break the protocol end the connection. */
+static void test_bad_query(const ListenerSpec *server) {
+    int fd = listener_connect(server, 1000, 1000);
+    assert(fd >= 0);
+    unsigned char message[GALLERY_SHARD_PREFIX_BYTES + 2] = {0};
+    put_u32(message, 3);
+    message[4] = GALLERY_SHARD_QUERY;
+    write_all_or_fail(fd, message, sizeof(message));
+    char byte;
+    assert(read(fd, &byte, 1) == 0);
+    close(fd);
+}
+
+int main(void) {
+    remove(STORE_DIR "/gallery.snapshot");
+    remove(STORE_DIR "/gallery.log");
+    assert(gallery_store_open(STORE_DIR, DIM));
+    enroll("alice", 0);
+    enroll("bob", 1);
+    test_local();
+
+    ListenerSpec server;
+    assert(gallery_shard_serve_start(open_listener(&server, "127.0.0.1:0")));
+    assert(gallery_shard_listen_fd() >= 0);
+    test_merge(&server);
+    test_hedge(&server);
+    test_stalled_reply(&server);
+    test_forged_name(&server);
+    test_reconnect(&server);
+    test_bad_query(&server);
+    gallery_shard_serve_stop();
+    assert(gallery_shard_listen_fd() < 0);
+
+    gallery_store_close();
+    remove(STORE_DIR "/gallery.snapshot");
+    remove(STORE_DIR "/gallery.log");
+    rmdir(STORE_DIR);
+    puts("test_gallery_shard: OK");
+    return 0;
+}
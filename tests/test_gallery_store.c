@@ -0,0 +1,219 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "gallery_store.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DIM 32
+#define STORE_DIR "test_gallery_store_data"
+#define SNAPSHOT_FILE STORE_DIR "/gallery.snapshot"
+#define LOG_FILE STORE_DIR "/gallery.log"
+
+static void identity_vector(float *out, unsigned int identity, unsigned int sample) {
+    unsigned int seed = identity * 7919u + 1u;
+    for (size_t i = 0; i < DIM; i++) {
+        seed = seed * 1103515245u + 12345u;
+        out[i] = (float)((seed >> 8) & 0xffff) / 32768.0f - 1.0f;
+    }
+    out[sample % DIM] += 0.05f;
+}
+
+static void remove_store(void) {
+    remove(SNAPSHOT_FILE);
+    remove(SNAPSHOT_FILE ".tmp");
+    remove(LOG_FILE);
+    rmdir(STORE_DIR);
+}
+
+static long file_size(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static void copy_file(const char *from, const char *to, long length) {
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    assert(in != NULL && out != NULL);
+    int c;
+    while ((length < 0 || length-- > 0) && (c = fgetc(in)) != EOF) {
+        fputc(c, out);
+    }
+    fclose(in);
+    fclose(out);
+}
+
+static const char *best_match(unsigned int identity) {
+    static GalleryStoreMatch matches[1];
+    float query[DIM];
+    identity_vector(query, identity, 99);
+    if (gallery_store_search(query, 1, 0.5f, matches) == 0) {
+        return NULL;
+    }
+    return matches[0].identity.name;
+}
+
+static void test_identity_names(void) {
+    assert(gallery_valid_identity_name("alice"));
+    assert(gallery_valid_identity_name("bob.smith-2_x"));
+    assert(!gallery_valid_identity_name(""));
+    assert(!gallery_valid_identity_name(".."));
+    assert(!gallery_valid_identity_name("a/b"));
+    assert(!gallery_valid_identity_name("has space"));
+    char long_name[GALLERY_NAME_MAX + 2];
+    memset(long_name, 'a', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+    assert(!gallery_valid_identity_name(long_name));
+}
+
+static void test_enroll_remove_and_replay(void) {
+    remove_store();
+    assert(gallery_store_open(STORE_DIR, DIM));
+    assert(!gallery_store_open(STORE_DIR, DIM));
+
+    float vector[DIM];
+    GalleryIdentity identity;
+    identity_vector(vector, 1, 0);
+    assert(gallery_store_enroll("alice", vector, &identity));
+    assert(identity.id == 1 && identity.entries == 1);
+    identity_vector(vector, 1, 1);
+    assert(gallery_store_enroll("alice", vector, &identity));
+    assert(identity.id == 1 && identity.entries == 2);
+    identity_vector(vector, 2, 0);
+    assert(gallery_store_enroll("bob", vector, &identity));
+    assert(identity.id == 2);
+    identity_vector(vector, 3, 0);
+    assert(gallery_store_enroll("carol", vector, &identity));
+    assert(!gallery_store_enroll("bad name", vector, NULL));
+
+    assert(strcmp(best_match(1), "alice") == 0);
+    assert(strcmp(best_match(2), "bob") == 0);
+
+    assert(gallery_store_remove("bob", &identity));
+    assert(identity.entries == 1);
+    assert(!gallery_store_remove("bob", NULL));
+    assert(best_match(2) == NULL);
+
+    char json[1024];
+    assert(gallery_store_format_identities_json(json, sizeof(json)) > 0);
+    assert(strstr(json, "{\"identity\":\"alice\",\"id\":1,\"entries\":2}") != NULL);
+    assert(strstr(json, "bob") == NULL);
+
+    /* Closing folds the log into a snapshot, so the reopen is a single mmap. */
+    GalleryStoreStats stats;
+    gallery_store_stats(&stats);
+    assert(stats.identities == 2 && stats.entries == 3 && stats.log_records == 5);
+    gallery_store_close();
+    assert(file_size(LOG_FILE) == 0);
+    assert(gallery_store_open(STORE_DIR, DIM));
+    gallery_store_stats(&stats);
+    assert(stats.snapshot_mapped);
+    assert(stats.identities == 2 && stats.entries == 3 && stats.log_records == 0);
+    assert(strcmp(best_match(1), "alice") == 0);
+    assert(strcmp(best_match(3), "carol") == 0);
+    assert(best_match(2) == NULL);
+
+    /* Ids are never reused, even after the highest one was deleted and snapshotted. */
+    identity_vector(vector, 4, 0);
+    assert(gallery_store_enroll("dave", vector, &identity));
+    assert(identity.id == 4);
+    gallery_store_close();
+
+    /* Wrong dimension is refused rather than silently discarding the snapshot. */
+    assert(!gallery_store_open(STORE_DIR, DIM * 2));
+    remove_store();
+}
+
+static void test_log_replay_and_torn_tail(void) {
+    remove_store();
+    assert(gallery_store_open(STORE_DIR, DIM));
+    float vector[DIM];
+    identity_vector(vector, 1, 0);
+    assert(gallery_store_enroll("alice", vector, NULL));
+    assert(gallery_store_compact());
+    identity_vector(vector, 2, 0);
+    assert(gallery_store_enroll("bob", vector, NULL));
+    identity_vector(vector, 3, 0);
+    assert(gallery_store_enroll("carol", vector, NULL));
+    GalleryStoreStats stats;
+    gallery_store_stats(&stats);
+    assert(stats.compactions == 1 && stats.log_records == 2);
+
+    /*
+     * Simulate a crash: capture the files as they are now (close would fold
+     * the log into a new snapshot), then chop the last record short.
+     */
+    long log_length = file_size(LOG_FILE);
+    assert(log_length > 0);
+    copy_file(SNAPSHOT_FILE, SNAPSHOT_FILE ".crash", -1);
+    copy_file(LOG_FILE, LOG_FILE ".crash", log_length - 10);
+    gallery_store_close();
+    assert(rename(SNAPSHOT_FILE ".crash", SNAPSHOT_FILE) == 0);
+    assert(rename(LOG_FILE ".crash", LOG_FILE) == 0);
+
+    assert(gallery_store_open(STORE_DIR, DIM));
+    gallery_store_stats(&stats);
+    assert(stats.snapshot_mapped);
+    assert(stats.identities == 2 && stats.log_records == 1);
+    assert(strcmp(best_match(1), "alice") == 0);
+    assert(strcmp(best_match(2), "bob") == 0);
+    assert(best_match(3) == NULL);
+
+    /* The torn bytes were cut off, so new appends replay cleanly. */
+    long bob_record = 32 + 3 + DIM * (long)sizeof(float) + 4;
+    assert(file_size(LOG_FILE) == bob_record);
+    identity_vector(vector, 3, 0);
+    assert(gallery_store_enroll("carol", vector, NULL));
+    gallery_store_close();
+    assert(gallery_store_open(STORE_DIR, DIM));
+    assert(strcmp(best_match(3), "carol") == 0);
+    gallery_store_close();
+    remove_store();
+}
+
+static void test_compaction_drops_deleted_entries(void) {
+    remove_store();
+    assert(gallery_store_open(STORE_DIR, DIM));
+    float vector[DIM];
+    char name[16];
+    for (unsigned int i = 1; i <= 20; i++) {
+        snprintf(name, sizeof(name), "person%u", i);
+        identity_vector(vector, i, 0);
+        assert(gallery_store_enroll(name, vector, NULL));
+    }
+    for (unsigned int i = 1; i <= 10; i++) {
+        snprintf(name, sizeof(name), "person%u", i);
+        assert(gallery_store_remove(name, NULL));
+    }
+
+    GalleryStoreStats stats;
+    gallery_store_stats(&stats);
+    assert(stats.deleted == 10);
+    assert(gallery_store_compact());
+    gallery_store_stats(&stats);
+    assert(stats.deleted == 0 && stats.entries == 10 && stats.identities == 10);
+    assert(best_match(5) == NULL);
+    assert(strcmp(best_match(15), "person15") == 0);
+    gallery_store_close();
+    remove_store();
+}
+
+int main(void) {
+    test_identity_names();
+    test_enroll_remove_and_replay();
+    test_log_replay_and_torn_tail();
+    test_compaction_drops_deleted_entries();
+    puts("test_gallery_store: OK");
+    return 0;
+}
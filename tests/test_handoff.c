@@ -0,0 +1,148 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "frame_store.h"
+#include "handoff.h"
+#include "router.h"
+#include "server_config.h"
+
+#include "test_utils.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef struct {
+    int sock;
+    FrameStoreParams params;
+    int listen_fds[MAX_LISTENERS];
+    size_t listen_count;
+} TakeOver;
+
+static int listen_on_loopback(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    assert(listen(fd, 16) == 0);
+    return fd;
+}
+
+static unsigned short local_port(int fd) {
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    assert(getsockname(fd, (struct sockaddr *)&addr, &length) == 0);
+    return ntohs(addr.sin_port);
+}
+
+/* Stands in for the new process: both halves share this process's stores. */
+static void *take_over(void *arg) {
+    TakeOver *job = (TakeOver *)arg;
+    job->listen_count =
+        handoff_take_over(job->sock, &job->params, job->listen_fds, MAX_LISTENERS);
+    return NULL;
+}
+
+static void test_listener_and_frames_move_over(void) {
+    FrameStoreParams params = memory_params(1 << 16);
+    assert(frame_store_open(&params));
+    char frame[64];
+    for (int i = 0; i < 3; i++) {
+        snprintf(frame, sizeof(frame), "cam-frame-%d", i);
+        assert(frame_store_append("cam", 1000 + 100 * (uint64_t)i, (unsigned char *)frame,
+                                  strlen(frame), NULL));
+    }
+    assert(frame_store_append("lobby", 1500, (const unsigned char *)"lobby-frame", 11, NULL));
+    router_restore_latest_frame((const unsigned char *)"latest-jpeg", 11);
+
+    int listen_fds[2] = {listen_on_loopback(), listen_on_loopback()};
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    TakeOver job = {pair[1], params, {-1}, 0};
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, take_over, &job) == 0);
+
+    HandoffChild child = {-1, pair[0]};
+    assert(handoff_serve(&child, listen_fds, 2, &params));
+    assert(child.sock == -1 && child.pid == -1);
+    pthread_join(thread, NULL);
+
+    /* New descriptors for the same sockets: closing the old ones keeps them listening. */
+    assert(job.listen_count == 2);
+    for (size_t i = 0; i < 2; i++) {
+        assert(job.listen_fds[i] >= 0 && job.listen_fds[i] != listen_fds[i]);
+        assert(local_port(job.listen_fds[i]) == local_port(listen_fds[i]));
+        close(listen_fds[i]);
+        assert(listen(job.listen_fds[i], 16) == 0);
+        close(job.listen_fds[i]);
+    }
+
+    char response[1024];
+    assert(serve_frame("cam", 1150, response, sizeof(response)) == 200);
+    assert_contains(response, "X-Frame-Time: 1100\r\n");
+    assert_contains(response, "cam-frame-1");
+    assert(serve_frame("cam", 5000, response, sizeof(response)) == 200);
+    assert_contains(response, "cam-frame-2");
+    assert(serve_frame("lobby", 1500, response, sizeof(response)) == 200);
+    assert_contains(response, "lobby-frame");
+
+    size_t latest_length = 0;
+    const unsigned char *latest = router_latest_frame(&latest_length);
+    assert(latest_length == 11 && memcmp(latest, "latest-jpeg", 11) == 0);
+    frame_store_close();
+}
+
+/* A new process that dies mid-way leaves the old one serving with a fresh store. */
+static void test_failed_take_over_reopens_store(void) {
+    FrameStoreParams params = memory_params(1 << 16);
+    assert(frame_store_open(&params));
+    assert(frame_store_append("cam", 1000, (const unsigned char *)"kept", 4, NULL));
+
+    int listen_fd = listen_on_loopback();
+    int pair[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0);
+    char ready = 'R';
+    assert(write(pair[1], &ready, 1) == 1);
+    close(pair[1]);
+
+    HandoffChild child = {-1, pair[0]};
+    assert(!handoff_serve(&child, &listen_fd, 1, &params));
+    handoff_abandon(&child);
+    assert(child.sock == -1);
+
+    assert(frame_store_append("cam", 2000, (const unsigned char *)"after", 5, NULL));
+    char response[1024];
+    assert(serve_frame("cam", 2000, response, sizeof(response)) == 200);
+    assert_contains(response, "after");
+    frame_store_close();
+    close(listen_fd);
+}
+
+static void test_inherited_socket(void) {
+    unsetenv(HANDOFF_ENV);
+    assert(handoff_inherited_socket() == -1);
+    setenv(HANDOFF_ENV, "not-a-number", 1);
+    assert(handoff_inherited_socket() == -1);
+    assert(getenv(HANDOFF_ENV) == NULL);
+    setenv(HANDOFF_ENV, "17", 1);
+    assert(handoff_inherited_socket() == 17);
+    assert(getenv(HANDOFF_ENV) == NULL);
+}
+
+int main(void) {
+    test_listener_and_frames_move_over();
+    test_failed_take_over_reopens_store();
+    test_inherited_socket();
+    puts("test_handoff: OK");
+    return 0;
+}
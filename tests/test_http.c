@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 static void test_send_http_response(void) {
@@ -51,7 +52,7 @@ static void test_read_http_request_get(void) {
     make_socket_pair(fds);
 
     static const char req[] =
-        "GET /styles.css?cache=1 HTTP/1.1\r\n"
+        "GET /styles.css?cache=1&name=front%20door&flag&q=a+b HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "\r\n";
     write_all_or_fail(fds[1], req, sizeof(req) - 1);
@@ -64,6 +65,15 @@ static void test_read_http_request_get(void) {
     assert(ok);
     assert(strcmp(request.method, "GET") == 0);
     assert(strcmp(request.path, "/styles.css") == 0);
+    assert(strcmp(request.query, "cache=1&name=front%20door&flag&q=a+b") == 0);
+    char value[16];
+    assert(http_query_param(&request, "cache", value, sizeof(value)) && strcmp(value, "1") == 0);
+    assert(http_query_param(&request, "name", value, sizeof(value)));
+    assert(strcmp(value, "front door") == 0);
+    assert(http_query_param(&request, "flag", value, sizeof(value)) && value[0] == '\0');
+    assert(http_query_param(&request, "q", value, sizeof(value)) && strcmp(value, "a b") == 0);
+    assert(!http_query_param(&request, "nam", value, sizeof(value)));
+    assert(!http_query_param(&request, "name", value, 4));
     assert(request.body == NULL);
     assert(request.body_length == 0);
     free_http_request(&request);
@@ -79,6 +89,7 @@ static void test_read_http_request_post(void) {
         "POST /api/frame HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "Content-Type: image/jpeg\r\n"
+        "X-Stream-Id:  door-cam \r\n"
         "Content-Length: 5\r\n"
         "\r\n"
         "ab";
@@ -95,6 +106,7 @@ static void test_read_http_request_post(void) {
     assert(strcmp(request.method, "POST") == 0);
     assert(strcmp(request.path, "/api/frame") == 0);
     assert(strcmp(request.content_type, "image/jpeg") == 0);
+    assert(strcmp(request.stream_id, "door-cam") == 0);
     assert(request.body_length == 5);
     assert(memcmp(request.body, "abcde", 5) == 0);
     free_http_request(&request);
@@ -155,6 +167,97 @@ static void test_read_http_request_too_large(void) {
     close_pair(fds);
 }
 
+/* Limits set at runtime (config reload) apply to the next request read. */
+static void test_read_http_request_runtime_limits(void) {
+    http_set_limits(2048, 1024);
+    int fds[2];
+    make_socket_pair(fds);
+    static const char req[] = "POST /api/frame HTTP/1.1\r\nContent-Length: 4096\r\n\r\n";
+    write_all_or_fail(fds[1], req, sizeof(req) - 1);
+    shutdown(fds[1], SHUT_WR);
+    HttpRequest request;
+    int status = 0;
+    assert(!read_http_request(fds[0], &request, &status));
+    assert(status == 413);
+    free_http_request(&request);
+    close_pair(fds);
+
+    /* A header block that does not fit in max_header bytes is rejected. */
+    make_socket_pair(fds);
+    char headers[1200];
+    memset(headers, 'a', sizeof(headers));
+    memcpy(headers, "GET / HTTP/1.1\r\nX-Pad: ", 24);
+    write_all_or_fail(fds[1], headers, sizeof(headers));
+    shutdown(fds[1], SHUT_WR);
+    assert(!read_http_request(fds[0], &request, &status));
+    assert(status == 400);
+    free_http_request(&request);
+    close_pair(fds);
+    http_set_limits(MAX_REQUEST_SIZE, MAX_HEADER_SIZE);
+
+    /* A client that stops sending mid-request times out with 408. */
+    make_socket_pair(fds);
+    struct timeval timeout = {0, 50000};
+    assert(setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0);
+    static const char partial[] = "GET / HTTP/1.1\r\nHost: x\r\n";
+    write_all_or_fail(fds[1], partial, sizeof(partial) - 1);
+    assert(!read_http_request(fds[0], &request, &status));
+    assert(status == 408);
+    free_http_request(&request);
+    close_pair(fds);
+}
+
+/* The head alone leaves the body on the socket for a reader that takes it piece by piece. */
+static void test_read_http_request_streamed_body(void) {
+    int fds[2];
+    make_socket_pair(fds);
+    static const char head[] =
+        "POST /api/frames/batch HTTP/1.1\r\n"
+        "Content-Length: 10\r\n"
+        "\r\n"
+        "0123";
+    write_all_or_fail(fds[1], head, sizeof(head) - 1);
+
+    HttpRequest request;
+    int status = 0;
+    assert(read_http_request_head(fds[0], &request, &status));
+    assert(request.content_length == 10 && request.body_length == 4);
+    write_all_or_fail(fds[1], "456789", 6);
+    shutdown(fds[1], SHUT_WR);
+
+    HttpBodyReader reader;
+    http_body_reader_init(&reader, fds[0], &request);
+    char part[8];
+    assert(http_body_read(&reader, part, 2, &status));
+    assert(memcmp(part, "01", 2) == 0);
+    assert(http_body_read(&reader, NULL, 3, &status));
+    assert(http_body_read(&reader, part, 5, &status));
+    assert(memcmp(part, "56789", 5) == 0 && reader.remaining == 0);
+    assert(!http_body_read(&reader, part, 1, &status) && status == 400);
+    free_http_request(&request);
+    close_pair(fds);
+
+    /* A body cut short fails the read instead of returning less. */
+    make_socket_pair(fds);
+    write_all_or_fail(fds[1], head, sizeof(head) - 1);
+    shutdown(fds[1], SHUT_WR);
+    assert(read_http_request_head(fds[0], &request, &status));
+    http_body_reader_init(&reader, fds[0], &request);
+    assert(!http_body_read(&reader, part, 8, &status) && status == 400);
+    free_http_request(&request);
+    close_pair(fds);
+}
+
+/* Escapes quotes and backslashes, drops control bytes, and never cuts an escape in half. */
+static void test_json_escape(void) {
+    char out[16];
+    assert(http_json_escape(out, sizeof(out), "a\"b\\c\nd") == 8);
+    assert(strcmp(out, "a\\\"b\\\\cd") == 0);
+    assert(http_json_escape(out, 4, "abcdef") == 3 && strcmp(out, "abc") == 0);
+    assert(http_json_escape(out, 4, "ab\"c") == 2 && strcmp(out, "ab") == 0);
+    assert(http_json_escape(out, 1, "abc") == 0 && out[0] == '\0');
+}
+
 int main(void) {
     test_send_http_response();
     test_send_error_response();
@@ -162,6 +265,9 @@ int main(void) {
     test_read_http_request_post();
     test_read_http_request_invalid_content_length();
     test_read_http_request_too_large();
+    test_read_http_request_runtime_limits();
+    test_read_http_request_streamed_body();
+    test_json_escape();
     puts("test_http: OK");
     return 0;
 }
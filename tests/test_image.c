@@ -0,0 +1,137 @@
+#include "image.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void fill_random(uint8_t *data, size_t len, unsigned int seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+static void test_pool_acquire_release(void) {
+    assert(image_pool_init(2, 100, 50));
+    assert(image_pool_available() == 2);
+
+    ImageBuffer *a = image_pool_acquire();
+    ImageBuffer *b = image_pool_acquire();
+    assert(a != NULL && b != NULL && a != b);
+    assert(image_pool_acquire() == NULL);
+    assert(image_pool_available() == 0);
+
+    assert(a->stride % IMAGE_ALIGNMENT == 0);
+    assert(a->stride >= 100);
+    assert(((uintptr_t)a->gray % IMAGE_ALIGNMENT) == 0);
+    assert(((uintptr_t)a->r % IMAGE_ALIGNMENT) == 0);
+    assert(((uintptr_t)a->g % IMAGE_ALIGNMENT) == 0);
+    assert(((uintptr_t)a->b % IMAGE_ALIGNMENT) == 0);
+    assert(a->capacity_width == 100 && a->capacity_height == 50);
+
+    image_pool_release(a);
+    assert(image_pool_available() == 1);
+    assert(image_pool_acquire() == a);
+    image_pool_release(a);
+    image_pool_release(b);
+    image_pool_shutdown();
+}
+
+static void test_ycc_known_colors(void) {
+    image_set_kernel_level(IMAGE_KERNEL_SCALAR);
+    const uint8_t ycc[] = {
+        128, 128, 128,
+        76, 85, 255,
+        255, 128, 128,
+    };
+    uint8_t gray[3];
+    uint8_t r[3];
+    uint8_t g[3];
+    uint8_t b[3];
+    image_ycc_to_planes(ycc, 3, gray, r, g, b);
+
+    assert(gray[0] == 128 && r[0] == 128 && g[0] == 128 && b[0] == 128);
+    assert(r[1] >= 253 && g[1] <= 2 && b[1] <= 2);
+    assert(r[2] == 255 && g[2] == 255 && b[2] == 255);
+}
+
+static void test_ycc_simd_matches_scalar(void) {
+    enum { WIDTH = 77 };
+    uint8_t ycc[WIDTH * 3];
+    fill_random(ycc, sizeof(ycc), 7);
+
+    uint8_t expected[4][WIDTH];
+    image_set_kernel_level(IMAGE_KERNEL_SCALAR);
+    image_ycc_to_planes(ycc, WIDTH, expected[0], expected[1], expected[2], expected[3]);
+
+    for (int level = IMAGE_KERNEL_SSSE3; level <= IMAGE_KERNEL_AVX2; level++) {
+        if (image_set_kernel_level((ImageKernelLevel)level) != (ImageKernelLevel)level) {
+            continue;
+        }
+        uint8_t actual[4][WIDTH];
+        image_ycc_to_planes(ycc, WIDTH, actual[0], actual[1], actual[2], actual[3]);
+        assert(memcmp(expected, actual, sizeof(expected)) == 0);
+    }
+}
+
+static void test_resize_constant_plane(void) {
+    enum { SW = 64, SH = 48, DW = 21, DH = 17 };
+    uint8_t src[SW * SH];
+    uint8_t dst[DW * DH];
+    memset(src, 200, sizeof(src));
+    image_resize_plane(src, SW, SH, SW, dst, DW, DH, DW);
+    for (size_t i = 0; i < sizeof(dst); i++) {
+        assert(dst[i] == 200);
+    }
+}
+
+static void test_resize_simd_matches_scalar(void) {
+    enum { SW = 203, SH = 97, DW = 131, DH = 61 };
+    uint8_t *src = (uint8_t *)malloc(SW * SH);
+    uint8_t *expected = (uint8_t *)malloc(DW * DH);
+    uint8_t *actual = (uint8_t *)malloc(DW * DH);
+    assert(src != NULL && expected != NULL && actual != NULL);
+    fill_random(src, SW * SH, 3);
+
+    image_set_kernel_level(IMAGE_KERNEL_SCALAR);
+    image_resize_plane(src, SW, SH, SW, expected, DW, DH, DW);
+
+    for (int level = IMAGE_KERNEL_SSSE3; level <= IMAGE_KERNEL_AVX2; level++) {
+        if (image_set_kernel_level((ImageKernelLevel)level) != (ImageKernelLevel)level) {
+            continue;
+        }
+        memset(actual, 0, DW * DH);
+        image_resize_plane(src, SW, SH, SW, actual, DW, DH, DW);
+        assert(memcmp(expected, actual, DW * DH) == 0);
+    }
+
+    free(src);
+    free(expected);
+    free(actual);
+}
+
+static void test_fit_size(void) {
+    int w = 0;
+    int h = 0;
+    image_fit_size(640, 480, 320, 240, &w, &h);
+    assert(w == 320 && h == 240);
+    image_fit_size(1280, 480, 320, 240, &w, &h);
+    assert(w == 320 && h == 120);
+    image_fit_size(480, 960, 320, 240, &w, &h);
+    assert(w == 120 && h == 240);
+    image_fit_size(100, 80, 320, 240, &w, &h);
+    assert(w == 100 && h == 80);
+}
+
+int main(void) {
+    test_pool_acquire_release();
+    test_ycc_known_colors();
+    test_ycc_simd_matches_scalar();
+    test_resize_constant_plane();
+    test_resize_simd_matches_scalar();
+    test_fit_size();
+    puts("test_image: OK");
+    return 0;
+}
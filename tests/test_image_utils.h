@@ -0,0 +1,82 @@
+#ifndef TEST_IMAGE_UTILS_H
+#define TEST_IMAGE_UTILS_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBJPEG
+#include <jpeglib.h>
+
+static inline unsigned char *encode_test_jpeg(const uint8_t *pixels,
+                                              int width,
+                                              int height,
+                                              int components,
+                                              unsigned long *size_out) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char *buffer = NULL;
+    *size_out = 0;
+    jpeg_mem_dest(&cinfo, &buffer, size_out);
+
+    cinfo.image_width = (JDIMENSION)width;
+    cinfo.image_height = (JDIMENSION)height;
+    cinfo.input_components = components;
+    cinfo.in_color_space = components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 95, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW rows[1] = {(JSAMPROW)(pixels + (size_t)cinfo.next_scanline * (size_t)width *
+                                                    (size_t)components)};
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return buffer;
+}
+#endif
+
+static inline uint8_t *make_test_gray_image(int width, int height, uint8_t background) {
+    uint8_t *pixels = (uint8_t *)malloc((size_t)width * (size_t)height);
+    assert(pixels != NULL);
+    memset(pixels, background, (size_t)width * (size_t)height);
+    return pixels;
+}
+
+static inline void fill_test_rect(uint8_t *pixels,
+                                  int stride,
+                                  int x,
+                                  int y,
+                                  int width,
+                                  int height,
+                                  uint8_t value) {
+    for (int row = y; row < y + height; row++) {
+        memset(pixels + (size_t)row * (size_t)stride + (size_t)x, value, (size_t)width);
+    }
+}
+
+static const char test_square_cascade[] =
+    "# one-stage cascade that fires on a dark square centered in a bright window\n"
+    "haar_cascade 1\n"
+    "window 20 20\n"
+    "stages 1\n"
+    "stage 1 0.5\n"
+    "weak -0.1 1.0 -1.0 2\n"
+    "rect 0 0 20 20 -1\n"
+    "rect 5 5 10 10 4\n";
+
+static inline void write_test_file(const char *path, const char *contents) {
+    FILE *file = fopen(path, "w");
+    assert(file != NULL);
+    assert(fputs(contents, file) >= 0);
+    fclose(file);
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "image.h"
+#include "jpeg_decode.h"
+
+#include "test_image_utils.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBJPEG
+static unsigned char *encode_solid_jpeg(int width,
+                                        int height,
+                                        int components,
+                                        const uint8_t color[3],
+                                        unsigned long *size_out) {
+    uint8_t *pixels = (uint8_t *)malloc((size_t)width * (size_t)height * (size_t)components);
+    assert(pixels != NULL);
+    for (int i = 0; i < width * height; i++) {
+        for (int c = 0; c < components; c++) {
+            pixels[i * components + c] = color[c];
+        }
+    }
+    unsigned char *jpeg = encode_test_jpeg(pixels, width, height, components, size_out);
+    free(pixels);
+    return jpeg;
+}
+
+static int abs_diff(int a, int b) {
+    return a > b ? a - b : b - a;
+}
+
+static void test_decode_color_with_dct_scaling(void) {
+    static const uint8_t color[3] = {200, 60, 30};
+    unsigned long size = 0;
+    unsigned char *jpeg = encode_solid_jpeg(640, 480, 3, color, &size);
+    assert(jpeg != NULL && size > 0);
+
+    assert(image_pool_init(1, 320, 240));
+    ImageBuffer *image = image_pool_acquire();
+    assert(image != NULL);
+
+    JpegDecodeStats stats;
+    assert(jpeg_decode_frame(jpeg, size, 320, 240, image, &stats));
+    assert(image->width == 320 && image->height == 240);
+    assert(stats.source_width == 640 && stats.source_height == 480);
+    assert(stats.scale_denom == 2);
+    assert(stats.scaled_width == 320 && stats.scaled_height == 240);
+
+    size_t center = (size_t)120 * image->stride + 160;
+    assert(abs_diff(image->r[center], color[0]) <= 4);
+    assert(abs_diff(image->g[center], color[1]) <= 4);
+    assert(abs_diff(image->b[center], color[2]) <= 4);
+    int expected_gray = (299 * color[0] + 587 * color[1] + 114 * color[2]) / 1000;
+    assert(abs_diff(image->gray[center], expected_gray) <= 3);
+
+    image_pool_release(image);
+    image_pool_shutdown();
+    free(jpeg);
+}
+
+static void test_decode_grayscale_non_power_of_two(void) {
+    static const uint8_t color[3] = {90, 0, 0};
+    unsigned long size = 0;
+    unsigned char *jpeg = encode_solid_jpeg(500, 260, 1, color, &size);
+    assert(jpeg != NULL);
+
+    assert(image_pool_init(1, 320, 240));
+    ImageBuffer *image = image_pool_acquire();
+
+    int width = 0;
+    int height = 0;
+    assert(jpeg_decode_size(jpeg, size, &width, &height));
+    assert(width == 500 && height == 260);
+
+    JpegDecodeStats stats;
+    assert(jpeg_decode_frame(jpeg, size, 320, 240, image, &stats));
+    assert(image->width == 320 && image->height == 166);
+    assert(stats.scale_denom == 1);
+
+    size_t center = (size_t)80 * image->stride + 100;
+    assert(abs_diff(image->gray[center], 90) <= 2);
+    assert(image->r[center] == image->gray[center]);
+    assert(image->b[center] == image->gray[center]);
+
+    image_pool_release(image);
+    image_pool_shutdown();
+    free(jpeg);
+}
+
+static void test_decode_truncated_jpeg_fails(void) {
+    static const uint8_t color[3] = {10, 20, 30};
+    unsigned long size = 0;
+    unsigned char *jpeg = encode_solid_jpeg(64, 64, 3, color, &size);
+
+    assert(image_pool_init(1, 320, 240));
+    ImageBuffer *image = image_pool_acquire();
+    assert(!jpeg_decode_frame(jpeg, 40, 320, 240, image, NULL));
+    int width = 0;
+    int height = 0;
+    assert(!jpeg_decode_size(jpeg, 12, &width, &height));
+    image_pool_release(image);
+    image_pool_shutdown();
+    free(jpeg);
+}
+#endif
+
+static void test_rejects_non_jpeg(void) {
+    assert(image_pool_init(1, 32, 32));
+    ImageBuffer *image = image_pool_acquire();
+    static const unsigned char data[] = "abc123";
+    JpegDecodeStats stats;
+    assert(!jpeg_decode_frame(data, sizeof(data) - 1, 32, 32, image, &stats));
+    assert(stats.decode_us == 0);
+    image_pool_release(image);
+    image_pool_shutdown();
+}
+
+int main(void) {
+    test_rejects_non_jpeg();
+#ifdef HAVE_LIBJPEG
+    assert(jpeg_decode_available());
+    test_decode_color_with_dct_scaling();
+    test_decode_grayscale_non_power_of_two();
+    test_decode_truncated_jpeg_fails();
+    puts("test_jpeg_decode: OK");
+#else
+    assert(!jpeg_decode_available());
+    puts("test_jpeg_decode: OK (libjpeg not available, decode tests skipped)");
+#endif
+    return 0;
+}
@@ -0,0 +1,73 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "model_warmup.h"
+#include "router.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MODEL_PATH "test_model_warmup.bin"
+
+static void test_not_ready_before_start(void) {
+    assert(!model_warmup_ready());
+    char response[1024];
+    route_request("GET", "/api/ready", response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 503 Service Unavailable");
+    assert_contains(response, "Retry-After: 1");
+    assert_contains(response, "{\"ready\":false,");
+}
+
+static void test_prewarm_mapped_model(void) {
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *random = embedding_model_create_random(&spec, 7);
+    assert(random != NULL && embedding_model_save(random, MODEL_PATH));
+    embedding_model_free(random);
+    EmbeddingModel *model = embedding_model_load(MODEL_PATH);
+    remove(MODEL_PATH);
+    assert(model != NULL);
+
+    model_warmup_start(model, true);
+    model_warmup_wait();
+    assert(model_warmup_ready());
+    ModelWarmupStats stats;
+    model_warmup_stats(&stats);
+    assert(stats.prewarm && stats.mapped_bytes == embedding_model_mapped_bytes(model));
+    assert(stats.resident_bytes == stats.mapped_bytes);
+
+    char response[1024];
+    route_request("GET", "/api/ready", response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "Content-Type: application/json");
+    assert_contains(response, "{\"ready\":true,\"prewarm\":true,\"mapped_bytes\":");
+
+    /* Without prewarm the model is ready at once and pages load on demand. */
+    model_warmup_start(model, false);
+    assert(model_warmup_ready());
+    model_warmup_stats(&stats);
+    assert(!stats.prewarm && stats.warm_us == 0);
+    embedding_model_free(model);
+}
+
+static void test_no_model(void) {
+    model_warmup_start(NULL, true);
+    assert(model_warmup_ready());
+    ModelWarmupStats stats;
+    model_warmup_stats(&stats);
+    assert(stats.mapped_bytes == 0 && stats.resident_bytes == 0);
+    char json[16];
+    assert(model_warmup_format_stats_json(&stats, json, sizeof(json)) == 0);
+}
+
+int main(void) {
+    test_not_ready_before_start();
+    test_prewarm_mapped_model();
+    test_no_model();
+    puts("test_model_warmup: OK");
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "image.h"
+#include "motion_gate.h"
+
+#include "test_image_utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { W = 320, H = 240 };
+
+static void add_noise(uint8_t *pixels, size_t count, unsigned int seed, int amplitude) {
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        int value = pixels[i] + (int)((seed >> 16) % (unsigned)(2 * amplitude + 1)) - amplitude;
+        pixels[i] = (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+}
+
+static void test_signature_averages_cells(void) {
+    uint8_t *pixels = make_test_gray_image(W, H, 100);
+    fill_test_rect(pixels, W, 0, 0, 10, 10, 200);
+
+    MotionSignature signature;
+    motion_signature_compute(pixels, W, H, W, &signature);
+    assert(signature.cells[0] == 200);
+    assert(signature.cells[1] == 100);
+    assert(signature.cells[MOTION_GRID_CELLS - 1] == 100);
+    free(pixels);
+}
+
+static void test_noise_is_not_motion(void) {
+    uint8_t *a = make_test_gray_image(W, H, 120);
+    uint8_t *b = make_test_gray_image(W, H, 120);
+    add_noise(a, (size_t)W * H, 1, 10);
+    add_noise(b, (size_t)W * H, 2, 10);
+
+    MotionSignature sa;
+    MotionSignature sb;
+    motion_signature_compute(a, W, H, W, &sa);
+    motion_signature_compute(b, W, H, W, &sb);
+    assert(motion_changed_cells(&sa, &sb, 4) == 0);
+    free(a);
+    free(b);
+}
+
+static void test_moved_object_changes_cells(void) {
+    uint8_t *a = make_test_gray_image(W, H, 200);
+    uint8_t *b = make_test_gray_image(W, H, 200);
+    fill_test_rect(a, W, 100, 100, 40, 40, 20);
+    fill_test_rect(b, W, 130, 100, 40, 40, 20);
+
+    MotionSignature sa;
+    MotionSignature sb;
+    motion_signature_compute(a, W, H, W, &sa);
+    motion_signature_compute(b, W, H, W, &sb);
+    assert(motion_changed_cells(&sa, &sa, 0) == 0);
+    /* 30 pixels of shift uncovers three cell columns and covers three more. */
+    assert(motion_changed_cells(&sa, &sb, 12) >= 6 * 4);
+    free(a);
+    free(b);
+}
+
+static void test_kernel_levels_agree(void) {
+    MotionSignature a;
+    MotionSignature b;
+    unsigned int seed = 7;
+    for (size_t i = 0; i < MOTION_GRID_CELLS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        a.cells[i] = (uint8_t)(seed >> 16);
+        seed = seed * 1103515245u + 12345u;
+        b.cells[i] = (uint8_t)(a.cells[i] + (int)((seed >> 16) % 41) - 20);
+    }
+
+    ImageKernelLevel original = image_kernel_level();
+    image_set_kernel_level(IMAGE_KERNEL_SCALAR);
+    size_t expected[3];
+    int thresholds[3] = {0, 10, 255};
+    for (int t = 0; t < 3; t++) {
+        expected[t] = motion_changed_cells(&a, &b, thresholds[t]);
+    }
+    assert(expected[2] == 0);
+    for (int level = IMAGE_KERNEL_SSSE3; level <= IMAGE_KERNEL_AVX2; level++) {
+        if (image_set_kernel_level((ImageKernelLevel)level) != (ImageKernelLevel)level) {
+            continue;
+        }
+        for (int t = 0; t < 3; t++) {
+            assert(motion_changed_cells(&a, &b, thresholds[t]) == expected[t]);
+        }
+    }
+    image_set_kernel_level(original);
+}
+
+int main(void) {
+    test_signature_averages_cells();
+    test_noise_is_not_motion();
+    test_moved_object_changes_cells();
+    test_kernel_levels_agree();
+    puts("test_motion_gate: OK");
+    return 0;
+}
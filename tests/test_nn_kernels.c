@@ -0,0 +1,121 @@
+#include "nn_kernels.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int next_random(unsigned int *seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 16;
+}
+
+static void fill_random_f32(float *data, size_t len, unsigned int seed) {
+    for (size_t i = 0; i < len; i++) {
+        data[i] = (float)(next_random(&seed) & 0xffff) / 32768.0f - 1.0f;
+    }
+}
+
+static void test_padded_k(void) {
+    assert(nn_int8_padded_k(0) == 0);
+    assert(nn_int8_padded_k(1) == NN_INT8_K_ALIGN);
+    assert(nn_int8_padded_k(NN_INT8_K_ALIGN) == NN_INT8_K_ALIGN);
+    assert(nn_int8_padded_k(NN_INT8_K_ALIGN + 1) == 2 * NN_INT8_K_ALIGN);
+}
+
+static void test_gemm_f32_small_known(void) {
+    nn_set_kernel_level(NN_KERNEL_SCALAR);
+    const float a[] = {1, 2, 3, 4, 5, 6};
+    const float b[] = {7, 8, 9, 10, 11, 12};
+    float c[4];
+    nn_gemm_f32(2, 2, 3, a, 3, b, 2, c, 2);
+    assert(c[0] == 58.0f && c[1] == 64.0f);
+    assert(c[2] == 139.0f && c[3] == 154.0f);
+}
+
+static void test_gemm_f32_simd_matches_scalar(void) {
+    enum { M = 37, N = 83, K = 29 };
+    float *a = (float *)malloc(sizeof(float) * M * K);
+    float *b = (float *)malloc(sizeof(float) * K * N);
+    float *expected = (float *)malloc(sizeof(float) * M * N);
+    float *actual = (float *)malloc(sizeof(float) * M * N);
+    assert(a != NULL && b != NULL && expected != NULL && actual != NULL);
+    fill_random_f32(a, M * K, 1);
+    fill_random_f32(b, K * N, 2);
+
+    nn_set_kernel_level(NN_KERNEL_SCALAR);
+    nn_gemm_f32(M, N, K, a, K, b, N, expected, N);
+
+    for (int level = NN_KERNEL_AVX2; level <= NN_KERNEL_AVX512; level++) {
+        if (nn_set_kernel_level((NnKernelLevel)level) != (NnKernelLevel)level) {
+            continue;
+        }
+        memset(actual, 0, sizeof(float) * M * N);
+        nn_gemm_f32(M, N, K, a, K, b, N, actual, N);
+        for (size_t i = 0; i < M * N; i++) {
+            assert(fabsf(expected[i] - actual[i]) < 1e-4f);
+        }
+    }
+
+    free(a);
+    free(b);
+    free(expected);
+    free(actual);
+}
+
+static void test_gemm_u8s8_simd_matches_scalar(void) {
+    enum { M = 19, N = 45, K = 75 };
+    size_t kp = nn_int8_padded_k(K);
+    int8_t *a = (int8_t *)calloc(M * kp, 1);
+    uint8_t *bt = (uint8_t *)calloc(N * kp, 1);
+    int32_t *expected = (int32_t *)malloc(sizeof(int32_t) * M * N);
+    int32_t *actual = (int32_t *)malloc(sizeof(int32_t) * M * N);
+    assert(a != NULL && bt != NULL && expected != NULL && actual != NULL);
+
+    unsigned int seed = 9;
+    for (size_t row = 0; row < M; row++) {
+        for (size_t k = 0; k < K; k++) {
+            a[row * kp + k] = (int8_t)((int)(next_random(&seed) % 255u) - 127);
+        }
+    }
+    for (size_t col = 0; col < N; col++) {
+        for (size_t k = 0; k < K; k++) {
+            bt[col * kp + k] = (uint8_t)next_random(&seed);
+        }
+    }
+    bt[0] = 255;
+    a[0] = 127;
+
+    nn_set_kernel_level(NN_KERNEL_SCALAR);
+    nn_gemm_u8s8(M, N, kp, a, bt, expected, N);
+    int32_t direct = 0;
+    for (size_t k = 0; k < K; k++) {
+        direct += (int32_t)a[k] * (int32_t)bt[k];
+    }
+    assert(expected[0] == direct);
+
+    for (int level = NN_KERNEL_AVX2; level <= NN_KERNEL_AVX512; level++) {
+        if (nn_set_kernel_level((NnKernelLevel)level) != (NnKernelLevel)level) {
+            continue;
+        }
+        memset(actual, 0, sizeof(int32_t) * M * N);
+        nn_gemm_u8s8(M, N, kp, a, bt, actual, N);
+        assert(memcmp(expected, actual, sizeof(int32_t) * M * N) == 0);
+    }
+
+    free(a);
+    free(bt);
+    free(expected);
+    free(actual);
+}
+
+int main(void) {
+    test_padded_k();
+    test_gemm_f32_small_known();
+    test_gemm_f32_simd_matches_scalar();
+    test_gemm_u8s8_simd_matches_scalar();
+    puts("test_nn_kernels: OK");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "perf_counters.h"
+#include "router.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef WEB_SERVER_PERF_COUNTERS
+static volatile unsigned long long sink;
+
+static void spin(void) {
+    unsigned long long sum = 0;
+    for (unsigned long long i = 0; i < 2000000; i++) {
+        sum += i * i;
+    }
+    sink = sum;
+}
+
+static void *measure_on_worker(void *arg) {
+    (void)arg;
+    perf_set_thread_name("worker");
+    PERF_START(start);
+    spin();
+    PERF_END(PERF_STAGE_DECODE, start);
+    return NULL;
+}
+
+static char *format(void) {
+    size_t capacity = perf_counters_json_capacity();
+    char *json = (char *)malloc(capacity);
+    assert(json != NULL);
+    size_t length = perf_counters_format_json(json, capacity);
+    assert(length == strlen(json));
+    assert(strcmp(json + length - 2, "]}") == 0);
+    return json;
+}
+
+static void test_disabled_counts_nothing(void) {
+    assert(!perf_counters_enabled());
+    PERF_START(start);
+    spin();
+    PERF_END(PERF_STAGE_SEARCH, start);
+    PerfCounterStats stats;
+    perf_counters_stats(&stats);
+    assert(!stats.enabled && stats.threads == 0 && stats.samples == 0);
+
+    char *json = format();
+    assert(strcmp(json, "{\"enabled\":false,\"events\":[\"cpu_ns\",\"cycles\",\"instructions\","
+                        "\"llc_misses\",\"branch_misses\"],\"error\":null,\"threads\":[]}") == 0);
+    free(json);
+}
+
+/*
+ * Hardware counters are often missing in virtual machines and containers,
+ * and perf_event_open may be refused outright, so what is asserted depends
+ * on what the kernel allowed.
+ */
+static void test_stages_per_thread(void) {
+    perf_counters_set_enabled(true);
+    perf_set_thread_name("test-main");
+    for (int i = 0; i < 3; i++) {
+        PERF_START(start);
+        spin();
+        PERF_END(PERF_STAGE_SEARCH, start);
+    }
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, measure_on_worker, NULL) == 0);
+    pthread_join(thread, NULL);
+
+    PerfCounterStats stats;
+    perf_counters_stats(&stats);
+    assert(stats.enabled && stats.threads == 2);
+    char *json = format();
+    assert_contains(json, "{\"enabled\":true,");
+    assert_contains(json, "{\"name\":\"test-main\",\"tid\":1,");
+    assert_contains(json, "{\"name\":\"worker\",\"tid\":2,");
+    if (stats.unavailable_threads == 0) {
+        assert(stats.samples == 4);
+        const char *search = strstr(json, "\"search\":{\"calls\":3,\"cpu_ns\":");
+        assert(search != NULL);
+        assert(strtoull(strchr(search + 20, ':') + 1, NULL, 10) > 0);
+        assert_contains(json, "\"decode\":{\"calls\":1,\"cpu_ns\":");
+        assert(strstr(json, "\"read\":") == NULL);
+        if (strstr(json, "\"cycles\":null") == NULL) {
+            assert_contains(json, "\"instructions\":");
+        }
+    } else {
+        assert(stats.unavailable_threads == 2 && stats.samples == 0);
+        assert_contains(json, "\"available\":false,\"stages\":{}}");
+        assert(strstr(json, "\"error\":null") == NULL);
+    }
+
+    /* A thread that exits hands its slot to the next one. */
+    assert(pthread_create(&thread, NULL, measure_on_worker, NULL) == 0);
+    pthread_join(thread, NULL);
+    perf_counters_stats(&stats);
+    assert(stats.threads == 2);
+
+    /* Too small a buffer drops threads but still closes the JSON. */
+    size_t length = perf_counters_format_json(json, 200);
+    assert(length > 0 && length < 200 && strcmp(json + length - 2, "]}") == 0);
+    assert(perf_counters_format_json(json, 16) == 0);
+    free(json);
+}
+#endif
+
+static void test_perf_route(void) {
+    char response[16384];
+    route_request("GET", "/debug/perf", response, sizeof(response));
+#ifdef WEB_SERVER_PERF_COUNTERS
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "Content-Type: application/json");
+    assert_contains(response, "{\"enabled\":true,\"events\":[");
+#else
+    assert_contains(response, "HTTP/1.1 404 Not Found");
+#endif
+    route_request("POST", "/debug/perf", response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+}
+
+int main(void) {
+#ifdef WEB_SERVER_PERF_COUNTERS
+    test_disabled_counts_nothing();
+    test_stages_per_thread();
+    test_perf_route();
+    puts("test_perf_counters: OK");
+#else
+    assert(perf_counters_json_capacity() == 0);
+    test_perf_route();
+    puts("test_perf_counters: OK (perf counters compiled out)");
+#endif
+    return 0;
+}
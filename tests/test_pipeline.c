@@ -0,0 +1,274 @@
+#include "event_feed.h"
+#include "face_detect.h"
+#include "gallery_store.h"
+#include "image.h"
+#include "pipeline.h"
+
+#include "test_image_utils.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CASCADE_PATH "test_pipeline_cascade.txt"
+#define STORE_DIR "test_pipeline_gallery"
+
+static void test_submit_requires_running_pipeline(void) {
+    static const unsigned char frame[] = "abc";
+    assert(!pipeline_running());
+    assert(!pipeline_submit_frame(NULL, frame, 3, NULL));
+}
+
+static void test_format_faces_json(void) {
+    PipelineResult result;
+    memset(&result, 0, sizeof(result));
+    result.seq = 7;
+    result.frame_width = 640;
+    result.frame_height = 480;
+    result.decode_us = 1500;
+    result.face_count = 2;
+    FaceBox a = {1, 2, 3, 4, 5};
+    FaceBox b = {10, 20, 30, 40, 3};
+    result.faces[0].box = a;
+    result.faces[0].track_id = 9;
+    result.faces[1].box = b;
+    result.faces[1].track_id = 4;
+    result.faces[1].identified = true;
+    snprintf(result.faces[1].identity.name, sizeof(result.faces[1].identity.name), "al\"ice");
+
+    char json[512];
+    size_t n = pipeline_format_faces_json(&result, json, sizeof(json));
+    assert(n == strlen(json));
+    assert(strstr(json, "\"seq\":7") != NULL);
+    assert(strstr(json, "\"decode_ms\":1.500") != NULL);
+    assert(strstr(json, "\"motion_skipped\":false") != NULL);
+    assert(strstr(json, "{\"x\":1,\"y\":2,\"w\":3,\"h\":4,\"track\":9},{\"x\":10,") != NULL);
+    assert(strstr(json, "\"track\":4,\"identity\":\"al\\\"ice\"}]") != NULL);
+
+    assert(pipeline_format_faces_json(&result, json, 16) == 0);
+
+    /* A full frame of identified faces with the longest escaped names and widest numbers. */
+    result.face_count = PIPELINE_MAX_FACES;
+    for (size_t i = 0; i < PIPELINE_MAX_FACES; i++) {
+        FaceBox wide = {INT_MIN, INT_MIN, INT_MIN, INT_MIN, 1};
+        result.faces[i].box = wide;
+        result.faces[i].track_id = UINT32_MAX;
+        result.faces[i].identified = true;
+        memset(result.faces[i].identity.name, '"', GALLERY_NAME_MAX);
+        result.faces[i].identity.name[GALLERY_NAME_MAX] = '\0';
+    }
+    size_t capacity = pipeline_faces_json_capacity(&result);
+    assert(capacity > 4096);
+    char *full = (char *)malloc(capacity);
+    assert(full != NULL);
+    n = pipeline_format_faces_json(&result, full, capacity);
+    assert(n > 4096 && n == strlen(full));
+    free(full);
+}
+
+static void test_non_jpeg_frames_complete_without_result(void) {
+    assert(image_pool_init(2, 320, 240));
+    assert(pipeline_start(NULL, 1, 2));
+
+    static const unsigned char frame[] = "not a jpeg";
+    uint64_t seq = 0;
+    assert(pipeline_submit_frame(NULL, frame, sizeof(frame) - 1, &seq));
+    assert(seq > 0);
+    assert(pipeline_wait_for_seq(seq, 2000));
+
+    PipelineStats stats;
+    pipeline_stats(&stats);
+    assert(stats.submitted == 1);
+    assert(stats.decode_failures + stats.dropped == 1);
+
+    pipeline_stop();
+    image_pool_shutdown();
+}
+
+#ifdef HAVE_LIBJPEG
+static void test_detects_faces_off_request_thread(void) {
+    write_test_file(CASCADE_PATH, test_square_cascade);
+    FaceDetector *detector = face_detector_load(CASCADE_PATH);
+    remove(CASCADE_PATH);
+    assert(detector != NULL);
+
+    enum { W = 640, H = 480 };
+    uint8_t *pixels = make_test_gray_image(W, H, 220);
+    fill_test_rect(pixels, W, 240, 160, 160, 160, 20);
+    unsigned long size = 0;
+    unsigned char *jpeg = encode_test_jpeg(pixels, W, H, 1, &size);
+    free(pixels);
+
+    assert(image_pool_init(4, 320, 240));
+    PipelineEngines engines = {detector, NULL, EMBEDDING_PRECISION_FLOAT};
+    assert(pipeline_start(&engines, 2, 4));
+
+    uint64_t seq = 0;
+    assert(pipeline_submit_frame("cam", jpeg, size, &seq));
+    assert(pipeline_wait_for_seq(seq, 5000));
+
+    PipelineResult result;
+    pipeline_latest_result(&result);
+    assert(result.seq == seq);
+    assert(result.frame_width == W && result.frame_height == H);
+    assert(result.face_count >= 1);
+    bool found = false;
+    for (size_t i = 0; i < result.face_count; i++) {
+        const FaceBox *box = &result.faces[i].box;
+        int cx = box->x + box->width / 2;
+        int cy = box->y + box->height / 2;
+        if (abs(cx - 320) <= 16 && abs(cy - 240) <= 16) {
+            found = true;
+        }
+    }
+    assert(found);
+
+    pipeline_stop();
+    image_pool_shutdown();
+    face_detector_free(detector);
+    free(jpeg);
+}
+
+static unsigned char *square_frame(int x, unsigned long *size) {
+    enum { W = 640, H = 480 };
+    uint8_t *pixels = make_test_gray_image(W, H, 220);
+    fill_test_rect(pixels, W, x, 160, 160, 160, 20);
+    unsigned char *jpeg = encode_test_jpeg(pixels, W, H, 1, size);
+    free(pixels);
+    return jpeg;
+}
+
+static void submit_and_wait(const char *stream, const unsigned char *jpeg, unsigned long size,
+                            PipelineResult *result) {
+    uint64_t seq = 0;
+    assert(pipeline_submit_frame(stream, jpeg, size, &seq));
+    assert(pipeline_wait_for_seq(seq, 5000));
+    pipeline_latest_result(result);
+    assert(result->seq == seq);
+}
+
+static void test_unchanged_frames_reuse_detections(void) {
+    write_test_file(CASCADE_PATH, test_square_cascade);
+    FaceDetector *detector = face_detector_load(CASCADE_PATH);
+    remove(CASCADE_PATH);
+    assert(detector != NULL);
+
+    unsigned long still_size = 0;
+    unsigned long moved_size = 0;
+    unsigned char *still = square_frame(240, &still_size);
+    unsigned char *moved = square_frame(280, &moved_size);
+
+    assert(image_pool_init(4, 320, 240));
+    PipelineEngines engines = {detector, NULL, EMBEDDING_PRECISION_FLOAT};
+    assert(pipeline_start(&engines, 1, 4));
+    const char *cam = "cam";
+
+    PipelineResult first;
+    submit_and_wait(cam, still, still_size, &first);
+    assert(!first.motion_skipped && first.face_count >= 1);
+    uint32_t track = first.faces[0].track_id;
+    assert(track != 0);
+
+    PipelineResult repeat;
+    submit_and_wait(cam, still, still_size, &repeat);
+    assert(repeat.motion_skipped && repeat.detect_us == 0);
+    assert(repeat.face_count == first.face_count && repeat.faces[0].track_id == track);
+
+    /* Another stream has no history, so the same image is analysed in full. */
+    PipelineResult other;
+    submit_and_wait("lobby", still, still_size, &other);
+    assert(!other.motion_skipped && other.faces[0].track_id != track);
+
+    /* A moved face is detected again but keeps its track. */
+    PipelineResult shifted;
+    submit_and_wait(cam, moved, moved_size, &shifted);
+    assert(!shifted.motion_skipped && shifted.face_count >= 1);
+    assert(shifted.faces[0].track_id == track);
+    assert(shifted.faces[0].box.x > first.faces[0].box.x);
+
+    PipelineStats stats;
+    pipeline_stats(&stats);
+    assert(stats.processed == 4 && stats.motion_skipped == 1);
+
+    pipeline_stop();
+    image_pool_shutdown();
+    face_detector_free(detector);
+    free(still);
+    free(moved);
+}
+
+static void test_identified_tracks_publish_events(void) {
+    write_test_file(CASCADE_PATH, test_square_cascade);
+    FaceDetector *detector = face_detector_load(CASCADE_PATH);
+    remove(CASCADE_PATH);
+    assert(detector != NULL);
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *embedder = embedding_model_create_random(&spec, 7);
+    assert(embedder != NULL);
+
+    unsigned long still_size = 0;
+    unsigned long moved_size = 0;
+    unsigned char *still = square_frame(240, &still_size);
+    unsigned char *moved = square_frame(280, &moved_size);
+
+    assert(image_pool_init(4, 320, 240));
+    PipelineEngines engines = {detector, embedder, EMBEDDING_PRECISION_FLOAT};
+    assert(pipeline_start(&engines, 1, 4));
+    assert(gallery_store_open(STORE_DIR, embedding_model_dim(embedder)));
+    EventFeedParams params = {16, 4, 1000, 1000};
+    assert(event_feed_start(&params));
+
+    PipelineResult *result = (PipelineResult *)malloc(sizeof(*result));
+    assert(result != NULL);
+    assert(pipeline_extract_faces(still, still_size, result));
+    assert(result->face_count >= 1 && result->faces[0].has_embedding);
+    assert(gallery_store_enroll("alice", result->faces[0].embedding, NULL));
+
+    submit_and_wait("door", still, still_size, result);
+    assert(result->faces[0].identified);
+    assert(strcmp(result->faces[0].identity.name, "alice") == 0);
+    EventFeedStats events;
+    event_feed_stats(&events);
+    assert(events.published == 1);
+
+    /* The same person on the same track is not announced again. */
+    submit_and_wait("door", moved, moved_size, result);
+    assert(result->faces[0].identified && !result->faces[0].embedding_reused);
+    event_feed_stats(&events);
+    assert(events.published == 1);
+
+    PipelineStats stats;
+    pipeline_stats(&stats);
+    assert(stats.identifications == 2);
+    free(result);
+
+    event_feed_stop();
+    gallery_store_close();
+    remove(STORE_DIR "/gallery.snapshot");
+    remove(STORE_DIR "/gallery.log");
+    rmdir(STORE_DIR);
+    pipeline_stop();
+    image_pool_shutdown();
+    embedding_model_free(embedder);
+    face_detector_free(detector);
+    free(still);
+    free(moved);
+}
+#endif
+
+int main(void) {
+    test_submit_requires_running_pipeline();
+    test_format_faces_json();
+    test_non_jpeg_frames_complete_without_result();
+#ifdef HAVE_LIBJPEG
+    test_detects_faces_off_request_thread();
+    test_unchanged_frames_reuse_detections();
+    test_identified_tracks_publish_events();
+#endif
+    puts("test_pipeline: OK");
+    return 0;
+}
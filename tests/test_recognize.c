@@ -0,0 +1,174 @@
+#include "embedding.h"
+#include "face_detect.h"
+#include "gallery_store.h"
+#include "image.h"
+#include "pipeline.h"
+#include "recognize.h"
+#include "router.h"
+
+#include "test_image_utils.h"
+#include "test_utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CASCADE_PATH "test_recognize_cascade.txt"
+#define STORE_DIR "test_recognize_gallery"
+
+static void test_format_json_and_timing(void) {
+    RecognizeResult result;
+    memset(&result, 0, sizeof(result));
+    result.frame_width = 640;
+    result.frame_height = 480;
+    result.read_us = 250;
+    result.detect_us = 6100;
+    result.total_us = 9000;
+    result.face_count = 2;
+    FaceBox a = {1, 2, 3, 4, 0};
+    FaceBox b = {10, 20, 30, 40, 0};
+    result.faces[0].box = a;
+    result.faces[0].identified = true;
+    result.faces[0].identity.id = 3;
+    snprintf(result.faces[0].identity.name, sizeof(result.faces[0].identity.name), "alice");
+    result.faces[0].similarity = 0.875f;
+    result.faces[1].box = b;
+
+    char json[512];
+    size_t n = recognize_format_json(&result, json, sizeof(json));
+    assert(n == strlen(json));
+    assert_contains(json, "{\"width\":640,\"height\":480,\"faces\":[");
+    assert_contains(json, "\"identity\":\"alice\",\"id\":3,\"similarity\":0.8750}");
+    assert_contains(json, "{\"x\":10,\"y\":20,\"w\":30,\"h\":40,\"identity\":null}]}");
+    assert(recognize_format_json(&result, json, 32) == 0);
+
+    char timing[256];
+    assert(recognize_format_server_timing(&result, timing, sizeof(timing)) == strlen(timing));
+    assert_contains(timing, "read;dur=0.250, queue;dur=0.000, decode;dur=0.000, ");
+    assert_contains(timing, "detect;dur=6.100, embed;dur=0.000, search;dur=0.000, total;dur=9.000");
+}
+
+static void test_route_rejections(void) {
+    char response[4096];
+    HttpRequest get = make_request("GET", "/api/recognize");
+    run_route_and_read(&get, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+
+    HttpRequest empty = make_request("POST", "/api/recognize");
+    run_route_and_read(&empty, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    unsigned char body[] = "{}";
+    HttpRequest json = make_request("POST", "/api/recognize");
+    snprintf(json.content_type, sizeof(json.content_type), "application/json");
+    json.body = body;
+    json.body_length = 2;
+    run_route_and_read(&json, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 415 Unsupported Media Type");
+
+    /* Without a compute pool the request is turned away, not run inline. */
+    HttpRequest jpeg = make_request("POST", "/api/recognize");
+    jpeg.body = body;
+    jpeg.body_length = 2;
+    run_route_and_read(&jpeg, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 503 Service Unavailable");
+    assert_contains(response, "Retry-After: 1");
+}
+
+static void test_undecodable_body_answered_from_pool(void) {
+    assert(image_pool_init(2, 320, 240));
+    assert(recognize_start(1, 2));
+
+    unsigned char body[] = "not a jpeg";
+    HttpRequest request = make_request("POST", "/api/recognize");
+    request.body = body;
+    request.body_length = sizeof(body) - 1;
+    char response[4096];
+    run_route_and_read(&request, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 422 Unprocessable Entity");
+
+    recognize_stop();
+    RecognizeStats stats;
+    recognize_stats(&stats);
+    assert(stats.accepted == 1 && stats.completed == 1 && stats.in_flight == 0);
+    image_pool_shutdown();
+}
+
+#ifdef HAVE_LIBJPEG
+static void test_recognizes_enrolled_face(void) {
+    write_test_file(CASCADE_PATH, test_square_cascade);
+    FaceDetector *detector = face_detector_load(CASCADE_PATH);
+    remove(CASCADE_PATH);
+    assert(detector != NULL);
+    EmbeddingSpec spec = embedding_default_spec();
+    EmbeddingModel *embedder = embedding_model_create_random(&spec, 7);
+    assert(embedder != NULL);
+
+    enum { W = 640, H = 480 };
+    uint8_t *pixels = make_test_gray_image(W, H, 220);
+    fill_test_rect(pixels, W, 240, 160, 160, 160, 20);
+    unsigned long size = 0;
+    unsigned char *jpeg = encode_test_jpeg(pixels, W, H, 1, &size);
+    free(pixels);
+
+    assert(image_pool_init(4, 320, 240));
+    PipelineEngines engines = {detector, embedder, EMBEDDING_PRECISION_FLOAT};
+    assert(pipeline_start(&engines, 1, 4));
+    assert(gallery_store_open(STORE_DIR, embedding_model_dim(embedder)));
+    assert(recognize_start(2, 4));
+
+    RecognizeResult *result = (RecognizeResult *)malloc(sizeof(*result));
+    assert(result != NULL);
+    assert(recognize_frame(jpeg, size, result) == 200);
+    assert(result->face_count >= 1 && !result->faces[0].identified);
+
+    PipelineResult *faces = (PipelineResult *)malloc(sizeof(*faces));
+    assert(faces != NULL);
+    assert(pipeline_extract_faces(jpeg, size, faces));
+    assert(faces->faces[0].has_embedding);
+    assert(gallery_store_enroll("alice", faces->faces[0].embedding, NULL));
+    free(faces);
+
+    assert(recognize_frame(jpeg, size, result) == 200);
+    assert(result->faces[0].identified);
+    assert(strcmp(result->faces[0].identity.name, "alice") == 0);
+    assert(result->faces[0].similarity > 0.99f);
+    free(result);
+
+    HttpRequest request = make_request("POST", "/api/recognize");
+    snprintf(request.content_type, sizeof(request.content_type), "image/jpeg");
+    request.body = jpeg;
+    request.body_length = size;
+    request.read_us = 1500;
+    char response[8192];
+    run_route_and_read(&request, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "Server-Timing: read;dur=1.500, queue;dur=");
+    assert_contains(response, ", search;dur=");
+    assert_contains(response, "\"identity\":\"alice\"");
+
+    recognize_stop();
+    gallery_store_close();
+    remove(STORE_DIR "/gallery.snapshot");
+    remove(STORE_DIR "/gallery.log");
+    rmdir(STORE_DIR);
+    pipeline_stop();
+    image_pool_shutdown();
+    embedding_model_free(embedder);
+    face_detector_free(detector);
+    free(jpeg);
+}
+#endif
+
+int main(void) {
+    test_format_json_and_timing();
+    test_route_rejections();
+    test_undecodable_body_answered_from_pool();
+#ifdef HAVE_LIBJPEG
+    test_recognizes_enrolled_face();
+#endif
+    puts("test_recognize: OK");
+    return 0;
+}
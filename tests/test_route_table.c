@@ -0,0 +1,141 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "route_table.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static void handler_a(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)client_fd;
+    (void)request;
+    (void)match;
+}
+
+static void handler_b(int client_fd, const HttpRequest *request, const RouteMatch *match) {
+    (void)client_fd;
+    (void)request;
+    (void)match;
+}
+
+static void test_literal_and_method_dispatch(void) {
+    RouteTable *table = route_table_create();
+    assert(table != NULL);
+    static const char root_context[] = "root";
+    assert(route_table_add(table, ROUTE_GET, "/", handler_a, root_context));
+    assert(route_table_add(table, ROUTE_GET, "/api/frame", handler_a, NULL));
+    assert(route_table_add(table, ROUTE_POST, "/api/frame", handler_b, NULL));
+    assert(route_table_add(table, ROUTE_GET, "/api/frame/faces", handler_b, NULL));
+
+    RouteMatch match;
+    assert(route_table_lookup(table, "GET", "/", &match) == 200);
+    assert(match.handler == handler_a && match.context == root_context);
+    assert(route_table_lookup(table, "GET", "/api/frame", &match) == 200);
+    assert(match.handler == handler_a && match.param_count == 0);
+    assert(route_table_lookup(table, "POST", "/api/frame", &match) == 200);
+    assert(match.handler == handler_b);
+    assert(route_table_lookup(table, "GET", "/api/frame/faces", &match) == 200);
+    assert(match.handler == handler_b);
+
+    assert(route_table_lookup(table, "DELETE", "/api/frame", &match) == 405);
+    assert(match.allowed == (ROUTE_GET | ROUTE_POST) && match.handler == NULL);
+    assert(route_table_lookup(table, "BREW", "/", &match) == 405);
+    assert(match.allowed == ROUTE_GET);
+
+    /* Intermediate segments and near misses are not routes. */
+    assert(route_table_lookup(table, "GET", "/api", &match) == 404);
+    assert(route_table_lookup(table, "GET", "/api/frame/", &match) == 404);
+    assert(route_table_lookup(table, "GET", "/api/fram", &match) == 404);
+    assert(route_table_lookup(table, "GET", "/api/frames", &match) == 404);
+    assert(route_table_lookup(table, "GET", "api/frame", &match) == 404);
+    assert(route_table_lookup(table, "GET", "", &match) == 404);
+    route_table_free(table);
+}
+
+static void test_params(void) {
+    RouteTable *table = route_table_create();
+    assert(route_table_add(table, ROUTE_POST | ROUTE_DELETE, "/api/gallery/{identity}", handler_a,
+                           NULL));
+    assert(route_table_add(table, ROUTE_GET, "/api/gallery/stats", handler_b, NULL));
+    assert(route_table_add(table, ROUTE_GET, "/api/gallery/{identity}/entries/{entry}", handler_b,
+                           NULL));
+
+    RouteMatch match;
+    char value[32];
+    assert(route_table_lookup(table, "DELETE", "/api/gallery/alice", &match) == 200);
+    assert(match.handler == handler_a && match.param_count == 1);
+    assert(route_param(&match, "identity", value, sizeof(value)));
+    assert(strcmp(value, "alice") == 0);
+    assert(!route_param(&match, "entry", value, sizeof(value)));
+    assert(!route_param(&match, "identity", value, 5));
+
+    /* A literal sibling wins; if its branch dead-ends, the capture still gets a try. */
+    assert(route_table_lookup(table, "GET", "/api/gallery/stats", &match) == 200);
+    assert(match.handler == handler_b && match.param_count == 0);
+    assert(route_table_lookup(table, "POST", "/api/gallery/stats", &match) == 405);
+    assert(match.allowed == ROUTE_GET);
+    assert(route_table_lookup(table, "GET", "/api/gallery/stats/entries/7", &match) == 200);
+    assert(match.param_count == 2);
+    assert(route_param(&match, "identity", value, sizeof(value)) && strcmp(value, "stats") == 0);
+    assert(route_param(&match, "entry", value, sizeof(value)) && strcmp(value, "7") == 0);
+
+    assert(route_table_lookup(table, "GET", "/api/gallery/alice", &match) == 405);
+    assert(match.allowed == (ROUTE_POST | ROUTE_DELETE));
+    assert(route_table_lookup(table, "POST", "/api/gallery/", &match) == 404);
+    assert(route_table_lookup(table, "POST", "/api/gallery/a/b", &match) == 404);
+    assert(match.param_count == 0);
+    route_table_free(table);
+}
+
+static void test_rejects_bad_routes(void) {
+    RouteTable *table = route_table_create();
+    assert(route_table_add(table, ROUTE_GET, "/items/{id}", handler_a, NULL));
+    assert(!route_table_add(table, ROUTE_GET, "/items/{id}", handler_b, NULL));
+    assert(route_table_add(table, ROUTE_PUT, "/items/{id}", handler_b, NULL));
+    assert(!route_table_add(table, ROUTE_GET, "/items/{name}/tags", handler_a, NULL));
+    assert(!route_table_add(table, ROUTE_GET, "items", handler_a, NULL));
+    assert(!route_table_add(table, 0, "/empty", handler_a, NULL));
+    assert(!route_table_add(table, ROUTE_GET, "/a/{}", handler_a, NULL));
+    assert(!route_table_add(table, ROUTE_GET, "/{a}/{b}/{c}/{d}/{e}", handler_a, NULL));
+    assert(!route_table_add(table, ROUTE_GET, "/null", NULL, NULL));
+    route_table_free(table);
+}
+
+/* Many sibling routes still resolve each one and nothing else. */
+static void test_many_routes(void) {
+    RouteTable *table = route_table_create();
+    char path[64];
+    for (int i = 0; i < 500; i++) {
+        snprintf(path, sizeof(path), "/r/%d/leaf", (i * 7919) % 500);
+        assert(route_table_add(table, ROUTE_GET, path, handler_a, NULL));
+    }
+    RouteMatch match;
+    for (int i = 0; i < 500; i++) {
+        snprintf(path, sizeof(path), "/r/%d/leaf", i);
+        assert(route_table_lookup(table, "GET", path, &match) == 200);
+    }
+    assert(route_table_lookup(table, "GET", "/r/500/leaf", &match) == 404);
+    route_table_free(table);
+}
+
+static void test_allow_header(void) {
+    char allow[32];
+    assert(route_format_allow(ROUTE_GET | ROUTE_POST | ROUTE_DELETE, allow, sizeof(allow)) == 17);
+    assert(strcmp(allow, "GET, POST, DELETE") == 0);
+    assert(route_format_allow(ROUTE_OPTIONS, allow, sizeof(allow)) == 7);
+    assert(route_format_allow(ROUTE_GET | ROUTE_POST, allow, 6) == 0);
+    assert(route_method_mask("PATCH") == ROUTE_PATCH);
+    assert(route_method_mask("get") == 0);
+}
+
+int main(void) {
+    test_literal_and_method_dispatch();
+    test_params();
+    test_rejects_bad_routes();
+    test_many_routes();
+    test_allow_header();
+    puts("test_route_table: OK");
+    return 0;
+}
@@ -1,5 +1,8 @@
 #include "router.h"
 
+#include "cluster.h"
+#include "frame_store.h"
+#include "gallery_store.h"
 #include "server_config.h"
 #include "static_assets.h"
 #include "test_utils.h"
@@ -10,27 +13,6 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
-static size_t run_route_and_read(const HttpRequest *request, char *response, size_t cap) {
-    int fds[2];
-    make_socket_pair(fds);
-
-    handle_request(fds[0], request);
-    shutdown(fds[0], SHUT_WR);
-
-    size_t n = read_all_or_fail(fds[1], response, cap - 1);
-    response[n] = '\0';
-    close_pair(fds);
-    return n;
-}
-
-static HttpRequest make_request(const char *method, const char *path) {
-    HttpRequest request;
-    memset(&request, 0, sizeof(request));
-    snprintf(request.method, sizeof(request.method), "%s", method);
-    snprintf(request.path, sizeof(request.path), "%s", path);
-    return request;
-}
-
 static void test_router_static_route(void) {
     HttpRequest request = make_request("GET", "/");
     char response[8192];
@@ -49,6 +31,7 @@ static void test_router_frame_flow(void) {
     HttpRequest bad_method = make_request("PUT", "/api/frame");
     run_route_and_read(&bad_method, response, sizeof(response));
     assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+    assert_contains(response, "Allow: GET, POST\r\n");
 
     HttpRequest post_empty = make_request("POST", "/api/frame");
     post_empty.body_length = 0;
@@ -61,13 +44,23 @@ static void test_router_frame_flow(void) {
     run_route_and_read(&post_too_large, response, sizeof(response));
     assert_contains(response, "HTTP/1.1 413 Payload Too Large");
 
+    /* The limit follows the runtime config. */
+    router_set_max_frame_size(4);
+    HttpRequest post_over_limit = make_request("POST", "/api/frame");
+    post_over_limit.body = (unsigned char *)"abcde";
+    post_over_limit.body_length = 5;
+    run_route_and_read(&post_over_limit, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 413 Payload Too Large");
+    router_set_max_frame_size(MAX_FRAME_SIZE);
+
     unsigned char frame_data[] = "abc123";
     HttpRequest post_ok = make_request("POST", "/api/frame");
     post_ok.body = frame_data;
     post_ok.body_length = sizeof(frame_data) - 1;
     run_route_and_read(&post_ok, response, sizeof(response));
     assert_contains(response, "HTTP/1.1 200 OK");
-    assert_contains(response, "{\"ok\":true}");
+    assert_contains(response, "{\"ok\":true,\"advice\":{\"interval_ms\":");
+    assert_contains(response, "\"max_width\":640,\"quality\":70}}");
 
     HttpRequest get_after_post = make_request("GET", "/api/frame");
     run_route_and_read(&get_after_post, response, sizeof(response));
@@ -76,6 +69,267 @@ static void test_router_frame_flow(void) {
     assert_contains(response, "abc123");
 }
 
+static void test_router_faces_route(void) {
+    char response[4096];
+
+    HttpRequest get_faces = make_request("GET", "/api/frame/faces");
+    run_route_and_read(&get_faces, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "Content-Type: application/json");
+    assert_contains(response, "\"faces\":[]");
+
+    HttpRequest post_faces = make_request("POST", "/api/frame/faces");
+    run_route_and_read(&post_faces, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+}
+
+static void test_router_pipeline_stats_route(void) {
+    char response[4096];
+
+    HttpRequest get_stats = make_request("GET", "/api/pipeline/stats");
+    run_route_and_read(&get_stats, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "\"stale_dropped\":0");
+    assert_contains(response, "\"mean_queue_wait_ms\":");
+
+    HttpRequest post_stats = make_request("POST", "/api/pipeline/stats");
+    run_route_and_read(&post_stats, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+}
+
+static void test_router_gallery_routes(void) {
+    char response[4096];
+
+    HttpRequest unavailable = make_request("GET", "/api/gallery");
+    run_route_and_read(&unavailable, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 503 Service Unavailable");
+
+    assert(gallery_store_open("test_router_gallery", 4));
+
+    char json_body[] = "{\"embedding\": [0.1, 0.2, 0.3, 0.4]}";
+    HttpRequest enroll_json = make_request("POST", "/api/gallery/alice");
+    snprintf(enroll_json.content_type, sizeof(enroll_json.content_type), "application/json");
+    enroll_json.body = (unsigned char *)json_body;
+    enroll_json.body_length = sizeof(json_body) - 1;
+    run_route_and_read(&enroll_json, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 201 Created");
+    assert_contains(response, "{\"identity\":\"alice\",\"id\":1,\"entries\":1}");
+
+    float raw[4] = {0.4f, 0.3f, 0.2f, 0.1f};
+    HttpRequest enroll_raw = make_request("POST", "/api/gallery/alice");
+    snprintf(enroll_raw.content_type, sizeof(enroll_raw.content_type), "application/octet-stream");
+    enroll_raw.body = (unsigned char *)raw;
+    enroll_raw.body_length = sizeof(raw);
+    run_route_and_read(&enroll_raw, response, sizeof(response));
+    assert_contains(response, "\"entries\":2");
+
+    enroll_raw.body_length = sizeof(raw) - 1;
+    run_route_and_read(&enroll_raw, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    char short_json[] = "{\"embedding\":[1,2,3]}";
+    enroll_json.body = (unsigned char *)short_json;
+    enroll_json.body_length = sizeof(short_json) - 1;
+    run_route_and_read(&enroll_json, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    unsigned char not_jpeg[] = "not a jpeg";
+    HttpRequest enroll_image = make_request("POST", "/api/gallery/bob");
+    snprintf(enroll_image.content_type, sizeof(enroll_image.content_type), "image/jpeg");
+    enroll_image.body = not_jpeg;
+    enroll_image.body_length = sizeof(not_jpeg) - 1;
+    run_route_and_read(&enroll_image, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 422 Unprocessable Entity");
+
+    HttpRequest bad_name = make_request("POST", "/api/gallery/a%20b");
+    run_route_and_read(&bad_name, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    HttpRequest list = make_request("GET", "/api/gallery");
+    run_route_and_read(&list, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "{\"identities\":[{\"identity\":\"alice\",\"id\":1,\"entries\":2}]}");
+
+    char query_json[] = "{\"embedding\": [0.1, 0.2, 0.3, 0.4]}";
+    HttpRequest search = make_request("POST", "/api/search");
+    snprintf(search.content_type, sizeof(search.content_type), "application/json");
+    snprintf(search.query, sizeof(search.query), "k=2&min=0.9");
+    search.body = (unsigned char *)query_json;
+    search.body_length = sizeof(query_json) - 1;
+    run_route_and_read(&search, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response,
+                    "{\"matches\":[{\"identity\":\"alice\",\"id\":1,\"entries\":2,\"similarity\":");
+    assert_contains(response, "}],\"shards\":0,\"answered\":0,\"hedged\":0,\"search_us\":");
+    snprintf(search.query, sizeof(search.query), "k=0");
+    run_route_and_read(&search, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+    snprintf(search.query, sizeof(search.query), "min=2");
+    run_route_and_read(&search, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    HttpRequest search_stats = make_request("GET", "/api/search/stats");
+    run_route_and_read(&search_stats, response, sizeof(response));
+    assert_contains(response, "{\"shards\":0,\"idle_connections\":0,");
+
+    HttpRequest wrong_method = make_request("PUT", "/api/gallery/alice");
+    run_route_and_read(&wrong_method, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+    assert_contains(response, "Allow: POST, DELETE\r\n");
+
+    HttpRequest nested = make_request("DELETE", "/api/gallery/alice/extra");
+    run_route_and_read(&nested, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 404 Not Found");
+
+    HttpRequest remove_request = make_request("DELETE", "/api/gallery/alice");
+    run_route_and_read(&remove_request, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "{\"identity\":\"alice\",\"removed\":2}");
+    run_route_and_read(&remove_request, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 404 Not Found");
+
+    gallery_store_close();
+    remove("test_router_gallery/gallery.snapshot");
+    remove("test_router_gallery/gallery.log");
+    rmdir("test_router_gallery");
+}
+
+static size_t add_batch_frame(unsigned char *out, uint64_t time_ms, const char *data) {
+    size_t length = strlen(data);
+    put_u64(out, time_ms);
+    put_u32(out + 8, (uint32_t)length);
+    memcpy(out + FRAME_BATCH_HEADER_BYTES, data, length);
+    return FRAME_BATCH_HEADER_BYTES + length;
+}
+
+/* The first `prefetched` bytes arrive with the head; the handler reads the rest from the socket. */
+static void run_batch(const unsigned char *batch,
+                      size_t length,
+                      size_t prefetched,
+                      char *response,
+                      size_t cap) {
+    HttpRequest request = make_request("POST", "/api/frames/batch");
+    snprintf(request.content_type, sizeof(request.content_type), "%s", FRAME_BATCH_CONTENT_TYPE);
+    snprintf(request.stream_id, sizeof(request.stream_id), "yard");
+    request.content_length = length;
+    request.body = (unsigned char *)batch;
+    request.body_length = prefetched;
+    assert(router_streams_body(&request));
+
+    int fds[2];
+    make_socket_pair(fds);
+    write_all_or_fail(fds[1], batch + prefetched, length - prefetched);
+    shutdown(fds[1], SHUT_WR);
+    handle_request(fds[0], &request);
+    shutdown(fds[0], SHUT_WR);
+    size_t n = read_all_or_fail(fds[1], response, cap - 1);
+    response[n] = '\0';
+    close_pair(fds);
+}
+
+static void test_router_frame_batch(void) {
+    FrameStoreParams params;
+    memset(&params, 0, sizeof(params));
+    params.stream_bytes = 1 << 16;
+    params.max_frames = 64;
+    assert(frame_store_open(&params));
+    router_set_max_frame_size(16);
+
+    unsigned char batch[512];
+    size_t length = 0;
+    length += add_batch_frame(batch + length, 1000, "yard-1");
+    length += add_batch_frame(batch + length, 2000, "");
+    length += add_batch_frame(batch + length, 500, "late");
+    length += add_batch_frame(batch + length, 3000, "far-too-large-for-limit");
+    length += add_batch_frame(batch + length, 4000, "yard-4");
+    char response[4096];
+    run_batch(batch, length, 7, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "{\"frames\":5,\"stored\":2,\"latest_ms\":4000,");
+    assert_contains(response, "\"unrecorded\":0,\"acks\":[200,400,409,413,200]}");
+
+    /* Resending the batch stores nothing twice. */
+    run_batch(batch, length, length, response, sizeof(response));
+    assert_contains(response, "{\"frames\":5,\"stored\":0,\"latest_ms\":0,");
+    assert_contains(response, "\"acks\":[409,400,409,413,409]}");
+
+    /* Only the newest frame became the live frame; the rest are in the history. */
+    HttpRequest get_latest = make_request("GET", "/api/frame");
+    run_route_and_read(&get_latest, response, sizeof(response));
+    assert_contains(response, "yard-4");
+    HttpRequest get_past = make_request("GET", "/api/frame");
+    snprintf(get_past.query, sizeof(get_past.query), "at=1999&stream=yard");
+    run_route_and_read(&get_past, response, sizeof(response));
+    assert_contains(response, "X-Frame-Time: 1000\r\n");
+    assert_contains(response, "yard-1");
+    HttpRequest get_stream = make_request("GET", "/api/frame");
+    snprintf(get_stream.query, sizeof(get_stream.query), "stream=yard");
+    run_route_and_read(&get_stream, response, sizeof(response));
+    assert_contains(response, "X-Frame-Time: 4000\r\n");
+    snprintf(get_stream.query, sizeof(get_stream.query), "stream=gate");
+    run_route_and_read(&get_stream, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 204 No Content");
+
+    /* A frame claiming more bytes than the body holds. */
+    length = add_batch_frame(batch, 5000, "yard-5");
+    batch[11] = 200;
+    run_batch(batch, length, 0, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 400 Bad Request");
+
+    HttpRequest not_batch = make_request("POST", "/api/frames/batch");
+    snprintf(not_batch.content_type, sizeof(not_batch.content_type), "image/jpeg");
+    not_batch.content_length = 4;
+    run_route_and_read(&not_batch, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 415 Unsupported Media Type");
+    HttpRequest not_streamed = make_request("POST", "/api/frame");
+    assert(!router_streams_body(&not_streamed));
+
+    /* With the history closed nothing is stored, so nothing replaces the live frame. */
+    frame_store_close();
+    length = add_batch_frame(batch, 6000, "yard-6");
+    run_batch(batch, length, length, response, sizeof(response));
+    assert_contains(response, "{\"frames\":1,\"stored\":0,\"latest_ms\":0,\"seq\":0,");
+    assert_contains(response, "\"acks\":[500]}");
+    run_route_and_read(&get_latest, response, sizeof(response));
+    assert_contains(response, "yard-4");
+    router_set_max_frame_size(MAX_FRAME_SIZE);
+}
+
+/* A node that does not own a stream sends its requests to the owner. */
+static void test_router_cluster_routes(void) {
+    ListenerSpec nodes[2];
+    assert(listener_spec_parse("127.0.0.1:19001", &nodes[0]));
+    assert(listener_spec_parse("127.0.0.1:19002", &nodes[1]));
+    assert(cluster_start(nodes, 2, &nodes[0]));
+    const char *stream = cluster_owner("door") == 1 ? "door" : "yard";
+    assert(cluster_owner(stream) == 1);
+    char response[4096];
+
+    HttpRequest upload = make_request("POST", "/api/frame");
+    snprintf(upload.stream_id, sizeof(upload.stream_id), "%s", stream);
+    upload.body = (unsigned char *)"jpeg";
+    upload.body_length = 4;
+    upload.content_length = 4;
+    run_route_and_read(&upload, response, sizeof(response));
+    assert_contains(response, "HTTP/1.1 307 Temporary Redirect");
+    assert_contains(response, "Location: http://127.0.0.1:19002/api/frame\r\n");
+
+    HttpRequest live = make_request("GET", "/api/frames/live");
+    snprintf(live.query, sizeof(live.query), "stream=%s", stream);
+    run_route_and_read(&live, response, sizeof(response));
+    char location[128];
+    snprintf(location, sizeof(location),
+             "Location: http://127.0.0.1:19002/api/frames/live?stream=%s\r\n", stream);
+    assert_contains(response, location);
+
+    HttpRequest info = make_request("GET", "/api/cluster");
+    snprintf(info.query, sizeof(info.query), "stream=%s", stream);
+    run_route_and_read(&info, response, sizeof(response));
+    assert_contains(response, "{\"role\":\"origin\",\"nodes\":2,\"self\":0,\"redirects\":2,");
+    assert_contains(response, ",\"owner\":\"127.0.0.1:19002\"}");
+    cluster_stop();
+}
+
 static void test_router_not_found(void) {
     HttpRequest request = make_request("GET", "/missing");
     char response[2048];
@@ -87,6 +341,11 @@ int main(void) {
     assert(load_static_assets());
     test_router_static_route();
     test_router_frame_flow();
+    test_router_faces_route();
+    test_router_pipeline_stats_route();
+    test_router_gallery_routes();
+    test_router_frame_batch();
+    test_router_cluster_routes();
     test_router_not_found();
     free_static_assets();
     puts("test_router: OK");
@@ -0,0 +1,317 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "listener.h"
+#include "runtime_config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CONFIG_PATH "test_runtime_config.conf"
+#define SOCKET_PATH "test_runtime_config.sock"
+
+static void write_config(const char *text) {
+    FILE *file = fopen(CONFIG_PATH, "w");
+    assert(file != NULL);
+    fputs(text, file);
+    fclose(file);
+}
+
+static void test_listener_specs(void) {
+    ListenerSpec spec;
+    char name[160];
+    assert(listener_spec_parse("8080", &spec));
+    assert(spec.family == LISTENER_TCP4 && spec.port == 8080);
+    assert(strcmp(spec.address, "0.0.0.0") == 0);
+    assert(listener_spec_parse("127.0.0.1:9000", &spec));
+    listener_spec_format(&spec, name, sizeof(name));
+    assert(strcmp(name, "127.0.0.1:9000") == 0);
+    assert(listener_spec_parse("[::1]:443", &spec));
+    assert(spec.family == LISTENER_TCP6 && spec.port == 443);
+    listener_spec_format(&spec, name, sizeof(name));
+    assert(strcmp(name, "[::1]:443") == 0);
+    assert(listener_spec_parse("[]:80", &spec) && strcmp(spec.address, "::") == 0);
+    assert(listener_spec_parse("unix:/run/web_server.sock", &spec));
+    assert(spec.family == LISTENER_UNIX && strcmp(spec.address, "/run/web_server.sock") == 0);
+
+    assert(!listener_spec_parse("localhost:80", &spec));
+    assert(!listener_spec_parse("1.2.3.4:65536", &spec));
+    assert(!listener_spec_parse("[::1]80", &spec));
+    assert(!listener_spec_parse("unix:", &spec));
+    assert(!listener_spec_parse("", &spec));
+}
+
+static void test_file_then_arguments(void) {
+    write_config("# deployment\n"
+                 "listen = 127.0.0.1:9001\n"
+                 "listen = [::1]:9001   # both families\n"
+                 "max_frame_bytes = 4M\n"
+                 "tcp_nodelay = off\n"
+                 "pipeline_workers = 6\n"
+                 "image_pool_size = 12\n"
+                 "\n"
+                 "read_timeout_ms = 2500\n");
+    char *argv[] = {"web_server", "--config", CONFIG_PATH, "--pipeline-workers=3",
+                    "--backlog", "512", NULL};
+    RuntimeConfig config;
+    assert(runtime_config_load(&config, 6, argv));
+    assert(strcmp(config.config_path, CONFIG_PATH) == 0);
+    assert(config.listener_count == 2);
+    assert(config.listeners[0].family == LISTENER_TCP4 && config.listeners[0].port == 9001);
+    assert(config.listeners[1].family == LISTENER_TCP6);
+    assert(config.max_frame_bytes == 4u << 20);
+    assert(!config.socket.tcp_nodelay);
+    assert(config.pipeline_workers == 3);
+    assert(config.socket.backlog == 512);
+    assert(config.socket.read_timeout_ms == 2500);
+    assert(config.max_request_bytes == MAX_REQUEST_SIZE);
+
+    /* Listen addresses on the command line replace the file's; a bare port still works. */
+    char *port_argv[] = {"web_server", "--config=" CONFIG_PATH, "3000", "--listen",
+                         "unix:" SOCKET_PATH, NULL};
+    assert(runtime_config_load(&config, 5, port_argv));
+    assert(config.listener_count == 2);
+    assert(config.listeners[0].family == LISTENER_TCP4 && config.listeners[0].port == 3000);
+    assert(config.listeners[1].family == LISTENER_UNIX);
+    remove(CONFIG_PATH);
+}
+
+static void test_rejects_bad_input(void) {
+    RuntimeConfig config;
+    runtime_config_defaults(&config);
+    assert(config.listener_count == 1 && config.listeners[0].port == DEFAULT_PORT);
+    assert(!runtime_config_set(&config, "no_such_option", "1"));
+    assert(!runtime_config_set(&config, "backlog", "0"));
+    assert(!runtime_config_set(&config, "backlog", "-5"));
+    assert(!runtime_config_set(&config, "read_timeout_ms", "10k"));
+    assert(!runtime_config_set(&config, "max_frame_bytes", "12q"));
+    assert(!runtime_config_set(&config, "tcp_nodelay", "maybe"));
+    assert(!runtime_config_set(&config, "shm_ingest_slots", "65"));
+    assert(!runtime_config_set(&config, "ingest_listen", "camera:9090"));
+    assert(!config.ingest_listener_set);
+    assert(runtime_config_set(&config, "ingest_listen", "127.0.0.1:9090"));
+    assert(config.ingest_listener_set && config.ingest_listener.port == 9090);
+    assert(runtime_config_set(&config, "ingest_listen", ""));
+    assert(!config.ingest_listener_set);
+    assert(runtime_config_set(&config, "cluster_nodes", "127.0.0.1:8081, 127.0.0.2:8081"));
+    assert(config.cluster_node_count == 2 && config.cluster_nodes[1].port == 8081);
+    assert(!runtime_config_set(&config, "cluster_nodes", "127.0.0.1:8081,127.0.0.1:8081"));
+    assert(!runtime_config_set(&config, "cluster_nodes", "127.0.0.1:8081,,127.0.0.2:8081"));
+    assert(!runtime_config_set(&config, "cluster_nodes", "0.0.0.0:8081"));
+    assert(!runtime_config_set(&config, "cluster_self", "unix:/tmp/node.sock"));
+    assert(runtime_config_set(&config, "cluster_self", "127.0.0.2:8081"));
+    assert(config.cluster_self_set);
+    assert(runtime_config_set(&config, "cluster_nodes", ""));
+    assert(config.cluster_node_count == 0);
+    assert(runtime_config_set(&config, "gallery_shard_listen", "unix:/tmp/shard.sock"));
+    assert(config.gallery_shard_listener_set);
+    assert(runtime_config_set(&config, "gallery_shards",
+                              "127.0.0.1:9101 | 127.0.0.2:9101, unix:/tmp/shard.sock"));
+    assert(config.gallery_shard_count == 2 && config.gallery_shards[0].replica_count == 2);
+    assert(config.gallery_shards[0].replicas[1].port == 9101);
+    assert(config.gallery_shards[1].replicas[0].family == LISTENER_UNIX);
+    assert(!runtime_config_set(&config, "gallery_shards", "127.0.0.1:9101,|127.0.0.2:9101"));
+    assert(!runtime_config_set(&config, "gallery_shards", "0.0.0.0:9101"));
+    assert(!runtime_config_set(&config, "gallery_shards",
+                               "127.0.0.1:1|127.0.0.1:2|127.0.0.1:3|127.0.0.1:4|127.0.0.1:5"));
+    assert(runtime_config_set(&config, "gallery_shards", ""));
+    assert(config.gallery_shard_count == 0);
+    assert(config.gallery_shard_timeout_ms == GALLERY_SHARD_TIMEOUT_MS);
+    assert(runtime_config_set(&config, "gallery_shard_hedge_ms", "0"));
+    assert(!runtime_config_set(&config, "gallery_shard_timeout_ms", "0"));
+    assert(!config.perf_counters);
+    assert(runtime_config_set(&config, "perf_counters", "on") && config.perf_counters);
+    assert(config.model_prewarm);
+    assert(runtime_config_set(&config, "model_prewarm", "off") && !config.model_prewarm);
+    assert(runtime_config_set(&config, "max_header_bytes", "32k"));
+    assert(config.max_header_bytes == 32768);
+    assert(config.socket.backlog == BACKLOG);
+
+    write_config("backlog = 64\n"
+                 "this line has no equals sign\n"
+                 "pipeline_workers = 1000\n");
+    assert(!runtime_config_load_file(&config, CONFIG_PATH));
+    remove(CONFIG_PATH);
+    assert(!runtime_config_load_file(&config, CONFIG_PATH));
+
+    char *argv[] = {"web_server", "--backlog", NULL};
+    assert(!runtime_config_load(&config, 2, argv));
+    char *port_argv[] = {"web_server", "70000", NULL};
+    assert(!runtime_config_load(&config, 2, port_argv));
+
+    /* The image pool must cover every decoding worker plus one. */
+    char *pool_argv[] = {"web_server", "--pipeline_workers=4", "--recognize_workers=4", NULL};
+    assert(!runtime_config_load(&config, 3, pool_argv));
+    char *sized_argv[] = {"web_server", "--pipeline_workers=4", "--recognize_workers=4",
+                          "--image_pool_size=9", NULL};
+    assert(runtime_config_load(&config, 4, sized_argv));
+    assert(config.image_pool_size == 9);
+}
+
+/* A reload takes the live settings and reports, but keeps, the others. */
+static void test_merge_live(void) {
+    RuntimeConfig running;
+    RuntimeConfig loaded;
+    runtime_config_defaults(&running);
+    runtime_config_defaults(&loaded);
+    char skipped[256];
+    assert(runtime_config_merge_live(&running, &loaded, skipped, sizeof(skipped)) == 0);
+    assert(skipped[0] == '\0');
+
+    assert(runtime_config_set(&loaded, "max_request_bytes", "1M"));
+    assert(runtime_config_set(&loaded, "busy_poll_us", "50"));
+    assert(runtime_config_set(&loaded, "recognize_workers", "8"));
+    assert(runtime_config_set(&loaded, "listen", "127.0.0.1:1234"));
+    assert(runtime_config_set(&loaded, "shm_ingest", "/run/web_server-ingest.sock"));
+    assert(runtime_config_set(&loaded, "ingest_listen", "0.0.0.0:9090"));
+    assert(runtime_config_set(&loaded, "ingest_credits", "32"));
+    assert(runtime_config_set(&loaded, "cluster_nodes", "127.0.0.1:8081"));
+    assert(runtime_config_set(&loaded, "cluster_self", "127.0.0.1:8081"));
+    assert(runtime_config_set(&loaded, "gallery_shards", "127.0.0.1:9101"));
+    assert(runtime_config_set(&loaded, "gallery_shard_hedge_ms", "5"));
+    assert(runtime_config_set(&loaded, "perf_counters", "on"));
+    size_t n = runtime_config_merge_live(&running, &loaded, skipped, sizeof(skipped));
+    assert(n == strlen(skipped));
+    assert(strcmp(skipped, "listen, shm_ingest, ingest_listen, cluster_nodes, cluster_self, "
+                           "gallery_shards, recognize_workers, ingest_credits") == 0);
+    assert(running.gallery_shard_count == 0 && running.gallery_shard_hedge_ms == 5);
+    assert(running.perf_counters);
+    assert(running.cluster_node_count == 0 && !running.cluster_self_set);
+    assert(running.shm_ingest_path[0] == '\0');
+    assert(!running.ingest_listener_set && running.ingest_credits == BINARY_INGEST_CREDITS);
+    assert(running.max_request_bytes == 1u << 20 && running.socket.busy_poll_us == 50);
+    assert(running.recognize_workers == RECOGNIZE_WORKERS);
+    assert(running.listener_count == 1 && running.listeners[0].port == DEFAULT_PORT);
+
+    /* Keys that do not fit are dropped whole rather than cut mid-name. */
+    char tiny[20];
+    n = runtime_config_merge_live(&running, &loaded, tiny, sizeof(tiny));
+    assert(n == strlen(tiny));
+    assert(strcmp(tiny, "listen, shm_ingest") == 0);
+}
+
+static int get_int(int fd, int level, int name) {
+    int value = -1;
+    socklen_t length = sizeof(value);
+    assert(getsockopt(fd, level, name, &value, &length) == 0);
+    return value;
+}
+
+static int connect_to(int family, const struct sockaddr *addr, socklen_t length) {
+    int fd = socket(family, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    assert(connect(fd, addr, length) == 0);
+    return fd;
+}
+
+static int accept_one(int listen_fd) {
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    assert(poll(&pfd, 1, 2000) == 1);
+    int fd = accept(listen_fd, NULL, NULL);
+    assert(fd >= 0);
+    return fd;
+}
+
+/* Options set on the listener are what accepted connections get, and a reload changes them. */
+static void test_listener_options(void) {
+    RuntimeConfig config;
+    runtime_config_defaults(&config);
+    config.socket.read_timeout_ms = 1500;
+    ListenerSpec spec;
+    assert(listener_spec_parse("127.0.0.1:0", &spec));
+    int listen_fd = listener_open(&spec, &config.socket);
+    assert(listen_fd >= 0);
+    assert(listener_matches(listen_fd, &spec));
+
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    assert(getsockname(listen_fd, (struct sockaddr *)&addr, &length) == 0);
+    assert(accept(listen_fd, NULL, NULL) < 0 && errno == EAGAIN);
+    int client = connect_to(AF_INET, (struct sockaddr *)&addr, length);
+    int accepted = accept_one(listen_fd);
+    assert(get_int(accepted, IPPROTO_TCP, TCP_NODELAY) != 0);
+    struct timeval timeout;
+    socklen_t timeout_length = sizeof(timeout);
+    assert(getsockopt(accepted, SOL_SOCKET, SO_RCVTIMEO, &timeout, &timeout_length) == 0);
+    assert(timeout.tv_sec == 1 && timeout.tv_usec == 500000);
+    close(accepted);
+    close(client);
+
+    config.socket.tcp_nodelay = false;
+    config.socket.receive_buffer = 64 * 1024;
+    assert(listener_configure(listen_fd, &spec, &config.socket));
+    client = connect_to(AF_INET, (struct sockaddr *)&addr, length);
+    accepted = accept_one(listen_fd);
+    assert(get_int(accepted, IPPROTO_TCP, TCP_NODELAY) == 0);
+    assert(get_int(accepted, SOL_SOCKET, SO_RCVBUF) >= 64 * 1024);
+    close(accepted);
+    close(client);
+
+    ListenerSpec other;
+    assert(listener_spec_parse("127.0.0.2:0", &other));
+    assert(!listener_matches(listen_fd, &other));
+    close(listen_fd);
+
+    /* IPv6 may be unavailable in a sandbox; the listener then simply fails to open. */
+    assert(listener_spec_parse("[::1]:0", &spec));
+    listen_fd = listener_open(&spec, &config.socket);
+    if (listen_fd >= 0) {
+        assert(listener_matches(listen_fd, &spec));
+        close(listen_fd);
+    }
+}
+
+static void test_unix_listener(void) {
+    RuntimeConfig config;
+    runtime_config_defaults(&config);
+    ListenerSpec spec;
+    assert(listener_spec_parse("unix:" SOCKET_PATH, &spec));
+    int listen_fd = listener_open(&spec, &config.socket);
+    assert(listen_fd >= 0);
+    assert(listener_matches(listen_fd, &spec));
+    close(listen_fd);
+
+    /* The socket file left behind is replaced, not an error. */
+    assert(access(SOCKET_PATH, F_OK) == 0);
+    listen_fd = listener_open(&spec, &config.socket);
+    assert(listen_fd >= 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", SOCKET_PATH);
+    int client = connect_to(AF_UNIX, (struct sockaddr *)&addr, sizeof(addr));
+    int accepted = accept_one(listen_fd);
+    close(accepted);
+    close(client);
+    close(listen_fd);
+    listener_remove_path(&spec);
+    assert(access(SOCKET_PATH, F_OK) != 0);
+
+    /* A regular file in the way is never removed. */
+    write_config("x");
+    assert(listener_spec_parse("unix:" CONFIG_PATH, &spec));
+    assert(listener_open(&spec, &config.socket) < 0);
+    assert(access(CONFIG_PATH, F_OK) == 0);
+    remove(CONFIG_PATH);
+}
+
+int main(void) {
+    test_listener_specs();
+    test_file_then_arguments();
+    test_rejects_bad_input();
+    test_merge_live();
+    test_listener_options();
+    test_unix_listener();
+    puts("test_runtime_config: OK");
+    return 0;
+}
@@ -0,0 +1,216 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "frame_store.h"
+#include "router.h"
+#include "server_config.h"
+#include "shm_ingest.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SOCKET_PATH "test_shm_ingest.sock"
+#define SLOTS 4
+#define SLOT_BYTES 256
+#define FRAMES 50
+
+typedef struct {
+    ShmIngestProducer producer;
+    bool connected;
+    size_t published;
+    atomic_bool done;
+} ProducerJob;
+
+/* Producers block on the server, so the server side runs here while they work. */
+static void pump_until_done(ProducerJob *job) {
+    while (!atomic_load(&job->done)) {
+        struct pollfd pfd = {shm_ingest_fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 10) > 0) {
+            shm_ingest_poll();
+        }
+    }
+    for (int i = 0; i < 20; i++) {
+        struct pollfd pfd = {shm_ingest_fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 10) > 0) {
+            shm_ingest_poll();
+        }
+    }
+}
+
+static void *publish_frames(void *arg) {
+    ProducerJob *job = (ProducerJob *)arg;
+    job->connected = shm_ingest_connect(SOCKET_PATH, "dock", &job->producer);
+    char frame[64];
+    for (int i = 0; job->connected && i < FRAMES; i++) {
+        int n = snprintf(frame, sizeof(frame), "dock-frame-%02d", i);
+        if (shm_ingest_publish(&job->producer, (const unsigned char *)frame, (size_t)n, 2000)) {
+            job->published++;
+        }
+    }
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+static void *connect_only(void *arg) {
+    ProducerJob *job = (ProducerJob *)arg;
+    job->connected = shm_ingest_connect(SOCKET_PATH, "cam", &job->producer);
+    atomic_store(&job->done, true);
+    return NULL;
+}
+
+static void open_stores(void) {
+    FrameStoreParams params = memory_params(1 << 16);
+    params.max_frames = 256;
+    assert(frame_store_open(&params));
+    assert(shm_ingest_open(SOCKET_PATH, SLOTS, SLOT_BYTES));
+}
+
+static void close_stores(void) {
+    shm_ingest_close(true);
+    assert(access(SOCKET_PATH, F_OK) != 0);
+    frame_store_close();
+}
+
+/* More frames than slots: the producer waits for freed slots and every frame arrives in order. */
+static void test_frames_reach_the_store(void) {
+    open_stores();
+    ProducerJob job;
+    memset(&job, 0, sizeof(job));
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, publish_frames, &job) == 0);
+    pump_until_done(&job);
+    pthread_join(thread, NULL);
+    assert(job.connected && job.published == FRAMES);
+
+    ShmIngestStats stats;
+    shm_ingest_stats(&stats);
+    assert(stats.connected == 1 && stats.producers == 1);
+    assert(stats.frames == FRAMES && stats.rejected == 0);
+    assert(stats.bytes == FRAMES * strlen("dock-frame-00"));
+
+    size_t length = 0;
+    const unsigned char *latest = router_latest_frame(&length);
+    assert(length == 13 && memcmp(latest, "dock-frame-49", 13) == 0);
+    char response[1024];
+    assert(serve_frame("dock", UINT64_MAX / 2, response, sizeof(response)) == 200);
+    assert_contains(response, "dock-frame-49");
+
+    char json[256];
+    assert(shm_ingest_format_stats_json(&stats, json, sizeof(json)) > 0);
+    assert_contains(json, "\"producers\":1,\"connected\":1,\"frames\":50");
+
+    /* Hanging up frees the producer slot. */
+    shm_ingest_disconnect(&job.producer);
+    memset(&job, 0, sizeof(job));
+    atomic_store(&job.done, true);
+    pump_until_done(&job);
+    shm_ingest_stats(&stats);
+    assert(stats.producers == 0 && stats.dropped_producers == 0);
+    close_stores();
+}
+
+static void test_limits(void) {
+    open_stores();
+    ProducerJob job;
+    memset(&job, 0, sizeof(job));
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, connect_only, &job) == 0);
+    pump_until_done(&job);
+    pthread_join(thread, NULL);
+    assert(job.connected);
+    ShmIngestProducer *producer = &job.producer;
+    assert(producer->slot_count == SLOTS && producer->slot_bytes == SLOT_BYTES);
+
+    /* Larger than a slot never leaves the producer. */
+    unsigned char big[SLOT_BYTES + 1];
+    memset(big, 'x', sizeof(big));
+    assert(!shm_ingest_publish(producer, big, sizeof(big), 0));
+
+    /* With the server not consuming, the ring fills and publishing times out. */
+    for (int i = 0; i < SLOTS; i++) {
+        assert(shm_ingest_publish(producer, big, 100, 0));
+    }
+    assert(!shm_ingest_publish(producer, big, 100, 20));
+
+    /* The router's frame limit still applies: these frames are counted and skipped. */
+    router_set_max_frame_size(50);
+    shm_ingest_poll();
+    ShmIngestStats stats;
+    shm_ingest_stats(&stats);
+    assert(stats.rejected == SLOTS && stats.frames == 0);
+    router_set_max_frame_size(MAX_FRAME_SIZE);
+    assert(shm_ingest_publish(producer, big, 100, 0));
+    shm_ingest_poll();
+    shm_ingest_stats(&stats);
+    assert(stats.frames == 1);
+
+    /* A producer claiming more than a ring of frames is cut off. */
+    atomic_store(&producer->ring->head, producer->head + SLOTS + 1);
+    uint64_t one = 1;
+    assert(write(producer->ready_fd, &one, sizeof(one)) == (ssize_t)sizeof(one));
+    shm_ingest_poll();
+    shm_ingest_stats(&stats);
+    assert(stats.producers == 0 && stats.dropped_producers == 1);
+
+    /* A dropped producer that keeps signalling no longer wakes the server. */
+    for (int i = 0; i < 10; i++) {
+        assert(write(producer->ready_fd, &one, sizeof(one)) == (ssize_t)sizeof(one));
+        struct pollfd pfd = {shm_ingest_fd(), POLLIN, 0};
+        assert(poll(&pfd, 1, 0) == 0);
+    }
+    shm_ingest_disconnect(producer);
+    close_stores();
+}
+
+static void test_rejects_bad_hello(void) {
+    open_stores();
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    assert(fd >= 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", SOCKET_PATH);
+    assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    ShmIngestHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = SHM_INGEST_MAGIC;
+    hello.version = SHM_INGEST_VERSION + 1;
+    assert(send(fd, &hello, sizeof(hello), 0) == (ssize_t)sizeof(hello));
+    for (int i = 0; i < 4; i++) {
+        struct pollfd pfd = {shm_ingest_fd(), POLLIN, 0};
+        if (poll(&pfd, 1, 100) > 0) {
+            shm_ingest_poll();
+        }
+    }
+    char byte;
+    assert(recv(fd, &byte, 1, 0) == 0);
+    close(fd);
+
+    ShmIngestStats stats;
+    shm_ingest_stats(&stats);
+    assert(stats.connected == 0 && stats.producers == 0 && stats.dropped_producers == 1);
+    close_stores();
+
+    assert(!shm_ingest_open(SOCKET_PATH, 0, SLOT_BYTES));
+    assert(!shm_ingest_open(SOCKET_PATH, SHM_INGEST_MAX_SLOTS + 1, SLOT_BYTES));
+    assert(!shm_ingest_open("", SLOTS, SLOT_BYTES));
+    assert(shm_ingest_fd() == -1 && shm_ingest_poll() == 0);
+}
+
+int main(void) {
+    test_frames_reach_the_store();
+    test_limits();
+    test_rejects_bad_hello();
+    puts("test_shm_ingest: OK");
+    return 0;
+}
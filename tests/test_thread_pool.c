@@ -0,0 +1,95 @@
+#include "thread_pool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void count_task(void *arg) {
+    atomic_fetch_add((atomic_int *)arg, 1);
+}
+
+static void mark_range(size_t begin, size_t end, void *arg) {
+    unsigned char *marks = (unsigned char *)arg;
+    for (size_t i = begin; i < end; i++) {
+        marks[i]++;
+    }
+}
+
+static void test_submit_runs_every_task(void) {
+    ThreadPool *pool = thread_pool_create(3, 64);
+    assert(pool != NULL);
+    assert(thread_pool_size(pool) == 3);
+
+    atomic_int counter = 0;
+    for (int i = 0; i < 50; i++) {
+        assert(thread_pool_submit(pool, count_task, &counter));
+    }
+    thread_pool_destroy(pool);
+    assert(atomic_load(&counter) == 50);
+}
+
+static void test_parallel_for_covers_range_once(void) {
+    enum { COUNT = 1003 };
+    ThreadPool *pool = thread_pool_create(4, 16);
+    assert(pool != NULL);
+
+    unsigned char *marks = (unsigned char *)calloc(COUNT, 1);
+    assert(marks != NULL);
+    for (int round = 0; round < 20; round++) {
+        memset(marks, 0, COUNT);
+        thread_pool_parallel_for(pool, COUNT, 7, mark_range, marks);
+        for (size_t i = 0; i < COUNT; i++) {
+            assert(marks[i] == 1);
+        }
+    }
+
+    free(marks);
+    thread_pool_destroy(pool);
+}
+
+static void test_parallel_for_without_pool(void) {
+    unsigned char marks[10];
+    memset(marks, 0, sizeof(marks));
+    thread_pool_parallel_for(NULL, sizeof(marks), 3, mark_range, marks);
+    for (size_t i = 0; i < sizeof(marks); i++) {
+        assert(marks[i] == 1);
+    }
+}
+
+typedef struct {
+    ThreadPool *pool;
+    unsigned char marks[256];
+} NestedJob;
+
+static void nested_range(size_t begin, size_t end, void *arg) {
+    NestedJob *job = (NestedJob *)arg;
+    for (size_t i = begin; i < end; i++) {
+        thread_pool_parallel_for(job->pool, 16, 4, mark_range, job->marks + i * 16);
+    }
+}
+
+static void test_nested_parallel_for_does_not_deadlock(void) {
+    NestedJob job;
+    memset(&job, 0, sizeof(job));
+    job.pool = thread_pool_create(2, 4);
+    assert(job.pool != NULL);
+
+    thread_pool_parallel_for(job.pool, 16, 1, nested_range, &job);
+    for (size_t i = 0; i < sizeof(job.marks); i++) {
+        assert(job.marks[i] == 1);
+    }
+    thread_pool_destroy(job.pool);
+}
+
+int main(void) {
+    test_submit_runs_every_task();
+    test_parallel_for_covers_range_once();
+    test_parallel_for_without_pool();
+    test_nested_parallel_for_does_not_deadlock();
+    puts("test_thread_pool: OK");
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "router.h"
+#include "server_config.h"
+#include "trace.h"
+
+#include "test_utils.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef WEB_SERVER_TRACING
+static size_t count_occurrences(const char *haystack, const char *needle) {
+    size_t count = 0;
+    for (const char *at = strstr(haystack, needle); at != NULL; at = strstr(at + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+static void *record_on_worker(void *arg) {
+    (void)arg;
+    trace_set_thread_name("worker");
+    trace_set_request(77);
+    TRACE_START(start);
+    TRACE_END("worker_span", start);
+    return NULL;
+}
+
+static void test_spans_export_as_chrome_json(void) {
+    trace_set_thread_name("test-main");
+    uint64_t id = trace_request_begin();
+    assert(id != 0 && trace_current_request() == id);
+    TRACE_START(start);
+    struct timespec pause = {0, 2 * 1000000L};
+    nanosleep(&pause, NULL);
+    TRACE_END("read", start);
+    TRACE_SPAN("clamped", start + 1000, start, id);
+
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, record_on_worker, NULL) == 0);
+    pthread_join(thread, NULL);
+
+    size_t capacity = trace_json_capacity();
+    char *json = (char *)malloc(capacity);
+    assert(json != NULL);
+    size_t length = trace_format_json(json, capacity);
+    assert(length == strlen(json));
+    assert(strncmp(json, "{\"traceEvents\":[", 16) == 0);
+    assert(strcmp(json + length - 2, "]}") == 0);
+    assert_contains(json, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":");
+    assert_contains(json, "\"args\":{\"name\":\"test-main\"}");
+    assert_contains(json, "\"args\":{\"name\":\"worker\"}");
+
+    /* Ticks come back as microseconds: the 2 ms sleep shows up as such. */
+    const char *read = strstr(json, "{\"name\":\"read\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":");
+    assert(read != NULL);
+    double dur_us = atof(strstr(read, "\"dur\":") + 6);
+    assert(dur_us >= 1900.0 && dur_us < 500000.0);
+    char expected[64];
+    snprintf(expected, sizeof(expected), "\"args\":{\"request\":%llu}}", (unsigned long long)id);
+    assert_contains(read, expected);
+    const char *clamped = strstr(json, "{\"name\":\"clamped\"");
+    assert(clamped != NULL);
+    assert(strncmp(strstr(clamped, "\"dur\":"), "\"dur\":0.000,", 12) == 0);
+    assert_contains(json, "\"name\":\"worker_span\"");
+    assert_contains(json, "\"args\":{\"request\":77}");
+
+    /* Too small a buffer drops spans but still closes the JSON. */
+    length = trace_format_json(json, 200);
+    assert(length > 0 && length < 200 && strcmp(json + length - 2, "]}") == 0);
+    assert(trace_format_json(json, 8) == 0);
+    free(json);
+}
+
+static void test_ring_keeps_latest_spans(void) {
+    for (int i = 0; i < TRACE_RING_SPANS + 100; i++) {
+        TRACE_SPAN(i < 100 ? "old" : "new", trace_clock(), trace_clock(), 0);
+    }
+    size_t capacity = trace_json_capacity();
+    char *json = (char *)malloc(capacity);
+    assert(json != NULL);
+    trace_format_json(json, capacity);
+    assert(strstr(json, "\"name\":\"old\"") == NULL);
+    assert(count_occurrences(json, "\"name\":\"new\"") == TRACE_RING_SPANS);
+    free(json);
+}
+
+static void test_exited_threads_hand_over_rings(void) {
+    TraceStats before;
+    trace_stats(&before);
+    for (int i = 0; i < TRACE_MAX_THREADS + 8; i++) {
+        pthread_t thread;
+        assert(pthread_create(&thread, NULL, record_on_worker, NULL) == 0);
+        pthread_join(thread, NULL);
+    }
+    TraceStats stats;
+    trace_stats(&stats);
+    assert(stats.threads == before.threads);
+    assert(stats.dropped == 0);
+    assert(stats.recorded == before.recorded + TRACE_MAX_THREADS + 8);
+}
+#endif
+
+static void test_trace_route(void) {
+    size_t capacity = 8 * 1024 * 1024;
+    char *response = (char *)malloc(capacity);
+    assert(response != NULL);
+    route_request("GET", "/debug/trace", response, capacity);
+#ifdef WEB_SERVER_TRACING
+    assert_contains(response, "HTTP/1.1 200 OK");
+    assert_contains(response, "Content-Type: application/json");
+    assert_contains(response, "{\"traceEvents\":[");
+#else
+    assert_contains(response, "HTTP/1.1 404 Not Found");
+#endif
+    route_request("POST", "/debug/trace", response, capacity);
+    assert_contains(response, "HTTP/1.1 405 Method Not Allowed");
+    free(response);
+}
+
+int main(void) {
+#ifdef WEB_SERVER_TRACING
+    test_spans_export_as_chrome_json();
+    test_ring_keeps_latest_spans();
+    test_exited_threads_hand_over_rings();
+    test_trace_route();
+    puts("test_trace: OK");
+#else
+    assert(trace_json_capacity() == 0);
+    test_trace_route();
+    puts("test_trace: OK (tracing compiled out)");
+#endif
+    return 0;
+}
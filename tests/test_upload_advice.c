@@ -0,0 +1,103 @@
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include "upload_advice.h"
+
+#include "server_config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static const UploadLoad idle_load = {0.1, 0.0, 0, 2};
+static const UploadLoad busy_load = {0.95, 0.75, 0, 2};
+
+static UploadAdvice advise(const char *stream, const UploadLoad *load, uint64_t now_ms) {
+    UploadAdvice advice;
+    upload_advice_compute(stream, load, now_ms, &advice);
+    return advice;
+}
+
+static void test_idle_stream_gets_best(void) {
+    upload_advice_reset();
+    UploadAdvice advice = advise("door", &idle_load, 1000);
+    assert(advice.interval_ms == UPLOAD_MIN_INTERVAL_MS);
+    assert(advice.max_width == 640 && advice.quality == 70);
+
+    char json[96];
+    assert(upload_advice_format_json(&advice, json, sizeof(json)) > 0);
+    assert(strcmp(json, "{\"interval_ms\":66,\"max_width\":640,\"quality\":70}") == 0);
+    assert(upload_advice_format_json(&advice, json, 8) == 0);
+}
+
+/* Overload costs resolution and quality first, then frame rate; recovery undoes it in reverse. */
+static void test_backoff_and_recovery(void) {
+    upload_advice_reset();
+    uint64_t now = 1000;
+    advise("door", &busy_load, now);
+
+    /* Within one window nothing moves, however many frames arrive. */
+    UploadAdvice advice = advise("door", &busy_load, now + 10);
+    assert(advice.max_width == 640 && advice.interval_ms == UPLOAD_MIN_INTERVAL_MS);
+
+    now += UPLOAD_ADVICE_WINDOW_MS;
+    advice = advise("door", &busy_load, now);
+    assert(advice.max_width == 480 && advice.quality == 60);
+    now += UPLOAD_ADVICE_WINDOW_MS;
+    advice = advise("door", &busy_load, now);
+    assert(advice.max_width == DETECTOR_INPUT_WIDTH && advice.quality == 50);
+    assert(advice.interval_ms == UPLOAD_MIN_INTERVAL_MS);
+    now += UPLOAD_ADVICE_WINDOW_MS;
+    advice = advise("door", &busy_load, now);
+    assert(advice.max_width == DETECTOR_INPUT_WIDTH && advice.interval_ms == 99);
+    for (int i = 0; i < 20; i++) {
+        now += UPLOAD_ADVICE_WINDOW_MS;
+        advice = advise("door", &busy_load, now);
+    }
+    assert(advice.interval_ms == UPLOAD_MAX_INTERVAL_MS);
+
+    /* A stream that has not been pushed back starts at the top. */
+    advice = advise("yard", &busy_load, now);
+    assert(advice.max_width == 640 && advice.interval_ms == UPLOAD_MIN_INTERVAL_MS);
+
+    unsigned previous = UPLOAD_MAX_INTERVAL_MS;
+    while (advice.interval_ms > UPLOAD_MIN_INTERVAL_MS || advice.max_width != 640) {
+        now += UPLOAD_ADVICE_WINDOW_MS;
+        advice = advise("door", &idle_load, now);
+        assert(advice.interval_ms <= previous);
+        if (advice.interval_ms > UPLOAD_MIN_INTERVAL_MS) {
+            assert(advice.max_width == DETECTOR_INPUT_WIDTH);
+        }
+        previous = advice.interval_ms;
+    }
+    assert(advice.quality == 70);
+}
+
+/* The interval never drops below the stream's share of the pipeline. */
+static void test_fair_share_floor(void) {
+    upload_advice_reset();
+    UploadLoad load = {0.5, 0.0, 40000, 2};
+    UploadAdvice advice = advise("a", &load, 1000);
+    assert(advice.interval_ms == UPLOAD_MIN_INTERVAL_MS);
+    char name[16];
+    for (int i = 0; i < 7; i++) {
+        snprintf(name, sizeof(name), "cam-%d", i);
+        advise(name, &load, 1000);
+    }
+    /* Eight streams at 40 ms a frame on two workers at 80% busy: 200 ms each. */
+    advice = advise("a", &load, 1001);
+    assert(advice.interval_ms == 200);
+
+    /* Streams that stop uploading no longer count. */
+    advice = advise("a", &load, 1000 + UPLOAD_ADVICE_IDLE_MS + 1);
+    assert(advice.interval_ms >= UPLOAD_MIN_INTERVAL_MS && advice.interval_ms < 200);
+}
+
+int main(void) {
+    test_idle_stream_gets_best();
+    test_backoff_and_recovery();
+    test_fair_share_floor();
+    puts("test_upload_advice: OK");
+    return 0;
+}
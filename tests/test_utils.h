@@ -1,14 +1,39 @@
 #ifndef TEST_UTILS_H
 #define TEST_UTILS_H
 
+#include "frame_store.h"
+#include "router.h"
+
 #include <assert.h>
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+/* Big-endian fields, as the binary wire formats carry them. */
+static inline uint32_t get_u32(const unsigned char *in) {
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static inline uint64_t get_u64(const unsigned char *in) {
+    return ((uint64_t)get_u32(in) << 32) | get_u32(in + 4);
+}
+
+static inline void put_u32(unsigned char *out, uint32_t value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static inline void put_u64(unsigned char *out, uint64_t value) {
+    put_u32(out, (uint32_t)(value >> 32));
+    put_u32(out + 4, (uint32_t)value);
+}
+
 static inline void make_socket_pair(int fds[2]) {
     int rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
     assert(rc == 0);
@@ -52,4 +77,57 @@ static inline void close_pair(int fds[2]) {
     close(fds[1]);
 }
 
+static inline HttpRequest make_request(const char *method, const char *path) {
+    HttpRequest request;
+    memset(&request, 0, sizeof(request));
+    snprintf(request.method, sizeof(request.method), "%s", method);
+    snprintf(request.path, sizeof(request.path), "%s", path);
+    return request;
+}
+
+/*
+ * Routes the request and reads until every descriptor for the socket is
+ * closed, so an answer written later by a worker holding a dup() arrives too.
+ */
+static inline size_t run_route_and_read(const HttpRequest *request, char *response, size_t cap) {
+    int fds[2];
+    make_socket_pair(fds);
+    handle_request(fds[0], request);
+    close(fds[0]);
+    size_t n = read_all_or_fail(fds[1], response, cap - 1);
+    response[n] = '\0';
+    close(fds[1]);
+    return n;
+}
+
+static inline size_t route_request(const char *method,
+                                   const char *path,
+                                   char *response,
+                                   size_t capacity) {
+    HttpRequest request = make_request(method, path);
+    return run_route_and_read(&request, response, capacity);
+}
+
+/* A frame store that only keeps frames in memory, `stream_bytes` per stream. */
+static inline FrameStoreParams memory_params(size_t stream_bytes) {
+    FrameStoreParams params;
+    memset(&params, 0, sizeof(params));
+    params.stream_bytes = stream_bytes;
+    params.max_frames = 8;
+    return params;
+}
+
+/* Serves `at_ms` into a socket pair; returns the status and fills `response`. */
+static inline int serve_frame(const char *stream, uint64_t at_ms, char *response,
+                              size_t capacity) {
+    int fds[2];
+    make_socket_pair(fds);
+    int status = frame_store_serve(fds[0], stream, at_ms);
+    close(fds[0]);
+    size_t n = read_all_or_fail(fds[1], response, capacity - 1);
+    response[n] = '\0';
+    close(fds[1]);
+    return status;
+}
+
 #endif
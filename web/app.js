@@ -9,12 +9,41 @@ let uploadBusy = false;
 let downloadBusy = false;
 let lastObjectUrl = '';
 const MAX_UPLOAD_WIDTH = 640;
-const JPEG_QUALITY = 0.6;
-const UPLOAD_INTERVAL_MS = 100;
 const DOWNLOAD_INTERVAL_MS = 100;
+// Starting values; every upload response carries the server's advice for the next ones.
+let uploadIntervalMs = 100;
+let uploadWidth = MAX_UPLOAD_WIDTH;
+let jpegQuality = 0.6;
+const STREAM_ID = `tab-${Math.random().toString(36).slice(2, 10)}`;
+// Rounded up to a step so viewers of similar size share one server-side variant.
+const VARIANT_WIDTH_STEP = 80;
+
+function frameUrl() {
+  const displayWidth = Math.round(remoteImage.clientWidth * (window.devicePixelRatio || 1));
+  if (displayWidth <= 0 || displayWidth >= MAX_UPLOAD_WIDTH) {
+    return '/api/frame';
+  }
+  const width = Math.ceil(displayWidth / VARIANT_WIDTH_STEP) * VARIANT_WIDTH_STEP;
+  return `/api/frame?w=${width}`;
+}
 
 function toJpegBlob() {
-  return new Promise((resolve) => canvas.toBlob(resolve, 'image/jpeg', JPEG_QUALITY));
+  return new Promise((resolve) => canvas.toBlob(resolve, 'image/jpeg', jpegQuality));
+}
+
+function applyUploadAdvice(advice) {
+  if (!advice) {
+    return;
+  }
+  if (Number.isFinite(advice.interval_ms) && advice.interval_ms > 0) {
+    uploadIntervalMs = advice.interval_ms;
+  }
+  if (Number.isFinite(advice.max_width) && advice.max_width > 0) {
+    uploadWidth = Math.min(MAX_UPLOAD_WIDTH, advice.max_width);
+  }
+  if (Number.isFinite(advice.quality) && advice.quality > 0) {
+    jpegQuality = Math.min(100, advice.quality) / 100;
+  }
 }
 
 function getUserMediaCompat(constraints) {
@@ -47,7 +76,7 @@ async function uploadFrame() {
 
   uploadBusy = true;
   try {
-    const scale = Math.min(1, MAX_UPLOAD_WIDTH / localVideo.videoWidth);
+    const scale = Math.min(1, uploadWidth / localVideo.videoWidth);
     canvas.width = Math.max(1, Math.round(localVideo.videoWidth * scale));
     canvas.height = Math.max(1, Math.round(localVideo.videoHeight * scale));
     ctx.drawImage(localVideo, 0, 0, canvas.width, canvas.height);
@@ -57,12 +86,16 @@ async function uploadFrame() {
       return;
     }
 
-    await fetch('/api/frame', {
+    const response = await fetch('/api/frame', {
       method: 'POST',
-      headers: { 'Content-Type': 'image/jpeg' },
+      headers: { 'Content-Type': 'image/jpeg', 'X-Stream-Id': STREAM_ID },
       body: blob,
       cache: 'no-store',
     });
+    if (response.ok) {
+      const result = await response.json();
+      applyUploadAdvice(result.advice);
+    }
   } catch (error) {
     statusEl.textContent = 'Upload error';
   } finally {
@@ -70,6 +103,14 @@ async function uploadFrame() {
   }
 }
 
+// The next upload is due one advised interval after this one started.
+async function uploadLoop() {
+  const started = performance.now();
+  await uploadFrame();
+  const elapsed = performance.now() - started;
+  setTimeout(uploadLoop, Math.max(0, uploadIntervalMs - elapsed));
+}
+
 async function downloadFrame() {
   if (downloadBusy) {
     return;
@@ -77,7 +118,7 @@ async function downloadFrame() {
 
   downloadBusy = true;
   try {
-    const response = await fetch('/api/frame', { cache: 'no-store' });
+    const response = await fetch(frameUrl(), { cache: 'no-store' });
     if (response.status !== 200) {
       return;
     }
@@ -104,7 +145,7 @@ async function start() {
     await localVideo.play();
 
     statusEl.textContent = 'Streaming through server';
-    setInterval(uploadFrame, UPLOAD_INTERVAL_MS);
+    uploadLoop();
     setInterval(downloadFrame, DOWNLOAD_INTERVAL_MS);
   } catch (error) {
     statusEl.textContent = `Camera error: ${error?.message || error}`;